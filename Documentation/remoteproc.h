@@ -24,12 +24,69 @@ duplicated.
      function immediately succeeds.
      On success, returns the rproc handle. On failure, NULL is returned.
 
+     Note: the firmware is loaded asynchronously, so rproc_get() doesn't
+     wait for the remote processor to boot, and several remote processors
+     can boot at the same time.
+
+  int rproc_wait_for_boot(struct rproc *rproc);
+   - wait until the (asynchronous) boot of the remote processor is over.
+     Returns 0 if it's up, or -EIO if its boot failed. Might sleep.
+     The generic rpmsg host waits this way (in a work item, so its init
+     isn't blocked) before it sets up the rpmsg bus of a remote processor
+     whose IPC layout is taken from its firmware.
+
+  int rproc_event_register(struct rproc *rproc, struct notifier_block *nb);
+  int rproc_event_unregister(struct rproc *rproc, struct notifier_block *nb);
+   - for users that can't wait: 'nb' is called (in process context) with
+     RPROC_BOOTED whenever the remote processor is booted, or with
+     RPROC_BOOT_FAILED if its boot failed.
+
   void rproc_put(struct rproc *rproc);
    - power off the remote processor, identified by the rproc handle.
      Every call to rproc_get() must be (eventually) accompanied by a call
      to rproc_put(). Calling rproc_put() redundantly is a bug.
      Note: the remote processor will actually be powered off only when the
      last user calls rproc_put().
+     The image it was booted with is kept in memory (unless remoteproc's
+     fw_cache parameter is off), so powering it on again doesn't have to
+     read the image from the filesystem again.
+
+  int rproc_suspend(struct rproc *rproc);
+   - put a running remote processor in a low power state (e.g. once it's
+     been idle for a while), from which it can quickly be woken up.
+     Returns 0 on success, -ENOSYS if the platform can't suspend it, or
+     -EINVAL if it isn't running.
+
+  int rproc_resume(struct rproc *rproc);
+   - wake up a suspended remote processor. Returns 0 on success (or if it
+     isn't suspended). The rpmsg bus does this by itself whenever there
+     are messages to send, so rpmsg drivers don't need to bother.
+
+  void rproc_report_crash(struct rproc *rproc);
+   - declare that a running remote processor crashed (e.g. when it says so).
+     Might sleep.
+
+  int rproc_restart(struct rproc *rproc);
+   - power off a remote processor that was reported to have crashed, and
+     boot it again with a fresh copy of its firmware. Its users keep their
+     rproc handles. Nothing is done if it isn't marked as crashed (anymore),
+     so when all the users of a remote processor recover from the same
+     crash, it's rebooted only once. Returns 0 on success.
+     The rpmsg bus recovers this way by itself, keeping its channels, once
+     the platform's rpmsg backend reports the crash.
+
+  const struct rproc_mem_entry *rproc_get_memory_maps(const char *name);
+   - return the memory maps the 'name' remote processor was registered
+     with (or NULL if none), without booting it. Lets users translate
+     addresses before the remote processor is booted, e.g. when it's only
+     booted on its first use.
+
+  void *rproc_pa_to_va(struct rproc *rproc, phys_addr_t pa, u32 len);
+   - return the kernel address of a region of the remote processor's memory
+     maps (e.g. of its IPC carveout), or NULL if it's not in one. Each
+     region is mapped write-combined once, and stays mapped until the
+     remote processor is unregistered (so don't iounmap it). The firmware
+     sections and trace buffers are accessed through the same mappings.
 
 3. Typical usage
 
@@ -96,6 +153,16 @@ On success, 0 is returned, and on failure, an appropriate error code.
 The ->stop() handler takes a rproc handle and powers the device off.
 On success, 0 is returned, and on failure, an appropriate error code.
 
+Implementations that support low power states may also provide these
+(optional) handlers:
+
+	int (*suspend)(struct rproc *rproc);
+	int (*resume)(struct rproc *rproc);
+
+The ->suspend() handler should put the device in a low power state, from
+which the ->resume() handler can quickly bring it back up. Both return 0
+on success, and an appropriate error code on failure.
+
 6. Binary Firmware Structure
 
 The following enums and structures define the binary format of the images
@@ -146,9 +213,26 @@ The way a resource is really handled strongly depends on its type.
 Some resources are just one-way announcements, e.g., a RSC_TRACE type means
 that the remote processor will be writing log messages into a trace buffer
 which is located at the address specified in 'da'. In that case, 'len' is
-the size of that buffer. A RSC_BOOTADDR resource type announces the boot
-address (i.e. the first instruction the remote processor should be booted with)
-in 'da'.
+the size of that buffer. The trace is exposed in debugfs (trace0/trace1);
+each reader only reads what was added since its last read, and can poll()
+for more, so the trace can be followed cheaply.
+A RSC_BOOTADDR resource type announces the boot address (i.e. the first
+instruction the remote processor should be booted with) in 'da'.
+A RSC_IPC resource type announces the layout of an IPC (rpmsg) link the
+firmware was built with: 'name' identifies the link, 'len' is the number of
+IPC buffers and 'flags' is the size of each buffer. A RSC_VRING resource
+type, named after the same link, announces its vrings: 'len' is the number
+of entries of each vring, and 'flags' is their alignment (0 for the host's
+default of 4096). The vrings need at least an entry per buffer of their
+side; if there's only a RSC_VRING entry, the link gets a buffer per entry.
+The IPC transport can query the layout with:
+
+  int rproc_get_ipc_cfg(struct rproc *rproc, const char *name,
+					struct rproc_ipc_cfg *cfg);
+  - returns the layout of the 'name' link, after waiting for the firmware
+    of 'rproc' (which must have been acquired with rproc_get()) to load.
+    Whatever the firmware didn't announce is 0 in 'cfg'.
+    Returns -ENOENT if the firmware didn't announce such a link.
 
 Other resources entries might be a two-way request/respond negotiation where
 a certain resource (memory or any other hardware resource) is requested
@@ -168,3 +252,46 @@ yet. It's left to see how this all works out.
 Most likely this kind of static allocations of hardware resources for
 remote processors can also use DT, so it's interesting to see how
 this all work out when DT materializes.
+
+7. ELF images
+
+Instead of an RPRC image, remoteproc can boot a 32-bit ELF executable as is,
+so the toolchain's output doesn't have to be converted (or stripped) first.
+
+Only the PT_LOAD segments of the image are loaded, each at its physical
+address ('p_paddr', which is a device address in the above sense). Their
+first 'p_filesz' bytes are copied from the image, and the rest of the
+segment (up to 'p_memsz', e.g. its bss) is zeroed in place. Debug info,
+symbols and any other part of the image that isn't loadable is skipped, so
+debug builds load just as fast as stripped ones.
+
+The resource table, if there is one, is the content of the section that
+is named ".resource_table", and has the very same format as the resource
+section above. The remote processor is booted at the image's entry point,
+unless a RSC_BOOTADDR resource says otherwise.
+
+8. Boot profiling
+
+The debugfs directory of every remote processor (next to its 'name' and
+'state' files) has a 'boot_stats' file, which breaks down where the time
+of its last boot went:
+
+  firmware: ducati-m3.bin (cached)
+  status: 0
+  request: 312 us
+  validate: 41 us
+  copy: 10488 us (dma wait 0 us), 3145728 bytes
+  resources: 17 us
+  start: 1290 us
+  total: 12151 us
+  section 0: pa 0x9d000000, 1048576/1048576 bytes, 3420 us
+  ...
+
+'request' is the latency of getting the image (from the filesystem, or the
+cached copy of the previous boot), 'validate' is the time spent parsing
+the image headers, 'copy' is the time spent loading its sections (waiting
+for the DMA copies to complete included, if they're done by a DMA engine),
+'resources' is the time spent handling its resource table, and 'start' is
+the time the ->start() handler took. 'status' is 1 while the boot is in
+progress, and its result once it's over. The first 16 sections (or ELF
+segments) are listed individually.
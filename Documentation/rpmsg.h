@@ -29,6 +29,12 @@ Rpmsg is a virtio-based messaging bus that allows kernel drivers to communicate
 with remote processors available on the system. In turn, drivers could then
 expose appropriate user space interfaces, if needed.
 
+Remote services that don't need a dedicated kernel driver may announce an
+"rpmsg-char" channel instead: the generic rpmsg-char driver exposes every
+such channel as a /dev/rpmsg-charN device, every open() of which creates a
+new endpoint, and messages are then exchanged using read(), write() and
+poll() (see include/linux/rpmsg_char.h).
+
 When writing a driver that exposes rpmsg communication to userland, please
 keep in mind that remote processors might have direct access to the
 system's physical memory and/or other sensitive hardware resources (e.g. on
@@ -65,8 +71,8 @@ the driver's rx handler with the payload of the incoming message).
      In case there are no TX buffers available, the function will block until
      one becomes available (i.e. until the remote processor will consume
      a tx buffer and put it back on virtio's used descriptor ring),
-     or a timeout of 15 seconds elapses. When the latter happens,
-     -ERESTARTSYS is returned.
+     or the channel's tx timeout (15 seconds by default) elapses. When the
+     latter happens, -ERESTARTSYS is returned.
      The function can only be called from a process context (for now).
      Returns 0 on success and an appropriate error value on failure.
 
@@ -82,8 +88,8 @@ the driver's rx handler with the payload of the incoming message).
      In case there are no TX buffers available, the function will block until
      one becomes available (i.e. until the remote processor will consume
      a tx buffer and put it back on virtio's used descriptor ring),
-     or a timeout of 15 seconds elapses. When the latter happens,
-     -ERESTARTSYS is returned.
+     or the channel's tx timeout (15 seconds by default) elapses. When the
+     latter happens, -ERESTARTSYS is returned.
      The function can only be called from a process context (for now).
      Returns 0 on success and an appropriate error value on failure.
 
@@ -100,8 +106,8 @@ the driver's rx handler with the payload of the incoming message).
      In case there are no TX buffers available, the function will block until
      one becomes available (i.e. until the remote processor will consume
      a tx buffer and put it back on virtio's used descriptor ring),
-     or a timeout of 15 seconds elapses. When the latter happens,
-     -ERESTARTSYS is returned.
+     or the channel's tx timeout (15 seconds by default) elapses. When the
+     latter happens, -ERESTARTSYS is returned.
      The function can only be called from a process context (for now).
      Returns 0 on success and an appropriate error value on failure.
 
@@ -146,6 +152,147 @@ the driver's rx handler with the payload of the incoming message).
      The function can only be called from a process context (for now).
      Returns 0 on success and an appropriate error value on failure.
 
+  int rpmsg_sendv(struct rpmsg_channel *rpdev, const struct kvec *vec,
+								size_t nvec);
+  int rpmsg_sendtov(struct rpmsg_channel *rpdev, const struct kvec *vec,
+							size_t nvec, u32 dst);
+   - identical to rpmsg_send() and rpmsg_sendto() respectively, except that
+     the payload is gathered from the nvec buffers described by vec, in order,
+     directly into the TX buffer. This way drivers that build their messages
+     out of several pieces need not flatten them into a single buffer first.
+     Explicit source and destination addresses, as well as a non-blocking
+     mode, are available using rpmsg_sendv_offchannel_raw().
+
+  int rpmsg_send_timeout(struct rpmsg_channel *rpdev, void *data, int len,
+								long timeout);
+   - identical to rpmsg_send(), except that the caller specifies how long
+     (in jiffies) it is willing to wait for a TX buffer in this call, instead
+     of using the channel's tx timeout. A timeout of 0 means don't wait at
+     all, and MAX_SCHEDULE_TIMEOUT means wait indefinitely.
+     rpmsg_send_offchannel_timeout() is the explicit src/dst flavor of it.
+
+     The default tx timeout of a channel is 15 seconds, and drivers may
+     change it by setting the tx_timeout member of their rpmsg_channel.
+     Latency-sensitive drivers may also set its tx_spin_us member, in order
+     to have their senders busy-poll for a TX buffer for up to that many
+     microseconds before sleeping (or failing, for non-blocking sends).
+
+  int rpmsg_send_urgent(struct rpmsg_channel *rpdev, void *data, int len);
+   - identical to rpmsg_send(), but for the few control messages that must
+     not wait behind the bulk traffic of the channel (e.g. "stop decoding"
+     on a channel that also carries the bitstream): the message gets a TX
+     buffer out of a small reserve that bulk senders can't exhaust, and,
+     if the remote processor supports a high priority virtqueue pair, it
+     is sent (and kicked right away) on it, so it's handled ahead of the
+     bulk messages already queued. It might thus overtake them.
+     rpmsg_send_urgent_offchannel() is the explicit src/dst flavor of it,
+     which also takes a 'wait' argument.
+
+  void rpmsg_init_tx_waiter(struct rpmsg_tx_waiter *w,
+		void (*cb)(struct rpmsg_channel *, void *), void *priv);
+  int rpmsg_tx_notify(struct rpmsg_channel *rpdev, struct rpmsg_tx_waiter *w);
+  void rpmsg_tx_notify_cancel(struct rpmsg_channel *rpdev,
+						struct rpmsg_tx_waiter *w);
+   - lets senders that can't block (e.g. after rpmsg_trysend() failed with
+     -ENOMEM) ask to have their callback invoked once TX space may have
+     become available again, instead of polling or sleeping. The callback
+     is invoked once per registration, possibly from an interrupt context,
+     so it must not sleep; it would normally just retry sending.
+
+  void *rpmsg_alloc_tx_buf(struct rpmsg_channel *rpdev, int len, bool wait);
+   - reserves a TX buffer that can hold a payload of len bytes, and returns
+     a pointer to its payload area, so the caller can build its message
+     directly in the memory that is shared with the remote processor
+     (instead of building it privately and having rpmsg_send() copy it).
+     If wait is true, the function blocks (up to the channel's tx timeout)
+     until a TX buffer becomes available, similarly to rpmsg_send().
+     Returns the payload pointer on success, or an ERR_PTR() value on failure.
+
+  int rpmsg_send_prepared(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+							void *buf, int len);
+   - sends a message that was built in a buffer obtained with
+     rpmsg_alloc_tx_buf(), using the src and dst addresses provided
+     by the user. len may be smaller than the length that was reserved,
+     in which case the unused space is given back.
+     Ownership of the buffer is passed to rpmsg, even on failure.
+     Returns 0 on success and an appropriate error value on failure.
+
+  void rpmsg_free_tx_buf(struct rpmsg_channel *rpdev, void *buf);
+   - gives back a buffer obtained with rpmsg_alloc_tx_buf(), without
+     sending it.
+
+  int rpmsg_send_batch(struct rpmsg_channel *rpdev, const struct kvec *msgs,
+								int num);
+   - sends num messages (one per kvec entry) on the channel, in order,
+     using the channel's src and dst addresses, and then kicks the remote
+     processor only once for all of them (instead of once per message).
+     Blocks like rpmsg_send() does. Returns the number of messages sent,
+     or an appropriate error value if the first message couldn't be sent.
+
+  void rpmsg_cork(struct rpmsg_channel *rpdev);
+  void rpmsg_uncork(struct rpmsg_channel *rpdev);
+   - while a channel is corked, its messages are queued to the remote
+     processor without kicking it; the kick is deferred until the channel
+     is uncorked. This way a burst of messages, sent using any of the
+     above sending functions, costs the remote processor a single interrupt.
+     Calls nest, and every rpmsg_cork() must be balanced by rpmsg_uncork().
+
+  struct rpmsg_rx_buf *rpmsg_hold_rx_buf(struct rpmsg_endpoint *ept,
+							void *data);
+   - normally an rx callback must consume its message synchronously,
+     because the buffer is given back to the remote processor as soon as
+     the callback returns. Endpoints that set RPMSG_EPT_HOLD_RX in their
+     flags may call this function from within their rx callback in order
+     to keep the buffer (and avoid copying the message).
+     The number of rx buffers that can be held is limited (per endpoint and
+     in total), so a slow endpoint can't starve the others; when the limit
+     is reached, NULL is returned and the message should be copied instead.
+     Returns an rx buffer handle, which describes the message and can be
+     queued by the holder using its node member.
+
+  void rpmsg_release_rx_buf(struct rpmsg_rx_buf *rxb);
+   - gives a held rx buffer back to the remote processor. Must not be
+     called from an rx callback.
+
+  int rpmsg_set_rx_quota(struct rpmsg_endpoint *ept, int quota);
+   - sets the max number of rx buffers @ept may hold (0 restores the
+     default, which is a quarter of the rx buffers). Bulk endpoints may
+     lower it to leave room for the control traffic of other endpoints.
+     Returns 0 on success, or -EINVAL if @quota exceeds the total limit.
+
+     Independently of the quotas, inbound messages are dispatched
+     round-robin across their endpoints: when several messages are pending,
+     the oldest message of every endpoint is handled first, so a burst of
+     bulk traffic to one endpoint doesn't delay the messages of the others.
+
+  int rpmsg_set_rx_credits(struct rpmsg_endpoint *ept, int credits);
+   - limits the remote processor to @credits messages in flight to @ept
+     (0 disables flow control), so a bulk sender is throttled according
+     to the pace of its own endpoint, instead of consuming the rx buffers
+     that latency sensitive channels need. Credits are given back as @ept
+     consumes messages. Requires VIRTIO_RPMSG_F_CREDITS, and might sleep.
+     Returns 0 on success, or -EOPNOTSUPP if flow control isn't supported.
+
+  int rpmsg_set_batch_cb(struct rpmsg_endpoint *ept,
+		void (*batch_cb)(struct rpmsg_channel *, struct rpmsg_rx_msg *,
+								int, void *));
+   - has the inbound messages of @ept delivered in batches: all the
+     messages @ept receives in a single rx run are passed, in order and as
+     an array of struct rpmsg_rx_msg, to one invocation of @batch_cb
+     (up to 32 messages per invocation), instead of one rx callback
+     invocation per message. High-rate drivers may then take their locks
+     and wake up their readers once per batch. NULL restores the regular
+     rx callback. Might sleep, and must not be called from a callback.
+     Returns 0 on success, or -ENOMEM.
+
+  int rpmsg_pa_to_da(struct rpmsg_channel *rpdev, phys_addr_t pa,
+							size_t len, u32 *da);
+   - translates the physical address of a buffer that is shared with the
+     remote processor out of band (e.g. a video frame) to the address the
+     remote processor sees it at, using the memory maps of its IOMMU.
+     Returns 0 on success, or -EINVAL if the whole buffer isn't mapped by
+     the remote processor.
+
   struct rpmsg_endpoint *rpmsg_create_ept(struct rpmsg_channel *rpdev,
 		void (*cb)(struct rpmsg_channel *, void *, int, void *, u32),
 		void *priv, u32 addr);
@@ -184,6 +331,8 @@ the driver's rx handler with the payload of the incoming message).
   void rpmsg_destroy_ept(struct rpmsg_endpoint *ept);
    - destroys an existing rpmsg endpoint. user should provide a pointer
      to an rpmsg endpoint that was previously created with rpmsg_create_ept().
+     when this function returns, the endpoint's rx callback is guaranteed
+     not to be running anymore, so it must not be called from an rx callback.
 
   int register_rpmsg_driver(struct rpmsg_driver *rpdrv);
    - registers an rpmsg driver with the rpmsg bus. user should provide
@@ -283,6 +432,13 @@ rpmsg core will treat them as completely independent processors (despite
 the fact that both of are part of the same physical device, and they are
 powered on/off together).
 
+Rpmsg can also be exercised without any remote processor: the loopback host
+(see loopback_rpmsg.c) registers a pair of virtio devices whose vrings are
+cross-connected, so each of them is the remote processor of the other. The
+second one publishes the server sample and an "rpmsg-echo" service, which
+makes it possible to test and profile the bus, its drivers and user space
+interfaces (e.g. with the rpmsg benchmark driver) on any machine.
+
 Notable virtio implementation bits:
 
 * virtio features: VIRTIO_RPMSG_F_NS should be enabled if the remote
@@ -298,6 +454,56 @@ Notable virtio implementation bits:
   If/when a relevant rpmsg driver is registered, it will be immediately probed
   by the bus, and can then start sending messages to the remote service.
 
+  VIRTIO_RPMSG_F_PRIO should be enabled if the remote processor supports a
+  second, high priority, pair of virtqueues. The rpmsg bus then asks for
+  four virtqueues instead of two: "input", "output", "prio_input" and
+  "prio_output" (in this order). Channels are mapped to a traffic class
+  when they are created: static channels using the prio member of their
+  struct rpmsg_channel_info, and announced channels using the RPMSG_NS_PRIO
+  name service flag. Messages of RPMSG_PRIO_HIGH channels are sent on the
+  high priority tx virtqueue, and inbound messages of the high priority rx
+  virtqueue (which gets an eighth of the rx buffers) are dispatched before
+  any others, so control messages are never stuck behind bulk traffic.
+
+  VIRTIO_RPMSG_F_NS_BATCH should be enabled if the remote processor may
+  pack several struct rpmsg_ns_msg announcements, back to back, into a
+  single name service message (e.g. to announce all of its services at
+  once when it boots). Either way, announcements are processed in order,
+  from a work item rather than from the rx path, so the channels they
+  create (and the probing of their drivers) show up asynchronously.
+
+  VIRTIO_RPMSG_F_FRAG should be enabled if the remote processor can
+  reassemble fragmented messages (and may send such messages itself).
+  Payloads that don't fit in a single buffer (buf_size minus the rpmsg
+  header) are then transparently sent, using the regular sending API, as
+  several consecutive fragments of up to 64KB in total: every fragment
+  carries its payload offset in the reserved field of its rpmsg header,
+  and all fragments but the last have RPMSG_HDR_MORE_FRAGS set. Inbound
+  fragmented messages are reassembled before they are delivered to their
+  endpoint, using a bounded amount of memory (and can't be held using
+  rpmsg_hold_rx_buf()). Fragmented messages with the same source and
+  destination addresses must not be sent concurrently.
+
+  VIRTIO_RPMSG_F_COMPACT_HDR should be enabled if the remote processor uses
+  the 8-byte struct rpmsg_hdr_compact (16-bit addresses and length) instead
+  of the 16-byte struct rpmsg_hdr, which halves the header overhead of small
+  control messages. Rpmsg drivers aren't affected, but their addresses must
+  then fit in 16 bits, and messages aren't fragmented (even if
+  VIRTIO_RPMSG_F_FRAG is negotiated, too).
+
+  VIRTIO_RPMSG_F_CREDITS should be enabled if the remote processor supports
+  per-endpoint flow control. An endpoint is flow-controlled by sending a
+  struct rpmsg_credit_msg with RPMSG_CREDIT_SET from its address to the
+  reserved address 54; the sender may then only send that many messages to
+  it (a fragmented message counts once), and more credits are granted by
+  sending struct rpmsg_credit_msg again, without RPMSG_CREDIT_SET. Setting
+  RPMSG_CREDITS_UNLIMITED ends flow control; senders to an endpoint that
+  never set credits aren't throttled. Senders that run out of credits
+  block, or get -ENOMEM if they can't (and may then use rpmsg_tx_notify()).
+
+  The low byte of the flags of a message header is set aside for such
+  bus-level features; the rest of the bits must be zero.
+
 * virtqueue's notify handler: should inform the remote processor whenever
   it is kicked by virtio. OMAP4 is using its mailbox device to interrupt
   the remote processor, and inform it which virtqueue number is kicked
@@ -306,3 +512,18 @@ Notable virtio implementation bits:
 * virtio_config_ops's ->get() handler: the rpmsg bus uses this handler
   to request for platform-specific configuration values.
   see enum rpmsg_platform_requests for more info.
+
+* crash recovery: a platform that learns its remote processor crashed may
+  say so via VPROC_CRASHED, and invoke the ->config_changed() handler of
+  the virtio driver. The rpmsg bus then stops sending, takes back all the
+  buffers, resets the device (->reset() must stop the notifications and
+  reset the vrings, e.g. with vring_reset_virtqueue()), posts its rx
+  buffers again, and sets VIRTIO_CONFIG_S_DRIVER_OK (->set_status() must
+  restart the notifications and reboot the remote processor, e.g. with
+  rproc_restart()). The channels, their endpoints and their users are
+  kept: local channels are announced to the rebooted remote processor
+  again, and remote channels it announces anew are matched with the old
+  ones. Messages that were in flight are lost, and sending fails with
+  -ENXIO until the remote processor is back. The generic rpmsg host
+  (rpmsg_host.c) does all this for its backends, which just need to call
+  rpmsg_host_crashed().
@@ -557,6 +557,10 @@ static int armpmu_event_init(struct perf_event *event)
 	if (!armpmu)
 		return -ENODEV;
 
+	/* There is no branch record facility to sample from */
+	if (has_branch_stack(event))
+		return -EOPNOTSUPP;
+
 	event->destroy = hw_perf_event_destroy;
 
 	if (!atomic_inc_not_zero(&active_events)) {
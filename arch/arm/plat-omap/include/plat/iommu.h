@@ -13,6 +13,8 @@
 #ifndef __MACH_IOMMU_H
 #define __MACH_IOMMU_H
 
+#include <linux/rbtree.h>
+
 struct iotlb_entry {
 	u32 da;
 	u32 pa;
@@ -25,6 +27,21 @@ struct iotlb_entry {
 	};
 };
 
+/*
+ * Performance counters, see the 'stats' file of iommu-debug. Map/unmap
+ * counters and latencies are protected by 'page_table_lock'.
+ */
+struct iommu_stats {
+	u32	faults[5];	/* by OMAP_IOMMU_ERR_* bit */
+	u32	maps[4];	/* by MMU_CAM_PGSZ_* */
+	u32	unmaps;		/* entries cleared */
+	u64	map_ns;		/* total time spent mapping */
+	u64	unmap_ns;	/* total time spent unmapping */
+	u32	map_max_ns;
+	u32	unmap_max_ns;
+	u32	unmap_calls;	/* a range counts once */
+};
+
 struct iommu {
 	const char	*name;
 	struct module	*owner;
@@ -46,8 +63,12 @@ struct iommu {
 	int		nr_tlb_entries;
 
 	struct list_head	mmap;
+	struct rb_root		mmap_rb; /* mmap, indexed by da */
+	struct rb_root		mmap_cache; /* IOVMF_CACHED mmap, by sgt */
 	struct mutex		mmap_lock; /* protect mmap */
 
+	struct iommu_stats	stats;
+
 	int (*isr)(struct iommu *obj, u32 da, u32 iommu_errs, void *priv);
 
 	void *ctx; /* iommu context: registres saved area */
@@ -165,6 +186,7 @@ extern int iopgtable_store_entry(struct iommu *obj, struct iotlb_entry *e);
 extern void iopgtable_lookup_entry(struct iommu *obj, u32 da, u32 **ppgd,
 				   u32 **ppte);
 extern size_t iopgtable_clear_entry(struct iommu *obj, u32 iova);
+extern size_t iopgtable_clear_range(struct iommu *obj, u32 start, u32 end);
 
 extern int iommu_set_da_range(struct iommu *obj, u32 start, u32 end);
 extern int iommu_set_isr(const char *name,
@@ -21,8 +21,11 @@ struct iovm_struct {
 	u32			da_end;
 	u32			flags; /* IOVMF_: see below */
 	struct list_head	list; /* linked in ascending order */
+	struct rb_node		node; /* indexed by 'da_start' */
 	const struct sg_table	*sgt; /* keep 'page' <-> 'da' mapping */
 	void			*va; /* mpu side mapped address */
+	struct rb_node		cache_node; /* IOVMF_CACHED: indexed by 'sgt' */
+	unsigned int		refcount; /* IOVMF_CACHED: 'iommu_vmap()' users */
 };
 
 /*
@@ -71,12 +74,17 @@ struct iovm_struct {
 
 #define IOVMF_DA_FIXED		(1 << (4 + IOVMF_SW_SHIFT))
 
+/* 'iommu_vmap()' only: keep the mapping of 'sgt' until 'iommu_vuncache()' */
+#define IOVMF_CACHED		(1 << (5 + IOVMF_SW_SHIFT))
+
 
 extern struct iovm_struct *find_iovm_area(struct iommu *obj, u32 da);
 extern u32 iommu_vmap(struct iommu_domain *domain, struct iommu *obj, u32 da,
 			const struct sg_table *sgt, u32 flags);
 extern struct sg_table *iommu_vunmap(struct iommu_domain *domain,
 				struct iommu *obj, u32 da);
+extern struct sg_table *iommu_vuncache(struct iommu_domain *domain,
+				struct iommu *obj, const struct sg_table *sgt);
 extern u32 iommu_vmalloc(struct iommu_domain *domain, struct iommu *obj,
 				u32 da, size_t bytes, u32 flags);
 extern void iommu_vfree(struct iommu_domain *domain, struct iommu *obj,
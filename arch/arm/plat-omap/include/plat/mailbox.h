@@ -8,6 +8,8 @@
 #include <linux/interrupt.h>
 #include <linux/device.h>
 #include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/rwsem.h>
 
 typedef u32 mbox_msg_t;
 struct omap_mbox;
@@ -41,6 +43,38 @@ struct omap_mbox_ops {
 	void		(*restore_ctx)(struct omap_mbox *mbox);
 };
 
+/* number of buckets of the log2 latency histograms (the last one is open) */
+#define OMAP_MBOX_HIST_BUCKETS	16
+
+/*
+ * bucket 0 counts latencies below 1 usec, bucket i those of [2^(i-1), 2^i)
+ * usecs, and the last one all the longer ones
+ */
+struct omap_mbox_hist {
+	unsigned long bucket[OMAP_MBOX_HIST_BUCKETS];
+};
+
+struct omap_mbox_stats {
+	unsigned long		tx_msgs;
+	unsigned long		tx_coalesced;
+	unsigned long		tx_irqs;
+	unsigned int		tx_depth_max;
+	struct omap_mbox_hist	tx_poll;
+	unsigned long		rx_msgs;
+	unsigned long		rx_irqs;
+	unsigned long		rx_full;
+	unsigned int		rx_depth_max;
+	struct omap_mbox_hist	rx_lag;
+};
+
+/* number of message values that can be dispatched to a handler directly */
+#define OMAP_MBOX_NR_HANDLERS	16
+
+struct omap_mbox_handler {
+	void			(*func)(mbox_msg_t msg, void *priv);
+	void			*priv;
+};
+
 struct omap_mbox_queue {
 	spinlock_t		lock;
 	struct kfifo		fifo;
@@ -48,6 +82,9 @@ struct omap_mbox_queue {
 	struct tasklet_struct	tasklet;
 	struct omap_mbox	*mbox;
 	bool full;
+	bool rx_prio_set;
+	unsigned long doorbells;
+	ktime_t rx_stamp;
 };
 
 struct omap_mbox {
@@ -59,14 +96,23 @@ struct omap_mbox {
 	void			*priv;
 	int			use_count;
 	struct blocking_notifier_head   notifier;
+	struct omap_mbox_handler handlers[OMAP_MBOX_NR_HANDLERS];
+	struct rw_semaphore	handlers_sem;
+	struct omap_mbox_stats	stats;
+	struct dentry		*dbg_file;
 };
 
 int omap_mbox_msg_send(struct omap_mbox *, mbox_msg_t msg);
+int omap_mbox_doorbell_send(struct omap_mbox *, mbox_msg_t msg);
 void omap_mbox_init_seq(struct omap_mbox *);
 
 struct omap_mbox *omap_mbox_get(const char *, struct notifier_block *nb);
 void omap_mbox_put(struct omap_mbox *mbox, struct notifier_block *nb);
 
+int omap_mbox_register_handler(struct omap_mbox *mbox, mbox_msg_t msg,
+		void (*func)(mbox_msg_t msg, void *priv), void *priv);
+void omap_mbox_unregister_handler(struct omap_mbox *mbox, mbox_msg_t msg);
+
 int omap_mbox_register(struct device *parent, struct omap_mbox **);
 int omap_mbox_unregister(void);
 
@@ -317,6 +317,72 @@ err_out:
 	return count;
 }
 
+static u32 debug_avg_ns(u64 total, u32 count)
+{
+	if (!count)
+		return 0;
+	do_div(total, count);
+	return total;
+}
+
+static ssize_t debug_read_stats(struct file *file, char __user *userbuf,
+				size_t count, loff_t *ppos)
+{
+	struct iommu *obj = file->private_data;
+	static const char *faults[] = {
+		"tlb miss", "translation", "emu miss", "table walk", "multi hit",
+	};
+	struct iommu_stats s;
+	char *p, *buf;
+	ssize_t bytes;
+	int i;
+
+	buf = (char *)__get_free_page(GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	p = buf;
+
+	spin_lock(&obj->page_table_lock);
+	s = obj->stats;
+	spin_unlock(&obj->page_table_lock);
+
+	/* tlb misses only interrupt (and count) with table walking off */
+	p += sprintf(p, "faults:\n");
+	for (i = 0; i < ARRAY_SIZE(faults); i++)
+		p += sprintf(p, "  %-12s %10u\n", faults[i], s.faults[i]);
+
+	p += sprintf(p, "maps:\n");
+	for (i = 0; i < ARRAY_SIZE(s.maps); i++)
+		p += sprintf(p, "  %-12x %10u\n", iopgsz_to_bytes(i), s.maps[i]);
+	p += sprintf(p, "unmaps:        %10u (%u calls)\n",
+		     s.unmaps, s.unmap_calls);
+
+	p += sprintf(p, "map ns:        %10u avg %10u max\n",
+		     debug_avg_ns(s.map_ns, s.maps[0] + s.maps[1] +
+				  s.maps[2] + s.maps[3]), s.map_max_ns);
+	p += sprintf(p, "unmap ns:      %10u avg %10u max\n",
+		     debug_avg_ns(s.unmap_ns, s.unmap_calls), s.unmap_max_ns);
+
+	bytes = simple_read_from_buffer(userbuf, count, ppos, buf, p - buf);
+
+	free_page((unsigned long)buf);
+
+	return bytes;
+}
+
+/* any write resets the counters */
+static ssize_t debug_write_stats(struct file *file, const char __user *userbuf,
+				 size_t count, loff_t *ppos)
+{
+	struct iommu *obj = file->private_data;
+
+	spin_lock(&obj->page_table_lock);
+	memset(&obj->stats, 0, sizeof(obj->stats));
+	spin_unlock(&obj->page_table_lock);
+
+	return count;
+}
+
 static int debug_open_generic(struct inode *inode, struct file *file)
 {
 	file->private_data = inode->i_private;
@@ -344,6 +410,7 @@ DEBUG_FOPS_RO(tlb);
 DEBUG_FOPS(pagetable);
 DEBUG_FOPS_RO(mmap);
 DEBUG_FOPS(mem);
+DEBUG_FOPS(stats);
 
 #define __DEBUG_ADD_FILE(attr, mode)					\
 	{								\
@@ -382,6 +449,7 @@ static int iommu_debug_register(struct device *dev, void *data)
 	DEBUG_ADD_FILE(pagetable);
 	DEBUG_ADD_FILE_RO(mmap);
 	DEBUG_ADD_FILE(mem);
+	DEBUG_ADD_FILE(stats);
 
 	return 0;
 }
@@ -20,6 +20,7 @@
 #include <linux/platform_device.h>
 #include <linux/iommu.h>
 #include <linux/mutex.h>
+#include <linux/ktime.h>
 
 #include <asm/cacheflush.h>
 
@@ -355,17 +356,34 @@ EXPORT_SYMBOL_GPL(flush_iotlb_page);
  * @start:	iommu device virtual address(start)
  * @end:	iommu device virtual address(end)
  *
- * Clear an iommu tlb entry which includes 'da' address.
+ * Clear the iommu tlb entries which overlap [start, end), in a single
+ * pass over the tlb, whatever their page sizes.
  **/
 void flush_iotlb_range(struct iommu *obj, u32 start, u32 end)
 {
-	u32 da = start;
+	int i;
+	struct cr_regs cr;
 
-	while (da < end) {
-		flush_iotlb_page(obj, da);
-		/* FIXME: Optimize for multiple page size */
-		da += IOPTE_SIZE;
+	clk_enable(obj->clk);
+
+	for_each_iotlb_cr(obj, obj->nr_tlb_entries, i, cr) {
+		u32 da;
+		size_t bytes;
+
+		if (!iotlb_cr_valid(&cr))
+			continue;
+
+		da = iotlb_cr_to_virt(&cr);
+		bytes = iopgsz_to_bytes(cr.cam & 3);
+
+		if ((da < end) && (start < da + bytes)) {
+			dev_dbg(obj->dev, "%s: %08x-%08x(%x)\n",
+				__func__, start, end, da);
+			iotlb_load_cr(obj, &cr);
+			iommu_write_reg(obj, 1, MMU_FLUSH_ENTRY);
+		}
 	}
+	clk_disable(obj->clk);
 }
 EXPORT_SYMBOL_GPL(flush_iotlb_range);
 
@@ -648,6 +666,16 @@ static int iopgtable_store_entry_core(struct iommu *obj, struct iotlb_entry *e)
 	return err;
 }
 
+/* account the time since @start; called with 'page_table_lock' held */
+static void iommu_stat_time(u64 *total, u32 *max, ktime_t start)
+{
+	u32 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	*total += ns;
+	if (ns > *max)
+		*max = ns;
+}
+
 /**
  * iopgtable_store_entry - Make an iommu pte entry
  * @obj:	target iommu
@@ -655,6 +683,7 @@ static int iopgtable_store_entry_core(struct iommu *obj, struct iotlb_entry *e)
  **/
 int iopgtable_store_entry(struct iommu *obj, struct iotlb_entry *e)
 {
+	ktime_t start = ktime_get();
 	int err;
 
 	flush_iotlb_page(obj, e->da);
@@ -663,6 +692,13 @@ int iopgtable_store_entry(struct iommu *obj, struct iotlb_entry *e)
 	if (!err)
 		load_iotlb_entry(obj, e);
 #endif
+	if (!err) {
+		spin_lock(&obj->page_table_lock);
+		obj->stats.maps[e->pgsz & 3]++;
+		iommu_stat_time(&obj->stats.map_ns, &obj->stats.map_max_ns,
+				start);
+		spin_unlock(&obj->page_table_lock);
+	}
 	return err;
 }
 EXPORT_SYMBOL_GPL(iopgtable_store_entry);
@@ -745,6 +781,7 @@ out:
  **/
 size_t iopgtable_clear_entry(struct iommu *obj, u32 da)
 {
+	ktime_t start = ktime_get();
 	size_t bytes;
 
 	spin_lock(&obj->page_table_lock);
@@ -752,12 +789,55 @@ size_t iopgtable_clear_entry(struct iommu *obj, u32 da)
 	bytes = iopgtable_clear_entry_core(obj, da);
 	flush_iotlb_page(obj, da);
 
+	if (bytes)
+		obj->stats.unmaps++;
+	obj->stats.unmap_calls++;
+	iommu_stat_time(&obj->stats.unmap_ns, &obj->stats.unmap_max_ns, start);
+
 	spin_unlock(&obj->page_table_lock);
 
 	return bytes;
 }
 EXPORT_SYMBOL_GPL(iopgtable_clear_entry);
 
+/**
+ * iopgtable_clear_range - Remove the iommu pte entries of a range
+ * @obj:	target iommu
+ * @start:	iommu device virtual address(start)
+ * @end:	iommu device virtual address(end)
+ *
+ * Clear all the entries mapping [start, end) first, and flush the tlb only
+ * once for the lot. Stops at the first unmapped address; returns the number
+ * of bytes cleared.
+ **/
+size_t iopgtable_clear_range(struct iommu *obj, u32 start, u32 end)
+{
+	ktime_t t = ktime_get();
+	size_t bytes, total = 0;
+	u32 da = start;
+
+	spin_lock(&obj->page_table_lock);
+
+	while (da < end) {
+		bytes = iopgtable_clear_entry_core(obj, da);
+		if (!bytes)
+			break;
+
+		da += bytes;
+		total += bytes;
+		obj->stats.unmaps++;
+	}
+	flush_iotlb_range(obj, start, da);
+
+	obj->stats.unmap_calls++;
+	iommu_stat_time(&obj->stats.unmap_ns, &obj->stats.unmap_max_ns, t);
+
+	spin_unlock(&obj->page_table_lock);
+
+	return total;
+}
+EXPORT_SYMBOL_GPL(iopgtable_clear_range);
+
 void iopgtable_clear_entry_all(struct iommu *obj)
 {
 	int i;
@@ -794,6 +874,7 @@ static irqreturn_t iommu_fault_handler(int irq, void *data)
 	u32 da, errs;
 	u32 *iopgd, *iopte;
 	struct iommu *obj = data;
+	int i;
 
 	if (!obj->refcount)
 		return IRQ_NONE;
@@ -804,6 +885,10 @@ static irqreturn_t iommu_fault_handler(int irq, void *data)
 	if (errs == 0)
 		return IRQ_HANDLED;
 
+	for (i = 0; i < ARRAY_SIZE(obj->stats.faults); i++)
+		if (errs & (1 << i))
+			obj->stats.faults[i]++;
+
 	/* Fault callback or TLB/PTE Dynamic loading */
 	if (obj->isr && !obj->isr(obj, da, errs, obj->isr_priv))
 		return IRQ_HANDLED;
@@ -1004,6 +1089,8 @@ static int __devinit omap_iommu_probe(struct platform_device *pdev)
 	mutex_init(&obj->mmap_lock);
 	spin_lock_init(&obj->page_table_lock);
 	INIT_LIST_HEAD(&obj->mmap);
+	obj->mmap_rb = RB_ROOT;
+	obj->mmap_cache = RB_ROOT;
 
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!res) {
@@ -227,10 +227,18 @@ static inline void vunmap_sg(const void *va)
 
 static struct iovm_struct *__find_iovm_area(struct iommu *obj, const u32 da)
 {
+	struct rb_node *n = obj->mmap_rb.rb_node;
 	struct iovm_struct *tmp;
 
-	list_for_each_entry(tmp, &obj->mmap, list) {
-		if ((da >= tmp->da_start) && (da < tmp->da_end)) {
+	/* iovmas never overlap, so ordering them by 'da_start' will do */
+	while (n) {
+		tmp = rb_entry(n, struct iovm_struct, node);
+
+		if (da < tmp->da_start) {
+			n = n->rb_left;
+		} else if (da >= tmp->da_end) {
+			n = n->rb_right;
+		} else {
 			size_t len;
 
 			len = tmp->da_end - tmp->da_start;
@@ -264,6 +272,68 @@ struct iovm_struct *find_iovm_area(struct iommu *obj, u32 da)
 }
 EXPORT_SYMBOL_GPL(find_iovm_area);
 
+static void insert_iovm_area(struct iommu *obj, struct iovm_struct *new)
+{
+	struct rb_node **p = &obj->mmap_rb.rb_node, *parent = NULL;
+	struct iovm_struct *tmp;
+
+	while (*p) {
+		parent = *p;
+		tmp = rb_entry(parent, struct iovm_struct, node);
+
+		if (new->da_start < tmp->da_start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &obj->mmap_rb);
+}
+
+/*
+ * IOVMF_CACHED iovmas are also indexed by their 'sgt', so mapping the
+ * same buffer again just finds the iovma of the last time.
+ */
+static struct iovm_struct *__find_cached_iovm_area(struct iommu *obj,
+						const struct sg_table *sgt)
+{
+	struct rb_node *n = obj->mmap_cache.rb_node;
+	struct iovm_struct *tmp;
+
+	while (n) {
+		tmp = rb_entry(n, struct iovm_struct, cache_node);
+
+		if (sgt < tmp->sgt)
+			n = n->rb_left;
+		else if (sgt > tmp->sgt)
+			n = n->rb_right;
+		else
+			return tmp;
+	}
+
+	return NULL;
+}
+
+static void cache_iovm_area(struct iommu *obj, struct iovm_struct *area)
+{
+	struct rb_node **p = &obj->mmap_cache.rb_node, *parent = NULL;
+	struct iovm_struct *tmp;
+
+	while (*p) {
+		parent = *p;
+		tmp = rb_entry(parent, struct iovm_struct, cache_node);
+
+		if (area->sgt < tmp->sgt)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&area->cache_node, parent, p);
+	rb_insert_color(&area->cache_node, &obj->mmap_cache);
+}
+
 /*
  * This finds the hole(area) which fits the requested address and len
  * in iovmas mmap, and returns the new allocated iovma.
@@ -328,6 +398,7 @@ found:
 	new->da_start = start;
 	new->da_end = start + bytes;
 	new->flags = flags;
+	RB_CLEAR_NODE(&new->cache_node);
 
 	/*
 	 * keep ascending order of iovmas
@@ -336,6 +407,7 @@ found:
 		list_add_tail(&new->list, &tmp->list);
 	else
 		list_add(&new->list, &obj->mmap);
+	insert_iovm_area(obj, new);
 
 	dev_dbg(obj->dev, "%s: found %08x-%08x-%08x(%x) %08x\n",
 		__func__, new->da_start, start, new->da_end, bytes, flags);
@@ -355,6 +427,9 @@ static void free_iovm_area(struct iommu *obj, struct iovm_struct *area)
 		__func__, area->da_start, area->da_end, bytes, area->flags);
 
 	list_del(&area->list);
+	rb_erase(&area->node, &obj->mmap_rb);
+	if (!RB_EMPTY_NODE(&area->cache_node))
+		rb_erase(&area->cache_node, &obj->mmap_cache);
 	kmem_cache_free(iovm_area_cachep, area);
 }
 
@@ -515,40 +590,39 @@ err_out:
 	return err;
 }
 
-/* release 'da' <-> 'pa' mapping */
-static void unmap_iovm_area(struct iommu_domain *domain, struct iommu *obj,
-						struct iovm_struct *area)
+/*
+ * release 'da' <-> 'pa' mapping
+ *
+ * All the entries are cleared first, and then the tlb is flushed just once,
+ * rather than once per sg element as 'iommu_unmap()' would.
+ */
+static void unmap_iovm_area(struct iommu *obj, struct iovm_struct *area)
 {
-	u32 start;
 	size_t total = area->da_end - area->da_start;
-	const struct sg_table *sgt = area->sgt;
-	struct scatterlist *sg;
-	int i, err;
 
-	BUG_ON(!sgtable_ok(sgt));
+	BUG_ON(!sgtable_ok(area->sgt));
 	BUG_ON((!total) || !IS_ALIGNED(total, PAGE_SIZE));
 
-	start = area->da_start;
-	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
-		size_t bytes;
-		int order;
+	total -= iopgtable_clear_range(obj, area->da_start, area->da_end);
 
-		bytes = sg->length;
-		order = get_order(bytes);
+	dev_dbg(obj->dev, "%s: unmap %08x-%08x %08x\n",
+		__func__, area->da_start, area->da_end, area->flags);
 
-		err = iommu_unmap(domain, start, order);
-		if (err)
-			break;
+	BUG_ON(total);
+}
+
+static void release_iovm_area(struct iommu *obj, struct iovm_struct *area,
+			      void (*fn)(const void *))
+{
+	unmap_iovm_area(obj, area);
 
-		dev_dbg(obj->dev, "%s: unmap %08x(%x) %08x\n",
-				__func__, start, bytes, area->flags);
+	fn(area->va);
 
-		BUG_ON(!IS_ALIGNED(bytes, PAGE_SIZE));
+	dev_dbg(obj->dev, "%s: %08x-%08x(%x) %08x\n", __func__,
+		area->da_start, area->da_end,
+		area->da_end - area->da_start, area->flags);
 
-		total -= bytes;
-		start += bytes;
-	}
-	BUG_ON(total);
+	free_iovm_area(obj, area);
 }
 
 /* template function for all unmapping */
@@ -577,17 +651,17 @@ static struct sg_table *unmap_vm_area(struct iommu_domain *domain,
 			area->flags);
 		goto out;
 	}
-	sgt = (struct sg_table *)area->sgt;
-
-	unmap_iovm_area(domain, obj, area);
 
-	fn(area->va);
-
-	dev_dbg(obj->dev, "%s: %08x-%08x-%08x(%x) %08x\n", __func__,
-		area->da_start, da, area->da_end,
-		area->da_end - area->da_start, area->flags);
+	/* cached iovmas stay mapped for the next user, see iommu_vuncache() */
+	if (area->flags & IOVMF_CACHED) {
+		WARN_ON(!area->refcount);
+		if (area->refcount)
+			area->refcount--;
+		goto out;
+	}
 
-	free_iovm_area(obj, area);
+	sgt = (struct sg_table *)area->sgt;
+	release_iovm_area(obj, area, fn);
 out:
 	mutex_unlock(&obj->mmap_lock);
 
@@ -614,6 +688,11 @@ static u32 map_iommu_region(struct iommu_domain *domain, struct iommu *obj,
 	if (map_iovm_area(domain, new, sgt, new->flags))
 		goto err_map;
 
+	if (new->flags & IOVMF_CACHED) {
+		new->refcount = 1;
+		cache_iovm_area(obj, new);
+	}
+
 	mutex_unlock(&obj->mmap_lock);
 
 	dev_dbg(obj->dev, "%s: da:%08x(%x) flags:%08x va:%p\n",
@@ -643,6 +722,10 @@ static inline u32 __iommu_vmap(struct iommu_domain *domain, struct iommu *obj,
  *
  * Creates 1-n-1 mapping with given @sgt and returns @da.
  * All @sgt element must be io page size aligned.
+ *
+ * With 'IOVMF_CACHED', the mapping outlives 'iommu_vunmap()', and mapping
+ * the same @sgt again (with the same @flags) just returns it again.  The
+ * caller must keep @sgt until it gets it back from 'iommu_vuncache()'.
  */
 u32 iommu_vmap(struct iommu_domain *domain, struct iommu *obj, u32 da,
 		const struct sg_table *sgt, u32 flags)
@@ -653,6 +736,28 @@ u32 iommu_vmap(struct iommu_domain *domain, struct iommu *obj, u32 da,
 	if (!obj || !obj->dev || !sgt)
 		return -EINVAL;
 
+	if (flags & IOVMF_CACHED) {
+		struct iovm_struct *area;
+
+		mutex_lock(&obj->mmap_lock);
+		area = __find_cached_iovm_area(obj, sgt);
+		if (area) {
+			if (area->flags != (flags | IOVMF_DISCONT | IOVMF_MMIO) ||
+			    !(flags & IOVMF_MMIO) != !area->va ||
+			    (flags & IOVMF_DA_FIXED && da != area->da_start)) {
+				dev_err(obj->dev, "%s: sgt cached as %08x(%08x)\n",
+					__func__, area->da_start, area->flags);
+				da = -EBUSY;
+			} else {
+				area->refcount++;
+				da = area->da_start;
+			}
+		}
+		mutex_unlock(&obj->mmap_lock);
+		if (area)
+			return da;
+	}
+
 	bytes = sgtable_len(sgt);
 	if (!bytes)
 		return -EINVAL;
@@ -682,6 +787,9 @@ EXPORT_SYMBOL_GPL(iommu_vmap);
  *
  * Free the iommu virtually contiguous memory area starting at
  * @da, which was returned by 'iommu_vmap()'.
+ *
+ * 'IOVMF_CACHED' areas are only released by 'iommu_vuncache()', so this
+ * returns NULL for them.
  */
 struct sg_table *
 iommu_vunmap(struct iommu_domain *domain, struct iommu *obj, u32 da)
@@ -699,6 +807,43 @@ iommu_vunmap(struct iommu_domain *domain, struct iommu *obj, u32 da)
 }
 EXPORT_SYMBOL_GPL(iommu_vunmap);
 
+/**
+ * iommu_vuncache  -  release a mapping cached by 'iommu_vmap()'
+ * @obj:	objective iommu
+ * @sgt:	address of scatter gather table
+ *
+ * Free the 'IOVMF_CACHED' mapping of @sgt, once all its users called
+ * 'iommu_vunmap()', and return @sgt to the caller to free.
+ */
+struct sg_table *iommu_vuncache(struct iommu_domain *domain,
+				struct iommu *obj, const struct sg_table *sgt)
+{
+	struct iovm_struct *area;
+
+	mutex_lock(&obj->mmap_lock);
+
+	area = __find_cached_iovm_area(obj, sgt);
+	if (!area) {
+		dev_dbg(obj->dev, "%s: sgt not cached\n", __func__);
+		sgt = NULL;
+		goto out;
+	}
+
+	if (area->refcount) {
+		dev_err(obj->dev, "%s: %08x still in use\n", __func__,
+			area->da_start);
+		sgt = NULL;
+		goto out;
+	}
+
+	release_iovm_area(obj, area, vunmap_sg);
+out:
+	mutex_unlock(&obj->mmap_lock);
+
+	return (struct sg_table *)sgt;
+}
+EXPORT_SYMBOL_GPL(iommu_vuncache);
+
 /**
  * iommu_vmalloc  -  (d)-(p)-(v) address allocator and mapper
  * @obj:	objective iommu
@@ -724,6 +869,7 @@ u32 iommu_vmalloc(struct iommu_domain *domain, struct iommu *obj, u32 da,
 	if (!va)
 		return -ENOMEM;
 
+	flags &= ~IOVMF_CACHED;
 	flags |= IOVMF_DISCONT;
 	flags |= IOVMF_ALLOC;
 
@@ -774,6 +920,7 @@ static u32 __iommu_kmap(struct iommu_domain *domain, struct iommu *obj,
 {
 	struct sg_table *sgt;
 
+	flags &= ~IOVMF_CACHED;
 	sgt = sgtable_alloc(bytes, flags, da, pa);
 	if (IS_ERR(sgt))
 		return PTR_ERR(sgt);
@@ -29,6 +29,9 @@
 #include <linux/kfifo.h>
 #include <linux/err.h>
 #include <linux/notifier.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <plat/mailbox.h>
 
@@ -41,6 +44,20 @@ static unsigned int mbox_kfifo_size = CONFIG_OMAP_MBOX_KFIFO_SIZE;
 module_param(mbox_kfifo_size, uint, S_IRUGO);
 MODULE_PARM_DESC(mbox_kfifo_size, "Size of omap's mailbox kfifo (bytes)");
 
+/*
+ * Inbound messages are normally delivered from the shared events workqueue,
+ * where they compete with any other kernel work. Latency sensitive users
+ * (e.g. rpmsg) may rather have them delivered from a dedicated irq thread
+ * per mailbox, running at a real-time priority of their choice.
+ */
+static bool mbox_rx_thread;
+module_param(mbox_rx_thread, bool, S_IRUGO);
+MODULE_PARM_DESC(mbox_rx_thread, "Deliver inbound messages from an irq thread");
+
+static unsigned int mbox_rx_prio = MAX_USER_RT_PRIO / 2;
+module_param(mbox_rx_prio, uint, S_IRUGO);
+MODULE_PARM_DESC(mbox_rx_prio, "SCHED_FIFO priority of the irq thread (1-99)");
+
 /* Mailbox FIFO handle functions */
 static inline mbox_msg_t mbox_fifo_read(struct omap_mbox *mbox)
 {
@@ -70,87 +87,191 @@ static inline int is_mbox_irq(struct omap_mbox *mbox, omap_mbox_irq_t irq)
 	return mbox->ops->is_irq(mbox, irq);
 }
 
+/* account a latency, given in usecs, in its log2 histogram bucket */
+static inline void mbox_hist_add(struct omap_mbox_hist *hist, s64 us)
+{
+	int i = us > 0 ? fls(min_t(s64, us, INT_MAX)) : 0;
+
+	hist->bucket[min(i, OMAP_MBOX_HIST_BUCKETS - 1)]++;
+}
+
 /*
  * message sender
  */
 static int __mbox_poll_for_space(struct omap_mbox *mbox)
 {
 	int ret = 0, i = 1000;
+	ktime_t start;
+
+	if (!mbox_fifo_full(mbox))
+		return 0;
 
+	if (mbox->ops->type == OMAP_MBOX_TYPE2)
+		return -1;
+
+	start = ktime_get();
 	while (mbox_fifo_full(mbox)) {
-		if (mbox->ops->type == OMAP_MBOX_TYPE2)
-			return -1;
-		if (--i == 0)
-			return -1;
+		if (--i == 0) {
+			ret = -1;
+			break;
+		}
 		udelay(1);
 	}
+	mbox_hist_add(&mbox->stats.tx_poll,
+				ktime_us_delta(ktime_get(), start));
+
 	return ret;
 }
 
-int omap_mbox_msg_send(struct omap_mbox *mbox, mbox_msg_t msg)
+/*
+ * Write as many queued messages as the h/w fifo takes right now, and fall
+ * back to the TX-not-full interrupt for the rest. Must be called with the
+ * txq lock held.
+ */
+static void __mbox_tx_flush(struct omap_mbox *mbox)
 {
 	struct omap_mbox_queue *mq = mbox->txq;
+	mbox_msg_t msg;
+	int ret;
+
+	while (kfifo_len(&mq->fifo)) {
+		if (__mbox_poll_for_space(mbox)) {
+			omap_mbox_enable_irq(mbox, IRQ_TX);
+			mbox->stats.tx_irqs++;
+			break;
+		}
+
+		ret = kfifo_out(&mq->fifo, (unsigned char *)&msg,
+								sizeof(msg));
+		WARN_ON(ret != sizeof(msg));
+
+		/* a doorbell rung from now on needs a message of its own */
+		if (msg < BITS_PER_LONG)
+			clear_bit(msg, &mq->doorbells);
+
+		mbox_fifo_write(mbox, msg);
+		mbox->stats.tx_msgs++;
+	}
+}
+
+static int __mbox_msg_send(struct omap_mbox *mbox, mbox_msg_t msg,
+							bool doorbell)
+{
+	struct omap_mbox_queue *mq = mbox->txq;
+	unsigned int depth;
 	int ret = 0, len;
 
 	spin_lock_bh(&mq->lock);
 
-	if (kfifo_avail(&mq->fifo) < sizeof(msg)) {
-		ret = -ENOMEM;
+	if (doorbell && test_bit(msg, &mq->doorbells)) {
+		mbox->stats.tx_coalesced++;
 		goto out;
 	}
 
-	if (kfifo_is_empty(&mq->fifo) && !__mbox_poll_for_space(mbox)) {
-		mbox_fifo_write(mbox, msg);
+	if (kfifo_avail(&mq->fifo) < sizeof(msg)) {
+		ret = -ENOMEM;
 		goto out;
 	}
 
+	if (doorbell)
+		set_bit(msg, &mq->doorbells);
+
+	/* keep the ordering: whatever is already queued goes out first */
 	len = kfifo_in(&mq->fifo, (unsigned char *)&msg, sizeof(msg));
 	WARN_ON(len != sizeof(msg));
 
-	tasklet_schedule(&mbox->txq->tasklet);
+	__mbox_tx_flush(mbox);
+
+	depth = kfifo_len(&mq->fifo) / sizeof(msg);
+	if (depth > mbox->stats.tx_depth_max)
+		mbox->stats.tx_depth_max = depth;
 
 out:
 	spin_unlock_bh(&mq->lock);
 	return ret;
 }
+
+int omap_mbox_msg_send(struct omap_mbox *mbox, mbox_msg_t msg)
+{
+	return __mbox_msg_send(mbox, msg, false);
+}
 EXPORT_SYMBOL(omap_mbox_msg_send);
 
+/*
+ * Doorbells are messages that only tell the other side to go look at
+ * something (e.g. a virtqueue index), so ringing a doorbell which is
+ * still queued in the kfifo carries no new information: the receiver
+ * will see our latest changes when it processes the queued one.
+ *
+ * Each doorbell value below BITS_PER_LONG gets a pending bit, set while
+ * it is waiting in the kfifo and cleared right before it is written to
+ * the h/w fifo. A doorbell already pending is dropped, which relieves
+ * both the mailbox fifo and the remote interrupt load.
+ */
+int omap_mbox_doorbell_send(struct omap_mbox *mbox, mbox_msg_t msg)
+{
+	return __mbox_msg_send(mbox, msg, msg < BITS_PER_LONG);
+}
+EXPORT_SYMBOL(omap_mbox_doorbell_send);
+
 static void mbox_tx_tasklet(unsigned long tx_data)
 {
 	struct omap_mbox *mbox = (struct omap_mbox *)tx_data;
 	struct omap_mbox_queue *mq = mbox->txq;
-	mbox_msg_t msg;
-	int ret;
 
-	while (kfifo_len(&mq->fifo)) {
-		if (__mbox_poll_for_space(mbox)) {
-			omap_mbox_enable_irq(mbox, IRQ_TX);
-			break;
-		}
+	spin_lock_bh(&mq->lock);
+	__mbox_tx_flush(mbox);
+	spin_unlock_bh(&mq->lock);
+}
 
-		ret = kfifo_out(&mq->fifo, (unsigned char *)&msg,
-								sizeof(msg));
-		WARN_ON(ret != sizeof(msg));
+/*
+ * Message values below OMAP_MBOX_NR_HANDLERS (e.g. virtqueue indices) may
+ * have a handler of their own, which is then invoked directly rather than
+ * walking the notifier chain: with several users sharing a mailbox, every
+ * notifier would otherwise have to look at (and mostly ignore) every
+ * message. Everything else still goes to the notifier chain.
+ */
+static bool mbox_rx_dispatch(struct omap_mbox *mbox, mbox_msg_t msg)
+{
+	struct omap_mbox_handler *h;
+	bool handled = false;
 
-		mbox_fifo_write(mbox, msg);
+	if (msg >= OMAP_MBOX_NR_HANDLERS)
+		return false;
+
+	down_read(&mbox->handlers_sem);
+	h = &mbox->handlers[msg];
+	if (h->func) {
+		h->func(msg, h->priv);
+		handled = true;
 	}
+	up_read(&mbox->handlers_sem);
+
+	return handled;
 }
 
 /*
- * Message receiver(workqueue)
+ * Message receiver(workqueue or irq thread)
  */
-static void mbox_rx_work(struct work_struct *work)
+static void mbox_rx_deliver(struct omap_mbox_queue *mq)
 {
-	struct omap_mbox_queue *mq =
-			container_of(work, struct omap_mbox_queue, work);
+	struct omap_mbox_stats *stats = &mq->mbox->stats;
 	mbox_msg_t msg;
 	int len;
 
+	/* how long the messages waited since the interrupt that queued them */
+	if (mq->rx_stamp.tv64) {
+		mbox_hist_add(&stats->rx_lag,
+				ktime_us_delta(ktime_get(), mq->rx_stamp));
+		mq->rx_stamp.tv64 = 0;
+	}
+
 	while (kfifo_len(&mq->fifo) >= sizeof(msg)) {
 		len = kfifo_out(&mq->fifo, (unsigned char *)&msg, sizeof(msg));
 		WARN_ON(len != sizeof(msg));
 
-		blocking_notifier_call_chain(&mq->mbox->notifier, len,
+		if (!mbox_rx_dispatch(mq->mbox, msg))
+			blocking_notifier_call_chain(&mq->mbox->notifier, len,
 								(void *)msg);
 		spin_lock_irq(&mq->lock);
 		if (mq->full) {
@@ -161,6 +282,33 @@ static void mbox_rx_work(struct work_struct *work)
 	}
 }
 
+static void mbox_rx_work(struct work_struct *work)
+{
+	struct omap_mbox_queue *mq =
+			container_of(work, struct omap_mbox_queue, work);
+
+	mbox_rx_deliver(mq);
+}
+
+static irqreturn_t mbox_rx_thread_fn(int irq, void *p)
+{
+	struct omap_mbox *mbox = p;
+	struct omap_mbox_queue *mq = mbox->rxq;
+	struct sched_param param = { .sched_priority = mbox_rx_prio };
+
+	/* the irq thread is created by the irq core, so set it up lazily */
+	if (unlikely(!mq->rx_prio_set)) {
+		if (sched_setscheduler(current, SCHED_FIFO, &param))
+			pr_warn("%s: can't set rx thread priority to %u\n",
+						mbox->name, mbox_rx_prio);
+		mq->rx_prio_set = true;
+	}
+
+	mbox_rx_deliver(mq);
+
+	return IRQ_HANDLED;
+}
+
 /*
  * Mailbox interrupt handler
  */
@@ -174,14 +322,21 @@ static void __mbox_tx_interrupt(struct omap_mbox *mbox)
 static void __mbox_rx_interrupt(struct omap_mbox *mbox)
 {
 	struct omap_mbox_queue *mq = mbox->rxq;
+	unsigned int depth;
 	mbox_msg_t msg;
 	int len;
 
+	mbox->stats.rx_irqs++;
+
+	if (!mq->rx_stamp.tv64)
+		mq->rx_stamp = ktime_get();
+
 	while (!mbox_fifo_empty(mbox)) {
 		if (unlikely(kfifo_avail(&mq->fifo) < sizeof(msg))) {
 			omap_mbox_disable_irq(mbox, IRQ_RX);
 			mq->full = true;
-			goto nomem;
+			mbox->stats.rx_full++;
+			return;
 		}
 
 		msg = mbox_fifo_read(mbox);
@@ -189,27 +344,37 @@ static void __mbox_rx_interrupt(struct omap_mbox *mbox)
 		len = kfifo_in(&mq->fifo, (unsigned char *)&msg, sizeof(msg));
 		WARN_ON(len != sizeof(msg));
 
+		mbox->stats.rx_msgs++;
+		depth = kfifo_len(&mq->fifo) / sizeof(msg);
+		if (depth > mbox->stats.rx_depth_max)
+			mbox->stats.rx_depth_max = depth;
+
 		if (mbox->ops->type == OMAP_MBOX_TYPE1)
 			break;
 	}
 
 	/* no more messages in the fifo. clear IRQ source. */
 	ack_mbox_irq(mbox, IRQ_RX);
-nomem:
-	schedule_work(&mbox->rxq->work);
 }
 
 static irqreturn_t mbox_interrupt(int irq, void *p)
 {
 	struct omap_mbox *mbox = p;
+	irqreturn_t ret = IRQ_HANDLED;
 
 	if (is_mbox_irq(mbox, IRQ_TX))
 		__mbox_tx_interrupt(mbox);
 
-	if (is_mbox_irq(mbox, IRQ_RX))
+	if (is_mbox_irq(mbox, IRQ_RX)) {
 		__mbox_rx_interrupt(mbox);
 
-	return IRQ_HANDLED;
+		if (mbox_rx_thread)
+			ret = IRQ_WAKE_THREAD;
+		else
+			schedule_work(&mbox->rxq->work);
+	}
+
+	return ret;
 }
 
 static struct omap_mbox_queue *mbox_queue_alloc(struct omap_mbox *mbox,
@@ -260,13 +425,7 @@ static int omap_mbox_startup(struct omap_mbox *mbox)
 	}
 
 	if (!mbox->use_count++) {
-		ret = request_irq(mbox->irq, mbox_interrupt, IRQF_SHARED,
-							mbox->name, mbox);
-		if (unlikely(ret)) {
-			pr_err("failed to register mailbox interrupt:%d\n",
-									ret);
-			goto fail_request_irq;
-		}
+		/* the irq might fire right away, so set up the queues first */
 		mq = mbox_queue_alloc(mbox, NULL, mbox_tx_tasklet);
 		if (!mq) {
 			ret = -ENOMEM;
@@ -281,15 +440,24 @@ static int omap_mbox_startup(struct omap_mbox *mbox)
 		}
 		mbox->rxq = mq;
 		mq->mbox = mbox;
+
+		ret = request_threaded_irq(mbox->irq, mbox_interrupt,
+				mbox_rx_thread ? mbox_rx_thread_fn : NULL,
+				IRQF_SHARED, mbox->name, mbox);
+		if (unlikely(ret)) {
+			pr_err("failed to register mailbox interrupt:%d\n",
+									ret);
+			goto fail_request_irq;
+		}
 	}
 	mutex_unlock(&mbox_configured_lock);
 	return 0;
 
+fail_request_irq:
+	mbox_queue_free(mbox->rxq);
 fail_alloc_rxq:
 	mbox_queue_free(mbox->txq);
 fail_alloc_txq:
-	free_irq(mbox->irq, mbox);
-fail_request_irq:
 	if (mbox->ops->shutdown)
 		mbox->ops->shutdown(mbox);
 	mbox->use_count--;
@@ -355,8 +523,123 @@ void omap_mbox_put(struct omap_mbox *mbox, struct notifier_block *nb)
 }
 EXPORT_SYMBOL(omap_mbox_put);
 
+/**
+ * omap_mbox_register_handler() - handle a message value directly
+ * @mbox: the mailbox
+ * @msg: the message value, below OMAP_MBOX_NR_HANDLERS
+ * @func: invoked, in process context, whenever @msg is received
+ * @priv: private data for @func
+ *
+ * Messages with a registered handler are no longer passed to the
+ * mailbox's notifier chain.
+ *
+ * Returns 0 on success, -EINVAL if @msg is out of range, or -EBUSY if
+ * it already has a handler.
+ */
+int omap_mbox_register_handler(struct omap_mbox *mbox, mbox_msg_t msg,
+		void (*func)(mbox_msg_t msg, void *priv), void *priv)
+{
+	int ret = 0;
+
+	if (msg >= OMAP_MBOX_NR_HANDLERS || !func)
+		return -EINVAL;
+
+	down_write(&mbox->handlers_sem);
+	if (mbox->handlers[msg].func) {
+		ret = -EBUSY;
+	} else {
+		mbox->handlers[msg].func = func;
+		mbox->handlers[msg].priv = priv;
+	}
+	up_write(&mbox->handlers_sem);
+
+	return ret;
+}
+EXPORT_SYMBOL(omap_mbox_register_handler);
+
+/**
+ * omap_mbox_unregister_handler() - stop handling a message value directly
+ * @mbox: the mailbox
+ * @msg: the message value
+ *
+ * When this returns, the handler is no longer running, and won't be
+ * invoked again.
+ */
+void omap_mbox_unregister_handler(struct omap_mbox *mbox, mbox_msg_t msg)
+{
+	if (msg >= OMAP_MBOX_NR_HANDLERS)
+		return;
+
+	down_write(&mbox->handlers_sem);
+	mbox->handlers[msg].func = NULL;
+	mbox->handlers[msg].priv = NULL;
+	up_write(&mbox->handlers_sem);
+}
+EXPORT_SYMBOL(omap_mbox_unregister_handler);
+
 static struct class omap_mbox_class = { .name = "mbox", };
 
+static struct dentry *mbox_dbg_dir;
+
+static void mbox_hist_show(struct seq_file *s, const char *name,
+				const struct omap_mbox_hist *hist)
+{
+	int i;
+
+	seq_printf(s, "%s (usecs):\n", name);
+
+	for (i = 0; i < OMAP_MBOX_HIST_BUCKETS - 1; i++)
+		seq_printf(s, "   < %-8lu %lu\n", 1UL << i, hist->bucket[i]);
+
+	seq_printf(s, "  >= %-8lu %lu\n", 1UL << (i - 1), hist->bucket[i]);
+}
+
+/*
+ * the counters are updated locklessly from irq and softirq context, so
+ * this is a snapshot, which is all we need for diagnostics.
+ */
+static int mbox_stats_show(struct seq_file *s, void *unused)
+{
+	struct omap_mbox *mbox = s->private;
+	struct omap_mbox_stats stats = mbox->stats;
+	unsigned int txd = 0, rxd = 0;
+
+	mutex_lock(&mbox_configured_lock);
+	if (mbox->use_count) {
+		txd = kfifo_len(&mbox->txq->fifo) / sizeof(mbox_msg_t);
+		rxd = kfifo_len(&mbox->rxq->fifo) / sizeof(mbox_msg_t);
+	}
+	mutex_unlock(&mbox_configured_lock);
+
+	seq_printf(s, "tx msgs:           %lu\n", stats.tx_msgs);
+	seq_printf(s, "tx coalesced:      %lu\n", stats.tx_coalesced);
+	seq_printf(s, "tx irqs armed:     %lu\n", stats.tx_irqs);
+	seq_printf(s, "tx queued:         %u\n", txd);
+	seq_printf(s, "tx max queued:     %u\n", stats.tx_depth_max);
+	seq_printf(s, "rx msgs:           %lu\n", stats.rx_msgs);
+	seq_printf(s, "rx irqs:           %lu\n", stats.rx_irqs);
+	seq_printf(s, "rx kfifo full:     %lu\n", stats.rx_full);
+	seq_printf(s, "rx queued:         %u\n", rxd);
+	seq_printf(s, "rx max queued:     %u\n", stats.rx_depth_max);
+
+	mbox_hist_show(s, "tx busy-poll time", &stats.tx_poll);
+	mbox_hist_show(s, "rx irq to delivery", &stats.rx_lag);
+
+	return 0;
+}
+
+static int mbox_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mbox_stats_show, inode->i_private);
+}
+
+static const struct file_operations mbox_stats_ops = {
+	.open = mbox_stats_open,
+	.read = seq_read,
+	.llseek	= seq_lseek,
+	.release = single_release,
+};
+
 int omap_mbox_register(struct device *parent, struct omap_mbox **list)
 {
 	int ret;
@@ -376,12 +659,19 @@ int omap_mbox_register(struct device *parent, struct omap_mbox **list)
 		}
 
 		BLOCKING_INIT_NOTIFIER_HEAD(&mbox->notifier);
+		init_rwsem(&mbox->handlers_sem);
+
+		if (mbox_dbg_dir)
+			mbox->dbg_file = debugfs_create_file(mbox->name,
+				0400, mbox_dbg_dir, mbox, &mbox_stats_ops);
 	}
 	return 0;
 
 err_out:
-	while (i--)
+	while (i--) {
+		debugfs_remove(mboxes[i]->dbg_file);
 		device_unregister(mboxes[i]->dev);
+	}
 	return ret;
 }
 EXPORT_SYMBOL(omap_mbox_register);
@@ -393,8 +683,10 @@ int omap_mbox_unregister(void)
 	if (!mboxes)
 		return -EINVAL;
 
-	for (i = 0; mboxes[i]; i++)
+	for (i = 0; mboxes[i]; i++) {
+		debugfs_remove(mboxes[i]->dbg_file);
 		device_unregister(mboxes[i]->dev);
+	}
 	mboxes = NULL;
 	return 0;
 }
@@ -408,6 +700,12 @@ static int __init omap_mbox_init(void)
 	if (err)
 		return err;
 
+	if (debugfs_initialized()) {
+		mbox_dbg_dir = debugfs_create_dir("omap_mailbox", NULL);
+		if (!mbox_dbg_dir)
+			pr_err("can't create debugfs dir\n");
+	}
+
 	/* kfifo size sanity check: alignment and minimal size */
 	mbox_kfifo_size = ALIGN(mbox_kfifo_size, sizeof(mbox_msg_t));
 	mbox_kfifo_size = max_t(unsigned int, mbox_kfifo_size,
@@ -419,6 +717,7 @@ subsys_initcall(omap_mbox_init);
 
 static void __exit omap_mbox_exit(void)
 {
+	debugfs_remove(mbox_dbg_dir);
 	class_unregister(&omap_mbox_class);
 }
 module_exit(omap_mbox_exit);
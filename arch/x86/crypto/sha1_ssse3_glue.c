@@ -0,0 +1,215 @@
+/*
+ * SHA-1 with the message schedule computed by SSSE3 instructions.
+ * This file contains glue code.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/cryptohash.h>
+#include <linux/types.h>
+#include <crypto/internal/hash.h>
+#include <crypto/sha.h>
+#include <asm/byteorder.h>
+#include <asm/i387.h>
+
+asmlinkage void sha1_schedule_ssse3(u32 *W, const u8 *data);
+
+#define f1(x, y, z)	(z ^ (x & (y ^ z)))		/* x ? y : z */
+#define f2(x, y, z)	(x ^ y ^ z)			/* XOR */
+#define f3(x, y, z)	((x & y) + (z & (x ^ y)))	/* majority */
+
+#define K1	0x5A827999L
+#define K2	0x6ED9EBA1L
+#define K3	0x8F1BBCDCL
+#define K4	0xCA62C1D6L
+
+/* one round, the callers rotate the variables instead of moving them */
+#define R(a, b, c, d, e, f, k, i) do {				\
+	e += rol32(a, 5) + f(b, c, d) + k + W[i];		\
+	b = rol32(b, 30);					\
+} while (0)
+
+#define R5(f, k, i) do {					\
+	R(a, b, c, d, e, f, k, i);				\
+	R(e, a, b, c, d, f, k, i + 1);				\
+	R(d, e, a, b, c, f, k, i + 2);				\
+	R(c, d, e, a, b, f, k, i + 3);				\
+	R(b, c, d, e, a, f, k, i + 4);				\
+} while (0)
+
+static void sha1_rounds(u32 *state, const u32 *W)
+{
+	u32 a = state[0], b = state[1], c = state[2], d = state[3],
+	    e = state[4];
+	int i;
+
+	for (i = 0; i < 20; i += 5)
+		R5(f1, K1, i);
+	for (; i < 40; i += 5)
+		R5(f2, K2, i);
+	for (; i < 60; i += 5)
+		R5(f3, K3, i);
+	for (; i < 80; i += 5)
+		R5(f2, K4, i);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void sha1_ssse3_transform(u32 *state, const u8 *data,
+				 unsigned int blocks)
+{
+	u32 W[SHA_WORKSPACE_WORDS] __aligned(16);
+
+	if (irq_fpu_usable()) {
+		kernel_fpu_begin();
+		for (; blocks; blocks--, data += SHA1_BLOCK_SIZE) {
+			sha1_schedule_ssse3(W, data);
+			sha1_rounds(state, W);
+		}
+		kernel_fpu_end();
+	} else {
+		for (; blocks; blocks--, data += SHA1_BLOCK_SIZE)
+			sha_transform(state, (const char *)data, W);
+	}
+
+	memset(W, 0, sizeof(W));
+}
+
+static int sha1_ssse3_init(struct shash_desc *desc)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+
+	*sctx = (struct sha1_state){
+		.state = { SHA1_H0, SHA1_H1, SHA1_H2, SHA1_H3, SHA1_H4 },
+	};
+
+	return 0;
+}
+
+static int sha1_ssse3_update(struct shash_desc *desc, const u8 *data,
+			     unsigned int len)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+	unsigned int partial = sctx->count % SHA1_BLOCK_SIZE;
+	unsigned int blocks;
+
+	sctx->count += len;
+
+	if (partial && partial + len >= SHA1_BLOCK_SIZE) {
+		unsigned int fill = SHA1_BLOCK_SIZE - partial;
+
+		memcpy(sctx->buffer + partial, data, fill);
+		sha1_ssse3_transform(sctx->state, sctx->buffer, 1);
+		data += fill;
+		len -= fill;
+		partial = 0;
+	}
+
+	blocks = len / SHA1_BLOCK_SIZE;
+	if (blocks) {
+		sha1_ssse3_transform(sctx->state, data, blocks);
+		data += blocks * SHA1_BLOCK_SIZE;
+		len -= blocks * SHA1_BLOCK_SIZE;
+	}
+
+	memcpy(sctx->buffer + partial, data, len);
+
+	return 0;
+}
+
+/* Add padding and return the message digest. */
+static int sha1_ssse3_final(struct shash_desc *desc, u8 *out)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+	__be32 *dst = (__be32 *)out;
+	u32 i, index, padlen;
+	__be64 bits;
+	static const u8 padding[64] = { 0x80, };
+
+	bits = cpu_to_be64(sctx->count << 3);
+
+	/* Pad out to 56 mod 64 */
+	index = sctx->count & 0x3f;
+	padlen = (index < 56) ? (56 - index) : ((64+56) - index);
+	sha1_ssse3_update(desc, padding, padlen);
+
+	/* Append length */
+	sha1_ssse3_update(desc, (const u8 *)&bits, sizeof(bits));
+
+	/* Store state in digest */
+	for (i = 0; i < 5; i++)
+		dst[i] = cpu_to_be32(sctx->state[i]);
+
+	/* Wipe context */
+	memset(sctx, 0, sizeof(*sctx));
+
+	return 0;
+}
+
+static int sha1_ssse3_export(struct shash_desc *desc, void *out)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+
+	memcpy(out, sctx, sizeof(*sctx));
+	return 0;
+}
+
+static int sha1_ssse3_import(struct shash_desc *desc, const void *in)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+
+	memcpy(sctx, in, sizeof(*sctx));
+	return 0;
+}
+
+static struct shash_alg alg = {
+	.digestsize	=	SHA1_DIGEST_SIZE,
+	.init		=	sha1_ssse3_init,
+	.update		=	sha1_ssse3_update,
+	.final		=	sha1_ssse3_final,
+	.export		=	sha1_ssse3_export,
+	.import		=	sha1_ssse3_import,
+	.descsize	=	sizeof(struct sha1_state),
+	.statesize	=	sizeof(struct sha1_state),
+	.base		=	{
+		.cra_name	=	"sha1",
+		.cra_driver_name=	"sha1-ssse3",
+		.cra_priority	=	150,
+		.cra_flags	=	CRYPTO_ALG_TYPE_SHASH,
+		.cra_blocksize	=	SHA1_BLOCK_SIZE,
+		.cra_module	=	THIS_MODULE,
+	}
+};
+
+static int __init sha1_ssse3_mod_init(void)
+{
+	if (!boot_cpu_has(X86_FEATURE_SSSE3)) {
+		printk(KERN_INFO "SSSE3 instructions are not detected.\n");
+		return -ENODEV;
+	}
+
+	return crypto_register_shash(&alg);
+}
+
+static void __exit sha1_ssse3_mod_fini(void)
+{
+	crypto_unregister_shash(&alg);
+}
+
+module_init(sha1_ssse3_mod_init);
+module_exit(sha1_ssse3_mod_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SHA1 Secure Hash Algorithm, SSSE3 accelerated");
+
+MODULE_ALIAS("sha1");
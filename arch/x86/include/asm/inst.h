@@ -152,6 +152,16 @@
 	MODRM 0xc0 pshufb_opd1 pshufb_opd2
 	.endm
 
+	.macro PALIGNR imm8 xmm1 xmm2
+	XMM_NUM palignr_opd1 \xmm1
+	XMM_NUM palignr_opd2 \xmm2
+	PFX_OPD_SIZE
+	PFX_REX palignr_opd1 palignr_opd2
+	.byte 0x0f, 0x3a, 0x0f
+	MODRM 0xc0 palignr_opd1 palignr_opd2
+	.byte \imm8
+	.endm
+
 	.macro PCLMULQDQ imm8 xmm1 xmm2
 	XMM_NUM clmul_opd1 \xmm1
 	XMM_NUM clmul_opd2 \xmm2
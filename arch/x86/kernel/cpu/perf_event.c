@@ -130,6 +130,8 @@ struct cpu_hw_events {
 	void				*lbr_context;
 	struct perf_branch_stack	lbr_stack;
 	struct perf_branch_entry	lbr_entries[MAX_LBR_ENTRIES];
+	struct perf_branch_stack	lbr_filter_stack;
+	struct perf_branch_entry	lbr_filter_entries[MAX_LBR_ENTRIES];
 
 	/*
 	 * Intel percore register state.
@@ -654,6 +656,17 @@ static int x86_pmu_hw_config(struct perf_event *event)
 			return -EOPNOTSUPP;
 	}
 
+	if (has_branch_stack(event)) {
+		/* Branch stacks come from the LBR only */
+		if (!x86_pmu.lbr_nr)
+			return -EOPNOTSUPP;
+
+		/* The LBR is not programmed to filter on branch type */
+		if ((event->attr.branch_sample_type &
+		     ~PERF_SAMPLE_BRANCH_PLM_ALL) != PERF_SAMPLE_BRANCH_ANY)
+			return -EOPNOTSUPP;
+	}
+
 	/*
 	 * Generate PMC IRQs:
 	 * (keep 'enabled' bit clear for now)
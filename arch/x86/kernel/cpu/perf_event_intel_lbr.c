@@ -7,6 +7,15 @@ enum {
 	LBR_FORMAT_EIP_FLAGS	= 0x03,
 };
 
+static inline bool kernel_ip(unsigned long ip)
+{
+#ifdef CONFIG_X86_32
+	return ip > PAGE_OFFSET;
+#else
+	return (long)ip < 0;
+#endif
+}
+
 /*
  * We only support LBR implementations that have FREEZE_LBRS_ON_PMI
  * otherwise it becomes near impossible to get a reliable stack.
@@ -191,6 +200,43 @@ static void intel_pmu_lbr_read(void)
 		intel_pmu_lbr_read_64(cpuc);
 }
 
+static bool intel_pmu_lbr_plm_ok(u64 ip, u64 br_type)
+{
+	if (kernel_ip(ip))
+		return br_type & PERF_SAMPLE_BRANCH_KERNEL;
+
+	return br_type & PERF_SAMPLE_BRANCH_USER;
+}
+
+/*
+ * The LBR records branches at all privilege levels, so hand an event
+ * only the branches whose source and target both lie at the levels it
+ * asked for; a user-only event must not see kernel addresses.
+ */
+static struct perf_branch_stack *
+intel_pmu_lbr_filter(struct cpu_hw_events *cpuc, struct perf_event *event)
+{
+	u64 br_type = event->attr.branch_sample_type;
+	int i, n = 0;
+
+	for (i = 0; i < cpuc->lbr_stack.nr; i++) {
+		struct perf_branch_entry *br = &cpuc->lbr_entries[i];
+
+		/* slots not written since the last reset */
+		if (!br->from && !br->to)
+			continue;
+
+		if (!intel_pmu_lbr_plm_ok(br->from, br_type) ||
+		    !intel_pmu_lbr_plm_ok(br->to, br_type))
+			continue;
+
+		cpuc->lbr_filter_entries[n++] = *br;
+	}
+	cpuc->lbr_filter_stack.nr = n;
+
+	return &cpuc->lbr_filter_stack;
+}
+
 static void intel_pmu_lbr_init_core(void)
 {
 	x86_pmu.lbr_nr     = 4;
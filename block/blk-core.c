@@ -285,6 +285,7 @@ EXPORT_SYMBOL(blk_stop_queue);
 void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
+	hrtimer_cancel(&q->flush_merge_timer);
 	cancel_delayed_work_sync(&q->delay_work);
 }
 EXPORT_SYMBOL(blk_sync_queue);
@@ -438,6 +439,7 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	INIT_LIST_HEAD(&q->flush_queue[0]);
 	INIT_LIST_HEAD(&q->flush_queue[1]);
 	INIT_LIST_HEAD(&q->flush_data_in_flight);
+	blk_flush_init_queue(q);
 	INIT_DELAYED_WORK(&q->delay_work, blk_delay_work);
 
 	kobject_init(&q->kobj, &blk_queue_ktype);
@@ -1280,8 +1282,7 @@ get_rq:
 
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
 	    bio_flagged(bio, BIO_CPU_AFFINE)) {
-		req->cpu = blk_cpu_to_group(get_cpu());
-		put_cpu();
+		req->cpu = raw_smp_processor_id();
 	}
 
 	plug = current->plug;
@@ -1597,6 +1598,38 @@ void generic_make_request(struct bio *bio)
 }
 EXPORT_SYMBOL(generic_make_request);
 
+/**
+ * blk_poll - spin on the completions of a queue
+ * @q:		the queue
+ *
+ * Description:
+ *    Instead of sleeping until the interrupt of a fast device, a
+ *    synchronous submitter may spin on the completions of the device with
+ *    this, if the driver supports it and io_poll is enabled for the queue.
+ *    It's called in place of io_schedule(), with the task state already
+ *    set for sleeping, and returns true once the end_io handler of the I/O
+ *    woke the task up. It gives up (returning false) as soon as something
+ *    else needs the CPU, or after a jiffy at worst, and the caller then
+ *    sleeps as usual.
+ */
+bool blk_poll(struct request_queue *q)
+{
+	unsigned long timeout = jiffies + 1;
+
+	if (!q->poll_fn || !blk_queue_poll(q))
+		return false;
+
+	while (!need_resched() && time_before_eq(jiffies, timeout)) {
+		q->poll_fn(q);
+		if (current->state == TASK_RUNNING)
+			return true;
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 /**
  * submit_bio - submit a bio to the block device layer for I/O
  * @rw: whether to %READ or %WRITE, or maybe to %READA (read ahead)
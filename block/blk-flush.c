@@ -49,6 +49,12 @@
  *     starvation in the unlikely case where there are continuous stream of
  *     FUA (without FLUSH) requests.
  *
+ * C4. If q->flush_merge_us is set (through the flush_merge_us sysfs
+ *     attribute), flush is deferred until the first pending request has
+ *     waited that long, so that the flushes of concurrent fsync()ers
+ *     arriving meanwhile are gathered into a single one.  The
+ *     flush_merge_timer issues the flush once the window has passed.
+ *
  * For devices which support FUA, it isn't clear whether C2 (and thus C3)
  * is beneficial.
  *
@@ -69,6 +75,7 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/gfp.h>
+#include <linux/hrtimer.h>
 
 #include "blk.h"
 
@@ -159,9 +166,13 @@ static bool blk_flush_complete_seq(struct request *rq, unsigned int seq,
 	case REQ_FSEQ_PREFLUSH:
 	case REQ_FSEQ_POSTFLUSH:
 		/* queue for flush */
-		if (list_empty(pending))
+		if (list_empty(pending)) {
 			q->flush_pending_since = jiffies;
+			if (q->flush_merge_us)
+				q->flush_pending_stamp = ktime_get();
+		}
 		list_move_tail(&rq->flush.list, pending);
+		q->flush_requested++;
 		break;
 
 	case REQ_FSEQ_DATA:
@@ -250,6 +261,19 @@ static bool blk_kick_flush(struct request_queue *q)
 	if (q->flush_pending_idx != q->flush_running_idx || list_empty(pending))
 		return false;
 
+	/* C4 */
+	if (q->flush_merge_us) {
+		ktime_t expires = ktime_add_us(q->flush_pending_stamp,
+					       q->flush_merge_us);
+
+		if (ktime_to_ns(ktime_sub(expires, ktime_get())) > 0) {
+			if (!hrtimer_active(&q->flush_merge_timer))
+				hrtimer_start(&q->flush_merge_timer, expires,
+					      HRTIMER_MODE_ABS);
+			return false;
+		}
+	}
+
 	/* C2 and C3 */
 	if (!list_empty(&q->flush_data_in_flight) &&
 	    time_before(jiffies,
@@ -268,9 +292,31 @@ static bool blk_kick_flush(struct request_queue *q)
 
 	q->flush_pending_idx ^= 1;
 	list_add_tail(&q->flush_rq.queuelist, &q->queue_head);
+	q->flush_issued++;
 	return true;
 }
 
+/* The flush gathering window (C4) has passed, issue the flush now */
+static enum hrtimer_restart blk_flush_merge_timer_fn(struct hrtimer *timer)
+{
+	struct request_queue *q = container_of(timer, struct request_queue,
+					       flush_merge_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	if (blk_kick_flush(q))
+		blk_run_queue_async(q);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+void blk_flush_init_queue(struct request_queue *q)
+{
+	hrtimer_init(&q->flush_merge_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	q->flush_merge_timer.function = blk_flush_merge_timer_fn;
+}
+
 static void flush_data_end_io(struct request *rq, int error)
 {
 	struct request_queue *q = rq->q;
@@ -81,6 +81,23 @@ void blk_queue_softirq_done(struct request_queue *q, softirq_done_fn *fn)
 }
 EXPORT_SYMBOL(blk_queue_softirq_done);
 
+/**
+ * blk_queue_poll_fn - set the completion polling function of a queue
+ * @q:		queue
+ * @fn:		the function, which reaps the completions of the hardware
+ *		queue of the calling CPU, and returns how many it found
+ *
+ * Description:
+ *    A driver that can reap its completions without waiting for an
+ *    interrupt sets this, and polling then may be enabled through the
+ *    io_poll sysfs attribute of the queue (see blk_poll()).
+ */
+void blk_queue_poll_fn(struct request_queue *q, poll_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL(blk_queue_poll_fn);
+
 void blk_queue_rq_timeout(struct request_queue *q, unsigned int timeout)
 {
 	q->rq_timeout = timeout;
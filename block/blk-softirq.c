@@ -36,45 +36,97 @@ static void blk_done_softirq(struct softirq_action *h)
 }
 
 #if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+/*
+ * Completions sent to another CPU are queued on its remote list, and only
+ * the request that finds the list empty sends the IPI: the whole batch
+ * queued up until the IPI is handled is then completed with it.
+ */
+struct blk_remote_done {
+	spinlock_t		lock;
+	struct list_head	list;
+	struct call_single_data	csd;
+};
+
+static DEFINE_PER_CPU(struct blk_remote_done, blk_remote_done);
+
 static void trigger_softirq(void *data)
 {
-	struct request *rq = data;
+	struct blk_remote_done *rd = data;
 	unsigned long flags;
 	struct list_head *list;
 
 	local_irq_save(flags);
 	list = &__get_cpu_var(blk_cpu_done);
-	list_add_tail(&rq->csd.list, list);
 
-	if (list->next == &rq->csd.list)
+	spin_lock(&rd->lock);
+	list_splice_tail_init(&rd->list, list);
+	spin_unlock(&rd->lock);
+
+	if (!list_empty(list))
 		raise_softirq_irqoff(BLOCK_SOFTIRQ);
 
 	local_irq_restore(flags);
 }
 
 /*
- * Setup and invoke a run of 'trigger_softirq' on the given cpu.
+ * Queue the request on the given cpu, and invoke a run of
+ * 'trigger_softirq' there if it's the first one of a batch.
  */
 static int raise_blk_irq(int cpu, struct request *rq)
 {
 	if (cpu_online(cpu)) {
-		struct call_single_data *data = &rq->csd;
+		struct blk_remote_done *rd = &per_cpu(blk_remote_done, cpu);
+		bool first;
 
-		data->func = trigger_softirq;
-		data->info = rq;
-		data->flags = 0;
+		spin_lock(&rd->lock);
+		first = list_empty(&rd->list);
+		list_add_tail(&rq->csd.list, &rd->list);
+		spin_unlock(&rd->lock);
 
-		__smp_call_function_single(cpu, data, 0);
+		/*
+		 * If the previous batch's IPI is still being handled, this
+		 * waits for it to release the csd.
+		 */
+		if (first)
+			__smp_call_function_single(cpu, &rd->csd, 0);
 		return 0;
 	}
 
 	return 1;
 }
+
+static void blk_remote_done_init(int cpu)
+{
+	struct blk_remote_done *rd = &per_cpu(blk_remote_done, cpu);
+
+	spin_lock_init(&rd->lock);
+	INIT_LIST_HEAD(&rd->list);
+	rd->csd.func = trigger_softirq;
+	rd->csd.info = rd;
+	rd->csd.flags = 0;
+}
+
+static void blk_remote_done_splice(int cpu)
+{
+	struct blk_remote_done *rd = &per_cpu(blk_remote_done, cpu);
+
+	spin_lock(&rd->lock);
+	list_splice_tail_init(&rd->list, &__get_cpu_var(blk_cpu_done));
+	spin_unlock(&rd->lock);
+}
 #else /* CONFIG_SMP && CONFIG_USE_GENERIC_SMP_HELPERS */
 static int raise_blk_irq(int cpu, struct request *rq)
 {
 	return 1;
 }
+
+static inline void blk_remote_done_init(int cpu)
+{
+}
+
+static inline void blk_remote_done_splice(int cpu)
+{
+}
 #endif
 
 static int __cpuinit blk_cpu_notify(struct notifier_block *self,
@@ -90,6 +142,7 @@ static int __cpuinit blk_cpu_notify(struct notifier_block *self,
 		local_irq_disable();
 		list_splice_init(&per_cpu(blk_cpu_done, cpu),
 				 &__get_cpu_var(blk_cpu_done));
+		blk_remote_done_splice(cpu);
 		raise_softirq_irqoff(BLOCK_SOFTIRQ);
 		local_irq_enable();
 	}
@@ -105,23 +158,26 @@ void __blk_complete_request(struct request *req)
 {
 	struct request_queue *q = req->q;
 	unsigned long flags;
-	int ccpu, cpu, group_cpu;
+	int ccpu, cpu;
+	bool shared = false;
 
 	BUG_ON(!q->softirq_done_fn);
 
 	local_irq_save(flags);
 	cpu = smp_processor_id();
-	group_cpu = blk_cpu_to_group(cpu);
 
 	/*
-	 * Select completion CPU
+	 * Select completion CPU: the submitting one, or with SAME_COMP
+	 * alone, any CPU of its group.
 	 */
-	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) && req->cpu != -1)
+	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) && req->cpu != -1) {
 		ccpu = req->cpu;
-	else
+		if (!test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags))
+			shared = blk_cpu_to_group(ccpu) == blk_cpu_to_group(cpu);
+	} else
 		ccpu = cpu;
 
-	if (ccpu == cpu || ccpu == group_cpu) {
+	if (ccpu == cpu || shared) {
 		struct list_head *list;
 do_local:
 		list = &__get_cpu_var(blk_cpu_done);
@@ -165,8 +221,10 @@ static __init int blk_softirq_init(void)
 {
 	int i;
 
-	for_each_possible_cpu(i)
+	for_each_possible_cpu(i) {
 		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i));
+		blk_remote_done_init(i);
+	}
 
 	open_softirq(BLOCK_SOFTIRQ, blk_done_softirq);
 	register_hotcpu_notifier(&blk_cpu_notifier);
@@ -51,6 +51,7 @@ static inline void blk_clear_rq_complete(struct request *rq)
 
 void blk_insert_flush(struct request *rq);
 void blk_abort_flushes(struct request_queue *q);
+void blk_flush_init_queue(struct request_queue *q);
 
 static inline struct request *__elv_next_request(struct request_queue *q)
 {
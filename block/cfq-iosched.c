@@ -287,6 +287,7 @@ struct cfq_data {
 	unsigned int cfq_slice_idle;
 	unsigned int cfq_group_idle;
 	unsigned int cfq_latency;
+	unsigned int cfq_nonrot_lite;
 
 	unsigned int cic_index;
 	struct list_head cic_list;
@@ -394,8 +395,20 @@ CFQ_CFQQ_FNS(wait_busy);
 			&cfqg->service_trees[i][j]: NULL) \
 
 
+/*
+ * Lightweight mode for non-rotational devices: no idling at all, and no
+ * seek optimizations, but still fairness between groups (in IOPS mode).
+ */
+static inline bool cfq_lite(struct cfq_data *cfqd)
+{
+	return cfqd->cfq_nonrot_lite && blk_queue_nonrot(cfqd->queue);
+}
+
 static inline bool iops_mode(struct cfq_data *cfqd)
 {
+	if (cfq_lite(cfqd))
+		return true;
+
 	/*
 	 * If we are not idling on queues and it is a NCQ drive, parallel
 	 * execution of requests is on and measuring time is not possible
@@ -673,6 +686,10 @@ cfq_choose_req(struct cfq_data *cfqd, struct request *rq1, struct request *rq2,
 	if ((rq1->cmd_flags ^ rq2->cmd_flags) & REQ_META)
 		return rq1->cmd_flags & REQ_META ? rq1 : rq2;
 
+	/* Seeks are free, keep the current choice */
+	if (cfq_lite(cfqd))
+		return rq1;
+
 	s1 = blk_rq_pos(rq1);
 	s2 = blk_rq_pos(rq2);
 
@@ -1404,6 +1421,9 @@ static void cfq_prio_tree_add(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 		return;
 	if (!cfqq->next_rq)
 		return;
+	/* No cooperating queues to look for */
+	if (cfq_lite(cfqd))
+		return;
 
 	cfqq->p_root = &cfqd->prio_trees[cfqq->org_ioprio];
 	__cfqq = cfq_prio_tree_lookup(cfqd, cfqq->p_root,
@@ -1897,6 +1917,8 @@ static struct cfq_queue *cfq_close_cooperator(struct cfq_data *cfqd,
 {
 	struct cfq_queue *cfqq;
 
+	if (cfq_lite(cfqd))
+		return NULL;
 	if (cfq_class_idle(cur_cfqq))
 		return NULL;
 	if (!cfq_cfqq_sync(cur_cfqq))
@@ -1952,7 +1974,7 @@ static bool cfq_should_idle(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	BUG_ON(!service_tree);
 	BUG_ON(!service_tree->count);
 
-	if (!cfqd->cfq_slice_idle)
+	if (!cfqd->cfq_slice_idle || cfq_lite(cfqd))
 		return false;
 
 	/* We never do for idle class queues. */
@@ -1986,7 +2008,7 @@ static void cfq_arm_slice_timer(struct cfq_data *cfqd)
 	 * for devices that support queuing, otherwise we still have a problem
 	 * with sync vs async workloads.
 	 */
-	if (blk_queue_nonrot(cfqd->queue) && cfqd->hw_tag)
+	if ((blk_queue_nonrot(cfqd->queue) && cfqd->hw_tag) || cfq_lite(cfqd))
 		return;
 
 	WARN_ON(!RB_EMPTY_ROOT(&cfqq->sort_list));
@@ -2380,8 +2402,8 @@ static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
 	 * this group, wait for requests to complete.
 	 */
 check_group_idle:
-	if (cfqd->cfq_group_idle && cfqq->cfqg->nr_cfqq == 1
-	    && cfqq->cfqg->dispatched) {
+	if (cfqd->cfq_group_idle && !cfq_lite(cfqd) &&
+	    cfqq->cfqg->nr_cfqq == 1 && cfqq->cfqg->dispatched) {
 		cfqq = NULL;
 		goto keep_queue;
 	}
@@ -3508,6 +3530,10 @@ static bool cfq_should_wait_busy(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	if (!RB_EMPTY_ROOT(&cfqq->sort_list))
 		return false;
 
+	/* Nor if we don't idle at all */
+	if (cfq_lite(cfqd))
+		return false;
+
 	/* If there are other queues in the group, don't wait */
 	if (cfqq->cfqg->nr_cfqq > 1)
 		return false;
@@ -4059,6 +4085,7 @@ static void *cfq_init_queue(struct request_queue *q)
 	cfqd->cfq_slice_idle = cfq_slice_idle;
 	cfqd->cfq_group_idle = cfq_group_idle;
 	cfqd->cfq_latency = 1;
+	cfqd->cfq_nonrot_lite = 0;
 	cfqd->hw_tag = -1;
 	/*
 	 * we optimistically start assuming sync ops weren't delayed in last
@@ -4134,6 +4161,7 @@ SHOW_FUNCTION(cfq_slice_sync_show, cfqd->cfq_slice[1], 1);
 SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice[0], 1);
 SHOW_FUNCTION(cfq_slice_async_rq_show, cfqd->cfq_slice_async_rq, 0);
 SHOW_FUNCTION(cfq_low_latency_show, cfqd->cfq_latency, 0);
+SHOW_FUNCTION(cfq_nonrot_lite_show, cfqd->cfq_nonrot_lite, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -4167,6 +4195,7 @@ STORE_FUNCTION(cfq_slice_async_store, &cfqd->cfq_slice[0], 1, UINT_MAX, 1);
 STORE_FUNCTION(cfq_slice_async_rq_store, &cfqd->cfq_slice_async_rq, 1,
 		UINT_MAX, 0);
 STORE_FUNCTION(cfq_low_latency_store, &cfqd->cfq_latency, 0, 1, 0);
+STORE_FUNCTION(cfq_nonrot_lite_store, &cfqd->cfq_nonrot_lite, 0, 1, 0);
 #undef STORE_FUNCTION
 
 #define CFQ_ATTR(name) \
@@ -4184,6 +4213,7 @@ static struct elv_fs_entry cfq_attrs[] = {
 	CFQ_ATTR(slice_idle),
 	CFQ_ATTR(group_idle),
 	CFQ_ATTR(low_latency),
+	CFQ_ATTR(nonrot_lite),
 	__ATTR_NULL
 };
 
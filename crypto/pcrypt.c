@@ -27,6 +27,7 @@
 #include <linux/notifier.h>
 #include <linux/kobject.h>
 #include <linux/cpu.h>
+#include <linux/topology.h>
 #include <crypto/pcrypt.h>
 
 struct padata_pcrypt {
@@ -53,12 +54,28 @@ struct padata_pcrypt {
 		cpumask_var_t mask;
 	} *cb_cpumask;
 	struct notifier_block nblock;
+	char name[16];
 };
 
 static struct padata_pcrypt pencrypt;
 static struct padata_pcrypt pdecrypt;
 static struct kset           *pcrypt_kset;
 
+/*
+ * With numa_local, each node with cpus also gets its own pair of padata
+ * instances, restricted to the cpus of that node. A tfm sticks to the
+ * node it is first used on, so that its requests are still serialized
+ * by a single instance, and are processed close to where they were
+ * submitted (and their data is).
+ */
+static bool numa_local;
+module_param(numa_local, bool, 0444);
+MODULE_PARM_DESC(numa_local, "Process requests on the cpus of the node "
+		 "they are submitted on");
+
+static struct padata_pcrypt **pencrypt_node;
+static struct padata_pcrypt **pdecrypt_node;
+
 struct pcrypt_instance_ctx {
 	struct crypto_spawn spawn;
 	unsigned int tfm_count;
@@ -67,6 +84,7 @@ struct pcrypt_instance_ctx {
 struct pcrypt_aead_ctx {
 	struct crypto_aead *child;
 	unsigned int cb_cpu;
+	int node;
 };
 
 static int pcrypt_do_parallel(struct padata_priv *padata, unsigned int *cb_cpu,
@@ -98,6 +116,34 @@ out:
 	return padata_do_parallel(pcrypt->pinst, padata, cpu);
 }
 
+static int pcrypt_do_parallel_node(struct padata_priv *padata,
+				   struct pcrypt_aead_ctx *ctx,
+				   struct padata_pcrypt *pcrypt,
+				   struct padata_pcrypt **pcrypt_node)
+{
+	struct padata_pcrypt *local;
+	int node, err;
+
+	if (!pcrypt_node)
+		return pcrypt_do_parallel(padata, &ctx->cb_cpu, pcrypt);
+
+	node = ctx->node;
+	if (node == NUMA_NO_NODE) {
+		cmpxchg(&ctx->node, NUMA_NO_NODE, numa_node_id());
+		node = ctx->node;
+	}
+
+	local = pcrypt_node[node];
+	if (local) {
+		err = pcrypt_do_parallel(padata, &ctx->cb_cpu, local);
+		/* unless all the cpus of the node went away */
+		if (err != -EINVAL)
+			return err;
+	}
+
+	return pcrypt_do_parallel(padata, &ctx->cb_cpu, pcrypt);
+}
+
 static int pcrypt_aead_setkey(struct crypto_aead *parent,
 			      const u8 *key, unsigned int keylen)
 {
@@ -177,7 +223,7 @@ static int pcrypt_aead_encrypt(struct aead_request *req)
 			       req->cryptlen, req->iv);
 	aead_request_set_assoc(creq, req->assoc, req->assoclen);
 
-	err = pcrypt_do_parallel(padata, &ctx->cb_cpu, &pencrypt);
+	err = pcrypt_do_parallel_node(padata, ctx, &pencrypt, pencrypt_node);
 	if (!err)
 		return -EINPROGRESS;
 
@@ -219,7 +265,7 @@ static int pcrypt_aead_decrypt(struct aead_request *req)
 			       req->cryptlen, req->iv);
 	aead_request_set_assoc(creq, req->assoc, req->assoclen);
 
-	err = pcrypt_do_parallel(padata, &ctx->cb_cpu, &pdecrypt);
+	err = pcrypt_do_parallel_node(padata, ctx, &pdecrypt, pdecrypt_node);
 	if (!err)
 		return -EINPROGRESS;
 
@@ -263,7 +309,7 @@ static int pcrypt_aead_givencrypt(struct aead_givcrypt_request *req)
 	aead_givcrypt_set_assoc(creq, areq->assoc, areq->assoclen);
 	aead_givcrypt_set_giv(creq, req->giv, req->seq);
 
-	err = pcrypt_do_parallel(padata, &ctx->cb_cpu, &pencrypt);
+	err = pcrypt_do_parallel_node(padata, ctx, &pencrypt, pencrypt_node);
 	if (!err)
 		return -EINPROGRESS;
 
@@ -286,6 +332,8 @@ static int pcrypt_aead_init_tfm(struct crypto_tfm *tfm)
 	for (cpu = 0; cpu < cpu_index; cpu++)
 		ctx->cb_cpu = cpumask_next(ctx->cb_cpu, cpu_active_mask);
 
+	ctx->node = NUMA_NO_NODE;
+
 	cipher = crypto_spawn_aead(crypto_instance_ctx(inst));
 
 	if (IS_ERR(cipher))
@@ -448,19 +496,20 @@ static int pcrypt_sysfs_add(struct padata_instance *pinst, const char *name)
 }
 
 static int pcrypt_init_padata(struct padata_pcrypt *pcrypt,
-			      const char *name)
+			      const char *name, const struct cpumask *cpumask)
 {
 	int ret = -ENOMEM;
 	struct pcrypt_cpumask *mask;
 
 	get_online_cpus();
 
-	pcrypt->wq = alloc_workqueue(name,
+	strlcpy(pcrypt->name, name, sizeof(pcrypt->name));
+	pcrypt->wq = alloc_workqueue(pcrypt->name,
 				     WQ_MEM_RECLAIM | WQ_CPU_INTENSIVE, 1);
 	if (!pcrypt->wq)
 		goto err;
 
-	pcrypt->pinst = padata_alloc_possible(pcrypt->wq);
+	pcrypt->pinst = padata_alloc(pcrypt->wq, cpumask, cpumask);
 	if (!pcrypt->pinst)
 		goto err_destroy_workqueue;
 
@@ -472,7 +521,7 @@ static int pcrypt_init_padata(struct padata_pcrypt *pcrypt,
 		goto err_free_padata;
 	}
 
-	cpumask_and(mask->mask, cpu_possible_mask, cpu_active_mask);
+	cpumask_and(mask->mask, cpumask, cpu_active_mask);
 	rcu_assign_pointer(pcrypt->cb_cpumask, mask);
 
 	pcrypt->nblock.notifier_call = pcrypt_cpumask_change_notify;
@@ -480,7 +529,7 @@ static int pcrypt_init_padata(struct padata_pcrypt *pcrypt,
 	if (ret)
 		goto err_free_cpumask;
 
-	ret = pcrypt_sysfs_add(pcrypt->pinst, name);
+	ret = pcrypt_sysfs_add(pcrypt->pinst, pcrypt->name);
 	if (ret)
 		goto err_unregister_notifier;
 
@@ -514,6 +563,61 @@ static void pcrypt_fini_padata(struct padata_pcrypt *pcrypt)
 	padata_free(pcrypt->pinst);
 }
 
+static void pcrypt_fini_padata_node(struct padata_pcrypt **pcrypt_node)
+{
+	int node;
+
+	if (!pcrypt_node)
+		return;
+
+	for (node = 0; node < nr_node_ids; node++) {
+		if (!pcrypt_node[node])
+			continue;
+		pcrypt_fini_padata(pcrypt_node[node]);
+		kfree(pcrypt_node[node]);
+	}
+	kfree(pcrypt_node);
+}
+
+static struct padata_pcrypt **pcrypt_init_padata_node(const char *name)
+{
+	struct padata_pcrypt **pcrypt_node;
+	char node_name[16];
+	int node, err;
+
+	pcrypt_node = kcalloc(nr_node_ids, sizeof(*pcrypt_node), GFP_KERNEL);
+	if (!pcrypt_node)
+		return ERR_PTR(-ENOMEM);
+
+	for_each_online_node(node) {
+		const struct cpumask *cpumask = cpumask_of_node(node);
+
+		if (!cpumask_intersects(cpumask, cpu_active_mask))
+			continue;
+
+		err = -ENOMEM;
+		pcrypt_node[node] = kzalloc(sizeof(**pcrypt_node), GFP_KERNEL);
+		if (!pcrypt_node[node])
+			goto err;
+
+		snprintf(node_name, sizeof(node_name), "%s.%d", name, node);
+		err = pcrypt_init_padata(pcrypt_node[node], node_name,
+					 cpumask);
+		if (err) {
+			kfree(pcrypt_node[node]);
+			pcrypt_node[node] = NULL;
+			goto err;
+		}
+		padata_start(pcrypt_node[node]->pinst);
+	}
+
+	return pcrypt_node;
+
+err:
+	pcrypt_fini_padata_node(pcrypt_node);
+	return ERR_PTR(err);
+}
+
 static struct crypto_template pcrypt_tmpl = {
 	.name = "pcrypt",
 	.alloc = pcrypt_alloc,
@@ -529,19 +633,39 @@ static int __init pcrypt_init(void)
 	if (!pcrypt_kset)
 		goto err;
 
-	err = pcrypt_init_padata(&pencrypt, "pencrypt");
+	err = pcrypt_init_padata(&pencrypt, "pencrypt", cpu_possible_mask);
 	if (err)
 		goto err_unreg_kset;
 
-	err = pcrypt_init_padata(&pdecrypt, "pdecrypt");
+	err = pcrypt_init_padata(&pdecrypt, "pdecrypt", cpu_possible_mask);
 	if (err)
 		goto err_deinit_pencrypt;
 
 	padata_start(pencrypt.pinst);
 	padata_start(pdecrypt.pinst);
 
+	if (numa_local && num_online_nodes() > 1) {
+		pencrypt_node = pcrypt_init_padata_node("pencrypt");
+		if (IS_ERR(pencrypt_node)) {
+			err = PTR_ERR(pencrypt_node);
+			pencrypt_node = NULL;
+			goto err_deinit_pdecrypt;
+		}
+
+		pdecrypt_node = pcrypt_init_padata_node("pdecrypt");
+		if (IS_ERR(pdecrypt_node)) {
+			err = PTR_ERR(pdecrypt_node);
+			pdecrypt_node = NULL;
+			goto err_deinit_pencrypt_node;
+		}
+	}
+
 	return crypto_register_template(&pcrypt_tmpl);
 
+err_deinit_pencrypt_node:
+	pcrypt_fini_padata_node(pencrypt_node);
+err_deinit_pdecrypt:
+	pcrypt_fini_padata(&pdecrypt);
 err_deinit_pencrypt:
 	pcrypt_fini_padata(&pencrypt);
 err_unreg_kset:
@@ -552,6 +676,8 @@ err:
 
 static void __exit pcrypt_exit(void)
 {
+	pcrypt_fini_padata_node(pencrypt_node);
+	pcrypt_fini_padata_node(pdecrypt_node);
 	pcrypt_fini_padata(&pencrypt);
 	pcrypt_fini_padata(&pdecrypt);
 
@@ -48,6 +48,8 @@ struct driver_private {
 	struct klist_node knode_bus;
 	struct module_kobject *mkobj;
 	struct device_driver *driver;
+	struct list_head async_probes;
+	atomic_t async_pending;
 };
 #define to_driver(obj) container_of(obj, struct driver_private, kobj)
 
@@ -62,6 +64,9 @@ struct driver_private {
  * list soon.
  * @device - pointer back to the struct class that this structure is
  * associated with.
+ * @async_pending - asynchronous probes of the device not done yet.
+ * @dead - set when the device is being removed, so that no asynchronous
+ * probe is scheduled for it anymore.
  *
  * Nothing outside of the driver core should ever touch these fields.
  */
@@ -72,6 +77,8 @@ struct device_private {
 	struct klist_node knode_bus;
 	void *driver_data;
 	struct device *device;
+	atomic_t async_pending;
+	bool dead;
 };
 #define to_device_private_parent(obj)	\
 	container_of(obj, struct device_private, knode_parent)
@@ -105,6 +112,8 @@ extern void bus_remove_driver(struct device_driver *drv);
 
 extern void driver_detach(struct device_driver *drv);
 extern int driver_probe_device(struct device_driver *drv, struct device *dev);
+extern void driver_wait_for_async_probes(struct device_driver *drv);
+extern void device_wait_for_async_probes(struct device *dev);
 static inline int driver_match_device(struct device_driver *drv,
 				      struct device *dev)
 {
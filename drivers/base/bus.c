@@ -516,6 +516,7 @@ void bus_remove_device(struct device *dev)
 
 		pr_debug("bus: '%s': remove device %s\n",
 			 dev->bus->name, dev_name(dev));
+		device_wait_for_async_probes(dev);
 		device_release_driver(dev);
 		bus_put(dev->bus);
 	}
@@ -640,6 +641,7 @@ int bus_add_driver(struct device_driver *drv)
 		goto out_put_bus;
 	}
 	klist_init(&priv->klist_devices, NULL, NULL);
+	INIT_LIST_HEAD(&priv->async_probes);
 	priv->driver = drv;
 	drv->p = priv;
 	priv->kobj.kset = bus->p->drivers_kset;
@@ -708,6 +710,7 @@ void bus_remove_driver(struct device_driver *drv)
 	driver_remove_file(drv, &driver_attr_uevent);
 	klist_remove(&drv->p->knode_bus);
 	pr_debug("bus: '%s': remove driver %s\n", drv->bus->name, drv->name);
+	driver_wait_for_async_probes(drv);
 	driver_detach(drv);
 	module_remove_driver(drv);
 	kobject_put(&drv->p->kobj);
@@ -24,6 +24,7 @@
 #include <linux/wait.h>
 #include <linux/async.h>
 #include <linux/pm_runtime.h>
+#include <linux/slab.h>
 
 #include "base.h"
 #include "power/power.h"
@@ -215,13 +216,159 @@ int driver_probe_device(struct device_driver *drv, struct device *dev)
 	return ret;
 }
 
-static int __device_attach(struct device_driver *drv, void *data)
+static bool driver_allows_async_probing(struct device_driver *drv)
 {
-	struct device *dev = data;
+	switch (drv->probe_type) {
+	case PROBE_PREFER_ASYNCHRONOUS:
+		return true;
+	case PROBE_FORCE_SYNCHRONOUS:
+		return false;
+	default:
+		return drv->bus->async_probe;
+	}
+}
+
+/*
+ * Wait for the asynchronous probes of the drivers @drv depends on. Only
+ * the probes scheduled so far are waited for: a dependency that is not
+ * registered yet has nothing to wait for.
+ */
+static void driver_wait_for_deps(struct device_driver *drv)
+{
+	const char * const *name;
+	struct device_driver *dep;
+
+	if (!drv->probe_after)
+		return;
+
+	for (name = drv->probe_after; *name; name++) {
+		dep = driver_find(*name, drv->bus);
+		if (!dep)
+			continue;
+		async_synchronize_full_domain(&dep->p->async_probes);
+		put_driver(dep);
+	}
+}
+
+/*
+ * A pending asynchronous probe is accounted in its device, its driver and
+ * probe_count, from the time it is decided on until it is done, so that
+ * the removal of either and wait_for_device_probe() wait for it.
+ *
+ * With @dev locked, returns false if @dev is being removed.
+ */
+static bool async_probe_get(struct device_driver *drv, struct device *dev)
+{
+	if (dev->p->dead)
+		return false;
+
+	atomic_inc(&dev->p->async_pending);
+	atomic_inc(&drv->p->async_pending);
+	atomic_inc(&probe_count);
+	return true;
+}
+
+/* Neither @dev nor @drv may be touched anymore once this returns */
+static void async_probe_put(struct device_driver *drv, struct device *dev)
+{
+	atomic_dec(&probe_count);
+	atomic_dec(&drv->p->async_pending);
+	atomic_dec(&dev->p->async_pending);
+	wake_up(&probe_waitqueue);
+}
+
+/**
+ * driver_wait_for_async_probes - wait for the asynchronous probes of a driver
+ * @drv: driver being removed, which no device matches anymore.
+ */
+void driver_wait_for_async_probes(struct device_driver *drv)
+{
+	wait_event(probe_waitqueue, !atomic_read(&drv->p->async_pending));
+	/* let the async core let go of the domain too */
+	async_synchronize_full_domain(&drv->p->async_probes);
+}
+
+/**
+ * device_wait_for_async_probes - wait for the asynchronous probes of a device
+ * @dev: device being removed.
+ *
+ * No asynchronous probe is scheduled for @dev once this is called.
+ */
+void device_wait_for_async_probes(struct device *dev)
+{
+	device_lock(dev);
+	dev->p->dead = true;
+	device_unlock(dev);
+
+	wait_event(probe_waitqueue, !atomic_read(&dev->p->async_pending));
+}
+
+struct async_probe {
+	struct device_driver *drv;
+	struct device *dev;
+};
+
+static void __driver_probe_async(void *data, async_cookie_t cookie)
+{
+	struct async_probe *ap = data;
+	struct device_driver *drv = ap->drv;
+	struct device *dev = ap->dev;
+
+	kfree(ap);
+	driver_wait_for_deps(drv);
+
+	device_lock(dev);
+	if (!dev->p->dead && !dev->driver && driver_match_device(drv, dev))
+		driver_probe_device(drv, dev);
+	device_unlock(dev);
+
+	async_probe_put(drv, dev);
+}
+
+/*
+ * Schedule the probe of @dev by @drv in the async domain of @drv, which
+ * the probes of the drivers depending on @drv wait for. The caller holds
+ * a reference on the probe with async_probe_get(), which is handed over
+ * on success.
+ *
+ * The probe may run before this returns, so no lock of @dev must be held.
+ */
+static int driver_probe_async(struct device_driver *drv, struct device *dev)
+{
+	struct async_probe *ap;
+
+	ap = kmalloc(sizeof(*ap), GFP_KERNEL);
+	if (!ap)
+		return -ENOMEM;
+
+	ap->drv = drv;
+	ap->dev = dev;
+	async_schedule_domain(__driver_probe_async, ap, &drv->p->async_probes);
+	return 0;
+}
+
+struct device_attach_data {
+	struct device *dev;
+	struct device_driver *async_drv;
+};
+
+static int __device_attach(struct device_driver *drv, void *_data)
+{
+	struct device_attach_data *data = _data;
+	struct device *dev = data->dev;
 
 	if (!driver_match_device(drv, dev))
 		return 0;
 
+	/* Scheduled by device_attach() once the device lock is dropped */
+	if (driver_allows_async_probing(drv)) {
+		if (!async_probe_get(drv, dev))
+			return -ENODEV;
+		data->async_drv = drv;
+		return 1;
+	}
+
+	driver_wait_for_deps(drv);
 	return driver_probe_device(drv, dev);
 }
 
@@ -234,13 +381,17 @@ static int __device_attach(struct device_driver *drv, void *data)
  * pair is found, break out and return.
  *
  * Returns 1 if the device was bound to a driver;
- * 0 if no matching driver was found;
+ * 0 if no matching driver was found or the matching driver probes
+ * asynchronously;
  * -ENODEV if the device is not registered.
  *
  * When called for a USB interface, @dev->parent lock must be held.
  */
 int device_attach(struct device *dev)
 {
+	struct device_attach_data data = {
+		.dev = dev,
+	};
 	int ret = 0;
 
 	device_lock(dev);
@@ -258,11 +409,23 @@ int device_attach(struct device *dev)
 		}
 	} else {
 		pm_runtime_get_noresume(dev);
-		ret = bus_for_each_drv(dev->bus, NULL, dev, __device_attach);
+		ret = bus_for_each_drv(dev->bus, NULL, &data, __device_attach);
 		pm_runtime_put_sync(dev);
 	}
 out_unlock:
 	device_unlock(dev);
+
+	if (data.async_drv) {
+		ret = 0;
+		if (driver_probe_async(data.async_drv, dev)) {
+			driver_wait_for_deps(data.async_drv);
+			device_lock(dev);
+			if (!dev->p->dead && !dev->driver)
+				ret = driver_probe_device(data.async_drv, dev);
+			device_unlock(dev);
+			async_probe_put(data.async_drv, dev);
+		}
+	}
 	return ret;
 }
 EXPORT_SYMBOL_GPL(device_attach);
@@ -284,6 +447,21 @@ static int __driver_attach(struct device *dev, void *data)
 	if (!driver_match_device(drv, dev))
 		return 0;
 
+	if (driver_allows_async_probing(drv)) {
+		bool pending;
+
+		device_lock(dev);
+		pending = async_probe_get(drv, dev);
+		device_unlock(dev);
+		if (!pending)
+			return 0;
+		if (!driver_probe_async(drv, dev))
+			return 0;
+		async_probe_put(drv, dev);
+	}
+
+	driver_wait_for_deps(drv);
+
 	if (dev->parent)	/* Needed for USB */
 		device_lock(dev->parent);
 	device_lock(dev);
@@ -304,6 +482,8 @@ static int __driver_attach(struct device *dev, void *data)
  * match the driver with each one.  If driver_probe_device()
  * returns 0 and the @dev->driver is set, we've found a
  * compatible pair.
+ *
+ * Asynchronous probes may still be running when this returns.
  */
 int driver_attach(struct device_driver *drv)
 {
@@ -20,6 +20,9 @@
 #include <linux/highmem.h>
 #include <linux/firmware.h>
 #include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <generated/utsrelease.h>
 
 #define to_dev(obj) container_of(obj, struct device, kobj)
 
@@ -510,6 +513,164 @@ static void fw_destroy_instance(struct firmware_priv *fw_priv)
 	device_unregister(f_dev);
 }
 
+/* Direct filesystem loading, without a trip to userspace */
+
+static char fw_path_para[256];
+module_param_string(path, fw_path_para, sizeof(fw_path_para), 0644);
+MODULE_PARM_DESC(path, "Directory searched first for firmware images");
+
+static const char * const fw_path[] = {
+	fw_path_para,
+	"/lib/firmware/updates/" UTS_RELEASE,
+	"/lib/firmware/updates",
+	"/lib/firmware/" UTS_RELEASE,
+	"/lib/firmware"
+};
+
+static int fw_read_file(struct firmware *fw, struct file *file)
+{
+	loff_t size = i_size_read(file->f_path.dentry->d_inode);
+	int nr_pages = PFN_UP(size);
+	struct page **pages;
+	loff_t pos = 0;
+	int i, len;
+	char *buf;
+
+	if (size <= 0 || size > INT_MAX)
+		return -EINVAL;
+
+	pages = kcalloc(nr_pages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
+		if (!pages[i])
+			goto err;
+
+		len = min_t(loff_t, size - pos, PAGE_SIZE);
+		buf = kmap(pages[i]);
+		len = len == kernel_read(file, pos, buf, len) ? len : -EIO;
+		kunmap(pages[i]);
+		if (len < 0)
+			goto err_page;
+		pos += len;
+	}
+
+	fw->data = vmap(pages, nr_pages, 0, PAGE_KERNEL_RO);
+	if (!fw->data)
+		goto err;
+	fw->pages = pages;
+	fw->size = size;
+	return 0;
+
+err_page:
+	i++;
+err:
+	while (i--)
+		__free_page(pages[i]);
+	kfree(pages);
+	return -ENOMEM;
+}
+
+/*
+ * Look @name up in the firmware directories, newest kernel release first.
+ * Falls back to the userspace helper when none holds it.
+ */
+static bool fw_get_filesystem_firmware(struct firmware *fw, const char *name)
+{
+	struct file *file;
+	char *path;
+	int i, len;
+	bool found = false;
+
+	path = __getname();
+	if (!path)
+		return false;
+
+	for (i = 0; i < ARRAY_SIZE(fw_path) && !found; i++) {
+		/* skip the unset path parameter */
+		if (!fw_path[i][0])
+			continue;
+
+		len = snprintf(path, PATH_MAX, "%s/%s", fw_path[i], name);
+		if (len >= PATH_MAX)
+			continue;
+
+		file = filp_open(path, O_RDONLY, 0);
+		if (IS_ERR(file))
+			continue;
+		found = !fw_read_file(fw, file);
+		fput(file);
+	}
+
+	__putname(path);
+	return found;
+}
+
+/* Firmware cache */
+
+/*
+ * A firmware image kept in memory by cache_firmware(), shared by the
+ * requests for it. Its pages belong to the buffer, which the cache and
+ * each request served from it hold a reference on.
+ */
+struct firmware_buf {
+	struct kref ref;
+	struct list_head list;
+	unsigned int cached;	/* cache_firmware() calls not yet undone */
+	size_t size;
+	const u8 *data;
+	struct page **pages;
+	char fw_id[];
+};
+
+static LIST_HEAD(fw_cache);
+static DEFINE_MUTEX(fw_cache_lock);
+
+static struct firmware_buf *__fw_cache_lookup(const char *name)
+{
+	struct firmware_buf *buf;
+
+	list_for_each_entry(buf, &fw_cache, list)
+		if (!strcmp(buf->fw_id, name))
+			return buf;
+
+	return NULL;
+}
+
+static void fw_buf_release(struct kref *ref)
+{
+	struct firmware_buf *buf = container_of(ref, struct firmware_buf, ref);
+	int i;
+
+	/* built-in images are cached in place */
+	if (buf->pages) {
+		vunmap(buf->data);
+		for (i = 0; i < PFN_UP(buf->size); i++)
+			__free_page(buf->pages[i]);
+		kfree(buf->pages);
+	}
+	kfree(buf);
+}
+
+static bool fw_get_cached_firmware(struct firmware *fw, const char *name)
+{
+	struct firmware_buf *buf;
+
+	mutex_lock(&fw_cache_lock);
+	buf = __fw_cache_lookup(name);
+	if (buf) {
+		kref_get(&buf->ref);
+		fw->size = buf->size;
+		fw->data = buf->data;
+		fw->priv = buf;
+	}
+	mutex_unlock(&fw_cache_lock);
+
+	return buf;
+}
+
 static int _request_firmware(const struct firmware **firmware_p,
 			     const char *name, struct device *device,
 			     bool uevent, bool nowait)
@@ -521,11 +682,6 @@ static int _request_firmware(const struct firmware **firmware_p,
 	if (!firmware_p)
 		return -EINVAL;
 
-	if (WARN_ON(usermodehelper_is_disabled())) {
-		dev_err(device, "firmware: %s will not be loaded\n", name);
-		return -EBUSY;
-	}
-
 	*firmware_p = firmware = kzalloc(sizeof(*firmware), GFP_KERNEL);
 	if (!firmware) {
 		dev_err(device, "%s: kmalloc(struct firmware) failed\n",
@@ -539,6 +695,23 @@ static int _request_firmware(const struct firmware **firmware_p,
 		return 0;
 	}
 
+	/* the cache is all there is while the system suspends or resumes */
+	if (fw_get_cached_firmware(firmware, name)) {
+		dev_dbg(device, "firmware: using cached firmware %s\n", name);
+		return 0;
+	}
+
+	if (WARN_ON(usermodehelper_is_disabled())) {
+		dev_err(device, "firmware: %s will not be loaded\n", name);
+		retval = -EBUSY;
+		goto out;
+	}
+
+	if (fw_get_filesystem_firmware(firmware, name)) {
+		dev_dbg(device, "firmware: direct-loading firmware %s\n", name);
+		return 0;
+	}
+
 	if (uevent)
 		dev_dbg(device, "firmware: requesting %s\n", name);
 
@@ -608,12 +781,110 @@ request_firmware(const struct firmware **firmware_p, const char *name,
 void release_firmware(const struct firmware *fw)
 {
 	if (fw) {
-		if (!fw_is_builtin_firmware(fw))
+		if (fw->priv)
+			kref_put(&((struct firmware_buf *)fw->priv)->ref,
+				 fw_buf_release);
+		else if (!fw_is_builtin_firmware(fw))
 			firmware_free_data(fw);
 		kfree(fw);
 	}
 }
 
+/**
+ * cache_firmware: - keep a firmware image in memory
+ * @name: name of firmware file
+ * @device: device for which firmware is being loaded
+ *
+ *	Loads @name like request_firmware() does, and keeps it in memory
+ *	until uncache_firmware() is called as many times as this was.
+ *	Until then, requests for @name are served from memory: they don't
+ *	wait on the filesystem or userspace, and still succeed while the
+ *	system suspends or resumes, when neither is available.
+ **/
+int cache_firmware(const char *name, struct device *device)
+{
+	const struct firmware *fw;
+	struct firmware_buf *buf, *old;
+	int ret;
+
+again:
+	mutex_lock(&fw_cache_lock);
+	old = __fw_cache_lookup(name);
+	if (old)
+		old->cached++;
+	mutex_unlock(&fw_cache_lock);
+	if (old)
+		return 0;
+
+	buf = kzalloc(sizeof(*buf) + strlen(name) + 1, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = request_firmware(&fw, name, device);
+	if (ret) {
+		kfree(buf);
+		return ret;
+	}
+
+	/* somebody else cached it meanwhile, and @fw came from the cache */
+	if (fw->priv) {
+		release_firmware(fw);
+		kfree(buf);
+		goto again;
+	}
+
+	/* take the image over from @fw */
+	kref_init(&buf->ref);
+	buf->cached = 1;
+	buf->size = fw->size;
+	buf->data = fw->data;
+	buf->pages = fw->pages;
+	strcpy(buf->fw_id, name);
+	kfree(fw);
+
+	mutex_lock(&fw_cache_lock);
+	old = __fw_cache_lookup(name);
+	if (old)
+		old->cached++;
+	else
+		list_add(&buf->list, &fw_cache);
+	mutex_unlock(&fw_cache_lock);
+
+	/* somebody else cached it meanwhile */
+	if (old)
+		kref_put(&buf->ref, fw_buf_release);
+
+	return 0;
+}
+
+/**
+ * uncache_firmware: - undo a cache_firmware() call
+ * @name: name of firmware file
+ *
+ *	The image is freed once it is uncached as many times as it was
+ *	cached, and released by the requests it served.
+ **/
+int uncache_firmware(const char *name)
+{
+	struct firmware_buf *buf;
+
+	mutex_lock(&fw_cache_lock);
+	buf = __fw_cache_lookup(name);
+	if (!buf) {
+		mutex_unlock(&fw_cache_lock);
+		return -EINVAL;
+	}
+	if (--buf->cached)
+		buf = NULL;
+	else
+		list_del(&buf->list);
+	mutex_unlock(&fw_cache_lock);
+
+	if (buf)
+		kref_put(&buf->ref, fw_buf_release);
+	return 0;
+}
+
 /* Async support */
 struct firmware_work {
 	struct work_struct work;
@@ -716,3 +987,5 @@ module_exit(firmware_class_exit);
 EXPORT_SYMBOL(release_firmware);
 EXPORT_SYMBOL(request_firmware);
 EXPORT_SYMBOL(request_firmware_nowait);
+EXPORT_SYMBOL_GPL(cache_firmware);
+EXPORT_SYMBOL_GPL(uncache_firmware);
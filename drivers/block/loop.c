@@ -75,6 +75,8 @@
 #include <linux/kthread.h>
 #include <linux/splice.h>
 #include <linux/sysfs.h>
+#include <linux/vmalloc.h>
+#include <linux/fiemap.h>
 
 #include <asm/uaccess.h>
 
@@ -498,6 +500,156 @@ out:
 	return ret;
 }
 
+/*
+ * With LO_FLAGS_DIRECT_IO, the bios of a loop device backed by a regular
+ * file are remapped straight to the blocks of the file on the block device
+ * holding it, bypassing the page cache and the loop thread. The file is
+ * mapped once, when direct I/O is turned on, so it must be fully allocated
+ * and written, and it is pinned with S_SWAPFILE, as swap files are, so it
+ * can't be truncated, written, punched or moved around by its filesystem
+ * for as long as direct I/O is on.
+ */
+struct loop_extent {
+	sector_t start;		/* in the backing file */
+	sector_t nr;
+	sector_t disk;		/* on the block device of the backing file */
+};
+
+/*
+ * Pin the blocks of the backing file, as swapon does, so that nobody can
+ * truncate, write, punch, reflink or defragment it while it is mapped.
+ */
+static int loop_pin_file(struct inode *inode)
+{
+	int error = 0;
+
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode))
+		error = -EBUSY;
+	else
+		inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+
+	return error;
+}
+
+static void loop_unpin_file(struct inode *inode)
+{
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+}
+
+/* lo_lock is held */
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t sector)
+{
+	unsigned int lo_idx = 0, hi_idx = lo->lo_nr_extents;
+
+	while (lo_idx < hi_idx) {
+		unsigned int mid = (lo_idx + hi_idx) / 2;
+		struct loop_extent *e = &lo->lo_extents[mid];
+
+		if (sector < e->start)
+			hi_idx = mid;
+		else if (sector >= e->start + e->nr)
+			lo_idx = mid + 1;
+		else
+			return e;
+	}
+
+	return NULL;
+}
+
+static struct block_device *loop_direct_bdev(struct loop_device *lo)
+{
+	return lo->lo_backing_file->f_mapping->host->i_sb->s_bdev;
+}
+
+/*
+ * Remap a bio of a direct I/O loop device. Returns 1 if remapped, 0 if the
+ * bio has to be split @split sectors in, and -EIO if it is past the file.
+ * lo_lock is held.
+ */
+static int loop_direct_remap(struct loop_device *lo, struct bio *bio,
+			     int *split)
+{
+	sector_t sector = bio->bi_sector + (lo->lo_offset >> 9);
+	struct loop_extent *e;
+
+	if (!bio->bi_size) {
+		/* a flush */
+		bio->bi_bdev = loop_direct_bdev(lo);
+		return 1;
+	}
+
+	e = loop_find_extent(lo, sector);
+	if (!e)
+		return -EIO;
+
+	if (sector + bio_sectors(bio) > e->start + e->nr) {
+		*split = e->start + e->nr - sector;
+		return 0;
+	}
+
+	bio->bi_bdev = loop_direct_bdev(lo);
+	bio->bi_sector = e->disk + (sector - e->start);
+	return 1;
+}
+
+/*
+ * Keep the bios of a direct I/O loop device within an extent of the file
+ * (and within what the underlying device accepts there).
+ */
+static int loop_merge_bvec(struct request_queue *q, struct bvec_merge_data *bvm,
+			   struct bio_vec *biovec)
+{
+	struct loop_device *lo = q->queuedata;
+	struct block_device *bdev;
+	struct request_queue *bq;
+	struct loop_extent *e;
+	unsigned long flags;
+	sector_t sector, left;
+	int max;
+
+	spin_lock_irqsave(&lo->lo_lock, flags);
+	if (!(lo->lo_flags & LO_FLAGS_DIRECT_IO)) {
+		spin_unlock_irqrestore(&lo->lo_lock, flags);
+		return biovec->bv_len;
+	}
+
+	sector = bvm->bi_sector + get_start_sect(bvm->bi_bdev) +
+		 (lo->lo_offset >> 9);
+	e = loop_find_extent(lo, sector);
+	if (!e) {
+		/* let loop_make_request fail it */
+		spin_unlock_irqrestore(&lo->lo_lock, flags);
+		return biovec->bv_len;
+	}
+
+	left = e->start + e->nr - sector;
+	max = left > (INT_MAX >> 9) ? INT_MAX : left << 9;
+	max -= bvm->bi_size;
+	sector = e->disk + (sector - e->start);
+	bdev = loop_direct_bdev(lo);
+	spin_unlock_irqrestore(&lo->lo_lock, flags);
+
+	if (max < 0)
+		max = 0;
+	/* always allow the first page */
+	if (max <= biovec->bv_len && !bvm->bi_size)
+		max = biovec->bv_len;
+
+	bq = bdev_get_queue(bdev);
+	if (bq->merge_bvec_fn) {
+		bvm->bi_bdev = bdev;
+		bvm->bi_sector = sector;
+		max = min(max, bq->merge_bvec_fn(bq, bvm, biovec));
+	}
+
+	return max;
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -529,6 +681,24 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		int split, ret = loop_direct_remap(lo, old_bio, &split);
+
+		spin_unlock_irq(&lo->lo_lock);
+		if (ret > 0)
+			return 1;
+		if (ret == 0 && old_bio->bi_vcnt == 1 && !old_bio->bi_idx) {
+			/* a single page across extents */
+			struct bio_pair *bp = bio_split(old_bio, split);
+
+			generic_make_request(&bp->bio1);
+			generic_make_request(&bp->bio2);
+			bio_pair_release(bp);
+			return 0;
+		}
+		bio_io_error(old_bio);
+		return 0;
+	}
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -672,9 +842,10 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (lo->lo_state != Lo_bound)
 		goto out;
 
-	/* the loop device has to be read-only */
+	/* the loop device has to be read-only, and not map its file */
 	error = -EINVAL;
-	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
+	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY) ||
+	    (lo->lo_flags & LO_FLAGS_DIRECT_IO))
 		goto out;
 
 	error = -EBADF;
@@ -784,16 +955,25 @@ static ssize_t loop_attr_autoclear_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", autoclear ? "1" : "0");
 }
 
+static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
+{
+	int dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO);
+
+	return sprintf(buf, "%s\n", dio ? "1" : "0");
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
+LOOP_ATTR_RO(dio);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
 	&loop_attr_offset.attr,
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
+	&loop_attr_dio.attr,
 	NULL,
 };
 
@@ -1007,6 +1187,12 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	kthread_stop(lo->lo_thread);
 
+	blk_queue_merge_bvec(lo->lo_queue, NULL);
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		loop_unpin_file(filp->f_mapping->host);
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
 	lo->lo_backing_file = NULL;
 
 	loop_release_xfer(lo);
@@ -1063,6 +1249,10 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* direct I/O can neither transfer nor map partial sectors */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type || (info->lo_offset & 511)))
+		return -EINVAL;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1282,6 +1472,203 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	return err;
 }
 
+/* number of extents looked at in one go by loop_check_extents() */
+#define LOOP_FIEMAP_EXTENTS	32
+
+/* extents whose data isn't simply found at their blocks on the device */
+#define LOOP_FIEMAP_UNSAFE	(FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | \
+				 FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_UNWRITTEN | \
+				 FIEMAP_EXTENT_SHARED | FIEMAP_EXTENT_NOT_ALIGNED | \
+				 FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL)
+
+/*
+ * bmap() maps preallocated (unwritten) and shared (reflinked) blocks too,
+ * so ask the filesystem about the extents of the backing file as well.
+ * Filesystems without fiemap have neither kind of extent.
+ */
+static int loop_check_extents(struct inode *inode)
+{
+	struct fiemap_extent_info fieinfo = { .fi_flags = 0 };
+	struct fiemap_extent *fe;
+	loff_t size = i_size_read(inode);
+	mm_segment_t old_fs;
+	u64 start = 0, next;
+	int i, error = 0;
+
+	if (!inode->i_op->fiemap)
+		return 0;
+
+	fe = kmalloc(LOOP_FIEMAP_EXTENTS * sizeof(*fe), GFP_KERNEL);
+	if (!fe)
+		return -ENOMEM;
+
+	/* fiemap copies the extents out as if to the user */
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+
+	while (!error && start < size) {
+		fieinfo.fi_extents_mapped = 0;
+		fieinfo.fi_extents_max = LOOP_FIEMAP_EXTENTS;
+		fieinfo.fi_extents_start = (struct fiemap_extent __user *) fe;
+
+		error = inode->i_op->fiemap(inode, &fieinfo, start, size - start);
+		if (error)
+			break;
+		if (!fieinfo.fi_extents_mapped) {
+			error = -EINVAL;
+			break;
+		}
+
+		for (i = 0; i < fieinfo.fi_extents_mapped; i++) {
+			next = fe[i].fe_logical + fe[i].fe_length;
+			if ((fe[i].fe_flags & LOOP_FIEMAP_UNSAFE) ||
+			    next <= start) {
+				error = -EINVAL;
+				break;
+			}
+			start = next;
+			if (fe[i].fe_flags & FIEMAP_EXTENT_LAST)
+				start = size;
+		}
+		cond_resched();
+	}
+
+	set_fs(old_fs);
+	kfree(fe);
+
+	return error;
+}
+
+/*
+ * Map the blocks of the backing file into @extents (if not NULL), and return
+ * how many extents it takes, or -EINVAL if the file has holes.
+ */
+static int loop_map_extents(struct inode *inode, struct loop_extent *extents)
+{
+	unsigned int shift = inode->i_blkbits - 9;
+	sector_t blocks = (i_size_read(inode) + (1 << inode->i_blkbits) - 1) >>
+			  inode->i_blkbits;
+	struct loop_extent cur = { .nr = 0 };
+	sector_t block;
+	int n = 0;
+
+	for (block = 0; block < blocks; block++) {
+		sector_t disk = bmap(inode, block);
+
+		if (!disk)
+			return -EINVAL;
+		disk <<= shift;
+
+		if (cur.nr && cur.disk + cur.nr == disk) {
+			cur.nr += 1 << shift;
+			continue;
+		}
+
+		if (cur.nr && extents)
+			extents[n - 1] = cur;
+		n++;
+		cur.start = block << shift;
+		cur.nr = 1 << shift;
+		cur.disk = disk;
+		cond_resched();
+	}
+	if (cur.nr && extents)
+		extents[n - 1] = cur;
+
+	return n;
+}
+
+/*
+ * Turn direct I/O to the backing file on or off. The device must not be
+ * in use elsewhere, so that there is no I/O in flight through the other
+ * path meanwhile.
+ */
+static int loop_set_direct_io(struct loop_device *lo, unsigned long arg)
+{
+	struct file *file = lo->lo_backing_file;
+	struct loop_extent *extents;
+	struct address_space *mapping;
+	struct inode *inode;
+	int n, error;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (lo->lo_refcnt > 1)
+		return -EBUSY;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+
+	mapping = file->f_mapping;
+	inode = mapping->host;
+
+	if (!arg) {
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+		extents = lo->lo_extents;
+		lo->lo_extents = NULL;
+		lo->lo_nr_extents = 0;
+		spin_unlock_irq(&lo->lo_lock);
+
+		blk_queue_merge_bvec(lo->lo_queue, NULL);
+		vfree(extents);
+		/* the file was written behind the back of its page cache */
+		invalidate_inode_pages2(mapping);
+		loop_unpin_file(inode);
+		return 0;
+	}
+
+	if (!S_ISREG(inode->i_mode) || !mapping->a_ops->bmap ||
+	    !inode->i_sb->s_bdev)
+		return -EINVAL;
+	if (lo->transfer != transfer_none || (lo->lo_offset & 511))
+		return -EINVAL;
+
+	/* a swap file, or mapped by another loop device already */
+	error = loop_pin_file(inode);
+	if (error)
+		return error;
+
+	/* get the queued bios and dirty pages to the file, and allocated */
+	error = loop_flush(lo);
+	if (!error)
+		error = vfs_fsync(file, 0);
+	if (!error)
+		error = loop_check_extents(inode);
+	if (error)
+		goto out_unpin;
+
+	error = -EINVAL;
+	n = loop_map_extents(inode, NULL);
+	if (n <= 0)
+		goto out_unpin;
+
+	error = -ENOMEM;
+	extents = vmalloc(n * sizeof(*extents));
+	if (!extents)
+		goto out_unpin;
+	if (loop_map_extents(inode, extents) != n) {
+		vfree(extents);
+		error = -EINVAL;
+		goto out_unpin;
+	}
+
+	invalidate_inode_pages2(mapping);
+	blk_queue_stack_limits(lo->lo_queue, bdev_get_queue(inode->i_sb->s_bdev));
+	blk_queue_merge_bvec(lo->lo_queue, loop_merge_bvec);
+
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_extents = extents;
+	lo->lo_nr_extents = n;
+	lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	spin_unlock_irq(&lo->lo_lock);
+
+	return 0;
+
+ out_unpin:
+	loop_unpin_file(inode);
+	return error;
+}
+
 static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 	unsigned int cmd, unsigned long arg)
 {
@@ -1319,6 +1706,12 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		/* the device is then written straight to the fs's block device */
+		err = -EPERM;
+		if (capable(CAP_SYS_ADMIN))
+			err = loop_set_direct_io(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1473,6 +1866,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -14,27 +14,50 @@
 static int major, index;
 struct workqueue_struct *virtblk_wq;
 
+static bool use_bio;
+module_param(use_bio, bool, S_IRUGO);
+MODULE_PARM_DESC(use_bio, "Submit I/O straight to the virtqueues, bypassing the request queue");
+
+struct virtio_blk_vq {
+	struct virtqueue *vq;
+
+	/* Protects the virtqueue and the requests in flight on it. */
+	spinlock_t lock;
+
+	/* Request tracking. */
+	struct list_head reqs;
+
+	/* Bio submitters waiting for room on the virtqueue. */
+	wait_queue_head_t wait;
+
+	char name[16];
+} ____cacheline_aligned_in_smp;
+
 struct virtio_blk
 {
+	/* The request queue lock; also protects sg. */
 	spinlock_t lock;
 
 	struct virtio_device *vdev;
-	struct virtqueue *vq;
 
 	/* The disk structure for the kernel. */
 	struct gendisk *disk;
 
-	/* Request tracking. */
-	struct list_head reqs;
-
 	mempool_t *pool;
 
+	/* One virtqueue per CPU, as far as the host lets us. */
+	int num_vqs;
+	struct virtio_blk_vq *vqs;
+
 	/* Process context for config space updates */
 	struct work_struct config_work;
 
 	/* What host tells us, plus 2 for header & tailer. */
 	unsigned int sg_elems;
 
+	/* The request queue's own make_request_fn, with use_bio. */
+	make_request_fn *make_request;
+
 	/* Scatterlist: can be too big for stack. */
 	struct scatterlist sg[/*sg_elems*/];
 };
@@ -43,58 +66,151 @@ struct virtblk_req
 {
 	struct list_head list;
 	struct request *req;
+	struct bio *bio;
 	struct virtio_blk_outhdr out_hdr;
 	struct virtio_scsi_inhdr in_hdr;
 	u8 status;
+	/* Only with use_bio, for bios submitted straight to the vq. */
+	struct scatterlist sg[];
 };
 
-static void blk_done(struct virtqueue *vq)
+static struct virtio_blk_vq *virtblk_vq(struct virtio_blk *vblk,
+					struct virtqueue *vq)
 {
-	struct virtio_blk *vblk = vq->vdev->priv;
-	struct virtblk_req *vbr;
-	unsigned int len;
-	unsigned long flags;
+	int i;
 
-	spin_lock_irqsave(&vblk->lock, flags);
-	while ((vbr = virtqueue_get_buf(vblk->vq, &len)) != NULL) {
-		int error;
+	for (i = 0; i < vblk->num_vqs; i++)
+		if (vblk->vqs[i].vq == vq)
+			return &vblk->vqs[i];
 
-		switch (vbr->status) {
-		case VIRTIO_BLK_S_OK:
-			error = 0;
-			break;
-		case VIRTIO_BLK_S_UNSUPP:
-			error = -ENOTTY;
-			break;
-		default:
-			error = -EIO;
-			break;
-		}
+	BUG();
+	return NULL;
+}
 
-		switch (vbr->req->cmd_type) {
-		case REQ_TYPE_BLOCK_PC:
-			vbr->req->resid_len = vbr->in_hdr.residual;
-			vbr->req->sense_len = vbr->in_hdr.sense_len;
-			vbr->req->errors = vbr->in_hdr.errors;
-			break;
-		case REQ_TYPE_SPECIAL:
-			vbr->req->errors = (error != 0);
-			break;
-		default:
-			break;
+static int virtblk_result(struct virtblk_req *vbr)
+{
+	switch (vbr->status) {
+	case VIRTIO_BLK_S_OK:
+		return 0;
+	case VIRTIO_BLK_S_UNSUPP:
+		return -ENOTTY;
+	default:
+		return -EIO;
+	}
+}
+
+/* Reap the completions of a virtqueue, and return how many there were. */
+static int virtblk_drain_vq(struct virtio_blk *vblk, struct virtio_blk_vq *bvq)
+{
+	struct virtqueue *vq = bvq->vq;
+	struct request_queue *q = vblk->disk->queue;
+	struct virtblk_req *vbr, *next;
+	LIST_HEAD(bios);
+	unsigned int len;
+	unsigned long flags;
+	int done = 0;
+
+	/*
+	 * Only take the requests off the virtqueue here: the block softirq
+	 * finishes them, on the CPU that submitted them (QUEUE_FLAG_SAME_COMP),
+	 * and without this interrupt contending for the queue lock.
+	 *
+	 * Keep the callback disabled while draining, so that the host (which
+	 * with event idx won't even send them) doesn't interrupt us for
+	 * completions we're about to see anyway.
+	 */
+	spin_lock_irqsave(&bvq->lock, flags);
+	do {
+		virtqueue_disable_cb(vq);
+		while ((vbr = virtqueue_get_buf(vq, &len)) != NULL) {
+			if (vbr->bio)
+				list_move_tail(&vbr->list, &bios);
+			else {
+				list_del(&vbr->list);
+				blk_complete_request(vbr->req);
+			}
+			done++;
 		}
+	} while (!virtqueue_enable_cb(vq));
+	spin_unlock_irqrestore(&bvq->lock, flags);
 
-		__blk_end_request_all(vbr->req, error);
-		list_del(&vbr->list);
+	/*
+	 * Bios submitted straight to the vq are ended here, outside the vq
+	 * lock, as their owners may well submit more from bio_endio().
+	 */
+	list_for_each_entry_safe(vbr, next, &bios, list) {
+		bio_endio(vbr->bio, virtblk_result(vbr));
 		mempool_free(vbr, vblk->pool);
 	}
-	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+
+	if (done)
+		wake_up(&bvq->wait);
+
+	/*
+	 * If the queue was stopped on a full virtqueue, restart it once for
+	 * the whole batch, so the requests that waited for room go out with
+	 * a single kick rather than one per completed request.
+	 */
+	if (done && blk_queue_stopped(q)) {
+		spin_lock_irqsave(q->queue_lock, flags);
+		blk_start_queue(q);
+		spin_unlock_irqrestore(q->queue_lock, flags);
+	}
+
+	return done;
+}
+
+static void blk_done(struct virtqueue *vq)
+{
+	struct virtio_blk *vblk = vq->vdev->priv;
+
+	virtblk_drain_vq(vblk, virtblk_vq(vblk, vq));
+}
+
+/*
+ * With io_poll, synchronous submitters reap the completions of their
+ * CPU's virtqueue themselves, instead of waiting for its interrupt.
+ */
+static int virtblk_poll(struct request_queue *q)
+{
+	struct virtio_blk *vblk = q->queuedata;
+
+	return virtblk_drain_vq(vblk,
+			&vblk->vqs[raw_smp_processor_id() % vblk->num_vqs]);
+}
+
+static void virtblk_softirq_done(struct request *req)
+{
+	struct virtio_blk *vblk = req->q->queuedata;
+	struct virtblk_req *vbr = req->special;
+	unsigned long flags;
+	int error = virtblk_result(vbr);
+
+	switch (req->cmd_type) {
+	case REQ_TYPE_BLOCK_PC:
+		req->resid_len = vbr->in_hdr.residual;
+		req->sense_len = vbr->in_hdr.sense_len;
+		req->errors = vbr->in_hdr.errors;
+		break;
+	case REQ_TYPE_SPECIAL:
+		req->errors = (error != 0);
+		break;
+	default:
+		break;
+	}
+
+	mempool_free(vbr, vblk->pool);
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	__blk_end_request_all(req, error);
+	/* In case queue is stopped waiting for a request descriptor. */
+	if (blk_queue_stopped(req->q))
+		blk_start_queue(req->q);
 	spin_unlock_irqrestore(&vblk->lock, flags);
 }
 
 static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
-		   struct request *req)
+		   struct virtio_blk_vq *bvq, struct request *req)
 {
 	unsigned long num, out = 0, in = 0;
 	struct virtblk_req *vbr;
@@ -105,7 +221,8 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		return false;
 
 	vbr->req = req;
-
+	vbr->bio = NULL;
+	req->special = vbr;
 	if (req->cmd_flags & REQ_FLUSH) {
 		vbr->out_hdr.type = VIRTIO_BLK_T_FLUSH;
 		vbr->out_hdr.sector = 0;
@@ -165,36 +282,120 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		}
 	}
 
-	if (virtqueue_add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0) {
+	if (virtqueue_add_buf(bvq->vq, vblk->sg, out, in, vbr) < 0) {
 		mempool_free(vbr, vblk->pool);
 		return false;
 	}
 
-	list_add_tail(&vbr->list, &vblk->reqs);
+	list_add_tail(&vbr->list, &bvq->reqs);
 	return true;
 }
 
 static void do_virtblk_request(struct request_queue *q)
 {
 	struct virtio_blk *vblk = q->queuedata;
+	struct virtio_blk_vq *bvq;
 	struct request *req;
 	unsigned int issued = 0;
+	bool notify;
 
+	/* Submit on the virtqueue of this CPU. */
+	bvq = &vblk->vqs[smp_processor_id() % vblk->num_vqs];
+
+	spin_lock(&bvq->lock);
 	while ((req = blk_peek_request(q)) != NULL) {
 		BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
 
 		/* If this request fails, stop queue and wait for something to
 		   finish to restart it. */
-		if (!do_req(q, vblk, req)) {
+		if (!do_req(q, vblk, bvq, req)) {
 			blk_stop_queue(q);
 			break;
 		}
 		blk_start_request(req);
 		issued++;
 	}
+	/*
+	 * A single kick for everything we issued. Plugged I/O reaches us
+	 * once per unplug, so this is one kick per plug; and with event idx
+	 * there's none at all if the host is still busy with earlier ones.
+	 */
+	notify = issued && virtqueue_kick_prepare(bvq->vq);
+	spin_unlock(&bvq->lock);
+
+	/* The notification traps into the host: don't hold the queue lock
+	 * meanwhile. */
+	if (notify) {
+		spin_unlock_irq(q->queue_lock);
+		virtqueue_notify(bvq->vq);
+		spin_lock_irq(q->queue_lock);
+	}
+}
 
-	if (issued)
-		virtqueue_kick(vblk->vq);
+/*
+ * With use_bio, plain reads and writes skip the request queue (and its
+ * lock) altogether: each bio goes straight onto the virtqueue of the
+ * submitting CPU.  Everything else, as well as bios with more segments
+ * than we can take at once, still goes through the request queue.
+ */
+static int virtblk_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct virtio_blk *vblk = q->queuedata;
+	struct virtio_blk_vq *bvq;
+	struct virtblk_req *vbr;
+	struct bio_vec *bvec;
+	unsigned int out = 1, in = 1, num = 0;
+	bool notify;
+	DEFINE_WAIT(wait);
+	int i;
+
+	if ((bio->bi_rw & (REQ_FLUSH | REQ_FUA | REQ_DISCARD)) ||
+	    !bio_has_data(bio) ||
+	    bio->bi_vcnt - bio->bi_idx + 2 > vblk->sg_elems)
+		return vblk->make_request(q, bio);
+
+	vbr = mempool_alloc(vblk->pool, GFP_NOIO);
+	vbr->req = NULL;
+	vbr->bio = bio;
+	vbr->out_hdr.sector = bio->bi_sector;
+	vbr->out_hdr.ioprio = bio_prio(bio);
+
+	sg_init_table(vbr->sg, vblk->sg_elems);
+	sg_set_buf(&vbr->sg[num++], &vbr->out_hdr, sizeof(vbr->out_hdr));
+	bio_for_each_segment(bvec, bio, i)
+		sg_set_page(&vbr->sg[num++], bvec->bv_page, bvec->bv_len,
+			    bvec->bv_offset);
+	sg_set_buf(&vbr->sg[num++], &vbr->status, sizeof(vbr->status));
+
+	if (bio_data_dir(bio) == WRITE) {
+		vbr->out_hdr.type = VIRTIO_BLK_T_OUT;
+		out = num - 1;
+	} else {
+		vbr->out_hdr.type = VIRTIO_BLK_T_IN;
+		in = num - 1;
+	}
+
+	/* Submit on the virtqueue of this CPU. */
+	bvq = &vblk->vqs[raw_smp_processor_id() % vblk->num_vqs];
+
+	spin_lock_irq(&bvq->lock);
+	while (virtqueue_add_buf(bvq->vq, vbr->sg, out, in, vbr) < 0) {
+		/* Wait for blk_done() to make room. */
+		prepare_to_wait_exclusive(&bvq->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		spin_unlock_irq(&bvq->lock);
+		io_schedule();
+		spin_lock_irq(&bvq->lock);
+		finish_wait(&bvq->wait, &wait);
+	}
+	list_add_tail(&vbr->list, &bvq->reqs);
+	notify = virtqueue_kick_prepare(bvq->vq);
+	spin_unlock_irq(&bvq->lock);
+
+	if (notify)
+		virtqueue_notify(bvq->vq);
+
+	return 0;
 }
 
 /* return id (s/n) string for *disk to *id_str
@@ -337,6 +538,69 @@ static void virtblk_config_changed(struct virtio_device *vdev)
 	queue_work(virtblk_wq, &vblk->config_work);
 }
 
+static int init_vq(struct virtio_blk *vblk)
+{
+	struct virtio_device *vdev = vblk->vdev;
+	vq_callback_t **callbacks;
+	struct virtqueue **vqs;
+	const char **names;
+	u16 num_vqs;
+	int i, err;
+
+	err = virtio_config_val(vdev, VIRTIO_BLK_F_MQ,
+				offsetof(struct virtio_blk_config, num_queues),
+				&num_vqs);
+	if (err || !num_vqs)
+		num_vqs = 1;
+
+	/* There's no point in having more virtqueues than CPUs. */
+	num_vqs = min_t(unsigned int, num_vqs, num_online_cpus());
+
+	vblk->vqs = kzalloc(sizeof(*vblk->vqs) * num_vqs, GFP_KERNEL);
+	vqs = kmalloc(sizeof(*vqs) * num_vqs, GFP_KERNEL);
+	callbacks = kmalloc(sizeof(*callbacks) * num_vqs, GFP_KERNEL);
+	names = kmalloc(sizeof(*names) * num_vqs, GFP_KERNEL);
+	if (!vblk->vqs || !vqs || !callbacks || !names) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < num_vqs; i++) {
+		struct virtio_blk_vq *bvq = &vblk->vqs[i];
+
+		spin_lock_init(&bvq->lock);
+		INIT_LIST_HEAD(&bvq->reqs);
+		init_waitqueue_head(&bvq->wait);
+		snprintf(bvq->name, sizeof(bvq->name), "req.%d", i);
+		callbacks[i] = blk_done;
+		names[i] = bvq->name;
+	}
+
+	err = vdev->config->find_vqs(vdev, num_vqs, vqs, callbacks, names);
+	if (err)
+		goto out;
+
+	for (i = 0; i < num_vqs; i++)
+		vblk->vqs[i].vq = vqs[i];
+	vblk->num_vqs = num_vqs;
+
+	/* Hint each queue's interrupt to the cpus submitting to it, so the
+	 * completions don't need an IPI to get back there. */
+	if (num_vqs > 1)
+		for_each_online_cpu(i)
+			virtqueue_set_affinity(vblk->vqs[i % num_vqs].vq, i);
+
+out:
+	kfree(names);
+	kfree(callbacks);
+	kfree(vqs);
+	if (err) {
+		kfree(vblk->vqs);
+		vblk->vqs = NULL;
+	}
+	return err;
+}
+
 static int __devinit virtblk_probe(struct virtio_device *vdev)
 {
 	struct virtio_blk *vblk;
@@ -368,21 +632,19 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out;
 	}
 
-	INIT_LIST_HEAD(&vblk->reqs);
 	spin_lock_init(&vblk->lock);
 	vblk->vdev = vdev;
 	vblk->sg_elems = sg_elems;
 	sg_init_table(vblk->sg, vblk->sg_elems);
 	INIT_WORK(&vblk->config_work, virtblk_config_changed_work);
 
-	/* We expect one virtqueue, for output. */
-	vblk->vq = virtio_find_single_vq(vdev, blk_done, "requests");
-	if (IS_ERR(vblk->vq)) {
-		err = PTR_ERR(vblk->vq);
+	/* We expect request virtqueues, as many as the host offers. */
+	err = init_vq(vblk);
+	if (err)
 		goto out_free_vblk;
-	}
 
-	vblk->pool = mempool_create_kmalloc_pool(1,sizeof(struct virtblk_req));
+	vblk->pool = mempool_create_kmalloc_pool(1, sizeof(struct virtblk_req) +
+			(use_bio ? sizeof(struct scatterlist) * sg_elems : 0));
 	if (!vblk->pool) {
 		err = -ENOMEM;
 		goto out_free_vq;
@@ -402,6 +664,13 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	}
 
 	q->queuedata = vblk;
+	blk_queue_softirq_done(q, virtblk_softirq_done);
+
+	if (use_bio) {
+		vblk->make_request = q->make_request_fn;
+		q->make_request_fn = virtblk_make_request;
+		blk_queue_poll_fn(q, virtblk_poll);
+	}
 
 	if (index < 26) {
 		sprintf(vblk->disk->disk_name, "vd%c", 'a' + index % 26);
@@ -514,6 +783,7 @@ out_mempool:
 	mempool_destroy(vblk->pool);
 out_free_vq:
 	vdev->config->del_vqs(vdev);
+	kfree(vblk->vqs);
 out_free_vblk:
 	kfree(vblk);
 out:
@@ -523,11 +793,13 @@ out:
 static void __devexit virtblk_remove(struct virtio_device *vdev)
 {
 	struct virtio_blk *vblk = vdev->priv;
+	int i;
 
 	flush_work(&vblk->config_work);
 
 	/* Nothing should be pending. */
-	BUG_ON(!list_empty(&vblk->reqs));
+	for (i = 0; i < vblk->num_vqs; i++)
+		BUG_ON(!list_empty(&vblk->vqs[i].reqs));
 
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
@@ -537,6 +809,7 @@ static void __devexit virtblk_remove(struct virtio_device *vdev)
 	put_disk(vblk->disk);
 	mempool_destroy(vblk->pool);
 	vdev->config->del_vqs(vdev);
+	kfree(vblk->vqs);
 	kfree(vblk);
 }
 
@@ -548,7 +821,7 @@ static const struct virtio_device_id id_table[] = {
 static unsigned int features[] = {
 	VIRTIO_BLK_F_SEG_MAX, VIRTIO_BLK_F_SIZE_MAX, VIRTIO_BLK_F_GEOMETRY,
 	VIRTIO_BLK_F_RO, VIRTIO_BLK_F_BLK_SIZE, VIRTIO_BLK_F_SCSI,
-	VIRTIO_BLK_F_FLUSH, VIRTIO_BLK_F_TOPOLOGY
+	VIRTIO_BLK_F_FLUSH, VIRTIO_BLK_F_TOPOLOGY, VIRTIO_BLK_F_MQ
 };
 
 /*
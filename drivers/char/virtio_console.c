@@ -28,6 +28,8 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/splice.h>
+#include <linux/pagemap.h>
 #include <linux/virtio.h>
 #include <linux/virtio_console.h>
 #include <linux/wait.h>
@@ -107,6 +109,21 @@ struct port_buffer {
 	size_t offset;
 };
 
+/*
+ * What we queue up on an out_vq, and get back once the Host consumed
+ * it: either a kmalloc'd copy of the data written to the port, which
+ * follows the token, or the pages of a splice, which we hold a reference
+ * to until then.
+ */
+struct buffer_token {
+	/* Number of pages referenced by sg[], or 0 if the data is in buf[] */
+	unsigned int sgpages;
+	union {
+		char buf[0];
+		struct scatterlist sg[0];
+	};
+};
+
 /*
  * This is a per-device struct that stores data common to all the
  * ports for that device (vdev->priv).
@@ -468,26 +485,35 @@ static ssize_t send_control_msg(struct port *port, unsigned int event,
 	return 0;
 }
 
+static void free_token(struct buffer_token *tok)
+{
+	unsigned int i;
+
+	for (i = 0; i < tok->sgpages; i++)
+		put_page(sg_page(&tok->sg[i]));
+	kfree(tok);
+}
+
 /* Callers must take the port->outvq_lock */
 static void reclaim_consumed_buffers(struct port *port)
 {
-	void *buf;
+	struct buffer_token *tok;
 	unsigned int len;
 
 	if (!port->portdev) {
 		/* Device has been unplugged.  vqs are already gone. */
 		return;
 	}
-	while ((buf = virtqueue_get_buf(port->out_vq, &len))) {
-		kfree(buf);
+	while ((tok = virtqueue_get_buf(port->out_vq, &len))) {
+		free_token(tok);
 		port->outvq_full = false;
 	}
 }
 
-static ssize_t send_buf(struct port *port, void *in_buf, size_t in_count,
-			bool nonblock)
+static ssize_t __send_to_port(struct port *port, struct scatterlist *sg,
+			      int nents, size_t in_count, void *data,
+			      bool nonblock)
 {
-	struct scatterlist sg[1];
 	struct virtqueue *out_vq;
 	ssize_t ret;
 	unsigned long flags;
@@ -499,8 +525,7 @@ static ssize_t send_buf(struct port *port, void *in_buf, size_t in_count,
 
 	reclaim_consumed_buffers(port);
 
-	sg_init_one(sg, in_buf, in_count);
-	ret = virtqueue_add_buf(out_vq, sg, 1, 0, in_buf);
+	ret = virtqueue_add_buf(out_vq, sg, nents, 0, data);
 
 	/* Tell Host to go! */
 	virtqueue_kick(out_vq);
@@ -536,6 +561,15 @@ done:
 	return in_count;
 }
 
+static ssize_t send_buf(struct port *port, void *in_buf, size_t in_count,
+			void *data, bool nonblock)
+{
+	struct scatterlist sg[1];
+
+	sg_init_one(sg, in_buf, in_count);
+	return __send_to_port(port, sg, 1, in_count, data, nonblock);
+}
+
 /*
  * Give out the data that's requested from the buffer that we have
  * queued up.
@@ -657,11 +691,31 @@ static ssize_t port_fops_read(struct file *filp, char __user *ubuf,
 	return fill_readbuf(port, ubuf, count, true);
 }
 
+static int wait_port_writable(struct port *port, bool nonblock)
+{
+	int ret;
+
+	if (will_write_block(port)) {
+		if (nonblock)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(port->waitqueue,
+					       !will_write_block(port));
+		if (ret < 0)
+			return ret;
+	}
+	/* Port got hot-unplugged. */
+	if (!port->guest_connected)
+		return -ENODEV;
+
+	return 0;
+}
+
 static ssize_t port_fops_write(struct file *filp, const char __user *ubuf,
 			       size_t count, loff_t *offp)
 {
 	struct port *port;
-	char *buf;
+	struct buffer_token *tok;
 	ssize_t ret;
 	bool nonblock;
 
@@ -673,26 +727,18 @@ static ssize_t port_fops_write(struct file *filp, const char __user *ubuf,
 
 	nonblock = filp->f_flags & O_NONBLOCK;
 
-	if (will_write_block(port)) {
-		if (nonblock)
-			return -EAGAIN;
-
-		ret = wait_event_interruptible(port->waitqueue,
-					       !will_write_block(port));
-		if (ret < 0)
-			return ret;
-	}
-	/* Port got hot-unplugged. */
-	if (!port->guest_connected)
-		return -ENODEV;
+	ret = wait_port_writable(port, nonblock);
+	if (ret < 0)
+		return ret;
 
 	count = min((size_t)(32 * 1024), count);
 
-	buf = kmalloc(count, GFP_KERNEL);
-	if (!buf)
+	tok = kmalloc(sizeof(*tok) + count, GFP_KERNEL);
+	if (!tok)
 		return -ENOMEM;
+	tok->sgpages = 0;
 
-	ret = copy_from_user(buf, ubuf, count);
+	ret = copy_from_user(tok->buf, ubuf, count);
 	if (ret) {
 		ret = -EFAULT;
 		goto free_buf;
@@ -706,14 +752,91 @@ static ssize_t port_fops_write(struct file *filp, const char __user *ubuf,
 	 * through to the host.
 	 */
 	nonblock = true;
-	ret = send_buf(port, buf, count, nonblock);
+	ret = send_buf(port, tok->buf, count, tok, nonblock);
 
 	if (nonblock && ret > 0)
 		goto out;
 
 free_buf:
-	kfree(buf);
+	kfree(tok);
+out:
+	return ret;
+}
+
+struct sg_list {
+	unsigned int n;
+	unsigned int size;
+	size_t len;
+	struct scatterlist *sg;
+};
+
+/*
+ * Hand the page of a pipe buffer over to the Host as is, like sendpage()
+ * does: we only take a reference to it, which is dropped once the Host
+ * consumed the data.
+ */
+static int pipe_to_sg(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
+		      struct splice_desc *sd)
+{
+	struct sg_list *sgl = sd->u.data;
+
+	if (sgl->n == sgl->size)
+		return 0;
+
+	get_page(buf->page);
+	sg_set_page(&sgl->sg[sgl->n], buf->page, sd->len, buf->offset);
+
+	sgl->n++;
+	sgl->len += sd->len;
+
+	return sd->len;
+}
+
+/* Faster zero-copy write by splicing */
+static ssize_t port_fops_splice_write(struct pipe_inode_info *pipe,
+				      struct file *filp, loff_t *ppos,
+				      size_t len, unsigned int flags)
+{
+	struct port *port = filp->private_data;
+	struct buffer_token *tok;
+	struct sg_list sgl;
+	ssize_t ret;
+	struct splice_desc sd = {
+		.total_len = len,
+		.flags = flags,
+		.pos = *ppos,
+		.u.data = &sgl,
+	};
+
+	ret = wait_port_writable(port, filp->f_flags & O_NONBLOCK);
+	if (ret < 0)
+		return ret;
+
+	pipe_lock(pipe);
+
+	/* One sg entry for each of the buffers the pipe can hold */
+	sgl.n = 0;
+	sgl.len = 0;
+	sgl.size = pipe->buffers;
+	tok = kmalloc(sizeof(*tok) + sizeof(struct scatterlist) * sgl.size,
+		      GFP_KERNEL);
+	if (!tok) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	sgl.sg = tok->sg;
+	sg_init_table(sgl.sg, sgl.size);
+
+	ret = __splice_from_pipe(pipe, &sd, pipe_to_sg);
+	tok->sgpages = sgl.n;
+	if (likely(ret > 0)) {
+		sg_mark_end(&sgl.sg[sgl.n - 1]);
+		ret = __send_to_port(port, sgl.sg, sgl.n, sgl.len, tok, true);
+	}
+	if (unlikely(ret <= 0))
+		free_token(tok);
 out:
+	pipe_unlock(pipe);
 	return ret;
 }
 
@@ -848,6 +971,7 @@ static const struct file_operations port_fops = {
 	.open  = port_fops_open,
 	.read  = port_fops_read,
 	.write = port_fops_write,
+	.splice_write = port_fops_splice_write,
 	.poll  = port_fops_poll,
 	.release = port_fops_release,
 	.fasync = port_fops_fasync,
@@ -873,7 +997,7 @@ static int put_chars(u32 vtermno, const char *buf, int count)
 	if (!port)
 		return -EPIPE;
 
-	return send_buf(port, (void *)buf, count, false);
+	return send_buf(port, (void *)buf, count, (void *)buf, false);
 }
 
 /*
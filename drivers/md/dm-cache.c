@@ -0,0 +1,941 @@
+/*
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * A target that uses a fast device (e.g. an SSD) as a persistent
+ * write-back and read cache in front of a slow origin device.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/workqueue.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*
+ * Layout of the cache device:
+ *
+ *   sector 0: superblock
+ *   sector 1: metadata, one cache_disk_entry per cache block
+ *   then, aligned to the block size: the cache blocks
+ *
+ * The metadata is kept in core too, and the sector holding an entry is
+ * written (with flush and FUA) whenever the entry changes. Only the
+ * worker thread writes metadata, so the in-core copy of a sector is never
+ * changed while it is being written.
+ */
+#define CACHE_MAGIC		0x48434d44	/* "DMCH" */
+#define CACHE_VERSION		1
+
+struct cache_disk_super {
+	__le32 magic;
+	__le32 version;
+	__le32 block_size;
+	__le32 padding;
+	__le64 nr_blocks;
+} __packed;
+
+#define CDE_VALID		(1 << 0)
+#define CDE_DIRTY		(1 << 1)
+
+struct cache_disk_entry {
+	__le64 oblock;
+	__le64 flags;
+} __packed;
+
+#define ENTRIES_PER_SECTOR	((1 << SECTOR_SHIFT) / \
+				 sizeof(struct cache_disk_entry))
+
+/* how far up the LRU list to look for a clean block to reuse */
+#define ALLOC_SCAN		64
+/* dirty blocks written back at a time */
+#define WRITEBACK_BATCH		64
+
+/* in-core states of a cache block */
+enum {
+	CB_VALID,	/* holds the data of oblock */
+	CB_DIRTY,	/* which wasn't written back yet */
+	CB_BUSY,	/* being filled, written back, or marked dirty */
+};
+
+/* what the worker has to do for a busy block */
+enum cache_action {
+	CA_DIRTY,	/* persist the dirty flag */
+	CA_WRITE,	/* write the full block bio, and persist the mapping */
+	CA_PROMOTE,	/* copy oblock from the origin */
+	CA_PROMOTED,	/* persist the mapping of a promoted block */
+	CA_WRITTEN_BACK, /* persist that the block is clean */
+};
+
+struct cache_c;
+
+struct cache_block {
+	struct cache_c *cc;
+	struct hlist_node hlist;
+	struct list_head lru;		/* lru (or free) list */
+	struct list_head wlist;		/* work list of the worker */
+	sector_t oblock;
+	unsigned long flags;
+	enum cache_action action;
+	int error;
+	atomic_t pending;		/* bios in flight to the block */
+	struct bio *bio;		/* the write of CA_WRITE */
+	struct bio_list deferred;	/* bios waiting for it to be idle */
+};
+
+struct cache_c {
+	struct dm_target *ti;
+	struct dm_dev *origin;
+	struct dm_dev *cache;
+
+	sector_t block_size;
+	unsigned block_shift;
+	sector_t nr_blocks;
+	sector_t meta_sectors;
+	sector_t data_start;
+
+	struct cache_block *blocks;
+	struct cache_disk_entry *meta;
+
+	/* protects the hash, the lists and the block states */
+	spinlock_t lock;
+	struct hlist_head *buckets;
+	unsigned hash_bits;
+	struct list_head lru;
+	struct list_head free;
+	struct list_head work_list;
+	sector_t nr_dirty;
+
+	struct dm_io_client *io_client;
+	struct dm_kcopyd_client *kc;
+	atomic_t nr_copies;
+	atomic_t nr_writeback;
+	wait_queue_head_t copy_wait;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work writeback;
+
+	unsigned long read_hits;
+	unsigned long read_misses;
+	unsigned long write_hits;
+	unsigned long write_misses;
+	unsigned long promotions;
+	unsigned long writebacks;
+};
+
+static int __cache_map(struct cache_c *cc, struct bio *bio,
+		       union map_info *map_context);
+
+static sector_t block_to_sector(struct cache_c *cc, struct cache_block *cb)
+{
+	return cc->data_start + ((sector_t)(cb - cc->blocks) << cc->block_shift);
+}
+
+static struct cache_block *cache_lookup(struct cache_c *cc, sector_t oblock)
+{
+	struct cache_block *cb;
+	struct hlist_node *pos;
+	struct hlist_head *bucket = &cc->buckets[hash_64(oblock, cc->hash_bits)];
+
+	hlist_for_each_entry(cb, pos, bucket, hlist)
+		if (cb->oblock == oblock)
+			return cb;
+
+	return NULL;
+}
+
+static void cache_insert(struct cache_c *cc, struct cache_block *cb,
+			 sector_t oblock)
+{
+	cb->oblock = oblock;
+	hlist_add_head(&cb->hlist, &cc->buckets[hash_64(oblock, cc->hash_bits)]);
+}
+
+/*
+ * Get a block to cache a new oblock in: a free one, or the least recently
+ * used clean and idle one.
+ */
+static struct cache_block *cache_alloc_block(struct cache_c *cc)
+{
+	struct cache_block *cb;
+	int scanned = 0;
+
+	if (!list_empty(&cc->free)) {
+		cb = list_first_entry(&cc->free, struct cache_block, lru);
+		list_move_tail(&cb->lru, &cc->lru);
+		return cb;
+	}
+
+	list_for_each_entry(cb, &cc->lru, lru) {
+		if (scanned++ == ALLOC_SCAN)
+			break;
+		if (test_bit(CB_DIRTY, &cb->flags) ||
+		    test_bit(CB_BUSY, &cb->flags) || atomic_read(&cb->pending))
+			continue;
+
+		hlist_del_init(&cb->hlist);
+		cb->flags = 0;
+		list_move_tail(&cb->lru, &cc->lru);
+		return cb;
+	}
+
+	return NULL;
+}
+
+/* lock is held */
+static void queue_action(struct cache_c *cc, struct cache_block *cb,
+			 enum cache_action action)
+{
+	cb->action = action;
+	list_add_tail(&cb->wlist, &cc->work_list);
+	queue_work(cc->wq, &cc->worker);
+}
+
+static void cache_redispatch(struct cache_c *cc, struct bio *bio)
+{
+	if (__cache_map(cc, bio, dm_get_mapinfo(bio)) == DM_MAPIO_REMAPPED)
+		generic_make_request(bio);
+}
+
+/*
+ * The block is idle again: resubmit the bios that waited for it, or fail
+ * them with @error. With @release, the block goes back to the free list.
+ */
+static void cache_finish(struct cache_c *cc, struct cache_block *cb,
+			 int release, int error)
+{
+	struct bio_list bios;
+	struct bio *bio;
+
+	spin_lock(&cc->lock);
+	if (release) {
+		hlist_del_init(&cb->hlist);
+		if (test_bit(CB_DIRTY, &cb->flags))
+			cc->nr_dirty--;
+		cb->flags = 0;
+		list_move(&cb->lru, &cc->free);
+	} else
+		clear_bit(CB_BUSY, &cb->flags);
+	bios = cb->deferred;
+	bio_list_init(&cb->deferred);
+	spin_unlock(&cc->lock);
+
+	while ((bio = bio_list_pop(&bios))) {
+		if (error)
+			bio_endio(bio, error);
+		else
+			cache_redispatch(cc, bio);
+	}
+}
+
+/*-----------------------------------------------------------------
+ * Metadata and data I/O, done synchronously by the worker.
+ *---------------------------------------------------------------*/
+static int cache_io(struct cache_c *cc, int rw, struct dm_dev *dev,
+		    sector_t sector, sector_t count, struct dm_io_memory *mem)
+{
+	struct dm_io_region where = {
+		.bdev = dev->bdev,
+		.sector = sector,
+		.count = count,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem = *mem,
+		.notify.fn = NULL,
+		.client = cc->io_client,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+static int cache_meta_io(struct cache_c *cc, int rw, sector_t sector,
+			 sector_t count)
+{
+	struct dm_io_memory mem = {
+		.type = DM_IO_VMA,
+		.ptr.vma = (char *)cc->meta + (sector << SECTOR_SHIFT),
+	};
+
+	return cache_io(cc, rw, cc->cache, 1 + sector, count, &mem);
+}
+
+static int cache_write_entry(struct cache_c *cc, struct cache_block *cb,
+			     u64 flags)
+{
+	sector_t idx = cb - cc->blocks;
+	struct cache_disk_entry *e = &cc->meta[idx];
+
+	e->oblock = cpu_to_le64(cb->oblock);
+	e->flags = cpu_to_le64(flags);
+
+	/* idx becomes the metadata sector of the entry */
+	sector_div(idx, ENTRIES_PER_SECTOR);
+	return cache_meta_io(cc, WRITE_FLUSH_FUA, idx, 1);
+}
+
+/* Before the data of a block is replaced, its old mapping must go */
+static int cache_invalidate_entry(struct cache_c *cc, struct cache_block *cb)
+{
+	if (!(le64_to_cpu(cc->meta[cb - cc->blocks].flags) & CDE_VALID))
+		return 0;
+
+	return cache_write_entry(cc, cb, 0);
+}
+
+static int cache_flush_origin(struct cache_c *cc)
+{
+	struct dm_io_memory mem = {
+		.type = DM_IO_KMEM,
+		.ptr.addr = NULL,
+	};
+
+	return cache_io(cc, WRITE_FLUSH, cc->origin, 0, 0, &mem);
+}
+
+static void copy_done(struct cache_c *cc)
+{
+	if (atomic_dec_and_test(&cc->nr_copies))
+		wake_up(&cc->copy_wait);
+}
+
+static void promote_done(int read_err, unsigned long write_err, void *context)
+{
+	struct cache_block *cb = context;
+	struct cache_c *cc = cb->cc;
+
+	cb->error = (read_err || write_err) ? -EIO : 0;
+
+	spin_lock(&cc->lock);
+	queue_action(cc, cb, CA_PROMOTED);
+	spin_unlock(&cc->lock);
+
+	copy_done(cc);
+}
+
+static void writeback_done(int read_err, unsigned long write_err,
+			   void *context)
+{
+	struct cache_block *cb = context;
+	struct cache_c *cc = cb->cc;
+
+	cb->error = (read_err || write_err) ? -EIO : 0;
+
+	spin_lock(&cc->lock);
+	queue_action(cc, cb, CA_WRITTEN_BACK);
+	spin_unlock(&cc->lock);
+
+	atomic_dec(&cc->nr_writeback);
+	copy_done(cc);
+}
+
+static void cache_copy(struct cache_c *cc, struct cache_block *cb,
+		       int to_cache, dm_kcopyd_notify_fn fn)
+{
+	struct dm_io_region origin = {
+		.bdev = cc->origin->bdev,
+		.sector = cb->oblock << cc->block_shift,
+		.count = cc->block_size,
+	};
+	struct dm_io_region cache = {
+		.bdev = cc->cache->bdev,
+		.sector = block_to_sector(cc, cb),
+		.count = cc->block_size,
+	};
+	int r;
+
+	atomic_inc(&cc->nr_copies);
+	if (to_cache)
+		r = dm_kcopyd_copy(cc->kc, &origin, 1, &cache, 0, fn, cb);
+	else
+		r = dm_kcopyd_copy(cc->kc, &cache, 1, &origin, 0, fn, cb);
+	if (r < 0)
+		fn(1, 0, cb);
+}
+
+static void do_write(struct cache_c *cc, struct cache_block *cb)
+{
+	struct bio *bio = cb->bio;
+	struct dm_io_memory mem = {
+		.type = DM_IO_BVEC,
+		.ptr.bvec = bio->bi_io_vec + bio->bi_idx,
+	};
+	int r;
+
+	cb->bio = NULL;
+
+	r = cache_invalidate_entry(cc, cb);
+	if (!r)
+		r = cache_io(cc, WRITE, cc->cache, block_to_sector(cc, cb),
+			     cc->block_size, &mem);
+	if (!r)
+		r = cache_write_entry(cc, cb, CDE_VALID | CDE_DIRTY);
+
+	if (r) {
+		/* write around the cache instead */
+		cache_finish(cc, cb, 1, 0);
+		bio->bi_bdev = cc->origin->bdev;
+		bio->bi_sector = dm_target_offset(cc->ti, bio->bi_sector);
+		generic_make_request(bio);
+		return;
+	}
+
+	bio_endio(bio, 0);
+	cache_finish(cc, cb, 0, 0);
+}
+
+static void do_worker(struct work_struct *work)
+{
+	struct cache_c *cc = container_of(work, struct cache_c, worker);
+	struct cache_block *cb, *tmp;
+	int origin_flushed = 0, flush_err = 0;
+	LIST_HEAD(list);
+	int r;
+
+	spin_lock(&cc->lock);
+	list_splice_init(&cc->work_list, &list);
+	spin_unlock(&cc->lock);
+
+	list_for_each_entry_safe(cb, tmp, &list, wlist) {
+		list_del_init(&cb->wlist);
+
+		switch (cb->action) {
+		case CA_DIRTY:
+			r = cache_write_entry(cc, cb, CDE_VALID | CDE_DIRTY);
+			if (r)
+				DMERR("failed to mark block %llu dirty",
+				      (unsigned long long)cb->oblock);
+			cache_finish(cc, cb, 0, r);
+			break;
+
+		case CA_WRITE:
+			do_write(cc, cb);
+			break;
+
+		case CA_PROMOTE:
+			if (cache_invalidate_entry(cc, cb))
+				cache_finish(cc, cb, 1, 0);
+			else
+				cache_copy(cc, cb, 1, promote_done);
+			break;
+
+		case CA_PROMOTED:
+			r = cb->error;
+			if (!r)
+				r = cache_write_entry(cc, cb, CDE_VALID);
+			if (!r) {
+				spin_lock(&cc->lock);
+				set_bit(CB_VALID, &cb->flags);
+				cc->promotions++;
+				spin_unlock(&cc->lock);
+			}
+			cache_finish(cc, cb, r != 0, 0);
+			break;
+
+		case CA_WRITTEN_BACK:
+			/* one flush makes all the copies so far stable */
+			if (!origin_flushed) {
+				flush_err = cache_flush_origin(cc);
+				origin_flushed = 1;
+			}
+			r = cb->error ? cb->error : flush_err;
+			if (!r)
+				r = cache_write_entry(cc, cb, CDE_VALID);
+			if (!r) {
+				spin_lock(&cc->lock);
+				clear_bit(CB_DIRTY, &cb->flags);
+				cc->nr_dirty--;
+				cc->writebacks++;
+				spin_unlock(&cc->lock);
+			}
+			cache_finish(cc, cb, 0, 0);
+			break;
+		}
+	}
+}
+
+/*
+ * Write back the least recently used dirty blocks, a batch at a time.
+ */
+static void do_writeback(struct work_struct *work)
+{
+	struct cache_c *cc = container_of(to_delayed_work(work),
+					  struct cache_c, writeback);
+	struct cache_block *cb, *tmp;
+	LIST_HEAD(list);
+	int n = 0;
+
+	spin_lock(&cc->lock);
+	if (cc->nr_dirty && !atomic_read(&cc->nr_writeback))
+		list_for_each_entry(cb, &cc->lru, lru) {
+			if (n == WRITEBACK_BATCH)
+				break;
+			if (!test_bit(CB_DIRTY, &cb->flags) ||
+			    test_bit(CB_BUSY, &cb->flags) ||
+			    atomic_read(&cb->pending))
+				continue;
+
+			set_bit(CB_BUSY, &cb->flags);
+			list_add_tail(&cb->wlist, &list);
+			n++;
+		}
+	spin_unlock(&cc->lock);
+
+	atomic_add(n, &cc->nr_writeback);
+	list_for_each_entry_safe(cb, tmp, &list, wlist) {
+		list_del_init(&cb->wlist);
+		cache_copy(cc, cb, 0, writeback_done);
+	}
+
+	queue_delayed_work(cc->wq, &cc->writeback,
+			   n == WRITEBACK_BATCH ? HZ / 10 : HZ);
+}
+
+/*-----------------------------------------------------------------
+ * Loading and formatting the metadata.
+ *---------------------------------------------------------------*/
+static int cache_load(struct cache_c *cc)
+{
+	struct cache_disk_super *super;
+	struct dm_io_memory mem = { .type = DM_IO_KMEM };
+	sector_t i;
+	int r;
+
+	super = kzalloc(1 << SECTOR_SHIFT, GFP_KERNEL);
+	if (!super)
+		return -ENOMEM;
+	mem.ptr.addr = super;
+
+	r = cache_io(cc, READ, cc->cache, 0, 1, &mem);
+	if (r)
+		goto out;
+
+	if (le32_to_cpu(super->magic) == CACHE_MAGIC &&
+	    le32_to_cpu(super->version) == CACHE_VERSION &&
+	    le32_to_cpu(super->block_size) == cc->block_size &&
+	    le64_to_cpu(super->nr_blocks) == cc->nr_blocks)
+		r = cache_meta_io(cc, READ, 0, cc->meta_sectors);
+	else {
+		DMINFO("formatting cache device %s", cc->cache->name);
+
+		r = cache_meta_io(cc, WRITE, 0, cc->meta_sectors);
+		if (r)
+			goto out;
+
+		memset(super, 0, 1 << SECTOR_SHIFT);
+		super->magic = cpu_to_le32(CACHE_MAGIC);
+		super->version = cpu_to_le32(CACHE_VERSION);
+		super->block_size = cpu_to_le32(cc->block_size);
+		super->nr_blocks = cpu_to_le64(cc->nr_blocks);
+		r = cache_io(cc, WRITE_FLUSH_FUA, cc->cache, 0, 1, &mem);
+	}
+	if (r)
+		goto out;
+
+	for (i = 0; i < cc->nr_blocks; i++) {
+		struct cache_block *cb = &cc->blocks[i];
+		u64 flags = le64_to_cpu(cc->meta[i].flags);
+
+		if (!(flags & CDE_VALID)) {
+			list_add_tail(&cb->lru, &cc->free);
+			continue;
+		}
+
+		cache_insert(cc, cb, le64_to_cpu(cc->meta[i].oblock));
+		set_bit(CB_VALID, &cb->flags);
+		if (flags & CDE_DIRTY) {
+			set_bit(CB_DIRTY, &cb->flags);
+			cc->nr_dirty++;
+		}
+		list_add_tail(&cb->lru, &cc->lru);
+	}
+
+out:
+	kfree(super);
+	return r;
+}
+
+/* Split the cache device into the metadata and as many blocks as fit */
+static int cache_geometry(struct cache_c *cc)
+{
+	sector_t size = i_size_read(cc->cache->bdev->bd_inode) >> SECTOR_SHIFT;
+	sector_t nr = size >> cc->block_shift;
+
+	while (nr) {
+		cc->meta_sectors = nr + ENTRIES_PER_SECTOR - 1;
+		sector_div(cc->meta_sectors, ENTRIES_PER_SECTOR);
+		cc->data_start = ALIGN(1 + cc->meta_sectors, cc->block_size);
+		if (cc->data_start + (nr << cc->block_shift) <= size)
+			break;
+		nr--;
+	}
+
+	cc->nr_blocks = nr;
+	return nr ? 0 : -ENOSPC;
+}
+
+static void cache_dtr(struct dm_target *ti);
+
+/*
+ * Construct a cache mapping:
+ *   <origin dev> <cache dev> <block size>
+ *
+ * The block size is in sectors, and must be a power of 2 of at least a
+ * page.
+ */
+static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct cache_c *cc;
+	unsigned long block_size;
+	sector_t i;
+	int r = -EINVAL;
+
+	if (argc != 3) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (strict_strtoul(argv[2], 10, &block_size) ||
+	    !is_power_of_2(block_size) ||
+	    block_size < (PAGE_SIZE >> SECTOR_SHIFT) ||
+	    (ti->len & (block_size - 1))) {
+		ti->error = "Invalid block size";
+		return -EINVAL;
+	}
+
+	cc = kzalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc) {
+		ti->error = "Cannot allocate cache context";
+		return -ENOMEM;
+	}
+	ti->private = cc;
+	cc->ti = ti;
+	cc->block_size = block_size;
+	cc->block_shift = ffs(block_size) - 1;
+	spin_lock_init(&cc->lock);
+	INIT_LIST_HEAD(&cc->lru);
+	INIT_LIST_HEAD(&cc->free);
+	INIT_LIST_HEAD(&cc->work_list);
+	atomic_set(&cc->nr_copies, 0);
+	atomic_set(&cc->nr_writeback, 0);
+	init_waitqueue_head(&cc->copy_wait);
+	INIT_WORK(&cc->worker, do_worker);
+	INIT_DELAYED_WORK(&cc->writeback, do_writeback);
+
+	if (dm_get_device(ti, argv[0], dm_table_get_mode(ti->table),
+			  &cc->origin)) {
+		ti->error = "Origin device lookup failed";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[1], FMODE_READ | FMODE_WRITE, &cc->cache)) {
+		ti->error = "Cache device lookup failed";
+		goto bad;
+	}
+
+	r = cache_geometry(cc);
+	if (r) {
+		ti->error = "Cache device too small";
+		goto bad;
+	}
+
+	r = -ENOMEM;
+	cc->blocks = vzalloc(cc->nr_blocks * sizeof(*cc->blocks));
+	cc->meta = vzalloc(cc->meta_sectors << SECTOR_SHIFT);
+	cc->hash_bits = ilog2(roundup_pow_of_two(max_t(sector_t,
+						 cc->nr_blocks >> 2, 16)));
+	cc->buckets = vzalloc(sizeof(*cc->buckets) << cc->hash_bits);
+	if (!cc->blocks || !cc->meta || !cc->buckets) {
+		ti->error = "Cannot allocate cache metadata";
+		goto bad;
+	}
+
+	for (i = 0; i < cc->nr_blocks; i++) {
+		struct cache_block *cb = &cc->blocks[i];
+
+		cb->cc = cc;
+		INIT_HLIST_NODE(&cb->hlist);
+		INIT_LIST_HEAD(&cb->wlist);
+		atomic_set(&cb->pending, 0);
+		bio_list_init(&cb->deferred);
+	}
+
+	cc->io_client = dm_io_client_create();
+	if (IS_ERR(cc->io_client)) {
+		r = PTR_ERR(cc->io_client);
+		cc->io_client = NULL;
+		ti->error = "Cannot allocate dm-io client";
+		goto bad;
+	}
+
+	cc->kc = dm_kcopyd_client_create();
+	if (IS_ERR(cc->kc)) {
+		r = PTR_ERR(cc->kc);
+		cc->kc = NULL;
+		ti->error = "Cannot allocate kcopyd client";
+		goto bad;
+	}
+
+	cc->wq = create_singlethread_workqueue("kcached");
+	if (!cc->wq) {
+		ti->error = "Cannot allocate workqueue";
+		goto bad;
+	}
+
+	r = cache_load(cc);
+	if (r) {
+		ti->error = "Cannot read cache metadata";
+		goto bad;
+	}
+
+	ti->split_io = cc->block_size;
+	ti->num_flush_requests = 2;
+	return 0;
+
+bad:
+	cache_dtr(ti);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	if (cc->wq) {
+		cancel_delayed_work_sync(&cc->writeback);
+		wait_event(cc->copy_wait, !atomic_read(&cc->nr_copies));
+		destroy_workqueue(cc->wq);
+	}
+	if (cc->kc)
+		dm_kcopyd_client_destroy(cc->kc);
+	if (cc->io_client)
+		dm_io_client_destroy(cc->io_client);
+
+	vfree(cc->buckets);
+	vfree(cc->meta);
+	vfree(cc->blocks);
+
+	if (cc->cache)
+		dm_put_device(ti, cc->cache);
+	if (cc->origin)
+		dm_put_device(ti, cc->origin);
+	kfree(cc);
+}
+
+/*
+ * Reads and writes of a cached block go to the cache device. Writes of a
+ * clean block wait for it to be marked dirty on disk first. Read misses
+ * go to the origin, and get the block promoted to the cache in the
+ * background. Write misses of a whole block are cached, other write
+ * misses go to the origin.
+ */
+static int __cache_map(struct cache_c *cc, struct bio *bio,
+		       union map_info *map_context)
+{
+	sector_t sector = dm_target_offset(cc->ti, bio->bi_sector);
+	sector_t oblock = sector >> cc->block_shift;
+	int rw = bio_data_dir(bio);
+	struct cache_block *cb;
+
+	map_context->ptr = NULL;
+
+	spin_lock(&cc->lock);
+	cb = cache_lookup(cc, oblock);
+	if (cb) {
+		if (test_bit(CB_BUSY, &cb->flags))
+			goto defer;
+
+		if (rw == WRITE && !test_bit(CB_DIRTY, &cb->flags)) {
+			set_bit(CB_BUSY, &cb->flags);
+			set_bit(CB_DIRTY, &cb->flags);
+			cc->nr_dirty++;
+			queue_action(cc, cb, CA_DIRTY);
+			goto defer;
+		}
+
+		if (rw == WRITE)
+			cc->write_hits++;
+		else
+			cc->read_hits++;
+		list_move_tail(&cb->lru, &cc->lru);
+		atomic_inc(&cb->pending);
+		map_context->ptr = cb;
+		spin_unlock(&cc->lock);
+
+		bio->bi_bdev = cc->cache->bdev;
+		bio->bi_sector = block_to_sector(cc, cb) +
+				 (sector & (cc->block_size - 1));
+		return DM_MAPIO_REMAPPED;
+	}
+
+	if (rw == WRITE)
+		cc->write_misses++;
+	else
+		cc->read_misses++;
+
+	if (rw == READ || bio->bi_size == cc->block_size << SECTOR_SHIFT) {
+		cb = cache_alloc_block(cc);
+		if (cb) {
+			cache_insert(cc, cb, oblock);
+			set_bit(CB_BUSY, &cb->flags);
+			if (rw == WRITE) {
+				set_bit(CB_VALID, &cb->flags);
+				set_bit(CB_DIRTY, &cb->flags);
+				cc->nr_dirty++;
+				cb->bio = bio;
+				queue_action(cc, cb, CA_WRITE);
+				spin_unlock(&cc->lock);
+				return DM_MAPIO_SUBMITTED;
+			}
+			queue_action(cc, cb, CA_PROMOTE);
+		}
+	}
+	spin_unlock(&cc->lock);
+
+	bio->bi_bdev = cc->origin->bdev;
+	bio->bi_sector = sector;
+	return DM_MAPIO_REMAPPED;
+
+defer:
+	bio_list_add(&cb->deferred, bio);
+	spin_unlock(&cc->lock);
+	return DM_MAPIO_SUBMITTED;
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache_c *cc = ti->private;
+
+	if (bio->bi_rw & REQ_FLUSH) {
+		if (map_context->target_request_nr)
+			bio->bi_bdev = cc->cache->bdev;
+		else
+			bio->bi_bdev = cc->origin->bdev;
+		map_context->ptr = NULL;
+		return DM_MAPIO_REMAPPED;
+	}
+
+	return __cache_map(cc, bio, map_context);
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct cache_block *cb = map_context->ptr;
+
+	if (cb)
+		atomic_dec(&cb->pending);
+
+	return error;
+}
+
+static void cache_presuspend(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	cancel_delayed_work_sync(&cc->writeback);
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	wait_event(cc->copy_wait, !atomic_read(&cc->nr_copies));
+	flush_workqueue(cc->wq);
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	queue_delayed_work(cc->wq, &cc->writeback, HZ);
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned int maxlen)
+{
+	struct cache_c *cc = ti->private;
+	unsigned int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock(&cc->lock);
+		DMEMIT("%lu %lu %lu %lu %lu %lu %llu/%llu",
+		       cc->read_hits, cc->read_misses,
+		       cc->write_hits, cc->write_misses,
+		       cc->promotions, cc->writebacks,
+		       (unsigned long long)cc->nr_dirty,
+		       (unsigned long long)cc->nr_blocks);
+		spin_unlock(&cc->lock);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %llu", cc->origin->name, cc->cache->name,
+		       (unsigned long long)cc->block_size);
+		break;
+	}
+	return 0;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	struct cache_c *cc = ti->private;
+	int r;
+
+	r = fn(ti, cc->origin, 0, ti->len, data);
+	if (!r)
+		r = fn(ti, cc->cache, 0, cc->data_start +
+		       (cc->nr_blocks << cc->block_shift), data);
+
+	return r;
+}
+
+static struct target_type cache_target = {
+	.name   = "cache",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr    = cache_ctr,
+	.dtr    = cache_dtr,
+	.map    = cache_map,
+	.end_io = cache_end_io,
+	.presuspend = cache_presuspend,
+	.postsuspend = cache_postsuspend,
+	.resume	= cache_resume,
+	.status = cache_status,
+	.iterate_devices = cache_iterate_devices,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r = dm_register_target(&cache_target);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+}
+
+/* Module hooks */
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " write-back cache target");
+MODULE_LICENSE("GPL");
@@ -19,6 +19,8 @@
 #include <linux/workqueue.h>
 #include <linux/backing-dev.h>
 #include <linux/percpu.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
 #include <asm/atomic.h>
 #include <linux/scatterlist.h>
 #include <asm/page.h>
@@ -134,6 +136,14 @@ struct crypt_config {
 
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
+	unsigned int crypt_cpu;
+
+	/*
+	 * encrypted writes, submitted in sector order by write_thread
+	 */
+	struct task_struct *write_thread;
+	spinlock_t write_lock;
+	struct bio_list write_list;
 
 	char *cipher;
 	char *cipher_string;
@@ -951,6 +961,10 @@ static void crypt_dec_pending(struct dm_crypt_io *io)
  *
  * The work is done per CPU global for all dm-crypt instances.
  * They should not depend on each other and do not block.
+ *
+ * kcryptd work is spread over the online CPUs in turn, so that the bios
+ * of a single submitter are encrypted in parallel. The encrypted writes
+ * are then handed to dmcrypt_write, which submits them in sector order.
  */
 static void crypt_endio(struct bio *clone, int error)
 {
@@ -1020,23 +1034,14 @@ static int kcryptd_io_read(struct dm_crypt_io *io, gfp_t gfp)
 	return 0;
 }
 
-static void kcryptd_io_write(struct dm_crypt_io *io)
-{
-	struct bio *clone = io->ctx.bio_out;
-	generic_make_request(clone);
-}
-
 static void kcryptd_io(struct work_struct *work)
 {
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
 
-	if (bio_data_dir(io->base_bio) == READ) {
-		crypt_inc_pending(io);
-		if (kcryptd_io_read(io, GFP_NOIO))
-			io->error = -ENOMEM;
-		crypt_dec_pending(io);
-	} else
-		kcryptd_io_write(io);
+	crypt_inc_pending(io);
+	if (kcryptd_io_read(io, GFP_NOIO))
+		io->error = -ENOMEM;
+	crypt_dec_pending(io);
 }
 
 static void kcryptd_queue_io(struct dm_crypt_io *io)
@@ -1047,8 +1052,67 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 	queue_work(cc->io_queue, &io->work);
 }
 
-static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
-					  int error, int async)
+static int dmcrypt_write(void *data)
+{
+	struct crypt_config *cc = data;
+	struct bio_list bios;
+	struct blk_plug plug;
+	struct bio *clone;
+
+	while (1) {
+		spin_lock_irq(&cc->write_lock);
+		while (bio_list_empty(&cc->write_list)) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			spin_unlock_irq(&cc->write_lock);
+
+			if (kthread_should_stop()) {
+				__set_current_state(TASK_RUNNING);
+				return 0;
+			}
+
+			schedule();
+			spin_lock_irq(&cc->write_lock);
+		}
+		__set_current_state(TASK_RUNNING);
+
+		bios = cc->write_list;
+		bio_list_init(&cc->write_list);
+		spin_unlock_irq(&cc->write_lock);
+
+		blk_start_plug(&plug);
+		while ((clone = bio_list_pop(&bios)))
+			generic_make_request(clone);
+		blk_finish_plug(&plug);
+	}
+}
+
+/*
+ * Queue an encrypted clone for dmcrypt_write, keeping the list sorted by
+ * sector. Clones mostly arrive in order, so they are usually appended.
+ */
+static void kcryptd_queue_write(struct crypt_config *cc, struct bio *clone)
+{
+	struct bio_list *bl = &cc->write_list;
+	struct bio **p;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc->write_lock, flags);
+
+	if (!bl->tail || bl->tail->bi_sector <= clone->bi_sector)
+		bio_list_add(bl, clone);
+	else {
+		for (p = &bl->head; (*p)->bi_sector <= clone->bi_sector;
+		     p = &(*p)->bi_next)
+			;
+		clone->bi_next = *p;
+		*p = clone;
+	}
+
+	wake_up_process(cc->write_thread);
+	spin_unlock_irqrestore(&cc->write_lock, flags);
+}
+
+static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int error)
 {
 	struct bio *clone = io->ctx.bio_out;
 	struct crypt_config *cc = io->target->private;
@@ -1066,10 +1130,7 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
-		kcryptd_queue_io(io);
-	else
-		generic_make_request(clone);
+	kcryptd_queue_write(cc, clone);
 }
 
 static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
@@ -1112,7 +1173,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 
 		/* Encryption was already finished, submit io now */
 		if (crypt_finished) {
-			kcryptd_crypt_write_io_submit(io, r, 0);
+			kcryptd_crypt_write_io_submit(io, r);
 
 			/*
 			 * If there was an error, do not try next fragments.
@@ -1213,7 +1274,7 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_crypt_read_done(io, error);
 	else
-		kcryptd_crypt_write_io_submit(io, error, 1);
+		kcryptd_crypt_write_io_submit(io, error);
 }
 
 static void kcryptd_crypt(struct work_struct *work)
@@ -1226,12 +1287,23 @@ static void kcryptd_crypt(struct work_struct *work)
 		kcryptd_crypt_write_convert(io);
 }
 
+/*
+ * The crypto state is per CPU and crypt_queue is bound, so hand the ios
+ * to the online CPUs in turn to encrypt them in parallel. Racing updates
+ * of crypt_cpu only make the distribution a bit less even.
+ */
 static void kcryptd_queue_crypt(struct dm_crypt_io *io)
 {
 	struct crypt_config *cc = io->target->private;
+	unsigned int cpu;
+
+	cpu = cpumask_next(cc->crypt_cpu, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_online_mask);
+	cc->crypt_cpu = cpu;
 
 	INIT_WORK(&io->work, kcryptd_crypt);
-	queue_work(cc->crypt_queue, &io->work);
+	queue_work_on(cpu, cc->crypt_queue, &io->work);
 }
 
 /*
@@ -1372,6 +1444,8 @@ static void crypt_dtr(struct dm_target *ti)
 		destroy_workqueue(cc->io_queue);
 	if (cc->crypt_queue)
 		destroy_workqueue(cc->crypt_queue);
+	if (cc->write_thread)
+		kthread_stop(cc->write_thread);
 
 	if (cc->cpu)
 		for_each_possible_cpu(cpu) {
@@ -1668,6 +1742,18 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad;
 	}
 
+	spin_lock_init(&cc->write_lock);
+	bio_list_init(&cc->write_list);
+
+	cc->write_thread = kthread_create(dmcrypt_write, cc, "dmcrypt_write");
+	if (IS_ERR(cc->write_thread)) {
+		ret = PTR_ERR(cc->write_thread);
+		cc->write_thread = NULL;
+		ti->error = "Couldn't spawn write thread";
+		goto bad;
+	}
+	wake_up_process(cc->write_thread);
+
 	ti->num_flush_requests = 1;
 	return 0;
 
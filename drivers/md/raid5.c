@@ -193,18 +193,69 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+static struct workqueue_struct *raid5_wq;
+
+/* stripes a worker is expected to get through before another one is woken */
+#define RAID5_STRIPE_BATCH	8
+
+/* device_lock is held */
+static int raid5_worker_cpu(struct r5worker_group *group, int node)
+{
+	const struct cpumask *mask = cpumask_of_node(node);
+	int cpu;
+
+	cpu = cpumask_next_and(group->cpu, mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first_and(mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = raw_smp_processor_id();
+	group->cpu = cpu;
+	return cpu;
+}
+
+/* device_lock is held */
+static void raid5_wakeup_stripe_thread(raid5_conf_t *conf,
+				       struct r5worker_group *group)
+{
+	int node = group - conf->worker_groups;
+	int needed = DIV_ROUND_UP(group->stripes_cnt, RAID5_STRIPE_BATCH);
+	int i;
+
+	for (i = 0; i < conf->worker_cnt_per_group && needed > 0; i++) {
+		struct r5worker *worker = &group->workers[i];
+
+		needed--;
+		if (worker->working)
+			continue;
+		worker->working = true;
+		queue_work_on(raid5_worker_cpu(group, node), raid5_wq,
+			      &worker->work);
+	}
+}
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
 		BUG_ON(!list_empty(&sh->lru));
 		BUG_ON(atomic_read(&conf->active_stripes)==0);
 		if (test_bit(STRIPE_HANDLE, &sh->state)) {
-			if (test_bit(STRIPE_DELAYED, &sh->state))
+			if (test_bit(STRIPE_DELAYED, &sh->state)) {
+				sh->delay_stamp = jiffies;
 				list_add_tail(&sh->lru, &conf->delayed_list);
-			else if (test_bit(STRIPE_BIT_DELAY, &sh->state) &&
+			} else if (test_bit(STRIPE_BIT_DELAY, &sh->state) &&
 				   sh->bm_seq - conf->seq_write > 0)
 				list_add_tail(&sh->lru, &conf->bitmap_list);
-			else {
+			else if (conf->worker_cnt_per_group) {
+				struct r5worker_group *group;
+
+				clear_bit(STRIPE_BIT_DELAY, &sh->state);
+				group = &conf->worker_groups[cpu_to_node(sh->cpu)];
+				sh->group = group;
+				list_add_tail(&sh->lru, &group->handle_list);
+				group->stripes_cnt++;
+				raid5_wakeup_stripe_thread(conf, group);
+				return;
+			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
 				list_add_tail(&sh->lru, &conf->handle_list);
 			}
@@ -328,6 +379,7 @@ static void init_stripe(struct stripe_head *sh, sector_t sector, int previous)
 	sh->generation = conf->generation - previous;
 	sh->disks = previous ? conf->previous_raid_disks : conf->raid_disks;
 	sh->sector = sector;
+	sh->cpu = raw_smp_processor_id();
 	stripe_set_idx(sector, conf, previous, sh);
 	sh->state = 0;
 
@@ -3606,13 +3658,28 @@ static void handle_stripe(struct stripe_head *sh)
 		handle_stripe5(sh);
 }
 
+/*
+ * With write_defer_ms set, a stripe waiting to read for a partial write is
+ * only activated once it has waited that long, in case (sequential) writers
+ * complete the stripe meanwhile and spare the read. The delayed_list is in
+ * the order the stripes were delayed, so stop at the first recent one and
+ * come back when it expires.
+ */
 static void raid5_activate_delayed(raid5_conf_t *conf)
 {
+	unsigned long defer = msecs_to_jiffies(conf->write_defer_ms);
+
 	if (atomic_read(&conf->preread_active_stripes) < IO_THRESHOLD) {
 		while (!list_empty(&conf->delayed_list)) {
 			struct list_head *l = conf->delayed_list.next;
 			struct stripe_head *sh;
 			sh = list_entry(l, struct stripe_head, lru);
+			if (defer && time_before(jiffies,
+						 sh->delay_stamp + defer)) {
+				mod_timer(&conf->defer_timer,
+					  sh->delay_stamp + defer);
+				break;
+			}
 			list_del_init(l);
 			clear_bit(STRIPE_DELAYED, &sh->state);
 			if (!test_and_set_bit(STRIPE_PREREAD_ACTIVE, &sh->state))
@@ -3622,6 +3689,13 @@ static void raid5_activate_delayed(raid5_conf_t *conf)
 	}
 }
 
+static void raid5_defer_timeout(unsigned long data)
+{
+	raid5_conf_t *conf = (raid5_conf_t *)data;
+
+	md_wakeup_thread(conf->mddev->thread);
+}
+
 static void activate_bit_delay(raid5_conf_t *conf)
 {
 	/* device_lock is held */
@@ -3872,19 +3946,35 @@ static int chunk_aligned_read(mddev_t *mddev, struct bio * raid_bio)
  * stripe with in flight i/o.  The bypass_count will be reset when the
  * head of the hold_list has changed, i.e. the head was promoted to the
  * handle_list.
+ *
+ * With worker groups, the handle_list is that of @group, or the first busy
+ * one if @group is ANY_GROUP.
  */
-static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
+#define ANY_GROUP	NUMA_NO_NODE
+
+static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf, int group)
 {
 	struct stripe_head *sh;
+	struct list_head *handle_list = &conf->handle_list;
+	int i;
+
+	if (conf->worker_cnt_per_group && group != ANY_GROUP)
+		handle_list = &conf->worker_groups[group].handle_list;
+	else if (conf->worker_cnt_per_group)
+		for (i = 0; i < nr_node_ids; i++) {
+			handle_list = &conf->worker_groups[i].handle_list;
+			if (!list_empty(handle_list))
+				break;
+		}
 
 	pr_debug("%s: handle: %s hold: %s full_writes: %d bypass_count: %d\n",
 		  __func__,
-		  list_empty(&conf->handle_list) ? "empty" : "busy",
+		  list_empty(handle_list) ? "empty" : "busy",
 		  list_empty(&conf->hold_list) ? "empty" : "busy",
 		  atomic_read(&conf->pending_full_writes), conf->bypass_count);
 
-	if (!list_empty(&conf->handle_list)) {
-		sh = list_entry(conf->handle_list.next, typeof(*sh), lru);
+	if (!list_empty(handle_list)) {
+		sh = list_entry(handle_list->next, typeof(*sh), lru);
 
 		if (list_empty(&conf->hold_list))
 			conf->bypass_count = 0;
@@ -3911,6 +4001,10 @@ static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
 		return NULL;
 
 	list_del_init(&sh->lru);
+	if (sh->group) {
+		sh->group->stripes_cnt--;
+		sh->group = NULL;
+	}
 	atomic_inc(&sh->count);
 	BUG_ON(atomic_read(&sh->count) != 1);
 	return sh;
@@ -4498,7 +4592,7 @@ static void raid5d(mddev_t *mddev)
 			handled++;
 		}
 
-		sh = __get_priority_stripe(conf);
+		sh = __get_priority_stripe(conf, ANY_GROUP);
 
 		if (!sh)
 			break;
@@ -4521,6 +4615,89 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("--- raid5d inactive\n");
 }
 
+/*
+ * A worker of a group: handle the stripes of the group, and go back to
+ * sleep once there are none left.
+ */
+static void raid5_do_work(struct work_struct *work)
+{
+	struct r5worker *worker = container_of(work, struct r5worker, work);
+	struct r5worker_group *group = worker->group;
+	raid5_conf_t *conf = group->conf;
+	int group_id = group - conf->worker_groups;
+	struct stripe_head *sh;
+	struct blk_plug plug;
+	int handled = 0;
+
+	pr_debug("+++ raid5worker active\n");
+
+	blk_start_plug(&plug);
+	spin_lock_irq(&conf->device_lock);
+	while ((sh = __get_priority_stripe(conf, group_id))) {
+		spin_unlock_irq(&conf->device_lock);
+
+		handled++;
+		handle_stripe(sh);
+		release_stripe(sh);
+		cond_resched();
+
+		spin_lock_irq(&conf->device_lock);
+	}
+	worker->working = false;
+	spin_unlock_irq(&conf->device_lock);
+	pr_debug("%d stripes handled\n", handled);
+
+	async_tx_issue_pending_all();
+	blk_finish_plug(&plug);
+
+	pr_debug("--- raid5worker inactive\n");
+}
+
+static int alloc_thread_groups(raid5_conf_t *conf, int cnt,
+			       struct r5worker_group **worker_groups)
+{
+	struct r5worker_group *groups;
+	struct r5worker *workers;
+	int i, j;
+
+	*worker_groups = NULL;
+	if (!cnt)
+		return 0;
+
+	groups = kzalloc(nr_node_ids * (sizeof(*groups) +
+					cnt * sizeof(*workers)), GFP_KERNEL);
+	if (!groups)
+		return -ENOMEM;
+	workers = (struct r5worker *)(groups + nr_node_ids);
+
+	for (i = 0; i < nr_node_ids; i++) {
+		struct r5worker_group *group = &groups[i];
+
+		INIT_LIST_HEAD(&group->handle_list);
+		group->conf = conf;
+		group->workers = workers + i * cnt;
+		group->cpu = -1;
+
+		for (j = 0; j < cnt; j++) {
+			group->workers[j].group = group;
+			INIT_WORK(&group->workers[j].work, raid5_do_work);
+		}
+	}
+
+	*worker_groups = groups;
+	return 0;
+}
+
+static void free_thread_groups(struct r5worker_group *worker_groups)
+{
+	if (!worker_groups)
+		return;
+
+	/* let the workers that just ran out of stripes finish up */
+	flush_workqueue(raid5_wq);
+	kfree(worker_groups);
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -4629,10 +4806,98 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_write_defer(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%u\n", conf->write_defer_ms);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_write_defer(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	unsigned long new;
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > MSEC_PER_SEC)
+		return -EINVAL;
+	conf->write_defer_ms = new;
+	md_wakeup_thread(mddev->thread);
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_write_defer = __ATTR(write_defer_ms, S_IRUGO | S_IWUSR,
+			   raid5_show_write_defer,
+			   raid5_store_write_defer);
+
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%d\n", conf->worker_cnt_per_group);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	struct r5worker_group *new_groups, *old_groups;
+	unsigned long new;
+	int err;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > 256)
+		return -EINVAL;
+	if (new == conf->worker_cnt_per_group)
+		return len;
+
+	err = alloc_thread_groups(conf, new, &new_groups);
+	if (err)
+		return err;
+
+	/* no stripe is on a handle_list once the array is quiesced */
+	mddev_suspend(mddev);
+	spin_lock_irq(&conf->device_lock);
+	old_groups = conf->worker_groups;
+	conf->worker_groups = new_groups;
+	conf->worker_cnt_per_group = new;
+	spin_unlock_irq(&conf->device_lock);
+	mddev_resume(mddev);
+
+	free_thread_groups(old_groups);
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_group_thread_cnt.attr,
+	&raid5_write_defer.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4680,6 +4945,8 @@ static void raid5_free_percpu(raid5_conf_t *conf)
 
 static void free_conf(raid5_conf_t *conf)
 {
+	del_timer_sync(&conf->defer_timer);
+	free_thread_groups(conf->worker_groups);
 	shrink_stripes(conf);
 	raid5_free_percpu(conf);
 	kfree(conf->disks);
@@ -4808,6 +5075,8 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 	if (conf == NULL)
 		goto abort;
 	spin_lock_init(&conf->device_lock);
+	setup_timer(&conf->defer_timer, raid5_defer_timeout,
+		    (unsigned long)conf);
 	init_waitqueue_head(&conf->wait_for_stripe);
 	init_waitqueue_head(&conf->wait_for_overlap);
 	INIT_LIST_HEAD(&conf->handle_list);
@@ -5981,6 +6250,10 @@ static struct mdk_personality raid4_personality =
 
 static int __init raid5_init(void)
 {
+	raid5_wq = alloc_workqueue("raid5wq",
+				   WQ_MEM_RECLAIM | WQ_CPU_INTENSIVE, 0);
+	if (!raid5_wq)
+		return -ENOMEM;
 	register_md_personality(&raid6_personality);
 	register_md_personality(&raid5_personality);
 	register_md_personality(&raid4_personality);
@@ -5992,6 +6265,7 @@ static void raid5_exit(void)
 	unregister_md_personality(&raid6_personality);
 	unregister_md_personality(&raid5_personality);
 	unregister_md_personality(&raid4_personality);
+	destroy_workqueue(raid5_wq);
 }
 
 module_init(raid5_init);
@@ -201,6 +201,8 @@ struct stripe_head {
 	struct hlist_node	hash;
 	struct list_head	lru;	      /* inactive_list or handle_list */
 	struct raid5_private_data *raid_conf;
+	int			cpu;	      /* cpu of the last submitter */
+	struct r5worker_group	*group;	      /* worker group handling it */
 	short			generation;	/* increments with every
 						 * reshape */
 	sector_t		sector;		/* sector of this row */
@@ -211,6 +213,7 @@ struct stripe_head {
 	atomic_t		count;	      /* nr of active thread/requests */
 	spinlock_t		lock;
 	int			bm_seq;	/* sequence number for bitmap flushes */
+	unsigned long		delay_stamp; /* when put on the delayed_list */
 	int			disks;		/* disks in stripe */
 	enum check_states	check_state;
 	enum reconstruct_states reconstruct_state;
@@ -344,6 +347,25 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/*
+ * Stripe handling can be spread over worker threads, grouped by NUMA node:
+ * a stripe needing handling goes on the handle_list of the group of its
+ * last submitter, and is handled by one of the workers of that group.
+ */
+struct r5worker {
+	struct work_struct	work;
+	struct r5worker_group	*group;
+	bool			working;
+};
+
+struct r5worker_group {
+	struct list_head	handle_list;
+	struct raid5_private_data *conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;
+	int			cpu;	/* the last cpu a worker was queued on */
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
 	mddev_t			*mddev;
@@ -384,6 +406,13 @@ struct raid5_private_data {
 	int			bypass_threshold; /* preread nice */
 	struct list_head	*last_hold; /* detect hold_list promotions */
 
+	struct r5worker_group	*worker_groups; /* one per node, or NULL */
+	int			worker_cnt_per_group;
+
+	/* partial stripe writes wait this long for the rest of the stripe */
+	unsigned int		write_defer_ms;
+	struct timer_list	defer_timer;
+
 	atomic_t		reshape_stripes; /* stripes with pending writes for reshape */
 	/* unfortunately we need two cache names as we temporarily have
 	 * two caches.
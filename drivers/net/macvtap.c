@@ -14,6 +14,7 @@
 #include <linux/wait.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
+#include <linux/mm.h>
 
 #include <net/net_namespace.h>
 #include <net/rtnetlink.h>
@@ -341,6 +342,7 @@ static int macvtap_open(struct inode *inode, struct file *file)
 	struct net *net = current->nsproxy->net_ns;
 	struct net_device *dev = dev_get_by_index(net, iminor(inode));
 	struct macvtap_queue *q;
+	struct macvlan_dev *vlan;
 	int err;
 
 	err = -ENODEV;
@@ -369,6 +371,15 @@ static int macvtap_open(struct inode *inode, struct file *file)
 	q->flags = IFF_VNET_HDR | IFF_NO_PI | IFF_TAP;
 	q->vnet_hdr_sz = sizeof(struct virtio_net_hdr);
 
+	/*
+	 * Let in-kernel users (i.e. vhost-net) hand us their buffers rather
+	 * than a copy, if the lower device can take them as they are.
+	 */
+	vlan = netdev_priv(dev);
+	if ((vlan->lowerdev->features & NETIF_F_HIGHDMA) &&
+	    (vlan->lowerdev->features & NETIF_F_SG))
+		sock_set_flag(&q->sk, SOCK_ZEROCOPY);
+
 	err = macvtap_set_queue(dev, file, q);
 	if (err)
 		sock_put(&q->sk);
@@ -513,18 +524,125 @@ static int macvtap_skb_to_vnet_hdr(const struct sk_buff *skb,
 	return 0;
 }
 
+/* Number of pages the part of an iovec past offset spans. */
+static unsigned long iov_pages(const struct iovec *iv, int offset,
+			       unsigned long nr_segs)
+{
+	unsigned long seg, base;
+	int pages = 0, len, size;
+
+	while (nr_segs && (offset >= iv->iov_len)) {
+		offset -= iv->iov_len;
+		++iv;
+		--nr_segs;
+	}
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		base = (unsigned long)iv[seg].iov_base + offset;
+		len = iv[seg].iov_len - offset;
+		size = ((base & ~PAGE_MASK) + len + ~PAGE_MASK) >> PAGE_SHIFT;
+		pages += size;
+		offset = 0;
+	}
+
+	return pages;
+}
+
+/*
+ * Copy the first skb_headlen() bytes past offset in an iovec into the
+ * linear part of skb, and pin the pages of the rest as its frags.
+ * On failure, the frags pinned so far are released with skb.
+ */
+static int zerocopy_sg_from_iovec(struct sk_buff *skb,
+				  const struct iovec *from, int offset,
+				  unsigned long count)
+{
+	struct page *pages[MAX_SKB_FRAGS];
+	int copy = skb_headlen(skb);
+	int copied = 0;
+	int i = 0;
+
+	/* Skip over from offset */
+	while (count && (offset >= from->iov_len)) {
+		offset -= from->iov_len;
+		++from;
+		--count;
+	}
+
+	/* Copy up to skb headlen */
+	while (count && copied < copy) {
+		int size = min_t(int, copy - copied, from->iov_len - offset);
+
+		if (copy_from_user(skb->data + copied,
+				   from->iov_base + offset, size))
+			return -EFAULT;
+		copied += size;
+		offset += size;
+		if (offset == from->iov_len) {
+			offset = 0;
+			++from;
+			--count;
+		}
+	}
+
+	for (; count; ++from, --count, offset = 0) {
+		unsigned long base = (unsigned long)from->iov_base + offset;
+		int len = from->iov_len - offset;
+		int num_pages, n;
+
+		if (!len)
+			continue;
+
+		num_pages = ((base & ~PAGE_MASK) + len + ~PAGE_MASK) >>
+								PAGE_SHIFT;
+		if (i + num_pages > MAX_SKB_FRAGS)
+			return -EMSGSIZE;
+
+		n = get_user_pages_fast(base, num_pages, 0, pages);
+		if (n != num_pages) {
+			while (n > 0)
+				put_page(pages[--n]);
+			return -EFAULT;
+		}
+
+		skb->data_len += len;
+		skb->len += len;
+		skb->truesize += len;
+		atomic_add(len, &skb->sk->sk_wmem_alloc);
+
+		for (n = 0; len; n++, i++) {
+			skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+
+			f->page = pages[n];
+			f->page_offset = base & ~PAGE_MASK;
+			f->size = min_t(int, len, PAGE_SIZE - f->page_offset);
+			skb_shinfo(skb)->nr_frags++;
+			base += f->size;
+			len -= f->size;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Don't bother pinning the pages of small packets, and always copy enough
+ * for the headers to end up in the linear part of the skb.
+ */
+#define GOODCOPY_LEN 128
 
 /* Get packet from user space buffer */
-static ssize_t macvtap_get_user(struct macvtap_queue *q,
-				const struct iovec *iv, size_t count,
-				int noblock)
+static ssize_t macvtap_get_user(struct macvtap_queue *q, struct msghdr *m,
+				const struct iovec *iv, unsigned long total_len,
+				size_t count, int noblock)
 {
 	struct sk_buff *skb;
 	struct macvlan_dev *vlan;
-	size_t len = count;
+	unsigned long len = total_len;
 	int err;
 	struct virtio_net_hdr vnet_hdr = { 0 };
 	int vnet_hdr_len = 0;
+	int copylen = 0;
+	bool zerocopy = false;
 
 	if (q->flags & IFF_VNET_HDR) {
 		vnet_hdr_len = q->vnet_hdr_sz;
@@ -552,12 +670,32 @@ static ssize_t macvtap_get_user(struct macvtap_queue *q,
 	if (unlikely(len < ETH_HLEN))
 		goto err;
 
-	skb = macvtap_alloc_skb(&q->sk, NET_IP_ALIGN, len, vnet_hdr.hdr_len,
-				noblock, &err);
+	if (m && m->msg_control && sock_flag(&q->sk, SOCK_ZEROCOPY)) {
+		copylen = vnet_hdr.hdr_len;
+		if (copylen < GOODCOPY_LEN)
+			copylen = GOODCOPY_LEN;
+		if (copylen > len)
+			copylen = len;
+		/* Too many pages to pin? Copy them after all. */
+		zerocopy = len > copylen &&
+			   iov_pages(iv, vnet_hdr_len + copylen, count) <=
+								MAX_SKB_FRAGS;
+	}
+
+	if (zerocopy)
+		skb = macvtap_alloc_skb(&q->sk, NET_IP_ALIGN, copylen, copylen,
+					noblock, &err);
+	else
+		skb = macvtap_alloc_skb(&q->sk, NET_IP_ALIGN, len,
+					vnet_hdr.hdr_len, noblock, &err);
 	if (!skb)
 		goto err;
 
-	err = skb_copy_datagram_from_iovec(skb, 0, iv, vnet_hdr_len, len);
+	if (zerocopy)
+		err = zerocopy_sg_from_iovec(skb, iv, vnet_hdr_len, count);
+	else
+		err = skb_copy_datagram_from_iovec(skb, 0, iv, vnet_hdr_len,
+						   len);
 	if (err)
 		goto err_kfree;
 
@@ -571,6 +709,16 @@ static ssize_t macvtap_get_user(struct macvtap_queue *q,
 			goto err_kfree;
 	}
 
+	if (zerocopy) {
+		skb_shinfo(skb)->destructor_arg = m->msg_control;
+		skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
+	} else if (m && m->msg_control) {
+		/* Copied: the buffers are free to go right away. */
+		struct ubuf_info *uarg = m->msg_control;
+
+		uarg->callback(uarg);
+	}
+
 	rcu_read_lock_bh();
 	vlan = rcu_dereference_bh(q->vlan);
 	if (vlan)
@@ -579,7 +727,7 @@ static ssize_t macvtap_get_user(struct macvtap_queue *q,
 		kfree_skb(skb);
 	rcu_read_unlock_bh();
 
-	return count;
+	return total_len;
 
 err_kfree:
 	kfree_skb(skb);
@@ -601,8 +749,8 @@ static ssize_t macvtap_aio_write(struct kiocb *iocb, const struct iovec *iv,
 	ssize_t result = -ENOLINK;
 	struct macvtap_queue *q = file->private_data;
 
-	result = macvtap_get_user(q, iv, iov_length(iv, count),
-			      file->f_flags & O_NONBLOCK);
+	result = macvtap_get_user(q, NULL, iv, iov_length(iv, count), count,
+				  file->f_flags & O_NONBLOCK);
 	return result;
 }
 
@@ -815,8 +963,8 @@ static int macvtap_sendmsg(struct kiocb *iocb, struct socket *sock,
 			   struct msghdr *m, size_t total_len)
 {
 	struct macvtap_queue *q = container_of(sock, struct macvtap_queue, sock);
-	return macvtap_get_user(q, m->msg_iov, total_len,
-			    m->msg_flags & MSG_DONTWAIT);
+	return macvtap_get_user(q, m, m->msg_iov, total_len, m->msg_iovlen,
+				m->msg_flags & MSG_DONTWAIT);
 }
 
 static int macvtap_recvmsg(struct kiocb *iocb, struct socket *sock,
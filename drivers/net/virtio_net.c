@@ -26,6 +26,7 @@
 #include <linux/scatterlist.h>
 #include <linux/if_vlan.h>
 #include <linux/slab.h>
+#include <linux/u64_stats_sync.h>
 
 static int napi_weight = 128;
 module_param(napi_weight, int, 0444);
@@ -38,17 +39,81 @@ module_param(gso, bool, 0444);
 #define MAX_PACKET_LEN (ETH_HLEN + VLAN_HLEN + ETH_DATA_LEN)
 #define GOOD_COPY_LEN	128
 
+/*
+ * Mergeable buffers are carved out of MERGE_POOL_SIZE (compound) pages, so
+ * refilling doesn't hit the page allocator for every buffer, and a buffer
+ * only takes as much memory as a full sized packet does.
+ */
+#define MERGE_BUFFER_LEN ALIGN(sizeof(struct virtio_net_hdr_mrg_rxbuf) + \
+			       MAX_PACKET_LEN, L1_CACHE_BYTES)
+#define MERGE_POOL_SIZE	32768
+#define MERGE_POOL_ORDER get_order(MERGE_POOL_SIZE)
+
 #define VIRTNET_SEND_COMMAND_SG_MAX    2
 
+struct virtnet_stats {
+	struct u64_stats_sync syncp;
+	u64 packets;
+	u64 bytes;
+};
+
+/* Internal representation of a send virtqueue */
+struct send_queue {
+	/* Virtqueue associated with this send_queue */
+	struct virtqueue *vq;
+
+	/* TX: fragments + linear part + virtio header */
+	struct scatterlist sg[MAX_SKB_FRAGS + 2];
+
+	/* Only updated under the tx lock of the matching netdev_queue */
+	struct virtnet_stats stats;
+
+	/* Name of the send queue: output.$index */
+	char name[40];
+};
+
+/* Internal representation of a receive virtqueue */
+struct receive_queue {
+	/* Virtqueue associated with this receive_queue */
+	struct virtqueue *vq;
+
+	struct napi_struct napi;
+
+	/* Number of input buffers, and max we've ever had. */
+	unsigned int num, max;
+
+	/* Chain pages by the private ptr. */
+	struct page *pages;
+
+	/* Page the mergeable buffers are carved out of, and how much of it
+	 * has been handed out already. */
+	struct page *frag_page;
+	unsigned int frag_offset;
+	unsigned int frag_size;
+
+	/* RX: fragments + linear part + virtio header */
+	struct scatterlist sg[MAX_SKB_FRAGS + 2];
+
+	/* Only updated from the NAPI context of this queue */
+	struct virtnet_stats stats;
+
+	/* Name of this receive queue: input.$index */
+	char name[40];
+};
+
 struct virtnet_info {
 	struct virtio_device *vdev;
-	struct virtqueue *rvq, *svq, *cvq;
+	struct virtqueue *cvq;
 	struct net_device *dev;
-	struct napi_struct napi;
+	struct send_queue *sq;
+	struct receive_queue *rq;
 	unsigned int status;
 
-	/* Number of input buffers, and max we've ever had. */
-	unsigned int num, max;
+	/* Max # of queue pairs supported by the device */
+	u16 max_queue_pairs;
+
+	/* # of queue pairs currently used by the driver */
+	u16 curr_queue_pairs;
 
 	/* I like... big packets and I cannot lie! */
 	bool big_packets;
@@ -58,13 +123,6 @@ struct virtnet_info {
 
 	/* Work struct for refilling if we run low on memory. */
 	struct delayed_work refill;
-
-	/* Chain pages by the private ptr. */
-	struct page *pages;
-
-	/* fragments + linear part + virtio header */
-	struct scatterlist rx_sg[MAX_SKB_FRAGS + 2];
-	struct scatterlist tx_sg[MAX_SKB_FRAGS + 2];
 };
 
 struct skb_vnet_hdr {
@@ -90,26 +148,42 @@ static inline struct skb_vnet_hdr *skb_vnet_hdr(struct sk_buff *skb)
 	return (struct skb_vnet_hdr *)skb->cb;
 }
 
+/*
+ * The virtqueues come in pairs, receive then send, followed by the
+ * control virtqueue: rx0, tx0, rx1, tx1, ..., cvq.
+ */
+static int vq2qp(struct virtnet_info *vi, struct virtqueue *vq)
+{
+	int i;
+
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		if (vi->rq[i].vq == vq || vi->sq[i].vq == vq)
+			return i;
+
+	BUG();
+	return 0;
+}
+
 /*
  * private is used to chain pages for big packets, put the whole
  * most recent used list in the beginning for reuse
  */
-static void give_pages(struct virtnet_info *vi, struct page *page)
+static void give_pages(struct receive_queue *rq, struct page *page)
 {
 	struct page *end;
 
-	/* Find end of list, sew whole thing into vi->pages. */
+	/* Find end of list, sew whole thing into rq->pages. */
 	for (end = page; end->private; end = (struct page *)end->private);
-	end->private = (unsigned long)vi->pages;
-	vi->pages = page;
+	end->private = (unsigned long)rq->pages;
+	rq->pages = page;
 }
 
-static struct page *get_a_page(struct virtnet_info *vi, gfp_t gfp_mask)
+static struct page *get_a_page(struct receive_queue *rq, gfp_t gfp_mask)
 {
-	struct page *p = vi->pages;
+	struct page *p = rq->pages;
 
 	if (p) {
-		vi->pages = (struct page *)p->private;
+		rq->pages = (struct page *)p->private;
 		/* clear private here, it is used to chain pages */
 		p->private = 0;
 	} else
@@ -125,7 +199,7 @@ static void skb_xmit_done(struct virtqueue *svq)
 	virtqueue_disable_cb(svq);
 
 	/* We were probably waiting for more output buffers. */
-	netif_wake_queue(vi->dev);
+	netif_wake_subqueue(vi->dev, vq2qp(vi, svq));
 }
 
 static void set_skb_frag(struct sk_buff *skb, struct page *page,
@@ -145,15 +219,57 @@ static void set_skb_frag(struct sk_buff *skb, struct page *page,
 	*len -= f->size;
 }
 
-static struct sk_buff *page_to_skb(struct virtnet_info *vi,
-				   struct page *page, unsigned int len)
+/*
+ * Add @len bytes at @offset of the (head) @page to @skb, merging them with
+ * the last fragment if they follow it in the page. The caller's page
+ * reference goes to @skb either way.
+ */
+static void add_mergeable_frag(struct sk_buff *skb, struct page *page,
+			       unsigned int offset, unsigned int len)
+{
+	int i = skb_shinfo(skb)->nr_frags;
+	skb_frag_t *f;
+
+	if (i) {
+		f = &skb_shinfo(skb)->frags[i - 1];
+		if (f->page == page && f->page_offset + f->size == offset) {
+			f->size += len;
+			put_page(page);
+			goto out;
+		}
+	}
+
+	f = &skb_shinfo(skb)->frags[i];
+	f->size = len;
+	f->page_offset = offset;
+	f->page = page;
+	skb_shinfo(skb)->nr_frags++;
+out:
+	skb->data_len += len;
+	skb->len += len;
+}
+
+static bool can_add_mergeable_frag(struct sk_buff *skb, struct page *page,
+				   unsigned int offset)
+{
+	int i = skb_shinfo(skb)->nr_frags;
+	skb_frag_t *f = &skb_shinfo(skb)->frags[i - 1];
+
+	return i < MAX_SKB_FRAGS ||
+	       (f->page == page && f->page_offset + f->size == offset);
+}
+
+static struct sk_buff *page_to_skb(struct receive_queue *rq,
+				   struct page *page, unsigned int offset,
+				   unsigned int len)
 {
+	struct virtnet_info *vi = rq->vq->vdev->priv;
 	struct sk_buff *skb;
 	struct skb_vnet_hdr *hdr;
-	unsigned int copy, hdr_len, offset;
+	unsigned int copy, hdr_len, hdr_padded_len;
 	char *p;
 
-	p = page_address(page);
+	p = page_address(page) + offset;
 
 	/* copy small packet so we can reuse these pages for small data */
 	skb = netdev_alloc_skb_ip_align(vi->dev, GOOD_COPY_LEN);
@@ -164,16 +280,17 @@ static struct sk_buff *page_to_skb(struct virtnet_info *vi,
 
 	if (vi->mergeable_rx_bufs) {
 		hdr_len = sizeof hdr->mhdr;
-		offset = hdr_len;
+		hdr_padded_len = hdr_len;
 	} else {
 		hdr_len = sizeof hdr->hdr;
-		offset = sizeof(struct padded_vnet_hdr);
+		hdr_padded_len = sizeof(struct padded_vnet_hdr);
 	}
 
 	memcpy(hdr, p, hdr_len);
 
 	len -= hdr_len;
-	p += offset;
+	offset += hdr_padded_len;
+	p += hdr_padded_len;
 
 	copy = len;
 	if (copy > skb_tailroom(skb))
@@ -183,6 +300,15 @@ static struct sk_buff *page_to_skb(struct virtnet_info *vi,
 	len -= copy;
 	offset += copy;
 
+	/* A mergeable buffer is a single chunk of its page */
+	if (vi->mergeable_rx_bufs) {
+		if (len)
+			add_mergeable_frag(skb, page, offset, len);
+		else
+			put_page(page);
+		return skb;
+	}
+
 	while (len) {
 		set_skb_frag(skb, page, offset, &len);
 		page = (struct page *)page->private;
@@ -190,46 +316,81 @@ static struct sk_buff *page_to_skb(struct virtnet_info *vi,
 	}
 
 	if (page)
-		give_pages(vi, page);
+		give_pages(rq, page);
 
 	return skb;
 }
 
-static int receive_mergeable(struct virtnet_info *vi, struct sk_buff *skb)
+/* Drop the rest of the buffers of a packet we couldn't receive. */
+static void drop_mergeable_bufs(struct receive_queue *rq, int num_buf)
 {
-	struct skb_vnet_hdr *hdr = skb_vnet_hdr(skb);
+	unsigned int len;
+	void *buf;
+
+	while (--num_buf > 0) {
+		buf = virtqueue_get_buf(rq->vq, &len);
+		if (!buf)
+			break;
+		put_page(virt_to_head_page(buf));
+		--rq->num;
+	}
+}
+
+static int receive_mergeable(struct receive_queue *rq, struct sk_buff *head)
+{
+	struct skb_vnet_hdr *hdr = skb_vnet_hdr(head);
+	struct sk_buff *curr = head, *nskb;
+	unsigned int offset, len;
 	struct page *page;
-	int num_buf, i, len;
+	void *buf;
+	int num_buf;
 
 	num_buf = hdr->mhdr.num_buffers;
-	while (--num_buf) {
-		i = skb_shinfo(skb)->nr_frags;
-		if (i >= MAX_SKB_FRAGS) {
-			pr_debug("%s: packet too long\n", skb->dev->name);
-			skb->dev->stats.rx_length_errors++;
-			return -EINVAL;
-		}
-
-		page = virtqueue_get_buf(vi->rvq, &len);
-		if (!page) {
+	while (--num_buf > 0) {
+		buf = virtqueue_get_buf(rq->vq, &len);
+		if (!buf) {
 			pr_debug("%s: rx error: %d buffers missing\n",
-				 skb->dev->name, hdr->mhdr.num_buffers);
-			skb->dev->stats.rx_length_errors++;
+				 head->dev->name, hdr->mhdr.num_buffers);
+			head->dev->stats.rx_length_errors++;
 			return -EINVAL;
 		}
-		if (len > PAGE_SIZE)
-			len = PAGE_SIZE;
-
-		set_skb_frag(skb, page, 0, &len);
+		--rq->num;
+
+		page = virt_to_head_page(buf);
+		offset = (char *)buf - (char *)page_address(page);
+		if (len > MERGE_BUFFER_LEN)
+			len = MERGE_BUFFER_LEN;
+
+		/* Out of fragments: go on in a new skb of the frag_list */
+		if (!can_add_mergeable_frag(curr, page, offset)) {
+			nskb = alloc_skb(0, GFP_ATOMIC);
+			if (unlikely(!nskb)) {
+				put_page(page);
+				drop_mergeable_bufs(rq, num_buf);
+				head->dev->stats.rx_dropped++;
+				return -ENOMEM;
+			}
+			if (curr == head)
+				skb_shinfo(curr)->frag_list = nskb;
+			else
+				curr->next = nskb;
+			curr = nskb;
+			head->truesize += nskb->truesize;
+		}
 
-		--vi->num;
+		add_mergeable_frag(curr, page, offset, len);
+		if (curr != head) {
+			head->data_len += len;
+			head->len += len;
+		}
 	}
 	return 0;
 }
 
-static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
+static void receive_buf(struct receive_queue *rq, void *buf, unsigned int len)
 {
-	struct virtnet_info *vi = netdev_priv(dev);
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	struct net_device *dev = vi->dev;
 	struct sk_buff *skb;
 	struct page *page;
 	struct skb_vnet_hdr *hdr;
@@ -237,36 +398,54 @@ static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
 	if (unlikely(len < sizeof(struct virtio_net_hdr) + ETH_HLEN)) {
 		pr_debug("%s: short packet %i\n", dev->name, len);
 		dev->stats.rx_length_errors++;
-		if (vi->mergeable_rx_bufs || vi->big_packets)
-			give_pages(vi, buf);
+		if (vi->mergeable_rx_bufs)
+			put_page(virt_to_head_page(buf));
+		else if (vi->big_packets)
+			give_pages(rq, buf);
 		else
 			dev_kfree_skb(buf);
 		return;
 	}
 
-	if (!vi->mergeable_rx_bufs && !vi->big_packets) {
-		skb = buf;
-		len -= sizeof(struct virtio_net_hdr);
-		skb_trim(skb, len);
-	} else {
+	if (vi->mergeable_rx_bufs) {
+		page = virt_to_head_page(buf);
+		if (len > MERGE_BUFFER_LEN)
+			len = MERGE_BUFFER_LEN;
+		skb = page_to_skb(rq, page,
+				  (char *)buf - (char *)page_address(page), len);
+		if (unlikely(!skb)) {
+			struct virtio_net_hdr_mrg_rxbuf *mhdr = buf;
+
+			dev->stats.rx_dropped++;
+			drop_mergeable_bufs(rq, mhdr->num_buffers);
+			put_page(page);
+			return;
+		}
+		if (receive_mergeable(rq, skb)) {
+			dev_kfree_skb(skb);
+			return;
+		}
+	} else if (vi->big_packets) {
 		page = buf;
-		skb = page_to_skb(vi, page, len);
+		skb = page_to_skb(rq, page, 0, len);
 		if (unlikely(!skb)) {
 			dev->stats.rx_dropped++;
-			give_pages(vi, page);
+			give_pages(rq, page);
 			return;
 		}
-		if (vi->mergeable_rx_bufs)
-			if (receive_mergeable(vi, skb)) {
-				dev_kfree_skb(skb);
-				return;
-			}
+	} else {
+		skb = buf;
+		len -= sizeof(struct virtio_net_hdr);
+		skb_trim(skb, len);
 	}
 
 	hdr = skb_vnet_hdr(skb);
 	skb->truesize += skb->data_len;
-	dev->stats.rx_bytes += skb->len;
-	dev->stats.rx_packets++;
+
+	u64_stats_update_begin(&rq->stats.syncp);
+	rq->stats.bytes += skb->len;
+	rq->stats.packets++;
+	u64_stats_update_end(&rq->stats.syncp);
 
 	if (hdr->hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
 		pr_debug("Needs csum!\n");
@@ -315,6 +494,10 @@ static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
+	/* Let RPS, and the transmit queue selection of forwarded packets,
+	 * know which queue pair this came in on. */
+	skb_record_rx_queue(skb, rq - vi->rq);
+
 	netif_receive_skb(skb);
 	return;
 
@@ -323,152 +506,226 @@ frame_err:
 	dev_kfree_skb(skb);
 }
 
-static int add_recvbuf_small(struct virtnet_info *vi, gfp_t gfp)
+/* Small buffers take two sg each, so rx_sg has room for a batch of them. */
+#define SMALL_RX_BATCH ((MAX_SKB_FRAGS + 2) / 2)
+
+static int add_recvbufs_small(struct receive_queue *rq, gfp_t gfp,
+			      unsigned int *num)
 {
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	void *skbs[SMALL_RX_BATCH];
 	struct sk_buff *skb;
 	struct skb_vnet_hdr *hdr;
+	unsigned int i, n;
 	int err;
 
-	skb = netdev_alloc_skb_ip_align(vi->dev, MAX_PACKET_LEN);
-	if (unlikely(!skb))
-		return -ENOMEM;
+	for (n = 0; n < SMALL_RX_BATCH; n++) {
+		skb = netdev_alloc_skb_ip_align(vi->dev, MAX_PACKET_LEN);
+		if (unlikely(!skb))
+			break;
 
-	skb_put(skb, MAX_PACKET_LEN);
+		skb_put(skb, MAX_PACKET_LEN);
 
-	hdr = skb_vnet_hdr(skb);
-	sg_set_buf(vi->rx_sg, &hdr->hdr, sizeof hdr->hdr);
+		hdr = skb_vnet_hdr(skb);
+		sg_set_buf(&rq->sg[2 * n], &hdr->hdr, sizeof hdr->hdr);
 
-	skb_to_sgvec(skb, vi->rx_sg + 1, 0, skb->len);
+		skb_to_sgvec(skb, &rq->sg[2 * n + 1], 0, skb->len);
+		skbs[n] = skb;
+	}
 
-	err = virtqueue_add_buf_gfp(vi->rvq, vi->rx_sg, 0, 2, skb, gfp);
-	if (err < 0)
-		dev_kfree_skb(skb);
+	if (!n) {
+		*num = 0;
+		return -ENOMEM;
+	}
+
+	/* Expose the whole batch at once. */
+	*num = n;
+	err = virtqueue_add_bufs_gfp(rq->vq, rq->sg, num, 0, 2, skbs, gfp);
+	for (i = *num; i < n; i++)
+		dev_kfree_skb(skbs[i]);
+
+	/* Ran out of memory before filling the batch? */
+	if (err >= 0 && n < SMALL_RX_BATCH)
+		err = -ENOMEM;
 
 	return err;
 }
 
-static int add_recvbuf_big(struct virtnet_info *vi, gfp_t gfp)
+static int add_recvbuf_big(struct receive_queue *rq, gfp_t gfp)
 {
 	struct page *first, *list = NULL;
 	char *p;
 	int i, err, offset;
 
-	/* page in vi->rx_sg[MAX_SKB_FRAGS + 1] is list tail */
+	/* page in rq->sg[MAX_SKB_FRAGS + 1] is list tail */
 	for (i = MAX_SKB_FRAGS + 1; i > 1; --i) {
-		first = get_a_page(vi, gfp);
+		first = get_a_page(rq, gfp);
 		if (!first) {
 			if (list)
-				give_pages(vi, list);
+				give_pages(rq, list);
 			return -ENOMEM;
 		}
-		sg_set_buf(&vi->rx_sg[i], page_address(first), PAGE_SIZE);
+		sg_set_buf(&rq->sg[i], page_address(first), PAGE_SIZE);
 
 		/* chain new page in list head to match sg */
 		first->private = (unsigned long)list;
 		list = first;
 	}
 
-	first = get_a_page(vi, gfp);
+	first = get_a_page(rq, gfp);
 	if (!first) {
-		give_pages(vi, list);
+		give_pages(rq, list);
 		return -ENOMEM;
 	}
 	p = page_address(first);
 
-	/* vi->rx_sg[0], vi->rx_sg[1] share the same page */
-	/* a separated vi->rx_sg[0] for virtio_net_hdr only due to QEMU bug */
-	sg_set_buf(&vi->rx_sg[0], p, sizeof(struct virtio_net_hdr));
+	/* rq->sg[0], rq->sg[1] share the same page */
+	/* a separated rq->sg[0] for virtio_net_hdr only due to QEMU bug */
+	sg_set_buf(&rq->sg[0], p, sizeof(struct virtio_net_hdr));
 
-	/* vi->rx_sg[1] for data packet, from offset */
+	/* rq->sg[1] for data packet, from offset */
 	offset = sizeof(struct padded_vnet_hdr);
-	sg_set_buf(&vi->rx_sg[1], p + offset, PAGE_SIZE - offset);
+	sg_set_buf(&rq->sg[1], p + offset, PAGE_SIZE - offset);
 
 	/* chain first in list head */
 	first->private = (unsigned long)list;
-	err = virtqueue_add_buf_gfp(vi->rvq, vi->rx_sg, 0, MAX_SKB_FRAGS + 2,
+	err = virtqueue_add_buf_gfp(rq->vq, rq->sg, 0, MAX_SKB_FRAGS + 2,
 				    first, gfp);
 	if (err < 0)
-		give_pages(vi, first);
+		give_pages(rq, first);
 
 	return err;
 }
 
-static int add_recvbuf_mergeable(struct virtnet_info *vi, gfp_t gfp)
+/*
+ * Carve a mergeable buffer out of the pool page of @rq, holding a page
+ * reference for it. Once the pool page is used up, it's recycled if all of
+ * its buffers were freed by then, and replaced otherwise.
+ */
+static char *get_mergeable_buf(struct receive_queue *rq, gfp_t gfp)
 {
-	struct page *page;
+	struct page *page = rq->frag_page;
+	char *buf;
+
+	if (page && rq->frag_offset + MERGE_BUFFER_LEN > rq->frag_size) {
+		if (page_count(page) == 1) {
+			rq->frag_offset = 0;
+		} else {
+			put_page(page);
+			page = rq->frag_page = NULL;
+		}
+	}
+
+	if (!page) {
+		page = alloc_pages(gfp | __GFP_COMP | __GFP_NOWARN |
+				   __GFP_NORETRY, MERGE_POOL_ORDER);
+		if (page) {
+			rq->frag_size = PAGE_SIZE << MERGE_POOL_ORDER;
+		} else {
+			page = alloc_page(gfp);
+			if (!page)
+				return NULL;
+			rq->frag_size = PAGE_SIZE;
+		}
+		rq->frag_page = page;
+		rq->frag_offset = 0;
+	}
+
+	buf = (char *)page_address(page) + rq->frag_offset;
+	rq->frag_offset += MERGE_BUFFER_LEN;
+	get_page(page);
+
+	return buf;
+}
+
+static int add_recvbuf_mergeable(struct receive_queue *rq, gfp_t gfp)
+{
+	char *buf;
 	int err;
 
-	page = get_a_page(vi, gfp);
-	if (!page)
+	buf = get_mergeable_buf(rq, gfp);
+	if (!buf)
 		return -ENOMEM;
 
-	sg_init_one(vi->rx_sg, page_address(page), PAGE_SIZE);
+	sg_init_one(rq->sg, buf, MERGE_BUFFER_LEN);
 
-	err = virtqueue_add_buf_gfp(vi->rvq, vi->rx_sg, 0, 1, page, gfp);
+	err = virtqueue_add_buf_gfp(rq->vq, rq->sg, 0, 1, buf, gfp);
 	if (err < 0)
-		give_pages(vi, page);
+		put_page(virt_to_head_page(buf));
 
 	return err;
 }
 
 /* Returns false if we couldn't fill entirely (OOM). */
-static bool try_fill_recv(struct virtnet_info *vi, gfp_t gfp)
+static bool try_fill_recv(struct receive_queue *rq, gfp_t gfp)
 {
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	unsigned int added;
 	int err;
 	bool oom;
 
 	do {
-		if (vi->mergeable_rx_bufs)
-			err = add_recvbuf_mergeable(vi, gfp);
-		else if (vi->big_packets)
-			err = add_recvbuf_big(vi, gfp);
-		else
-			err = add_recvbuf_small(vi, gfp);
+		if (vi->mergeable_rx_bufs) {
+			err = add_recvbuf_mergeable(rq, gfp);
+			added = err >= 0;
+		} else if (vi->big_packets) {
+			err = add_recvbuf_big(rq, gfp);
+			added = err >= 0;
+		} else {
+			/* A batch may be partly added, even on error. */
+			err = add_recvbufs_small(rq, gfp, &added);
+		}
 
+		rq->num += added;
 		oom = err == -ENOMEM;
-		if (err < 0)
-			break;
-		++vi->num;
 	} while (err > 0);
-	if (unlikely(vi->num > vi->max))
-		vi->max = vi->num;
-	virtqueue_kick(vi->rvq);
+	if (unlikely(rq->num > rq->max))
+		rq->max = rq->num;
+	virtqueue_kick(rq->vq);
 	return !oom;
 }
 
 static void skb_recv_done(struct virtqueue *rvq)
 {
 	struct virtnet_info *vi = rvq->vdev->priv;
+	struct receive_queue *rq = &vi->rq[vq2qp(vi, rvq)];
+
 	/* Schedule NAPI, Suppress further interrupts if successful. */
-	if (napi_schedule_prep(&vi->napi)) {
+	if (napi_schedule_prep(&rq->napi)) {
 		virtqueue_disable_cb(rvq);
-		__napi_schedule(&vi->napi);
+		__napi_schedule(&rq->napi);
 	}
 }
 
-static void virtnet_napi_enable(struct virtnet_info *vi)
+static void virtnet_napi_enable(struct receive_queue *rq)
 {
-	napi_enable(&vi->napi);
+	napi_enable(&rq->napi);
 
 	/* If all buffers were filled by other side before we napi_enabled, we
 	 * won't get another interrupt, so process any outstanding packets
 	 * now.  virtnet_poll wants re-enable the queue, so we disable here.
 	 * We synchronize against interrupts via NAPI_STATE_SCHED */
-	if (napi_schedule_prep(&vi->napi)) {
-		virtqueue_disable_cb(vi->rvq);
-		__napi_schedule(&vi->napi);
+	if (napi_schedule_prep(&rq->napi)) {
+		virtqueue_disable_cb(rq->vq);
+		__napi_schedule(&rq->napi);
 	}
 }
 
 static void refill_work(struct work_struct *work)
 {
 	struct virtnet_info *vi;
-	bool still_empty;
+	bool still_empty = false;
+	int i;
 
 	vi = container_of(work, struct virtnet_info, refill.work);
-	napi_disable(&vi->napi);
-	still_empty = !try_fill_recv(vi, GFP_KERNEL);
-	virtnet_napi_enable(vi);
+	for (i = 0; i < vi->curr_queue_pairs; i++) {
+		struct receive_queue *rq = &vi->rq[i];
+
+		napi_disable(&rq->napi);
+		if (!try_fill_recv(rq, GFP_KERNEL))
+			still_empty = true;
+		virtnet_napi_enable(rq);
+	}
 
 	/* In theory, this can happen: if we don't get any buffers in
 	 * we will *never* try to fill again. */
@@ -478,29 +735,31 @@ static void refill_work(struct work_struct *work)
 
 static int virtnet_poll(struct napi_struct *napi, int budget)
 {
-	struct virtnet_info *vi = container_of(napi, struct virtnet_info, napi);
+	struct receive_queue *rq =
+		container_of(napi, struct receive_queue, napi);
+	struct virtnet_info *vi = rq->vq->vdev->priv;
 	void *buf;
 	unsigned int len, received = 0;
 
 again:
 	while (received < budget &&
-	       (buf = virtqueue_get_buf(vi->rvq, &len)) != NULL) {
-		receive_buf(vi->dev, buf, len);
-		--vi->num;
+	       (buf = virtqueue_get_buf(rq->vq, &len)) != NULL) {
+		receive_buf(rq, buf, len);
+		--rq->num;
 		received++;
 	}
 
-	if (vi->num < vi->max / 2) {
-		if (!try_fill_recv(vi, GFP_ATOMIC))
+	if (rq->num < rq->max / 2) {
+		if (!try_fill_recv(rq, GFP_ATOMIC))
 			schedule_delayed_work(&vi->refill, 0);
 	}
 
 	/* Out of packets? */
 	if (received < budget) {
 		napi_complete(napi);
-		if (unlikely(!virtqueue_enable_cb(vi->rvq)) &&
+		if (unlikely(!virtqueue_enable_cb(rq->vq)) &&
 		    napi_schedule_prep(napi)) {
-			virtqueue_disable_cb(vi->rvq);
+			virtqueue_disable_cb(rq->vq);
 			__napi_schedule(napi);
 			goto again;
 		}
@@ -509,23 +768,28 @@ again:
 	return received;
 }
 
-static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
+static unsigned int free_old_xmit_skbs(struct send_queue *sq)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
 
-	while ((skb = virtqueue_get_buf(vi->svq, &len)) != NULL) {
+	while ((skb = virtqueue_get_buf(sq->vq, &len)) != NULL) {
 		pr_debug("Sent skb %p\n", skb);
-		vi->dev->stats.tx_bytes += skb->len;
-		vi->dev->stats.tx_packets++;
+
+		u64_stats_update_begin(&sq->stats.syncp);
+		sq->stats.bytes += skb->len;
+		sq->stats.packets++;
+		u64_stats_update_end(&sq->stats.syncp);
+
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
 	return tot_sgs;
 }
 
-static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
+static int xmit_skb(struct send_queue *sq, struct sk_buff *skb)
 {
+	struct virtnet_info *vi = sq->vq->vdev->priv;
 	struct skb_vnet_hdr *hdr = skb_vnet_hdr(skb);
 	const unsigned char *dest = ((struct ethhdr *)skb->data)->h_dest;
 
@@ -562,25 +826,28 @@ static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 
 	/* Encode metadata header at front. */
 	if (vi->mergeable_rx_bufs)
-		sg_set_buf(vi->tx_sg, &hdr->mhdr, sizeof hdr->mhdr);
+		sg_set_buf(sq->sg, &hdr->mhdr, sizeof hdr->mhdr);
 	else
-		sg_set_buf(vi->tx_sg, &hdr->hdr, sizeof hdr->hdr);
+		sg_set_buf(sq->sg, &hdr->hdr, sizeof hdr->hdr);
 
-	hdr->num_sg = skb_to_sgvec(skb, vi->tx_sg + 1, 0, skb->len) + 1;
-	return virtqueue_add_buf(vi->svq, vi->tx_sg, hdr->num_sg,
+	hdr->num_sg = skb_to_sgvec(skb, sq->sg + 1, 0, skb->len) + 1;
+	return virtqueue_add_buf(sq->vq, sq->sg, hdr->num_sg,
 					0, skb);
 }
 
 static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int qnum = skb_get_queue_mapping(skb);
+	struct send_queue *sq = &vi->sq[qnum];
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, qnum);
 	int capacity;
 
 	/* Free up any pending old buffers before queueing new ones. */
-	free_old_xmit_skbs(vi);
+	free_old_xmit_skbs(sq);
 
 	/* Try to transmit */
-	capacity = xmit_skb(vi, skb);
+	capacity = xmit_skb(sq, skb);
 
 	/* This can happen with OOM and indirect buffers. */
 	if (unlikely(capacity < 0)) {
@@ -599,7 +866,7 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		kfree_skb(skb);
 		return NETDEV_TX_OK;
 	}
-	virtqueue_kick(vi->svq);
+	virtqueue_kick(sq->vq);
 
 	/* Don't wait up for transmitted skbs to be freed. */
 	skb_orphan(skb);
@@ -608,13 +875,13 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 	/* Apparently nice girls don't return TX_BUSY; stop the queue
 	 * before it gets out of hand.  Naturally, this wastes entries. */
 	if (capacity < 2+MAX_SKB_FRAGS) {
-		netif_stop_queue(dev);
-		if (unlikely(!virtqueue_enable_cb_delayed(vi->svq))) {
+		netif_tx_stop_queue(txq);
+		if (unlikely(!virtqueue_enable_cb_delayed(sq->vq))) {
 			/* More just got used, free them then recheck. */
-			capacity += free_old_xmit_skbs(vi);
+			capacity += free_old_xmit_skbs(sq);
 			if (capacity >= 2+MAX_SKB_FRAGS) {
-				netif_start_queue(dev);
-				virtqueue_disable_cb(vi->svq);
+				netif_tx_start_queue(txq);
+				virtqueue_disable_cb(sq->vq);
 			}
 		}
 	}
@@ -622,6 +889,63 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 	return NETDEV_TX_OK;
 }
 
+/*
+ * Keep each flow on the queue pair of the CPU sending it: the device
+ * steers the packets coming back to the receive queue of the same pair
+ * (see VIRTIO_NET_CTRL_MQ), so both directions of a flow are handled by
+ * one queue pair.  Forwarded packets go out on the pair they came in on.
+ */
+static u16 virtnet_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	unsigned int txq;
+
+	if (skb_rx_queue_recorded(skb))
+		txq = skb_get_rx_queue(skb);
+	else
+		txq = smp_processor_id();
+
+	return txq % dev->real_num_tx_queues;
+}
+
+static struct rtnl_link_stats64 *virtnet_stats(struct net_device *dev,
+					       struct rtnl_link_stats64 *tot)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	struct virtnet_stats *stats;
+	u64 packets, bytes;
+	unsigned int start;
+	int i;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		stats = &vi->sq[i].stats;
+		do {
+			start = u64_stats_fetch_begin_bh(&stats->syncp);
+			packets = stats->packets;
+			bytes = stats->bytes;
+		} while (u64_stats_fetch_retry_bh(&stats->syncp, start));
+		tot->tx_packets += packets;
+		tot->tx_bytes += bytes;
+
+		stats = &vi->rq[i].stats;
+		do {
+			start = u64_stats_fetch_begin_bh(&stats->syncp);
+			packets = stats->packets;
+			bytes = stats->bytes;
+		} while (u64_stats_fetch_retry_bh(&stats->syncp, start));
+		tot->rx_packets += packets;
+		tot->rx_bytes += bytes;
+	}
+
+	/* The error counters are rare enough to stay in dev->stats */
+	tot->tx_dropped = dev->stats.tx_dropped;
+	tot->tx_fifo_errors = dev->stats.tx_fifo_errors;
+	tot->rx_dropped = dev->stats.rx_dropped;
+	tot->rx_length_errors = dev->stats.rx_length_errors;
+	tot->rx_frame_errors = dev->stats.rx_frame_errors;
+
+	return tot;
+}
+
 static int virtnet_set_mac_address(struct net_device *dev, void *p)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
@@ -643,16 +967,27 @@ static int virtnet_set_mac_address(struct net_device *dev, void *p)
 static void virtnet_netpoll(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int i;
 
-	napi_schedule(&vi->napi);
+	for (i = 0; i < vi->curr_queue_pairs; i++)
+		napi_schedule(&vi->rq[i].napi);
 }
 #endif
 
 static int virtnet_open(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int i;
+
+	/* Enable all the queue pairs, even the unused ones, so changing
+	 * their number later doesn't have to deal with NAPI at all. */
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		virtnet_napi_enable(&vi->rq[i]);
+
+	/* Pairs enabled while we were down may not have buffers yet. */
+	if (vi->curr_queue_pairs > 1)
+		schedule_delayed_work(&vi->refill, 0);
 
-	virtnet_napi_enable(vi);
 	return 0;
 }
 
@@ -701,11 +1036,77 @@ static bool virtnet_send_command(struct virtnet_info *vi, u8 class, u8 cmd,
 	return status == VIRTIO_NET_OK;
 }
 
+/*
+ * Hint the interrupts of each queue pair to the cpus which
+ * virtnet_select_queue() sends from it, so their rx and tx completions
+ * are handled where the traffic comes from.
+ */
+static void virtnet_set_affinity(struct virtnet_info *vi)
+{
+	int i, cpu;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		virtqueue_set_affinity(vi->rq[i].vq, -1);
+		virtqueue_set_affinity(vi->sq[i].vq, -1);
+	}
+
+	if (vi->curr_queue_pairs == 1)
+		return;
+
+	for_each_online_cpu(cpu) {
+		i = cpu % vi->curr_queue_pairs;
+		virtqueue_set_affinity(vi->rq[i].vq, cpu);
+		virtqueue_set_affinity(vi->sq[i].vq, cpu);
+	}
+}
+
+/*
+ * Tell the device how many queue pairs to use, and start or stop using
+ * the others ourselves.  Called with the rtnl lock held.
+ */
+static int virtnet_set_queues(struct virtnet_info *vi, u16 queue_pairs)
+{
+	struct net_device *dev = vi->dev;
+	struct virtio_net_ctrl_mq s;
+	struct scatterlist sg;
+
+	ASSERT_RTNL();
+
+	if (queue_pairs == vi->curr_queue_pairs)
+		return 0;
+
+	s.virtqueue_pairs = queue_pairs;
+	sg_init_one(&sg, &s, sizeof(s));
+
+	if (!virtnet_send_command(vi, VIRTIO_NET_CTRL_MQ,
+				  VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &sg, 1, 0)) {
+		dev_warn(&dev->dev, "Failed to set %d queue pairs.\n",
+			 queue_pairs);
+		return -EINVAL;
+	}
+
+	vi->curr_queue_pairs = queue_pairs;
+	netif_set_real_num_tx_queues(dev, queue_pairs);
+	netif_set_real_num_rx_queues(dev, queue_pairs);
+	virtnet_set_affinity(vi);
+
+	/* Give the receive queues we just started using some buffers. */
+	if (netif_running(dev))
+		schedule_delayed_work(&vi->refill, 0);
+
+	return 0;
+}
+
 static int virtnet_close(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int i;
+
+	/* refill_work must not touch NAPI once it's disabled. */
+	cancel_delayed_work_sync(&vi->refill);
 
-	napi_disable(&vi->napi);
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		napi_disable(&vi->rq[i].napi);
 
 	return 0;
 }
@@ -810,8 +1211,39 @@ static void virtnet_vlan_rx_kill_vid(struct net_device *dev, u16 vid)
 		dev_warn(&dev->dev, "Failed to kill VLAN ID %d.\n", vid);
 }
 
+static void virtnet_get_channels(struct net_device *dev,
+				 struct ethtool_channels *channels)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	channels->combined_count = vi->curr_queue_pairs;
+	channels->max_combined = vi->max_queue_pairs;
+	channels->max_other = 0;
+	channels->rx_count = 0;
+	channels->tx_count = 0;
+	channels->other_count = 0;
+}
+
+static int virtnet_set_channels(struct net_device *dev,
+				struct ethtool_channels *channels)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	u16 queue_pairs = channels->combined_count;
+
+	/* We don't support separate rx/tx channels, nor other channels. */
+	if (channels->rx_count || channels->tx_count || channels->other_count)
+		return -EINVAL;
+
+	if (queue_pairs < 1 || queue_pairs > vi->max_queue_pairs)
+		return -EINVAL;
+
+	return virtnet_set_queues(vi, queue_pairs);
+}
+
 static const struct ethtool_ops virtnet_ethtool_ops = {
 	.get_link = ethtool_op_get_link,
+	.get_channels = virtnet_get_channels,
+	.set_channels = virtnet_set_channels,
 };
 
 #define MIN_MTU 68
@@ -829,6 +1261,8 @@ static const struct net_device_ops virtnet_netdev = {
 	.ndo_open            = virtnet_open,
 	.ndo_stop   	     = virtnet_close,
 	.ndo_start_xmit      = start_xmit,
+	.ndo_select_queue    = virtnet_select_queue,
+	.ndo_get_stats64     = virtnet_stats,
 	.ndo_validate_addr   = eth_validate_addr,
 	.ndo_set_mac_address = virtnet_set_mac_address,
 	.ndo_set_rx_mode     = virtnet_set_rx_mode,
@@ -861,10 +1295,10 @@ static void virtnet_update_status(struct virtnet_info *vi)
 
 	if (vi->status & VIRTIO_NET_S_LINK_UP) {
 		netif_carrier_on(vi->dev);
-		netif_wake_queue(vi->dev);
+		netif_tx_wake_all_queues(vi->dev);
 	} else {
 		netif_carrier_off(vi->dev);
-		netif_stop_queue(vi->dev);
+		netif_tx_stop_all_queues(vi->dev);
 	}
 }
 
@@ -875,18 +1309,110 @@ static void virtnet_config_changed(struct virtio_device *vdev)
 	virtnet_update_status(vi);
 }
 
+static void virtnet_free_queues(struct virtnet_info *vi)
+{
+	kfree(vi->rq);
+	kfree(vi->sq);
+}
+
+static int virtnet_alloc_queues(struct virtnet_info *vi)
+{
+	int i;
+
+	vi->sq = kzalloc(sizeof(*vi->sq) * vi->max_queue_pairs, GFP_KERNEL);
+	vi->rq = kzalloc(sizeof(*vi->rq) * vi->max_queue_pairs, GFP_KERNEL);
+	if (!vi->sq || !vi->rq) {
+		virtnet_free_queues(vi);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		netif_napi_add(vi->dev, &vi->rq[i].napi, virtnet_poll,
+			       napi_weight);
+
+		sg_init_table(vi->rq[i].sg, ARRAY_SIZE(vi->rq[i].sg));
+		sg_init_table(vi->sq[i].sg, ARRAY_SIZE(vi->sq[i].sg));
+
+		sprintf(vi->rq[i].name, "input.%d", i);
+		sprintf(vi->sq[i].name, "output.%d", i);
+	}
+
+	return 0;
+}
+
+static int virtnet_find_vqs(struct virtnet_info *vi)
+{
+	struct virtio_device *vdev = vi->vdev;
+	vq_callback_t **callbacks;
+	struct virtqueue **vqs;
+	const char **names;
+	int total_vqs;
+	int ret = -ENOMEM;
+	int i;
+
+	/* We expect a pair of virtqueues per queue pair, receive then
+	 * send, and optionally control. */
+	total_vqs = vi->max_queue_pairs * 2 +
+		    virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ);
+
+	vqs = kzalloc(total_vqs * sizeof(*vqs), GFP_KERNEL);
+	callbacks = kzalloc(total_vqs * sizeof(*callbacks), GFP_KERNEL);
+	names = kzalloc(total_vqs * sizeof(*names), GFP_KERNEL);
+	if (!vqs || !callbacks || !names)
+		goto out;
+
+	/* The control vq has no callback, and keeps its zeroed entry */
+	if (virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ))
+		names[total_vqs - 1] = "control";
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		callbacks[2 * i] = skb_recv_done;
+		callbacks[2 * i + 1] = skb_xmit_done;
+		names[2 * i] = vi->rq[i].name;
+		names[2 * i + 1] = vi->sq[i].name;
+	}
+
+	ret = vdev->config->find_vqs(vdev, total_vqs, vqs, callbacks, names);
+	if (ret)
+		goto out;
+
+	if (virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ))
+		vi->cvq = vqs[total_vqs - 1];
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		vi->rq[i].vq = vqs[2 * i];
+		vi->sq[i].vq = vqs[2 * i + 1];
+	}
+
+out:
+	kfree(names);
+	kfree(callbacks);
+	kfree(vqs);
+	return ret;
+}
+
 static int virtnet_probe(struct virtio_device *vdev)
 {
 	int err;
 	struct net_device *dev;
 	struct virtnet_info *vi;
-	struct virtqueue *vqs[3];
-	vq_callback_t *callbacks[] = { skb_recv_done, skb_xmit_done, NULL};
-	const char *names[] = { "input", "output", "control" };
-	int nvqs;
+	u16 max_queue_pairs = 1;
+
+	/* Find out how many queue pairs we may use; the pairs are set up
+	 * through the control virtqueue, so there's no MQ without it. */
+	if (virtio_has_feature(vdev, VIRTIO_NET_F_MQ) &&
+	    virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ)) {
+		vdev->config->get(vdev,
+				  offsetof(struct virtio_net_config,
+					   max_virtqueue_pairs),
+				  &max_queue_pairs, sizeof(max_queue_pairs));
+		if (max_queue_pairs < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
+		    max_queue_pairs > VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX)
+			max_queue_pairs = 1;
+	}
 
 	/* Allocate ourselves a network device with room for our info */
-	dev = alloc_etherdev(sizeof(struct virtnet_info));
+	dev = alloc_etherdev_mq(sizeof(struct virtnet_info), max_queue_pairs);
 	if (!dev)
 		return -ENOMEM;
 
@@ -932,14 +1458,16 @@ static int virtnet_probe(struct virtio_device *vdev)
 
 	/* Set up our device-specific information */
 	vi = netdev_priv(dev);
-	netif_napi_add(dev, &vi->napi, virtnet_poll, napi_weight);
 	vi->dev = dev;
 	vi->vdev = vdev;
 	vdev->priv = vi;
-	vi->pages = NULL;
 	INIT_DELAYED_WORK(&vi->refill, refill_work);
-	sg_init_table(vi->rx_sg, ARRAY_SIZE(vi->rx_sg));
-	sg_init_table(vi->tx_sg, ARRAY_SIZE(vi->tx_sg));
+
+	/* The device only uses the first pair until told otherwise. */
+	vi->max_queue_pairs = max_queue_pairs;
+	vi->curr_queue_pairs = 1;
+	netif_set_real_num_tx_queues(dev, 1);
+	netif_set_real_num_rx_queues(dev, 1);
 
 	/* If we can receive ANY GSO packets, we must allocate large ones. */
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_GUEST_TSO4) ||
@@ -950,23 +1478,17 @@ static int virtnet_probe(struct virtio_device *vdev)
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_MRG_RXBUF))
 		vi->mergeable_rx_bufs = true;
 
-	/* We expect two virtqueues, receive then send,
-	 * and optionally control. */
-	nvqs = virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VQ) ? 3 : 2;
-
-	err = vdev->config->find_vqs(vdev, nvqs, vqs, callbacks, names);
+	err = virtnet_alloc_queues(vi);
 	if (err)
 		goto free;
 
-	vi->rvq = vqs[0];
-	vi->svq = vqs[1];
-
-	if (virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VQ)) {
-		vi->cvq = vqs[2];
+	err = virtnet_find_vqs(vi);
+	if (err)
+		goto free_queues;
 
-		if (virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VLAN))
-			dev->features |= NETIF_F_HW_VLAN_FILTER;
-	}
+	if (virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VQ) &&
+	    virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VLAN))
+		dev->features |= NETIF_F_HW_VLAN_FILTER;
 
 	err = register_netdev(dev);
 	if (err) {
@@ -975,14 +1497,23 @@ static int virtnet_probe(struct virtio_device *vdev)
 	}
 
 	/* Last of all, set up some receive buffers. */
-	try_fill_recv(vi, GFP_KERNEL);
+	try_fill_recv(&vi->rq[0], GFP_KERNEL);
 
 	/* If we didn't even get one input buffer, we're useless. */
-	if (vi->num == 0) {
+	if (vi->rq[0].num == 0) {
 		err = -ENOMEM;
 		goto unregister;
 	}
 
+	/* Use a queue pair per CPU, if the device has enough of them;
+	 * the other pairs get their buffers from refill_work. */
+	if (vi->max_queue_pairs > 1) {
+		rtnl_lock();
+		virtnet_set_queues(vi, min_t(u16, vi->max_queue_pairs,
+					     num_online_cpus()));
+		rtnl_unlock();
+	}
+
 	/* Assume link up if device can't report link status,
 	   otherwise get link status from config. */
 	if (virtio_has_feature(vi->vdev, VIRTIO_NET_F_STATUS)) {
@@ -993,7 +1524,8 @@ static int virtnet_probe(struct virtio_device *vdev)
 		netif_carrier_on(dev);
 	}
 
-	pr_debug("virtnet: registered device %s\n", dev->name);
+	pr_debug("virtnet: registered device %s with %d/%d queue pairs\n",
+		 dev->name, vi->curr_queue_pairs, vi->max_queue_pairs);
 	return 0;
 
 unregister:
@@ -1001,6 +1533,8 @@ unregister:
 	cancel_delayed_work_sync(&vi->refill);
 free_vqs:
 	vdev->config->del_vqs(vdev);
+free_queues:
+	virtnet_free_queues(vi);
 free:
 	free_netdev(dev);
 	return err;
@@ -1009,28 +1543,35 @@ free:
 static void free_unused_bufs(struct virtnet_info *vi)
 {
 	void *buf;
-	while (1) {
-		buf = virtqueue_detach_unused_buf(vi->svq);
-		if (!buf)
-			break;
-		dev_kfree_skb(buf);
-	}
-	while (1) {
-		buf = virtqueue_detach_unused_buf(vi->rvq);
-		if (!buf)
-			break;
-		if (vi->mergeable_rx_bufs || vi->big_packets)
-			give_pages(vi, buf);
-		else
+	int i;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		struct virtqueue *vq = vi->sq[i].vq;
+
+		while ((buf = virtqueue_detach_unused_buf(vq)) != NULL)
 			dev_kfree_skb(buf);
-		--vi->num;
 	}
-	BUG_ON(vi->num != 0);
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		struct receive_queue *rq = &vi->rq[i];
+
+		while ((buf = virtqueue_detach_unused_buf(rq->vq)) != NULL) {
+			if (vi->mergeable_rx_bufs)
+				put_page(virt_to_head_page(buf));
+			else if (vi->big_packets)
+				give_pages(rq, buf);
+			else
+				dev_kfree_skb(buf);
+			--rq->num;
+		}
+		BUG_ON(rq->num != 0);
+	}
 }
 
 static void __devexit virtnet_remove(struct virtio_device *vdev)
 {
 	struct virtnet_info *vi = vdev->priv;
+	int i;
 
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
@@ -1044,9 +1585,14 @@ static void __devexit virtnet_remove(struct virtio_device *vdev)
 
 	vdev->config->del_vqs(vi->vdev);
 
-	while (vi->pages)
-		__free_pages(get_a_page(vi, GFP_KERNEL), 0);
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		while (vi->rq[i].pages)
+			__free_pages(get_a_page(&vi->rq[i], GFP_KERNEL), 0);
+		if (vi->rq[i].frag_page)
+			put_page(vi->rq[i].frag_page);
+	}
 
+	virtnet_free_queues(vi);
 	free_netdev(vi->dev);
 }
 
@@ -1062,7 +1608,7 @@ static unsigned int features[] = {
 	VIRTIO_NET_F_HOST_ECN, VIRTIO_NET_F_GUEST_TSO4, VIRTIO_NET_F_GUEST_TSO6,
 	VIRTIO_NET_F_GUEST_ECN, VIRTIO_NET_F_GUEST_UFO,
 	VIRTIO_NET_F_MRG_RXBUF, VIRTIO_NET_F_STATUS, VIRTIO_NET_F_CTRL_VQ,
-	VIRTIO_NET_F_CTRL_RX, VIRTIO_NET_F_CTRL_VLAN,
+	VIRTIO_NET_F_CTRL_RX, VIRTIO_NET_F_CTRL_VLAN, VIRTIO_NET_F_MQ,
 };
 
 static struct virtio_driver virtio_net_driver = {
@@ -20,17 +20,53 @@
 #include <linux/platform_device.h>
 #include <linux/iommu.h>
 #include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/remoteproc.h>
 
 #include <plat/iommu.h>
 #include <plat/omap_device.h>
 #include <plat/remoteproc.h>
 
+/**
+ * struct omap_rproc_priv - omap remoteproc state
+ * @domain: the iommu domain the memory maps are mapped in. It's set up on
+ *	    the first boot, and kept until the device is removed, so the
+ *	    page tables don't have to be rebuilt whenever the remote reboots
+ * @iommu: the iommu device we're behind of
+ */
 struct omap_rproc_priv {
 	struct iommu_domain *domain;
 	struct device *iommu;
 };
 
+/*
+ * The TLB entries of the memory maps can be preloaded (and locked) every
+ * time the remote processor is booted, so its accesses to them never miss
+ * the TLB, and never wait for the table walking logic. The regions are
+ * preloaded in the order of the memory maps table (so the hottest, e.g.
+ * the IPC region, should come first), as long as there's room for them in
+ * the first half of the TLB; the rest of it is left for the table walks.
+ */
+static bool lock_tlb;
+module_param(lock_tlb, bool, S_IRUGO);
+MODULE_PARM_DESC(lock_tlb, "Preload and lock the TLB entries of the memory maps");
+
+/* find the max page size with which both pa, da are aligned */
+static u32 omap_rproc_pgsz(u32 da, u32 pa, u32 size)
+{
+	/* these are the page sizes supported by OMAP's IOMMU */
+	static const u32 pg_size[] = {SZ_16M, SZ_1M, SZ_64K, SZ_4K};
+	u32 all_bits = pa | da;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(pg_size) - 1; i++)
+		if ((size >= pg_size[i]) && ((all_bits & (pg_size[i] - 1)) == 0))
+			break;
+
+	return pg_size[i];
+}
+
 /*
  * Map a physically contiguous memory region using biggest pages possible.
  * TODO: this code should go away; it belongs in the generic IOMMU layer
@@ -38,12 +74,10 @@ struct omap_rproc_priv {
 static int omap_rproc_map_unmap(struct iommu_domain *domain,
 				const struct rproc_mem_entry *me, bool map)
 {
-	u32 all_bits;
-	/* these are the page sizes supported by OMAP's IOMMU */
-	u32 pg_size[] = {SZ_16M, SZ_1M, SZ_64K, SZ_4K};
-	int i, ret, size = me->size;
+	int ret, size = me->size;
 	u32 da = me->da;
 	u32 pa = me->pa;
+	u32 pgsz;
 	int order;
 	int flags;
 
@@ -54,16 +88,8 @@ static int omap_rproc_map_unmap(struct iommu_domain *domain,
 	}
 
 	while (size) {
-		/* find the max page size with which both pa, da are aligned */
-		all_bits = pa | da;
-		for (i = 0; i < ARRAY_SIZE(pg_size); i++) {
-			if ((size >= pg_size[i]) &&
-				((all_bits & (pg_size[i] - 1)) == 0)) {
-				break;
-			}
-		}
-
-		order = get_order(pg_size[i]);
+		pgsz = omap_rproc_pgsz(da, pa, size);
+		order = get_order(pgsz);
 
 		/* OMAP4's M3 is little endian, so no need for conversions */
 		flags = MMU_RAM_ENDIAN_LITTLE | MMU_RAM_ELSZ_NONE;
@@ -76,90 +102,158 @@ static int omap_rproc_map_unmap(struct iommu_domain *domain,
 		if (ret)
 			return ret;
 
-		size -= pg_size[i];
-		da += pg_size[i];
-		pa += pg_size[i];
+		size -= pgsz;
+		da += pgsz;
+		pa += pgsz;
 	}
 
 	return 0;
 }
 
+/* map (or unmap) all the memory maps in the iommu domain */
+static int omap_rproc_map_all(struct device *dev, struct iommu_domain *domain,
+			const struct rproc_mem_entry *maps, bool map)
+{
+	int ret = 0, i;
+
+	for (i = 0; maps[i].size; i++) {
+		ret = omap_rproc_map_unmap(domain, &maps[i], map);
+		if (ret) {
+			dev_err(dev, "iommu_%smap failed: %d\n",
+						map ? "" : "un", ret);
+			break;
+		}
+	}
+
+	/* don't leave a partial mapping behind */
+	if (ret && map)
+		while (--i >= 0)
+			omap_rproc_map_unmap(domain, &maps[i], false);
+
+	return ret;
+}
+
+/* preload the TLB with the entries of the memory maps (see lock_tlb) */
+static void omap_rproc_lock_tlb(struct rproc *rproc)
+{
+	struct omap_rproc_priv *priv = rproc->priv;
+	struct iommu *obj = dev_get_drvdata(priv->iommu);
+	int i, locked = 0, max = obj->nr_tlb_entries / 2;
+	struct iotlb_entry e;
+	u32 da, pa, size, pgsz;
+
+	for (i = 0; rproc->memory_maps[i].size; i++) {
+		const struct rproc_mem_entry *me = &rproc->memory_maps[i];
+
+		da = me->da;
+		pa = me->pa;
+		size = me->size;
+
+		while (size) {
+			if (locked == max)
+				goto out;
+
+			pgsz = omap_rproc_pgsz(da, pa, size);
+
+			memset(&e, 0, sizeof(e));
+			e.da = da;
+			e.pa = pa;
+			e.pgsz = bytes_to_iopgsz(pgsz);
+			e.valid = 1;
+			e.prsvd = 1;
+			e.endian = MMU_RAM_ENDIAN_LITTLE;
+			e.elsz = MMU_RAM_ELSZ_NONE;
+
+			if (load_iotlb_entry(obj, &e)) {
+				dev_warn(rproc->dev, "can't lock tlb entry of "
+							"da 0x%x\n", da);
+				goto out;
+			}
+
+			locked++;
+			size -= pgsz;
+			da += pgsz;
+			pa += pgsz;
+		}
+	}
+
+out:
+	dev_dbg(rproc->dev, "locked %d tlb entries\n", locked);
+}
+
 /* bootaddr isn't needed for the dual M3's */
 static inline int omap_rproc_start(struct rproc *rproc, u64 bootaddr)
 {
 	struct device *dev = rproc->dev;
 	struct platform_device *pdev = to_platform_device(dev);
 	struct omap_rproc_pdata *pdata = dev->platform_data;
-	struct iommu_domain *domain;
-	struct device *iommu;
-	struct omap_rproc_priv *priv;
-	int ret, i;
+	struct omap_rproc_priv *priv = platform_get_drvdata(pdev);
+	int ret;
 
 	if (!iommu_found()) {
 		dev_err(&pdev->dev, "iommu not found\n");
 		return -ENODEV;
 	}
 
-	priv = kmalloc(sizeof(*priv), GFP_KERNEL);
-	if (!priv) {
-		dev_err(&pdev->dev, "kzalloc failed\n");
-		return -ENOMEM;
+	rproc->priv = priv;
+
+	/* the iommu domain is kept across reboots, so it's only set up once */
+	if (priv->domain) {
+		ret = iommu_attach_device(priv->domain, priv->iommu);
+		if (ret) {
+			dev_err(&pdev->dev, "can't attach iommu device: %d\n",
+									ret);
+			return ret;
+		}
+		goto mapped;
 	}
 
 	/*
 	 * Use the specified iommu name to find our iommu device.
 	 * TODO: solve this generically so other platforms can use it, too
 	 */
-	iommu = omap_find_iommu_device(pdata->iommu_name);
-	if (!iommu) {
+	priv->iommu = omap_find_iommu_device(pdata->iommu_name);
+	if (!priv->iommu) {
 		dev_err(dev, "omap_find_iommu_device failed\n");
-		ret = -ENODEV;
-		goto free_mem;
+		return -ENODEV;
 	}
 
-	domain = iommu_domain_alloc();
-	if (!domain) {
+	priv->domain = iommu_domain_alloc();
+	if (!priv->domain) {
 		dev_err(&pdev->dev, "can't alloc iommu domain\n");
-		ret = -ENODEV;
-		goto free_mem;
+		return -ENODEV;
 	}
 
-	priv->iommu = iommu;
-	priv->domain = domain;
-	rproc->priv = priv;
-
-	ret = iommu_attach_device(domain, iommu);
+	ret = iommu_attach_device(priv->domain, priv->iommu);
 	if (ret) {
 		dev_err(&pdev->dev, "can't attach iommu device: %d\n", ret);
 		goto free_domain;
 	}
 
-	for (i = 0; rproc->memory_maps[i].size; i++) {
-		const struct rproc_mem_entry *me = &rproc->memory_maps[i];
+	ret = omap_rproc_map_all(dev, priv->domain, rproc->memory_maps, true);
+	if (ret)
+		goto detach_iommu;
 
-		ret = omap_rproc_map_unmap(domain, me, true);
-		if (ret) {
-			dev_err(&pdev->dev, "iommu_map failed: %d\n", ret);
-			goto unmap_regions;
-		}
-	}
+mapped:
+	/* attaching the iommu flushed its TLB */
+	if (lock_tlb)
+		omap_rproc_lock_tlb(rproc);
 
 	/* power on the remote processor itself */
 	ret = omap_device_enable(pdev);
-	if (ret)
-		goto unmap_regions;
+	if (ret) {
+		/* keep the mappings for the next try */
+		iommu_detach_device(priv->domain, priv->iommu);
+		return ret;
+	}
 
 	return 0;
 
-unmap_regions:
-	for (--i; i >= 0 && rproc->memory_maps[i].size; i--) {
-		const struct rproc_mem_entry *me = &rproc->memory_maps[i];
-		omap_rproc_map_unmap(domain, me, false);
-	}
+detach_iommu:
+	iommu_detach_device(priv->domain, priv->iommu);
 free_domain:
-	iommu_domain_free(domain);
-free_mem:
-	kfree(priv);
+	iommu_domain_free(priv->domain);
+	priv->domain = NULL;
 	return ret;
 }
 
@@ -168,32 +262,19 @@ static inline int omap_rproc_stop(struct rproc *rproc)
 	struct device *dev = rproc->dev;
 	struct platform_device *pdev = to_platform_device(dev);
 	struct omap_rproc_priv *priv = rproc->priv;
-	struct iommu_domain *domain = priv->domain;
-	struct device *iommu = priv->iommu;
-	int ret, i;
+	int ret;
 
 	/* power off the remote processor itself */
 	ret = omap_device_shutdown(pdev);
 	if (ret) {
 		dev_err(dev, "failed to shutdown: %d\n", ret);
-		goto out;
-	}
-
-	for (i = 0; rproc->memory_maps[i].size; i++) {
-		const struct rproc_mem_entry *me = &rproc->memory_maps[i];
-
-		ret = omap_rproc_map_unmap(domain, me, false);
-		if (ret) {
-			dev_err(&pdev->dev, "iommu_unmap failed: %d\n", ret);
-			goto out;
-		}
+		return ret;
 	}
 
-	iommu_detach_device(domain, iommu);
-	iommu_domain_free(domain);
+	/* the mappings are kept (in the domain) for the next boot */
+	iommu_detach_device(priv->domain, priv->iommu);
 
-out:
-	return ret;
+	return 0;
 }
 
 static struct rproc_ops omap_rproc_ops = {
@@ -204,17 +285,52 @@ static struct rproc_ops omap_rproc_ops = {
 static int omap_rproc_probe(struct platform_device *pdev)
 {
 	struct omap_rproc_pdata *pdata = pdev->dev.platform_data;
+	struct omap_rproc_priv *priv;
+	int ret;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv) {
+		dev_err(&pdev->dev, "kzalloc failed\n");
+		return -ENOMEM;
+	}
 
-	return rproc_register(&pdev->dev, pdata->name, &omap_rproc_ops,
+	platform_set_drvdata(pdev, priv);
+
+	ret = rproc_register(&pdev->dev, pdata->name, &omap_rproc_ops,
 				pdata->firmware, pdata->memory_maps,
 				THIS_MODULE);
+	if (ret) {
+		platform_set_drvdata(pdev, NULL);
+		kfree(priv);
+	}
+
+	return ret;
 }
 
 static int __devexit omap_rproc_remove(struct platform_device *pdev)
 {
 	struct omap_rproc_pdata *pdata = pdev->dev.platform_data;
+	struct omap_rproc_priv *priv = platform_get_drvdata(pdev);
+	int ret;
+
+	ret = rproc_unregister(pdata->name);
+	if (ret)
+		return ret;
+
+	/* the page tables can only be torn down while the iommu is attached */
+	if (priv->domain && !iommu_attach_device(priv->domain, priv->iommu)) {
+		omap_rproc_map_all(&pdev->dev, priv->domain,
+						pdata->memory_maps, false);
+		iommu_detach_device(priv->domain, priv->iommu);
+	}
 
-	return rproc_unregister(pdata->name);
+	if (priv->domain)
+		iommu_domain_free(priv->domain);
+
+	platform_set_drvdata(pdev, NULL);
+	kfree(priv);
+
+	return 0;
 }
 
 static struct platform_driver omap_rproc_driver = {
@@ -230,7 +346,10 @@ static int __init omap_rproc_init(void)
 {
 	return platform_driver_register(&omap_rproc_driver);
 }
-/* must be ready in time for device_initcall users */
+/*
+ * must be ready in time for device_initcall users (e.g. the rpmsg host,
+ * which rproc_get()s us), so the rprocs are registered synchronously too
+ */
 subsys_initcall(omap_rproc_init);
 
 static void __exit omap_rproc_exit(void)
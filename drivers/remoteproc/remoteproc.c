@@ -33,6 +33,13 @@
 #include <linux/io.h>
 #include <linux/list.h>
 #include <linux/debugfs.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/elf.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
 #include <linux/remoteproc.h>
 
 /* list of the available remote processors */
@@ -52,22 +59,66 @@ static struct dentry *rproc_dbg;
  * Some remote processors may support dumping trace logs into a shared
  * memory buffer. We expose this trace buffer using debugfs, so users
  * can easily tell what's going on remotely.
+ *
+ * The trace can be streamed: every reader keeps its own position, and
+ * only what the remote processor wrote since its last read is looked at
+ * (the trace buffer is uncached memory, so it's slow to scan), and read.
+ * Readers can poll() for new trace, too.
  */
 static ssize_t rproc_format_trace_buf(char __user *userbuf, size_t count,
 				    loff_t *ppos, const void *src, int size)
 {
 	const char *buf = (const char *) src;
-	int i;
+	loff_t i;
+
+	if (!buf)
+		return 0;
+
+	/* a remote processor that rebooted restarts its trace from scratch */
+	if (*ppos > 0 && *ppos <= size && !buf[*ppos - 1])
+		*ppos = 0;
 
 	/*
-	 * find the end of trace buffer (does not account for wrapping).
+	 * find the end of trace buffer (does not account for wrapping), from
+	 * where the last read ended, since this reader saw what's before it.
 	 * desirable improvement: use a ring buffer instead.
 	 */
-	for (i = 0; i < size && buf[i]; i++);
+	for (i = min_t(loff_t, *ppos, size); i < size && buf[i]; i++);
 
 	return simple_read_from_buffer(userbuf, count, ppos, src, i);
 }
 
+/*
+ * The remote processor doesn't tell us when it writes trace, so pollers
+ * are woken up periodically to check for it (but only while there are
+ * pollers, which re-arm the wakeup whenever they find nothing new).
+ */
+#define RPROC_TRACE_POLL_MS	100
+
+static unsigned int rproc_poll_trace_buf(struct file *filp, poll_table *wait,
+				struct rproc *rproc, const char *buf, int size)
+{
+	loff_t pos = filp->f_pos;
+
+	poll_wait(filp, &rproc->trace_wq, wait);
+
+	if (buf && pos < size && (buf[pos] || (pos > 0 && !buf[pos - 1])))
+		return POLLIN | POLLRDNORM;
+
+	schedule_delayed_work(&rproc->trace_work,
+				msecs_to_jiffies(RPROC_TRACE_POLL_MS));
+
+	return 0;
+}
+
+static void rproc_trace_work(struct work_struct *work)
+{
+	struct rproc *rproc = container_of(to_delayed_work(work),
+						struct rproc, trace_work);
+
+	wake_up_interruptible(&rproc->trace_wq);
+}
+
 static int rproc_open_generic(struct inode *inode, struct file *file)
 {
 	file->private_data = inode->i_private;
@@ -82,8 +133,16 @@ static ssize_t name## _rproc_read(struct file *filp,			\
 	return rproc_format_trace_buf(userbuf, count, ppos, value, len);\
 }									\
 									\
+static unsigned int name## _rproc_poll(struct file *filp,		\
+						poll_table *wait)	\
+{									\
+	struct rproc *rproc = filp->private_data;			\
+	return rproc_poll_trace_buf(filp, wait, rproc, value, len);	\
+}									\
+									\
 static const struct file_operations name ##_rproc_ops = {		\
 	.read = name ##_rproc_read,					\
+	.poll = name ##_rproc_poll,					\
 	.open = rproc_open_generic,					\
 	.llseek	= generic_file_llseek,					\
 };
@@ -148,6 +207,59 @@ static const struct file_operations rproc_state_ops = {
 	.llseek	= generic_file_llseek,
 };
 
+/* The profile of the last boot is exposed via debugfs, too */
+static ssize_t rproc_boot_stats_read(struct file *filp, char __user *userbuf,
+						size_t count, loff_t *ppos)
+{
+	struct rproc *rproc = filp->private_data;
+	struct rproc_boot_stats *stats = &rproc->boot_stats;
+	struct rproc_boot_segment *seg;
+	ssize_t ret;
+	char *buf;
+	int i, n;
+
+	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	n = scnprintf(buf, PAGE_SIZE, "firmware: %s%s\n", rproc->firmware,
+					stats->cached ? " (cached)" : "");
+	n += scnprintf(buf + n, PAGE_SIZE - n, "status: %d\n", stats->status);
+	n += scnprintf(buf + n, PAGE_SIZE - n, "request: %lld us\n",
+							stats->request_us);
+	n += scnprintf(buf + n, PAGE_SIZE - n, "validate: %lld us\n",
+							stats->validate_us);
+	n += scnprintf(buf + n, PAGE_SIZE - n,
+			"copy: %lld us (dma wait %lld us), %u bytes\n",
+			stats->copy_us, stats->copy_wait_us, stats->copy_bytes);
+	n += scnprintf(buf + n, PAGE_SIZE - n, "resources: %lld us\n",
+							stats->resources_us);
+	n += scnprintf(buf + n, PAGE_SIZE - n, "start: %lld us\n",
+							stats->start_us);
+	n += scnprintf(buf + n, PAGE_SIZE - n, "total: %lld us\n",
+							stats->total_us);
+
+	for (i = 0; i < min(stats->num_segments, RPROC_MAX_BOOT_SEGMENTS);
+									i++) {
+		seg = &stats->segments[i];
+		n += scnprintf(buf + n, PAGE_SIZE - n,
+			"section %d: pa 0x%08x, %u/%u bytes, %u us\n", i,
+			seg->pa, seg->filesz, seg->memsz, seg->us);
+	}
+
+	ret = simple_read_from_buffer(userbuf, count, ppos, buf, n);
+
+	kfree(buf);
+
+	return ret;
+}
+
+static const struct file_operations rproc_boot_stats_ops = {
+	.read = rproc_boot_stats_read,
+	.open = rproc_open_generic,
+	.llseek	= generic_file_llseek,
+};
+
 /* The name of the remote processor is exposed via debugfs, too */
 static ssize_t rproc_name_read(struct file *filp, char __user *userbuf,
 						size_t count, loff_t *ppos)
@@ -251,25 +363,143 @@ rproc_da_to_pa(const struct rproc_mem_entry *maps, u64 da, phys_addr_t *pa)
 	return -EINVAL;
 }
 
+/*
+ * Find the entry of @rproc's memory maps that holds the physical region
+ * [@pa, @pa + @len), and return its index, or -ENOENT if there's none.
+ */
+static int rproc_find_map(struct rproc *rproc, phys_addr_t pa, u32 len)
+{
+	const struct rproc_mem_entry *maps = rproc->memory_maps;
+	int i;
+
+	if (!maps)
+		return -ENOENT;
+
+	for (i = 0; maps[i].size; i++)
+		if (pa >= maps[i].pa && pa - maps[i].pa < maps[i].size &&
+				len <= maps[i].size - (pa - maps[i].pa))
+			return i;
+
+	return -ENOENT;
+}
+
+/**
+ * rproc_get_memory_maps() - get the memory maps of a remote processor
+ * @name: name of the remote processor
+ *
+ * Lets users translate addresses the way the remote processor sees them,
+ * even before they boot it (or without booting it at all).
+ *
+ * Returns the memory maps @name was registered with, or NULL if there are
+ * none (or if it isn't registered).
+ */
+const struct rproc_mem_entry *rproc_get_memory_maps(const char *name)
+{
+	struct rproc *rproc = __find_rproc_by_name(name);
+
+	return rproc ? rproc->memory_maps : NULL;
+}
+EXPORT_SYMBOL(rproc_get_memory_maps);
+
+/**
+ * rproc_pa_to_va() - get the kernel address of a region of a carveout
+ * @rproc: the remote processor
+ * @pa: physical address of the region
+ * @len: length of the region
+ *
+ * Each region of @rproc's memory maps is mapped (write-combined) the first
+ * time it's accessed, and the mapping is kept until the remote processor
+ * is unregistered, so it's shared by all the firmware sections, the trace
+ * buffers, and the IPC transports, and across reboots.
+ *
+ * Returns the kernel address of @pa, or NULL if it's not in a region of
+ * the memory maps (e.g. if there are none), or if it couldn't be mapped.
+ * The mapping mustn't be iounmap'ed by the caller. This might sleep.
+ */
+void *rproc_pa_to_va(struct rproc *rproc, phys_addr_t pa, u32 len)
+{
+	const struct rproc_mem_entry *me;
+	void *va = NULL;
+	int i;
+
+	i = rproc_find_map(rproc, pa, len);
+	if (i < 0 || !rproc->maps_va)
+		return NULL;
+
+	me = &rproc->memory_maps[i];
+
+	mutex_lock(&rproc->lock);
+
+	/* ioremaping normal memory, so make sparse happy */
+	if (!rproc->maps_va[i])
+		rproc->maps_va[i] = (__force void *) ioremap_wc(me->pa,
+								me->size);
+	if (rproc->maps_va[i])
+		va = rproc->maps_va[i] + (pa - me->pa);
+	else
+		dev_err(rproc->dev, "can't ioremap 0x%x\n", me->pa);
+
+	mutex_unlock(&rproc->lock);
+
+	return va;
+}
+EXPORT_SYMBOL(rproc_pa_to_va);
+
+/*
+ * Map a region of the remote processor's memory: use the persistent
+ * mapping of the carveout it's in, and only map it on its own if there's
+ * none (i.e. if the remote processor accesses physical memory directly).
+ * Undo with rproc_unmap().
+ */
+static void *rproc_map(struct rproc *rproc, phys_addr_t pa, u32 len)
+{
+	if (rproc_find_map(rproc, pa, len) >= 0)
+		return rproc_pa_to_va(rproc, pa, len);
+
+	/* ioremaping normal memory, so make sparse happy */
+	return (__force void *) ioremap_wc(pa, len);
+}
+
+/* unmap a region mapped by rproc_map(), unless it's in a carveout mapping */
+static void rproc_unmap(struct rproc *rproc, void *va)
+{
+	const struct rproc_mem_entry *maps = rproc->memory_maps;
+	int i;
+
+	for (i = 0; maps && maps[i].size; i++)
+		if (rproc->maps_va && rproc->maps_va[i] &&
+				va >= rproc->maps_va[i] &&
+				va < rproc->maps_va[i] + maps[i].size)
+			return;
+
+	/* iounmap normal memory, so make sparse happy */
+	iounmap((__force void __iomem *) va);
+}
+
 /**
  * rproc_start() - boot the remote processor
  * @rproc: the remote processor
  * @bootaddr: address of first instruction to execute (optional)
  *
  * Boot a remote processor (i.e. power it on, take it out of reset, etc..)
+ *
+ * Returns 0 on success, or an appropriate error code otherwise.
  */
-static void rproc_start(struct rproc *rproc, u64 bootaddr)
+static int rproc_start(struct rproc *rproc, u64 bootaddr)
 {
 	struct device *dev = rproc->dev;
+	ktime_t start;
 	int err;
 
 	err = mutex_lock_interruptible(&rproc->lock);
 	if (err) {
 		dev_err(dev, "can't lock remote processor %d\n", err);
-		return;
+		return err;
 	}
 
+	start = ktime_get();
 	err = rproc->ops->start(rproc, bootaddr);
+	rproc->boot_stats.start_us = ktime_us_delta(ktime_get(), start);
 	if (err) {
 		dev_err(dev, "can't start rproc %s: %d\n", rproc->name, err);
 		goto unlock_mutex;
@@ -281,6 +511,7 @@ static void rproc_start(struct rproc *rproc, u64 bootaddr)
 
 unlock_mutex:
 	mutex_unlock(&rproc->lock);
+	return err;
 }
 
 /**
@@ -288,9 +519,8 @@ unlock_mutex:
  * @rproc: the remote processor
  * @rsc: the trace resource descriptor
  *
- * In case the remote processor dumps trace logs into memory, ioremap it
+ * In case the remote processor dumps trace logs into memory, map it
  * and make it available to the user via debugfs.
- * Consider using the DMA mapping API here.
  *
  * Returns 0 on success, or an appropriate error code otherwise
  */
@@ -313,11 +543,7 @@ static int rproc_handle_trace_rsc(struct rproc *rproc, struct fw_resource *rsc)
 		return -EBUSY;
 	}
 
-	/*
-	 * trace buffer memory is normal memory, so we cast away the __iomem
-	 * to make sparse happy
-	 */
-	ptr = (__force void *) ioremap_nocache(pa, rsc->len);
+	ptr = rproc_map(rproc, pa, rsc->len);
 	if (!ptr) {
 		dev_err(dev, "can't ioremap trace buffer %s\n", rsc->name);
 		return -ENOMEM;
@@ -337,6 +563,77 @@ static int rproc_handle_trace_rsc(struct rproc *rproc, struct fw_resource *rsc)
 	return 0;
 }
 
+/*
+ * find the IPC layout of the link @rsc is about (both RSC_IPC and RSC_VRING
+ * entries describe it), or start a new one. returns NULL if there's no
+ * room for another link.
+ */
+static struct rproc_ipc_cfg *rproc_ipc_cfg(struct rproc *rproc,
+						struct fw_resource *rsc)
+{
+	struct rproc_ipc_cfg *cfg;
+	int i;
+
+	for (i = 0; i < rproc->num_ipc_cfgs; i++) {
+		cfg = &rproc->ipc_cfgs[i];
+		if (!strncmp(cfg->name, rsc->name, sizeof(cfg->name)))
+			return cfg;
+	}
+
+	if (rproc->num_ipc_cfgs == RPROC_MAX_IPC_CFGS)
+		return NULL;
+
+	cfg = &rproc->ipc_cfgs[rproc->num_ipc_cfgs++];
+	memset(cfg, 0, sizeof(*cfg));
+	strlcpy(cfg->name, rsc->name, sizeof(cfg->name));
+
+	return cfg;
+}
+
+/**
+ * rproc_handle_ipc_rsc() - handle an IPC layout announcement
+ * @rproc: the remote processor
+ * @rsc: the IPC (or vring) resource descriptor
+ *
+ * Just remember the layout, so the IPC transport can later ask for it
+ * using rproc_get_ipc_cfg().
+ *
+ * Returns 0 on success, or an appropriate error code otherwise
+ */
+static int rproc_handle_ipc_rsc(struct rproc *rproc, struct fw_resource *rsc)
+{
+	struct device *dev = rproc->dev;
+	struct rproc_ipc_cfg *cfg;
+
+	/* a vring's alignment is optional, but it has to have entries */
+	if (!rsc->len || (rsc->type == RSC_IPC && !rsc->flags)) {
+		dev_err(dev, "invalid ipc rsc %s\n", rsc->name);
+		return -EINVAL;
+	}
+
+	cfg = rproc_ipc_cfg(rproc, rsc);
+	if (!cfg) {
+		dev_warn(dev, "skipping extra ipc rsc %s\n", rsc->name);
+		return 0;
+	}
+
+	if (rsc->type == RSC_VRING) {
+		cfg->vring_num = rsc->len;
+		cfg->vring_align = rsc->flags;
+		dev_dbg(dev, "ipc %s: vrings of %u entries, aligned %u\n",
+				cfg->name, cfg->vring_num, cfg->vring_align);
+		return 0;
+	}
+
+	cfg->num_bufs = rsc->len;
+	cfg->buf_size = rsc->flags;
+
+	dev_dbg(dev, "ipc %s: %u bufs of %u bytes\n", cfg->name,
+						cfg->num_bufs, cfg->buf_size);
+
+	return 0;
+}
+
 /**
  * rproc_handle_resources - go over and handle the resource section
  * @rproc: rproc handle
@@ -348,6 +645,7 @@ static int rproc_handle_resources(struct rproc *rproc, struct fw_resource *rsc,
 							int len, u64 *bootaddr)
 {
 	struct device *dev = rproc->dev;
+	ktime_t start = ktime_get();
 	int ret = 0;
 
 	while (len >= sizeof(*rsc)) {
@@ -366,6 +664,12 @@ static int rproc_handle_resources(struct rproc *rproc, struct fw_resource *rsc,
 				dev_warn(dev, "bootaddr already set\n");
 			*bootaddr = rsc->da;
 			break;
+		case RSC_IPC:
+		case RSC_VRING:
+			ret = rproc_handle_ipc_rsc(rproc, rsc);
+			if (ret)
+				dev_err(dev, "failed handling rsc\n");
+			break;
 		default:
 			/* we don't support much yet, so don't be noisy */
 			dev_dbg(dev, "unsupported resource %d\n", rsc->type);
@@ -380,22 +684,196 @@ static int rproc_handle_resources(struct rproc *rproc, struct fw_resource *rsc,
 
 	/* unmap trace buffers on failure */
 	if (ret && rproc->trace_buf0)
-		iounmap((__force void __iomem *) rproc->trace_buf0);
+		rproc_unmap(rproc, rproc->trace_buf0);
 	if (ret && rproc->trace_buf1)
-		iounmap((__force void __iomem *) rproc->trace_buf1);
+		rproc_unmap(rproc, rproc->trace_buf1);
+
+	rproc->boot_stats.resources_us += ktime_us_delta(ktime_get(), start);
 
 	return ret;
 }
 
+/*
+ * The firmware sections can be copied by a DMA engine that can do memcpy,
+ * rather than by the CPU. This is considerably faster for big images, and
+ * the resource table is parsed while the copies are in flight. The engine
+ * must be able to access the remote processor's memory (i.e. its physical
+ * addresses) directly. If no engine is around, the CPU copies the sections.
+ */
+static bool dma_load;
+module_param(dma_load, bool, S_IRUGO);
+MODULE_PARM_DESC(dma_load, "Load the firmware sections using a DMA engine");
+
+#ifdef CONFIG_DMA_ENGINE
+static struct dma_chan *rproc_dma_get(void)
+{
+	dma_cap_mask_t mask;
+
+	if (!dma_load)
+		return NULL;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+
+	return dma_request_channel(mask, NULL, NULL);
+}
+
+/* wait for the issued copies to complete, and let go of the engine */
+static int rproc_dma_put(struct dma_chan *chan, dma_cookie_t cookie)
+{
+	enum dma_status status = DMA_SUCCESS;
+
+	if (cookie > 0) {
+		dma_async_issue_pending(chan);
+		status = dma_sync_wait(chan, cookie);
+	}
+
+	dma_release_channel(chan);
+
+	return status == DMA_SUCCESS ? 0 : -EIO;
+}
+
+/*
+ * issue the copy of a section, page by page, since the image itself is
+ * only virtually contiguous. the source pages are unmapped by the engine
+ * when the copy completes. returns the cookie of the last copy, or a
+ * negative error code if the copy couldn't be issued (entirely).
+ */
+static dma_cookie_t rproc_dma_section(struct dma_chan *chan, phys_addr_t pa,
+						const u8 *src, u32 len)
+{
+	struct dma_device *dma = chan->device;
+	struct dma_async_tx_descriptor *tx;
+	dma_cookie_t cookie = -EINVAL;
+	struct page *page;
+	dma_addr_t addr;
+	size_t off, chunk;
+
+	while (len) {
+		off = offset_in_page(src);
+		chunk = min_t(size_t, len, PAGE_SIZE - off);
+		page = is_vmalloc_addr(src) ? vmalloc_to_page(src) :
+							virt_to_page(src);
+
+		addr = dma_map_page(dma->dev, page, off, chunk, DMA_TO_DEVICE);
+		if (dma_mapping_error(dma->dev, addr))
+			return -ENOMEM;
+
+		/* the remote processor's memory isn't ours to map */
+		tx = dma->device_prep_dma_memcpy(chan, pa, addr, chunk,
+				DMA_CTRL_ACK | DMA_COMPL_SKIP_DEST_UNMAP);
+		if (!tx) {
+			dma_unmap_page(dma->dev, addr, chunk, DMA_TO_DEVICE);
+			return -ENOMEM;
+		}
+
+		cookie = tx->tx_submit(tx);
+		if (dma_submit_error(cookie))
+			return cookie;
+
+		src += chunk;
+		pa += chunk;
+		len -= chunk;
+	}
+
+	/* get the engine going while we're busy with the next section */
+	dma_async_issue_pending(chan);
+
+	return cookie;
+}
+#else
+static inline struct dma_chan *rproc_dma_get(void)
+{
+	return NULL;
+}
+
+static inline int rproc_dma_put(struct dma_chan *chan, dma_cookie_t cookie)
+{
+	return 0;
+}
+
+static inline dma_cookie_t rproc_dma_section(struct dma_chan *chan,
+				phys_addr_t pa, const u8 *src, u32 len)
+{
+	return -ENODEV;
+}
+#endif
+
+/*
+ * Put a segment of the image where the remote processor expects it: copy
+ * its @filesz bytes from @src to @pa (using the DMA engine, if there is
+ * one), and zero the rest of its @memsz bytes (e.g. its bss) in place.
+ * DMA copies are only waited for once the whole image is issued, so
+ * @last is updated with the cookie of the last one.
+ */
+static int rproc_load_segment(struct rproc *rproc, struct dma_chan *chan,
+			phys_addr_t pa, const void *src, u32 filesz, u32 memsz,
+			dma_cookie_t *last)
+{
+	struct rproc_boot_stats *stats = &rproc->boot_stats;
+	struct device *dev = rproc->dev;
+	dma_cookie_t cookie = -ENODEV;
+	ktime_t start;
+	void *ptr;
+	s64 us;
+
+	if (!memsz)
+		return 0;
+
+	start = ktime_get();
+
+	if (chan && filesz) {
+		cookie = rproc_dma_section(chan, pa, src, filesz);
+		if (cookie > 0) {
+			*last = cookie;
+			if (filesz == memsz)
+				goto out;
+		}
+	}
+
+	/*
+	 * it's mapped write-combined, since writing it strongly-ordered
+	 * is slow (and it's usually in a carveout, which stays mapped)
+	 */
+	ptr = rproc_map(rproc, pa, memsz);
+	if (!ptr) {
+		dev_err(dev, "can't ioremap 0x%x\n", pa);
+		return -ENOMEM;
+	}
+
+	if (cookie <= 0)
+		memcpy(ptr, src, filesz);
+	memset(ptr + filesz, 0, memsz - filesz);
+
+	rproc_unmap(rproc, ptr);
+
+out:
+	us = ktime_us_delta(ktime_get(), start);
+	if (stats->num_segments < RPROC_MAX_BOOT_SEGMENTS) {
+		struct rproc_boot_segment *seg =
+				&stats->segments[stats->num_segments];
+
+		seg->pa = pa;
+		seg->filesz = filesz;
+		seg->memsz = memsz;
+		seg->us = us;
+	}
+	stats->num_segments++;
+	stats->copy_bytes += filesz;
+	stats->copy_us += us;
+
+	return 0;
+}
+
 static int rproc_process_fw(struct rproc *rproc, struct fw_section *section,
-						int left, u64 *bootaddr)
+		int left, struct dma_chan *chan, dma_cookie_t *last,
+		u64 *bootaddr)
 {
 	struct device *dev = rproc->dev;
 	phys_addr_t pa;
 	u32 len, type;
 	u64 da;
 	int ret = 0;
-	void *ptr;
 
 	while (left > sizeof(struct fw_section)) {
 		da = section->da;
@@ -420,25 +898,21 @@ static int rproc_process_fw(struct rproc *rproc, struct fw_section *section,
 
 		dev_dbg(dev, "da 0x%llx pa 0x%x len 0x%x\n", da, pa, len);
 
-		/* ioremaping normal memory, so make sparse happy */
-		ptr = (__force void *) ioremap_nocache(pa, len);
-		if (!ptr) {
-			dev_err(dev, "can't ioremap 0x%x\n", pa);
-			ret = -ENOMEM;
-			break;
-		}
-
 		/* put the section where the remoteproc will expect it */
-		memcpy(ptr, section->content, len);
+		ret = rproc_load_segment(rproc, chan, pa, section->content,
+							len, len, last);
+		if (ret)
+			break;
 
-		/* a resource table needs special handling */
+		/*
+		 * a resource table needs special handling. it's parsed from
+		 * the image (even while it's being copied), since it's only
+		 * ever read, and the remote gets the very same one
+		 */
 		if (section->type == FW_RESOURCE)
 			ret = rproc_handle_resources(rproc,
-						(struct fw_resource *) ptr,
-						len, bootaddr);
-
-		/* iounmap normal memory; make sparse happy */
-		iounmap((__force void __iomem *) ptr);
+					(struct fw_resource *) section->content,
+					len, bootaddr);
 
 		/* rproc_handle_resources may have failed */
 		if (ret)
@@ -451,34 +925,166 @@ static int rproc_process_fw(struct rproc *rproc, struct fw_section *section,
 	return ret;
 }
 
-static void rproc_load_fw(const struct firmware *fw, void *context)
+/*
+ * Find the resource table of an ELF image, i.e. its ".resource_table"
+ * section, and handle it. An image doesn't have to have one.
+ */
+static int rproc_elf_resources(struct rproc *rproc, const struct firmware *fw,
+								u64 *bootaddr)
 {
-	struct rproc *rproc = context;
+	struct elf32_hdr *ehdr = (struct elf32_hdr *) fw->data;
+	struct elf32_shdr *shdr, *strtab;
 	struct device *dev = rproc->dev;
-	const char *fwfile = rproc->firmware;
-	u64 bootaddr = 0;
-	struct fw_header *image;
-	struct fw_section *section;
-	int left, ret;
+	const char *name;
+	int i;
 
-	if (!fw) {
-		dev_err(dev, "%s: failed to load %s\n", __func__, fwfile);
-		goto complete_fw;
+	if (!ehdr->e_shnum)
+		return 0;
+
+	if (ehdr->e_shoff > fw->size || ehdr->e_shstrndx >= ehdr->e_shnum ||
+			ehdr->e_shnum > (fw->size - ehdr->e_shoff) /
+							sizeof(*shdr)) {
+		dev_err(dev, "invalid elf section headers\n");
+		return -EINVAL;
 	}
 
-	dev_info(dev, "Loaded fw image %s, size %d\n", fwfile, fw->size);
+	shdr = (struct elf32_shdr *)(fw->data + ehdr->e_shoff);
+	strtab = &shdr[ehdr->e_shstrndx];
+
+	if (strtab->sh_offset > fw->size ||
+			strtab->sh_size > fw->size - strtab->sh_offset) {
+		dev_err(dev, "elf string table is truncated\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < ehdr->e_shnum; i++, shdr++) {
+		/* the name has to fit in the string table, with its NUL */
+		if (shdr->sh_name >= strtab->sh_size ||
+				strtab->sh_size - shdr->sh_name <
+						sizeof(".resource_table"))
+			continue;
+
+		name = fw->data + strtab->sh_offset + shdr->sh_name;
+		if (strcmp(name, ".resource_table"))
+			continue;
+
+		if (shdr->sh_offset > fw->size ||
+				shdr->sh_size > fw->size - shdr->sh_offset) {
+			dev_err(dev, "resource table is truncated\n");
+			return -EINVAL;
+		}
+
+		return rproc_handle_resources(rproc,
+				(struct fw_resource *)(fw->data + shdr->sh_offset),
+				shdr->sh_size, bootaddr);
+	}
+
+	return 0;
+}
+
+/*
+ * Load an ELF image: only its PT_LOAD segments are put in memory (at their
+ * physical, i.e. device, addresses), so debug info and symbols are never
+ * copied, and the part of a segment that isn't in the file (its bss) is
+ * zeroed in place. The boot address is the entry point, unless the
+ * resource table says otherwise.
+ */
+static int rproc_process_elf(struct rproc *rproc, const struct firmware *fw,
+		struct dma_chan *chan, dma_cookie_t *last, u64 *bootaddr)
+{
+	struct elf32_hdr *ehdr = (struct elf32_hdr *) fw->data;
+	struct device *dev = rproc->dev;
+	struct elf32_phdr *phdr;
+	phys_addr_t pa;
+	int i, ret;
+
+	if (fw->size < sizeof(*ehdr) || ehdr->e_ident[EI_CLASS] != ELFCLASS32) {
+		dev_err(dev, "Image is not a 32-bit elf\n");
+		return -EINVAL;
+	}
+
+	if (ehdr->e_type != ET_EXEC || ehdr->e_phoff > fw->size ||
+			ehdr->e_phnum > (fw->size - ehdr->e_phoff) /
+							sizeof(*phdr)) {
+		dev_err(dev, "Image has invalid elf program headers\n");
+		return -EINVAL;
+	}
+
+	ret = rproc_elf_resources(rproc, fw, bootaddr);
+	if (ret)
+		return ret;
+
+	phdr = (struct elf32_phdr *)(fw->data + ehdr->e_phoff);
+
+	for (i = 0; i < ehdr->e_phnum; i++, phdr++) {
+		if (phdr->p_type != PT_LOAD || !phdr->p_memsz)
+			continue;
+
+		dev_dbg(dev, "segment: da 0x%x filesz 0x%x memsz 0x%x\n",
+			phdr->p_paddr, phdr->p_filesz, phdr->p_memsz);
+
+		if (phdr->p_filesz > phdr->p_memsz ||
+				phdr->p_offset > fw->size ||
+				phdr->p_filesz > fw->size - phdr->p_offset) {
+			dev_err(dev, "firmware image is truncated\n");
+			return -EINVAL;
+		}
+
+		ret = rproc_da_to_pa(rproc->memory_maps, phdr->p_paddr, &pa);
+		if (ret) {
+			dev_err(dev, "rproc_da_to_pa failed: %d\n", ret);
+			return ret;
+		}
+
+		ret = rproc_load_segment(rproc, chan, pa,
+					fw->data + phdr->p_offset,
+					phdr->p_filesz, phdr->p_memsz, last);
+		if (ret)
+			return ret;
+	}
+
+	if (!*bootaddr)
+		*bootaddr = ehdr->e_entry;
+
+	return 0;
+}
+
+/*
+ * Load the image, in either the RPRC or the ELF format, and find out
+ * where the remote processor should be booted at
+ */
+static int rproc_load_image(struct rproc *rproc, const struct firmware *fw,
+								u64 *bootaddr)
+{
+	struct device *dev = rproc->dev;
+	struct fw_header *image;
+	struct fw_section *section;
+	struct dma_chan *chan;
+	dma_cookie_t last = 0;
+	int left, err, ret;
 
 	/* make sure this image is sane */
 	if (fw->size < sizeof(struct fw_header)) {
 		dev_err(dev, "Image is too small\n");
-		goto out;
+		return -EINVAL;
 	}
 
+	chan = rproc_dma_get();
+	if (chan)
+		dev_dbg(dev, "loading sections using %s\n",
+						dma_chan_name(chan));
+
 	image = (struct fw_header *) fw->data;
 
+	if (!memcmp(image->magic, ELFMAG, SELFMAG)) {
+		ret = rproc_process_elf(rproc, fw, chan, &last, bootaddr);
+		goto put_chan;
+	}
+
 	if (memcmp(image->magic, "RPRC", 4)) {
 		dev_err(dev, "Image is corrupted (bad magic)\n");
-		goto out;
+		ret = -EINVAL;
+		goto put_chan;
 	}
 
 	dev_info(dev, "BIOS image version is %d\n", image->version);
@@ -488,19 +1094,148 @@ static void rproc_load_fw(const struct firmware *fw, void *context)
 
 	left = fw->size - sizeof(struct fw_header) - image->header_len;
 
-	ret = rproc_process_fw(rproc, section, left, &bootaddr);
+	ret = rproc_process_fw(rproc, section, left, chan, &last, bootaddr);
+
+put_chan:
+	/* the sections must all be in place before the remote boots */
+	if (chan) {
+		ktime_t start = ktime_get();
+
+		err = rproc_dma_put(chan, last);
+		rproc->boot_stats.copy_wait_us = ktime_us_delta(ktime_get(),
+									start);
+		rproc->boot_stats.copy_us += rproc->boot_stats.copy_wait_us;
+		if (err && !ret) {
+			dev_err(dev, "dma of the firmware sections failed\n");
+			ret = err;
+		}
+	}
+
+	/* drain the write buffers of the write-combined mappings, too */
+	wmb();
+
+	return ret;
+}
+
+/*
+ * The last image a remote processor was successfully booted with is kept
+ * in memory, so rebooting it (e.g. when its users come and go, or after a
+ * crash) doesn't have to read the image from the filesystem again.
+ * Turn this off to have a new version of the image picked up on reboot.
+ */
+static bool fw_cache = true;
+module_param(fw_cache, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fw_cache, "Keep the firmware images around for reboots");
+
+/* keep @fw for the next boot if it's good, or let go of it otherwise */
+static void rproc_cache_fw(struct rproc *rproc, const struct firmware *fw,
+								bool good)
+{
+	if (good && fw_cache) {
+		if (fw != rproc->cached_fw) {
+			release_firmware(rproc->cached_fw);
+			rproc->cached_fw = fw;
+		}
+		return;
+	}
+
+	if (fw == rproc->cached_fw)
+		rproc->cached_fw = NULL;
+	release_firmware(fw);
+}
+
+static void rproc_load_fw(const struct firmware *fw, void *context)
+{
+	struct rproc *rproc = context;
+	struct rproc_boot_stats *stats = &rproc->boot_stats;
+	struct device *dev = rproc->dev;
+	const char *fwfile = rproc->firmware;
+	ktime_t start = ktime_get();
+	u64 bootaddr = 0;
+	int ret;
+
+	stats->request_us = ktime_us_delta(start, stats->requested);
+
+	if (!fw) {
+		dev_err(dev, "%s: failed to load %s\n", __func__, fwfile);
+		ret = -ENOENT;
+		goto complete_fw;
+	}
+
+	dev_info(dev, "Loaded fw image %s, size %d\n", fwfile, fw->size);
+
+	ret = rproc_load_image(rproc, fw, &bootaddr);
+	stats->validate_us = ktime_us_delta(ktime_get(), start) -
+					stats->copy_us - stats->resources_us;
 	if (ret) {
 		dev_err(dev, "Failed to process the image: %d\n", ret);
 		goto out;
 	}
 
-	rproc_start(rproc, bootaddr);
+	ret = rproc_start(rproc, bootaddr);
 
 out:
-	release_firmware(fw);
+	rproc_cache_fw(rproc, fw, !ret);
 complete_fw:
+	stats->total_us = ktime_us_delta(ktime_get(), stats->requested);
+	stats->status = ret;
+
 	/* allow all contexts calling rproc_put() to proceed */
 	complete_all(&rproc->firmware_loading_complete);
+
+	/* let the users that didn't want to wait know, too */
+	blocking_notifier_call_chain(&rproc->nbh,
+			ret ? RPROC_BOOT_FAILED : RPROC_BOOTED, NULL);
+}
+
+/* boot from the cached image of the previous boot */
+static void rproc_load_cached_fw(struct work_struct *work)
+{
+	struct rproc *rproc = container_of(work, struct rproc, fw_work);
+
+	rproc_load_fw(rproc->cached_fw, rproc);
+}
+
+/*
+ * Initiate an asynchronous loading of the image, which completes the
+ * firmware_loading_complete of @rproc when it's done. The image is only
+ * requested if there's no cached copy of it. Called with the lock held.
+ */
+static int rproc_request_fw(struct rproc *rproc)
+{
+	struct rproc_boot_stats *stats = &rproc->boot_stats;
+
+	if (rproc->cached_fw && !fw_cache) {
+		release_firmware(rproc->cached_fw);
+		rproc->cached_fw = NULL;
+	}
+
+	/* start profiling this boot afresh */
+	memset(stats, 0, sizeof(*stats));
+	stats->requested = ktime_get();
+	stats->cached = rproc->cached_fw;
+	stats->status = 1;
+
+	if (rproc->cached_fw) {
+		dev_dbg(rproc->dev, "using the cached %s\n", rproc->firmware);
+		schedule_work(&rproc->fw_work);
+		return 0;
+	}
+
+	return request_firmware_nowait(THIS_MODULE, FW_ACTION_HOTPLUG,
+			rproc->firmware, rproc->dev, GFP_KERNEL, rproc,
+			rproc_load_fw);
+}
+
+/* the trace buffers are looked up anew whenever an image is loaded */
+static void rproc_unmap_traces(struct rproc *rproc)
+{
+	if (rproc->trace_buf0)
+		rproc_unmap(rproc, rproc->trace_buf0);
+	if (rproc->trace_buf1)
+		rproc_unmap(rproc, rproc->trace_buf1);
+
+	rproc->trace_buf0 = rproc->trace_buf1 = NULL;
 }
 
 /**
@@ -550,6 +1285,9 @@ struct rproc *rproc_get(const char *name)
 	/* rproc_put() calls should wait until async loader completes */
 	init_completion(&rproc->firmware_loading_complete);
 
+	/* the resource table of the new image is yet to be parsed */
+	rproc->num_ipc_cfgs = 0;
+
 	dev_info(dev, "powering up %s\n", name);
 
 	/* loading a firmware is required */
@@ -562,8 +1300,7 @@ struct rproc *rproc_get(const char *name)
 	 * Initiate an asynchronous firmware loading, to allow building
 	 * remoteproc as built-in kernel code, without hanging the boot process
 	 */
-	err = request_firmware_nowait(THIS_MODULE, FW_ACTION_HOTPLUG,
-			rproc->firmware, dev, GFP_KERNEL, rproc, rproc_load_fw);
+	err = rproc_request_fw(rproc);
 	if (err < 0) {
 		dev_err(dev, "request_firmware_nowait failed: %d\n", err);
 		goto deref_rproc;
@@ -583,6 +1320,61 @@ unlock_mutex:
 }
 EXPORT_SYMBOL(rproc_get);
 
+/**
+ * rproc_wait_for_boot() - wait until the remote processor is booted
+ * @rproc: the remote processor, as returned by rproc_get()
+ *
+ * rproc_get() (and rproc_restart()) only initiate the asynchronous loading
+ * of the firmware, so several remote processors can boot at the same time.
+ * Users that need the remote processor to be up can wait for it here,
+ * while users that mustn't block can use rproc_event_register() instead.
+ *
+ * Returns 0 if the remote processor was booted, or -EIO if its boot failed.
+ * This might sleep.
+ */
+int rproc_wait_for_boot(struct rproc *rproc)
+{
+	int state;
+
+	wait_for_completion(&rproc->firmware_loading_complete);
+
+	state = ACCESS_ONCE(rproc->state);
+
+	return state == RPROC_RUNNING || state == RPROC_SUSPENDED ? 0 : -EIO;
+}
+EXPORT_SYMBOL(rproc_wait_for_boot);
+
+/**
+ * rproc_event_register() - get notified when the remote processor boots
+ * @rproc: the remote processor
+ * @nb: the notifier block
+ *
+ * @nb is called with RPROC_BOOTED whenever the remote processor is booted
+ * (by rproc_get() or rproc_restart()), or with RPROC_BOOT_FAILED if its
+ * boot failed. It's called in process context, after rproc_wait_for_boot()
+ * waiters were woken up.
+ *
+ * Returns 0 on success, or an appropriate error code otherwise.
+ */
+int rproc_event_register(struct rproc *rproc, struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&rproc->nbh, nb);
+}
+EXPORT_SYMBOL(rproc_event_register);
+
+/**
+ * rproc_event_unregister() - stop the notifications of rproc_event_register()
+ * @rproc: the remote processor
+ * @nb: the notifier block that was registered
+ *
+ * Returns 0 on success, or -ENOENT if @nb isn't registered.
+ */
+int rproc_event_unregister(struct rproc *rproc, struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&rproc->nbh, nb);
+}
+EXPORT_SYMBOL(rproc_event_unregister);
+
 /**
  * rproc_put() - power off the remote processor
  * @rproc: the remote processor
@@ -621,20 +1413,14 @@ void rproc_put(struct rproc *rproc)
 	if (--rproc->count)
 		goto out;
 
-	if (rproc->trace_buf0)
-		/* iounmap normal memory, so make sparse happy */
-		iounmap((__force void __iomem *) rproc->trace_buf0);
-	if (rproc->trace_buf1)
-		/* iounmap normal memory, so make sparse happy */
-		iounmap((__force void __iomem *) rproc->trace_buf1);
-
-	rproc->trace_buf0 = rproc->trace_buf1 = NULL;
+	rproc_unmap_traces(rproc);
 
 	/*
 	 * make sure rproc is really running before powering it off.
 	 * this is important, because the fw loading might have failed.
 	 */
-	if (rproc->state == RPROC_RUNNING) {
+	if (rproc->state == RPROC_RUNNING || rproc->state == RPROC_SUSPENDED ||
+					rproc->state == RPROC_CRASHED) {
 		ret = rproc->ops->stop(rproc);
 		if (ret) {
 			dev_err(dev, "can't stop rproc: %d\n", ret);
@@ -653,6 +1439,216 @@ out:
 }
 EXPORT_SYMBOL(rproc_put);
 
+/**
+ * rproc_report_crash() - declare that the remote processor crashed
+ * @rproc: the remote processor, as returned by rproc_get()
+ *
+ * Called by users that learn about a crash of the remote processor (e.g.
+ * when it tells them so), before they try to recover using rproc_restart().
+ *
+ * A remote processor that isn't running (e.g. one that is being rebooted
+ * already) isn't marked, so when all the users of a remote processor
+ * report the same crash, it is only rebooted once. This might sleep.
+ */
+void rproc_report_crash(struct rproc *rproc)
+{
+	mutex_lock(&rproc->lock);
+
+	if (rproc->state == RPROC_RUNNING || rproc->state == RPROC_SUSPENDED) {
+		rproc->state = RPROC_CRASHED;
+		dev_err(rproc->dev, "remote processor %s crashed\n",
+								rproc->name);
+	}
+
+	mutex_unlock(&rproc->lock);
+}
+EXPORT_SYMBOL(rproc_report_crash);
+
+/**
+ * rproc_restart() - reboot a crashed remote processor
+ * @rproc: the remote processor, as returned by rproc_get()
+ *
+ * Power off a remote processor that was reported to have crashed, and
+ * boot it again with a fresh copy of its firmware, which is loaded
+ * asynchronously (just like with rproc_get()). Its users keep their rproc
+ * handles throughout, so there's no need to rproc_put() and rproc_get()
+ * it again (which wouldn't reboot it anyway, while others use it).
+ *
+ * If the remote processor isn't marked as crashed (anymore), nothing is
+ * done, so it's rebooted once even if several users try to recover.
+ *
+ * Returns 0 on success (or if there's nothing to do), and an appropriate
+ * error code otherwise.
+ */
+int rproc_restart(struct rproc *rproc)
+{
+	struct device *dev = rproc->dev;
+	int ret;
+
+	ret = mutex_lock_interruptible(&rproc->lock);
+	if (ret) {
+		dev_err(dev, "can't lock rproc %s: %d\n", rproc->name, ret);
+		return ret;
+	}
+
+	if (rproc->state != RPROC_CRASHED)
+		goto unlock_mutex;
+
+	rproc_unmap_traces(rproc);
+
+	ret = rproc->ops->stop(rproc);
+	if (ret) {
+		dev_err(dev, "can't stop rproc %s: %d\n", rproc->name, ret);
+		goto unlock_mutex;
+	}
+
+	rproc->state = RPROC_OFFLINE;
+
+	/* rproc_put() calls should wait until async loader completes */
+	init_completion(&rproc->firmware_loading_complete);
+
+	/* the resource table of the new image is yet to be parsed */
+	rproc->num_ipc_cfgs = 0;
+
+	dev_info(dev, "rebooting %s\n", rproc->name);
+
+	ret = rproc_request_fw(rproc);
+	if (ret < 0) {
+		dev_err(dev, "request_firmware_nowait failed: %d\n", ret);
+		complete_all(&rproc->firmware_loading_complete);
+		goto unlock_mutex;
+	}
+
+	rproc->state = RPROC_LOADING;
+	ret = 0;
+
+unlock_mutex:
+	mutex_unlock(&rproc->lock);
+	return ret;
+}
+EXPORT_SYMBOL(rproc_restart);
+
+/**
+ * rproc_get_ipc_cfg() - get the IPC layout the firmware was built with
+ * @rproc: the remote processor, as returned by rproc_get()
+ * @name: name of the IPC link
+ * @cfg: where to put the layout of the link
+ *
+ * The layout is announced by RSC_IPC and/or RSC_VRING entries in the
+ * firmware's resource table, so this waits until the (asynchronous)
+ * firmware loading is over. Whatever the firmware didn't announce (e.g.
+ * the vrings, if there's only a RSC_IPC entry) is zero in @cfg.
+ *
+ * Returns 0 on success, or -ENOENT if the firmware didn't announce the
+ * layout of @name (or failed to load).
+ */
+int rproc_get_ipc_cfg(struct rproc *rproc, const char *name,
+						struct rproc_ipc_cfg *cfg)
+{
+	int i;
+
+	wait_for_completion(&rproc->firmware_loading_complete);
+
+	for (i = 0; i < rproc->num_ipc_cfgs; i++) {
+		if (!strcmp(rproc->ipc_cfgs[i].name, name)) {
+			*cfg = rproc->ipc_cfgs[i];
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+EXPORT_SYMBOL(rproc_get_ipc_cfg);
+
+/**
+ * rproc_suspend() - put the remote processor in a low power state
+ * @rproc: the remote processor
+ *
+ * Suspend a running remote processor (normally once it's been idle for
+ * a while), from which state it can quickly be woken up again using
+ * rproc_resume().
+ *
+ * On success, 0 is returned. If the platform doesn't support suspending
+ * its remote processor, -ENOSYS is returned, and if the remote processor
+ * isn't running, -EINVAL.
+ */
+int rproc_suspend(struct rproc *rproc)
+{
+	struct device *dev = rproc->dev;
+	int ret;
+
+	if (!rproc->ops->suspend)
+		return -ENOSYS;
+
+	ret = mutex_lock_interruptible(&rproc->lock);
+	if (ret) {
+		dev_err(dev, "can't lock rproc %s: %d\n", rproc->name, ret);
+		return ret;
+	}
+
+	if (rproc->state != RPROC_RUNNING) {
+		ret = -EINVAL;
+		goto unlock_mutex;
+	}
+
+	ret = rproc->ops->suspend(rproc);
+	if (ret) {
+		dev_err(dev, "can't suspend rproc %s: %d\n", rproc->name, ret);
+		goto unlock_mutex;
+	}
+
+	rproc->state = RPROC_SUSPENDED;
+
+	dev_dbg(dev, "suspended remote processor %s\n", rproc->name);
+
+unlock_mutex:
+	mutex_unlock(&rproc->lock);
+	return ret;
+}
+EXPORT_SYMBOL(rproc_suspend);
+
+/**
+ * rproc_resume() - wake up a suspended remote processor
+ * @rproc: the remote processor
+ *
+ * Wake up a remote processor that was suspended using rproc_suspend(),
+ * so it can receive messages again. This might sleep.
+ *
+ * On success (or if the remote processor isn't suspended at all), 0 is
+ * returned, and on failure, an appropriate error code.
+ */
+int rproc_resume(struct rproc *rproc)
+{
+	struct device *dev = rproc->dev;
+	int ret;
+
+	/* cheap check for the common case; it is verified under the lock */
+	if (ACCESS_ONCE(rproc->state) != RPROC_SUSPENDED)
+		return 0;
+
+	mutex_lock(&rproc->lock);
+
+	if (rproc->state != RPROC_SUSPENDED) {
+		ret = 0;
+		goto unlock_mutex;
+	}
+
+	ret = rproc->ops->resume ? rproc->ops->resume(rproc) : 0;
+	if (ret) {
+		dev_err(dev, "can't resume rproc %s: %d\n", rproc->name, ret);
+		goto unlock_mutex;
+	}
+
+	rproc->state = RPROC_RUNNING;
+
+	dev_dbg(dev, "resumed remote processor %s\n", rproc->name);
+
+unlock_mutex:
+	mutex_unlock(&rproc->lock);
+	return ret;
+}
+EXPORT_SYMBOL(rproc_resume);
+
 /**
  * rproc_register() - register a remote processor
  * @dev: the underlying device
@@ -676,6 +1672,7 @@ int rproc_register(struct device *dev, const char *name,
 				struct module *owner)
 {
 	struct rproc *rproc;
+	int i;
 
 	if (!dev || !name || !ops)
 		return -EINVAL;
@@ -686,6 +1683,18 @@ int rproc_register(struct device *dev, const char *name,
 		return -ENOMEM;
 	}
 
+	/* the memory maps are mapped on demand, see rproc_pa_to_va() */
+	for (i = 0; memory_maps && memory_maps[i].size; i++)
+		;
+	if (i) {
+		rproc->maps_va = kcalloc(i, sizeof(void *), GFP_KERNEL);
+		if (!rproc->maps_va) {
+			dev_err(dev, "%s: kcalloc failed\n", __func__);
+			kfree(rproc);
+			return -ENOMEM;
+		}
+	}
+
 	rproc->dev = dev;
 	rproc->name = name;
 	rproc->ops = ops;
@@ -694,6 +1703,10 @@ int rproc_register(struct device *dev, const char *name,
 	rproc->owner = owner;
 
 	mutex_init(&rproc->lock);
+	INIT_WORK(&rproc->fw_work, rproc_load_cached_fw);
+	BLOCKING_INIT_NOTIFIER_HEAD(&rproc->nbh);
+	init_waitqueue_head(&rproc->trace_wq);
+	INIT_DELAYED_WORK(&rproc->trace_work, rproc_trace_work);
 
 	rproc->state = RPROC_OFFLINE;
 
@@ -716,6 +1729,8 @@ int rproc_register(struct device *dev, const char *name,
 							&rproc_name_ops);
 	debugfs_create_file("state", 0400, rproc->dbg_dir, rproc,
 							&rproc_state_ops);
+	debugfs_create_file("boot_stats", 0400, rproc->dbg_dir, rproc,
+							&rproc_boot_stats_ops);
 
 out:
 	return 0;
@@ -734,6 +1749,7 @@ EXPORT_SYMBOL(rproc_register);
 int rproc_unregister(const char *name)
 {
 	struct rproc *rproc;
+	int i;
 
 	rproc = __find_rproc_by_name(name);
 	if (!rproc) {
@@ -743,9 +1759,22 @@ int rproc_unregister(const char *name)
 
 	dev_info(rproc->dev, "removing %s\n", name);
 
+	/* a boot from the cached image might still be going on */
+	flush_work_sync(&rproc->fw_work);
+
+	for (i = 0; rproc->maps_va && rproc->memory_maps[i].size; i++)
+		if (rproc->maps_va[i])
+			/* iounmap normal memory, so make sparse happy */
+			iounmap((__force void __iomem *) rproc->maps_va[i]);
+	kfree(rproc->maps_va);
+
+	release_firmware(rproc->cached_fw);
+
 	if (rproc->dbg_dir)
 		debugfs_remove_recursive(rproc->dbg_dir);
 
+	cancel_delayed_work_sync(&rproc->trace_work);
+
 	spin_lock(&rprocs_lock);
 	list_del(&rproc->next);
 	spin_unlock(&rprocs_lock);
@@ -0,0 +1,512 @@
+/*
+ * Remote processor messaging transport (loopback host)
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This host doesn't talk to a remote processor at all: it registers two
+ * virtual remote processors, and cross-connects their vrings, so the tx
+ * vring of each one is the rx vring of the other. Each side thus sees
+ * the other as its remote processor, and e.g. the name service, rpmsg
+ * drivers and user space interfaces can be exercised (and profiled) on
+ * any machine, without real hardware or firmware.
+ *
+ * The role of the remote processor (i.e. the virtio "device" side of the
+ * vrings) is played by a work item, which copies every message sent by
+ * one side to an rx buffer of the other side.
+ */
+
+#define pr_fmt(fmt) "%s: " fmt, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/virtio.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_ids.h>
+#include <linux/virtio_ring.h>
+#include <linux/rpmsg.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/log2.h>
+#include <linux/ratelimit.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <asm/io.h>
+
+#include <trace/events/rpmsg.h>
+
+/*
+ * By default, allocate 512 buffers of 512 bytes for each side, just like
+ * the OMAP host does. The vrings have an entry per buffer of their side.
+ */
+#define RPMSG_NUM_BUFS		(512)
+#define RPMSG_BUF_SIZE		(512)
+
+#define RPMSG_MIN_NUM_BUFS	(4)
+#define RPMSG_MIN_BUF_SIZE	(64)
+
+/* the alignment between the consumer and producer parts of the vring */
+#define RPMSG_VRING_ALIGN	(4096)
+
+#define RPMSG_RING_SIZE(nbufs)	PAGE_ALIGN(vring_size((nbufs) / 2, \
+							RPMSG_VRING_ALIGN))
+
+/* the number and size of the buffers of both sides (must be powers of 2) */
+static unsigned int num_bufs = RPMSG_NUM_BUFS;
+module_param(num_bufs, uint, S_IRUGO);
+MODULE_PARM_DESC(num_bufs, "Number of IPC buffers (rx + tx) of every side");
+
+static unsigned int buf_size = RPMSG_BUF_SIZE;
+module_param(buf_size, uint, S_IRUGO);
+MODULE_PARM_DESC(buf_size, "Size of each IPC buffer of every side");
+
+/* both sides are the rpmsg bus, so they can use compact headers, too */
+static bool compact_hdr;
+module_param(compact_hdr, bool, S_IRUGO);
+MODULE_PARM_DESC(compact_hdr, "Use compact (8-byte) message headers");
+
+/**
+ * struct loopback_rpmsg_vring - a vring, as seen by the "remote" side
+ * @vr: the vring layout (shared with the virtqueue of the local side)
+ * @addr: where the vring is mapped onto
+ * @vq: the virtqueue of the local side
+ * @last_avail_idx: index of the next available buffer we haven't used yet
+ */
+struct loopback_rpmsg_vring {
+	struct vring vr;
+	void *addr;
+	struct virtqueue *vq;
+	u16 last_avail_idx;
+};
+
+/**
+ * struct loopback_rpmsg_vproc - a loopback virtual remote processor
+ * @vdev: virtio device
+ * @vring: the rx and tx vrings of this side, in this order
+ * @buf_mapped: kernel address of the IPC buffer region
+ * @buf_paddr: physical address of the IPC buffer region
+ * @buf_size: size of IPC buffer region
+ * @ring_size: size of the memory occupied by each of the vrings
+ * @ready: the vrings are set up, so messages can be passed to this side
+ * @static_chnls: table of static channels for this side
+ */
+struct loopback_rpmsg_vproc {
+	struct virtio_device vdev;
+	struct loopback_rpmsg_vring vring[2];
+	void *buf_mapped;
+	phys_addr_t buf_paddr;
+	unsigned int buf_size;
+	unsigned int ring_size;
+	bool ready;
+	struct rpmsg_channel_info *static_chnls;
+};
+
+#define to_loopback_vproc(vd) container_of(vd, struct loopback_rpmsg_vproc, \
+									vdev)
+
+static void loopback_rpmsg_work_fn(struct work_struct *work);
+
+/* passes the messages between the two sides */
+static DECLARE_WORK(loopback_rpmsg_work, loopback_rpmsg_work_fn);
+
+/* protects the vrings (and readiness) of the two sides */
+static DEFINE_MUTEX(loopback_rpmsg_lock);
+
+/*
+ * The second side publishes a couple of services, which the first side
+ * learns about using the name service: the rpmsg server sample (to be
+ * used with the client sample), and an echo service (for the rpmsg
+ * benchmark driver).
+ */
+static struct rpmsg_channel_info loopback_rpmsg_server_chnls[] = {
+	{ RMSG_SERVER_CHNL("rpmsg-server-sample", 137) },
+	{ RMSG_SERVER_CHNL("rpmsg-echo", 138) },
+	{ },
+};
+
+static struct loopback_rpmsg_vproc loopback_rpmsg_vprocs[2];
+
+/*
+ * peek at the next buffer the local side made available, or return -1 if
+ * there is none. the caller consumes it by incrementing last_avail_idx.
+ */
+static int loopback_rpmsg_peek_avail(struct loopback_rpmsg_vring *lvr)
+{
+	struct vring *vr = &lvr->vr;
+
+	if (lvr->last_avail_idx == ACCESS_ONCE(vr->avail->idx))
+		return -1;
+
+	/* only read the entry after seeing the index that covers it */
+	smp_rmb();
+
+	return vr->avail->ring[lvr->last_avail_idx % vr->num];
+}
+
+/* give a buffer back to the local side */
+static void loopback_rpmsg_add_used(struct loopback_rpmsg_vring *lvr,
+						unsigned int head, u32 len)
+{
+	struct vring *vr = &lvr->vr;
+	struct vring_used_elem *used;
+
+	used = &vr->used->ring[vr->used->idx % vr->num];
+	used->id = head;
+	used->len = len;
+
+	/* the entry must be visible before the index that covers it */
+	smp_wmb();
+
+	vr->used->idx++;
+}
+
+/* interrupt the local side, unless it asked us not to */
+static void loopback_rpmsg_interrupt(struct loopback_rpmsg_vring *lvr)
+{
+	unsigned long flags;
+
+	/* make the used index visible before checking whether to interrupt */
+	smp_mb();
+
+	if (ACCESS_ONCE(lvr->vr.avail->flags) & VRING_AVAIL_F_NO_INTERRUPT)
+		return;
+
+	/* the rpmsg bus expects its vq callbacks to run with irqs disabled */
+	local_irq_save(flags);
+	vring_interrupt(0, lvr->vq);
+	local_irq_restore(flags);
+}
+
+/*
+ * copy the messages sent by @src to the rx buffers of @dst, for as long
+ * as @dst has rx buffers available. must be called with
+ * loopback_rpmsg_lock held.
+ */
+static void loopback_rpmsg_forward(struct loopback_rpmsg_vproc *src,
+					struct loopback_rpmsg_vproc *dst)
+{
+	struct loopback_rpmsg_vring *tx = &src->vring[1];
+	struct loopback_rpmsg_vring *rx = &dst->vring[0];
+	struct vring_desc *out, *in;
+	int out_head, in_head, sent = 0, received = 0;
+
+	while ((out_head = loopback_rpmsg_peek_avail(tx)) >= 0) {
+		/* wait for the destination to post more rx buffers */
+		in_head = loopback_rpmsg_peek_avail(rx);
+		if (in_head < 0)
+			break;
+
+		/* the rpmsg bus always uses a single descriptor per buffer */
+		out = &tx->vr.desc[out_head];
+		in = &rx->vr.desc[in_head];
+
+		if (out->len <= in->len) {
+			memcpy(phys_to_virt(in->addr), phys_to_virt(out->addr),
+								out->len);
+			loopback_rpmsg_add_used(rx, in_head, out->len);
+			rx->last_avail_idx++;
+			received++;
+		} else {
+			pr_err_ratelimited("dropping a %u bytes msg (max %u)\n",
+							out->len, in->len);
+		}
+
+		loopback_rpmsg_add_used(tx, out_head, 0);
+		tx->last_avail_idx++;
+		sent++;
+	}
+
+	if (received)
+		loopback_rpmsg_interrupt(rx);
+	if (sent)
+		loopback_rpmsg_interrupt(tx);
+}
+
+static void loopback_rpmsg_work_fn(struct work_struct *work)
+{
+	struct loopback_rpmsg_vproc *a = &loopback_rpmsg_vprocs[0];
+	struct loopback_rpmsg_vproc *b = &loopback_rpmsg_vprocs[1];
+
+	mutex_lock(&loopback_rpmsg_lock);
+
+	/* messages sent before the other side came up are still waiting */
+	if (a->ready && b->ready) {
+		loopback_rpmsg_forward(a, b);
+		loopback_rpmsg_forward(b, a);
+	}
+
+	mutex_unlock(&loopback_rpmsg_lock);
+}
+
+/*
+ * Provide rpmsg core with platform-specific configuration.
+ *
+ * For more info on these configuration requests, see enum
+ * rpmsg_platform_requests.
+ */
+static void loopback_rpmsg_get(struct virtio_device *vdev,
+			unsigned int request, void *buf, unsigned len)
+{
+	struct loopback_rpmsg_vproc *vproc = to_loopback_vproc(vdev);
+	int tmp;
+
+	switch (request) {
+	case VPROC_BUF_ADDR:
+		BUG_ON(len != sizeof(vproc->buf_mapped));
+		memcpy(buf, &vproc->buf_mapped, len);
+		break;
+	case VPROC_BUF_PADDR:
+		BUG_ON(len != sizeof(vproc->buf_paddr));
+		memcpy(buf, &vproc->buf_paddr, len);
+		break;
+	case VPROC_BUF_NUM:
+		BUG_ON(len != sizeof(tmp));
+		tmp = num_bufs;
+		memcpy(buf, &tmp, len);
+		break;
+	case VPROC_BUF_SZ:
+		BUG_ON(len != sizeof(tmp));
+		tmp = buf_size;
+		memcpy(buf, &tmp, len);
+		break;
+	case VPROC_STATIC_CHANNELS:
+		BUG_ON(len != sizeof(vproc->static_chnls));
+		memcpy(buf, &vproc->static_chnls, len);
+		break;
+	case VPROC_BUF_CACHE_OPS:
+		/* both sides are the same (coherent) cpu */
+		BUG_ON(len != sizeof(const struct rpmsg_cache_ops *));
+		*(const struct rpmsg_cache_ops **) buf = NULL;
+		break;
+	case VPROC_MEM_MAPS:
+		/* the other side uses physical addresses, as is */
+		BUG_ON(len != sizeof(const struct rproc_mem_entry *));
+		*(const struct rproc_mem_entry **) buf = NULL;
+		break;
+	case VPROC_PM_OPS:
+		/* the other side is always on */
+		BUG_ON(len != sizeof(const struct rpmsg_pm_ops *));
+		*(const struct rpmsg_pm_ops **) buf = NULL;
+		break;
+	default:
+		dev_err(&vdev->dev, "invalid request: %d\n", request);
+	}
+}
+
+/* "kick the remote processor": let the work item pass the messages on */
+static void loopback_rpmsg_notify(struct virtqueue *vq)
+{
+	struct loopback_rpmsg_vproc *vproc = to_loopback_vproc(vq->vdev);
+	struct loopback_rpmsg_vring *lvr = vq->priv;
+
+	trace_rpmsg_notify(vq, lvr - vproc->vring);
+
+	schedule_work(&loopback_rpmsg_work);
+}
+
+static void loopback_rpmsg_del_vqs(struct virtio_device *vdev)
+{
+	struct loopback_rpmsg_vproc *vproc = to_loopback_vproc(vdev);
+	int i;
+
+	/* once we're not ready, the work item doesn't touch our vrings */
+	mutex_lock(&loopback_rpmsg_lock);
+	vproc->ready = false;
+	mutex_unlock(&loopback_rpmsg_lock);
+
+	if (vproc->buf_mapped) {
+		free_pages_exact(vproc->buf_mapped, vproc->buf_size);
+		vproc->buf_mapped = NULL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(vproc->vring); i++) {
+		struct loopback_rpmsg_vring *lvr = &vproc->vring[i];
+
+		if (lvr->vq)
+			vring_del_virtqueue(lvr->vq);
+		if (lvr->addr)
+			free_pages_exact(lvr->addr, vproc->ring_size);
+
+		memset(lvr, 0, sizeof(*lvr));
+	}
+}
+
+static int loopback_rpmsg_find_vqs(struct virtio_device *vdev, unsigned nvqs,
+		       struct virtqueue *vqs[],
+		       vq_callback_t *callbacks[],
+		       const char *names[])
+{
+	struct loopback_rpmsg_vproc *vproc = to_loopback_vproc(vdev);
+	int i, err;
+
+	/* we maintain two virtqueues per side (for RX and TX) */
+	if (nvqs != 2)
+		return -EINVAL;
+
+	for (i = 0; i < nvqs; i++) {
+		struct loopback_rpmsg_vring *lvr = &vproc->vring[i];
+
+		lvr->addr = alloc_pages_exact(vproc->ring_size,
+						GFP_KERNEL | __GFP_ZERO);
+		if (!lvr->addr) {
+			err = -ENOMEM;
+			goto error;
+		}
+
+		/* our own view of the vring, as its "device" side */
+		vring_init(&lvr->vr, num_bufs / 2, lvr->addr,
+							RPMSG_VRING_ALIGN);
+		lvr->last_avail_idx = 0;
+
+		lvr->vq = vring_new_virtqueue(num_bufs / 2, RPMSG_VRING_ALIGN,
+				vdev, lvr->addr, loopback_rpmsg_notify,
+				callbacks[i], names[i]);
+		if (!lvr->vq) {
+			pr_err("vring_new_virtqueue failed\n");
+			err = -ENOMEM;
+			goto error;
+		}
+
+		lvr->vq->priv = lvr;
+		vqs[i] = lvr->vq;
+	}
+
+	vproc->buf_mapped = alloc_pages_exact(vproc->buf_size,
+						GFP_KERNEL | __GFP_ZERO);
+	if (!vproc->buf_mapped) {
+		err = -ENOMEM;
+		goto error;
+	}
+
+	vproc->buf_paddr = virt_to_phys(vproc->buf_mapped);
+
+	mutex_lock(&loopback_rpmsg_lock);
+	vproc->ready = true;
+	mutex_unlock(&loopback_rpmsg_lock);
+
+	/* the other side might have sent us something already */
+	schedule_work(&loopback_rpmsg_work);
+
+	return 0;
+
+error:
+	loopback_rpmsg_del_vqs(vdev);
+	return err;
+}
+
+static u8 loopback_rpmsg_get_status(struct virtio_device *vdev)
+{
+	return 0;
+}
+
+static void loopback_rpmsg_set_status(struct virtio_device *vdev, u8 status)
+{
+	dev_dbg(&vdev->dev, "new status: %d\n", status);
+}
+
+static void loopback_rpmsg_reset(struct virtio_device *vdev)
+{
+	dev_dbg(&vdev->dev, "reset !\n");
+}
+
+static u32 loopback_rpmsg_get_features(struct virtio_device *vdev)
+{
+	/*
+	 * the other side is the rpmsg bus, too, so it knows the name service,
+	 * can reassemble messages that don't fit in a single rx buffer, and
+	 * takes part in the flow control of endpoints
+	 */
+	u32 features = 1 << VIRTIO_RPMSG_F_NS | 1 << VIRTIO_RPMSG_F_FRAG |
+						1 << VIRTIO_RPMSG_F_CREDITS;
+
+	if (compact_hdr)
+		features |= 1 << VIRTIO_RPMSG_F_COMPACT_HDR;
+
+	return features;
+}
+
+static void loopback_rpmsg_finalize_features(struct virtio_device *vdev)
+{
+	/* Give virtio_ring a chance to accept features */
+	vring_transport_features(vdev);
+}
+
+static void loopback_rpmsg_vproc_release(struct device *dev)
+{
+	/* this handler is provided so driver core doesn't yell at us */
+}
+
+static struct virtio_config_ops loopback_rpmsg_config_ops = {
+	.get_features	= loopback_rpmsg_get_features,
+	.finalize_features = loopback_rpmsg_finalize_features,
+	.get		= loopback_rpmsg_get,
+	.find_vqs	= loopback_rpmsg_find_vqs,
+	.del_vqs	= loopback_rpmsg_del_vqs,
+	.reset		= loopback_rpmsg_reset,
+	.set_status	= loopback_rpmsg_set_status,
+	.get_status	= loopback_rpmsg_get_status,
+};
+
+static int __init loopback_rpmsg_init(void)
+{
+	int i, ret;
+
+	if (!is_power_of_2(num_bufs) || num_bufs < RPMSG_MIN_NUM_BUFS ||
+			!is_power_of_2(buf_size) ||
+			buf_size < RPMSG_MIN_BUF_SIZE) {
+		pr_err("invalid buffers config: %u x %u\n", num_bufs,
+								buf_size);
+		return -EINVAL;
+	}
+
+	loopback_rpmsg_vprocs[1].static_chnls = loopback_rpmsg_server_chnls;
+
+	for (i = 0; i < ARRAY_SIZE(loopback_rpmsg_vprocs); i++) {
+		struct loopback_rpmsg_vproc *vproc = &loopback_rpmsg_vprocs[i];
+
+		vproc->buf_size = PAGE_ALIGN(num_bufs * buf_size);
+		vproc->ring_size = RPMSG_RING_SIZE(num_bufs);
+
+		vproc->vdev.id.device = VIRTIO_ID_RPMSG;
+		vproc->vdev.config = &loopback_rpmsg_config_ops;
+		vproc->vdev.dev.release = loopback_rpmsg_vproc_release;
+
+		ret = register_virtio_device(&vproc->vdev);
+		if (ret) {
+			pr_err("failed to register vproc: %d\n", ret);
+			goto unregister;
+		}
+	}
+
+	return 0;
+
+unregister:
+	while (--i >= 0)
+		unregister_virtio_device(&loopback_rpmsg_vprocs[i].vdev);
+	cancel_work_sync(&loopback_rpmsg_work);
+	return ret;
+}
+module_init(loopback_rpmsg_init);
+
+static void __exit loopback_rpmsg_fini(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(loopback_rpmsg_vprocs); i++)
+		unregister_virtio_device(&loopback_rpmsg_vprocs[i].vdev);
+
+	cancel_work_sync(&loopback_rpmsg_work);
+}
+module_exit(loopback_rpmsg_fini);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Loopback remote processor messaging virtio device");
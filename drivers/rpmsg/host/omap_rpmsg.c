@@ -20,155 +20,442 @@
 #define pr_fmt(fmt) "%s: " fmt, __func__
 
 #include <linux/init.h>
-#include <linux/virtio.h>
-#include <linux/virtio_config.h>
-#include <linux/virtio_ids.h>
+#include <linux/module.h>
 #include <linux/virtio_ring.h>
 #include <linux/rpmsg.h>
 #include <linux/err.h>
-#include <linux/slab.h>
 #include <linux/notifier.h>
+#include <linux/genalloc.h>
 #include <linux/remoteproc.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <asm/io.h>
+#include <asm/cacheflush.h>
+#include <asm/outercache.h>
 
 #include <plat/mailbox.h>
 #include <plat/dsp.h>
 
+#include "rpmsg_host.h"
 #include "omap_rpmsg.h"
 
 /**
  * struct omap_rpmsg_vproc - omap's virtio remote processor state
- * @vdev: virtio device
- * @vring: phys address of two vrings; first one used for rx, 2nd one for tx
- * @buf_paddr: physical address of the IPC buffer region
- * @buf_size: size of IPC buffer region
- * @buf_mapped: kernel (ioremap'ed) address of IPC buffer region
+ * @hvp: the generic host state
  * @mbox_name: name of omap mailbox device to use with this vproc
- * @rproc_name: name of remote proc device to use with this vproc
  * @mbox: omap mailbox handle
- * @rproc: remoteproc handle
- * @nb: notifier block that will be invoked on inbound mailbox messages
- * @vq: virtio's virtqueues
- * @base_vq_id: index of first virtqueue that belongs to this vproc
- * @num_of_vqs: number of virtqueues this vproc owns
- * @static_chnls: table of static channels for this vproc
+ * @nb: notifier block that will be invoked on out-of-band mailbox messages
+ * @db: the mapped doorbell page, if doorbell mode is used
+ * @dispatched: number of vqs whose kicks the mailbox dispatches to us
+ * @watchdog: this vproc pings the remote processor (see the echo_ms module
+ *	      parameter). Only one vproc per mailbox may do so, because the
+ *	      echo replies can't be told apart.
+ * @echo_work: sends the periodic echo requests, and spots missed replies
+ * @echo_lock: protects the echo state below
+ * @echo_sent: when the pending echo request was sent, or 0 if none is
+ * @echo_misses: number of periods the pending echo request went unanswered
+ * @echo_pings: number of echo requests sent
+ * @echo_replies: number of echo replies received
+ * @echo_min: shortest echo round-trip, in usecs
+ * @echo_max: longest echo round-trip, in usecs
+ * @echo_sum: total of all echo round-trips, in usecs
+ * @dbg_file: debugfs file with the echo statistics
+ *
+ * The vrings, the IPC buffers and the remote processor itself are handled
+ * by the generic rpmsg host; this is just the mailbox based notification
+ * backend, and the dsp mempool based memory provider.
  */
 struct omap_rpmsg_vproc {
-	struct virtio_device vdev;
-	unsigned int vring[2]; /* mpu owns first vring, ipu owns the 2nd */
-	unsigned int buf_paddr;
-	unsigned int buf_size; /* size must be page-aligned */
-	void *buf_mapped;
+	struct rpmsg_host_vproc hvp;
 	char *mbox_name;
-	char *rproc_name;
 	struct omap_mbox *mbox;
-	struct rproc *rproc;
 	struct notifier_block nb;
-	struct virtqueue *vq[2];
-	int base_vq_id;
-	int num_of_vqs;
-	struct rpmsg_channel_info *static_chnls;
+	struct omap_rpmsg_doorbells *db;
+	int dispatched;
+	bool watchdog;
+	struct delayed_work echo_work;
+	spinlock_t echo_lock;
+	ktime_t echo_sent;
+	unsigned int echo_misses;
+	unsigned long echo_pings;
+	unsigned long echo_replies;
+	s64 echo_min;
+	s64 echo_max;
+	s64 echo_sum;
+	struct dentry *dbg_file;
 };
 
-#define to_omap_vproc(vd) container_of(vd, struct omap_rpmsg_vproc, vdev)
+#define to_omap_vproc(hv) container_of(hv, struct omap_rpmsg_vproc, hvp)
 
-/**
- * struct omap_rpmsg_vq_info - virtqueue state
- * @num: number of buffers supported by the vring
- * @vq_id: a unique index of this virtqueue
- * @addr: address where the vring is mapped onto
- * @vproc: the virtual remote processor state
- *
- * Such a struct will be maintained for every virtqueue we're
- * using to communicate with the remote processor
+/*
+ * With event index based notification suppression, the remote processor
+ * tells us exactly when it needs to be kicked, which saves us mailbox
+ * interrupts when it is busy anyway. This requires support from the
+ * firmware though, so it's off by default.
  */
-struct omap_rpmsg_vq_info {
-	__u16 num;
-	__u16 vq_id;
-	void *addr;
-	struct omap_rpmsg_vproc *vproc;
-};
+static bool event_idx;
+module_param(event_idx, bool, S_IRUGO);
+MODULE_PARM_DESC(event_idx, "Use virtio event index notification suppression");
 
 /*
- * For now, allocate 256 buffers of 512 bytes for each side. each buffer
- * will then have 16B for the msg header and 496B for the payload.
- * This will require a total space of 256KB for the buffers themselves, and
- * 3 pages for every vring (the size of the vring depends on the number of
- * buffers it supports).
+ * With the packed ring layout, a buffer's round trip only touches its own
+ * descriptor, rather than a descriptor and two separate (and shared) ring
+ * entries, so each message costs fewer uncached accesses. This requires
+ * support from the firmware though, so it's off by default.
  */
-#define RPMSG_NUM_BUFS		(512)
-#define RPMSG_BUF_SIZE		(512)
-#define RPMSG_BUFS_SPACE	(RPMSG_NUM_BUFS * RPMSG_BUF_SIZE)
+static bool packed_ring;
+module_param(packed_ring, bool, S_IRUGO);
+MODULE_PARM_DESC(packed_ring, "Use the packed virtio ring layout");
 
 /*
- * The alignment between the consumer and producer parts of the vring.
- * Note: this is part of the "wire" protocol. If you change this, you need
- * to update your BIOS image as well
+ * If the remote processor uses our buffers in the order we give them to
+ * it (as its messages are handled in order anyway), we needn't read the
+ * ids of the buffers it's done with, nor walk their descriptors to free
+ * them, which saves uncached reads on every message. It has to promise
+ * it though, so it's off by default.
  */
-#define RPMSG_VRING_ALIGN	(4096)
+static bool in_order;
+module_param(in_order, bool, S_IRUGO);
+MODULE_PARM_DESC(in_order, "The firmware uses the virtio buffers in order");
 
-/* With 256 buffers, our vring will occupy 3 pages */
-#define RPMSG_RING_SIZE	((DIV_ROUND_UP(vring_size(RPMSG_NUM_BUFS / 2, \
-				RPMSG_VRING_ALIGN), PAGE_SIZE)) * PAGE_SIZE)
+/*
+ * A second, high priority, pair of vrings lets control messages bypass
+ * the bulk traffic (e.g. video buffers) in both directions. Its virtqueue
+ * indices come from a separate range, so the indices of the normal pairs
+ * (and thus the firmware of remote processors that don't support it)
+ * aren't affected. This requires support from the firmware though, so
+ * it's off by default.
+ */
+static bool prio_vqs;
+module_param(prio_vqs, bool, S_IRUGO);
+MODULE_PARM_DESC(prio_vqs, "Offer a high priority pair of virtqueues");
 
-/* The total IPC space needed to communicate with a remote processor */
-#define RPMSG_IPC_MEM	(RPMSG_BUFS_SPACE + 2 * RPMSG_RING_SIZE)
+/*
+ * Mapping the IPC buffers write-combined (rather than strongly-ordered)
+ * lets the A9 merge and reorder its accesses to them, which significantly
+ * speeds up accessing message headers and payloads. The rpmsg bus issues
+ * the barriers needed before handing buffers over to the remote processor
+ * and after taking them back. The vrings themselves are still mapped
+ * uncached, since their ordering is relied upon by the virtio protocol.
+ */
+static bool buf_wc = true;
+module_param(buf_wc, bool, S_IRUGO);
+MODULE_PARM_DESC(buf_wc, "Map the IPC buffers write-combined (not uncached)");
 
 /*
- * Provide rpmsg core with platform-specific configuration.
- * Since user data is at stake here, bugs can't be tolerated. hence
- * the BUG_ON approach on invalid lengths.
- *
- * For more info on these configuration requests, see enum
- * rpmsg_platform_requests.
+ * Going further, the IPC buffers can also be mapped cacheable, in which
+ * case the rpmsg bus asks us to clean/invalidate exactly the range of
+ * every message it sends/receives. The remote processor isn't coherent
+ * with our caches, so this involves both the L1 and the outer (L2) cache.
+ * This takes precedence over buf_wc.
+ */
+static bool buf_cached;
+module_param(buf_cached, bool, S_IRUGO);
+MODULE_PARM_DESC(buf_cached, "Map the IPC buffers cacheable (overrides buf_wc)");
+
+/*
+ * In doorbell mode, kicks raise a flag per vq in a page shared with the
+ * remote processor, and a single RP_MBOX_DOORBELL message is sent as long
+ * as any flag is raised and unhandled. The receiver then processes all
+ * the kicked vqs in one pass, so any number of kicks takes one mailbox
+ * fifo slot. This requires support from the firmware though, so it's
+ * off by default.
+ */
+static bool doorbells;
+module_param(doorbells, bool, S_IRUGO);
+MODULE_PARM_DESC(doorbells, "Kick vqs through a shared-memory doorbell page");
+
+/*
+ * The number and size of the buffers can be changed per vproc, without
+ * rebuilding the kernel, e.g. to shrink the carveout used with firmware
+ * that only exchanges tiny messages, or to enlarge the buffers of a
+ * camera pipeline. Both must be powers of two (the vrings need a power of
+ * two number of entries, and the buffers must not straddle cache lines),
+ * and the firmware must of course be built with the same values.
+ * E.g. num_bufs=512,128 buf_size=512,256 (0 keeps the default).
+ */
+static unsigned int num_bufs[2];
+module_param_array(num_bufs, uint, NULL, S_IRUGO);
+MODULE_PARM_DESC(num_bufs, "Number of IPC buffers (rx + tx) of every vproc");
+
+static unsigned int buf_size[2];
+module_param_array(buf_size, uint, NULL, S_IRUGO);
+MODULE_PARM_DESC(buf_size, "Size of each IPC buffer of every vproc");
+
+/*
+ * Firmware may rather announce the layout it was built with (RSC_IPC
+ * and/or RSC_VRING entries in its resource table). The IPC memory is then set up according
+ * to it, so the memory used always fits the image at hand. This needs
+ * the firmware to be loaded (and the remote processor to be booted)
+ * before the buffers and vrings are set up, so the remote processor gets
+ * the READY and buffer address messages only after it boots, which it
+ * has to support. Hence, it's off by default.
+ */
+static bool fw_layout;
+module_param(fw_layout, bool, S_IRUGO);
+MODULE_PARM_DESC(fw_layout, "Take the IPC layout from the firmware resources");
+
+/*
+ * The remote processors can also be booted only once the rpmsg bus first
+ * has a message for them, rather than when the bus is set up, so cores
+ * that are rarely used don't delay the boot (or take memory and power)
+ * until they're needed. The static channels are there right away, but
+ * the remote's own channels only show up once it's booted. This can't
+ * be combined with fw_layout (which boots the remote up front).
+ */
+static bool lazy_boot;
+module_param(lazy_boot, bool, S_IRUGO);
+MODULE_PARM_DESC(lazy_boot, "Boot the remote processors on their first use");
+
+/*
+ * The remote processor can be pinged periodically with mailbox-level echo
+ * requests, which gives a cheap latency baseline (exposed in debugfs,
+ * along with the min/avg/max round-trip), and a liveness check: if
+ * echo_max_misses periods pass without a reply, the remote processor is
+ * considered dead, and it's recovered just as if it reported a crash.
+ * A suspended remote processor isn't pinged. 0 disables pinging.
  */
-static void omap_rpmsg_get(struct virtio_device *vdev, unsigned int request,
-		   void *buf, unsigned len)
+static unsigned int echo_ms;
+module_param(echo_ms, uint, S_IRUGO);
+MODULE_PARM_DESC(echo_ms, "Echo (liveness check) period, in msecs (0 = off)");
+
+static unsigned int echo_max_misses = 3;
+module_param(echo_max_misses, uint, S_IRUGO);
+MODULE_PARM_DESC(echo_max_misses, "Missed echo periods before recovering");
+
+static struct dentry *omap_rpmsg_dbg;
+
+/* the carveout memory, from which every vproc allocates its IPC memory */
+static struct gen_pool *omap_rpmsg_pool;
+
+/* make a cacheable buffer range visible to the remote processor */
+static void omap_rpmsg_sync_for_device(struct virtio_device *vdev, void *va,
+			phys_addr_t pa, size_t len, enum dma_data_direction dir)
 {
-	struct omap_rpmsg_vproc *vproc = to_omap_vproc(vdev);
-	int tmp;
+	dmac_map_area(va, len, dir);
 
-	switch (request) {
-	case VPROC_BUF_ADDR:
-		BUG_ON(len != sizeof(vproc->buf_mapped));
-		memcpy(buf, &vproc->buf_mapped, len);
-		break;
-	case VPROC_BUF_PADDR:
-		BUG_ON(len != sizeof(vproc->buf_paddr));
-		memcpy(buf, &vproc->buf_paddr, len);
-		break;
-	case VPROC_BUF_NUM:
-		BUG_ON(len != sizeof(tmp));
-		tmp = RPMSG_NUM_BUFS;
-		memcpy(buf, &tmp, len);
-		break;
-	case VPROC_BUF_SZ:
-		BUG_ON(len != sizeof(tmp));
-		tmp = RPMSG_BUF_SIZE;
-		memcpy(buf, &tmp, len);
-		break;
-	case VPROC_STATIC_CHANNELS:
-		BUG_ON(len != sizeof(vproc->static_chnls));
-		memcpy(buf, &vproc->static_chnls, len);
-		break;
-	default:
-		dev_err(&vdev->dev, "invalid request: %d\n", request);
+	if (dir == DMA_FROM_DEVICE)
+		outer_inv_range(pa, pa + len);
+	else
+		outer_clean_range(pa, pa + len);
+}
+
+/* drop stale cache lines of a buffer range the remote processor wrote */
+static void omap_rpmsg_sync_for_cpu(struct virtio_device *vdev, void *va,
+			phys_addr_t pa, size_t len, enum dma_data_direction dir)
+{
+	if (dir != DMA_TO_DEVICE) {
+		outer_inv_range(pa, pa + len);
+		dmac_unmap_area(va, len, dir);
 	}
 }
 
+static const struct rpmsg_cache_ops omap_rpmsg_cache_ops = {
+	.sync_for_device	= omap_rpmsg_sync_for_device,
+	.sync_for_cpu		= omap_rpmsg_sync_for_cpu,
+};
+
+/* ioremap'ing normal memory, so we cast away sparse's complaints */
+static void *omap_rpmsg_map_cached(struct rpmsg_host_vproc *hvp,
+					unsigned long pa, size_t size)
+{
+	return (__force void *) ioremap_cached(pa, size);
+}
+
+/* the carveout, with the IPC buffers mapped cacheable */
+static const struct rpmsg_host_mem_ops omap_rpmsg_cached_mem_ops = {
+	.alloc		= rpmsg_host_pool_alloc,
+	.free		= rpmsg_host_pool_free,
+	.map_bufs	= omap_rpmsg_map_cached,
+};
+
 /* kick the remote processor, and let it know which virtqueue to poke at */
-static void omap_rpmsg_notify(struct virtqueue *vq)
+static void omap_rpmsg_kick(struct rpmsg_host_vproc *hvp, int index,
+								int vq_id)
 {
-	struct omap_rpmsg_vq_info *rpvq = vq->priv;
+	struct omap_rpmsg_vproc *vproc = to_omap_vproc(hvp);
 	int ret;
 
-	pr_debug("sending mailbox msg: %d\n", rpvq->vq_id);
-	/* send the index of the triggered virtqueue in the mailbox payload */
-	ret = omap_mbox_msg_send(rpvq->vproc->mbox, rpvq->vq_id);
+	if (vproc->db) {
+		/* order the vring update before peeking at the doorbell */
+		mb();
+
+		/* the remote hasn't handled our last kick of this vq yet */
+		if (ACCESS_ONCE(vproc->db->to_remote[index]))
+			return;
+
+		ACCESS_ONCE(vproc->db->to_remote[index]) = 1;
+		wmb();
+
+		ret = omap_mbox_msg_send(vproc->mbox, RP_MBOX_DOORBELL);
+		if (ret)
+			pr_err("ugh, omap_mbox_msg_send() failed: %d\n", ret);
+		return;
+	}
+
+	pr_debug("sending mailbox msg: %d\n", vq_id);
+	/*
+	 * send the index of the triggered virtqueue in the mailbox payload.
+	 * it's a doorbell, so it's coalesced with a kick of the same vq that
+	 * is still waiting for room in the mailbox fifo.
+	 */
+	ret = omap_mbox_doorbell_send(vproc->mbox, vq_id);
 	if (ret)
-		pr_err("ugh, omap_mbox_msg_send() failed: %d\n", ret);
+		pr_err("ugh, omap_mbox_doorbell_send() failed: %d\n", ret);
 }
 
+/* translate a unique vq id to the index of the vq in its vproc */
+static int omap_rpmsg_vq_index(struct rpmsg_host_vproc *hvp, u32 vq_id)
+{
+	/* the high priority vqs follow the normal ones in hvp->vq */
+	if (hvp->num_of_vqs > 2 && vq_id >= hvp->prio_base_vq_id &&
+					vq_id < hvp->prio_base_vq_id + 2)
+		return vq_id - hvp->prio_base_vq_id + 2;
+
+	if (vq_id >= hvp->base_vq_id && vq_id < hvp->base_vq_id + 2)
+		return vq_id - hvp->base_vq_id;
+
+	return -1;
+}
+
+/* process every vq the remote processor raised the doorbell of */
+static void omap_rpmsg_ring_doorbells(struct omap_rpmsg_vproc *vproc)
+{
+	int i;
+
+	for (i = 0; i < vproc->hvp.num_of_vqs; i++) {
+		if (!ACCESS_ONCE(vproc->db->to_host[i]))
+			continue;
+
+		/* clear the flag first, so a kick raised meanwhile isn't lost */
+		ACCESS_ONCE(vproc->db->to_host[i]) = 0;
+		mb();
+
+		rpmsg_host_vq_interrupt(&vproc->hvp, i);
+	}
+}
+
+static void omap_rpmsg_remote_crashed(struct omap_rpmsg_vproc *vproc);
+
+/* account the reply to the pending echo request, if any */
+static void omap_rpmsg_echo_reply(struct omap_rpmsg_vproc *vproc)
+{
+	unsigned long flags;
+	s64 rtt;
+
+	spin_lock_irqsave(&vproc->echo_lock, flags);
+
+	/* the sanity ping of omap_rpmsg_start(), or another vproc's */
+	if (!vproc->echo_sent.tv64) {
+		spin_unlock_irqrestore(&vproc->echo_lock, flags);
+		pr_info("received echo reply from %s !\n",
+						vproc->hvp.rproc_name);
+		return;
+	}
+
+	rtt = ktime_us_delta(ktime_get(), vproc->echo_sent);
+	vproc->echo_sent.tv64 = 0;
+	vproc->echo_misses = 0;
+
+	if (!vproc->echo_replies++ || rtt < vproc->echo_min)
+		vproc->echo_min = rtt;
+	if (rtt > vproc->echo_max)
+		vproc->echo_max = rtt;
+	vproc->echo_sum += rtt;
+
+	spin_unlock_irqrestore(&vproc->echo_lock, flags);
+}
+
+/* ping the remote processor, unless it didn't answer the last ping yet */
+static void omap_rpmsg_echo_work(struct work_struct *work)
+{
+	struct omap_rpmsg_vproc *vproc = container_of(to_delayed_work(work),
+					struct omap_rpmsg_vproc, echo_work);
+	struct rproc *rproc = vproc->hvp.rproc;
+	unsigned long flags;
+	bool pending;
+	int ret;
+
+	spin_lock_irqsave(&vproc->echo_lock, flags);
+
+	/*
+	 * a suspended remote processor won't answer until it's woken up,
+	 * and one that is booted lazily won't until it's first needed
+	 */
+	if (!rproc || ACCESS_ONCE(rproc->state) == RPROC_SUSPENDED) {
+		vproc->echo_sent.tv64 = 0;
+		vproc->echo_misses = 0;
+		spin_unlock_irqrestore(&vproc->echo_lock, flags);
+		goto out;
+	}
+
+	pending = vproc->echo_sent.tv64;
+	if (pending && ++vproc->echo_misses >= echo_max_misses) {
+		spin_unlock_irqrestore(&vproc->echo_lock, flags);
+		pr_err("%s stopped answering echo requests\n",
+						vproc->hvp.rproc_name);
+		/* the recovery restarts the pings, once it's back */
+		omap_rpmsg_remote_crashed(vproc);
+		return;
+	}
+
+	if (!pending) {
+		vproc->echo_sent = ktime_get();
+		vproc->echo_pings++;
+	}
+
+	spin_unlock_irqrestore(&vproc->echo_lock, flags);
+
+	if (!pending) {
+		ret = omap_mbox_msg_send(vproc->mbox, RP_MBOX_ECHO_REQUEST);
+		if (ret)
+			pr_err("ugh, omap_mbox_msg_send() failed: %d\n", ret);
+	}
+
+out:
+	schedule_delayed_work(&vproc->echo_work, msecs_to_jiffies(echo_ms));
+}
+
+/* the echo statistics are exposed via debugfs */
+static int omap_rpmsg_echo_show(struct seq_file *s, void *unused)
+{
+	struct omap_rpmsg_vproc *vproc = s->private;
+	unsigned long pings, replies;
+	s64 min, max, sum;
+
+	spin_lock_irq(&vproc->echo_lock);
+	pings = vproc->echo_pings;
+	replies = vproc->echo_replies;
+	min = vproc->echo_min;
+	max = vproc->echo_max;
+	sum = vproc->echo_sum;
+	spin_unlock_irq(&vproc->echo_lock);
+
+	seq_printf(s, "echo requests:     %lu\n", pings);
+	seq_printf(s, "echo replies:      %lu\n", replies);
+	seq_printf(s, "rtt min (usecs):   %lld\n", (long long) min);
+	seq_printf(s, "rtt avg (usecs):   %lld\n",
+			(long long) (replies ? div_s64(sum, replies) : 0));
+	seq_printf(s, "rtt max (usecs):   %lld\n", (long long) max);
+
+	return 0;
+}
+
+static int omap_rpmsg_echo_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, omap_rpmsg_echo_show, inode->i_private);
+}
+
+static const struct file_operations omap_rpmsg_echo_ops = {
+	.open = omap_rpmsg_echo_open,
+	.read = seq_read,
+	.llseek	= seq_lseek,
+	.release = single_release,
+};
+
 /**
  * omap_rpmsg_mbox_callback() - inbound mailbox message handler
  * @this: notifier block
@@ -176,15 +463,13 @@ static void omap_rpmsg_notify(struct virtqueue *vq)
  * @data: mailbox payload
  *
  * This handler is invoked by omap's mailbox driver whenever a mailbox
- * message is received. Usually, the mailbox payload simply contains
- * the index of the virtqueue that is kicked by the remote processor,
- * and we let virtio handle it.
+ * message is received, which isn't the index of one of our virtqueues
+ * (those are dispatched directly to omap_rpmsg_vq_interrupt()).
  *
- * In addition to virtqueue indices, we also have some out-of-band values
- * that indicates different events. Those values are deliberately very
- * big so they don't coincide with virtqueue indices. Moreover,
- * they are rarely used, if used at all, and their necessity should
- * be revisited.
+ * These are out-of-band values that indicate different events. Those
+ * values are deliberately very big so they don't coincide with virtqueue
+ * indices. Moreover, they are rarely used, if used at all, and their
+ * necessity should be revisited.
  */
 static int omap_rpmsg_mbox_callback(struct notifier_block *this,
 					unsigned long index, void *data)
@@ -198,11 +483,15 @@ static int omap_rpmsg_mbox_callback(struct notifier_block *this,
 
 	switch (msg) {
 	case RP_MBOX_CRASH:
-		pr_err("%s has just crashed !\n", vproc->rproc_name);
-		/* todo: smarter error handling here */
+		pr_err("%s has just crashed !\n", vproc->hvp.rproc_name);
+		rpmsg_host_crashed(&vproc->hvp);
 		break;
 	case RP_MBOX_ECHO_REPLY:
-		pr_info("received echo reply from %s !\n", vproc->rproc_name);
+		omap_rpmsg_echo_reply(vproc);
+		break;
+	case RP_MBOX_DOORBELL:
+		if (vproc->db)
+			omap_rpmsg_ring_doorbells(vproc);
 		break;
 	case RP_MBOX_PENDING_MSG:
 		/*
@@ -210,146 +499,93 @@ static int omap_rpmsg_mbox_callback(struct notifier_block *this,
 		 * Let's pretend the message explicitly contained the rx vring
 		 * index number and handle it generically.
 		 */
-		msg = vproc->base_vq_id;
-		/* intentional fall-through */
+		rpmsg_host_vq_interrupt(&vproc->hvp, 0);
+		break;
 	default:
 		/* ignore vq indices which are clearly not for us */
-		if (msg < vproc->base_vq_id)
-			break;
-
-		msg -= vproc->base_vq_id;
-
-		/*
-		 * Currently both PENDING_MSG and explicit-virtqueue-index
-		 * messaging are supported.
-		 * Whatever approach is taken, at this point 'msg' contains
-		 * the index of the vring which was just triggered.
-		 */
-		if (msg < vproc->num_of_vqs)
-			vring_interrupt(msg, vproc->vq[msg]);
+		rpmsg_host_vq_interrupt(&vproc->hvp,
+				omap_rpmsg_vq_index(&vproc->hvp, msg));
 	}
 
 	return NOTIFY_DONE;
 }
 
-/* prepare a virtqueue */
-static struct virtqueue *rp_find_vq(struct virtio_device *vdev,
-				    unsigned index,
-				    void (*callback)(struct virtqueue *vq),
-				    const char *name)
+/* a virtqueue was kicked: dispatched directly by the mailbox layer */
+static void omap_rpmsg_vq_interrupt(mbox_msg_t msg, void *priv)
 {
-	struct omap_rpmsg_vproc *vproc = to_omap_vproc(vdev);
-	struct omap_rpmsg_vq_info *rpvq;
-	struct virtqueue *vq;
-	int err;
-
-	rpvq = kmalloc(sizeof(*rpvq), GFP_KERNEL);
-	if (!rpvq)
-		return ERR_PTR(-ENOMEM);
-
-	/* ioremap'ing normal memory, so we cast away sparse's complaints */
-	rpvq->addr = (__force void *) ioremap_nocache(vproc->vring[index],
-							RPMSG_RING_SIZE);
-	if (!rpvq->addr) {
-		err = -ENOMEM;
-		goto free_rpvq;
-	}
-
-	memset(rpvq->addr, 0, RPMSG_RING_SIZE);
+	struct rpmsg_host_vproc *hvp = priv;
 
-	pr_debug("vring%d: phys 0x%x, virt 0x%x\n", index, vproc->vring[index],
-					(unsigned int) rpvq->addr);
-
-	vq = vring_new_virtqueue(RPMSG_NUM_BUFS / 2, RPMSG_VRING_ALIGN, vdev,
-				rpvq->addr, omap_rpmsg_notify, callback, name);
-	if (!vq) {
-		pr_err("vring_new_virtqueue failed\n");
-		err = -ENOMEM;
-		goto unmap_vring;
-	}
-
-	vproc->vq[index] = vq;
-	vq->priv = rpvq;
-	/* unique id for this virtqueue */
-	rpvq->vq_id = vproc->base_vq_id + index;
-	rpvq->vproc = vproc;
-
-	return vq;
-
-unmap_vring:
-	/* iounmap normal memory, so make sparse happy */
-	iounmap((__force void __iomem *) rpvq->addr);
-free_rpvq:
-	kfree(rpvq);
-	return ERR_PTR(err);
+	rpmsg_host_vq_interrupt(hvp, omap_rpmsg_vq_index(hvp, msg));
 }
 
-static void omap_rpmsg_del_vqs(struct virtio_device *vdev)
+static void omap_rpmsg_stop(struct rpmsg_host_vproc *hvp)
 {
-	struct virtqueue *vq, *n;
-	struct omap_rpmsg_vproc *vproc = to_omap_vproc(vdev);
+	struct omap_rpmsg_vproc *vproc = to_omap_vproc(hvp);
+	int i;
 
-	if (vproc->rproc)
-		rproc_put(vproc->rproc);
+	if (vproc->watchdog && echo_ms)
+		cancel_delayed_work_sync(&vproc->echo_work);
 
-	if (vproc->mbox)
-		omap_mbox_put(vproc->mbox, &vproc->nb);
+	if (vproc->mbox) {
+		for (i = 0; i < vproc->dispatched; i++)
+			omap_mbox_unregister_handler(vproc->mbox, i < 2 ?
+					hvp->base_vq_id + i :
+					hvp->prio_base_vq_id + i - 2);
+		vproc->dispatched = 0;
 
-	if (vproc->buf_mapped)
-		/* iounmap normal memory, so make sparse happy */
-		iounmap((__force void __iomem *)vproc->buf_mapped);
+		omap_mbox_put(vproc->mbox, &vproc->nb);
+		vproc->mbox = NULL;
+	}
 
-	list_for_each_entry_safe(vq, n, &vdev->vqs, list) {
-		struct omap_rpmsg_vq_info *rpvq = vq->priv;
-		vring_del_virtqueue(vq);
-		/* iounmap normal memory, so make sparse happy */
-		iounmap((__force void __iomem *) rpvq->addr);
-		kfree(rpvq);
+	if (vproc->db) {
+		iounmap((__force void __iomem *)vproc->db);
+		vproc->db = NULL;
 	}
 }
 
-static int omap_rpmsg_find_vqs(struct virtio_device *vdev, unsigned nvqs,
-		       struct virtqueue *vqs[],
-		       vq_callback_t *callbacks[],
-		       const char *names[])
+static int omap_rpmsg_start(struct rpmsg_host_vproc *hvp)
 {
-	struct omap_rpmsg_vproc *vproc = to_omap_vproc(vdev);
+	struct omap_rpmsg_vproc *vproc = to_omap_vproc(hvp);
 	int i, err;
 
-	/* we maintain two virtqueues per remote processor (for RX and TX) */
-	if (nvqs != 2)
-		return -EINVAL;
-
-	for (i = 0; i < nvqs; ++i) {
-		vqs[i] = rp_find_vq(vdev, i, callbacks[i], names[i]);
-		if (IS_ERR(vqs[i])) {
-			err = PTR_ERR(vqs[i]);
-			goto error;
+	if (doorbells) {
+		/* normal memory again, so cast away sparse's complaints */
+		vproc->db = (__force void *) ioremap_nocache(hvp->extra_paddr,
+								PAGE_SIZE);
+		if (!vproc->db) {
+			pr_err("ioremap of the doorbell page failed\n");
+			return -ENOMEM;
 		}
+		memset(vproc->db, 0, sizeof(*vproc->db));
 	}
 
-	vproc->num_of_vqs = nvqs;
-
-	/* ioremap'ing normal memory, so we cast away sparse's complaints */
-	vproc->buf_mapped = (__force void *) ioremap_nocache(vproc->buf_paddr,
-							vproc->buf_size);
-	if (!vproc->buf_mapped) {
-		pr_err("ioremap failed\n");
-		err = -ENOMEM;
-		goto error;
-	}
-
-	/* for now, use mailbox's notifiers. later that can be optimized */
+	/* the notifier only sees the out-of-band messages */
 	vproc->nb.notifier_call = omap_rpmsg_mbox_callback;
 	vproc->mbox = omap_mbox_get(vproc->mbox_name, &vproc->nb);
 	if (IS_ERR(vproc->mbox)) {
 		pr_err("failed to get mailbox %s\n", vproc->mbox_name);
+		vproc->mbox = NULL;
 		err = -EINVAL;
 		goto error;
 	}
 
-	pr_debug("buf: phys 0x%x, virt 0x%x\n", vproc->buf_paddr,
-					(unsigned int) vproc->buf_mapped);
+	/*
+	 * kicks of our vqs are dispatched straight to them by the mailbox,
+	 * so their cost doesn't depend on how many vprocs share it
+	 */
+	for (i = 0; i < hvp->num_of_vqs; i++) {
+		int vq_id = i < 2 ? hvp->base_vq_id + i :
+					hvp->prio_base_vq_id + i - 2;
+
+		err = omap_mbox_register_handler(vproc->mbox, vq_id,
+						omap_rpmsg_vq_interrupt, hvp);
+		if (err) {
+			pr_err("can't register handler for vq %d: %d\n",
+								vq_id, err);
+			goto error;
+		}
+		vproc->dispatched++;
+	}
 
 	/* tell the M3 we're ready (so M3 will know we're sane) */
 	err = omap_mbox_msg_send(vproc->mbox, RP_MBOX_READY);
@@ -359,7 +595,7 @@ static int omap_rpmsg_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 	}
 
 	/* send it the physical address of the vrings + IPC buffer */
-	err = omap_mbox_msg_send(vproc->mbox, (mbox_msg_t) vproc->buf_paddr);
+	err = omap_mbox_msg_send(vproc->mbox, (mbox_msg_t) hvp->buf_paddr);
 	if (err) {
 		pr_err("ugh, omap_mbox_msg_send() failed: %d\n", err);
 		goto error;
@@ -373,67 +609,27 @@ static int omap_rpmsg_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 		goto error;
 	}
 
-	/* now load the firmware, and boot the M3 */
-	vproc->rproc = rproc_get(vproc->rproc_name);
-	if (!vproc->rproc) {
-		pr_err("failed to get rproc %s\n", vproc->rproc_name);
-		err = -EINVAL;
-		goto error;
+	/* give the remote processor a period to boot before the first ping */
+	if (vproc->watchdog && echo_ms) {
+		spin_lock_irq(&vproc->echo_lock);
+		vproc->echo_sent.tv64 = 0;
+		vproc->echo_misses = 0;
+		spin_unlock_irq(&vproc->echo_lock);
+		schedule_delayed_work(&vproc->echo_work,
+					msecs_to_jiffies(echo_ms));
 	}
 
 	return 0;
 
 error:
-	omap_rpmsg_del_vqs(vdev);
+	omap_rpmsg_stop(hvp);
 	return err;
 }
 
-/*
- * should be nice to add firmware support for these handlers.
- * for now provide them so virtio doesn't crash
- */
-static u8 omap_rpmsg_get_status(struct virtio_device *vdev)
-{
-	return 0;
-}
-
-static void omap_rpmsg_set_status(struct virtio_device *vdev, u8 status)
-{
-	dev_dbg(&vdev->dev, "new status: %d\n", status);
-}
-
-static void omap_rpmsg_reset(struct virtio_device *vdev)
-{
-	dev_dbg(&vdev->dev, "reset !\n");
-}
-
-static u32 omap_rpmsg_get_features(struct virtio_device *vdev)
-{
-	/* for now, use hardcoded bitmap. later this should be provided
-	 * by the firmware itself */
-	return (1 << VIRTIO_RPMSG_F_NS);
-}
-
-static void omap_rpmsg_finalize_features(struct virtio_device *vdev)
-{
-	/* Give virtio_ring a chance to accept features */
-	vring_transport_features(vdev);
-}
-
-static void omap_rpmsg_vproc_release(struct device *dev)
-{
-	/* this handler is provided so driver core doesn't yell at us */
-}
-
-static struct virtio_config_ops omap_rpmsg_config_ops = {
-	.get_features	= omap_rpmsg_get_features,
-	.finalize_features = omap_rpmsg_finalize_features,
-	.get		= omap_rpmsg_get,
-	.find_vqs	= omap_rpmsg_find_vqs,
-	.del_vqs	= omap_rpmsg_del_vqs,
-	.reset		= omap_rpmsg_reset,
-	.set_status	= omap_rpmsg_set_status,
-	.get_status	= omap_rpmsg_get_status,
+static const struct rpmsg_host_ops omap_rpmsg_host_ops = {
+	.start	= omap_rpmsg_start,
+	.stop	= omap_rpmsg_stop,
+	.kick	= omap_rpmsg_kick,
 };
 
 /*
@@ -457,29 +653,42 @@ static struct rpmsg_channel_info omap_ipuc1_static_chnls[] = {
 static struct omap_rpmsg_vproc omap_rpmsg_vprocs[] = {
 	/* ipu_c0's rpmsg backend */
 	{
-		.vdev.id.device	= VIRTIO_ID_RPMSG,
-		.vdev.config	= &omap_rpmsg_config_ops,
 		.mbox_name	= "mailbox-1",
-		.rproc_name	= "ipu",
-		/* core 0 is using indices 0 + 1 for its vqs */
-		.base_vq_id	= 0,
-		.static_chnls = omap_ipuc0_static_chnls,
+		.hvp.rproc_name	= "ipu",
+		.hvp.name	= "ipu_c0",
+		/* core 0 is using indices 0 + 1 for its vqs (4 + 5 for prio) */
+		.hvp.base_vq_id	= 0,
+		.hvp.prio_base_vq_id = 4,
+		.hvp.static_chnls = omap_ipuc0_static_chnls,
+		/* both cores share the mailbox, so only this one pings */
+		.watchdog	= true,
 	},
 	/* ipu_c1's rpmsg backend */
 	{
-		.vdev.id.device	= VIRTIO_ID_RPMSG,
-		.vdev.config	= &omap_rpmsg_config_ops,
 		.mbox_name	= "mailbox-1",
-		.rproc_name	= "ipu",
-		/* core 1 is using indices 2 + 3 for its vqs */
-		.base_vq_id	= 2,
-		.static_chnls = omap_ipuc1_static_chnls,
+		.hvp.rproc_name	= "ipu",
+		.hvp.name	= "ipu_c1",
+		/* core 1 is using indices 2 + 3 for its vqs (6 + 7 for prio) */
+		.hvp.base_vq_id	= 2,
+		.hvp.prio_base_vq_id = 6,
+		.hvp.static_chnls = omap_ipuc1_static_chnls,
 	},
 };
 
+/* the remote processor is gone, along with all of its cores (vprocs) */
+static void omap_rpmsg_remote_crashed(struct omap_rpmsg_vproc *vproc)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(omap_rpmsg_vprocs); i++)
+		if (!strcmp(omap_rpmsg_vprocs[i].mbox_name, vproc->mbox_name))
+			rpmsg_host_crashed(&omap_rpmsg_vprocs[i].hvp);
+}
+
 static int __init omap_rpmsg_ini(void)
 {
 	int i, ret = 0;
+
 	/*
 	 * This whole area generally needs some rework.
 	 * E.g, consider using dma_alloc_coherent for the IPC buffers and
@@ -488,38 +697,78 @@ static int __init omap_rpmsg_ini(void)
 	phys_addr_t paddr = omap_dsp_get_mempool_base();
 	phys_addr_t psize = omap_dsp_get_mempool_size();
 
+	/* the buffers config module params have room for every vproc */
+	BUILD_BUG_ON(ARRAY_SIZE(num_bufs) < ARRAY_SIZE(omap_rpmsg_vprocs));
+
 	/*
-	 * allocate carverout memory for the buffers and vring, and
-	 * then register the vproc virtio device
+	 * the vprocs only take what they need from the carveout, once their
+	 * layout is known (i.e. when their vqs are set up)
 	 */
-	for (i = 0; i < ARRAY_SIZE(omap_rpmsg_vprocs); i++) {
-		struct omap_rpmsg_vproc *vproc = &omap_rpmsg_vprocs[i];
-
-		if (psize < RPMSG_IPC_MEM) {
-			pr_err("out of carveout memory: %d (%d)\n", psize, i);
-			return -ENOMEM;
-		}
-
-		vproc->buf_paddr = paddr;
-		vproc->buf_size = RPMSG_BUFS_SPACE;
-		vproc->vring[0] = paddr + RPMSG_BUFS_SPACE;
-		vproc->vring[1] = paddr + RPMSG_BUFS_SPACE + RPMSG_RING_SIZE;
-
-		paddr += RPMSG_IPC_MEM;
-		psize -= RPMSG_IPC_MEM;
-
-		pr_debug("vproc%d: buf 0x%x, vring0 0x%x, vring1 0x%x\n", i,
-			vproc->buf_paddr, vproc->vring[0], vproc->vring[1]);
+	omap_rpmsg_pool = gen_pool_create(PAGE_SHIFT, -1);
+	if (!omap_rpmsg_pool)
+		return -ENOMEM;
+
+	ret = gen_pool_add(omap_rpmsg_pool, paddr, psize, -1);
+	if (ret) {
+		pr_err("can't add the carveout to the pool: %d\n", ret);
+		goto destroy_pool;
+	}
 
-		vproc->vdev.dev.release = omap_rpmsg_vproc_release;
+	if (echo_ms && debugfs_initialized()) {
+		omap_rpmsg_dbg = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (!omap_rpmsg_dbg)
+			pr_err("can't create debugfs dir\n");
+	}
 
-		ret = register_virtio_device(&vproc->vdev);
-		if (ret) {
-			pr_err("failed to register vproc: %d\n", ret);
-			break;
-		}
+	/* register the vproc virtio devices */
+	for (i = 0; i < ARRAY_SIZE(omap_rpmsg_vprocs); i++) {
+		struct omap_rpmsg_vproc *vproc = &omap_rpmsg_vprocs[i];
+		struct rpmsg_host_vproc *hvp = &vproc->hvp;
+
+		spin_lock_init(&vproc->echo_lock);
+		INIT_DELAYED_WORK(&vproc->echo_work, omap_rpmsg_echo_work);
+		if (vproc->watchdog && omap_rpmsg_dbg)
+			vproc->dbg_file = debugfs_create_file(hvp->name, 0400,
+					omap_rpmsg_dbg, vproc,
+					&omap_rpmsg_echo_ops);
+
+		hvp->ops = &omap_rpmsg_host_ops;
+		hvp->mem_ops = buf_cached ? &omap_rpmsg_cached_mem_ops :
+						&rpmsg_host_pool_mem_ops;
+		hvp->pool = omap_rpmsg_pool;
+		hvp->cache_ops = buf_cached ? &omap_rpmsg_cache_ops : NULL;
+		hvp->buf_wc = buf_wc;
+		hvp->fw_layout = fw_layout;
+		hvp->lazy_boot = lazy_boot;
+		hvp->extra_size = doorbells ? PAGE_SIZE : 0;
+		hvp->param_num_bufs = num_bufs[i] ?: RPMSG_HOST_NUM_BUFS;
+		hvp->param_buf_sz = buf_size[i] ?: RPMSG_HOST_BUF_SIZE;
+
+		/* for now, use hardcoded bitmap. later this should be provided
+		 * by the firmware itself */
+		hvp->features = 1U << VIRTIO_RPMSG_F_NS;
+		if (event_idx)
+			hvp->features |= 1U << VIRTIO_RING_F_EVENT_IDX;
+		if (packed_ring)
+			hvp->features |= 1U << VIRTIO_RING_F_PACKED;
+		if (in_order)
+			hvp->features |= 1U << VIRTIO_RING_F_IN_ORDER;
+		if (prio_vqs)
+			hvp->features |= 1U << VIRTIO_RPMSG_F_PRIO;
+
+		ret = rpmsg_host_register(hvp);
+		if (ret)
+			goto unregister;
 	}
 
+	return 0;
+
+unregister:
+	while (--i >= 0)
+		rpmsg_host_unregister(&omap_rpmsg_vprocs[i].hvp);
+	debugfs_remove_recursive(omap_rpmsg_dbg);
+destroy_pool:
+	gen_pool_destroy(omap_rpmsg_pool);
 	return ret;
 }
 module_init(omap_rpmsg_ini);
@@ -528,11 +777,11 @@ static void __exit omap_rpmsg_fini(void)
 {
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(omap_rpmsg_vprocs); i++) {
-		struct omap_rpmsg_vproc *vproc = &omap_rpmsg_vprocs[i];
+	for (i = 0; i < ARRAY_SIZE(omap_rpmsg_vprocs); i++)
+		rpmsg_host_unregister(&omap_rpmsg_vprocs[i].hvp);
 
-		unregister_virtio_device(&vproc->vdev);
-	}
+	debugfs_remove_recursive(omap_rpmsg_dbg);
+	gen_pool_destroy(omap_rpmsg_pool);
 }
 module_exit(omap_rpmsg_fini);
 
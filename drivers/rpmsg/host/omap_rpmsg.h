@@ -56,6 +56,9 @@
  *
  * @RP_MBOX_ABORT_REQUEST: a "please crash" request, used for testing the
  * recovery mechanism (to some extent).
+ *
+ * @RP_MBOX_DOORBELL: one or more virtqueues were kicked; their flags are
+ * raised in the shared doorbell page (only used in doorbell mode).
  */
 enum omap_rp_mbox_messages {
 	RP_MBOX_READY		= 0xFFFFFF00,
@@ -64,6 +67,23 @@ enum omap_rp_mbox_messages {
 	RP_MBOX_ECHO_REQUEST	= 0xFFFFFF03,
 	RP_MBOX_ECHO_REPLY	= 0xFFFFFF04,
 	RP_MBOX_ABORT_REQUEST	= 0xFFFFFF05,
+	RP_MBOX_DOORBELL	= 0xFFFFFF06,
+};
+
+/*
+ * struct omap_rpmsg_doorbells - the shared doorbell page of a vproc
+ *
+ * It directly follows the vrings of the vproc. Each side raises the flag
+ * of a (local) vq index in its own array, and sends RP_MBOX_DOORBELL only
+ * when the flag was clear. The receiving side clears a flag before it
+ * processes the vq, so a kick raised meanwhile is never lost.
+ *
+ * Flags are whole bytes rather than bits, because the two processors
+ * can't do atomic read-modify-write operations on this memory.
+ */
+struct omap_rpmsg_doorbells {
+	u8 to_remote[4];
+	u8 to_host[4];
 };
 
 #endif /* _OMAP_RPMSG_H */
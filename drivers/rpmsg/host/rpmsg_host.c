@@ -0,0 +1,802 @@
+/*
+ * Generic virtio-based remote processor messaging host
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * Ohad Ben-Cohen <ohad@wizery.com>
+ * Brian Swetland <swetland@google.com>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * This is everything a virtio rpmsg host does which isn't specific to the
+ * platform: setting up the vrings and the IPC buffers in memory that is
+ * shared with the remote processor, answering the configuration requests
+ * of the rpmsg bus, and booting the remote processor via remoteproc.
+ *
+ * The platform provides a notification backend (how to kick the remote
+ * processor, and where its kicks come from) and a provider of the IPC
+ * memory, so every SoC gets the same data path without copying it.
+ */
+
+#define pr_fmt(fmt) "%s: " fmt, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/virtio.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_ids.h>
+#include <linux/virtio_ring.h>
+#include <linux/rpmsg.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/genalloc.h>
+#include <linux/remoteproc.h>
+#include <linux/workqueue.h>
+#include <asm/io.h>
+
+#include <trace/events/rpmsg.h>
+
+#include "rpmsg_host.h"
+
+/**
+ * struct rpmsg_host_vq_info - virtqueue state
+ * @vq_id: a unique index of this virtqueue
+ * @index: index of this virtqueue in its vproc
+ * @addr: address where the vring is mapped onto
+ * @shared: @addr is in the remoteproc's mapping of its carveout
+ * @vproc: the virtual remote processor state
+ *
+ * Such a struct will be maintained for every virtqueue we're
+ * using to communicate with the remote processor
+ */
+struct rpmsg_host_vq_info {
+	__u16 vq_id;
+	__u16 index;
+	void *addr;
+	bool shared;
+	struct rpmsg_host_vproc *vproc;
+};
+
+#define RPMSG_HOST_MIN_NUM_BUFS	(4)
+#define RPMSG_HOST_MIN_BUF_SIZE	(64)
+
+/*
+ * The alignment between the consumer and producer parts of the vring.
+ * Note: this is part of the "wire" protocol. If you change this, you need
+ * to update your BIOS image as well
+ */
+#define RPMSG_VRING_ALIGN	(4096)
+
+
+unsigned long rpmsg_host_pool_alloc(struct rpmsg_host_vproc *vproc,
+								size_t size)
+{
+	return gen_pool_alloc(vproc->pool, size);
+}
+EXPORT_SYMBOL(rpmsg_host_pool_alloc);
+
+void rpmsg_host_pool_free(struct rpmsg_host_vproc *vproc, unsigned long pa,
+								size_t size)
+{
+	gen_pool_free(vproc->pool, pa, size);
+}
+EXPORT_SYMBOL(rpmsg_host_pool_free);
+
+const struct rpmsg_host_mem_ops rpmsg_host_pool_mem_ops = {
+	.alloc	= rpmsg_host_pool_alloc,
+	.free	= rpmsg_host_pool_free,
+};
+EXPORT_SYMBOL(rpmsg_host_pool_mem_ops);
+
+/*
+ * called before every kick, so it just peeks at the state of the rproc.
+ * a remote processor that is booted lazily is considered suspended until
+ * it's first needed, so the bus "resumes" it (i.e. boots it) just in time.
+ */
+static bool rpmsg_host_suspended(struct virtio_device *vdev)
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+	struct rproc *rproc = ACCESS_ONCE(vproc->rproc);
+
+	if (!rproc)
+		return vproc->lazy_boot;
+
+	return ACCESS_ONCE(rproc->state) == RPROC_SUSPENDED;
+}
+
+/* the bus doesn't resume concurrently, and it's over before del_vqs */
+static int rpmsg_host_resume(struct virtio_device *vdev)
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+	struct rproc *rproc;
+
+	if (vproc->rproc)
+		return rproc_resume(vproc->rproc);
+
+	/* the first use of a lazily booted remote processor */
+	rproc = rproc_get(vproc->rproc_name);
+	if (!rproc) {
+		pr_err("failed to get rproc %s\n", vproc->rproc_name);
+		return -ENODEV;
+	}
+
+	ACCESS_ONCE(vproc->rproc) = rproc;
+
+	return rproc_wait_for_boot(rproc);
+}
+
+static const struct rpmsg_pm_ops rpmsg_host_pm_ops = {
+	.suspended	= rpmsg_host_suspended,
+	.resume		= rpmsg_host_resume,
+};
+
+/*
+ * Provide rpmsg core with platform-specific configuration.
+ * Since user data is at stake here, bugs can't be tolerated. hence
+ * the BUG_ON approach on invalid lengths.
+ *
+ * For more info on these configuration requests, see enum
+ * rpmsg_platform_requests.
+ */
+static void rpmsg_host_get(struct virtio_device *vdev, unsigned int request,
+		   void *buf, unsigned len)
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+	int tmp;
+
+	switch (request) {
+	case VPROC_BUF_ADDR:
+		BUG_ON(len != sizeof(vproc->buf_mapped));
+		memcpy(buf, &vproc->buf_mapped, len);
+		break;
+	case VPROC_BUF_PADDR:
+		BUG_ON(len != sizeof(vproc->buf_paddr));
+		memcpy(buf, &vproc->buf_paddr, len);
+		break;
+	case VPROC_BUF_NUM:
+		BUG_ON(len != sizeof(tmp));
+		tmp = vproc->num_bufs;
+		memcpy(buf, &tmp, len);
+		break;
+	case VPROC_BUF_SZ:
+		BUG_ON(len != sizeof(tmp));
+		tmp = vproc->buf_sz;
+		memcpy(buf, &tmp, len);
+		break;
+	case VPROC_STATIC_CHANNELS:
+		BUG_ON(len != sizeof(vproc->static_chnls));
+		memcpy(buf, &vproc->static_chnls, len);
+		break;
+	case VPROC_BUF_CACHE_OPS:
+		BUG_ON(len != sizeof(const struct rpmsg_cache_ops *));
+		*(const struct rpmsg_cache_ops **) buf = vproc->cache_ops;
+		break;
+	case VPROC_MEM_MAPS:
+		BUG_ON(len != sizeof(const struct rproc_mem_entry *));
+		/* the remote processor might not be booted yet */
+		*(const struct rproc_mem_entry **) buf =
+				rproc_get_memory_maps(vproc->rproc_name);
+		break;
+	case VPROC_PM_OPS:
+		BUG_ON(len != sizeof(const struct rpmsg_pm_ops *));
+		*(const struct rpmsg_pm_ops **) buf = &rpmsg_host_pm_ops;
+		break;
+	case VPROC_CRASHED:
+		BUG_ON(len != sizeof(bool));
+		*(bool *) buf = vproc->crashed;
+		break;
+	default:
+		dev_err(&vdev->dev, "invalid request: %d\n", request);
+	}
+}
+
+/* kick the remote processor, and let it know which virtqueue to poke at */
+static void rpmsg_host_notify(struct virtqueue *vq)
+{
+	struct rpmsg_host_vq_info *rpvq = vq->priv;
+
+	trace_rpmsg_notify(vq, rpvq->vq_id);
+
+	/* the backend is down if the remote processor couldn't be recovered */
+	if (!rpvq->vproc->started)
+		return;
+
+	rpvq->vproc->ops->kick(rpvq->vproc, rpvq->index, rpvq->vq_id);
+}
+
+/**
+ * rpmsg_host_vq_interrupt() - the remote processor kicked a virtqueue
+ * @vproc: the virtual remote processor
+ * @index: index of the kicked virtqueue in @vproc
+ *
+ * Called by the notification backend whenever the remote processor
+ * notifies us, in any context vring_interrupt() may be called in.
+ * Out-of-range indices (e.g. of vqs that aren't set up yet) are ignored.
+ */
+void rpmsg_host_vq_interrupt(struct rpmsg_host_vproc *vproc, int index)
+{
+	if (index >= 0 && index < vproc->num_of_vqs)
+		vring_interrupt(index, vproc->vq[index]);
+}
+EXPORT_SYMBOL(rpmsg_host_vq_interrupt);
+
+/*
+ * IPC memory in one of the remote processor's carveouts is accessed through
+ * the remoteproc's (persistent) mapping of it, rather than mapped anew.
+ * That's only possible once the rproc handle is taken, i.e. with fw_layout.
+ */
+static void *rpmsg_host_rproc_va(struct rpmsg_host_vproc *vproc,
+					unsigned int pa, unsigned int size)
+{
+	if (!vproc->rproc)
+		return NULL;
+
+	return rproc_pa_to_va(vproc->rproc, pa, size);
+}
+
+/* prepare a virtqueue */
+static struct virtqueue *rp_find_vq(struct virtio_device *vdev,
+				    unsigned index,
+				    void (*callback)(struct virtqueue *vq),
+				    const char *name)
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+	struct rpmsg_host_vq_info *rpvq;
+	struct virtqueue *vq;
+	int err;
+
+	rpvq = kmalloc(sizeof(*rpvq), GFP_KERNEL);
+	if (!rpvq)
+		return ERR_PTR(-ENOMEM);
+
+	rpvq->addr = rpmsg_host_rproc_va(vproc, vproc->vring[index],
+							vproc->ring_size);
+	rpvq->shared = !!rpvq->addr;
+
+	/* ioremap'ing normal memory, so we cast away sparse's complaints */
+	if (!rpvq->addr)
+		rpvq->addr = (__force void *) ioremap_nocache(
+				vproc->vring[index], vproc->ring_size);
+	if (!rpvq->addr) {
+		err = -ENOMEM;
+		goto free_rpvq;
+	}
+
+	memset(rpvq->addr, 0, vproc->ring_size);
+
+	pr_debug("vring%d: phys 0x%x, virt 0x%x\n", index, vproc->vring[index],
+					(unsigned int) rpvq->addr);
+
+	vq = vring_new_virtqueue(vproc->vring_num, vproc->vring_align, vdev,
+				rpvq->addr, rpmsg_host_notify, callback, name);
+	if (!vq) {
+		pr_err("vring_new_virtqueue failed\n");
+		err = -ENOMEM;
+		goto unmap_vring;
+	}
+
+	vproc->vq[index] = vq;
+	vq->priv = rpvq;
+	/* unique id for this virtqueue */
+	if (index < 2)
+		rpvq->vq_id = vproc->base_vq_id + index;
+	else
+		rpvq->vq_id = vproc->prio_base_vq_id + index - 2;
+	rpvq->index = index;
+	rpvq->vproc = vproc;
+
+	return vq;
+
+unmap_vring:
+	/* iounmap normal memory, so make sparse happy */
+	if (!rpvq->shared)
+		iounmap((__force void __iomem *) rpvq->addr);
+free_rpvq:
+	kfree(rpvq);
+	return ERR_PTR(err);
+}
+
+static void rpmsg_host_del_vqs(struct virtio_device *vdev)
+{
+	struct virtqueue *vq, *n;
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+
+	if (vproc->rproc) {
+		rproc_put(vproc->rproc);
+		vproc->rproc = NULL;
+	}
+
+	if (vproc->started) {
+		vproc->ops->stop(vproc);
+		vproc->started = false;
+	}
+
+	vproc->crashed = false;
+
+	if (vproc->buf_mapped && !vproc->buf_shared)
+		/* iounmap normal memory, so make sparse happy */
+		iounmap((__force void __iomem *)vproc->buf_mapped);
+	vproc->buf_mapped = NULL;
+	vproc->buf_shared = false;
+
+	vproc->num_of_vqs = 0;
+
+	list_for_each_entry_safe(vq, n, &vdev->vqs, list) {
+		struct rpmsg_host_vq_info *rpvq = vq->priv;
+		vring_del_virtqueue(vq);
+		/* iounmap normal memory, so make sparse happy */
+		if (!rpvq->shared)
+			iounmap((__force void __iomem *) rpvq->addr);
+		kfree(rpvq);
+	}
+
+	if (vproc->ipc_mem) {
+		vproc->mem_ops->free(vproc, vproc->buf_paddr, vproc->ipc_mem);
+		vproc->ipc_mem = 0;
+	}
+}
+
+/**
+ * rpmsg_host_set_layout() - validate and apply a buffers config
+ * @vproc: the virtual remote processor
+ * @num_bufs: number of IPC buffers (rx + tx)
+ * @buf_sz: size of each IPC buffer
+ *
+ * Both must be powers of two: the vrings need a power of two number of
+ * entries, and the buffers must not straddle cache lines.
+ *
+ * Returns 0 on success, or -EINVAL if the config is invalid.
+ */
+int rpmsg_host_set_layout(struct rpmsg_host_vproc *vproc,
+				unsigned int num_bufs, unsigned int buf_sz)
+{
+	if (!is_power_of_2(num_bufs) || num_bufs < RPMSG_HOST_MIN_NUM_BUFS ||
+			!is_power_of_2(buf_sz) ||
+			buf_sz < RPMSG_HOST_MIN_BUF_SIZE) {
+		pr_err("invalid buffers config: %u x %u (%s)\n", num_bufs,
+							buf_sz, vproc->name);
+		return -EINVAL;
+	}
+
+	vproc->num_bufs = num_bufs;
+	vproc->buf_sz = buf_sz;
+	vproc->buf_size = PAGE_ALIGN(num_bufs * buf_sz);
+
+	/* every vring has an entry per buffer of its side, by default */
+	vproc->vring_num = num_bufs / 2;
+	vproc->vring_align = RPMSG_VRING_ALIGN;
+	vproc->ring_size = PAGE_ALIGN(vring_size(vproc->vring_num,
+							vproc->vring_align));
+
+	return 0;
+}
+EXPORT_SYMBOL(rpmsg_host_set_layout);
+
+/*
+ * apply the vrings config announced by the firmware, on top of the buffers
+ * config: the vrings need a power of two number of entries, which can't be
+ * less than the buffers of their side, and a power of two alignment.
+ */
+static int rpmsg_host_set_vrings(struct rpmsg_host_vproc *vproc,
+					unsigned int num, unsigned int align)
+{
+	if (!align)
+		align = RPMSG_VRING_ALIGN;
+
+	if (!is_power_of_2(num) || num < vproc->num_bufs / 2 ||
+			!is_power_of_2(align)) {
+		pr_err("invalid vrings config: %u entries, aligned %u (%s)\n",
+						num, align, vproc->name);
+		return -EINVAL;
+	}
+
+	vproc->vring_num = num;
+	vproc->vring_align = align;
+	vproc->ring_size = PAGE_ALIGN(vring_size(num, align));
+
+	return 0;
+}
+
+/*
+ * pick the buffers and vrings config (from the firmware, if it announced
+ * one, or else the defaults of the vproc), and allocate just enough IPC
+ * memory for it
+ */
+static int rpmsg_host_alloc_ipc(struct rpmsg_host_vproc *vproc, int nrings)
+{
+	struct rproc_ipc_cfg cfg = { .num_bufs = 0 };
+	u32 nbufs = vproc->param_num_bufs;
+	u32 bufsz = vproc->param_buf_sz;
+	unsigned int ipc_mem;
+	unsigned long paddr;
+	int j, err;
+
+	if (vproc->rproc && rproc_get_ipc_cfg(vproc->rproc, vproc->name, &cfg))
+		pr_warn("%s: firmware has no ipc layout, using %u x %u\n",
+						vproc->name, nbufs, bufsz);
+
+	/* with only vrings announced, fill them with buffers */
+	if (cfg.num_bufs)
+		nbufs = cfg.num_bufs;
+	else if (cfg.vring_num)
+		nbufs = 2 * cfg.vring_num;
+	if (cfg.buf_size)
+		bufsz = cfg.buf_size;
+
+	err = rpmsg_host_set_layout(vproc, nbufs, bufsz);
+	if (err)
+		return err;
+
+	if (cfg.vring_num) {
+		err = rpmsg_host_set_vrings(vproc, cfg.vring_num,
+							cfg.vring_align);
+		if (err)
+			return err;
+	}
+
+	/* the total IPC space needed to communicate with this vproc */
+	ipc_mem = vproc->buf_size + nrings * vproc->ring_size +
+					PAGE_ALIGN(vproc->extra_size);
+
+	paddr = vproc->mem_ops->alloc(vproc, ipc_mem);
+	if (!paddr) {
+		pr_err("out of IPC memory: %u (%s)\n", ipc_mem, vproc->name);
+		return -ENOMEM;
+	}
+
+	vproc->ipc_mem = ipc_mem;
+	vproc->buf_paddr = paddr;
+	for (j = 0; j < nrings; j++)
+		vproc->vring[j] = paddr + vproc->buf_size +
+						j * vproc->ring_size;
+	vproc->extra_paddr = paddr + vproc->buf_size +
+						nrings * vproc->ring_size;
+
+	pr_debug("%s: %u bufs of %u bytes, %u-entry vrings, buf 0x%x, "
+		"vring0 0x%x, vring1 0x%x\n", vproc->name, vproc->num_bufs,
+		vproc->buf_sz, vproc->vring_num, vproc->buf_paddr,
+		vproc->vring[0], vproc->vring[1]);
+
+	return 0;
+}
+
+static int rpmsg_host_find_vqs(struct virtio_device *vdev, unsigned nvqs,
+		       struct virtqueue *vqs[],
+		       vq_callback_t *callbacks[],
+		       const char *names[])
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+	bool prio = vproc->features & (1 << VIRTIO_RPMSG_F_PRIO);
+	int i, err;
+
+	/*
+	 * we maintain two virtqueues per remote processor (for RX and TX),
+	 * and two more for high priority traffic, if we offered those
+	 */
+	if (nvqs != 2 && !(nvqs == 4 && prio))
+		return -EINVAL;
+
+	/* the firmware has to be loaded to tell how big its buffers are */
+	if (vproc->fw_layout) {
+		vproc->rproc = rproc_get(vproc->rproc_name);
+		if (!vproc->rproc) {
+			pr_err("failed to get rproc %s\n", vproc->rproc_name);
+			return -EINVAL;
+		}
+	}
+
+	err = rpmsg_host_alloc_ipc(vproc, nvqs);
+	if (err)
+		goto error;
+
+	for (i = 0; i < nvqs; ++i) {
+		vqs[i] = rp_find_vq(vdev, i, callbacks[i], names[i]);
+		if (IS_ERR(vqs[i])) {
+			err = PTR_ERR(vqs[i]);
+			goto error;
+		}
+	}
+
+	vproc->num_of_vqs = nvqs;
+
+	/* ioremap'ing normal memory, so we cast away sparse's complaints */
+	if (vproc->mem_ops->map_bufs) {
+		vproc->buf_mapped = vproc->mem_ops->map_bufs(vproc,
+					vproc->buf_paddr, vproc->buf_size);
+	} else if (vproc->buf_wc) {
+		/* the remoteproc's carveout mapping is write-combined, too */
+		vproc->buf_mapped = rpmsg_host_rproc_va(vproc,
+					vproc->buf_paddr, vproc->buf_size);
+		vproc->buf_shared = !!vproc->buf_mapped;
+		if (!vproc->buf_mapped)
+			vproc->buf_mapped = (__force void *) ioremap_wc(
+					vproc->buf_paddr, vproc->buf_size);
+	} else {
+		vproc->buf_mapped = (__force void *) ioremap_nocache(
+					vproc->buf_paddr, vproc->buf_size);
+	}
+	if (!vproc->buf_mapped) {
+		pr_err("ioremap failed\n");
+		err = -ENOMEM;
+		goto error;
+	}
+
+	pr_debug("buf: phys 0x%x, virt 0x%x\n", vproc->buf_paddr,
+					(unsigned int) vproc->buf_mapped);
+
+	/* hook up the notifications, and tell the remote where it all is */
+	err = vproc->ops->start(vproc);
+	if (err)
+		goto error;
+	vproc->started = true;
+
+	/*
+	 * now load the firmware, and boot the remote (unless we already did,
+	 * or it's booted on its first use)
+	 */
+	if (!vproc->rproc && !vproc->lazy_boot) {
+		vproc->rproc = rproc_get(vproc->rproc_name);
+		if (!vproc->rproc) {
+			pr_err("failed to get rproc %s\n", vproc->rproc_name);
+			err = -EINVAL;
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	rpmsg_host_del_vqs(vdev);
+	return err;
+}
+
+/*
+ * should be nice to add firmware support for these handlers.
+ * for now provide them so virtio doesn't crash
+ */
+static u8 rpmsg_host_get_status(struct virtio_device *vdev)
+{
+	return 0;
+}
+
+/*
+ * when the rpmsg bus recovers from a crash of the remote processor (see
+ * VPROC_CRASHED), it resets us once it took back all of its buffers...
+ */
+static void rpmsg_host_reset(struct virtio_device *vdev)
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+	int i;
+
+	dev_dbg(&vdev->dev, "reset !\n");
+
+	if (!vproc->crashed)
+		return;
+
+	if (vproc->started) {
+		vproc->ops->stop(vproc);
+		vproc->started = false;
+	}
+
+	for (i = 0; i < vproc->num_of_vqs; i++)
+		vring_reset_virtqueue(vproc->vq[i]);
+}
+
+/* ...and lets us go again once the rx buffers are back in the vrings */
+static void rpmsg_host_set_status(struct virtio_device *vdev, u8 status)
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+	int err;
+
+	dev_dbg(&vdev->dev, "new status: %d\n", status);
+
+	if (!vproc->crashed || !(status & VIRTIO_CONFIG_S_DRIVER_OK))
+		return;
+
+	/* the IPC memory (and thus its layout) stays the same */
+	if (!vproc->started) {
+		err = vproc->ops->start(vproc);
+		if (err) {
+			dev_err(&vdev->dev, "can't restart the backend: %d\n",
+									err);
+			return;
+		}
+		vproc->started = true;
+	}
+
+	err = rproc_restart(vproc->rproc);
+	if (err) {
+		dev_err(&vdev->dev, "can't reboot %s: %d\n",
+						vproc->rproc_name, err);
+		return;
+	}
+
+	vproc->crashed = false;
+}
+
+/* hand a crash of the remote processor over to the rpmsg bus */
+static void rpmsg_host_crash_work(struct work_struct *work)
+{
+	struct rpmsg_host_vproc *vproc = container_of(work,
+				struct rpmsg_host_vproc, crash_work);
+	struct device *dev = &vproc->vdev.dev;
+	struct virtio_driver *drv;
+
+	/* the bus can't come and go while it recovers */
+	device_lock(dev);
+
+	/* if the bus isn't up, there's nothing to recover (yet) */
+	if (!dev->driver || !vproc->rproc)
+		goto unlock;
+
+	vproc->crashed = true;
+	rproc_report_crash(vproc->rproc);
+
+	drv = container_of(dev->driver, struct virtio_driver, driver);
+	if (drv->config_changed)
+		drv->config_changed(&vproc->vdev);
+
+	if (vproc->crashed)
+		dev_err(dev, "%s wasn't recovered\n", vproc->rproc_name);
+
+unlock:
+	device_unlock(dev);
+}
+
+/**
+ * rpmsg_host_crashed() - report a crash of the remote processor
+ * @vproc: the virtual remote processor
+ *
+ * Called by the notification backend when it learns that the remote
+ * processor crashed. The rpmsg bus then takes back all of its buffers,
+ * the vrings are reset in place, and the remote processor is rebooted,
+ * while the rpmsg channels (and the handles their users hold) are kept.
+ *
+ * May be called in any context; the recovery happens in process context.
+ */
+void rpmsg_host_crashed(struct rpmsg_host_vproc *vproc)
+{
+	schedule_work(&vproc->crash_work);
+}
+EXPORT_SYMBOL(rpmsg_host_crashed);
+
+static u32 rpmsg_host_get_features(struct virtio_device *vdev)
+{
+	struct rpmsg_host_vproc *vproc = to_rpmsg_host_vproc(vdev);
+
+	/* for now, the backend decides. later this should be provided
+	 * by the firmware itself */
+	return vproc->features;
+}
+
+static void rpmsg_host_finalize_features(struct virtio_device *vdev)
+{
+	/* Give virtio_ring a chance to accept features */
+	vring_transport_features(vdev);
+}
+
+static void rpmsg_host_vproc_release(struct device *dev)
+{
+	/* this handler is provided so driver core doesn't yell at us */
+}
+
+static struct virtio_config_ops rpmsg_host_config_ops = {
+	.get_features	= rpmsg_host_get_features,
+	.finalize_features = rpmsg_host_finalize_features,
+	.get		= rpmsg_host_get,
+	.find_vqs	= rpmsg_host_find_vqs,
+	.del_vqs	= rpmsg_host_del_vqs,
+	.reset		= rpmsg_host_reset,
+	.set_status	= rpmsg_host_set_status,
+	.get_status	= rpmsg_host_get_status,
+};
+
+/*
+ * The rpmsg bus of a vproc that takes its layout from the firmware can only
+ * come up once the firmware is loaded, so its virtio device is registered
+ * from here, once the remote processor has booted, rather than blocking
+ * rpmsg_host_register() (and whoever calls it at init) meanwhile.
+ */
+static void rpmsg_host_register_work(struct work_struct *work)
+{
+	struct rpmsg_host_vproc *vproc = container_of(work,
+				struct rpmsg_host_vproc, register_work);
+	int ret;
+
+	ret = rproc_wait_for_boot(vproc->boot_rproc);
+	if (ret)
+		pr_warn("%s didn't boot; registering %s anyway\n",
+					vproc->rproc_name, vproc->name);
+
+	ret = register_virtio_device(&vproc->vdev);
+	if (ret)
+		pr_err("failed to register vproc %s: %d\n", vproc->name, ret);
+	else
+		vproc->registered = true;
+
+	/* the bus holds its own reference now (if it's probed) */
+	rproc_put(vproc->boot_rproc);
+	vproc->boot_rproc = NULL;
+}
+
+/**
+ * rpmsg_host_register() - register a virtual remote processor
+ * @vproc: the virtual remote processor, set up by its backend
+ *
+ * The buffers config defaults of @vproc are validated right away, even
+ * if the firmware may later override them, so bad configs surface early.
+ *
+ * If @vproc takes its layout from the firmware, its remote processor is
+ * booted right away, and the rpmsg bus is only set up once it's up. This
+ * doesn't wait, so several remote processors can boot at the same time.
+ *
+ * Returns 0 on success, or an appropriate error code otherwise.
+ */
+int rpmsg_host_register(struct rpmsg_host_vproc *vproc)
+{
+	int ret;
+
+	if (!vproc->ops || !vproc->ops->start || !vproc->ops->stop ||
+			!vproc->ops->kick || !vproc->mem_ops)
+		return -EINVAL;
+
+	ret = rpmsg_host_set_layout(vproc, vproc->param_num_bufs,
+							vproc->param_buf_sz);
+	if (ret)
+		return ret;
+
+	vproc->vdev.id.device = VIRTIO_ID_RPMSG;
+	vproc->vdev.config = &rpmsg_host_config_ops;
+	vproc->vdev.dev.release = rpmsg_host_vproc_release;
+	INIT_WORK(&vproc->crash_work, rpmsg_host_crash_work);
+	INIT_WORK(&vproc->register_work, rpmsg_host_register_work);
+	vproc->registered = false;
+
+	/* if the rproc isn't there, the bus just fails to probe, as usual */
+	if (vproc->fw_layout) {
+		vproc->boot_rproc = rproc_get(vproc->rproc_name);
+		if (vproc->boot_rproc) {
+			schedule_work(&vproc->register_work);
+			return 0;
+		}
+	}
+
+	ret = register_virtio_device(&vproc->vdev);
+	if (ret)
+		pr_err("failed to register vproc %s: %d\n", vproc->name, ret);
+	else
+		vproc->registered = true;
+
+	return ret;
+}
+EXPORT_SYMBOL(rpmsg_host_register);
+
+/**
+ * rpmsg_host_unregister() - unregister a virtual remote processor
+ * @vproc: the virtual remote processor
+ */
+void rpmsg_host_unregister(struct rpmsg_host_vproc *vproc)
+{
+	/* wait for a deferred registration (it can't be cancelled midway) */
+	flush_work_sync(&vproc->register_work);
+
+	cancel_work_sync(&vproc->crash_work);
+	if (vproc->registered)
+		unregister_virtio_device(&vproc->vdev);
+	vproc->registered = false;
+}
+EXPORT_SYMBOL(rpmsg_host_unregister);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Generic virtio-based remote processor messaging host");
@@ -0,0 +1,183 @@
+/*
+ * Generic virtio-based remote processor messaging host
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _RPMSG_HOST_H
+#define _RPMSG_HOST_H
+
+#include <linux/virtio.h>
+#include <linux/rpmsg.h>
+#include <linux/genalloc.h>
+#include <linux/workqueue.h>
+
+struct rpmsg_host_vproc;
+
+/**
+ * struct rpmsg_host_ops - platform-specific notification backend
+ * @start: called once the vrings and the IPC buffers are set up (and before
+ *	   the remote processor is booted, unless the layout is taken from
+ *	   its firmware): hook up the inbound notifications of the vproc,
+ *	   and tell the remote processor where its IPC memory is.
+ * @stop: undo whatever @start did. Only called if @start succeeded.
+ * @kick: notify the remote processor that the vq @index (whose unique
+ *	  id is @vq_id) of @vproc was kicked. Called in atomic context.
+ *
+ * Inbound notifications are handed back to the core using
+ * rpmsg_host_vq_interrupt().
+ */
+struct rpmsg_host_ops {
+	int (*start)(struct rpmsg_host_vproc *vproc);
+	void (*stop)(struct rpmsg_host_vproc *vproc);
+	void (*kick)(struct rpmsg_host_vproc *vproc, int index, int vq_id);
+};
+
+/**
+ * struct rpmsg_host_mem_ops - provider of the IPC memory
+ * @alloc: allocate @size bytes of (page aligned) memory the remote processor
+ *	   can access, and return its physical address, or 0 on failure
+ * @free: free memory allocated with @alloc
+ * @map_bufs: map the IPC buffers (optional). If not provided, they're
+ *	      mapped write-combined or uncached, according to @buf_wc of the
+ *	      vproc. Either way, they're unmapped using iounmap().
+ *
+ * rpmsg_host_pool_mem_ops is a ready-made provider, which allocates from
+ * the gen_pool given in @pool of the vproc (e.g. a carveout). Its alloc
+ * and free handlers are exported, too, for providers that only need to
+ * map the buffers differently.
+ */
+struct rpmsg_host_mem_ops {
+	unsigned long (*alloc)(struct rpmsg_host_vproc *vproc, size_t size);
+	void (*free)(struct rpmsg_host_vproc *vproc, unsigned long pa,
+								size_t size);
+	void *(*map_bufs)(struct rpmsg_host_vproc *vproc, unsigned long pa,
+								size_t size);
+};
+
+extern const struct rpmsg_host_mem_ops rpmsg_host_pool_mem_ops;
+unsigned long rpmsg_host_pool_alloc(struct rpmsg_host_vproc *vproc,
+								size_t size);
+void rpmsg_host_pool_free(struct rpmsg_host_vproc *vproc, unsigned long pa,
+								size_t size);
+
+/**
+ * struct rpmsg_host_vproc - a virtual remote processor of a generic host
+ * @vdev: virtio device
+ * @name: name of the IPC link, as announced by the firmware's resource table
+ * @rproc_name: name of remote proc device to use with this vproc
+ * @ops: the notification backend
+ * @mem_ops: the provider of the IPC memory
+ * @pool: memory pool used by rpmsg_host_pool_mem_ops
+ * @base_vq_id: unique id of the first virtqueue of this vproc
+ * @prio_base_vq_id: unique id of the first high priority virtqueue
+ * @static_chnls: table of static channels for this vproc
+ * @features: the virtio features offered to the rpmsg bus
+ * @param_num_bufs: number of buffers to use if the firmware doesn't say
+ * @param_buf_sz: size of each buffer to use if the firmware doesn't say
+ * @fw_layout: boot the remote processor first, and take the layout of the
+ *	       IPC buffers from its firmware (see rproc_get_ipc_cfg())
+ * @lazy_boot: don't boot the remote processor when the rpmsg bus is set
+ *	       up, but only once the bus first has messages for it (ignored
+ *	       with @fw_layout, which needs the remote booted up front)
+ * @buf_wc: map the IPC buffers write-combined rather than uncached
+ * @cache_ops: cache maintenance handlers for IPC buffers the mem_ops map
+ *	       cacheable (see VPROC_BUF_CACHE_OPS)
+ * @extra_size: size of extra IPC memory the backend needs after the vrings
+ * @vring: phys address of the vrings; first one used for rx, 2nd one for tx
+ *	   (and likewise for the high priority pair, if there is one)
+ * @buf_paddr: physical address of the IPC buffer region
+ * @buf_size: size of IPC buffer region
+ * @num_bufs: number of buffers the IPC buffer region is split into
+ * @buf_sz: size of each of those buffers
+ * @vring_num: number of entries of each of the vrings
+ * @vring_align: alignment of the vrings
+ * @ring_size: size of the memory occupied by each of the vrings
+ * @extra_paddr: physical address of the extra IPC memory of the backend
+ * @ipc_mem: size of the IPC memory allocated for this vproc, or 0 if none
+ * @buf_mapped: kernel (ioremap'ed) address of IPC buffer region
+ * @buf_shared: @buf_mapped is in the remoteproc's mapping of its carveout
+ * @rproc: remoteproc handle
+ * @vq: virtio's virtqueues
+ * @num_of_vqs: number of virtqueues this vproc owns
+ * @started: whether the backend was started
+ * @crashed: the remote processor crashed, and wasn't recovered yet
+ * @crash_work: recovers from a crash of the remote processor
+ * @boot_rproc: remoteproc handle held while the remote boots, before the
+ *		virtio device is registered (only with @fw_layout)
+ * @register_work: registers the virtio device once the remote has booted
+ * @registered: whether the virtio device was registered
+ *
+ * The backend fills in everything up to @extra_size, and then registers
+ * the vproc using rpmsg_host_register(). The rest is set up by the core
+ * once the rpmsg bus asks for the virtqueues.
+ */
+struct rpmsg_host_vproc {
+	struct virtio_device vdev;
+	const char *name;
+	const char *rproc_name;
+	const struct rpmsg_host_ops *ops;
+	const struct rpmsg_host_mem_ops *mem_ops;
+	struct gen_pool *pool;
+	int base_vq_id;
+	int prio_base_vq_id;
+	struct rpmsg_channel_info *static_chnls;
+	u32 features;
+	unsigned int param_num_bufs;
+	unsigned int param_buf_sz;
+	bool fw_layout;
+	bool lazy_boot;
+	bool buf_wc;
+	const struct rpmsg_cache_ops *cache_ops;
+	unsigned int extra_size;
+
+	unsigned int vring[4];
+	unsigned int buf_paddr;
+	unsigned int buf_size;
+	unsigned int num_bufs;
+	unsigned int buf_sz;
+	unsigned int vring_num;
+	unsigned int vring_align;
+	unsigned int ring_size;
+	unsigned int extra_paddr;
+	unsigned int ipc_mem;
+	void *buf_mapped;
+	bool buf_shared;
+	struct rproc *rproc;
+	struct virtqueue *vq[4];
+	int num_of_vqs;
+	bool started;
+	bool crashed;
+	struct work_struct crash_work;
+	struct rproc *boot_rproc;
+	struct work_struct register_work;
+	bool registered;
+};
+
+#define to_rpmsg_host_vproc(vd) container_of(vd, struct rpmsg_host_vproc, vdev)
+
+/*
+ * By default, allocate 256 buffers of 512 bytes for each side. each buffer
+ * will then have 16B for the msg header and 496B for the payload.
+ */
+#define RPMSG_HOST_NUM_BUFS	(512)
+#define RPMSG_HOST_BUF_SIZE	(512)
+
+int rpmsg_host_set_layout(struct rpmsg_host_vproc *vproc,
+				unsigned int num_bufs, unsigned int buf_sz);
+int rpmsg_host_register(struct rpmsg_host_vproc *vproc);
+void rpmsg_host_unregister(struct rpmsg_host_vproc *vproc);
+void rpmsg_host_vq_interrupt(struct rpmsg_host_vproc *vproc, int index);
+void rpmsg_host_crashed(struct rpmsg_host_vproc *vproc);
+
+#endif /* _RPMSG_HOST_H */
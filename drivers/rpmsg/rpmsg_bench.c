@@ -0,0 +1,556 @@
+/*
+ * Remote processor messaging transport - benchmark driver
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This driver measures the performance of an rpmsg channel against an
+ * "rpmsg-echo" service on the remote processor, which is expected to send
+ * every message it receives back to its source address, as is, unless the
+ * message has RPMSG_BENCH_NO_ECHO set in its header.
+ *
+ * Tests are started by writing to the "run" debugfs file of the channel
+ * (under rpmsg_bench/), and their results are read from "results":
+ *
+ *   latency <size> <count>	   round trips of <size>-byte messages, one at
+ *				   a time (min/percentiles/max, in usecs)
+ *   throughput <size> <count>	   a burst of <count> one-way messages, of
+ *				   which only the last is echoed
+ *   fanout <epts> <size> <count>  <count> rounds, each sending a message from
+ *				   every one of <epts> endpoints at once, and
+ *				   waiting for all of the echoes
+ *
+ * Conversely, when an "rpmsg-echo" service is published locally (e.g.
+ * using the loopback host), this driver is the one that serves it.
+ */
+
+#define pr_fmt(fmt) "%s: " fmt, __func__
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/completion.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/sort.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/rpmsg.h>
+
+/* largest message the remote can echo (it must fit in an rx buffer) */
+#define RPMSG_BENCH_MAX_ECHO	(512 - sizeof(struct rpmsg_hdr))
+
+/* max number of messages (or rounds) per test */
+#define RPMSG_BENCH_MAX_COUNT	(100000)
+
+/* max number of endpoints in a fan-out test */
+#define RPMSG_BENCH_MAX_EPTS	(32)
+
+/* how long to wait for an echo before giving up on the test */
+#define RPMSG_BENCH_TIMEOUT_MS	(1000)
+
+/* the remote shouldn't echo this message */
+#define RPMSG_BENCH_NO_ECHO	(1 << 0)
+
+/**
+ * struct rpmsg_bench_hdr - header of every benchmark message
+ * @seq:	sequence number of the message (or round) within the test
+ * @flags:	see RPMSG_BENCH_NO_ECHO
+ */
+struct rpmsg_bench_hdr {
+	u32 seq;
+	u32 flags;
+} __packed;
+
+enum rpmsg_bench_test {
+	RPMSG_BENCH_NONE,
+	RPMSG_BENCH_LATENCY,
+	RPMSG_BENCH_THROUGHPUT,
+	RPMSG_BENCH_FANOUT,
+};
+
+static const char * const rpmsg_bench_names[] = {
+	[RPMSG_BENCH_NONE]	 = "none",
+	[RPMSG_BENCH_LATENCY]	 = "latency",
+	[RPMSG_BENCH_THROUGHPUT] = "throughput",
+	[RPMSG_BENCH_FANOUT]	 = "fanout",
+};
+
+/**
+ * struct rpmsg_bench - benchmark state of a single rpmsg-echo channel
+ * @rpdev:	the rpmsg channel
+ * @server:	we publish the echo service on this channel, rather than use it
+ * @dir:	debugfs directory of the channel
+ * @lock:	serializes the tests, and protects their results
+ * @pending:	number of echoes the current step of the test still waits for
+ * @seq:	sequence number of the echoes the current step waits for (late
+ *		echoes, of steps that timed out, are ignored)
+ * @done:	completed once @pending drops to zero
+ * @rx_stamp:	when the last echo arrived
+ * @test:	the last test that was run
+ * @size:	message size of the last test
+ * @count:	number of messages (or rounds) of the last test
+ * @nepts:	number of endpoints of the last test
+ * @done_count:	number of messages (or rounds) that actually completed
+ * @err:	error code of the last test (0 if it completed successfully)
+ * @elapsed:	total duration of the last test, in nsecs
+ * @min:	shortest round trip of the last test, in usecs
+ * @p50:	median round trip of the last test, in usecs
+ * @p90:	90th percentile round trip of the last test, in usecs
+ * @p99:	99th percentile round trip of the last test, in usecs
+ * @max:	longest round trip of the last test, in usecs
+ */
+struct rpmsg_bench {
+	struct rpmsg_channel *rpdev;
+	bool server;
+	struct dentry *dir;
+	struct mutex lock;
+	atomic_t pending;
+	u32 seq;
+	struct completion done;
+	ktime_t rx_stamp;
+	enum rpmsg_bench_test test;
+	u32 size, count, nepts, done_count;
+	int err;
+	u64 elapsed;
+	u32 min, p50, p90, p99, max;
+};
+
+static struct dentry *rpmsg_bench_root;
+
+static void rpmsg_bench_cb(struct rpmsg_channel *rpdev, void *data, int len,
+						void *priv, u32 src)
+{
+	/* the channel's own endpoint has no private data */
+	struct rpmsg_bench *bench = priv ?: dev_get_drvdata(&rpdev->dev);
+	struct rpmsg_bench_hdr *hdr = data;
+
+	if (len < sizeof(*hdr)) {
+		dev_warn(&rpdev->dev, "truncated echo from 0x%x\n", src);
+		return;
+	}
+
+	if (bench->server) {
+		if (!(hdr->flags & RPMSG_BENCH_NO_ECHO) &&
+				rpmsg_sendto(rpdev, data, len, src))
+			dev_err(&rpdev->dev, "failed to echo back to 0x%x\n",
+									src);
+		return;
+	}
+
+	if (hdr->seq != ACCESS_ONCE(bench->seq)) {
+		dev_dbg(&rpdev->dev, "stale echo %u from 0x%x\n", hdr->seq,
+									src);
+		return;
+	}
+
+	bench->rx_stamp = ktime_get();
+
+	if (atomic_dec_and_test(&bench->pending))
+		complete(&bench->done);
+}
+
+/* arm the wait for @n echoes of @seq (to be called before sending them) */
+static void rpmsg_bench_expect(struct rpmsg_bench *bench, u32 seq, int n)
+{
+	INIT_COMPLETION(bench->done);
+	atomic_set(&bench->pending, n);
+	bench->seq = seq;
+	smp_wmb();
+}
+
+static int rpmsg_bench_wait(struct rpmsg_bench *bench)
+{
+	if (!wait_for_completion_timeout(&bench->done,
+				msecs_to_jiffies(RPMSG_BENCH_TIMEOUT_MS)))
+		return -ETIMEDOUT;
+
+	return 0;
+}
+
+static int rpmsg_bench_send(struct rpmsg_bench *bench, u32 src, void *buf,
+						u32 seq, u32 flags, int size)
+{
+	struct rpmsg_bench_hdr *hdr = buf;
+
+	hdr->seq = seq;
+	hdr->flags = flags;
+
+	return rpmsg_send_offchannel(bench->rpdev, src, bench->rpdev->dst,
+								buf, size);
+}
+
+static int rpmsg_bench_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* sort the round trip samples of a test, and summarize them */
+static void rpmsg_bench_summarize(struct rpmsg_bench *bench, u32 *samples,
+								u32 n)
+{
+	if (!n)
+		return;
+
+	sort(samples, n, sizeof(*samples), rpmsg_bench_cmp, NULL);
+
+	bench->min = samples[0];
+	bench->p50 = samples[(n - 1) * 50 / 100];
+	bench->p90 = samples[(n - 1) * 90 / 100];
+	bench->p99 = samples[(n - 1) * 99 / 100];
+	bench->max = samples[n - 1];
+}
+
+/*
+ * send a message from every endpoint in @epts (the channel's own endpoint
+ * if @nepts is 1), @count times, waiting for all of the echoes every time
+ */
+static int rpmsg_bench_rounds(struct rpmsg_bench *bench,
+		struct rpmsg_endpoint **epts, u32 nepts, void *buf, u32 *samples)
+{
+	ktime_t start;
+	u32 i, j;
+	int ret = 0;
+
+	for (i = 0; i < bench->count; i++) {
+		rpmsg_bench_expect(bench, i, nepts);
+
+		start = ktime_get();
+
+		for (j = 0; j < nepts && !ret; j++)
+			ret = rpmsg_bench_send(bench, epts[j]->addr, buf, i, 0,
+								bench->size);
+		if (ret)
+			break;
+
+		ret = rpmsg_bench_wait(bench);
+		if (ret)
+			break;
+
+		samples[i] = ktime_us_delta(bench->rx_stamp, start);
+		bench->done_count++;
+	}
+
+	return ret;
+}
+
+static int rpmsg_bench_latency(struct rpmsg_bench *bench, void *buf,
+								u32 *samples)
+{
+	struct rpmsg_endpoint *ept = bench->rpdev->ept;
+
+	return rpmsg_bench_rounds(bench, &ept, 1, buf, samples);
+}
+
+static int rpmsg_bench_fanout(struct rpmsg_bench *bench, void *buf,
+								u32 *samples)
+{
+	struct rpmsg_endpoint *epts[RPMSG_BENCH_MAX_EPTS];
+	u32 i, n;
+	int ret = 0;
+
+	for (n = 0; n < bench->nepts; n++) {
+		epts[n] = rpmsg_create_ept(bench->rpdev, rpmsg_bench_cb, bench,
+							RPMSG_ADDR_ANY);
+		if (!epts[n]) {
+			ret = -ENOMEM;
+			break;
+		}
+	}
+
+	if (!ret)
+		ret = rpmsg_bench_rounds(bench, epts, n, buf, samples);
+
+	for (i = 0; i < n; i++)
+		rpmsg_destroy_ept(epts[i]);
+
+	return ret;
+}
+
+static int rpmsg_bench_throughput(struct rpmsg_bench *bench, void *buf)
+{
+	u32 src = bench->rpdev->ept->addr;
+	u32 i;
+	int ret;
+
+	rpmsg_bench_expect(bench, bench->count - 1, 1);
+
+	rpmsg_cork(bench->rpdev);
+
+	/* only the last message is echoed, to tell us the burst was consumed */
+	for (i = 0, ret = 0; i < bench->count - 1 && !ret; i++)
+		ret = rpmsg_bench_send(bench, src, buf, i, RPMSG_BENCH_NO_ECHO,
+								bench->size);
+	if (!ret)
+		ret = rpmsg_bench_send(bench, src, buf, i, 0,
+				min_t(u32, bench->size, RPMSG_BENCH_MAX_ECHO));
+
+	rpmsg_uncork(bench->rpdev);
+
+	if (ret)
+		return ret;
+
+	ret = rpmsg_bench_wait(bench);
+	if (!ret)
+		bench->done_count = bench->count;
+
+	return ret;
+}
+
+static int rpmsg_bench_run(struct rpmsg_bench *bench, enum rpmsg_bench_test test,
+					u32 nepts, u32 size, u32 count)
+{
+	u32 *samples = NULL;
+	ktime_t start;
+	void *buf;
+	int ret;
+
+	if (!count || count > RPMSG_BENCH_MAX_COUNT ||
+				size < sizeof(struct rpmsg_bench_hdr))
+		return -EINVAL;
+
+	if (test != RPMSG_BENCH_THROUGHPUT && size > RPMSG_BENCH_MAX_ECHO)
+		return -EMSGSIZE;
+
+	if (test == RPMSG_BENCH_FANOUT && (!nepts ||
+					nepts > RPMSG_BENCH_MAX_EPTS))
+		return -EINVAL;
+
+	buf = kzalloc(size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	if (test != RPMSG_BENCH_THROUGHPUT) {
+		samples = vmalloc(count * sizeof(*samples));
+		if (!samples) {
+			kfree(buf);
+			return -ENOMEM;
+		}
+	}
+
+	mutex_lock(&bench->lock);
+
+	bench->test = test;
+	bench->nepts = test == RPMSG_BENCH_FANOUT ? nepts : 1;
+	bench->size = size;
+	bench->count = count;
+	bench->done_count = 0;
+	bench->min = bench->p50 = bench->p90 = bench->p99 = bench->max = 0;
+
+	start = ktime_get();
+
+	switch (test) {
+	case RPMSG_BENCH_LATENCY:
+		ret = rpmsg_bench_latency(bench, buf, samples);
+		break;
+	case RPMSG_BENCH_THROUGHPUT:
+		ret = rpmsg_bench_throughput(bench, buf);
+		break;
+	default:
+		ret = rpmsg_bench_fanout(bench, buf, samples);
+		break;
+	}
+
+	bench->elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	bench->err = ret;
+
+	if (samples)
+		rpmsg_bench_summarize(bench, samples, bench->done_count);
+
+	mutex_unlock(&bench->lock);
+
+	if (ret)
+		dev_err(&bench->rpdev->dev, "%s test failed after %u: %d\n",
+			rpmsg_bench_names[test], bench->done_count, ret);
+
+	vfree(samples);
+	kfree(buf);
+
+	return ret;
+}
+
+static ssize_t rpmsg_bench_run_write(struct file *filp,
+		const char __user *userbuf, size_t count, loff_t *ppos)
+{
+	struct rpmsg_bench *bench = filp->private_data;
+	char buf[64], name[16];
+	u32 a, b, c = 0;
+	int n, ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, userbuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	n = sscanf(buf, "%15s %u %u %u", name, &a, &b, &c);
+
+	if (n == 3 && !strcmp(name, "latency"))
+		ret = rpmsg_bench_run(bench, RPMSG_BENCH_LATENCY, 0, a, b);
+	else if (n == 3 && !strcmp(name, "throughput"))
+		ret = rpmsg_bench_run(bench, RPMSG_BENCH_THROUGHPUT, 0, a, b);
+	else if (n == 4 && !strcmp(name, "fanout"))
+		ret = rpmsg_bench_run(bench, RPMSG_BENCH_FANOUT, a, b, c);
+	else
+		ret = -EINVAL;
+
+	return ret ? ret : count;
+}
+
+static int rpmsg_bench_open_generic(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations rpmsg_bench_run_ops = {
+	.write = rpmsg_bench_run_write,
+	.open = rpmsg_bench_open_generic,
+	.llseek = generic_file_llseek,
+};
+
+static int rpmsg_bench_results_show(struct seq_file *s, void *unused)
+{
+	struct rpmsg_bench *bench = s->private;
+	u64 ns, msgs;
+
+	mutex_lock(&bench->lock);
+
+	ns = bench->elapsed ?: 1;
+	msgs = (u64) bench->done_count * bench->nepts;
+
+	seq_printf(s, "test: %s\n", rpmsg_bench_names[bench->test]);
+	if (bench->test == RPMSG_BENCH_NONE)
+		goto unlock;
+
+	seq_printf(s, "status: %d\n", bench->err);
+	seq_printf(s, "endpoints: %u\n", bench->nepts);
+	seq_printf(s, "size: %u\n", bench->size);
+	seq_printf(s, "count: %u/%u\n", bench->done_count, bench->count);
+	seq_printf(s, "elapsed_us: %llu\n", div_u64(bench->elapsed, 1000));
+	seq_printf(s, "msgs_per_sec: %llu\n",
+				div64_u64(msgs * NSEC_PER_SEC, ns));
+	seq_printf(s, "bytes_per_sec: %llu\n",
+				div64_u64(msgs * bench->size * NSEC_PER_SEC, ns));
+
+	if (bench->test != RPMSG_BENCH_THROUGHPUT && bench->done_count)
+		seq_printf(s, "rtt_us: min %u p50 %u p90 %u p99 %u max %u\n",
+				bench->min, bench->p50, bench->p90,
+				bench->p99, bench->max);
+
+unlock:
+	mutex_unlock(&bench->lock);
+
+	return 0;
+}
+
+static int rpmsg_bench_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rpmsg_bench_results_show, inode->i_private);
+}
+
+static const struct file_operations rpmsg_bench_results_ops = {
+	.open = rpmsg_bench_results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int rpmsg_bench_probe(struct rpmsg_channel *rpdev)
+{
+	struct rpmsg_bench *bench;
+
+	bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+	if (!bench)
+		return -ENOMEM;
+
+	bench->rpdev = rpdev;
+	mutex_init(&bench->lock);
+	init_completion(&bench->done);
+
+	dev_set_drvdata(&rpdev->dev, bench);
+
+	/* a local service channel isn't bound to any remote address */
+	if (rpdev->dst == RPMSG_ADDR_ANY) {
+		bench->server = true;
+		dev_info(&rpdev->dev, "serving echo requests at 0x%x\n",
+								rpdev->src);
+		return 0;
+	}
+
+	if (rpmsg_bench_root) {
+		bench->dir = debugfs_create_dir(dev_name(&rpdev->dev),
+							rpmsg_bench_root);
+		debugfs_create_file("run", 0200, bench->dir, bench,
+							&rpmsg_bench_run_ops);
+		debugfs_create_file("results", 0400, bench->dir, bench,
+						&rpmsg_bench_results_ops);
+	}
+
+	dev_info(&rpdev->dev, "new echo channel: 0x%x <-> 0x%x!\n",
+					rpdev->src, rpdev->dst);
+
+	return 0;
+}
+
+static void __devexit rpmsg_bench_remove(struct rpmsg_channel *rpdev)
+{
+	struct rpmsg_bench *bench = dev_get_drvdata(&rpdev->dev);
+
+	debugfs_remove_recursive(bench->dir);
+	kfree(bench);
+}
+
+static struct rpmsg_device_id rpmsg_bench_id_table[] = {
+	{ .name	= "rpmsg-echo" },
+	{ },
+};
+MODULE_DEVICE_TABLE(rpmsg, rpmsg_bench_id_table);
+
+static struct rpmsg_driver rpmsg_bench_driver = {
+	.drv.name	= KBUILD_MODNAME,
+	.drv.owner	= THIS_MODULE,
+	.id_table	= rpmsg_bench_id_table,
+	.probe		= rpmsg_bench_probe,
+	.callback	= rpmsg_bench_cb,
+	.remove		= __devexit_p(rpmsg_bench_remove),
+};
+
+static int __init init(void)
+{
+	int ret;
+
+	if (debugfs_initialized()) {
+		rpmsg_bench_root = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (IS_ERR(rpmsg_bench_root))
+			rpmsg_bench_root = NULL;
+	}
+
+	ret = register_rpmsg_driver(&rpmsg_bench_driver);
+	if (ret)
+		debugfs_remove(rpmsg_bench_root);
+
+	return ret;
+}
+
+static void __exit fini(void)
+{
+	unregister_rpmsg_driver(&rpmsg_bench_driver);
+	debugfs_remove(rpmsg_bench_root);
+}
+module_init(init);
+module_exit(fini);
+
+MODULE_DESCRIPTION("Virtio remote processor messaging benchmark driver");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,502 @@
+/*
+ * Generic rpmsg user space interface
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt) "%s: " fmt, __func__
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/idr.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/err.h>
+#include <linux/kfifo.h>
+#include <linux/uaccess.h>
+#include <linux/rpmsg.h>
+#include <linux/rpmsg_char.h>
+
+/* maximum rpmsg-char devices this driver can handle */
+#define MAX_RPMSG_CHAR_DEVICES	8
+
+/* max number of inbound messages queued to the reader (power of two) */
+#define RPMSG_CHAR_QUEUE_LEN	(64)
+
+/**
+ * struct rpmsg_char_service - the char device of a single rpmsg channel
+ * @cdev:	the char device
+ * @dev:	the device node of @cdev
+ * @rpdev:	the rpmsg channel
+ * @minor:	minor number of @cdev
+ */
+struct rpmsg_char_service {
+	struct cdev cdev;
+	struct device *dev;
+	struct rpmsg_channel *rpdev;
+	int minor;
+};
+
+/**
+ * struct rpmsg_char_ept - an endpoint that belongs to a user space file
+ * @chserv:	the char device this endpoint was opened on
+ * @ept:	the rpmsg endpoint
+ * @dst:	remote address written messages are sent to
+ * @queue:	inbound messages waiting for the reader. the rx callback is
+ *		its only producer, so it's lockless on that side.
+ * @read_lock:	serializes the consumers of @queue
+ * @readq:	readers (and pollers) waiting for inbound messages
+ * @tx_waiter:	wakes up pollers once tx space is available again
+ */
+struct rpmsg_char_ept {
+	struct rpmsg_char_service *chserv;
+	struct rpmsg_endpoint *ept;
+	u32 dst;
+	DECLARE_KFIFO(queue, struct rpmsg_rx_buf *, RPMSG_CHAR_QUEUE_LEN);
+	struct mutex read_lock;
+	wait_queue_head_t readq;
+	struct rpmsg_tx_waiter tx_waiter;
+};
+
+static struct class *rpmsg_char_class;
+static dev_t rpmsg_char_dev;
+
+/* store all rpmsg-char services (one per rpmsg-char channel) */
+static DEFINE_IDR(rpmsg_char_services);
+static DEFINE_SPINLOCK(rpmsg_char_services_lock);
+
+/*
+ * inbound messages are queued as rpmsg_rx_buf handles: the rpmsg rx buffer
+ * itself is held whenever possible, and a private copy is made otherwise
+ */
+static struct rpmsg_rx_buf *rpmsg_char_copy_msg(void *data, int len, u32 src)
+{
+	struct rpmsg_rx_buf *rxb;
+
+	rxb = kzalloc(sizeof(*rxb) + len, GFP_KERNEL);
+	if (!rxb)
+		return NULL;
+
+	rxb->data = rxb + 1;
+	rxb->len = len;
+	rxb->src = src;
+	memcpy(rxb->data, data, len);
+
+	return rxb;
+}
+
+static void rpmsg_char_free_msg(struct rpmsg_rx_buf *rxb)
+{
+	if (rxb->vrp)
+		rpmsg_release_rx_buf(rxb);
+	else
+		kfree(rxb);
+}
+
+static void rpmsg_char_cb(struct rpmsg_channel *rpdev, void *data, int len,
+							void *priv, u32 src)
+{
+	struct rpmsg_char_ept *chept = priv;
+	const struct rpmsg_rx_buf *queued;
+	struct rpmsg_rx_buf *rxb;
+
+	/* we're the only producer, so the queue can't fill up later */
+	if (kfifo_is_full(&chept->queue)) {
+		dev_err(&rpdev->dev, "rx queue is full, msg dropped\n");
+		return;
+	}
+
+	/* try to avoid copying the message, fall back if we can't */
+	rxb = rpmsg_hold_rx_buf(chept->ept, data);
+	if (!rxb)
+		rxb = rpmsg_char_copy_msg(data, len, src);
+	if (!rxb) {
+		dev_err(&rpdev->dev, "failed to queue msg: %d\n", len);
+		return;
+	}
+
+	/* kfifo_put() insists on a pointer to a const element */
+	queued = rxb;
+	kfifo_put(&chept->queue, &queued);
+
+	wake_up_interruptible(&chept->readq);
+}
+
+/* invoked (possibly in an interrupt context) once tx space is available */
+static void rpmsg_char_tx_ready(struct rpmsg_channel *rpdev, void *priv)
+{
+	struct rpmsg_char_ept *chept = priv;
+
+	wake_up_interruptible(&chept->readq);
+}
+
+static
+long rpmsg_char_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct rpmsg_char_ept *chept = filp->private_data;
+	struct rpmsg_char_service *chserv = chept->chserv;
+	int ret = 0;
+
+	dev_dbg(chserv->dev, "%s: cmd %d, arg 0x%lx\n", __func__, cmd, arg);
+
+	if (_IOC_TYPE(cmd) != RPMSG_CHAR_IOC_MAGIC)
+		return -ENOTTY;
+	if (_IOC_NR(cmd) > RPMSG_CHAR_IOC_MAXNR)
+		return -ENOTTY;
+
+	switch (cmd) {
+	case RPMSG_CHAR_IOCGETADDR:
+		ret = put_user(chept->ept->addr, (u32 __user *) arg);
+		break;
+	case RPMSG_CHAR_IOCSETDST:
+		ret = get_user(chept->dst, (u32 __user *) arg);
+		break;
+	default:
+		dev_warn(chserv->dev, "unhandled ioctl cmd: %d\n", cmd);
+		ret = -ENOTTY;
+		break;
+	}
+
+	return ret;
+}
+
+static int rpmsg_char_open(struct inode *inode, struct file *filp)
+{
+	struct rpmsg_char_service *chserv;
+	struct rpmsg_char_ept *chept;
+
+	chserv = container_of(inode->i_cdev, struct rpmsg_char_service, cdev);
+
+	chept = kzalloc(sizeof(*chept), GFP_KERNEL);
+	if (!chept)
+		return -ENOMEM;
+
+	chept->chserv = chserv;
+	chept->dst = chserv->rpdev->dst;
+	INIT_KFIFO(chept->queue);
+	mutex_init(&chept->read_lock);
+	init_waitqueue_head(&chept->readq);
+	rpmsg_init_tx_waiter(&chept->tx_waiter, rpmsg_char_tx_ready, chept);
+
+	/* every file gets its own, dynamically assigned, local address */
+	chept->ept = rpmsg_create_ept(chserv->rpdev, rpmsg_char_cb, chept,
+							RPMSG_ADDR_ANY);
+	if (!chept->ept) {
+		dev_err(chserv->dev, "create ept failed\n");
+		kfree(chept);
+		return -ENOMEM;
+	}
+
+	/* we'd like to hand inbound messages to readers without copying */
+	chept->ept->flags |= RPMSG_EPT_HOLD_RX;
+
+	filp->private_data = chept;
+
+	dev_dbg(chserv->dev, "local addr assigned: 0x%x\n", chept->ept->addr);
+
+	return 0;
+}
+
+static int rpmsg_char_release(struct inode *inode, struct file *filp)
+{
+	struct rpmsg_char_ept *chept = filp->private_data;
+	struct rpmsg_rx_buf *rxb;
+
+	rpmsg_tx_notify_cancel(chept->chserv->rpdev, &chept->tx_waiter);
+	rpmsg_destroy_ept(chept->ept);
+
+	/* give back the messages no one has read */
+	while (kfifo_get(&chept->queue, &rxb))
+		rpmsg_char_free_msg(rxb);
+
+	kfree(chept);
+
+	return 0;
+}
+
+static ssize_t rpmsg_char_read(struct file *filp, char __user *buf,
+						size_t len, loff_t *offp)
+{
+	struct rpmsg_char_ept *chept = filp->private_data;
+	struct rpmsg_rx_buf *rxb;
+	int use;
+
+	/* readers only ever contend with each other, never with the producer */
+	if (mutex_lock_interruptible(&chept->read_lock))
+		return -ERESTARTSYS;
+
+	/* nothing to read ? */
+	while (!kfifo_get(&chept->queue, &rxb)) {
+		mutex_unlock(&chept->read_lock);
+		/* non-blocking requested ? return now */
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		/* otherwise block, and wait for data */
+		if (wait_event_interruptible(chept->readq,
+				!kfifo_is_empty(&chept->queue)))
+			return -ERESTARTSYS;
+		/* another reader may have beaten us to it, so check again */
+		if (mutex_lock_interruptible(&chept->read_lock))
+			return -ERESTARTSYS;
+	}
+
+	mutex_unlock(&chept->read_lock);
+
+	/* messages are never split: whatever doesn't fit in @buf is dropped */
+	use = min_t(size_t, len, rxb->len);
+
+	if (copy_to_user(buf, rxb->data, use))
+		use = -EFAULT;
+
+	rpmsg_char_free_msg(rxb);
+	return use;
+}
+
+/* send a single message, copying it from user space directly to rpmsg */
+static ssize_t rpmsg_char_write(struct file *filp, const char __user *ubuf,
+						size_t len, loff_t *offp)
+{
+	struct rpmsg_char_ept *chept = filp->private_data;
+	struct rpmsg_channel *rpdev = chept->chserv->rpdev;
+	bool wait = !(filp->f_flags & O_NONBLOCK);
+	void *buf;
+	int ret;
+
+	if (len > INT_MAX)
+		return -EMSGSIZE;
+
+	buf = rpmsg_alloc_tx_buf(rpdev, len, wait);
+	if (IS_ERR(buf)) {
+		ret = PTR_ERR(buf);
+		/* let poll() know when to try again */
+		if (!wait && ret == -ENOMEM) {
+			rpmsg_tx_notify(rpdev, &chept->tx_waiter);
+			ret = -EAGAIN;
+		}
+		return ret;
+	}
+
+	if (copy_from_user(buf, ubuf, len)) {
+		rpmsg_free_tx_buf(rpdev, buf);
+		return -EFAULT;
+	}
+
+	ret = rpmsg_send_prepared(rpdev, chept->ept->addr, chept->dst, buf,
+									len);
+	if (ret) {
+		dev_err(chept->chserv->dev, "rpmsg_send failed: %d\n", ret);
+		return ret;
+	}
+
+	return len;
+}
+
+/* is there any tx space right now ? (a big message might still block) */
+static bool rpmsg_char_writable(struct rpmsg_char_ept *chept)
+{
+	struct rpmsg_channel *rpdev = chept->chserv->rpdev;
+	void *buf;
+
+	buf = rpmsg_alloc_tx_buf(rpdev, 0, false);
+	if (IS_ERR(buf)) {
+		/* -EBUSY just means a notification is pending already */
+		rpmsg_tx_notify(rpdev, &chept->tx_waiter);
+		return false;
+	}
+
+	rpmsg_free_tx_buf(rpdev, buf);
+
+	return true;
+}
+
+static unsigned int
+rpmsg_char_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct rpmsg_char_ept *chept = filp->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(filp, &chept->readq, wait);
+
+	if (!kfifo_is_empty(&chept->queue))
+		mask |= POLLIN | POLLRDNORM;
+
+	if (rpmsg_char_writable(chept))
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
+}
+
+static const struct file_operations rpmsg_char_fops = {
+	.open		= rpmsg_char_open,
+	.release	= rpmsg_char_release,
+	.unlocked_ioctl	= rpmsg_char_ioctl,
+	.read		= rpmsg_char_read,
+	.write		= rpmsg_char_write,
+	.poll		= rpmsg_char_poll,
+	.owner		= THIS_MODULE,
+};
+
+static int rpmsg_char_probe(struct rpmsg_channel *rpdev)
+{
+	int ret, major, minor;
+	struct rpmsg_char_service *chserv;
+
+	if (!idr_pre_get(&rpmsg_char_services, GFP_KERNEL)) {
+		dev_err(&rpdev->dev, "idr_pre_get failed\n");
+		return -ENOMEM;
+	}
+
+	chserv = kzalloc(sizeof(*chserv), GFP_KERNEL);
+	if (!chserv) {
+		dev_err(&rpdev->dev, "kzalloc failed\n");
+		return -ENOMEM;
+	}
+
+	/* dynamically assign a new minor number */
+	spin_lock(&rpmsg_char_services_lock);
+	ret = idr_get_new(&rpmsg_char_services, chserv, &minor);
+	spin_unlock(&rpmsg_char_services_lock);
+
+	if (ret) {
+		dev_err(&rpdev->dev, "failed to idr_get_new: %d\n", ret);
+		goto free_chserv;
+	}
+
+	if (minor >= MAX_RPMSG_CHAR_DEVICES) {
+		dev_err(&rpdev->dev, "too many rpmsg-char devices\n");
+		ret = -ENOSPC;
+		goto rem_idr;
+	}
+
+	major = MAJOR(rpmsg_char_dev);
+
+	chserv->rpdev = rpdev;
+	chserv->minor = minor;
+
+	cdev_init(&chserv->cdev, &rpmsg_char_fops);
+	chserv->cdev.owner = THIS_MODULE;
+	ret = cdev_add(&chserv->cdev, MKDEV(major, minor), 1);
+	if (ret) {
+		dev_err(&rpdev->dev, "cdev_add failed: %d\n", ret);
+		goto rem_idr;
+	}
+
+	chserv->dev = device_create(rpmsg_char_class, &rpdev->dev,
+			MKDEV(major, minor), NULL,
+			"rpmsg-char%d", minor);
+	if (IS_ERR(chserv->dev)) {
+		ret = PTR_ERR(chserv->dev);
+		dev_err(&rpdev->dev, "device_create failed: %d\n", ret);
+		goto clean_cdev;
+	}
+
+	dev_set_drvdata(&rpdev->dev, chserv);
+
+	dev_info(chserv->dev, "new rpmsg-char channel: 0x%x -> 0x%x!\n",
+						rpdev->src, rpdev->dst);
+	return 0;
+
+clean_cdev:
+	cdev_del(&chserv->cdev);
+rem_idr:
+	spin_lock(&rpmsg_char_services_lock);
+	idr_remove(&rpmsg_char_services, minor);
+	spin_unlock(&rpmsg_char_services_lock);
+free_chserv:
+	kfree(chserv);
+	return ret;
+}
+
+static void __devexit rpmsg_char_remove(struct rpmsg_channel *rpdev)
+{
+	struct rpmsg_char_service *chserv = dev_get_drvdata(&rpdev->dev);
+	int major = MAJOR(rpmsg_char_dev);
+
+	device_destroy(rpmsg_char_class, MKDEV(major, chserv->minor));
+	cdev_del(&chserv->cdev);
+	spin_lock(&rpmsg_char_services_lock);
+	idr_remove(&rpmsg_char_services, chserv->minor);
+	spin_unlock(&rpmsg_char_services_lock);
+	kfree(chserv);
+}
+
+static void rpmsg_char_driver_cb(struct rpmsg_channel *rpdev, void *data,
+						int len, void *priv, u32 src)
+{
+	dev_warn(&rpdev->dev, "unexpected message from 0x%x\n", src);
+}
+
+static struct rpmsg_device_id rpmsg_char_id_table[] = {
+	{ .name	= "rpmsg-char" },
+	{ },
+};
+MODULE_DEVICE_TABLE(rpmsg, rpmsg_char_id_table);
+
+static struct rpmsg_driver rpmsg_char_driver = {
+	.drv.name	= KBUILD_MODNAME,
+	.drv.owner	= THIS_MODULE,
+	.id_table	= rpmsg_char_id_table,
+	.probe		= rpmsg_char_probe,
+	.callback	= rpmsg_char_driver_cb,
+	.remove		= __devexit_p(rpmsg_char_remove),
+};
+
+static int __init init(void)
+{
+	int ret;
+
+	ret = alloc_chrdev_region(&rpmsg_char_dev, 0, MAX_RPMSG_CHAR_DEVICES,
+							KBUILD_MODNAME);
+	if (ret) {
+		pr_err("alloc_chrdev_region failed: %d\n", ret);
+		goto out;
+	}
+
+	rpmsg_char_class = class_create(THIS_MODULE, KBUILD_MODNAME);
+	if (IS_ERR(rpmsg_char_class)) {
+		ret = PTR_ERR(rpmsg_char_class);
+		pr_err("class_create failed: %d\n", ret);
+		goto unreg_region;
+	}
+
+	ret = register_rpmsg_driver(&rpmsg_char_driver);
+	if (ret) {
+		pr_err("register_rpmsg_driver failed: %d\n", ret);
+		goto destroy_class;
+	}
+
+	return 0;
+
+destroy_class:
+	class_destroy(rpmsg_char_class);
+unreg_region:
+	unregister_chrdev_region(rpmsg_char_dev, MAX_RPMSG_CHAR_DEVICES);
+out:
+	return ret;
+}
+module_init(init);
+
+static void __exit fini(void)
+{
+	unregister_rpmsg_driver(&rpmsg_char_driver);
+	class_destroy(rpmsg_char_class);
+	unregister_chrdev_region(rpmsg_char_dev, MAX_RPMSG_CHAR_DEVICES);
+}
+module_exit(fini);
+
+MODULE_DESCRIPTION("Generic rpmsg user space interface");
+MODULE_LICENSE("GPL v2");
@@ -30,14 +30,32 @@
 #include <linux/jiffies.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
-#include <linux/skbuff.h>
+#include <linux/list.h>
 #include <linux/sched.h>
+#include <linux/err.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/eventfd.h>
+#include <linux/kfifo.h>
 #include <linux/rpmsg.h>
 #include <linux/rpmsg_omx.h>
 
 /* maximum OMX devices this driver can handle */
 #define MAX_OMX_DEVICES		8
 
+/* maximum size of an outbound OMX message (including the OMX header) */
+#define RPMSG_OMX_MAX_MSG	(512)
+
+/* number of preallocated buffers (per instance) to copy inbound messages to */
+#define RPMSG_OMX_POOL_BUFS	(16)
+#define RPMSG_OMX_POOL_BUF_SIZE	(sizeof(struct rpmsg_rx_buf) + RPMSG_OMX_MAX_MSG)
+
+/* max number of inbound messages queued to the reader (power of two) */
+#define RPMSG_OMX_QUEUE_LEN	(256)
+
 struct rpmsg_omx_service {
 	struct cdev cdev;
 	struct device *dev;
@@ -45,15 +63,78 @@ struct rpmsg_omx_service {
 	int minor;
 };
 
+/**
+ * struct rpmsg_omx_buf - a buffer that is shared with the remote OMX instance
+ * @node:	link in the instance's list of shared buffers
+ * @id:		the id of the buffer
+ * @da:		the address of the buffer, as seen by the remote processor
+ * @size:	size of the buffer, in bytes
+ */
+struct rpmsg_omx_buf {
+	struct list_head node;
+	u32 id;
+	u32 da;
+	u32 size;
+};
+
+/**
+ * struct rpmsg_omx_instance - a single connection to a remote OMX instance
+ * @omxserv:	the OMX connection service this instance belongs to
+ * @queue:	inbound messages waiting for the reader. the rx callback is
+ *		its only producer, so it's lockless on that side.
+ * @read_lock:	serializes the consumers of @queue
+ * @ring_lock:	serializes the producers of @ring's rx slots, and protects
+ *		@rx_head (and the publishing of @ring)
+ * @lock:	serializes the setting up of @ring, and protects @bufs
+ * @readq:	readers waiting for inbound messages
+ * @reply_arrived: signaled when the connection response arrives
+ * @ept:	the local endpoint of this instance
+ * @dst:	address of the remote OMX instance
+ * @state:	connection state, see enum omx_state
+ * @ring:	the mmap'able message rings (optional), see OMX_IOCRINGSETUP
+ * @ring_size:	size of @ring, in bytes
+ * @efd:	eventfd to signal whenever the instance may have become readable
+ *		or writable, i.e. whenever poll() might return something new
+ *		(optional, see OMX_IOCEVENTFD)
+ * @tx_waiter:	notifies the user when tx space is available again
+ * @rx_head:	private copy of @ring's rx_head (the user can't be trusted)
+ * @tx_tail:	private copy of @ring's tx_tail (the user can't be trusted)
+ * @num_slots:	private copy of @ring's num_slots (the user can't be trusted)
+ * @slots:	the first tx slot of @ring (the rx slots follow the tx slots)
+ * @tx_lock:	serializes the senders of @ring's tx slots
+ * @framed:	read() and write() use struct omx_frame batches
+ * @pool:	preallocated buffers for copies of inbound messages
+ * @pool_free:	the @pool buffers that are currently unused
+ * @pool_lock:	protects @pool_free
+ * @bufs:	buffers shared with the remote OMX instance (see OMX_IOCREGBUF)
+ * @next_buf_id: id of the next buffer to be shared
+ */
 struct rpmsg_omx_instance {
 	struct rpmsg_omx_service *omxserv;
-	struct sk_buff_head queue;
+	DECLARE_KFIFO(queue, struct rpmsg_rx_buf *, RPMSG_OMX_QUEUE_LEN);
+	struct mutex read_lock;
+	spinlock_t ring_lock;
 	struct mutex lock;
 	wait_queue_head_t readq;
 	struct completion reply_arrived;
 	struct rpmsg_endpoint *ept;
 	u32 dst;
 	int state;
+	struct omx_ring_ctrl *ring;
+	size_t ring_size;
+	struct eventfd_ctx *efd;
+	struct rpmsg_tx_waiter tx_waiter;
+	u32 rx_head;
+	u32 tx_tail;
+	u32 num_slots;
+	void *slots;
+	struct mutex tx_lock;
+	bool framed;
+	void *pool;
+	struct list_head pool_free;
+	spinlock_t pool_lock;
+	struct list_head bufs;
+	u32 next_buf_id;
 };
 
 static struct class *rpmsg_omx_class;
@@ -63,24 +144,509 @@ static dev_t rpmsg_omx_dev;
 static DEFINE_IDR(rpmsg_omx_services);
 static DEFINE_SPINLOCK(rpmsg_omx_services_lock);
 
-static void rpmsg_omx_cb(struct rpmsg_channel *rpdev, void *data, int len,
-							void *priv, u32 src)
+static struct rpmsg_rx_buf *rpmsg_omx_pool_get(struct rpmsg_omx_instance *omx)
+{
+	struct rpmsg_rx_buf *rxb = NULL;
+
+	spin_lock(&omx->pool_lock);
+	if (!list_empty(&omx->pool_free)) {
+		rxb = list_first_entry(&omx->pool_free, struct rpmsg_rx_buf,
+									node);
+		list_del(&rxb->node);
+	}
+	spin_unlock(&omx->pool_lock);
+
+	return rxb;
+}
+
+static void rpmsg_omx_pool_put(struct rpmsg_omx_instance *omx,
+						struct rpmsg_rx_buf *rxb)
+{
+	spin_lock(&omx->pool_lock);
+	list_add(&rxb->node, &omx->pool_free);
+	spin_unlock(&omx->pool_lock);
+}
+
+static int rpmsg_omx_pool_init(struct rpmsg_omx_instance *omx)
+{
+	struct rpmsg_rx_buf *rxb;
+	int i;
+
+	omx->pool = kcalloc(RPMSG_OMX_POOL_BUFS, RPMSG_OMX_POOL_BUF_SIZE,
+								GFP_KERNEL);
+	if (!omx->pool)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&omx->pool_free);
+	spin_lock_init(&omx->pool_lock);
+
+	for (i = 0; i < RPMSG_OMX_POOL_BUFS; i++) {
+		rxb = omx->pool + i * RPMSG_OMX_POOL_BUF_SIZE;
+		rxb->data = rxb + 1;
+		list_add_tail(&rxb->node, &omx->pool_free);
+	}
+
+	return 0;
+}
+
+/*
+ * Inbound OMX messages are queued to the reader as rpmsg_rx_buf handles.
+ * Normally the message is copied to one of the instance's preallocated
+ * pool buffers, which don't belong to any remote processor, so the rpmsg
+ * rx buffer goes straight back to the remote.
+ *
+ * If the reader lags so far behind that the pool runs dry, the rpmsg rx
+ * buffer itself is held instead, until the reader consumes the message.
+ * This pushes back on the remote processor without ever blocking the rx
+ * callback (which would stall every other endpoint of the remote), and
+ * the rx hold quota keeps the other endpoints from being starved.
+ */
+static struct rpmsg_rx_buf *rpmsg_omx_copy_msg(struct rpmsg_omx_instance *omx,
+						void *data, int len, u32 src)
+{
+	struct rpmsg_rx_buf *rxb;
+
+	if (len > RPMSG_OMX_MAX_MSG)
+		return NULL;
+
+	rxb = rpmsg_omx_pool_get(omx);
+	if (!rxb)
+		return NULL;
+
+	rxb->len = len;
+	rxb->src = src;
+	memcpy(rxb->data, data, len);
+
+	return rxb;
+}
+
+static void rpmsg_omx_free_msg(struct rpmsg_omx_instance *omx,
+						struct rpmsg_rx_buf *rxb)
+{
+	if (rxb->vrp)
+		rpmsg_release_rx_buf(rxb);
+	else
+		rpmsg_omx_pool_put(omx, rxb);
+}
+
+static struct omx_ring_slot *
+rpmsg_omx_ring_slot(struct rpmsg_omx_instance *omx, bool tx, u32 idx)
+{
+	u32 num = omx->num_slots;
+	void *slots = omx->slots;
+
+	if (!tx)
+		slots += num * OMX_RING_SLOT_SIZE;
+
+	return slots + (idx & (num - 1)) * OMX_RING_SLOT_SIZE;
+}
+
+/* copy an inbound message to the next rx slot. must be called with ring_lock */
+static bool __rpmsg_omx_ring_rx(struct rpmsg_omx_instance *omx,
+						struct omx_msg_hdr *hdr, int len)
+{
+	struct omx_ring_slot *slot;
+	int use;
+
+	/* is the rx ring full ? */
+	if (omx->rx_head - ACCESS_ONCE(omx->ring->rx_tail) >= omx->num_slots)
+		return false;
+
+	/* only the OMX payload is propagated to the user */
+	use = min_t(int, len - sizeof(*hdr), hdr->len);
+	use = min_t(int, use, OMX_RING_SLOT_SIZE - sizeof(*slot));
+
+	slot = rpmsg_omx_ring_slot(omx, false, omx->rx_head);
+	memcpy(slot->data, hdr->data, use);
+	slot->len = use;
+
+	/* make sure the slot is written before the user can see it */
+	smp_wmb();
+	omx->ring->rx_head = ++omx->rx_head;
+
+	return true;
+}
+
+/* let the user know that poll() might have something new to say */
+static void rpmsg_omx_signal(struct rpmsg_omx_instance *omx)
+{
+	struct eventfd_ctx *efd = ACCESS_ONCE(omx->efd);
+
+	if (efd)
+		eventfd_signal(efd, 1);
+
+	wake_up_interruptible(&omx->readq);
+}
+
+/* invoked (possibly in an interrupt context) once tx space is available */
+static void rpmsg_omx_tx_ready(struct rpmsg_channel *rpdev, void *priv)
+{
+	rpmsg_omx_signal(priv);
+}
+
+/*
+ * reserve a tx buffer. if the user doesn't want to block, and there's
+ * no tx space right now, arrange for a notification once there is, and
+ * tell the user to try again then.
+ */
+static void *rpmsg_omx_alloc_tx_buf(struct rpmsg_omx_instance *omx, int len,
+								bool wait)
+{
+	struct rpmsg_omx_service *omxserv = omx->omxserv;
+	void *buf;
+
+	buf = rpmsg_alloc_tx_buf(omxserv->rpdev, len, wait);
+	if (!IS_ERR(buf))
+		return buf;
+
+	if (!wait && PTR_ERR(buf) == -ENOMEM) {
+		/* -EBUSY just means a notification is pending already */
+		rpmsg_tx_notify(omxserv->rpdev, &omx->tx_waiter);
+		return ERR_PTR(-EAGAIN);
+	}
+
+	dev_err(omxserv->dev, "rpmsg_alloc_tx_buf failed: %ld\n", PTR_ERR(buf));
+
+	return buf;
+}
+
+/* can a message be sent right now ? if not, notify the user once it can */
+static bool rpmsg_omx_writable(struct rpmsg_omx_instance *omx)
+{
+	void *buf;
+
+	buf = rpmsg_omx_alloc_tx_buf(omx, RPMSG_OMX_MAX_MSG, false);
+	if (IS_ERR(buf))
+		return false;
+
+	rpmsg_free_tx_buf(omx->omxserv->rpdev, buf);
+
+	return true;
+}
+
+/* set the eventfd of an instance. it can only be set once. */
+static int rpmsg_omx_set_eventfd(struct rpmsg_omx_instance *omx, int fd)
+{
+	struct eventfd_ctx *efd;
+
+	efd = eventfd_ctx_fdget(fd);
+	if (IS_ERR(efd))
+		return PTR_ERR(efd);
+
+	spin_lock(&omx->ring_lock);
+	if (omx->efd) {
+		spin_unlock(&omx->ring_lock);
+		eventfd_ctx_put(efd);
+		return -EBUSY;
+	}
+	omx->efd = efd;
+	spin_unlock(&omx->ring_lock);
+
+	return 0;
+}
+
+/*
+ * with an rx ring set up, inbound messages are copied straight to the user,
+ * unless older messages are still queued (because the ring was full), in
+ * which case the new message is queued behind them, to keep them in order.
+ */
+static bool rpmsg_omx_ring_rx(struct rpmsg_omx_instance *omx,
+						struct omx_msg_hdr *hdr, int len)
+{
+	bool done = false;
+
+	spin_lock(&omx->ring_lock);
+	if (omx->ring && kfifo_is_empty(&omx->queue))
+		done = __rpmsg_omx_ring_rx(omx, hdr, len);
+	spin_unlock(&omx->ring_lock);
+
+	return done;
+}
+
+/* move queued inbound messages to the rx slots the user has consumed since */
+static void rpmsg_omx_ring_flush_rx(struct rpmsg_omx_instance *omx)
+{
+	struct rpmsg_rx_buf *rxb, *tmp;
+	LIST_HEAD(moved);
+
+	mutex_lock(&omx->read_lock);
+	spin_lock(&omx->ring_lock);
+	while (kfifo_peek(&omx->queue, &rxb)) {
+		if (!__rpmsg_omx_ring_rx(omx, rxb->data, rxb->len))
+			break;
+		kfifo_skip(&omx->queue);
+		list_add_tail(&rxb->node, &moved);
+	}
+	spin_unlock(&omx->ring_lock);
+	mutex_unlock(&omx->read_lock);
+
+	if (list_empty(&moved))
+		return;
+
+	list_for_each_entry_safe(rxb, tmp, &moved, node) {
+		list_del(&rxb->node);
+		rpmsg_omx_free_msg(omx, rxb);
+	}
+
+	rpmsg_omx_signal(omx);
+}
+
+/*
+ * send the tx slots the user has published so far, as OMX_RAW_MSG messages,
+ * kicking the remote processor only once for all of them.
+ *
+ * Returns the number of messages sent, or an error if none could be sent.
+ */
+static int rpmsg_omx_ring_tx(struct rpmsg_omx_instance *omx, bool wait)
+{
+	struct rpmsg_omx_service *omxserv = omx->omxserv;
+	struct omx_ring_slot *slot;
+	struct omx_msg_hdr *hdr;
+	int use, sent = 0, ret = 0;
+	u32 head;
+
+	if (omx->state != OMX_CONNECTED)
+		return -ENOTCONN;
+
+	mutex_lock(&omx->tx_lock);
+
+	head = ACCESS_ONCE(omx->ring->tx_head);
+	/*
+	 * make sure the slots are read only after the head is (this also
+	 * pairs with the smp_wmb() that publishes the ring in ring_setup)
+	 */
+	smp_rmb();
+
+	/* the user can't be trusted to publish only the slots it has */
+	if (head - omx->tx_tail > omx->num_slots) {
+		dev_err(omxserv->dev, "invalid tx head: %u (tail %u)\n", head,
+								omx->tx_tail);
+		mutex_unlock(&omx->tx_lock);
+		return -EINVAL;
+	}
+
+	rpmsg_cork(omxserv->rpdev);
+
+	while (omx->tx_tail != head) {
+		slot = rpmsg_omx_ring_slot(omx, true, omx->tx_tail);
+
+		/* the user can't be trusted with the length either */
+		use = min_t(u32, ACCESS_ONCE(slot->len),
+				RPMSG_OMX_MAX_MSG - sizeof(*hdr));
+		use = min_t(int, use, OMX_RING_SLOT_SIZE - sizeof(*slot));
+
+		hdr = rpmsg_omx_alloc_tx_buf(omx, sizeof(*hdr) + use, wait);
+		if (IS_ERR(hdr)) {
+			ret = PTR_ERR(hdr);
+			break;
+		}
+
+		memcpy(hdr->data, slot->data, use);
+		hdr->type = OMX_RAW_MSG;
+		hdr->flags = 0;
+		hdr->len = use;
+
+		ret = rpmsg_send_prepared(omxserv->rpdev, omx->ept->addr,
+					omx->dst, hdr, sizeof(*hdr) + use);
+		if (ret) {
+			dev_err(omxserv->dev, "rpmsg_send failed: %d\n", ret);
+			break;
+		}
+
+		omx->ring->tx_tail = ++omx->tx_tail;
+		sent++;
+	}
+
+	rpmsg_uncork(omxserv->rpdev);
+
+	mutex_unlock(&omx->tx_lock);
+
+	return sent ? sent : ret;
+}
+
+static int rpmsg_omx_ring_setup(struct rpmsg_omx_instance *omx,
+					struct omx_ring_setup *setup)
+{
+	struct rpmsg_omx_service *omxserv = omx->omxserv;
+	struct omx_ring_ctrl *ring;
+	size_t size;
+	int ret;
+
+	if (!is_power_of_2(setup->num_slots) ||
+				setup->num_slots > OMX_RING_MAX_SLOTS) {
+		dev_err(omxserv->dev, "invalid num of slots: %u\n",
+							setup->num_slots);
+		return -EINVAL;
+	}
+
+	/* the eventfd stays set even if setting up the rings fails below */
+	if (setup->eventfd >= 0) {
+		ret = rpmsg_omx_set_eventfd(omx, setup->eventfd);
+		if (ret)
+			return ret;
+	}
+
+	size = PAGE_SIZE + 2 * setup->num_slots * OMX_RING_SLOT_SIZE;
+	size = PAGE_ALIGN(size);
+
+	ring = vmalloc_user(size);
+	if (!ring) {
+		dev_err(omxserv->dev, "failed to allocate rings: %zu\n", size);
+		return -ENOMEM;
+	}
+
+	ring->num_slots = setup->num_slots;
+	ring->slot_size = OMX_RING_SLOT_SIZE;
+
+	mutex_lock(&omx->lock);
+
+	if (omx->ring) {
+		mutex_unlock(&omx->lock);
+		vfree(ring);
+		return -EBUSY;
+	}
+
+	spin_lock(&omx->ring_lock);
+	omx->ring_size = size;
+	omx->num_slots = setup->num_slots;
+	omx->slots = (void *)ring + PAGE_SIZE;
+	/* the geometry must be visible before the ring is */
+	smp_wmb();
+	omx->ring = ring;
+	spin_unlock(&omx->ring_lock);
+
+	mutex_unlock(&omx->lock);
+
+	/* messages that were already queued go to the ring too */
+	rpmsg_omx_ring_flush_rx(omx);
+
+	return 0;
+}
+
+static int rpmsg_omx_send_buf_msg(struct rpmsg_omx_instance *omx, u32 type,
+						struct rpmsg_omx_buf *buf)
+{
+	struct rpmsg_omx_service *omxserv = omx->omxserv;
+	struct omx_msg_hdr *hdr;
+	struct omx_buf_msg *payload;
+	char kbuf[sizeof(*hdr) + sizeof(*payload)];
+	int ret;
+
+	hdr = (struct omx_msg_hdr *) kbuf;
+	hdr->type = type;
+	hdr->flags = 0;
+	hdr->len = sizeof(*payload);
+
+	payload = (struct omx_buf_msg *) hdr->data;
+	payload->id = buf->id;
+	payload->da = buf->da;
+	payload->size = buf->size;
+
+	ret = rpmsg_send_offchannel(omxserv->rpdev, omx->ept->addr, omx->dst,
+							kbuf, sizeof(kbuf));
+	if (ret)
+		dev_err(omxserv->dev, "rpmsg_send failed: %d\n", ret);
+
+	return ret;
+}
+
+/*
+ * share a buffer with the remote OMX instance, so it can access it directly.
+ * this is only allowed for buffers the remote processor has mapped anyway.
+ */
+static int rpmsg_omx_reg_buf(struct rpmsg_omx_instance *omx,
+						struct omx_buf *ubuf)
+{
+	struct rpmsg_omx_service *omxserv = omx->omxserv;
+	struct rpmsg_omx_buf *buf;
+	int ret;
+
+	/* physical addresses are only for the trusted */
+	if (!capable(CAP_SYS_RAWIO))
+		return -EPERM;
+
+	if (omx->state != OMX_CONNECTED)
+		return -ENOTCONN;
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	if ((phys_addr_t) ubuf->pa != ubuf->pa ||
+			rpmsg_pa_to_da(omxserv->rpdev, ubuf->pa, ubuf->size,
+								&buf->da)) {
+		dev_err(omxserv->dev, "buffer not accessible by remote: 0x%llx\n",
+							ubuf->pa);
+		kfree(buf);
+		return -EINVAL;
+	}
+
+	buf->size = ubuf->size;
+
+	mutex_lock(&omx->lock);
+	buf->id = omx->next_buf_id++;
+	list_add_tail(&buf->node, &omx->bufs);
+	mutex_unlock(&omx->lock);
+
+	ret = rpmsg_omx_send_buf_msg(omx, OMX_REG_BUF, buf);
+	if (ret) {
+		mutex_lock(&omx->lock);
+		list_del(&buf->node);
+		mutex_unlock(&omx->lock);
+		kfree(buf);
+		return ret;
+	}
+
+	ubuf->id = buf->id;
+	ubuf->da = buf->da;
+
+	return 0;
+}
+
+static int rpmsg_omx_unreg_buf(struct rpmsg_omx_instance *omx, u32 id)
+{
+	struct rpmsg_omx_buf *buf, *found = NULL;
+
+	mutex_lock(&omx->lock);
+	list_for_each_entry(buf, &omx->bufs, node) {
+		if (buf->id == id) {
+			list_del(&buf->node);
+			found = buf;
+			break;
+		}
+	}
+	mutex_unlock(&omx->lock);
+
+	if (!found)
+		return -ENOENT;
+
+	/* the buffer is forgotten locally regardless */
+	rpmsg_omx_send_buf_msg(omx, OMX_UNREG_BUF, found);
+	kfree(found);
+
+	return 0;
+}
+
+/*
+ * handle an inbound message. returns true if the user should be told
+ * about it (the caller does that, so a batch of messages costs one wakeup).
+ */
+static bool rpmsg_omx_rx(struct rpmsg_channel *rpdev,
+			struct rpmsg_omx_instance *omx, void *data, int len,
+			u32 src)
 {
 	struct omx_msg_hdr *hdr = data;
-	struct rpmsg_omx_instance *omx = priv;
 	struct omx_conn_rsp *rsp;
-	struct sk_buff *skb;
-	char *skbdata;
+	struct rpmsg_rx_buf *rxb;
+	const struct rpmsg_rx_buf *queued;
 
-	if (len < sizeof(*hdr) || hdr->len < len - sizeof(*hdr)) {
+	if (len < sizeof(*hdr) || hdr->len > len - sizeof(*hdr)) {
 		dev_warn(&rpdev->dev, "%s: truncated message\n", __func__);
-		return;
+		return false;
 	}
 
 	dev_dbg(&rpdev->dev, "%s: incoming msg src 0x%x type %d len %d\n",
 					__func__, src, hdr->type, hdr->len);
-	print_hex_dump(KERN_DEBUG, "rpmsg_omx RX: ", DUMP_PREFIX_NONE, 16, 1,
-		       data, len,  true);
 
 	switch (hdr->type) {
 	case OMX_CONN_RSP:
@@ -97,29 +663,108 @@ static void rpmsg_omx_cb(struct rpmsg_channel *rpdev, void *data, int len,
 		else
 			omx->state = OMX_CONNECTED;
 		complete(&omx->reply_arrived);
-		break;
+		/* let pollers of a non-blocking connect know it's done */
+		return true;
 	case OMX_RAW_MSG:
-		skb = alloc_skb(hdr->len, GFP_KERNEL);
-		if (!skb) {
-			dev_err(&rpdev->dev, "alloc_skb err: %u\n", hdr->len);
+		if (rpmsg_omx_ring_rx(omx, hdr, len))
+			return true;
+
+		/*
+		 * the reader is so far behind that it doesn't deserve more.
+		 * we're the only producer, so the queue can't fill up later.
+		 */
+		if (kfifo_is_full(&omx->queue)) {
+			dev_err(&rpdev->dev, "rx queue is full, msg dropped\n");
 			break;
 		}
-		skbdata = skb_put(skb, hdr->len);
-		memcpy(skbdata, hdr->data, hdr->len);
 
-		mutex_lock(&omx->lock);
-		skb_queue_tail(&omx->queue, skb);
-		mutex_unlock(&omx->lock);
+		/* hold on to the rx buffer only once the pool runs dry */
+		rxb = rpmsg_omx_copy_msg(omx, data, len, src);
+		if (!rxb)
+			rxb = rpmsg_hold_rx_buf(omx->ept, data);
+		if (!rxb) {
+			dev_err(&rpdev->dev, "failed to queue msg: %u\n",
+								hdr->len);
+			break;
+		}
+
+		/* kfifo_put() insists on a pointer to a const element */
+		queued = rxb;
+		kfifo_put(&omx->queue, &queued);
+
 		/* wake up any blocking processes, waiting for new data */
-		wake_up_interruptible(&omx->readq);
-		break;
+		return true;
 	default:
 		dev_warn(&rpdev->dev, "unexpected msg type: %d\n", hdr->type);
 		break;
 	}
+
+	return false;
+}
+
+static void rpmsg_omx_cb(struct rpmsg_channel *rpdev, void *data, int len,
+							void *priv, u32 src)
+{
+	struct rpmsg_omx_instance *omx = priv;
+
+	if (rpmsg_omx_rx(rpdev, omx, data, len, src))
+		rpmsg_omx_signal(omx);
+}
+
+/* readers are woken up once per batch of inbound messages */
+static void rpmsg_omx_batch_cb(struct rpmsg_channel *rpdev,
+			struct rpmsg_rx_msg *msgs, int num, void *priv)
+{
+	struct rpmsg_omx_instance *omx = priv;
+	bool signal = false;
+	int i;
+
+	for (i = 0; i < num; i++)
+		if (rpmsg_omx_rx(rpdev, omx, msgs[i].data, msgs[i].len,
+								msgs[i].src))
+			signal = true;
+
+	if (signal)
+		rpmsg_omx_signal(omx);
 }
 
-static int rpmsg_omx_connect(struct rpmsg_omx_instance *omx, char *omxname)
+/* wait for the outcome of a connection request that was already sent */
+static int rpmsg_omx_connect_wait(struct rpmsg_omx_instance *omx)
+{
+	int ret;
+
+	/* wait until a connection reply arrives or 5 seconds elapse */
+	ret = wait_for_completion_interruptible_timeout(&omx->reply_arrived,
+						msecs_to_jiffies(5000));
+	if (omx->state == OMX_CONNECTED)
+		return 0;
+
+	if (omx->state == OMX_FAIL)
+		return -ENXIO;
+
+	/* interrupted: the request is still pending, the user may wait again */
+	if (ret < 0)
+		return ret;
+
+	if (ret) {
+		dev_err(omx->omxserv->dev, "premature wakeup: %d\n", ret);
+		return -EIO;
+	}
+
+	/* give up on this request, so the user may send another one */
+	omx->state = OMX_UNCONNECTED;
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * connect to a remote OMX service. a non-blocking connect only sends the
+ * request and returns -EINPROGRESS; its completion is then reported by
+ * poll() (POLLOUT on success, POLLERR on failure), so the user can bring
+ * up many instances at once, without waiting for each reply in turn.
+ */
+static int rpmsg_omx_connect(struct rpmsg_omx_instance *omx, char *omxname,
+								bool nonblock)
 {
 	struct omx_msg_hdr *hdr;
 	struct omx_conn_req *payload;
@@ -132,6 +777,9 @@ static int rpmsg_omx_connect(struct rpmsg_omx_instance *omx, char *omxname)
 		return -EISCONN;
 	}
 
+	if (omx->state == OMX_CONNECTING)
+		return nonblock ? -EALREADY : rpmsg_omx_connect_wait(omx);
+
 	hdr = (struct omx_msg_hdr *)connect_msg;
 	hdr->type = OMX_CONN_REQ;
 	hdr->flags = 0;
@@ -140,6 +788,7 @@ static int rpmsg_omx_connect(struct rpmsg_omx_instance *omx, char *omxname)
 	strcpy(payload->name, omxname);
 
 	init_completion(&omx->reply_arrived);
+	omx->state = OMX_CONNECTING;
 
 	/* send a conn req to the remote OMX connection service. use
 	 * the new local address that was just allocated by ->open */
@@ -147,24 +796,14 @@ static int rpmsg_omx_connect(struct rpmsg_omx_instance *omx, char *omxname)
 			omxserv->rpdev->dst, connect_msg, sizeof(connect_msg));
 	if (ret) {
 		dev_err(omxserv->dev, "rpmsg_send failed: %d\n", ret);
+		omx->state = OMX_UNCONNECTED;
 		return ret;
 	}
 
-	/* wait until a connection reply arrives or 5 seconds elapse */
-	ret = wait_for_completion_interruptible_timeout(&omx->reply_arrived,
-						msecs_to_jiffies(5000));
-	if (omx->state == OMX_CONNECTED)
-		return 0;
+	if (nonblock)
+		return -EINPROGRESS;
 
-	if (omx->state == OMX_FAIL)
-		return -ENXIO;
-
-	if (ret) {
-		dev_err(omxserv->dev, "premature wakeup: %d\n", ret);
-		return -EIO;
-	}
-
-	return -ETIMEDOUT;
+	return rpmsg_omx_connect_wait(omx);
 }
 
 static
@@ -172,8 +811,11 @@ long rpmsg_omx_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	struct rpmsg_omx_instance *omx = filp->private_data;
 	struct rpmsg_omx_service *omxserv = omx->omxserv;
+	struct omx_ring_setup setup;
+	struct omx_buf obuf;
 	char buf[48];
-	int ret = 0;
+	u32 id;
+	int fd, ret = 0;
 
 	dev_dbg(omxserv->dev, "%s: cmd %d, arg 0x%lx\n", __func__, cmd, arg);
 
@@ -192,7 +834,49 @@ long rpmsg_omx_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		/* make sure user input is null terminated */
 		buf[sizeof(buf) - 1] = '\0';
-		ret = rpmsg_omx_connect(omx, buf);
+		ret = rpmsg_omx_connect(omx, buf, filp->f_flags & O_NONBLOCK);
+		break;
+	case OMX_IOCRINGSETUP:
+		if (copy_from_user(&setup, (void __user *) arg, sizeof(setup))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = rpmsg_omx_ring_setup(omx, &setup);
+		break;
+	case OMX_IOCRINGKICK:
+		if (!omx->ring) {
+			ret = -EINVAL;
+			break;
+		}
+		rpmsg_omx_ring_flush_rx(omx);
+		ret = rpmsg_omx_ring_tx(omx, !(filp->f_flags & O_NONBLOCK));
+		break;
+	case OMX_IOCFRAMED:
+		omx->framed = !!arg;
+		break;
+	case OMX_IOCREGBUF:
+		if (copy_from_user(&obuf, (void __user *) arg, sizeof(obuf))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = rpmsg_omx_reg_buf(omx, &obuf);
+		if (!ret && copy_to_user((void __user *) arg, &obuf,
+								sizeof(obuf)))
+			ret = -EFAULT;
+		break;
+	case OMX_IOCUNREGBUF:
+		if (get_user(id, (u32 __user *) arg)) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = rpmsg_omx_unreg_buf(omx, id);
+		break;
+	case OMX_IOCEVENTFD:
+		if (get_user(fd, (int __user *) arg)) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = rpmsg_omx_set_eventfd(omx, fd);
 		break;
 	default:
 		dev_warn(omxserv->dev, "unhandled ioctl cmd: %d\n", cmd);
@@ -213,8 +897,18 @@ static int rpmsg_omx_open(struct inode *inode, struct file *filp)
 	if (!omx)
 		return -ENOMEM;
 
+	if (rpmsg_omx_pool_init(omx)) {
+		kfree(omx);
+		return -ENOMEM;
+	}
+
 	mutex_init(&omx->lock);
-	skb_queue_head_init(&omx->queue);
+	mutex_init(&omx->tx_lock);
+	mutex_init(&omx->read_lock);
+	spin_lock_init(&omx->ring_lock);
+	INIT_KFIFO(omx->queue);
+	rpmsg_init_tx_waiter(&omx->tx_waiter, rpmsg_omx_tx_ready, omx);
+	INIT_LIST_HEAD(&omx->bufs);
 	init_waitqueue_head(&omx->readq);
 	omx->omxserv = omxserv;
 	omx->state = OMX_UNCONNECTED;
@@ -224,10 +918,18 @@ static int rpmsg_omx_open(struct inode *inode, struct file *filp)
 							RPMSG_ADDR_ANY);
 	if (!omx->ept) {
 		dev_err(omxserv->dev, "create ept failed\n");
+		kfree(omx->pool);
 		kfree(omx);
 		return -ENOMEM;
 	}
 
+	/* we'd like to hand inbound messages to readers without copying */
+	omx->ept->flags |= RPMSG_EPT_HOLD_RX;
+
+	/* bursts of inbound messages should only wake up the readers once */
+	if (rpmsg_set_batch_cb(omx->ept, rpmsg_omx_batch_cb))
+		dev_warn(omxserv->dev, "no batch rx, falling back to single\n");
+
 	/* associate filp with the new omx instance */
 	filp->private_data = omx;
 
@@ -243,10 +945,10 @@ static int rpmsg_omx_release(struct inode *inode, struct file *filp)
 	char kbuf[512];
 	struct omx_msg_hdr *hdr = (struct omx_msg_hdr *) kbuf;
 	struct omx_disc_req *disc_req = (struct omx_disc_req *)hdr->data;
+	struct rpmsg_rx_buf *rxb;
+	struct rpmsg_omx_buf *buf, *btmp;
 	int use, ret;
 
-	/* todo: release resources here */
-
 	/* send a disconnect msg with the OMX instance addr */
 	hdr->type = OMX_DISCONNECT;
 	hdr->flags = 0;
@@ -265,63 +967,151 @@ static int rpmsg_omx_release(struct inode *inode, struct file *filp)
 		return ret;
 	}
 
+	rpmsg_tx_notify_cancel(omxserv->rpdev, &omx->tx_waiter);
 	rpmsg_destroy_ept(omx->ept);
+
+	/* give back the messages no one has read */
+	while (kfifo_get(&omx->queue, &rxb))
+		rpmsg_omx_free_msg(omx, rxb);
+
+	/* the remote releases the shared buffers when the instance goes away */
+	list_for_each_entry_safe(buf, btmp, &omx->bufs, node) {
+		list_del(&buf->node);
+		kfree(buf);
+	}
+
+	vfree(omx->ring);
+	if (omx->efd)
+		eventfd_ctx_put(omx->efd);
+
+	kfree(omx->pool);
 	kfree(omx);
 
 	return 0;
 }
 
+/* the length of an inbound message's OMX payload, as given to the user */
+static int rpmsg_omx_payload_len(struct rpmsg_rx_buf *rxb)
+{
+	struct omx_msg_hdr *hdr = rxb->data;
+
+	return min_t(int, rxb->len - sizeof(*hdr), hdr->len);
+}
+
+/*
+ * framed read: dequeue as many complete messages as fit in @len bytes
+ * (but at least one), and copy them to the user only after dropping the
+ * lock, so page faults don't hold up the rx callback.
+ * must be called with omx->read_lock, which is released.
+ */
+static ssize_t rpmsg_omx_read_frames(struct rpmsg_omx_instance *omx,
+					char __user *buf, size_t len)
+{
+	struct rpmsg_rx_buf *rxb, *tmp;
+	struct omx_msg_hdr *hdr;
+	LIST_HEAD(batch);
+	size_t need, off = 0;
+	ssize_t ret;
+	u32 use;
+
+	while (kfifo_peek(&omx->queue, &rxb)) {
+		need = OMX_FRAME_SIZE(rpmsg_omx_payload_len(rxb));
+		if (off + need > len)
+			break;
+		kfifo_skip(&omx->queue);
+		list_add_tail(&rxb->node, &batch);
+		off += need;
+	}
+
+	mutex_unlock(&omx->read_lock);
+
+	/* the user buffer can't hold even a single message */
+	if (list_empty(&batch))
+		return -EMSGSIZE;
+
+	ret = off;
+	off = 0;
+
+	list_for_each_entry_safe(rxb, tmp, &batch, node) {
+		hdr = rxb->data;
+		use = rpmsg_omx_payload_len(rxb);
+
+		if (ret >= 0 && (copy_to_user(buf + off, &use, sizeof(use)) ||
+			copy_to_user(buf + off + sizeof(use), hdr->data, use)))
+			ret = -EFAULT;
+
+		off += OMX_FRAME_SIZE(use);
+
+		list_del(&rxb->node);
+		rpmsg_omx_free_msg(omx, rxb);
+	}
+
+	return ret;
+}
+
 static ssize_t rpmsg_omx_read(struct file *filp, char __user *buf,
 						size_t len, loff_t *offp)
 {
 	struct rpmsg_omx_instance *omx = filp->private_data;
-	struct sk_buff *skb;
+	struct rpmsg_rx_buf *rxb;
+	struct omx_msg_hdr *hdr;
 	int use;
 
 	if (omx->state != OMX_CONNECTED)
 		return -ENOTCONN;
 
-	if (mutex_lock_interruptible(&omx->lock))
+	/* readers only ever contend with each other, never with the producer */
+	if (mutex_lock_interruptible(&omx->read_lock))
 		return -ERESTARTSYS;
 
 	/* nothing to read ? */
-	if (skb_queue_empty(&omx->queue)) {
-		mutex_unlock(&omx->lock);
+	while (kfifo_is_empty(&omx->queue)) {
+		mutex_unlock(&omx->read_lock);
 		/* non-blocking requested ? return now */
 		if (filp->f_flags & O_NONBLOCK)
 			return -EAGAIN;
 		/* otherwise block, and wait for data */
 		if (wait_event_interruptible(omx->readq,
-				!skb_queue_empty(&omx->queue)))
+				!kfifo_is_empty(&omx->queue)))
 			return -ERESTARTSYS;
-		if (mutex_lock_interruptible(&omx->lock))
+		/* another reader may have beaten us to it, so check again */
+		if (mutex_lock_interruptible(&omx->read_lock))
 			return -ERESTARTSYS;
 	}
 
-	skb = skb_dequeue(&omx->queue);
-	if (!skb) {
-		dev_err(omx->omxserv->dev, "err is rmpsg_omx racy ?\n");
-		return -EFAULT;
-	}
+	if (omx->framed)
+		return rpmsg_omx_read_frames(omx, buf, len);
 
-	mutex_unlock(&omx->lock);
+	if (!kfifo_get(&omx->queue, &rxb))
+		rxb = NULL;
 
-	use = min(len, skb->len);
+	mutex_unlock(&omx->read_lock);
 
-	if (copy_to_user(buf, skb->data, use))
+	if (!rxb)
+		return -EFAULT;
+
+	/* only the OMX payload is propagated to the user */
+	hdr = rxb->data;
+	use = min_t(size_t, len, rpmsg_omx_payload_len(rxb));
+
+	if (copy_to_user(buf, hdr->data, use))
 		use = -EFAULT;
 
-	kfree_skb(skb);
+	rpmsg_omx_free_msg(omx, rxb);
 	return use;
 }
 
-static ssize_t rpmsg_omx_write(struct file *filp, const char __user *ubuf,
-						size_t len, loff_t *offp)
+/*
+ * send the payload described by @iov as a single OMX_RAW_MSG, gathering it
+ * from user space directly into a shared tx buffer (so it's copied only once)
+ */
+static ssize_t rpmsg_omx_send_iov(struct rpmsg_omx_instance *omx,
+		const struct iovec *iov, unsigned long nr_segs, bool wait)
 {
-	struct rpmsg_omx_instance *omx = filp->private_data;
 	struct rpmsg_omx_service *omxserv = omx->omxserv;
-	char kbuf[512];
-	struct omx_msg_hdr *hdr = (struct omx_msg_hdr *) kbuf;
+	struct omx_msg_hdr *hdr;
+	unsigned long seg;
+	size_t chunk, off;
 	int use, ret;
 
 	if (omx->state != OMX_CONNECTED)
@@ -329,16 +1119,20 @@ static ssize_t rpmsg_omx_write(struct file *filp, const char __user *ubuf,
 
 	/*
 	 * for now, limit msg size to 512 bytes (incl. header).
-	 * (note: rpmsg's limit is even tighter. this whole thing needs fixing)
 	 */
-	use = min(sizeof(kbuf) - sizeof(*hdr), len);
+	use = min(RPMSG_OMX_MAX_MSG - sizeof(*hdr), iov_length(iov, nr_segs));
 
-	/*
-	 * copy the data. Later, number of copies can be optimized if found to
-	 * be significant in real use cases
-	 */
-	if (copy_from_user(hdr->data, ubuf, use))
-		return -EMSGSIZE;
+	hdr = rpmsg_omx_alloc_tx_buf(omx, sizeof(*hdr) + use, wait);
+	if (IS_ERR(hdr))
+		return PTR_ERR(hdr);
+
+	for (seg = 0, off = 0; seg < nr_segs && off < use; seg++, off += chunk) {
+		chunk = min_t(size_t, iov[seg].iov_len, use - off);
+		if (copy_from_user(hdr->data + off, iov[seg].iov_base, chunk)) {
+			rpmsg_free_tx_buf(omxserv->rpdev, hdr);
+			return -EMSGSIZE;
+		}
+	}
 
 	hdr->type = OMX_RAW_MSG;
 	hdr->flags = 0;
@@ -346,8 +1140,8 @@ static ssize_t rpmsg_omx_write(struct file *filp, const char __user *ubuf,
 
 	use += sizeof(*hdr);
 
-	ret = rpmsg_send_offchannel(omxserv->rpdev, omx->ept->addr,
-						omx->dst, kbuf, use);
+	ret = rpmsg_send_prepared(omxserv->rpdev, omx->ept->addr,
+						omx->dst, hdr, use);
 	if (ret) {
 		dev_err(omxserv->dev, "rpmsg_send failed: %d\n", ret);
 		return ret;
@@ -356,27 +1150,163 @@ static ssize_t rpmsg_omx_write(struct file *filp, const char __user *ubuf,
 	return use;
 }
 
+/*
+ * framed write: send every struct omx_frame in @ubuf as an OMX_RAW_MSG.
+ * the caller is expected to cork the channel, so the remote processor is
+ * kicked only once for the whole batch.
+ *
+ * Returns the number of bytes consumed, or an error if no message was sent.
+ */
+static ssize_t rpmsg_omx_send_frames(struct rpmsg_omx_instance *omx,
+			const char __user *ubuf, size_t len, bool wait)
+{
+	struct rpmsg_omx_service *omxserv = omx->omxserv;
+	struct omx_msg_hdr *hdr;
+	size_t off = 0;
+	int ret = 0;
+	u32 use;
+
+	while (off < len) {
+		if (len - off < sizeof(use) ||
+				copy_from_user(&use, ubuf + off, sizeof(use))) {
+			ret = -EINVAL;
+			break;
+		}
+
+		/* frames must be complete (the last one may lack padding) */
+		if (use > RPMSG_OMX_MAX_MSG - sizeof(*hdr) ||
+					sizeof(use) + use > len - off) {
+			ret = -EMSGSIZE;
+			break;
+		}
+
+		hdr = rpmsg_omx_alloc_tx_buf(omx, sizeof(*hdr) + use, wait);
+		if (IS_ERR(hdr)) {
+			ret = PTR_ERR(hdr);
+			break;
+		}
+
+		if (copy_from_user(hdr->data, ubuf + off + sizeof(use), use)) {
+			rpmsg_free_tx_buf(omxserv->rpdev, hdr);
+			ret = -EFAULT;
+			break;
+		}
+
+		hdr->type = OMX_RAW_MSG;
+		hdr->flags = 0;
+		hdr->len = use;
+
+		ret = rpmsg_send_prepared(omxserv->rpdev, omx->ept->addr,
+					omx->dst, hdr, sizeof(*hdr) + use);
+		if (ret) {
+			dev_err(omxserv->dev, "rpmsg_send failed: %d\n", ret);
+			break;
+		}
+
+		off += min(OMX_FRAME_SIZE(use), len - off);
+	}
+
+	return off ? off : ret;
+}
+
+static ssize_t rpmsg_omx_send_framed(struct rpmsg_omx_instance *omx,
+		const struct iovec *iov, unsigned long nr_segs, bool wait)
+{
+	struct rpmsg_channel *rpdev = omx->omxserv->rpdev;
+	ssize_t ret = 0, done = 0;
+	unsigned long seg;
+
+	if (omx->state != OMX_CONNECTED)
+		return -ENOTCONN;
+
+	rpmsg_cork(rpdev);
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		ret = rpmsg_omx_send_frames(omx, iov[seg].iov_base,
+						iov[seg].iov_len, wait);
+		if (ret < 0)
+			break;
+		done += ret;
+		/* stop at the first segment that wasn't sent in full */
+		if (ret < iov[seg].iov_len)
+			break;
+	}
+
+	rpmsg_uncork(rpdev);
+
+	return done ? done : ret;
+}
+
+static ssize_t rpmsg_omx_write(struct file *filp, const char __user *ubuf,
+						size_t len, loff_t *offp)
+{
+	struct rpmsg_omx_instance *omx = filp->private_data;
+	struct iovec iov = { .iov_base = (void __user *) ubuf, .iov_len = len };
+	bool wait = !(filp->f_flags & O_NONBLOCK);
+
+	if (omx->framed)
+		return rpmsg_omx_send_framed(omx, &iov, 1, wait);
+
+	return rpmsg_omx_send_iov(omx, &iov, 1, wait);
+}
+
+/*
+ * writev() gathers all of its segments into a single message (in framed
+ * mode, every segment carries its own frames instead)
+ */
+static ssize_t rpmsg_omx_aio_write(struct kiocb *iocb, const struct iovec *iov,
+					unsigned long nr_segs, loff_t pos)
+{
+	struct rpmsg_omx_instance *omx = iocb->ki_filp->private_data;
+	bool wait = !(iocb->ki_filp->f_flags & O_NONBLOCK);
+
+	if (omx->framed)
+		return rpmsg_omx_send_framed(omx, iov, nr_segs, wait);
+
+	return rpmsg_omx_send_iov(omx, iov, nr_segs, wait);
+}
+
 static
 unsigned int rpmsg_poll(struct file *filp, struct poll_table_struct *wait)
 {
 	struct rpmsg_omx_instance *omx = filp->private_data;
 	unsigned int mask = 0;
 
-	if (mutex_lock_interruptible(&omx->lock))
-		return -ERESTARTSYS;
-
 	poll_wait(filp, &omx->readq, wait);
 
-	if (!skb_queue_empty(&omx->queue))
+	if (!kfifo_is_empty(&omx->queue))
 		mask |= POLLIN | POLLRDNORM;
 
-	/* implement missing rpmsg virtio functionality here */
-	if (true)
+	spin_lock(&omx->ring_lock);
+	if (omx->ring && omx->rx_head != ACCESS_ONCE(omx->ring->rx_tail))
+		mask |= POLLIN | POLLRDNORM;
+	spin_unlock(&omx->ring_lock);
+
+	/*
+	 * a pending connect is reported by POLLOUT (or POLLERR), and once
+	 * connected, POLLOUT means a message can be sent without blocking
+	 */
+	if (omx->state == OMX_FAIL)
+		mask |= POLLERR;
+	else if (omx->state != OMX_CONNECTING &&
+		(omx->state != OMX_CONNECTED || rpmsg_omx_writable(omx)))
 		mask |= POLLOUT | POLLWRNORM;
 
+	return mask;
+}
+
+/* map the message rings, which must have been set up with OMX_IOCRINGSETUP */
+static int rpmsg_omx_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct rpmsg_omx_instance *omx = filp->private_data;
+	int ret = -EINVAL;
+
+	mutex_lock(&omx->lock);
+	if (omx->ring)
+		ret = remap_vmalloc_range(vma, omx->ring, vma->vm_pgoff);
 	mutex_unlock(&omx->lock);
 
-	return mask;
+	return ret;
 }
 
 static const struct file_operations rpmsg_omx_fops = {
@@ -385,7 +1315,9 @@ static const struct file_operations rpmsg_omx_fops = {
 	.unlocked_ioctl	= rpmsg_omx_ioctl,
 	.read		= rpmsg_omx_read,
 	.write		= rpmsg_omx_write,
+	.aio_write	= rpmsg_omx_aio_write,
 	.poll		= rpmsg_poll,
+	.mmap		= rpmsg_omx_mmap,
 	.owner		= THIS_MODULE,
 };
 
@@ -27,29 +27,200 @@
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <linux/idr.h>
+#include <linux/rcupdate.h>
+#include <linux/srcu.h>
 #include <linux/jiffies.h>
 #include <linux/sched.h>
 #include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/genalloc.h>
+#include <linux/percpu.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/seq_file.h>
 #include <linux/rpmsg.h>
+#include <linux/remoteproc.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/rpmsg.h>
+
+/* the platform-specific backends trace their notifications, too */
+EXPORT_TRACEPOINT_SYMBOL(rpmsg_notify);
+
+/* number of buckets of the log2 latency histograms (the last one is open) */
+#define RPMSG_HIST_BUCKETS		(16)
+
+/**
+ * struct rpmsg_hist - a log2 histogram of latencies
+ * @bucket: bucket 0 counts latencies below 1 usec, bucket i counts latencies
+ *	    of [2^(i-1), 2^i) usecs, and the last one counts all the longer ones
+ */
+struct rpmsg_hist {
+	unsigned long bucket[RPMSG_HIST_BUCKETS];
+};
+
+/* number of records in the message capture ring (must be a power of two) */
+#define RPMSG_CAPTURE_RECS		(256)
+
+/* max number of payload bytes recorded per captured message */
+#define RPMSG_CAPTURE_BYTES		(32)
+
+/**
+ * struct rpmsg_capture_rec - a message recorded by the capture ring
+ * @seq:	sequence number of the message plus one (0 while the record is
+ *		being written)
+ * @tx:		whether the message was sent or received
+ * @copied:	number of payload bytes recorded in @data
+ * @ts:		when the message was sent or received
+ * @src:	source address of the message
+ * @dst:	destination address of the message
+ * @len:	length of the message's payload
+ * @data:	the first @copied bytes of the payload
+ */
+struct rpmsg_capture_rec {
+	u32 seq;
+	bool tx;
+	u8 copied;
+	u16 len;
+	ktime_t ts;
+	u32 src;
+	u32 dst;
+	u8 data[RPMSG_CAPTURE_BYTES];
+};
+
+/* number of buckets of the channels hash (must be a power of two) */
+#define RPMSG_CHANNEL_HASH_SIZE		(64)
+
+/* number of buckets of the tx credits hash (must be a power of two) */
+#define RPMSG_CREDIT_HASH_SIZE		(16)
 
 /**
  * struct virtproc_info - virtual remote processor state
  * @vdev:	the virtio device
- * @rvq:	rx virtqueue (from pov of local processor)
- * @svq:	tx virtqueue (from pov of local processor)
+ * @rvq:	rx virtqueues (from pov of local processor), one per traffic class
+ * @svq:	tx virtqueues (from pov of local processor), one per traffic class
+ * @num_vq_pairs: number of traffic classes (i.e. rx/tx virtqueue pairs) the
+ *		remote processor supports: 2 with VIRTIO_RPMSG_F_PRIO, else 1
  * @rbufs:	address of rx buffers
  * @sbufs:	address of tx buffers
- * @last_sbuf:	index of last tx buffer used
+ * @tx_pools:	per-cpu allocators of variable-size tx buffers, carved out of
+ *		@sbufs (each pool owns a contiguous slice of it)
+ * @num_tx_pools: number of tx pools
+ * @tx_pool_size: size of the slice of @sbufs owned by each tx pool
+ * @tx_caches:	per-cpu caches of free small tx buffers, taken from @tx_pools
+ * @tx_urgent_pool: allocator of the tx space reserved for urgent messages
+ *		    (the slice of @sbufs after those of @tx_pools), or NULL
+ * @tx_urgent_size: size of the tx space reserved for urgent messages
+ * @tx_max_size: largest tx buffer (including the rpmsg header) we allow
  * @phys_base:	physical base addr of the buffers
- * @tx_lock:	protects svq, sbufs and sleepers, to allow concurrent senders
+ * @cache_ops:	cache maintenance ops, if the buffers are mapped cacheable
+ * @mem_maps:	the remote processor's memory mappings, or NULL if it has none
+ * @pm_ops:	power management ops, if the remote processor may be suspended
+ * @tx_resuming: the remote processor is being resumed, so kicks are deferred
+ *		 until @resume_work is done (protected by @tx_lock)
+ * @resume_work: resumes the remote processor, and then kicks it
+ * @tx_resumes:	number of times the remote processor was resumed to send
+ * @crashed:	the remote processor crashed, and is being recovered, so nothing
+ *		is sent meanwhile (protected by @tx_lock)
+ * @recoveries:	number of times the remote processor was recovered from a crash
+ * @hdr_off:	offset of the on-the-wire header within a buffer: 0, or, with
+ *		compact headers, the size of the fields they omit (see struct
+ *		rpmsg_hdr_compact)
+ * @tx_lock:	protects svq, to allow concurrent senders (taken from the vq
+ *		callbacks and by senders in interrupt context, so with the
+ *		local interrupts disabled)
+ * @tx_kicking:	a sender is currently notifying the remote processor
+ * @tx_kick_again: buffers were added while @tx_kicking, so kick once more
+ * @tx_unkicked: number of tx buffers added to each svq but not yet kicked
+ * @tx_inflight: number of tx buffers handed over to the remote processor,
+ *		 and not yet reclaimed (protected by @tx_lock)
+ * @tx_reserved: number of tx buffers allocated by senders, but not yet sent
+ * @tx_bytes_used: number of bytes currently allocated out of the tx pools
+ *		(including the buffers sitting in @tx_caches)
+ * @tx_add_errors: number of tx buffers that couldn't be added to svq
+ * @tx_msgs:	number of messages sent (protected by @tx_lock, like the
+ *		rest of the tx statistics below)
+ * @tx_bytes:	number of payload bytes sent
+ * @tx_kicks:	number of times the remote processor was notified
+ * @tx_waits:	number of times senders had to sleep waiting for a tx buffer
+ * @tx_wait_us:	total time senders spent sleeping waiting for a tx buffer
+ * @tx_lat:	histogram of the time it takes to send a message, from the
+ *		send call until the message is handed over to the remote
+ *		processor (including waiting for a tx buffer)
  * @num_bufs:	total number of buffers allocated for communicating with this
  *		virtual remote processor. half is used for rx and half for tx.
  * @buf_size:	size of buffers allocated for communications
  * @endpoints:	idr of local endpoints, allows fast retrieval
- * @endpoints_lock: lock of the endpoints set
- * @sendq:	wait queue of sending contexts waiting for a tx buffers
+ * @endpoints_lock: serializes updates of the endpoints set (lookups use rcu)
+ * @ept_srcu:	lets rpmsg_destroy_ept() wait for in-flight rx callbacks
+ * @sendq:	wait queue of sending contexts waiting for a tx buffers (or
+ *		credits); tx buffer waiters sleep exclusively
  * @sleepers:	number of senders that are waiting for a tx buffer
+ * @tx_waiters:	senders that asked to be notified when tx space is available
+ * @tx_waiters_lock: protects @tx_waiters (taken from the tx-complete vq
+ *		callback, so with the local interrupts disabled)
  * @ns_ept:	the bus's name service endpoint
+ * @ns_work:	creates/destroys the channels of name service announcements
+ * @ns_pending:	name service announcements waiting for @ns_work
+ * @ns_lock:	protects @ns_pending and @ns_stopped
+ * @ns_stopped:	the vproc is going away, so announcements are ignored
+ * @credit_ept:	the bus's flow control credits endpoint, if the remote
+ *		processor supports VIRTIO_RPMSG_F_CREDITS
+ * @tx_credits:	hash of the credits the remote processor granted us, by the
+ *		address of its flow-controlled endpoints
+ * @credits_lock: protects @tx_credits
+ * @channels:	hash of the channels of this vproc, by name and dst address
+ * @channels_lock: protects @channels
+ * @rx_lock:	serializes the consumers of the rx virtqueue
+ * @rvq_lock:	protects rvq and the rx buffers hold accounting, so rx buffers
+ *		can be given back while inbound messages are being processed
+ * @rx_resetting: the rx virtqueues are being reset, so released rx buffers
+ *		are given back to the remote processor only afterwards
+ *		(protected by @rvq_lock)
+ * @rx_stopped:	inbound messages aren't dispatched anymore, so rx
+ *		notifications are ignored (protected by @rvq_lock)
+ * @rx_bufs:	per rx buffer state, used to let endpoints hold rx buffers
+ * @num_hi_rx_bufs: number of rx buffers (the first ones) dedicated to the
+ *		high priority rx virtqueue
+ * @rx_held:	number of rx buffers currently held by endpoints
+ * @rx_hold_max: default max number of rx buffers a single endpoint may hold
+ * @rx_slots:	the messages of the current rx run, in dispatch order
+ * @rx_wq:	dedicated workqueue in which inbound messages are dispatched
+ * @rx_work:	drains the rx virtqueue (from @rx_wq)
+ * @rx_thread:	real-time kthread in which inbound messages are dispatched,
+ *		instead of @rx_wq (see the rx_rt_prio module parameter)
+ * @rx_pending:	tells @rx_thread there might be inbound messages to process
+ * @rx_coalesce_us: see the rx_coalesce_us module parameter
+ * @rx_coalesce_msgs: see the rx_coalesce_msgs module parameter
+ * @rx_calls:	number of times the rx virtqueue was drained
+ * @rx_msgs:	number of inbound messages processed
+ * @rx_max_batch: largest number of messages processed in a single run
+ * @rx_bytes:	number of inbound payload bytes processed
+ * @rx_dropped:	number of inbound messages that had no recipient (or were
+ *		malformed)
+ * @rx_kicks:	number of times the remote processor notified us (protected
+ *		by @rvq_lock)
+ * @rx_irq_time: when the oldest notification that wasn't handled yet was
+ *		received, or 0 if there is none (protected by @rvq_lock)
+ * @rx_run_time: when the notification the current rx run serves was received
+ * @rx_lat:	histogram of the time from the notification of the remote
+ *		processor until the rx callback is invoked
+ * @rx_frags:	inbound fragmented messages being reassembled, oldest first
+ * @num_rx_frags: number of messages in @rx_frags
+ * @rx_frag_bytes: number of bytes reassembled so far in @rx_frags
+ * @rx_batches:	endpoints with messages pending delivery to their batch
+ *		callback in the current rx run
+ * @dbg_dir:	debugfs directory of this virtual remote processor
+ * @capture:	ring of the most recently sent/received messages, or NULL
+ * @capture_head: sequence number of the next message to capture
+ * @capture_len: number of payload bytes to capture per message (0 disables
+ *		capturing; set via debugfs)
  *
  * This structure stores the rpmsg state of a given virtio remote processor
  * device (there might be several virtio proc devices for each physical
@@ -57,18 +228,135 @@
  */
 struct virtproc_info {
 	struct virtio_device *vdev;
-	struct virtqueue *rvq, *svq;
+	struct virtqueue *rvq[RPMSG_PRIO_MAX], *svq[RPMSG_PRIO_MAX];
+	int num_vq_pairs;
 	void *rbufs, *sbufs;
-	int last_sbuf;
+	struct gen_pool **tx_pools;
+	int num_tx_pools;
+	int tx_pool_size;
+	struct rpmsg_tx_cache __percpu *tx_caches;
+	struct gen_pool *tx_urgent_pool;
+	int tx_urgent_size;
+	int tx_max_size;
 	phys_addr_t phys_base;
+	const struct rpmsg_cache_ops *cache_ops;
+	const struct rproc_mem_entry *mem_maps;
+	const struct rpmsg_pm_ops *pm_ops;
+	bool tx_resuming;
+	struct work_struct resume_work;
+	unsigned long tx_resumes;
+	bool crashed;
+	unsigned long recoveries;
+	int hdr_off;
 	spinlock_t tx_lock;
+	bool tx_kicking;
+	bool tx_kick_again;
+	int tx_unkicked[RPMSG_PRIO_MAX];
+	int tx_inflight;
+	atomic_t tx_reserved;
+	atomic_t tx_bytes_used;
+	unsigned long tx_add_errors;
+	unsigned long tx_msgs;
+	unsigned long tx_bytes;
+	unsigned long tx_kicks;
+	unsigned long tx_waits;
+	u64 tx_wait_us;
+	struct rpmsg_hist tx_lat;
 	int num_bufs;
 	int buf_size;
 	struct idr endpoints;
 	spinlock_t endpoints_lock;
+	struct srcu_struct ept_srcu;
 	wait_queue_head_t sendq;
-	int sleepers;
+	atomic_t sleepers;
+	struct list_head tx_waiters;
+	spinlock_t tx_waiters_lock;
 	struct rpmsg_endpoint *ns_ept;
+	struct work_struct ns_work;
+	struct list_head ns_pending;
+	spinlock_t ns_lock;
+	bool ns_stopped;
+	struct rpmsg_endpoint *credit_ept;
+	struct hlist_head tx_credits[RPMSG_CREDIT_HASH_SIZE];
+	spinlock_t credits_lock;
+	struct hlist_head channels[RPMSG_CHANNEL_HASH_SIZE];
+	spinlock_t channels_lock;
+	struct mutex rx_lock;
+	spinlock_t rvq_lock;
+	bool rx_resetting;
+	bool rx_stopped;
+	struct rpmsg_rx_buf *rx_bufs;
+	int num_hi_rx_bufs;
+	int rx_held;
+	int rx_hold_max;
+	struct rpmsg_rx_slot *rx_slots;
+	struct workqueue_struct *rx_wq;
+	struct work_struct rx_work;
+	struct task_struct *rx_thread;
+	unsigned long rx_pending;
+	u32 rx_coalesce_us;
+	u32 rx_coalesce_msgs;
+	unsigned long rx_calls;
+	unsigned long rx_msgs;
+	unsigned int rx_max_batch;
+	unsigned long rx_bytes;
+	unsigned long rx_dropped;
+	unsigned long rx_kicks;
+	ktime_t rx_irq_time;
+	ktime_t rx_run_time;
+	struct rpmsg_hist rx_lat;
+	struct list_head rx_frags;
+	struct list_head rx_batches;
+	int num_rx_frags;
+	int rx_frag_bytes;
+	struct dentry *dbg_dir;
+	struct rpmsg_capture_rec *capture;
+	atomic_t capture_head;
+	u32 capture_len;
+};
+
+/**
+ * struct rpmsg_rx_slot - an inbound message pending dispatch
+ * @msg:	the message
+ * @dst:	its destination address
+ * @seq:	its position in the rx virtqueue
+ * @round:	its position among the pending messages of the same endpoint
+ */
+struct rpmsg_rx_slot {
+	struct rpmsg_hdr *msg;
+	u32 dst;
+	u16 seq;
+	u16 round;
+};
+
+/**
+ * struct rpmsg_frag - an inbound fragmented message being reassembled
+ * @node:	link in the vproc's list of messages being reassembled
+ * @src:	source address of the message
+ * @dst:	destination address of the message
+ * @len:	number of payload bytes reassembled so far
+ * @data:	the payload reassembled so far
+ *
+ * All of these are protected by the vproc's rx_lock.
+ */
+struct rpmsg_frag {
+	struct list_head node;
+	u32 src;
+	u32 dst;
+	int len;
+	void *data;
+};
+
+/**
+ * struct rpmsg_tx_credit - credits for sending to a remote endpoint
+ * @node:	link in the vproc's tx credits hash
+ * @addr:	address of the flow-controlled remote endpoint
+ * @credits:	number of messages we may still send to @addr
+ */
+struct rpmsg_tx_credit {
+	struct hlist_node node;
+	u32 addr;
+	unsigned int credits;
 };
 
 #define to_rpmsg_channel(d) container_of(d, struct rpmsg_channel, dev)
@@ -84,6 +372,154 @@ struct virtproc_info {
 /* Address 53 is reserved for advertising remote services */
 #define RPMSG_NS_ADDR			(53)
 
+/* Address 54 is reserved for flow control credits */
+#define RPMSG_CREDIT_ADDR		(54)
+
+/*
+ * A flow-controlled endpoint gives credits back to the remote processor
+ * in batches of (at least) this fraction of its window.
+ */
+#define RPMSG_CREDIT_RETURN_SHARE	(4)
+
+/*
+ * Maximum number of inbound messages that are processed in a single
+ * rx run before the rx buffers are handed back to the remote processor.
+ * If more messages are pending, draining continues from a work item, so
+ * a long burst doesn't monopolize the (shared) mailbox rx context.
+ */
+static unsigned int rx_budget = 64;
+module_param(rx_budget, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rx_budget, "Max inbound messages to process per rx run");
+
+/*
+ * Inbound messages are dispatched in a context dedicated to their virtual
+ * remote processor, so a slow rx callback can't stall the mailbox (which
+ * is shared with other remote processors), nor other unrelated system work.
+ * By default this is a high priority workqueue, but for latency-sensitive
+ * use cases (e.g. audio) a SCHED_FIFO kthread can be used instead.
+ */
+static unsigned int rx_rt_prio;
+module_param(rx_rt_prio, uint, S_IRUGO);
+MODULE_PARM_DESC(rx_rt_prio,
+	"If nonzero, dispatch inbound messages in a kthread of this RT priority");
+
+/*
+ * Inbound messages are processed NAPI-style: once the remote processor
+ * notifies us, its notifications are suppressed, and the rx virtqueues
+ * are polled until they run dry. On top of that, when a run was busy
+ * (i.e. had at least rx_coalesce_msgs messages), we wait rx_coalesce_us
+ * and poll again, rather than taking notifications right away, which
+ * batches the messages of a steady stream into fewer, bigger runs.
+ * These are the defaults; they can be tuned per vproc in debugfs.
+ */
+static unsigned int rx_coalesce_us;
+module_param(rx_coalesce_us, uint, S_IRUGO);
+MODULE_PARM_DESC(rx_coalesce_us,
+	"Time to wait before polling again after a busy rx run (0 to disable)");
+
+static unsigned int rx_coalesce_msgs = 8;
+module_param(rx_coalesce_msgs, uint, S_IRUGO);
+MODULE_PARM_DESC(rx_coalesce_msgs, "Min messages in an rx run to consider it busy");
+
+/* debugfs parent dir */
+static struct dentry *rpmsg_dbg;
+
+/*
+ * TX buffers are dynamically allocated out of the TX half of the shared
+ * memory region, in units of 32 bytes (the size of a cache line on the
+ * Cortex-A9, and enough to hold the rpmsg header itself). This way small
+ * messages are packed densely, while messages bigger than the platform's
+ * buffer size can still be sent.
+ */
+#define RPMSG_TX_ALLOC_ORDER		(5)
+
+/* the largest tx buffer (header + payload) we're willing to allocate */
+#define RPMSG_TX_MAX_SIZE		(4096)
+
+/*
+ * This much of the tx space is set aside for urgent messages (see
+ * rpmsg_send_urgent_offchannel()), so they don't have to wait for a buffer
+ * behind bulk traffic, provided the tx space is at least
+ * RPMSG_TX_URGENT_MIN_SHARE times bigger.
+ */
+#define RPMSG_TX_URGENT_SIZE		(2048)
+#define RPMSG_TX_URGENT_MIN_SHARE	(16)
+
+/*
+ * Every cpu caches a few free tx buffers of the most common (small) sizes,
+ * i.e. of 1 to RPMSG_TX_CACHE_CLASSES allocation units, so the common send
+ * path doesn't touch the state shared with the other cpus. The caches are
+ * refilled from, and drained to, the tx pools in batches.
+ */
+#define RPMSG_TX_CACHE_CLASSES		(4)
+#define RPMSG_TX_CACHE_DEPTH		(8)
+#define RPMSG_TX_CACHE_BATCH		(RPMSG_TX_CACHE_DEPTH / 2)
+
+/**
+ * struct rpmsg_tx_cache - a cpu's cache of free tx buffers
+ * @count:	number of cached buffers, per size class
+ * @bufs:	the cached buffers, per size class (class i holds buffers of
+ *		i + 1 allocation units)
+ */
+struct rpmsg_tx_cache {
+	unsigned int count[RPMSG_TX_CACHE_CLASSES];
+	void *bufs[RPMSG_TX_CACHE_CLASSES][RPMSG_TX_CACHE_DEPTH];
+};
+
+/*
+ * With VIRTIO_RPMSG_F_FRAG, payloads that don't fit in a single buffer
+ * are sent in fragments, up to this size. Inbound fragmented messages
+ * are reassembled, using up to RPMSG_FRAG_MAX_BYTES bytes for at most
+ * RPMSG_FRAG_MAX_MSGS messages at a time (the oldest one is dropped to
+ * make room for a new one).
+ */
+#define RPMSG_FRAG_MAX_SIZE		(64 * 1024)
+#define RPMSG_FRAG_MAX_MSGS		(16)
+#define RPMSG_FRAG_MAX_BYTES		(256 * 1024)
+
+/* the remote processor is kicked after this many fragments of a message */
+#define RPMSG_FRAG_KICK_BATCH		(16)
+
+/* where a compact header begins, within the struct rpmsg_hdr it overlays */
+#define RPMSG_HDR_COMPACT_OFF		(sizeof(struct rpmsg_hdr) - \
+					 sizeof(struct rpmsg_hdr_compact))
+
+/* largest address that fits in a compact header */
+#define RPMSG_HDR_COMPACT_MAX_ADDR	(0xffff)
+
+/* default time a blocking sender waits for a tx buffer before giving up */
+#define RPMSG_TX_TIMEOUT_MS		(15000)
+
+/*
+ * Endpoints may hold on to rx buffers (see rpmsg_hold_rx_buf()), but in
+ * order not to starve the other endpoints, a single endpoint may only hold
+ * up to a quarter of the rx buffers, and all endpoints together may only
+ * hold up to half of them.
+ */
+#define RPMSG_RX_HOLD_EPT_SHARE		(4)
+#define RPMSG_RX_HOLD_ALL_SHARE		(2)
+
+/*
+ * Endpoints with a batch callback get the messages of an rx run delivered
+ * in batches of up to this many messages.
+ */
+#define RPMSG_RX_BATCH_MAX		(32)
+
+/*
+ * When the remote processor supports a high priority virtqueue pair, an
+ * eighth of the rx buffers is dedicated to it. Control traffic is sparse,
+ * so this is plenty, and the bulk traffic keeps most of the rx buffers.
+ */
+#define RPMSG_RX_HI_SHARE		(8)
+
+/* account a latency, given in usecs, in its log2 histogram bucket */
+static inline void rpmsg_hist_add(struct rpmsg_hist *hist, s64 us)
+{
+	int i = us > 0 ? fls(min_t(s64, us, INT_MAX)) : 0;
+
+	hist->bucket[min(i, RPMSG_HIST_BUCKETS - 1)]++;
+}
+
 /* show configuration fields */
 #define rpmsg_show_attr(field, path, format_string)			\
 static ssize_t								\
@@ -155,6 +591,41 @@ static int rpmsg_uevent(struct device *dev, struct kobj_uevent_env *env)
 					rpdev->id.name);
 }
 
+/* give the credits of the messages @ept consumed back to the remote */
+static void rpmsg_ept_credit_work(struct work_struct *work)
+{
+	struct rpmsg_endpoint *ept = container_of(work, struct rpmsg_endpoint,
+								credit_work);
+	struct rpmsg_credit_msg msg;
+	int owed, err;
+
+	owed = atomic_xchg(&ept->rx_credits_owed, 0);
+	if (!owed)
+		return;
+
+	msg.credits = owed;
+	msg.flags = 0;
+
+	err = rpmsg_send_offchannel_raw(ept->rpdev, ept->addr,
+				RPMSG_CREDIT_ADDR, &msg, sizeof(msg), true);
+	if (err) {
+		dev_err(&ept->rpdev->dev, "failed to give back credits: %d\n",
+									err);
+		/* try again with the next batch */
+		atomic_add(owed, &ept->rx_credits_owed);
+	}
+}
+
+/* @ept consumed a message, so the remote processor may send another one */
+static void rpmsg_rx_credit_consumed(struct rpmsg_endpoint *ept)
+{
+	int window = ACCESS_ONCE(ept->rx_credits);
+
+	if (window && atomic_inc_return(&ept->rx_credits_owed) >=
+			DIV_ROUND_UP(window, RPMSG_CREDIT_RETURN_SHARE))
+		schedule_work(&ept->credit_work);
+}
+
 /* for more info, see below documentation of rpmsg_create_ept() */
 static struct rpmsg_endpoint *__rpmsg_create_ept(struct virtproc_info *vrp,
 		struct rpmsg_channel *rpdev,
@@ -174,6 +645,11 @@ static struct rpmsg_endpoint *__rpmsg_create_ept(struct virtproc_info *vrp,
 		return NULL;
 	}
 
+	kref_init(&ept->refcount);
+	INIT_WORK(&ept->credit_work, rpmsg_ept_credit_work);
+	INIT_LIST_HEAD(&ept->rx_batch_node);
+
+	ept->vrp = vrp;
 	ept->rpdev = rpdev;
 	ept->cb = cb;
 	ept->priv = priv;
@@ -210,6 +686,16 @@ free_ept:
 	return NULL;
 }
 
+/* called when the last reference to an endpoint is gone */
+static void __rpmsg_ept_release(struct kref *kref)
+{
+	struct rpmsg_endpoint *ept = container_of(kref, struct rpmsg_endpoint,
+								refcount);
+
+	kfree(ept->rx_batch);
+	kfree(ept);
+}
+
 /**
  * rpmsg_create_ept() - create a new rpmsg_endpoint
  * @rpdev: rpmsg channel device
@@ -264,16 +750,32 @@ EXPORT_SYMBOL(rpmsg_create_ept);
  *
  * Should be used by drivers to destroy an rpmsg endpoint previously
  * created with rpmsg_create_ept().
+ *
+ * Once this function returns, the endpoint's rx callback is not running
+ * anymore, and will not be invoked again. This also means that it must
+ * not be called from an rx callback (the name service is the only exception).
+ *
+ * Rx buffers held by the endpoint (see rpmsg_hold_rx_buf()) are not
+ * reclaimed; they should still be released by their holder, either before
+ * or after the endpoint is destroyed. Each of them keeps a reference to
+ * the endpoint, so its memory is only freed after the last one is released.
  */
 void rpmsg_destroy_ept(struct rpmsg_endpoint *ept)
 {
-	struct virtproc_info *vrp = ept->rpdev->vrp;
+	struct virtproc_info *vrp = ept->vrp;
 
 	spin_lock(&vrp->endpoints_lock);
 	idr_remove(&vrp->endpoints, ept->addr);
 	spin_unlock(&vrp->endpoints_lock);
 
-	kfree(ept);
+	/* wait for in-flight rx callbacks that might still be using ept */
+	synchronize_srcu(&vrp->ept_srcu);
+
+	/* the channel may go away, so no more credits can be given back */
+	ept->rx_credits = 0;
+	cancel_work_sync(&ept->credit_work);
+
+	kref_put(&ept->refcount, __rpmsg_ept_release);
 }
 EXPORT_SYMBOL(rpmsg_destroy_ept);
 
@@ -285,11 +787,32 @@ EXPORT_SYMBOL(rpmsg_destroy_ept);
  * if we need to, we also announce about this channel to the remote
  * processor (needed in case the driver is exposing an rpmsg service).
  */
+/*
+ * tell the remote processor's name service about a local channel (if it
+ * needs to be announced at all)
+ */
+static int rpmsg_announce(struct rpmsg_channel *rpdev, u32 flags)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct rpmsg_ns_msg nsm;
+
+	if (!rpdev->announce ||
+			!virtio_has_feature(vrp->vdev, VIRTIO_RPMSG_F_NS))
+		return 0;
+
+	strncpy(nsm.name, rpdev->id.name, RPMSG_NAME_SIZE);
+	nsm.addr = rpdev->src;
+	nsm.flags = flags;
+	if (!(flags & RPMSG_NS_DESTROY) && rpdev->prio == RPMSG_PRIO_HIGH)
+		nsm.flags |= RPMSG_NS_PRIO;
+
+	return rpmsg_sendto(rpdev, &nsm, sizeof(nsm), RPMSG_NS_ADDR);
+}
+
 static int rpmsg_dev_probe(struct device *dev)
 {
 	struct rpmsg_channel *rpdev = to_rpmsg_channel(dev);
 	struct rpmsg_driver *rpdrv = to_rpmsg_driver(rpdev->dev.driver);
-	struct virtproc_info *vrp = rpdev->vrp;
 	struct rpmsg_endpoint *ept;
 	int err;
 
@@ -311,18 +834,9 @@ static int rpmsg_dev_probe(struct device *dev)
 	}
 
 	/* need to tell remote processor's name service about this channel ? */
-	if (rpdev->announce &&
-			virtio_has_feature(vrp->vdev, VIRTIO_RPMSG_F_NS)) {
-		struct rpmsg_ns_msg nsm;
-
-		strncpy(nsm.name, rpdev->id.name, RPMSG_NAME_SIZE);
-		nsm.addr = rpdev->src;
-		nsm.flags = RPMSG_NS_CREATE;
-
-		err = rpmsg_sendto(rpdev, &nsm, sizeof(nsm), RPMSG_NS_ADDR);
-		if (err)
-			dev_err(dev, "failed to announce service %d\n", err);
-	}
+	err = rpmsg_announce(rpdev, RPMSG_NS_CREATE);
+	if (err)
+		dev_err(dev, "failed to announce service %d\n", err);
 
 out:
 	return err;
@@ -332,22 +846,12 @@ static int rpmsg_dev_remove(struct device *dev)
 {
 	struct rpmsg_channel *rpdev = to_rpmsg_channel(dev);
 	struct rpmsg_driver *rpdrv = to_rpmsg_driver(rpdev->dev.driver);
-	struct virtproc_info *vrp = rpdev->vrp;
-	int err = 0;
+	int err;
 
 	/* tell remote processor's name service we're removing this channel */
-	if (rpdev->announce &&
-			virtio_has_feature(vrp->vdev, VIRTIO_RPMSG_F_NS)) {
-		struct rpmsg_ns_msg nsm;
-
-		strncpy(nsm.name, rpdev->id.name, RPMSG_NAME_SIZE);
-		nsm.addr = rpdev->src;
-		nsm.flags = RPMSG_NS_DESTROY;
-
-		err = rpmsg_sendto(rpdev, &nsm, sizeof(nsm), RPMSG_NS_ADDR);
-		if (err)
-			dev_err(dev, "failed to announce service %d\n", err);
-	}
+	err = rpmsg_announce(rpdev, RPMSG_NS_DESTROY);
+	if (err)
+		dev_err(dev, "failed to announce service %d\n", err);
 
 	rpdrv->remove(rpdev);
 
@@ -363,6 +867,7 @@ static struct bus_type rpmsg_bus = {
 	.uevent		= rpmsg_uevent,
 	.probe		= rpmsg_dev_probe,
 	.remove		= rpmsg_dev_remove,
+	.async_probe	= true,
 };
 
 /**
@@ -402,11 +907,9 @@ static void rpmsg_release_device(struct device *dev)
  * this is used to make sure we're not creating rpmsg devices for channels
  * that already exist.
  */
-static int rpmsg_channel_match(struct device *dev, void *data)
+static bool rpmsg_channel_match(struct rpmsg_channel *rpdev,
+					struct rpmsg_channel_info *chinfo)
 {
-	struct rpmsg_channel_info *chinfo = data;
-	struct rpmsg_channel *rpdev = to_rpmsg_channel(dev);
-
 	if (chinfo->src != RPMSG_ADDR_ANY && chinfo->src != rpdev->src)
 		return 0;
 
@@ -420,6 +923,53 @@ static int rpmsg_channel_match(struct device *dev, void *data)
 	return 1;
 }
 
+static inline struct hlist_head *rpmsg_channel_bucket(struct virtproc_info *vrp,
+						const char *name, u32 dst)
+{
+	u32 hash = jhash(name, strnlen(name, RPMSG_NAME_SIZE), dst);
+
+	return &vrp->channels[hash & (RPMSG_CHANNEL_HASH_SIZE - 1)];
+}
+
+/*
+ * find a channel in the channels hash. must be called with channels_lock.
+ *
+ * channels are hashed by their name and dst address, so a lookup is O(1),
+ * except when any dst address will do (i.e. when setting up static
+ * channels), in which case all the buckets are searched.
+ */
+static struct rpmsg_channel *__rpmsg_find_channel(struct virtproc_info *vrp,
+					struct rpmsg_channel_info *chinfo)
+{
+	struct rpmsg_channel *rpdev;
+	struct hlist_node *n;
+	int i;
+
+	if (chinfo->dst != RPMSG_ADDR_ANY) {
+		hlist_for_each_entry(rpdev, n, rpmsg_channel_bucket(vrp,
+					chinfo->name, chinfo->dst), node)
+			if (rpmsg_channel_match(rpdev, chinfo))
+				return rpdev;
+		return NULL;
+	}
+
+	for (i = 0; i < RPMSG_CHANNEL_HASH_SIZE; i++)
+		hlist_for_each_entry(rpdev, n, &vrp->channels[i], node)
+			if (rpmsg_channel_match(rpdev, chinfo))
+				return rpdev;
+
+	return NULL;
+}
+
+/* take a channel out of the channels hash, if it's still there */
+static void rpmsg_unhash_channel(struct virtproc_info *vrp,
+						struct rpmsg_channel *rpdev)
+{
+	spin_lock(&vrp->channels_lock);
+	hlist_del_init(&rpdev->node);
+	spin_unlock(&vrp->channels_lock);
+}
+
 /*
  * create an rpmsg channel using its name and address info.
  * this function will be used to create both static and dynamic
@@ -429,28 +979,22 @@ static struct rpmsg_channel *rpmsg_create_channel(struct virtproc_info *vrp,
 				struct rpmsg_channel_info *chinfo)
 {
 	struct rpmsg_channel *rpdev;
-	struct device *tmp, *dev = &vrp->vdev->dev;
+	struct device *dev = &vrp->vdev->dev;
 	int ret;
 
-	/* make sure a similar channel doesn't already exist */
-	tmp = device_find_child(dev, chinfo, rpmsg_channel_match);
-	if (tmp) {
-		/* decrement the matched device's refcount back */
-		put_device(tmp);
-		dev_err(dev, "channel %s:%x:%x already exist\n",
-				chinfo->name, chinfo->src, chinfo->dst);
-		return NULL;
-	}
-
 	rpdev = kzalloc(sizeof(struct rpmsg_channel), GFP_KERNEL);
 	if (!rpdev) {
 		pr_err("kzalloc failed\n");
 		return NULL;
 	}
 
+	INIT_HLIST_NODE(&rpdev->node);
+
 	rpdev->vrp = vrp;
 	rpdev->src = chinfo->src;
 	rpdev->dst = chinfo->dst;
+	rpdev->prio = chinfo->prio;
+	rpdev->tx_timeout = msecs_to_jiffies(RPMSG_TX_TIMEOUT_MS);
 
 	/*
 	 * rpmsg server channels has predefined local address (for now),
@@ -467,9 +1011,23 @@ static struct rpmsg_channel *rpmsg_create_channel(struct virtproc_info *vrp,
 	rpdev->dev.bus = &rpmsg_bus;
 	rpdev->dev.release = rpmsg_release_device;
 
+	/* make sure a similar channel doesn't already exist */
+	spin_lock(&vrp->channels_lock);
+	if (__rpmsg_find_channel(vrp, chinfo)) {
+		spin_unlock(&vrp->channels_lock);
+		dev_err(dev, "channel %s:%x:%x already exist\n",
+				chinfo->name, chinfo->src, chinfo->dst);
+		kfree(rpdev);
+		return NULL;
+	}
+	hlist_add_head(&rpdev->node, rpmsg_channel_bucket(vrp, rpdev->id.name,
+								rpdev->dst));
+	spin_unlock(&vrp->channels_lock);
+
 	ret = device_register(&rpdev->dev);
 	if (ret) {
 		dev_err(dev, "device_register failed: %d\n", ret);
+		rpmsg_unhash_channel(vrp, rpdev);
 		kfree(rpdev);
 		return NULL;
 	}
@@ -484,381 +1042,3193 @@ static struct rpmsg_channel *rpmsg_create_channel(struct virtproc_info *vrp,
 static int rpmsg_destroy_channel(struct virtproc_info *vrp,
 					struct rpmsg_channel_info *chinfo)
 {
-	struct virtio_device *vdev = vrp->vdev;
-	struct device *dev;
+	struct rpmsg_channel *rpdev;
 
-	dev = device_find_child(&vdev->dev, chinfo, rpmsg_channel_match);
-	if (!dev)
-		return -EINVAL;
+	spin_lock(&vrp->channels_lock);
+	rpdev = __rpmsg_find_channel(vrp, chinfo);
+	if (rpdev)
+		hlist_del_init(&rpdev->node);
+	spin_unlock(&vrp->channels_lock);
 
-	device_unregister(dev);
+	if (!rpdev)
+		return -EINVAL;
 
-	put_device(dev);
+	device_unregister(&rpdev->dev);
 
-	kfree(to_rpmsg_channel(dev));
+	kfree(rpdev);
 
 	return 0;
 }
 
-/* super simple buffer "allocator" that is just enough for now */
-static void *get_a_tx_buf(struct virtproc_info *vrp)
+/*
+ * describe a buffer of the shared memory region using a single-entry sg.
+ *
+ * can't use sg_set_buf because buffers might not be residing in
+ * virt_to_page()-able memory (e.g. an ioremap'ed carveout); instead, the
+ * physical address of a buffer is implied by its offset within the region.
+ */
+static void rpmsg_buf_to_sg(struct virtproc_info *vrp, struct scatterlist *sg,
+						void *buf, unsigned int len)
 {
-	unsigned int len;
-	void *ret;
+	phys_addr_t phys_addr = vrp->phys_base + (buf - vrp->rbufs);
 
-	/* support multiple concurrent senders */
-	spin_lock(&vrp->tx_lock);
+	sg_init_table(sg, 1);
+	sg_set_page(sg, phys_to_page(phys_addr), len,
+					offset_in_page(phys_addr));
+}
 
-	/*
-	 * either pick the next unused tx buffer
-	 * (half of our buffers are used for sending messages)
-	 */
-	if (vrp->last_sbuf < vrp->num_bufs / 2)
-		ret = vrp->sbufs + vrp->buf_size * vrp->last_sbuf++;
-	/* or recycle a used one */
-	else
-		ret = virtqueue_get_buf(vrp->svq, &len);
+/*
+ * with compact headers, only the last part of the struct rpmsg_hdr of a
+ * buffer is on the wire: its addresses are packed into the reserved field
+ * before a message is sent, and unpacked back when a message is received
+ * (the first bytes of the buffer are never accessed by the remote side).
+ */
+static inline void rpmsg_pack_hdr(struct virtproc_info *vrp,
+						struct rpmsg_hdr *msg)
+{
+	struct rpmsg_hdr_compact *hdr = (void *) msg + vrp->hdr_off;
 
-	spin_unlock(&vrp->tx_lock);
+	if (vrp->hdr_off) {
+		hdr->src = msg->src;
+		hdr->dst = msg->dst;
+	}
+}
 
-	return ret;
+static inline void rpmsg_unpack_hdr(struct virtproc_info *vrp,
+						struct rpmsg_hdr *msg)
+{
+	struct rpmsg_hdr_compact *hdr = (void *) msg + vrp->hdr_off;
+
+	if (vrp->hdr_off) {
+		msg->src = hdr->src;
+		msg->dst = hdr->dst;
+		msg->reserved = 0;
+	}
 }
 
-/**
- * rpmsg_upref_sleepers() - enable "tx-complete" interrupts, if needed
- * @vrp: virtual remote processor state
- *
- * This function is called before a sender is blocked, waiting for
- * a tx buffer to become available.
- *
- * If we already have blocking senders, this function merely increases
- * the "sleepers" reference count, and exits.
- *
- * Otherwise, if this is the first sender to block, we also enable
- * virtio's tx callbacks, so we'd be immediately notified when a tx
- * buffer is consumed (we rely on virtio's tx callback in order
- * to wake up sleeping senders as soon as a tx buffer is used by the
- * remote processor).
+/*
+ * if the shared buffers are mapped cacheable, sync the @len bytes at @buf
+ * before handing them over to the remote processor (and after taking them
+ * back, respectively). this is a no-op for uncached buffers.
  */
-static void rpmsg_upref_sleepers(struct virtproc_info *vrp)
+static inline void rpmsg_sync_for_device(struct virtproc_info *vrp, void *buf,
+				size_t len, enum dma_data_direction dir)
 {
-	/* support multiple concurrent senders */
-	spin_lock(&vrp->tx_lock);
-
-	/* are we the first sleeping context waiting for tx buffers ? */
-	if (!vrp->sleepers++)
-		/* enable "tx-complete" interrupts before dozing off */
-		virtqueue_enable_cb(vrp->svq);
+	if (vrp->cache_ops)
+		vrp->cache_ops->sync_for_device(vrp->vdev, buf,
+				vrp->phys_base + (buf - vrp->rbufs), len, dir);
+}
 
-	spin_unlock(&vrp->tx_lock);
+static inline void rpmsg_sync_for_cpu(struct virtproc_info *vrp, void *buf,
+				size_t len, enum dma_data_direction dir)
+{
+	if (vrp->cache_ops)
+		vrp->cache_ops->sync_for_cpu(vrp->vdev, buf,
+				vrp->phys_base + (buf - vrp->rbufs), len, dir);
 }
 
-/**
- * rpmsg_downref_sleepers() - disable "tx-complete" interrupts, if needed
- * @vrp: virtual remote processor state
- *
- * This function is called after a sender, that waited for a tx buffer
- * to become available, is unblocked.
- *
- * If we still have blocking senders, this function merely decreases
- * the "sleepers" reference count, and exits.
- *
- * Otherwise, if there are no more blocking senders, we also disable
- * virtio's tx callbacks, to avoid the overhead incurred with handling
- * those (now redundant) interrupts.
+/*
+ * Record a message in the capture ring, instead of dumping it to the log.
+ * Writers don't synchronize with one another: every message gets its own
+ * sequence number, and thus its own record (the oldest record is simply
+ * overwritten), and readers skip the records that change under their feet.
  */
-static void rpmsg_downref_sleepers(struct virtproc_info *vrp)
+static void rpmsg_capture(struct virtproc_info *vrp, struct rpmsg_hdr *msg,
+								bool tx)
 {
-	/* support multiple concurrent senders */
-	spin_lock(&vrp->tx_lock);
+	u32 seq = atomic_inc_return(&vrp->capture_head) - 1;
+	struct rpmsg_capture_rec *rec;
 
-	/* are we the last sleeping context waiting for tx buffers ? */
-	if (!--vrp->sleepers)
-		/* disable "tx-complete" interrupts */
-		virtqueue_disable_cb(vrp->svq);
+	rec = &vrp->capture[seq & (RPMSG_CAPTURE_RECS - 1)];
+
+	rec->seq = 0;
+	smp_wmb();
 
-	spin_unlock(&vrp->tx_lock);
+	rec->tx = tx;
+	rec->ts = ktime_get();
+	rec->src = msg->src;
+	rec->dst = msg->dst;
+	rec->len = msg->len;
+	rec->copied = min3(vrp->capture_len, (u32) msg->len,
+						(u32) RPMSG_CAPTURE_BYTES);
+	memcpy(rec->data, msg->data, rec->copied);
+
+	smp_wmb();
+	rec->seq = seq + 1;
 }
 
-/**
- * rpmsg_send_offchannel_raw() - send a message across to the remote processor
- * @rpdev: the rpmsg channel
- * @src: source address
- * @dst: destination address
- * @data: payload of message
- * @len: length of payload
- * @wait: indicates whether caller should block in case no TX buffers available
- *
- * This function is the base implementation for all of the rpmsg sending API.
- *
- * It will send @data of length @len to @dst, and say it's from @src. The
- * message will be sent to the remote processor which the @rpdev channel
- * belongs to.
- *
- * The message is sent using one of the TX buffers that are available for
- * communication with this remote processor.
- *
- * If @wait is true, the caller will be blocked until either a TX buffer is
- * available, or 15 seconds elapses (we don't want callers to
- * sleep indefinitely due to misbehaving remote processors), and in that
- * case -ERESTARTSYS is returned. The number '15' itself was picked
- * arbitrarily; there's little point in asking drivers to provide a timeout
- * value themselves.
- *
- * Otherwise, if @wait is false, and there are no TX buffers available,
- * the function will immediately fail, and -ENOMEM will be returned.
- *
- * Normally drivers shouldn't use this function directly; instead, drivers
- * should use the appropriate rpmsg_{try}send{to, _offchannel} API
- * (see include/linux/rpmsg.h).
- *
- * Returns 0 on success and an appropriate error value on failure.
- */
-int rpmsg_send_offchannel_raw(struct rpmsg_channel *rpdev, u32 src, u32 dst,
-					void *data, int len, bool wait)
+/* capturing is enabled at runtime, so keep it out of the way when it's off */
+static inline void rpmsg_capture_msg(struct virtproc_info *vrp,
+					struct rpmsg_hdr *msg, bool tx)
+{
+	if (unlikely(vrp->capture_len) && vrp->capture)
+		rpmsg_capture(vrp, msg, tx);
+}
+
+/* the size of a tx buffer is implied by the message it carries */
+static inline size_t rpmsg_tx_buf_size(struct rpmsg_hdr *msg)
+{
+	return sizeof(*msg) + msg->len;
+}
+
+/* is this tx buffer part of the space reserved for urgent messages ? */
+static inline bool rpmsg_tx_buf_urgent(struct virtproc_info *vrp, void *buf)
+{
+	return buf >= vrp->sbufs + vrp->num_tx_pools * vrp->tx_pool_size;
+}
+
+/* the tx pool a tx buffer belongs to is implied by its address */
+static void __rpmsg_tx_pool_free(struct virtproc_info *vrp, void *buf,
+								size_t size)
+{
+	int pool = (buf - vrp->sbufs) / vrp->tx_pool_size;
+
+	if (rpmsg_tx_buf_urgent(vrp, buf))
+		gen_pool_free(vrp->tx_urgent_pool, (unsigned long) buf, size);
+	else
+		gen_pool_free(vrp->tx_pools[pool], (unsigned long) buf, size);
+
+	atomic_sub(ALIGN(size, 1 << RPMSG_TX_ALLOC_ORDER), &vrp->tx_bytes_used);
+}
+
+/*
+ * allocate from the local cpu's tx pool, and fall back to the pools of
+ * the other cpus only when it's exhausted. the cpu number is merely a
+ * hint for spreading the senders, so we don't care if we get migrated.
+ */
+static void *__rpmsg_tx_pool_alloc(struct virtproc_info *vrp, size_t size)
+{
+	int first = raw_smp_processor_id() % vrp->num_tx_pools;
+	unsigned long buf;
+	int i;
+
+	for (i = 0; i < vrp->num_tx_pools; i++) {
+		buf = gen_pool_alloc(vrp->tx_pools[(first + i) %
+						vrp->num_tx_pools], size);
+		if (buf) {
+			atomic_add(ALIGN(size, 1 << RPMSG_TX_ALLOC_ORDER),
+							&vrp->tx_bytes_used);
+			return (void *) buf;
+		}
+	}
+
+	return NULL;
+}
+
+/* the size class of a tx buffer in the per-cpu caches, or -1 if uncached */
+static inline int rpmsg_tx_cache_class(size_t size)
+{
+	int units = ALIGN(size, 1 << RPMSG_TX_ALLOC_ORDER) >>
+							RPMSG_TX_ALLOC_ORDER;
+
+	return units <= RPMSG_TX_CACHE_CLASSES ? units - 1 : -1;
+}
+
+/*
+ * allocate a tx buffer, preferably from the local cpu's cache. senders
+ * might run in interrupt context, so the cache is accessed with the local
+ * interrupts disabled.
+ */
+static void *rpmsg_tx_pool_alloc(struct virtproc_info *vrp, size_t size)
+{
+	int class = rpmsg_tx_cache_class(size);
+	struct rpmsg_tx_cache *cache;
+	unsigned long flags;
+	void *buf;
+
+	if (class < 0)
+		return __rpmsg_tx_pool_alloc(vrp, size);
+
+	local_irq_save(flags);
+
+	cache = this_cpu_ptr(vrp->tx_caches);
+
+	/* refill an empty cache with a batch of buffers */
+	if (!cache->count[class]) {
+		while (cache->count[class] < RPMSG_TX_CACHE_BATCH) {
+			buf = __rpmsg_tx_pool_alloc(vrp, size);
+			if (!buf)
+				break;
+			cache->bufs[class][cache->count[class]++] = buf;
+		}
+	}
+
+	buf = NULL;
+	if (cache->count[class])
+		buf = cache->bufs[class][--cache->count[class]];
+
+	local_irq_restore(flags);
+
+	return buf;
+}
+
+/* free a tx buffer, preferably to the local cpu's cache */
+static void rpmsg_tx_pool_free(struct virtproc_info *vrp, void *buf,
+								size_t size)
+{
+	int class = rpmsg_tx_cache_class(size);
+	struct rpmsg_tx_cache *cache;
+	unsigned long flags;
+
+	/* the urgent reserve must not leak into the caches of bulk senders */
+	if (class < 0 || rpmsg_tx_buf_urgent(vrp, buf)) {
+		__rpmsg_tx_pool_free(vrp, buf, size);
+		return;
+	}
+
+	local_irq_save(flags);
+
+	cache = this_cpu_ptr(vrp->tx_caches);
+
+	/* drain a full cache down to a batch of buffers */
+	if (cache->count[class] == RPMSG_TX_CACHE_DEPTH)
+		while (cache->count[class] > RPMSG_TX_CACHE_BATCH)
+			__rpmsg_tx_pool_free(vrp,
+				cache->bufs[class][--cache->count[class]],
+				(class + 1) << RPMSG_TX_ALLOC_ORDER);
+
+	cache->bufs[class][cache->count[class]++] = buf;
+
+	local_irq_restore(flags);
+}
+
+/*
+ * give back to the tx pools all the buffers that the remote processor
+ * has already consumed. must be called with tx_lock held.
+ * returns the number of buffers reclaimed.
+ */
+static int __rpmsg_reclaim_tx_bufs(struct virtproc_info *vrp)
+{
+	struct rpmsg_hdr *msg;
+	unsigned int len;
+	int i, num = 0;
+
+	for (i = 0; i < vrp->num_vq_pairs; i++) {
+		while ((msg = virtqueue_get_buf(vrp->svq[i], &len))) {
+			rpmsg_tx_pool_free(vrp, msg, rpmsg_tx_buf_size(msg));
+			num++;
+		}
+	}
+
+	vrp->tx_inflight -= num;
+
+	return num;
+}
+
+/**
+ * get_a_tx_buf() - allocate a tx buffer from the shared memory region
+ * @vrp: virtual remote processor state
+ * @size: size of the requested buffer, including the rpmsg header
+ *
+ * Allocates a @size bytes tx buffer from the tx pools. Only if they are
+ * exhausted, tx_lock is taken in order to recycle the buffers that were
+ * already consumed by the remote processor, and the allocation is retried.
+ *
+ * Returns the buffer on success, or NULL if no space is available.
+ */
+static void *get_a_tx_buf(struct virtproc_info *vrp, size_t size)
+{
+	void *buf;
+	unsigned long flags;
+
+	buf = rpmsg_tx_pool_alloc(vrp, size);
+	if (buf)
+		goto out;
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	__rpmsg_reclaim_tx_bufs(vrp);
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	buf = rpmsg_tx_pool_alloc(vrp, size);
+	if (!buf)
+		return NULL;
+
+out:
+	atomic_inc(&vrp->tx_reserved);
+	return buf;
+}
+
+/* release a tx buffer that was not handed over to the remote processor */
+static void put_a_tx_buf(struct virtproc_info *vrp, struct rpmsg_hdr *msg)
+{
+	rpmsg_tx_pool_free(vrp, msg, rpmsg_tx_buf_size(msg));
+	atomic_dec(&vrp->tx_reserved);
+
+	/* let blocking senders know some tx space was just freed */
+	if (atomic_read(&vrp->sleepers))
+		wake_up_interruptible(&vrp->sendq);
+}
+
+/*
+ * enable "tx-complete" interrupts, but have them delayed until most of the
+ * pending tx buffers are consumed, so a batch of consumed buffers costs a
+ * single interrupt. returns false if buffers were already consumed in the
+ * meantime. must be called with tx_lock held.
+ */
+static bool __rpmsg_enable_tx_complete(struct virtproc_info *vrp)
+{
+	bool armed = true;
+	int i;
+
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		if (!virtqueue_enable_cb_delayed(vrp->svq[i]))
+			armed = false;
+
+	return armed;
+}
+
+/**
+ * rpmsg_upref_sleepers() - enable "tx-complete" interrupts, if needed
+ * @vrp: virtual remote processor state
+ *
+ * This function is called before a sender is blocked, waiting for
+ * a tx buffer to become available.
+ *
+ * If we already have blocking senders, this function merely increases
+ * the "sleepers" reference count, and exits.
+ *
+ * Otherwise, if this is the first sender to block, we also enable
+ * virtio's tx callbacks, so we'd be immediately notified when a tx
+ * buffers are consumed (we rely on virtio's tx callback in order
+ * to wake up sleeping senders once tx buffers are used by the
+ * remote processor).
+ */
+static void rpmsg_upref_sleepers(struct virtproc_info *vrp)
+{
+	unsigned long flags;
+
+	/* are we the first sleeping context waiting for tx buffers ? */
+	if (atomic_inc_return(&vrp->sleepers) == 1) {
+		spin_lock_irqsave(&vrp->tx_lock, flags);
+		/*
+		 * enable "tx-complete" interrupts before dozing off. buffers
+		 * that were consumed meanwhile are reclaimed by the sleepers
+		 * themselves, so there's no need to check for them here.
+		 */
+		__rpmsg_enable_tx_complete(vrp);
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+	}
+}
+
+/**
+ * rpmsg_downref_sleepers() - disable "tx-complete" interrupts, if needed
+ * @vrp: virtual remote processor state
+ *
+ * This function is called after a sender, that waited for a tx buffer
+ * to become available, is unblocked.
+ *
+ * If we still have blocking senders, this function merely decreases
+ * the "sleepers" reference count, and exits.
+ *
+ * Otherwise, if there are no more blocking senders, we also disable
+ * virtio's tx callbacks, to avoid the overhead incurred with handling
+ * those (now redundant) interrupts.
+ */
+static void rpmsg_downref_sleepers(struct virtproc_info *vrp)
+{
+	int i;
+	unsigned long flags;
+
+	/* are we the last sleeping context waiting for tx buffers ? */
+	if (atomic_dec_and_test(&vrp->sleepers)) {
+		spin_lock_irqsave(&vrp->tx_lock, flags);
+		/* a new sleeper might have shown up (and enabled them) meanwhile */
+		if (!atomic_read(&vrp->sleepers)) {
+			/* disable "tx-complete" interrupts */
+			for (i = 0; i < vrp->num_vq_pairs; i++)
+				virtqueue_disable_cb(vrp->svq[i]);
+		}
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+	}
+}
+
+/**
+ * rpmsg_wait_tx_buf() - sleep until a tx buffer can be allocated
+ * @vrp: virtual remote processor state
+ * @size: size of the requested buffer, including the rpmsg header
+ * @timeout: how long (in jiffies) to wait for the buffer
+ * @buf: where the allocated buffer is returned
+ *
+ * Blocking senders wait exclusively, so a consumed tx buffer only wakes
+ * up a single sender, rather than a herd of senders racing for it. The
+ * sender that got a buffer then passes the wakeup on to the next one,
+ * since its reclaim might have freed more buffers than it needed.
+ *
+ * Must be called between rpmsg_upref_sleepers() and rpmsg_downref_sleepers().
+ *
+ * Returns the same values as wait_event_interruptible_timeout().
+ */
+static long rpmsg_wait_tx_buf(struct virtproc_info *vrp, size_t size,
+						long timeout, void **buf)
+{
+	DEFINE_WAIT(wait);
+	long ret = timeout;
+	bool armed;
+	unsigned long flags;
+
+	for (;;) {
+		prepare_to_wait_exclusive(&vrp->sendq, &wait,
+						TASK_INTERRUPTIBLE);
+
+		*buf = get_a_tx_buf(vrp, size);
+		if (*buf)
+			break;
+
+		/*
+		 * the reclaim re-armed the "tx-complete" interrupt for the
+		 * very next consumed buffer, so delay it again
+		 */
+		spin_lock_irqsave(&vrp->tx_lock, flags);
+		armed = __rpmsg_enable_tx_complete(vrp);
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		if (!armed)
+			continue;
+
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+
+		ret = schedule_timeout(ret);
+		if (!ret)
+			break;
+	}
+
+	if (!*buf) {
+		/* don't swallow a wakeup that was meant for another sender */
+		abort_exclusive_wait(&vrp->sendq, &wait, TASK_INTERRUPTIBLE,
+									NULL);
+		return ret;
+	}
+
+	finish_wait(&vrp->sendq, &wait);
+
+	/* are there other senders sleeping (besides us) ? */
+	if (atomic_read(&vrp->sleepers) > 1)
+		wake_up_interruptible(&vrp->sendq);
+
+	return ret;
+}
+
+/*
+ * invoke the callbacks of the senders that asked to be notified when tx
+ * space becomes available (see rpmsg_tx_notify()). every waiter is
+ * notified once; waiters that are re-registered by their own callback
+ * will only be notified the next time around.
+ */
+static void rpmsg_fire_tx_waiters(struct virtproc_info *vrp)
+{
+	struct rpmsg_tx_waiter *w;
+	LIST_HEAD(waiters);
+	unsigned long flags;
+
+	spin_lock_irqsave(&vrp->tx_waiters_lock, flags);
+	list_splice_init(&vrp->tx_waiters, &waiters);
+
+	while (!list_empty(&waiters)) {
+		w = list_first_entry(&waiters, struct rpmsg_tx_waiter, node);
+		list_del_init(&w->node);
+		spin_unlock_irqrestore(&vrp->tx_waiters_lock, flags);
+
+		rpmsg_downref_sleepers(vrp);
+		w->cb(w->rpdev, w->priv);
+
+		spin_lock_irqsave(&vrp->tx_waiters_lock, flags);
+	}
+
+	spin_unlock_irqrestore(&vrp->tx_waiters_lock, flags);
+}
+
+/* find the credits for sending to @addr. must be called with credits_lock */
+static struct rpmsg_tx_credit *__rpmsg_find_tx_credit(struct virtproc_info *vrp,
+								u32 addr)
+{
+	struct rpmsg_tx_credit *tc;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(tc, pos,
+		&vrp->tx_credits[addr & (RPMSG_CREDIT_HASH_SIZE - 1)], node)
+		if (tc->addr == addr)
+			return tc;
+
+	return NULL;
+}
+
+/*
+ * take a credit for sending a message to @dst. returns false if @dst is
+ * flow-controlled by the remote processor, and no credit is left.
+ */
+static bool rpmsg_try_take_credit(struct virtproc_info *vrp, u32 dst)
+{
+	struct rpmsg_tx_credit *tc;
+	bool ok = true;
+
+	spin_lock(&vrp->credits_lock);
+
+	tc = __rpmsg_find_tx_credit(vrp, dst);
+	if (tc) {
+		if (tc->credits)
+			tc->credits--;
+		else
+			ok = false;
+	}
+
+	spin_unlock(&vrp->credits_lock);
+
+	return ok;
+}
+
+/* give back a credit that was taken for a message that wasn't sent */
+static void rpmsg_put_credit(struct virtproc_info *vrp, u32 dst)
+{
+	struct rpmsg_tx_credit *tc;
+
+	if (!vrp->credit_ept)
+		return;
+
+	spin_lock(&vrp->credits_lock);
+	tc = __rpmsg_find_tx_credit(vrp, dst);
+	if (tc)
+		tc->credits++;
+	spin_unlock(&vrp->credits_lock);
+}
+
+/**
+ * rpmsg_take_credit() - take a credit for sending a message, if needed
+ * @rpdev: the sending channel
+ * @dst: destination address of the message
+ * @timeout: how long (in jiffies) to wait for a credit, if none is left
+ *
+ * Only senders to a flow-controlled remote endpoint, which ran out of
+ * credits, are throttled, so a slow remote task doesn't hold back the
+ * senders of other channels (as running out of tx buffers would).
+ * Control messages of the bus are never flow-controlled.
+ *
+ * Returns 0 if the message may be sent, -ENOMEM if no credit is left and
+ * @timeout is 0, or -ERESTARTSYS if the wait was interrupted or timed out.
+ */
+static int rpmsg_take_credit(struct rpmsg_channel *rpdev, u32 dst,
+							long timeout)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	long err;
+
+	if (!vrp->credit_ept || dst == RPMSG_NS_ADDR ||
+						dst == RPMSG_CREDIT_ADDR)
+		return 0;
+
+	if (rpmsg_try_take_credit(vrp, dst))
+		return 0;
+
+	if (!timeout)
+		return -ENOMEM;
+
+	/* credits arrive with inbound messages, which wake up sendq */
+	err = wait_event_interruptible_timeout(vrp->sendq,
+				rpmsg_try_take_credit(vrp, dst), timeout);
+	if (err < 0)
+		return err;
+
+	if (!err) {
+		dev_err(&rpdev->dev, "timeout waiting for a credit (0x%x)\n",
+									dst);
+		return -ERESTARTSYS;
+	}
+
+	return 0;
+}
+
+/* invoked when the remote processor grants us flow control credits */
+static void rpmsg_credit_cb(struct rpmsg_channel *rpdev, void *data, int len,
+							void *priv, u32 src)
+{
+	struct virtproc_info *vrp = priv;
+	struct rpmsg_credit_msg *msg = data;
+	struct rpmsg_tx_credit *tc, *new;
+
+	if (len != sizeof(*msg)) {
+		dev_err(&vrp->vdev->dev, "malformed credits msg (%d)\n", len);
+		return;
+	}
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+
+	spin_lock(&vrp->credits_lock);
+
+	tc = __rpmsg_find_tx_credit(vrp, src);
+
+	if (msg->flags & RPMSG_CREDIT_SET &&
+				msg->credits == RPMSG_CREDITS_UNLIMITED) {
+		/* the remote endpoint isn't flow-controlled anymore */
+		if (tc) {
+			hlist_del(&tc->node);
+			kfree(tc);
+		}
+	} else if (tc || new) {
+		if (!tc) {
+			tc = new;
+			new = NULL;
+			tc->addr = src;
+			hlist_add_head(&tc->node, &vrp->tx_credits[src &
+						(RPMSG_CREDIT_HASH_SIZE - 1)]);
+		}
+
+		if (msg->flags & RPMSG_CREDIT_SET)
+			tc->credits = msg->credits;
+		else
+			tc->credits += msg->credits;
+	} else {
+		dev_err(&vrp->vdev->dev, "can't track credits of 0x%x\n", src);
+	}
+
+	spin_unlock(&vrp->credits_lock);
+
+	kfree(new);
+
+	/* let the senders that ran out of credits try again */
+	wake_up_interruptible(&vrp->sendq);
+	rpmsg_fire_tx_waiters(vrp);
+}
+
+/**
+ * __rpmsg_kick_tx() - publish the added tx buffers and notify the remote
+ * @vrp: virtual remote processor state
+ *
+ * Notifying the remote processor (e.g. writing to a mailbox) might be slow,
+ * so it's done without holding tx_lock. Senders that add buffers while
+ * another context is notifying leave it to that context to kick once more
+ * on their behalf, so concurrent senders are batched into fewer kicks.
+ *
+ * Only the tx virtqueues that have new buffers are kicked, the high
+ * priority one first.
+ *
+ * Must be called with tx_lock held, taken with spin_lock_irqsave() and
+ * @flags; it is released before returning.
+ */
+static void __rpmsg_kick_tx(struct virtproc_info *vrp, unsigned long flags)
+{
+	bool notify[RPMSG_PRIO_MAX];
+	int i;
+
+	/* the vrings are about to be reset, so there's no one to kick */
+	if (vrp->crashed) {
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		return;
+	}
+
+	/*
+	 * a suspended remote processor is resumed in the background, and
+	 * meanwhile the messages just pile up in the tx vrings (they're
+	 * accounted in tx_unkicked), so they're all kicked once it's up
+	 */
+	if (vrp->tx_resuming ||
+			(vrp->pm_ops && vrp->pm_ops->suspended(vrp->vdev))) {
+		if (!vrp->tx_resuming) {
+			vrp->tx_resuming = true;
+			vrp->tx_resumes++;
+			schedule_work(&vrp->resume_work);
+		}
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		return;
+	}
+
+	if (vrp->tx_kicking) {
+		vrp->tx_kick_again = true;
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		return;
+	}
+
+	vrp->tx_kicking = true;
+
+	do {
+		vrp->tx_kick_again = false;
+		for (i = 0; i < vrp->num_vq_pairs; i++) {
+			notify[i] = vrp->tx_unkicked[i] &&
+					virtqueue_kick_prepare(vrp->svq[i]);
+			vrp->tx_unkicked[i] = 0;
+			vrp->tx_kicks += notify[i];
+		}
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+		/* tell the remote processor it has pending messages to read */
+		for (i = vrp->num_vq_pairs - 1; i >= 0; i--)
+			if (notify[i])
+				virtqueue_notify(vrp->svq[i]);
+
+		spin_lock_irqsave(&vrp->tx_lock, flags);
+	} while (vrp->tx_kick_again);
+
+	vrp->tx_kicking = false;
+
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+}
+
+/* kick the tx buffers that were added to svq while their channel was corked */
+static void rpmsg_flush_tx(struct virtproc_info *vrp)
+{
+	int i;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		if (vrp->tx_unkicked[i])
+			break;
+
+	if (i == vrp->num_vq_pairs) {
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		return;
+	}
+
+	/* releases tx_lock */
+	__rpmsg_kick_tx(vrp, flags);
+}
+
+/* wake up a suspended remote processor, and let it know about our messages */
+static void rpmsg_resume_work(struct work_struct *work)
+{
+	struct virtproc_info *vrp = container_of(work, struct virtproc_info,
+								resume_work);
+	int err;
+	unsigned long flags;
+
+	err = vrp->pm_ops->resume(vrp->vdev);
+	if (err)
+		dev_err(&vrp->vdev->dev, "failed to resume: %d\n", err);
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	vrp->tx_resuming = false;
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	/*
+	 * kick all the messages that were queued meanwhile at once (if the
+	 * remote processor was suspended again already, it's just resumed
+	 * once more)
+	 */
+	rpmsg_flush_tx(vrp);
+}
+
+/**
+ * rpmsg_get_tx_buf_wait() - grab a tx buffer, possibly waiting for one
+ * @rpdev: the sending channel
+ * @len: length of the payload that will be sent using the buffer
+ * @timeout: how long (in jiffies) to wait for a tx buffer, if none is
+ *	     available. 0 means don't wait at all, MAX_SCHEDULE_TIMEOUT
+ *	     means wait indefinitely.
+ *
+ * If the channel has a nonzero @tx_spin_us, no tx buffer is available,
+ * then we first busy-poll for one for up to @tx_spin_us microseconds,
+ * before going to sleep (or failing, if @timeout is 0).
+ *
+ * Returns a tx buffer that can hold @len bytes of payload (in addition
+ * to the rpmsg header), or an ERR_PTR() value on failure.
+ */
+static struct rpmsg_hdr *rpmsg_get_tx_buf_wait(struct rpmsg_channel *rpdev,
+							size_t len, long timeout)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct device *dev = &rpdev->dev;
+	struct rpmsg_hdr *msg;
+	ktime_t start;
+	s64 waited;
+	long err;
+	unsigned long flags;
+
+	/*
+	 * The tx buffers are allocated according to the size of each
+	 * message, up to tx_max_size bytes (including the rpmsg header).
+	 * A negative length passed by a caller is huge here, so it's
+	 * rejected as well.
+	 */
+	if (len > vrp->tx_max_size - sizeof(struct rpmsg_hdr)) {
+		dev_err(dev, "message is too big (%zu)\n", len);
+		return ERR_PTR(-EMSGSIZE);
+	}
+
+	/* grab a buffer */
+	msg = get_a_tx_buf(vrp, sizeof(*msg) + len);
+	if (msg)
+		goto out;
+
+	/* corked messages must be kicked before we wait for them */
+	rpmsg_flush_tx(vrp);
+
+	/* low-latency senders would rather spin for a bit than sleep */
+	if (rpdev->tx_spin_us) {
+		start = ktime_get();
+		do {
+			cpu_relax();
+			msg = get_a_tx_buf(vrp, sizeof(*msg) + len);
+		} while (!msg && ktime_us_delta(ktime_get(), start) <
+							rpdev->tx_spin_us);
+		if (msg)
+			goto out;
+	}
+
+	if (!timeout)
+		return ERR_PTR(-ENOMEM);
+
+	/* enable "tx-complete" interrupts, if not already enabled */
+	rpmsg_upref_sleepers(vrp);
+
+	start = ktime_get();
+
+	/* sleep until a free buffer is available or the timeout elapses */
+	err = rpmsg_wait_tx_buf(vrp, sizeof(*msg) + len, timeout,
+							(void **) &msg);
+
+	waited = ktime_us_delta(ktime_get(), start);
+
+	/* disable "tx-complete" interrupts if we're the last sleeper */
+	rpmsg_downref_sleepers(vrp);
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	vrp->tx_waits++;
+	vrp->tx_wait_us += waited;
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	/* interrupted by a signal ? */
+	if (err < 0)
+		return ERR_PTR(err);
+
+	/* timeout ? */
+	if (!err) {
+		dev_err(dev, "timeout waiting for a tx buffer\n");
+		return ERR_PTR(-ERESTARTSYS);
+	}
+
+out:
+	/* the payload length implies the size of the buffer, see put_a_tx_buf */
+	msg->len = len;
+
+	return msg;
+}
+
+/**
+ * __rpmsg_send_msg() - hand a filled tx buffer over to the remote processor
+ * @rpdev: the sending channel
+ * @msg: the tx buffer, with its header and payload already set
+ * @urgent: whether the message should overtake the channel's bulk traffic
+ *
+ * The message is sent on the tx virtqueue of the channel's traffic class,
+ * and the remote processor is kicked, unless @rpdev is corked (see
+ * rpmsg_cork()). Urgent messages are sent on the high priority tx
+ * virtqueue (if there is one) instead, and are kicked right away.
+ *
+ * On failure, the tx buffer is released back to the tx pool.
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+static int __rpmsg_send_msg(struct rpmsg_channel *rpdev,
+				struct rpmsg_hdr *msg, bool urgent)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct device *dev = &rpdev->dev;
+	struct scatterlist sg;
+	int err, p, tlen;
+	unsigned long flags;
+
+	p = urgent ? RPMSG_PRIO_HIGH : rpdev->prio;
+
+	/* without a high priority vq pair, all channels share the normal one */
+	if (p >= vrp->num_vq_pairs)
+		p = RPMSG_PRIO_NORMAL;
+
+	dev_dbg(dev, "TX From 0x%x, To 0x%x, Len %d, Flags %d, Reserved %d\n",
+					msg->src, msg->dst, msg->len,
+					msg->flags, msg->reserved);
+
+	if (vrp->hdr_off && (msg->src > RPMSG_HDR_COMPACT_MAX_ADDR ||
+				msg->dst > RPMSG_HDR_COMPACT_MAX_ADDR)) {
+		dev_err(dev, "addr doesn't fit a compact header (0x%x, 0x%x)\n",
+							msg->src, msg->dst);
+		put_a_tx_buf(vrp, msg);
+		return -EINVAL;
+	}
+
+	rpmsg_capture_msg(vrp, msg, true);
+
+	rpmsg_pack_hdr(vrp, msg);
+
+	/* only the on-the-wire part of the buffer is handed over */
+	tlen = sizeof(*msg) - vrp->hdr_off + msg->len;
+	rpmsg_buf_to_sg(vrp, &sg, (void *) msg + vrp->hdr_off, tlen);
+
+	/* only the used part of the buffer needs to be written back */
+	rpmsg_sync_for_device(vrp, (void *) msg + vrp->hdr_off, tlen,
+							DMA_TO_DEVICE);
+
+	/*
+	 * the buffers might be mapped write-combined, so make sure the
+	 * message is out there before the remote processor can access it
+	 */
+	wmb();
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+
+	/* the remote processor crashed, so whatever we send now is lost */
+	if (unlikely(vrp->crashed)) {
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		put_a_tx_buf(vrp, msg);
+		return -ENXIO;
+	}
+
+	/* add message to the remote processor's virtqueue */
+	err = virtqueue_add_buf_gfp(vrp->svq[p], &sg, 1, 0, msg, GFP_ATOMIC);
+	if (err < 0) {
+		vrp->tx_add_errors++;
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		dev_err(dev, "virtqueue_add_buf_gfp failed: %d\n", err);
+		put_a_tx_buf(vrp, msg);
+		return err;
+	}
+
+	trace_rpmsg_send(vrp->svq[p], msg->src, msg->dst, msg->len);
+
+	atomic_dec(&vrp->tx_reserved);
+	vrp->tx_inflight++;
+	vrp->tx_unkicked[p]++;
+
+	vrp->tx_msgs++;
+	vrp->tx_bytes += msg->len;
+	/* messages sent off-channel are only accounted for the vproc */
+	if (rpdev->ept && rpdev->ept->addr == msg->src) {
+		rpdev->ept->tx_msgs++;
+		rpdev->ept->tx_bytes += msg->len;
+	}
+
+	/* a corked channel leaves the kick to rpmsg_uncork() */
+	if (atomic_read(&rpdev->corked) && !urgent) {
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		return 0;
+	}
+
+	/* releases tx_lock */
+	__rpmsg_kick_tx(vrp, flags);
+
+	return 0;
+}
+
+static inline int rpmsg_send_msg(struct rpmsg_channel *rpdev,
+						struct rpmsg_hdr *msg)
+{
+	return __rpmsg_send_msg(rpdev, msg, false);
+}
+
+/* account the time it took to send a message since the send call began */
+static void rpmsg_tx_account_latency(struct virtproc_info *vrp, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	unsigned long flags;
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	rpmsg_hist_add(&vrp->tx_lat, us);
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+}
+
+/* compact headers have no room for the offset of a fragment */
+static bool rpmsg_frags_enabled(struct virtproc_info *vrp)
+{
+	return virtio_has_feature(vrp->vdev, VIRTIO_RPMSG_F_FRAG) &&
+							!vrp->hdr_off;
+}
+
+/* does a @len bytes payload have to be sent in fragments ? */
+static bool rpmsg_needs_frags(struct virtproc_info *vrp, size_t len)
+{
+	return len > vrp->buf_size - sizeof(struct rpmsg_hdr) &&
+					rpmsg_frags_enabled(vrp);
+}
+
+/*
+ * send a payload, gathered from @nvec buffers, in fragments that fit in
+ * the rx buffers of the remote processor. the fragments are queued with
+ * the channel corked, and the remote processor is kicked every few
+ * fragments (and whenever we have to wait for a tx buffer), so it can
+ * start consuming them while we're still copying the rest.
+ *
+ * if a fragment can't be sent, the remaining ones aren't sent either, and
+ * the remote processor discards the partial message eventually.
+ */
+static int rpmsg_send_frags(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+		const struct kvec *vec, size_t nvec, size_t len, long timeout)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	size_t max = vrp->buf_size - sizeof(struct rpmsg_hdr);
+	size_t offset = 0, v = 0, voff = 0;
+	struct rpmsg_hdr *msg;
+	int err = 0, num = 0;
+
+	if (len > RPMSG_FRAG_MAX_SIZE) {
+		dev_err(&rpdev->dev, "message is too big (%zu)\n", len);
+		return -EMSGSIZE;
+	}
+
+	rpmsg_cork(rpdev);
+
+	while (offset < len) {
+		size_t chunk = min(max, len - offset), left, n;
+		void *p;
+
+		msg = rpmsg_get_tx_buf_wait(rpdev, chunk, timeout);
+		if (IS_ERR(msg)) {
+			err = PTR_ERR(msg);
+			break;
+		}
+
+		msg->flags = offset + chunk < len ? RPMSG_HDR_MORE_FRAGS : 0;
+		msg->src = src;
+		msg->dst = dst;
+		msg->reserved = offset;
+
+		for (p = msg->data, left = chunk; left; p += n, left -= n) {
+			n = min(left, vec[v].iov_len - voff);
+			memcpy(p, vec[v].iov_base + voff, n);
+			voff += n;
+			if (voff == vec[v].iov_len) {
+				v++;
+				voff = 0;
+			}
+		}
+
+		err = rpmsg_send_msg(rpdev, msg);
+		if (err)
+			break;
+
+		offset += chunk;
+
+		if (!(++num % RPMSG_FRAG_KICK_BATCH))
+			rpmsg_flush_tx(vrp);
+	}
+
+	rpmsg_uncork(rpdev);
+
+	return err;
+}
+
+/**
+ * rpmsg_send_offchannel_raw() - send a message across to the remote processor
+ * @rpdev: the rpmsg channel
+ * @src: source address
+ * @dst: destination address
+ * @data: payload of message
+ * @len: length of payload
+ * @wait: indicates whether caller should block in case no TX buffers available
+ *
+ * This function is the base implementation for all of the rpmsg sending API.
+ *
+ * It will send @data of length @len to @dst, and say it's from @src. The
+ * message will be sent to the remote processor which the @rpdev channel
+ * belongs to.
+ *
+ * The message is sent using one of the TX buffers that are available for
+ * communication with this remote processor.
+ *
+ * If @wait is true, the caller will be blocked until either a TX buffer is
+ * available, or the channel's @tx_timeout elapses (15 seconds by default;
+ * we don't want callers to sleep indefinitely due to misbehaving remote
+ * processors), and in that case -ERESTARTSYS is returned.
+ *
+ * Otherwise, if @wait is false, and there are no TX buffers available,
+ * the function will immediately fail, and -ENOMEM will be returned.
+ *
+ * In both cases, if the channel's @tx_spin_us is set, the caller first
+ * busy-polls for a TX buffer for up to @tx_spin_us microseconds.
+ *
+ * If the remote processor supports VIRTIO_RPMSG_F_FRAG, payloads that
+ * don't fit in a single rx buffer of the remote processor are sent in
+ * several fragments (using a TX buffer each), which the remote processor
+ * reassembles. Such payloads may be up to 64KB long. Fragmented messages
+ * must not be sent concurrently with the same @src and @dst, since their
+ * fragments would then interleave.
+ *
+ * Normally drivers shouldn't use this function directly; instead, drivers
+ * should use the appropriate rpmsg_{try}send{to, _offchannel} API
+ * (see include/linux/rpmsg.h).
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+int rpmsg_send_offchannel_raw(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+					void *data, int len, bool wait)
+{
+	long timeout = wait ? rpdev->tx_timeout : 0;
+
+	return rpmsg_send_offchannel_timeout(rpdev, src, dst, data, len,
+								timeout);
+}
+EXPORT_SYMBOL(rpmsg_send_offchannel_raw);
+
+/**
+ * rpmsg_send_offchannel_timeout() - send a message, with an explicit timeout
+ * @rpdev: the rpmsg channel
+ * @src: source address
+ * @dst: destination address
+ * @data: payload of message
+ * @len: length of payload
+ * @timeout: how long (in jiffies) to wait for a TX buffer, if none is
+ *	     available. 0 means don't wait at all, MAX_SCHEDULE_TIMEOUT
+ *	     means wait indefinitely.
+ *
+ * This function is identical to rpmsg_send_offchannel_raw(), except that
+ * instead of using the channel's @tx_timeout, the caller provides the time
+ * it is willing to wait for a TX buffer in this specific call.
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+int rpmsg_send_offchannel_timeout(struct rpmsg_channel *rpdev, u32 src,
+			u32 dst, void *data, int len, long timeout)
+{
+	struct device *dev = &rpdev->dev;
+	struct rpmsg_hdr *msg;
+	ktime_t start = ktime_get();
+	int err;
+
+	if (src == RPMSG_ADDR_ANY || dst == RPMSG_ADDR_ANY) {
+		dev_err(dev, "invalid addr (src 0x%x, dst 0x%x)\n", src, dst);
+		return -EINVAL;
+	}
+
+	err = rpmsg_take_credit(rpdev, dst, timeout);
+	if (err)
+		return err;
+
+	if (len >= 0 && rpmsg_needs_frags(rpdev->vrp, len)) {
+		struct kvec vec = { .iov_base = data, .iov_len = len };
+
+		err = rpmsg_send_frags(rpdev, src, dst, &vec, 1, len, timeout);
+		goto out;
+	}
+
+	msg = rpmsg_get_tx_buf_wait(rpdev, len, timeout);
+	if (IS_ERR(msg)) {
+		err = PTR_ERR(msg);
+		goto out;
+	}
+
+	msg->flags = 0;
+	msg->src = src;
+	msg->dst = dst;
+	msg->reserved = 0;
+	memcpy(msg->data, data, len);
+
+	err = rpmsg_send_msg(rpdev, msg);
+out:
+	if (!err)
+		rpmsg_tx_account_latency(rpdev->vrp, start);
+	else
+		rpmsg_put_credit(rpdev->vrp, dst);
+
+	return err;
+}
+EXPORT_SYMBOL(rpmsg_send_offchannel_timeout);
+
+/**
+ * rpmsg_sendv_offchannel_raw() - send a message gathered from several buffers
+ * @rpdev: the rpmsg channel
+ * @src: source address
+ * @dst: destination address
+ * @vec: the buffers that make up the payload of the message, in order
+ * @nvec: number of buffers in @vec
+ * @wait: indicates whether caller should block in case no TX buffers available
+ *
+ * This is the vectored flavor of rpmsg_send_offchannel_raw(): the payload
+ * is gathered from the @nvec buffers described by @vec straight into the
+ * TX buffer, so drivers that build their messages out of several pieces
+ * (e.g. a protocol header and a payload) don't have to flatten them into
+ * an intermediate buffer first.
+ *
+ * The blocking semantics of @wait are identical to those of
+ * rpmsg_send_offchannel_raw().
+ *
+ * Normally drivers shouldn't use this function directly; instead, drivers
+ * should use rpmsg_sendv() or rpmsg_sendtov() (see include/linux/rpmsg.h).
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+int rpmsg_sendv_offchannel_raw(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+			const struct kvec *vec, size_t nvec, bool wait)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct device *dev = &rpdev->dev;
+	struct rpmsg_hdr *msg;
+	ktime_t start = ktime_get();
+	size_t i, len = 0;
+	void *p;
+	int err;
+
+	if (src == RPMSG_ADDR_ANY || dst == RPMSG_ADDR_ANY) {
+		dev_err(dev, "invalid addr (src 0x%x, dst 0x%x)\n", src, dst);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nvec; i++)
+		len += vec[i].iov_len;
+
+	err = rpmsg_take_credit(rpdev, dst, wait ? rpdev->tx_timeout : 0);
+	if (err)
+		return err;
+
+	if (rpmsg_needs_frags(vrp, len)) {
+		err = rpmsg_send_frags(rpdev, src, dst, vec, nvec, len,
+					wait ? rpdev->tx_timeout : 0);
+		goto out;
+	}
+
+	msg = rpmsg_get_tx_buf_wait(rpdev, len, wait ? rpdev->tx_timeout : 0);
+	if (IS_ERR(msg)) {
+		err = PTR_ERR(msg);
+		goto out;
+	}
+
+	msg->flags = 0;
+	msg->src = src;
+	msg->dst = dst;
+	msg->reserved = 0;
+
+	/* gather the payload directly into the tx buffer */
+	for (i = 0, p = msg->data; i < nvec; p += vec[i].iov_len, i++)
+		memcpy(p, vec[i].iov_base, vec[i].iov_len);
+
+	err = rpmsg_send_msg(rpdev, msg);
+out:
+	if (!err)
+		rpmsg_tx_account_latency(vrp, start);
+	else
+		rpmsg_put_credit(vrp, dst);
+
+	return err;
+}
+EXPORT_SYMBOL(rpmsg_sendv_offchannel_raw);
+
+/* grab a tx buffer out of the space reserved for urgent messages */
+static struct rpmsg_hdr *rpmsg_get_urgent_tx_buf(struct virtproc_info *vrp,
+								int len)
+{
+	size_t size = sizeof(struct rpmsg_hdr) + len;
+	struct rpmsg_hdr *msg;
+	unsigned long flags;
+
+	if (!vrp->tx_urgent_pool)
+		return NULL;
+
+	msg = (void *) gen_pool_alloc(vrp->tx_urgent_pool, size);
+	if (!msg) {
+		/* urgent messages that were already consumed can be recycled */
+		spin_lock_irqsave(&vrp->tx_lock, flags);
+		__rpmsg_reclaim_tx_bufs(vrp);
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+		msg = (void *) gen_pool_alloc(vrp->tx_urgent_pool, size);
+		if (!msg)
+			return NULL;
+	}
+
+	atomic_add(ALIGN(size, 1 << RPMSG_TX_ALLOC_ORDER), &vrp->tx_bytes_used);
+	atomic_inc(&vrp->tx_reserved);
+
+	msg->len = len;
+
+	return msg;
+}
+
+/**
+ * rpmsg_send_urgent_offchannel() - send an urgent message
+ * @rpdev: the rpmsg channel
+ * @src: source address
+ * @dst: destination address
+ * @data: payload of message
+ * @len: length of payload
+ * @wait: indicates whether caller should block in case no TX buffers available
+ *
+ * This is rpmsg_send_offchannel_raw() for the (rare) messages that can't
+ * wait behind the bulk traffic of the channel, e.g. a "stop decoding"
+ * command on a channel that also carries the bitstream.
+ *
+ * Urgent messages first try to use the tx space that is reserved for
+ * them, so they don't wait for a tx buffer even if bulk senders have
+ * exhausted all the others. If the remote processor supports a high
+ * priority virtqueue pair (VIRTIO_RPMSG_F_PRIO), they are also sent on it,
+ * so they are handled ahead of the bulk messages that are already queued,
+ * and they are kicked right away even if the channel is corked.
+ *
+ * Note that urgent messages might thus overtake the messages that were
+ * sent before them on the same channel. Urgent messages aren't fragmented,
+ * and are still subject to flow control credits.
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+int rpmsg_send_urgent_offchannel(struct rpmsg_channel *rpdev, u32 src,
+				u32 dst, void *data, int len, bool wait)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct device *dev = &rpdev->dev;
+	long timeout = wait ? rpdev->tx_timeout : 0;
+	struct rpmsg_hdr *msg;
+	ktime_t start = ktime_get();
+	int err;
+
+	if (src == RPMSG_ADDR_ANY || dst == RPMSG_ADDR_ANY) {
+		dev_err(dev, "invalid addr (src 0x%x, dst 0x%x)\n", src, dst);
+		return -EINVAL;
+	}
+
+	if (len < 0 || len > vrp->tx_max_size - sizeof(*msg)) {
+		dev_err(dev, "message is too big (%d)\n", len);
+		return -EMSGSIZE;
+	}
+
+	err = rpmsg_take_credit(rpdev, dst, timeout);
+	if (err)
+		return err;
+
+	/* fall back to the regular tx space if the reserve is used up */
+	msg = rpmsg_get_urgent_tx_buf(vrp, len);
+	if (!msg)
+		msg = rpmsg_get_tx_buf_wait(rpdev, len, timeout);
+	if (IS_ERR(msg)) {
+		err = PTR_ERR(msg);
+		goto out;
+	}
+
+	msg->flags = 0;
+	msg->src = src;
+	msg->dst = dst;
+	msg->reserved = 0;
+	memcpy(msg->data, data, len);
+
+	err = __rpmsg_send_msg(rpdev, msg, true);
+out:
+	if (!err)
+		rpmsg_tx_account_latency(vrp, start);
+	else
+		rpmsg_put_credit(vrp, dst);
+
+	return err;
+}
+EXPORT_SYMBOL(rpmsg_send_urgent_offchannel);
+
+/**
+ * rpmsg_alloc_tx_buf() - reserve a tx buffer for a zero-copy send
+ * @rpdev: the rpmsg channel
+ * @len: maximum length of the payload that will be written to the buffer
+ * @wait: indicates whether caller should block in case no TX buffers available
+ *
+ * This is the first half of the zero-copy sending API: it reserves a TX
+ * buffer, big enough to hold @len bytes of payload, and returns a pointer
+ * to its payload area. The caller should then construct its message
+ * directly in there, and send it using rpmsg_send_prepared() (or
+ * give the buffer back using rpmsg_free_tx_buf(), if it changed its mind).
+ *
+ * This way the payload is written only once, straight into the memory
+ * that is shared with the remote processor, instead of being built in
+ * a private buffer and then copied over by rpmsg_send().
+ *
+ * The blocking semantics of @wait are identical to those of
+ * rpmsg_send_offchannel_raw().
+ *
+ * Returns a pointer to the payload area on success, or an ERR_PTR()
+ * value on failure.
+ */
+void *rpmsg_alloc_tx_buf(struct rpmsg_channel *rpdev, int len, bool wait)
+{
+	struct rpmsg_hdr *msg;
+
+	msg = rpmsg_get_tx_buf_wait(rpdev, len, wait ? rpdev->tx_timeout : 0);
+	if (IS_ERR(msg))
+		return msg;
+
+	return msg->data;
+}
+EXPORT_SYMBOL(rpmsg_alloc_tx_buf);
+
+/* shrink a reserved tx buffer down to a (possibly) shorter payload length */
+static void rpmsg_trim_tx_buf(struct virtproc_info *vrp, struct rpmsg_hdr *msg,
+								int len)
+{
+	unsigned long unit = 1UL << RPMSG_TX_ALLOC_ORDER;
+	unsigned long used = ALIGN(sizeof(*msg) + len, unit);
+	unsigned long reserved = ALIGN(rpmsg_tx_buf_size(msg), unit);
+
+	if (reserved > used) {
+		rpmsg_tx_pool_free(vrp, (void *) msg + used, reserved - used);
+		if (atomic_read(&vrp->sleepers))
+			wake_up_interruptible(&vrp->sendq);
+	}
+
+	msg->len = len;
+}
+
+/**
+ * rpmsg_send_prepared() - send a message that was built in a reserved buffer
+ * @rpdev: the rpmsg channel
+ * @src: source address
+ * @dst: destination address
+ * @buf: payload area previously returned by rpmsg_alloc_tx_buf()
+ * @len: actual length of the payload (might be smaller than reserved)
+ *
+ * This is the second half of the zero-copy sending API: it sends the
+ * message the caller has written into @buf to @dst, and says it's from
+ * @src. If the message is shorter than what was reserved, the remaining
+ * space is given back to the TX pool.
+ *
+ * Ownership of @buf is passed to rpmsg, whether this function succeeds
+ * or not, so the caller must not access @buf anymore after calling it.
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+int rpmsg_send_prepared(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+							void *buf, int len)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	struct device *dev = &rpdev->dev;
+	struct rpmsg_hdr *msg = container_of(buf, struct rpmsg_hdr, data);
+	int err;
+
+	if (src == RPMSG_ADDR_ANY || dst == RPMSG_ADDR_ANY ||
+						len < 0 || len > msg->len) {
+		dev_err(dev, "invalid msg (src 0x%x, dst 0x%x, len %d)\n",
+							src, dst, len);
+		put_a_tx_buf(vrp, msg);
+		return -EINVAL;
+	}
+
+	/* we can't wait for a credit here, as the caller might not sleep */
+	if (rpmsg_take_credit(rpdev, dst, 0)) {
+		put_a_tx_buf(vrp, msg);
+		return -ENOMEM;
+	}
+
+	rpmsg_trim_tx_buf(vrp, msg, len);
+
+	msg->flags = 0;
+	msg->src = src;
+	msg->dst = dst;
+	msg->reserved = 0;
+
+	err = rpmsg_send_msg(rpdev, msg);
+	if (err)
+		rpmsg_put_credit(vrp, dst);
+
+	return err;
+}
+EXPORT_SYMBOL(rpmsg_send_prepared);
+
+/**
+ * rpmsg_free_tx_buf() - give back a reserved tx buffer without sending it
+ * @rpdev: the rpmsg channel
+ * @buf: payload area previously returned by rpmsg_alloc_tx_buf()
+ */
+void rpmsg_free_tx_buf(struct rpmsg_channel *rpdev, void *buf)
+{
+	struct rpmsg_hdr *msg = container_of(buf, struct rpmsg_hdr, data);
+
+	put_a_tx_buf(rpdev->vrp, msg);
+
+	if (atomic_read(&rpdev->vrp->sleepers))
+		rpmsg_fire_tx_waiters(rpdev->vrp);
+}
+EXPORT_SYMBOL(rpmsg_free_tx_buf);
+
+/**
+ * rpmsg_tx_notify() - ask to be notified when tx space is available
+ * @rpdev: the rpmsg channel
+ * @w: the waiter, initialized using rpmsg_init_tx_waiter()
+ *
+ * Senders that can't block, and whose non-blocking send just failed
+ * with -ENOMEM, may use this function in order to have their @w->cb
+ * invoked once tx space may have become available again (typically
+ * when the remote processor consumes some of the pending messages).
+ * The callback would then normally retry sending.
+ *
+ * The callback is invoked once per registration, possibly from an
+ * interrupt context, so it must not sleep.
+ *
+ * Returns 0 on success, or -EBUSY if @w is already registered.
+ */
+int rpmsg_tx_notify(struct rpmsg_channel *rpdev, struct rpmsg_tx_waiter *w)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	int freed;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vrp->tx_waiters_lock, flags);
+	if (!list_empty(&w->node)) {
+		spin_unlock_irqrestore(&vrp->tx_waiters_lock, flags);
+		return -EBUSY;
+	}
+	w->rpdev = rpdev;
+	list_add_tail(&w->node, &vrp->tx_waiters);
+	spin_unlock_irqrestore(&vrp->tx_waiters_lock, flags);
+
+	/* enable "tx-complete" interrupts, if not already enabled */
+	rpmsg_upref_sleepers(vrp);
+
+	/*
+	 * buffers might have been consumed before the interrupts were
+	 * enabled, in which case we'd never be notified about them
+	 */
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	freed = __rpmsg_reclaim_tx_bufs(vrp);
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	if (freed)
+		rpmsg_fire_tx_waiters(vrp);
+
+	return 0;
+}
+EXPORT_SYMBOL(rpmsg_tx_notify);
+
+/**
+ * rpmsg_tx_notify_cancel() - cancel a pending tx space notification
+ * @rpdev: the rpmsg channel
+ * @w: a waiter previously registered using rpmsg_tx_notify()
+ *
+ * Note that @w->cb might still be running when this function returns,
+ * if it was already invoked.
+ */
+void rpmsg_tx_notify_cancel(struct rpmsg_channel *rpdev,
+						struct rpmsg_tx_waiter *w)
+{
+	struct virtproc_info *vrp = rpdev->vrp;
+	bool pending;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vrp->tx_waiters_lock, flags);
+	pending = !list_empty(&w->node);
+	list_del_init(&w->node);
+	spin_unlock_irqrestore(&vrp->tx_waiters_lock, flags);
+
+	if (pending)
+		rpmsg_downref_sleepers(vrp);
+}
+EXPORT_SYMBOL(rpmsg_tx_notify_cancel);
+
+/**
+ * rpmsg_cork() - defer kicking the remote processor for a channel's messages
+ * @rpdev: the rpmsg channel
+ *
+ * Every message that is sent is normally followed by a kick, which
+ * usually costs an interrupt at the remote processor. While a channel is
+ * corked, its messages are still added to the tx virtqueue, but the kick
+ * is deferred until the channel is uncorked, so a burst of messages is
+ * signaled to the remote processor only once.
+ *
+ * Calls to rpmsg_cork() nest, and every one of them must be balanced
+ * by a call to rpmsg_uncork().
+ */
+void rpmsg_cork(struct rpmsg_channel *rpdev)
+{
+	atomic_inc(&rpdev->corked);
+}
+EXPORT_SYMBOL(rpmsg_cork);
+
+/**
+ * rpmsg_uncork() - kick the remote processor for the channel's corked messages
+ * @rpdev: the rpmsg channel
+ *
+ * See rpmsg_cork().
+ */
+void rpmsg_uncork(struct rpmsg_channel *rpdev)
+{
+	if (atomic_dec_and_test(&rpdev->corked))
+		rpmsg_flush_tx(rpdev->vrp);
+}
+EXPORT_SYMBOL(rpmsg_uncork);
+
+/**
+ * rpmsg_send_batch() - send several messages using a single kick
+ * @rpdev: the rpmsg channel
+ * @msgs: the payloads of the messages (one message per entry)
+ * @num: number of messages in @msgs
+ *
+ * This function sends @num messages on the @rpdev channel, in order,
+ * using @rpdev's source and destination addresses, and then kicks the
+ * remote processor only once for all of them.
+ *
+ * The blocking semantics are identical to those of rpmsg_send().
+ *
+ * Returns the number of messages that were sent, or an appropriate error
+ * value if the first message couldn't be sent.
+ */
+int rpmsg_send_batch(struct rpmsg_channel *rpdev, const struct kvec *msgs,
+								int num)
+{
+	int i, err = 0;
+
+	rpmsg_cork(rpdev);
+
+	for (i = 0; i < num; i++) {
+		err = rpmsg_send_offchannel_raw(rpdev, rpdev->src, rpdev->dst,
+				msgs[i].iov_base, msgs[i].iov_len, true);
+		if (err)
+			break;
+	}
+
+	rpmsg_uncork(rpdev);
+
+	return i ? i : err;
+}
+EXPORT_SYMBOL(rpmsg_send_batch);
+
+/* the rx virtqueue an rx buffer belongs to is implied by its index */
+static inline struct virtqueue *rpmsg_rx_vq(struct virtproc_info *vrp,
+								void *buf)
+{
+	if ((buf - vrp->rbufs) / vrp->buf_size < vrp->num_hi_rx_bufs)
+		return vrp->rvq[RPMSG_PRIO_HIGH];
+
+	return vrp->rvq[RPMSG_PRIO_NORMAL];
+}
+
+/*
+ * make an rx buffer available again for the remote processor.
+ * must be called with rvq_lock held. the caller is responsible for kicking
+ * the remote processor afterwards.
+ */
+static void __rpmsg_post_rx_buf(struct virtproc_info *vrp,
+						struct rpmsg_hdr *msg)
 {
-	struct virtproc_info *vrp = rpdev->vrp;
-	struct device *dev = &rpdev->dev;
 	struct scatterlist sg;
+	int err;
+
+	rpmsg_buf_to_sg(vrp, &sg, (void *) msg + vrp->hdr_off,
+					vrp->buf_size - vrp->hdr_off);
+
+	/* drop the lines of the last message, so they won't be stale next time */
+	rpmsg_sync_for_device(vrp, msg, min_t(size_t, sizeof(*msg) + msg->len,
+					vrp->buf_size), DMA_FROM_DEVICE);
+
+	/* we must be done reading the buffer before the remote can reuse it */
+	mb();
+
+	err = virtqueue_add_buf_gfp(rpmsg_rx_vq(vrp, msg), &sg, 0, 1, msg,
+								GFP_ATOMIC);
+	if (err < 0)
+		dev_err(&vrp->vdev->dev, "failed to add a virtqueue buffer: %d\n",
+									err);
+}
+
+/* how many rx buffers are posted at once by __rpmsg_post_rx_bufs() */
+#define RPMSG_RX_POST_BATCH	16
+
+/*
+ * make all the rx buffers that endpoints don't hold available for the
+ * remote processor, a batch at a time (each batch is exposed at once, and
+ * never spans both rx vqs). must be called with rvq_lock held, unless the
+ * rx vqs aren't in use yet. the caller is responsible for kicking the
+ * remote processor afterwards.
+ */
+static void __rpmsg_post_rx_bufs(struct virtproc_info *vrp, gfp_t gfp)
+{
+	struct scatterlist sg[RPMSG_RX_POST_BATCH];
+	void *bufs[RPMSG_RX_POST_BATCH];
+	unsigned int i, n = 0, added, total = vrp->num_bufs / 2;
+	struct virtqueue *vq = NULL, *next;
+	void *buf;
+	int err;
+
+	for (i = 0; i <= total; i++) {
+		buf = vrp->rbufs + i * vrp->buf_size;
+		next = i < total ? rpmsg_rx_vq(vrp, buf) : NULL;
+
+		/* post the batch once it's full, or the next buffer isn't its */
+		if (n && (n == RPMSG_RX_POST_BATCH || next != vq)) {
+			/* we must be done with the buffers before the remote */
+			mb();
+
+			added = n;
+			err = virtqueue_add_bufs_gfp(vq, sg, &added, 0, 1,
+								bufs, gfp);
+			if (err < 0)
+				dev_err(&vrp->vdev->dev, "failed to add %u "
+					"virtqueue buffers: %d\n", n - added,
+					err);
+			n = 0;
+		}
+
+		if (!next || vrp->rx_bufs[i].held)
+			continue;
+
+		vq = next;
+		rpmsg_buf_to_sg(vrp, &sg[n], buf + vrp->hdr_off,
+					vrp->buf_size - vrp->hdr_off);
+		rpmsg_sync_for_device(vrp, buf, vrp->buf_size, DMA_FROM_DEVICE);
+		bufs[n++] = buf;
+	}
+}
+
+/* find the state of the rx buffer that carries @msg */
+static inline struct rpmsg_rx_buf *rpmsg_msg_to_rx_buf(struct virtproc_info *vrp,
+						struct rpmsg_hdr *msg)
+{
+	unsigned long offset = ((unsigned long) msg) - ((unsigned long) vrp->rbufs);
+
+	return &vrp->rx_bufs[offset / vrp->buf_size];
+}
+
+/**
+ * rpmsg_hold_rx_buf() - keep an inbound message buffer beyond the rx callback
+ * @ept: the endpoint whose rx callback is currently running
+ * @data: the payload pointer that was handed to the rx callback
+ *
+ * Normally an rx callback must consume the message synchronously, because
+ * its buffer is given back to the remote processor as soon as the callback
+ * returns. Endpoints that set RPMSG_EPT_HOLD_RX in their @flags may
+ * instead call this function from within their rx callback, in order to
+ * keep the buffer (and thus avoid copying the message), and then give it
+ * back later using rpmsg_release_rx_buf().
+ *
+ * The returned handle describes the message, and its @node member is free
+ * for the holder to use (e.g. for queueing it) until the buffer is released.
+ *
+ * To make sure a slow endpoint can't starve the others, the number of rx
+ * buffers that can be held is limited, both per endpoint (see
+ * rpmsg_set_rx_quota()) and in total. When the limit is reached, NULL is
+ * returned, and the caller should fall back to copying the message.
+ *
+ * Returns the rx buffer handle on success, or NULL on failure.
+ */
+struct rpmsg_rx_buf *rpmsg_hold_rx_buf(struct rpmsg_endpoint *ept, void *data)
+{
+	struct virtproc_info *vrp = ept->vrp;
+	struct rpmsg_hdr *msg = container_of(data, struct rpmsg_hdr, data);
+	struct rpmsg_rx_buf *rxb;
+	int total = vrp->num_bufs / 2;
+
+	/* reassembled messages don't reside in an rx buffer */
+	if (data < vrp->rbufs || data >= vrp->rbufs + total * vrp->buf_size) {
+		dev_dbg(&vrp->vdev->dev, "can't hold a reassembled msg\n");
+		return NULL;
+	}
+
+	rxb = rpmsg_msg_to_rx_buf(vrp, msg);
+
+	if (!(ept->flags & RPMSG_EPT_HOLD_RX) || rxb->data != data) {
+		dev_err(&vrp->vdev->dev, "invalid rx buffer hold request\n");
+		return NULL;
+	}
+
+	spin_lock(&vrp->rvq_lock);
+
+	if (ept->rx_held >= (ept->rx_quota ?: vrp->rx_hold_max) ||
+			vrp->rx_held >= total / RPMSG_RX_HOLD_ALL_SHARE) {
+		spin_unlock(&vrp->rvq_lock);
+		dev_dbg(&vrp->vdev->dev, "rx hold quota exceeded (0x%x)\n",
+								ept->addr);
+		return NULL;
+	}
+
+	rxb->ept = ept;
+	rxb->held = true;
+	ept->rx_held++;
+	vrp->rx_held++;
+
+	spin_unlock(&vrp->rvq_lock);
+
+	/* the endpoint must outlive its held buffers */
+	kref_get(&ept->refcount);
+
+	return rxb;
+}
+EXPORT_SYMBOL(rpmsg_hold_rx_buf);
+
+/**
+ * rpmsg_set_rx_quota() - limit the number of rx buffers an endpoint may hold
+ * @ept: the endpoint
+ * @quota: max number of rx buffers @ept may hold, or 0 for the default
+ *
+ * By default, an endpoint may hold up to a quarter of the rx buffers of
+ * its remote processor (see rpmsg_hold_rx_buf()). Endpoints that carry bulk
+ * traffic may want to hold less (so they leave room for the control
+ * traffic of others), and endpoints that need deep queues may hold more,
+ * up to half of the rx buffers (the limit on all endpoints together).
+ *
+ * Lowering the quota below the number of buffers @ept currently holds
+ * doesn't take them back; it just fails further hold attempts until enough
+ * buffers are released.
+ *
+ * Returns 0 on success, or -EINVAL if @quota is out of range.
+ */
+int rpmsg_set_rx_quota(struct rpmsg_endpoint *ept, int quota)
+{
+	struct virtproc_info *vrp = ept->vrp;
+
+	if (quota < 0 || quota > vrp->num_bufs / 2 / RPMSG_RX_HOLD_ALL_SHARE)
+		return -EINVAL;
+
+	spin_lock(&vrp->rvq_lock);
+	ept->rx_quota = quota;
+	spin_unlock(&vrp->rvq_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(rpmsg_set_rx_quota);
+
+/**
+ * rpmsg_set_rx_credits() - flow control the messages sent to an endpoint
+ * @ept: the endpoint
+ * @credits: max number of messages the remote processor may have in flight
+ *	     to @ept, or 0 to disable flow control
+ *
+ * A bulk sender on the remote processor can quickly consume all our rx
+ * buffers when the endpoint it is sending to is slow to digest messages,
+ * which would then hold back the latency sensitive channels sharing the
+ * same vrings. Giving @ept a credits window throttles the remote sender
+ * of @ept alone instead: it may only send @credits messages, and @ept
+ * gives the credits back (in batches) as it consumes them, i.e. when its
+ * rx callback returns, or when a held buffer is released.
+ *
+ * This requires the remote processor to support VIRTIO_RPMSG_F_CREDITS.
+ * The new window is sent to the remote processor, so this function might
+ * sleep, and it should be called before the remote processor starts
+ * sending to @ept (e.g. from the probe function of the driver).
+ *
+ * Returns 0 on success, -EOPNOTSUPP if the remote processor doesn't
+ * support flow control, or an appropriate error value on failure.
+ */
+int rpmsg_set_rx_credits(struct rpmsg_endpoint *ept, int credits)
+{
+	struct virtproc_info *vrp = ept->vrp;
+	struct rpmsg_credit_msg msg;
+
+	if (!vrp->credit_ept)
+		return -EOPNOTSUPP;
+
+	if (!ept->rpdev || credits < 0)
+		return -EINVAL;
+
+	/* credits owed under the old window are covered by the new one */
+	ept->rx_credits = 0;
+	cancel_work_sync(&ept->credit_work);
+	atomic_set(&ept->rx_credits_owed, 0);
+	ept->rx_credits = credits;
+
+	msg.credits = credits ? credits : RPMSG_CREDITS_UNLIMITED;
+	msg.flags = RPMSG_CREDIT_SET;
+
+	return rpmsg_send_offchannel_raw(ept->rpdev, ept->addr,
+				RPMSG_CREDIT_ADDR, &msg, sizeof(msg), true);
+}
+EXPORT_SYMBOL(rpmsg_set_rx_credits);
+
+/**
+ * rpmsg_set_batch_cb() - have inbound messages delivered in batches
+ * @ept: the endpoint
+ * @batch_cb: the batch callback, or NULL to go back to @ept's rx callback
+ *
+ * Instead of invoking @ept's rx callback once per inbound message, the
+ * messages @ept receives during a single rx run (i.e. all the messages
+ * that are pending when the remote processor's notification is handled)
+ * are delivered together, in order, with a single invocation of
+ * @batch_cb (or a few of them, with bigger runs). High-rate drivers can
+ * then amortize their own locking and wakeups over the whole batch.
+ *
+ * The messages are valid until @batch_cb returns. They may be held by
+ * @batch_cb using rpmsg_hold_rx_buf(), just like by an rx callback.
+ * Reassembled fragmented messages are delivered in batches of their own.
+ *
+ * This function might sleep, and it must not be called from an rx callback.
+ *
+ * Returns 0 on success, or -ENOMEM if the batch can't be allocated.
+ */
+int rpmsg_set_batch_cb(struct rpmsg_endpoint *ept,
+		void (*batch_cb)(struct rpmsg_channel *, struct rpmsg_rx_msg *,
+								int, void *))
+{
+	struct virtproc_info *vrp = ept->vrp;
+	struct rpmsg_rx_msg *batch = NULL;
+
+	if (batch_cb && !ept->rx_batch) {
+		batch = kcalloc(RPMSG_RX_BATCH_MAX, sizeof(*batch), GFP_KERNEL);
+		if (!batch)
+			return -ENOMEM;
+	}
+
+	/* batches only exist during rx runs, so this can't race with one */
+	mutex_lock(&vrp->rx_lock);
+	if (batch)
+		ept->rx_batch = batch;
+	ept->batch_cb = batch_cb;
+	mutex_unlock(&vrp->rx_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(rpmsg_set_batch_cb);
+
+/**
+ * rpmsg_pa_to_da() - find where the remote processor sees a buffer
+ * @rpdev: the rpmsg channel
+ * @pa: physical address of the buffer
+ * @len: length of the buffer, in bytes
+ * @da: where to store the device address of the buffer
+ *
+ * Some payloads (e.g. video frames) are far too big to be copied through
+ * rpmsg buffers, so drivers share them with the remote processor out of
+ * band, and only send it a reference to them. This function translates
+ * the physical address of such a buffer to the device address the remote
+ * processor should use to access it (i.e. through its IOMMU).
+ *
+ * The whole buffer must be mapped, contiguously, by the remote processor,
+ * so that drivers can't use this to expose memory it has no business with.
+ *
+ * Returns 0 on success, or -EINVAL if the buffer isn't accessible by the
+ * remote processor.
+ */
+int rpmsg_pa_to_da(struct rpmsg_channel *rpdev, phys_addr_t pa, size_t len,
+								u32 *da)
+{
+	const struct rproc_mem_entry *me = rpdev->vrp->mem_maps;
+
+	if (!len || pa + len - 1 < pa)
+		return -EINVAL;
+
+	/* no IOMMU: the remote processor accesses physical memory directly */
+	if (!me) {
+		if (pa + len - 1 > (u32)~0U)
+			return -EINVAL;
+		*da = pa;
+		return 0;
+	}
+
+	for (; me->size; me++) {
+		if (pa >= me->pa && pa + len - 1 <= me->pa + me->size - 1) {
+			*da = me->da + (pa - me->pa);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+EXPORT_SYMBOL(rpmsg_pa_to_da);
+
+/**
+ * rpmsg_release_rx_buf() - give back a held inbound message buffer
+ * @rxb: the rx buffer handle returned by rpmsg_hold_rx_buf()
+ *
+ * The buffer is handed back to the remote processor, so the caller must
+ * not access the message after calling this function.
+ *
+ * Must not be called from an rx callback.
+ */
+void rpmsg_release_rx_buf(struct rpmsg_rx_buf *rxb)
+{
+	struct virtproc_info *vrp = rxb->vrp;
+	struct rpmsg_hdr *msg = container_of(rxb->data, struct rpmsg_hdr, data);
+	struct rpmsg_endpoint *ept = rxb->ept;
+
+	spin_lock(&vrp->rvq_lock);
+
+	ept->rx_held--;
+	rxb->ept = NULL;
+	rxb->held = false;
+	vrp->rx_held--;
+
+	/* rx buffers released during a reset are given back after it */
+	if (!vrp->rx_resetting) {
+		__rpmsg_post_rx_buf(vrp, msg);
+		virtqueue_kick(rpmsg_rx_vq(vrp, msg));
+	}
+
+	spin_unlock(&vrp->rvq_lock);
+
+	rpmsg_rx_credit_consumed(ept);
+
+	/* this might be the last reference to an already destroyed endpoint */
+	kref_put(&ept->refcount, __rpmsg_ept_release);
+}
+EXPORT_SYMBOL(rpmsg_release_rx_buf);
+
+/* drop the reassembly state of a message */
+static void rpmsg_frag_free(struct virtproc_info *vrp, struct rpmsg_frag *frag)
+{
+	list_del(&frag->node);
+	vrp->num_rx_frags--;
+	vrp->rx_frag_bytes -= frag->len;
+	kfree(frag->data);
+	kfree(frag);
+}
+
+/*
+ * add an inbound fragment to the message it belongs to. the fragments of
+ * a message arrive in order, and each one carries its payload offset in
+ * the reserved field of its header.
+ *
+ * returns the reassembled message once its last fragment has arrived (the
+ * caller should then kfree() both the message and its data), or NULL
+ * otherwise. must be called with rx_lock held.
+ */
+static struct rpmsg_frag *rpmsg_frag_add(struct virtproc_info *vrp,
+						struct rpmsg_hdr *msg)
+{
+	struct device *dev = &vrp->vdev->dev;
+	struct rpmsg_frag *frag, *found = NULL;
+	void *data;
+
+	list_for_each_entry(frag, &vrp->rx_frags, node) {
+		if (frag->src == msg->src && frag->dst == msg->dst) {
+			found = frag;
+			break;
+		}
+	}
+	frag = found;
+
+	if (!msg->reserved) {
+		/* a new message; what's left of a previous one is incomplete */
+		if (frag) {
+			dev_err(dev, "incomplete msg from 0x%x dropped\n",
+								frag->src);
+			rpmsg_frag_free(vrp, frag);
+			vrp->rx_dropped++;
+		}
+
+		/* make room by dropping the oldest message, if needed */
+		if (vrp->num_rx_frags >= RPMSG_FRAG_MAX_MSGS) {
+			frag = list_first_entry(&vrp->rx_frags,
+						struct rpmsg_frag, node);
+			dev_err(dev, "stale msg from 0x%x dropped\n",
+								frag->src);
+			rpmsg_frag_free(vrp, frag);
+			vrp->rx_dropped++;
+		}
+
+		frag = kzalloc(sizeof(*frag), GFP_KERNEL);
+		if (!frag) {
+			vrp->rx_dropped++;
+			return NULL;
+		}
+
+		frag->src = msg->src;
+		frag->dst = msg->dst;
+		list_add_tail(&frag->node, &vrp->rx_frags);
+		vrp->num_rx_frags++;
+	} else if (!frag || frag->len != msg->reserved) {
+		dev_err(dev, "unexpected fragment from 0x%x (offset %u)\n",
+						msg->src, msg->reserved);
+		if (frag)
+			rpmsg_frag_free(vrp, frag);
+		vrp->rx_dropped++;
+		return NULL;
+	}
+
+	if (frag->len + msg->len > RPMSG_FRAG_MAX_SIZE ||
+		vrp->rx_frag_bytes + msg->len > RPMSG_FRAG_MAX_BYTES) {
+		dev_err(dev, "no room to reassemble msg from 0x%x\n",
+								msg->src);
+		goto drop;
+	}
+
+	data = krealloc(frag->data, frag->len + msg->len, GFP_KERNEL);
+	if (!data)
+		goto drop;
+
+	memcpy(data + frag->len, msg->data, msg->len);
+	frag->data = data;
+	frag->len += msg->len;
+	vrp->rx_frag_bytes += msg->len;
+
+	if (msg->flags & RPMSG_HDR_MORE_FRAGS)
+		return NULL;
+
+	/* that was the last fragment; the message is now the caller's */
+	list_del(&frag->node);
+	vrp->num_rx_frags--;
+	vrp->rx_frag_bytes -= frag->len;
+
+	return frag;
+
+drop:
+	rpmsg_frag_free(vrp, frag);
+	vrp->rx_dropped++;
+	return NULL;
+}
+
+/*
+ * deliver the pending batch of @ept, and make its buffers available again
+ * for the remote processor (except those its batch callback decided to
+ * hold). the caller is responsible for kicking the remote processor.
+ */
+static void rpmsg_rx_flush_batch(struct virtproc_info *vrp,
+					struct rpmsg_endpoint *ept)
+{
+	struct rpmsg_hdr *msg;
+	bool alive;
+	int i, idx;
+
+	/*
+	 * ept might have been destroyed since its messages were batched (e.g.
+	 * by a name service announcement). rpmsg_destroy_ept() waits for the
+	 * srcu read section to complete, so if ept is still there, it can't
+	 * go away while its batch callback is running.
+	 */
+	idx = srcu_read_lock(&vrp->ept_srcu);
+
+	rcu_read_lock();
+	alive = idr_find(&vrp->endpoints, ept->addr) == ept;
+	rcu_read_unlock();
+
+	if (alive && ept->batch_cb) {
+		ept->batch_cb(ept->rpdev, ept->rx_batch, ept->rx_batch_len,
+								ept->priv);
+	} else {
+		vrp->rx_dropped += ept->rx_batch_len;
+		dev_warn(&vrp->vdev->dev, "batch received with no recepient\n");
+	}
+
+	for (i = 0; i < ept->rx_batch_len; i++) {
+		msg = container_of(ept->rx_batch[i].data, struct rpmsg_hdr,
+									data);
+
+		/* the recipient might have decided to keep the buffer for now */
+		if (rpmsg_msg_to_rx_buf(vrp, msg)->held)
+			continue;
+
+		if (alive)
+			rpmsg_rx_credit_consumed(ept);
+
+		spin_lock(&vrp->rvq_lock);
+		__rpmsg_post_rx_buf(vrp, msg);
+		spin_unlock(&vrp->rvq_lock);
+	}
+
+	srcu_read_unlock(&vrp->ept_srcu, idx);
+
+	ept->rx_batch_len = 0;
+	list_del_init(&ept->rx_batch_node);
+
+	/* this might be the last reference to an already destroyed endpoint */
+	kref_put(&ept->refcount, __rpmsg_ept_release);
+}
+
+/* add an inbound message to the pending batch of @ept */
+static void rpmsg_rx_batch_add(struct virtproc_info *vrp,
+			struct rpmsg_endpoint *ept, struct rpmsg_hdr *msg)
+{
+	struct rpmsg_rx_msg *m = &ept->rx_batch[ept->rx_batch_len++];
+
+	m->data = msg->data;
+	m->len = msg->len;
+	m->src = msg->src;
+
+	/* the endpoint must outlive its pending batch */
+	if (ept->rx_batch_len == 1) {
+		kref_get(&ept->refcount);
+		list_add_tail(&ept->rx_batch_node, &vrp->rx_batches);
+	}
+
+	if (ept->rx_batch_len == RPMSG_RX_BATCH_MAX)
+		rpmsg_rx_flush_batch(vrp, ept);
+}
+
+/*
+ * digest a single inbound message, and make its buffer available again
+ * for the remote processor (unless its recipient decided to hold it).
+ * The caller is responsible for kicking the remote processor afterwards.
+ */
+static void rpmsg_recv_single(struct virtproc_info *vrp, struct device *dev,
+						struct rpmsg_hdr *msg)
+{
+	struct rpmsg_endpoint *ept;
+	struct rpmsg_rx_buf *rxb = rpmsg_msg_to_rx_buf(vrp, msg);
+	struct rpmsg_frag *frag = NULL;
+	void *data = msg->data;
+	int idx, len = msg->len;
+
+	dev_dbg(dev, "From: 0x%x, To: 0x%x, Len: %d, Flags: %d, Reserved: %d\n",
+					msg->src, msg->dst, msg->len,
+					msg->flags, msg->reserved);
+
+	/* don't let the remote processor trick us into overrunning buffers */
+	if (sizeof(*msg) + msg->len > vrp->buf_size) {
+		dev_err(dev, "inbound msg too big: (%d)\n", msg->len);
+		vrp->rx_dropped++;
+		goto repost;
+	}
+
+	vrp->rx_bytes += msg->len;
+	if (vrp->rx_run_time.tv64)
+		rpmsg_hist_add(&vrp->rx_lat,
+			ktime_us_delta(ktime_get(), vrp->rx_run_time));
+
+	rpmsg_sync_for_cpu(vrp, msg->data, msg->len, DMA_FROM_DEVICE);
+
+	trace_rpmsg_recv(rpmsg_rx_vq(vrp, msg), msg->src, msg->dst, msg->len);
+
+	rpmsg_capture_msg(vrp, msg, false);
+
+	/* fragments are only delivered once their message is reassembled */
+	if ((msg->flags & RPMSG_HDR_MORE_FRAGS || msg->reserved) &&
+					rpmsg_frags_enabled(vrp)) {
+		frag = rpmsg_frag_add(vrp, msg);
+		if (!frag)
+			goto repost;
+
+		data = frag->data;
+		len = frag->len;
+	}
+
+	rxb->data = msg->data;
+	rxb->len = msg->len;
+	rxb->src = msg->src;
+
+	/*
+	 * The name service endpoint lives as long as vrp does, and its
+	 * callback may destroy channels (and thus wait for in-flight rx
+	 * callbacks to complete), so it is invoked outside the srcu section.
+	 */
+	if (msg->dst == RPMSG_NS_ADDR && vrp->ns_ept) {
+		ept = vrp->ns_ept;
+		ept->rx_msgs++;
+		ept->rx_bytes += len;
+		ept->cb(ept->rpdev, data, len, ept->priv, msg->src);
+		goto out;
+	}
+
+	/*
+	 * Use the dst addr to fetch the callback of the appropriate user.
+	 * rpmsg_destroy_ept() waits for the srcu read section to complete,
+	 * so ept can't go away while its callback is running.
+	 */
+	idx = srcu_read_lock(&vrp->ept_srcu);
+
+	rcu_read_lock();
+	ept = idr_find(&vrp->endpoints, msg->dst);
+	rcu_read_unlock();
+
+	if (ept && ept->batch_cb && !frag) {
+		ept->rx_msgs++;
+		ept->rx_bytes += len;
+		rpmsg_rx_batch_add(vrp, ept, msg);
+		srcu_read_unlock(&vrp->ept_srcu, idx);
+		/* the buffer is made available again along with its batch */
+		return;
+	}
+
+	if (ept && ept->batch_cb) {
+		struct rpmsg_rx_msg one = { data, len, msg->src };
+
+		ept->rx_msgs++;
+		ept->rx_bytes += len;
+
+		/* keep the messages in order */
+		if (ept->rx_batch_len)
+			rpmsg_rx_flush_batch(vrp, ept);
+
+		ept->batch_cb(ept->rpdev, &one, 1, ept->priv);
+
+		rpmsg_rx_credit_consumed(ept);
+	} else if (ept && ept->cb) {
+		ept->rx_msgs++;
+		ept->rx_bytes += len;
+		ept->cb(ept->rpdev, data, len, ept->priv, msg->src);
+
+		/* held messages are only consumed when they are released */
+		if (!rxb->held)
+			rpmsg_rx_credit_consumed(ept);
+	} else {
+		vrp->rx_dropped++;
+		dev_warn(dev, "msg received with no recepient\n");
+	}
+
+	srcu_read_unlock(&vrp->ept_srcu, idx);
+
+out:
+	if (frag) {
+		kfree(frag->data);
+		kfree(frag);
+	}
+
+	/* the recipient might have decided to keep the buffer for now */
+	if (rxb->held)
+		return;
+
+repost:
+	/* add the buffer back to the remote processor's virtqueue */
+	spin_lock(&vrp->rvq_lock);
+	__rpmsg_post_rx_buf(vrp, msg);
+	spin_unlock(&vrp->rvq_lock);
+}
+
+static int rpmsg_rx_slot_cmp_dst(const void *a, const void *b)
+{
+	const struct rpmsg_rx_slot *x = a, *y = b;
+
+	if (x->dst != y->dst)
+		return x->dst < y->dst ? -1 : 1;
+
+	return x->seq - y->seq;
+}
+
+static int rpmsg_rx_slot_cmp_round(const void *a, const void *b)
+{
+	const struct rpmsg_rx_slot *x = a, *y = b;
+
+	if (x->round != y->round)
+		return x->round - y->round;
+
+	return x->seq - y->seq;
+}
+
+/*
+ * Reorder the messages of an rx run so they are dispatched round-robin
+ * across their endpoints: first the oldest message of every endpoint, then
+ * the second oldest one of every endpoint, etc. This way a burst of bulk
+ * messages to one endpoint doesn't delay, say, a control message to
+ * another one. The order of the messages of any given endpoint is kept.
+ */
+static void rpmsg_rx_fair_order(struct rpmsg_rx_slot *slots, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+		slots[i].seq = i;
+
+	/* group the messages by endpoint, and number them within each group */
+	sort(slots, num, sizeof(*slots), rpmsg_rx_slot_cmp_dst, NULL);
+
+	for (i = 0; i < num; i++)
+		slots[i].round = i && slots[i].dst == slots[i - 1].dst ?
+						slots[i - 1].round + 1 : 0;
+
+	sort(slots, num, sizeof(*slots), rpmsg_rx_slot_cmp_round, NULL);
+}
+
+/* take up to @max used rx buffers off @rvq, and note their recipients */
+static unsigned int rpmsg_rx_collect(struct virtproc_info *vrp,
+			struct virtqueue *rvq, struct rpmsg_rx_slot *slots,
+			unsigned int max)
+{
 	struct rpmsg_hdr *msg;
-	int err;
-	unsigned long offset;
-	phys_addr_t phys_addr;
+	unsigned int len, num = 0;
 
-	if (src == RPMSG_ADDR_ANY || dst == RPMSG_ADDR_ANY) {
-		dev_err(dev, "invalid addr (src 0x%x, dst 0x%x)\n", src, dst);
-		return -EINVAL;
+	while (num < max) {
+		spin_lock(&vrp->rvq_lock);
+		msg = virtqueue_get_buf(rvq, &len);
+		spin_unlock(&vrp->rvq_lock);
+		if (!msg)
+			break;
+
+		/* don't read the message before the remote is done writing it */
+		rmb();
+
+		/* the header tells us how much of the buffer is worth syncing */
+		rpmsg_sync_for_cpu(vrp, msg, sizeof(*msg), DMA_FROM_DEVICE);
+
+		rpmsg_unpack_hdr(vrp, msg);
+
+		slots[num].msg = msg;
+		slots[num].dst = msg->dst;
+		num++;
+	}
+
+	return num;
+}
+
+/**
+ * rpmsg_rx_drain() - process the inbound messages pending in the rx vqs
+ * @vrp: virtual remote processor state
+ *
+ * @budget: max number of messages to process
+ *
+ * Consume up to @budget used rx buffers, dispatch their messages, and
+ * then give all of them back to the remote processor using a single kick
+ * per rx virtqueue.
+ *
+ * Messages of the high priority rx virtqueue (if any) are dispatched
+ * first, in order. The others are dispatched fairly across their
+ * endpoints (see rpmsg_rx_fair_order()).
+ *
+ * Returns the number of messages processed.
+ */
+static unsigned int rpmsg_rx_drain(struct virtproc_info *vrp,
+							unsigned int budget)
+{
+	struct device *dev = &vrp->vdev->dev;
+	struct rpmsg_rx_slot *slots = vrp->rx_slots;
+	unsigned int i, num_hi = 0, num, msgs_recvd;
+
+	mutex_lock(&vrp->rx_lock);
+
+	/*
+	 * the pending messages might have been notified by an earlier run
+	 * (which ran out of budget), in which case keep its timestamp
+	 */
+	spin_lock(&vrp->rvq_lock);
+	if (vrp->rx_irq_time.tv64) {
+		vrp->rx_run_time = vrp->rx_irq_time;
+		vrp->rx_irq_time.tv64 = 0;
+	}
+	spin_unlock(&vrp->rvq_lock);
+
+	if (vrp->num_vq_pairs > RPMSG_PRIO_HIGH)
+		num_hi = rpmsg_rx_collect(vrp, vrp->rvq[RPMSG_PRIO_HIGH],
+							slots, budget);
+
+	num = rpmsg_rx_collect(vrp, vrp->rvq[RPMSG_PRIO_NORMAL],
+					slots + num_hi, budget - num_hi);
+
+	msgs_recvd = num_hi + num;
+
+	if (num > 1)
+		rpmsg_rx_fair_order(slots + num_hi, num);
+
+	for (i = 0; i < msgs_recvd; i++)
+		rpmsg_recv_single(vrp, dev, slots[i].msg);
+
+	/* deliver what's left of the batches of this run */
+	while (!list_empty(&vrp->rx_batches))
+		rpmsg_rx_flush_batch(vrp, list_first_entry(&vrp->rx_batches,
+				struct rpmsg_endpoint, rx_batch_node));
+
+	if (msgs_recvd) {
+		/* tell the remote processor we added available rx buffers */
+		spin_lock(&vrp->rvq_lock);
+		if (num_hi)
+			virtqueue_kick(vrp->rvq[RPMSG_PRIO_HIGH]);
+		if (num)
+			virtqueue_kick(vrp->rvq[RPMSG_PRIO_NORMAL]);
+		spin_unlock(&vrp->rvq_lock);
+
+		vrp->rx_calls++;
+		vrp->rx_msgs += msgs_recvd;
+		if (msgs_recvd > vrp->rx_max_batch)
+			vrp->rx_max_batch = msgs_recvd;
+	} else {
+		/* the buffers were probably drained by a previous run */
+		dev_dbg(dev, "uhm, incoming signal, but no used buffer ?\n");
+	}
+
+	mutex_unlock(&vrp->rx_lock);
+
+	dev_dbg(dev, "processed %u inbound messages\n", msgs_recvd);
+
+	return msgs_recvd;
+}
+
+/* turn the rx notifications off, or back on. must be called with rvq_lock */
+static void __rpmsg_rx_disable_cb(struct virtproc_info *vrp)
+{
+	int i;
+
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		virtqueue_disable_cb(vrp->rvq[i]);
+}
+
+/* returns false if rx buffers were used meanwhile (and might be missed) */
+static bool __rpmsg_rx_enable_cb(struct virtproc_info *vrp)
+{
+	bool idle = true;
+	int i;
+
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		if (!virtqueue_enable_cb(vrp->rvq[i]))
+			idle = false;
+
+	return idle;
+}
+
+/**
+ * rpmsg_rx_poll() - a single NAPI-like rx polling step
+ * @vrp: virtual remote processor state
+ *
+ * Process up to rx_budget inbound messages, while the remote processor's
+ * notifications are suppressed (see rpmsg_recv_done()). Only once the rx
+ * virtqueues are idle, the notifications are turned back on.
+ *
+ * Returns true if polling should go on, and false if the notifications
+ * were turned back on.
+ */
+static bool rpmsg_rx_poll(struct virtproc_info *vrp)
+{
+	unsigned int budget = clamp(rx_budget, 1U, vrp->num_bufs / 2U);
+	unsigned int done, us = vrp->rx_coalesce_us;
+	bool idle;
+
+	done = rpmsg_rx_drain(vrp, budget);
+	if (done == budget)
+		return true;
+
+	/* a busy stream will have more messages for us soon; wait for them */
+	if (us && done && done >= vrp->rx_coalesce_msgs) {
+		usleep_range(us, us + us / 4);
+		return true;
+	}
+
+	spin_lock(&vrp->rvq_lock);
+	idle = __rpmsg_rx_enable_cb(vrp);
+	/* we've raced with the remote processor, so keep polling */
+	if (!idle)
+		__rpmsg_rx_disable_cb(vrp);
+	spin_unlock(&vrp->rvq_lock);
+
+	return !idle;
+}
+
+/* poll the rx vqs, and reschedule ourselves until they are idle */
+static void rpmsg_rx_work(struct work_struct *work)
+{
+	struct virtproc_info *vrp = container_of(work, struct virtproc_info,
+								rx_work);
+
+	if (rpmsg_rx_poll(vrp))
+		queue_work(vrp->rx_wq, &vrp->rx_work);
+}
+
+/* the real-time flavor of rpmsg_rx_work */
+static int rpmsg_rx_thread(void *data)
+{
+	struct virtproc_info *vrp = data;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		if (!test_and_clear_bit(0, &vrp->rx_pending)) {
+			schedule();
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+
+		/* let others run in between budgets */
+		while (rpmsg_rx_poll(vrp))
+			cond_resched();
+	}
+
+	return 0;
+}
+
+/* called when rx buffers are used, and it's time to digest messages */
+static void rpmsg_recv_done(struct virtqueue *rvq)
+{
+	struct virtproc_info *vrp = rvq->vdev->priv;
+
+	trace_rpmsg_recv_done(rvq);
+
+	spin_lock(&vrp->rvq_lock);
+	vrp->rx_kicks++;
+	if (!vrp->rx_irq_time.tv64)
+		vrp->rx_irq_time = ktime_get();
+	/* no more notifications until we're done polling */
+	__rpmsg_rx_disable_cb(vrp);
+	if (vrp->rx_stopped) {
+		spin_unlock(&vrp->rvq_lock);
+		return;
+	}
+	spin_unlock(&vrp->rvq_lock);
+
+	/* the messages are dispatched in our own context */
+	if (vrp->rx_thread) {
+		set_bit(0, &vrp->rx_pending);
+		wake_up_process(vrp->rx_thread);
+	} else {
+		queue_work(vrp->rx_wq, &vrp->rx_work);
+	}
+}
+
+/*
+ * This is invoked whenever the remote processor completed processing
+ * a TX msg we just sent it, and the buffer is put back to the used ring.
+ *
+ * Normally, though, we suppress this "tx complete" interrupt in order to
+ * avoid the incurred overhead.
+ */
+static void rpmsg_xmit_done(struct virtqueue *svq)
+{
+	struct virtproc_info *vrp = svq->vdev->priv;
+
+	trace_rpmsg_xmit_done(svq);
+
+	dev_dbg(&svq->vdev->dev, "%s\n", __func__);
+
+	/*
+	 * wake up one of the senders that are waiting for a tx buffer (it
+	 * will wake up the next one after it reclaimed the consumed buffers)
+	 */
+	wake_up_interruptible(&vrp->sendq);
+
+	/* and notify those who asked to be called back */
+	rpmsg_fire_tx_waiters(vrp);
+}
+
+/**
+ * struct rpmsg_ns_batch - name service announcements pending processing
+ * @node:	link in the vproc's list of pending announcements
+ * @num:	number of announcements in @msgs
+ * @msgs:	the announcements, in the order they were sent
+ */
+struct rpmsg_ns_batch {
+	struct list_head node;
+	int num;
+	struct rpmsg_ns_msg msgs[0];
+};
+
+/* create or destroy the channel of a single name service announcement */
+static void rpmsg_ns_handle(struct virtproc_info *vrp, struct rpmsg_ns_msg *msg)
+{
+	struct rpmsg_channel *newch;
+	struct rpmsg_channel_info chinfo;
+	struct device *dev = &vrp->vdev->dev;
+	int ret;
+
+	/* don't trust the remote processor for null terminating the name */
+	msg->name[RPMSG_NAME_SIZE - 1] = '\0';
+
+	trace_rpmsg_ns(vrp->vdev, msg->name, msg->addr, msg->flags);
+
+	dev_info(dev, "%sing channel %s addr 0x%x\n",
+			msg->flags & RPMSG_NS_DESTROY ? "destroy" : "creat",
+			msg->name, msg->addr);
+
+	strlcpy(chinfo.name, msg->name, sizeof(chinfo.name));
+	chinfo.src = RPMSG_ADDR_ANY;
+	chinfo.dst = msg->addr;
+	chinfo.prio = msg->flags & RPMSG_NS_PRIO ? RPMSG_PRIO_HIGH :
+							RPMSG_PRIO_NORMAL;
+
+	if (msg->flags & RPMSG_NS_DESTROY) {
+		ret = rpmsg_destroy_channel(vrp, &chinfo);
+		if (ret)
+			dev_err(dev, "rpmsg_destroy_channel failed: %d\n", ret);
+	} else {
+		/* a recovered remote processor announces our old channels anew */
+		spin_lock(&vrp->channels_lock);
+		newch = __rpmsg_find_channel(vrp, &chinfo);
+		spin_unlock(&vrp->channels_lock);
+		if (newch) {
+			dev_dbg(dev, "channel %s addr 0x%x is back\n",
+							msg->name, msg->addr);
+			return;
+		}
+
+		newch = rpmsg_create_channel(vrp, &chinfo);
+		if (!newch)
+			dev_err(dev, "rpmsg_create_channel failed\n");
+	}
+}
+
+/*
+ * process the pending name service announcements, in order.
+ * registering a channel probes its driver, which may take a while, so
+ * this is done here rather than in the rx context, where it would hold up
+ * the inbound messages of all the other channels.
+ */
+static void rpmsg_ns_work(struct work_struct *work)
+{
+	struct virtproc_info *vrp = container_of(work, struct virtproc_info,
+								ns_work);
+	struct rpmsg_ns_batch *batch;
+	int i;
+
+	spin_lock(&vrp->ns_lock);
+
+	while (!list_empty(&vrp->ns_pending)) {
+		batch = list_first_entry(&vrp->ns_pending,
+					struct rpmsg_ns_batch, node);
+		list_del(&batch->node);
+		spin_unlock(&vrp->ns_lock);
+
+		for (i = 0; i < batch->num; i++)
+			rpmsg_ns_handle(vrp, &batch->msgs[i]);
+
+		kfree(batch);
+
+		spin_lock(&vrp->ns_lock);
+	}
+
+	spin_unlock(&vrp->ns_lock);
+}
+
+/* stop processing name service announcements, and drop the pending ones */
+static void rpmsg_ns_stop(struct virtproc_info *vrp)
+{
+	struct rpmsg_ns_batch *batch, *tmp;
+
+	spin_lock(&vrp->ns_lock);
+	vrp->ns_stopped = true;
+	spin_unlock(&vrp->ns_lock);
+
+	cancel_work_sync(&vrp->ns_work);
+
+	list_for_each_entry_safe(batch, tmp, &vrp->ns_pending, node) {
+		list_del(&batch->node);
+		kfree(batch);
+	}
+}
+
+/* invoked when a name service announcement arrives */
+static void rpmsg_ns_cb(struct rpmsg_channel *rpdev, void *data, int len,
+							void *priv, u32 src)
+{
+	struct virtproc_info *vrp = priv;
+	struct device *dev = &vrp->vdev->dev;
+	struct rpmsg_ns_batch *batch;
+	int num = len / sizeof(struct rpmsg_ns_msg);
+
+	print_hex_dump(KERN_DEBUG, "NS announcement: ",
+			DUMP_PREFIX_NONE, 16, 1,
+			data, len, true);
+
+	/* several announcements may be batched, if the remote supports it */
+	if (!num || len % sizeof(struct rpmsg_ns_msg) || (num > 1 &&
+			!virtio_has_feature(vrp->vdev, VIRTIO_RPMSG_F_NS_BATCH))) {
+		dev_err(dev, "malformed ns msg (%d)\n", len);
+		return;
+	}
+
+	/*
+	 * the name service ept does _not_ belong to a real rpmsg channel,
+	 * and is handled by the rpmsg bus itself.
+	 * for sanity reasons, make sure a valid rpdev has _not_ sneaked
+	 * in somehow.
+	 */
+	if (rpdev) {
+		dev_err(dev, "anomaly: ns ept has an rpdev handle\n");
+		return;
+	}
+
+	batch = kmalloc(sizeof(*batch) + len, GFP_KERNEL);
+	if (!batch) {
+		dev_err(dev, "no memory for ns msg (%d)\n", len);
+		return;
+	}
+
+	batch->num = num;
+	memcpy(batch->msgs, data, len);
+
+	spin_lock(&vrp->ns_lock);
+
+	if (vrp->ns_stopped) {
+		spin_unlock(&vrp->ns_lock);
+		kfree(batch);
+		return;
+	}
+
+	list_add_tail(&batch->node, &vrp->ns_pending);
+	schedule_work(&vrp->ns_work);
+
+	spin_unlock(&vrp->ns_lock);
+}
+
+static int rpmsg_open_generic(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+/* the inbound messages batching statistics are exposed via debugfs */
+static ssize_t rpmsg_rx_stats_read(struct file *filp, char __user *userbuf,
+						size_t count, loff_t *ppos)
+{
+	struct virtproc_info *vrp = filp->private_data;
+	unsigned long calls, msgs;
+	unsigned int max_batch;
+	char buf[128];
+	int i;
+
+	mutex_lock(&vrp->rx_lock);
+	calls = vrp->rx_calls;
+	msgs = vrp->rx_msgs;
+	max_batch = vrp->rx_max_batch;
+	mutex_unlock(&vrp->rx_lock);
+
+	i = snprintf(buf, sizeof(buf), "rx runs: %lu\nrx msgs: %lu\n"
+			"msgs per run: %lu\nmax msgs per run: %u\n",
+			calls, msgs, calls ? msgs / calls : 0, max_batch);
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, i);
+}
+
+static const struct file_operations rpmsg_rx_stats_ops = {
+	.read = rpmsg_rx_stats_read,
+	.open = rpmsg_open_generic,
+	.llseek	= generic_file_llseek,
+};
+
+/* the tx buffers accounting is exposed via debugfs, too */
+static ssize_t rpmsg_tx_stats_read(struct file *filp, char __user *userbuf,
+						size_t count, loff_t *ppos)
+{
+	struct virtproc_info *vrp = filp->private_data;
+	int total = vrp->num_tx_pools * vrp->tx_pool_size + vrp->tx_urgent_size;
+	int used, inflight, cached = 0;
+	struct rpmsg_tx_cache *cache;
+	unsigned long add_errors;
+	char buf[256];
+	int i, cpu;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	inflight = vrp->tx_inflight;
+	add_errors = vrp->tx_add_errors;
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	used = atomic_read(&vrp->tx_bytes_used);
+
+	/* racy, but it's only a snapshot anyway */
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(vrp->tx_caches, cpu);
+		for (i = 0; i < RPMSG_TX_CACHE_CLASSES; i++)
+			cached += cache->count[i] *
+					((i + 1) << RPMSG_TX_ALLOC_ORDER);
 	}
 
-	/*
-	 * The size of the payload is currently limited according to the
-	 * buffers size picked by the platform.
-	 *
-	 * One of the possible improvements here is either to support
-	 * user-provided buffers (and then we can also support zero-copy
-	 * messaging), or to improve the buffer allocator, to support
-	 * variable-length buffer sizes.
-	 */
-	if (len > vrp->buf_size - sizeof(struct rpmsg_hdr)) {
-		dev_err(dev, "message is too big (%d)\n", len);
-		return -EMSGSIZE;
-	}
+	i = snprintf(buf, sizeof(buf), "tx pools: %d\ntx bytes total: %d\n"
+			"tx bytes free: %d\ntx bytes cached: %d\n"
+			"tx bytes reserved for urgent msgs: %d\n"
+			"tx bufs reserved: %d\n"
+			"tx bufs in flight: %d\ntx add errors: %lu\n",
+			vrp->num_tx_pools, total, total - used + cached,
+			cached, vrp->tx_urgent_size, atomic_read(&vrp->tx_reserved), inflight,
+			add_errors);
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, i);
+}
+
+static const struct file_operations rpmsg_tx_stats_ops = {
+	.read = rpmsg_tx_stats_read,
+	.open = rpmsg_open_generic,
+	.llseek	= generic_file_llseek,
+};
+
+/* the endpoints, and the rx buffers each of them holds, are listed, too */
+static int rpmsg_ept_show(int id, void *p, void *data)
+{
+	struct rpmsg_endpoint *ept = p;
+	struct seq_file *s = data;
+
+	seq_printf(s, "0x%-8x %-8d %-8d %-10lu %-12lu %-10lu %lu\n",
+			ept->addr, ept->rx_held,
+			ept->rx_quota ?: ept->vrp->rx_hold_max,
+			ept->rx_msgs, ept->rx_bytes, ept->tx_msgs, ept->tx_bytes);
+
+	return 0;
+}
+
+static int rpmsg_endpoints_show(struct seq_file *s, void *unused)
+{
+	struct virtproc_info *vrp = s->private;
+
+	seq_printf(s, "%-10s %-8s %-8s %-10s %-12s %-10s %s\n", "addr", "held",
+		"quota", "rx msgs", "rx bytes", "tx msgs", "tx bytes");
+
+	spin_lock(&vrp->endpoints_lock);
+	idr_for_each(&vrp->endpoints, rpmsg_ept_show, s);
+	spin_unlock(&vrp->endpoints_lock);
+
+	return 0;
+}
+
+static int rpmsg_endpoints_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rpmsg_endpoints_show, inode->i_private);
+}
+
+static const struct file_operations rpmsg_endpoints_ops = {
+	.open = rpmsg_endpoints_open,
+	.read = seq_read,
+	.llseek	= seq_lseek,
+	.release = single_release,
+};
+
+/* the traffic counters are exposed via debugfs, too */
+static int rpmsg_stats_show(struct seq_file *s, void *unused)
+{
+	struct virtproc_info *vrp = s->private;
+	unsigned long tx_msgs, tx_bytes, tx_kicks, tx_waits, rx_kicks;
+	unsigned long tx_resumes, recoveries;
+	u64 tx_wait_us;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	tx_msgs = vrp->tx_msgs;
+	tx_bytes = vrp->tx_bytes;
+	tx_kicks = vrp->tx_kicks;
+	tx_resumes = vrp->tx_resumes;
+	tx_waits = vrp->tx_waits;
+	tx_wait_us = vrp->tx_wait_us;
+	recoveries = vrp->recoveries;
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	spin_lock(&vrp->rvq_lock);
+	rx_kicks = vrp->rx_kicks;
+	spin_unlock(&vrp->rvq_lock);
+
+	seq_printf(s, "tx msgs: %lu\ntx bytes: %lu\ntx kicks sent: %lu\n"
+			"tx buffer waits: %lu\ntx buffer wait usecs: %llu\n"
+			"tx remote resumes: %lu\ncrash recoveries: %lu\n",
+			tx_msgs, tx_bytes, tx_kicks, tx_waits,
+			(unsigned long long) tx_wait_us, tx_resumes,
+			recoveries);
+
+	mutex_lock(&vrp->rx_lock);
+	seq_printf(s, "rx msgs: %lu\nrx bytes: %lu\nrx dropped: %lu\n"
+			"rx kicks received: %lu\n", vrp->rx_msgs,
+			vrp->rx_bytes, vrp->rx_dropped, rx_kicks);
+	mutex_unlock(&vrp->rx_lock);
+
+	return 0;
+}
+
+static int rpmsg_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rpmsg_stats_show, inode->i_private);
+}
 
-	/* grab a buffer */
-	msg = get_a_tx_buf(vrp);
-	if (!msg && !wait)
-		return -ENOMEM;
+static const struct file_operations rpmsg_stats_ops = {
+	.open = rpmsg_stats_open,
+	.read = seq_read,
+	.llseek	= seq_lseek,
+	.release = single_release,
+};
 
-	/* no free buffer ? wait for one (but bail after 15 seconds) */
-	while (!msg) {
-		/* enable "tx-complete" interrupts, if not already enabled */
-		rpmsg_upref_sleepers(vrp);
+static void rpmsg_hist_show(struct seq_file *s, const char *name,
+						const struct rpmsg_hist *hist)
+{
+	int i;
 
-		/*
-		 * sleep until a free buffer is available or 15 secs elapse.
-		 * the timeout period is not configurable because there's
-		 * little point in asking drivers to specify that.
-		 * if later this happens to be required, it'd be easy to add.
-		 */
-		err = wait_event_interruptible_timeout(vrp->sendq,
-					(msg = get_a_tx_buf(vrp)),
-					msecs_to_jiffies(15000));
+	seq_printf(s, "%s latency (usecs):\n", name);
 
-		/* disable "tx-complete" interrupts if we're the last sleeper */
-		rpmsg_downref_sleepers(vrp);
+	for (i = 0; i < RPMSG_HIST_BUCKETS - 1; i++)
+		seq_printf(s, "   < %-8lu %lu\n", 1UL << i, hist->bucket[i]);
 
-		/* timeout ? */
-		if (!err) {
-			dev_err(dev, "timeout waiting for a tx buffer\n");
-			return -ERESTARTSYS;
-		}
-	}
+	seq_printf(s, "  >= %-8lu %lu\n", 1UL << (i - 1), hist->bucket[i]);
+}
 
-	msg->len = len;
-	msg->flags = 0;
-	msg->src = src;
-	msg->dst = dst;
-	msg->reserved = 0;
-	memcpy(msg->data, data, len);
+/* and so are the latency histograms */
+static int rpmsg_latency_show(struct seq_file *s, void *unused)
+{
+	struct virtproc_info *vrp = s->private;
+	struct rpmsg_hist hist;
+	unsigned long flags;
 
-	dev_dbg(dev, "TX From 0x%x, To 0x%x, Len %d, Flags %d, Reserved %d\n",
-					msg->src, msg->dst, msg->len,
-					msg->flags, msg->reserved);
-	print_hex_dump(KERN_DEBUG, "rpmsg_virtio TX: ", DUMP_PREFIX_NONE, 16, 1,
-					msg, sizeof(*msg) + msg->len, true);
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	hist = vrp->tx_lat;
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
 
-	offset = ((unsigned long) msg) - ((unsigned long) vrp->rbufs);
+	rpmsg_hist_show(s, "send", &hist);
 
-	phys_addr = vrp->phys_base + offset;
+	mutex_lock(&vrp->rx_lock);
+	hist = vrp->rx_lat;
+	mutex_unlock(&vrp->rx_lock);
 
-	sg_init_table(&sg, 1);
+	rpmsg_hist_show(s, "interrupt to rx callback", &hist);
 
-	/*
-	 * can't use sg_set_buf because buffers might not be residing
-	 * in virt_to_page()-able memory.
-	 * revisit this to achieve a cleaner solution (e.g. DMA API).
-	 */
-	sg_set_page(&sg, phys_to_page(phys_addr), sizeof(*msg) + len,
-						offset_in_page(phys_addr));
+	return 0;
+}
 
-	spin_lock(&vrp->tx_lock);
+static int rpmsg_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rpmsg_latency_show, inode->i_private);
+}
 
-	/* add message to the remote processor's virtqueue */
-	err = virtqueue_add_buf_gfp(vrp->svq, &sg, 1, 0, msg, GFP_KERNEL);
-	if (err < 0) {
-		/*
-		 * need to reclaim the buffer here, otherwise it's lost
-		 * (memory won't leak, but rpmsg won't use it again for TX).
-		 * this will wait for a buffer management overhaul.
-		 */
-		dev_err(dev, "virtqueue_add_buf_gfp failed: %d\n", err);
-		goto out;
+static const struct file_operations rpmsg_latency_ops = {
+	.open = rpmsg_latency_open,
+	.read = seq_read,
+	.llseek	= seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * the message capture ring is exposed via debugfs, too, oldest record
+ * first. records that are overwritten while being read are skipped.
+ */
+static int rpmsg_capture_show(struct seq_file *s, void *unused)
+{
+	struct virtproc_info *vrp = s->private;
+	struct rpmsg_capture_rec rec;
+	u32 head = atomic_read(&vrp->capture_head);
+	u32 seq = head > RPMSG_CAPTURE_RECS ? head - RPMSG_CAPTURE_RECS : 0;
+	char hex[3 * RPMSG_CAPTURE_BYTES + 2];
+	struct timespec ts;
+
+	for (; seq != head; seq++) {
+		struct rpmsg_capture_rec *p;
+
+		p = &vrp->capture[seq & (RPMSG_CAPTURE_RECS - 1)];
+
+		rec = *p;
+		smp_rmb();
+		if (rec.seq != seq + 1 || p->seq != rec.seq)
+			continue;
+
+		ts = ktime_to_timespec(rec.ts);
+		hex_dump_to_buffer(rec.data, rec.copied, RPMSG_CAPTURE_BYTES, 1,
+							hex, sizeof(hex), false);
+
+		seq_printf(s, "[%5lu.%06lu] %s 0x%x -> 0x%x len %u: %s\n",
+				(unsigned long) ts.tv_sec, ts.tv_nsec / 1000,
+				rec.tx ? "TX" : "RX", rec.src, rec.dst,
+				rec.len, hex);
 	}
 
-	/* tell the remote processor it has a pending message to read */
-	virtqueue_kick(vrp->svq);
+	return 0;
+}
 
-	err = 0;
-out:
-	spin_unlock(&vrp->tx_lock);
-	return err;
+static int rpmsg_capture_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rpmsg_capture_show, inode->i_private);
 }
-EXPORT_SYMBOL(rpmsg_send_offchannel_raw);
 
-/* called when an rx buffer is used, and it's time to digest a message */
-static void rpmsg_recv_done(struct virtqueue *rvq)
+static const struct file_operations rpmsg_capture_ops = {
+	.open = rpmsg_capture_open,
+	.read = seq_read,
+	.llseek	= seq_lseek,
+	.release = single_release,
+};
+
+/* set up the context in which inbound messages are dispatched */
+static int rpmsg_rx_start(struct virtproc_info *vrp)
 {
-	struct rpmsg_hdr *msg;
-	unsigned int len;
-	struct rpmsg_endpoint *ept;
-	struct scatterlist sg;
-	unsigned long offset;
-	phys_addr_t phys_addr;
-	struct virtproc_info *vrp = rvq->vdev->priv;
-	struct device *dev = &rvq->vdev->dev;
-	int err;
+	struct device *dev = &vrp->vdev->dev;
+	struct sched_param param = { .sched_priority = rx_rt_prio };
 
-	msg = virtqueue_get_buf(rvq, &len);
-	if (!msg) {
-		dev_err(dev, "uhm, incoming signal, but no used buffer ?\n");
-		return;
+	if (!rx_rt_prio) {
+		vrp->rx_wq = alloc_workqueue(dev_name(dev),
+						WQ_HIGHPRI | WQ_MEM_RECLAIM, 1);
+		return vrp->rx_wq ? 0 : -ENOMEM;
 	}
 
-	dev_dbg(dev, "From: 0x%x, To: 0x%x, Len: %d, Flags: %d, Reserved: %d\n",
-					msg->src, msg->dst, msg->len,
-					msg->flags, msg->reserved);
-	print_hex_dump(KERN_DEBUG, "rpmsg_virtio RX: ", DUMP_PREFIX_NONE, 16, 1,
-					msg, sizeof(*msg) + msg->len, true);
+	if (rx_rt_prio >= MAX_RT_PRIO) {
+		dev_err(dev, "invalid rt priority: %u\n", rx_rt_prio);
+		return -EINVAL;
+	}
 
-	/* use the dst addr to fetch the callback of the appropriate user */
-	spin_lock(&vrp->endpoints_lock);
-	ept = idr_find(&vrp->endpoints, msg->dst);
-	spin_unlock(&vrp->endpoints_lock);
+	vrp->rx_thread = kthread_create(rpmsg_rx_thread, vrp, "rpmsg-rx/%s",
+							dev_name(dev));
+	if (IS_ERR(vrp->rx_thread)) {
+		int err = PTR_ERR(vrp->rx_thread);
 
-	if (ept && ept->cb)
-		ept->cb(ept->rpdev, msg->data, msg->len, ept->priv, msg->src);
-	else
-		dev_warn(dev, "msg received with no recepient\n");
+		vrp->rx_thread = NULL;
+		return err;
+	}
 
-	/* add the buffer back to the remote processor's virtqueue */
-	offset = ((unsigned long) msg) - ((unsigned long) vrp->rbufs);
-	phys_addr = vrp->phys_base + offset;
+	sched_setscheduler(vrp->rx_thread, SCHED_FIFO, &param);
+	wake_up_process(vrp->rx_thread);
 
-	sg_init_table(&sg, 1);
+	return 0;
+}
 
-	/*
-	 * can't use sg_set_buf because buffers might not be residing
-	 * in virt_to_page()-able memory.
-	 * revisit this to achieve a cleaner solution.
-	 */
-	sg_set_page(&sg, phys_to_page(phys_addr), sizeof(*msg) + len,
-						offset_in_page(phys_addr));
+/* make sure no one is still draining the rx vq, nor will be woken to */
+static void rpmsg_rx_stop(struct virtproc_info *vrp)
+{
+	spin_lock(&vrp->rvq_lock);
+	vrp->rx_stopped = true;
+	spin_unlock(&vrp->rvq_lock);
 
-	err = virtqueue_add_buf_gfp(vrp->rvq, &sg, 0, 1, msg, GFP_KERNEL);
-	if (err < 0) {
-		dev_err(dev, "failed to add a virtqueue buffer: %d\n", err);
+	if (vrp->rx_thread) {
+		kthread_stop(vrp->rx_thread);
 		return;
 	}
 
-	/* tell the remote processor we added another available rx buffer */
-	virtqueue_kick(vrp->rvq);
+	cancel_work_sync(&vrp->rx_work);
+	destroy_workqueue(vrp->rx_wq);
 }
 
-/*
- * This is invoked whenever the remote processor completed processing
- * a TX msg we just sent it, and the buffer is put back to the used ring.
- *
- * Normally, though, we suppress this "tx complete" interrupt in order to
- * avoid the incurred overhead.
- */
-static void rpmsg_xmit_done(struct virtqueue *svq)
+static void rpmsg_destroy_tx_pools(struct virtproc_info *vrp)
 {
-	struct virtproc_info *vrp = svq->vdev->priv;
+	struct rpmsg_tx_cache *cache;
+	int cpu, class, i;
+
+	/* the pools can only be destroyed once all of their buffers are back */
+	if (vrp->tx_caches) {
+		for_each_possible_cpu(cpu) {
+			cache = per_cpu_ptr(vrp->tx_caches, cpu);
+			for (class = 0; class < RPMSG_TX_CACHE_CLASSES; class++)
+				while (cache->count[class])
+					__rpmsg_tx_pool_free(vrp,
+					cache->bufs[class][--cache->count[class]],
+					(class + 1) << RPMSG_TX_ALLOC_ORDER);
+		}
+		free_percpu(vrp->tx_caches);
+	}
 
-	dev_dbg(&svq->vdev->dev, "%s\n", __func__);
+	for (i = 0; i < vrp->num_tx_pools; i++)
+		if (vrp->tx_pools[i])
+			gen_pool_destroy(vrp->tx_pools[i]);
 
-	/* wake up potential senders that are waiting for a tx buffer */
-	wake_up_interruptible(&vrp->sendq);
+	kfree(vrp->tx_pools);
+
+	if (vrp->tx_urgent_pool)
+		gen_pool_destroy(vrp->tx_urgent_pool);
 }
 
-/* invoked when a name service announcement arrives */
-static void rpmsg_ns_cb(struct rpmsg_channel *rpdev, void *data, int len,
-							void *priv, u32 src)
+/*
+ * Split the TX half of the shared buffers between per-cpu tx pools, so
+ * concurrent senders don't contend on a single allocator lock. Every pool
+ * must still be able to hold the biggest tx buffer we allow. On top of
+ * the pools, every cpu has a cache of small buffers (see struct rpmsg_tx_cache).
+ */
+static int rpmsg_create_tx_pools(struct virtproc_info *vrp, int size)
 {
-	struct rpmsg_ns_msg *msg = data;
-	struct rpmsg_channel *newch;
-	struct rpmsg_channel_info chinfo;
-	struct virtproc_info *vrp = priv;
-	struct device *dev = &vrp->vdev->dev;
-	int ret;
+	unsigned long addr;
+	phys_addr_t phys_addr;
+	int num_pools, i, err;
 
-	print_hex_dump(KERN_DEBUG, "NS announcement: ",
-			DUMP_PREFIX_NONE, 16, 1,
-			data, len, true);
+	/* the urgent reserve comes off the end of the tx space */
+	if (size >= RPMSG_TX_URGENT_SIZE * RPMSG_TX_URGENT_MIN_SHARE)
+		vrp->tx_urgent_size = RPMSG_TX_URGENT_SIZE;
 
-	if (len != sizeof(*msg)) {
-		dev_err(dev, "malformed ns msg (%d)\n", len);
-		return;
-	}
+	num_pools = clamp_t(int, nr_cpu_ids, 1,
+			(size - vrp->tx_urgent_size) / vrp->tx_max_size);
 
-	/*
-	 * the name service ept does _not_ belong to a real rpmsg channel,
-	 * and is handled by the rpmsg bus itself.
-	 * for sanity reasons, make sure a valid rpdev has _not_ sneaked
-	 * in somehow.
-	 */
-	if (rpdev) {
-		dev_err(dev, "anomaly: ns ept has an rpdev handle\n");
-		return;
+	vrp->tx_pools = kcalloc(num_pools, sizeof(*vrp->tx_pools), GFP_KERNEL);
+	if (!vrp->tx_pools)
+		return -ENOMEM;
+
+	vrp->num_tx_pools = num_pools;
+	vrp->tx_pool_size = round_down((size - vrp->tx_urgent_size) / num_pools,
+					1 << RPMSG_TX_ALLOC_ORDER);
+
+	vrp->tx_caches = alloc_percpu(struct rpmsg_tx_cache);
+	if (!vrp->tx_caches) {
+		err = -ENOMEM;
+		goto destroy_pools;
 	}
 
-	/* don't trust the remote processor for null terminating the name */
-	msg->name[RPMSG_NAME_SIZE - 1] = '\0';
+	for (i = 0; i < num_pools; i++) {
+		addr = (unsigned long) vrp->sbufs + i * vrp->tx_pool_size;
+		phys_addr = vrp->phys_base + size + i * vrp->tx_pool_size;
 
-	dev_info(dev, "%sing channel %s addr 0x%x\n",
-			msg->flags & RPMSG_NS_DESTROY ? "destroy" : "creat",
-			msg->name, msg->addr);
+		vrp->tx_pools[i] = gen_pool_create(RPMSG_TX_ALLOC_ORDER, -1);
+		if (!vrp->tx_pools[i]) {
+			err = -ENOMEM;
+			goto destroy_pools;
+		}
 
-	strncpy(chinfo.name, msg->name, sizeof(chinfo.name));
-	chinfo.src = RPMSG_ADDR_ANY;
-	chinfo.dst = msg->addr;
+		err = gen_pool_add_virt(vrp->tx_pools[i], addr, phys_addr,
+						vrp->tx_pool_size, -1);
+		if (err)
+			goto destroy_pools;
+	}
 
-	if (msg->flags & RPMSG_NS_DESTROY) {
-		ret = rpmsg_destroy_channel(vrp, &chinfo);
-		if (ret)
-			dev_err(dev, "rpmsg_destroy_channel failed: %d\n", ret);
-	} else {
-		newch = rpmsg_create_channel(vrp, &chinfo);
-		if (!newch)
-			dev_err(dev, "rpmsg_create_channel failed\n");
+	if (vrp->tx_urgent_size) {
+		addr = (unsigned long) vrp->sbufs + i * vrp->tx_pool_size;
+		phys_addr = vrp->phys_base + size + i * vrp->tx_pool_size;
+
+		vrp->tx_urgent_pool = gen_pool_create(RPMSG_TX_ALLOC_ORDER, -1);
+		if (!vrp->tx_urgent_pool) {
+			err = -ENOMEM;
+			goto destroy_pools;
+		}
+
+		err = gen_pool_add_virt(vrp->tx_urgent_pool, addr, phys_addr,
+						vrp->tx_urgent_size, -1);
+		if (err)
+			goto destroy_pools;
 	}
+
+	return 0;
+
+destroy_pools:
+	rpmsg_destroy_tx_pools(vrp);
+	return err;
 }
 
 static int rpmsg_probe(struct virtio_device *vdev)
 {
-	vq_callback_t *vq_cbs[] = { rpmsg_recv_done, rpmsg_xmit_done };
-	const char *names[] = { "input", "output" };
-	struct virtqueue *vqs[2];
+	vq_callback_t *vq_cbs[] = { rpmsg_recv_done, rpmsg_xmit_done,
+				    rpmsg_recv_done, rpmsg_xmit_done };
+	const char *names[] = { "input", "output", "prio_input", "prio_output" };
+	struct virtqueue *vqs[2 * RPMSG_PRIO_MAX];
 	struct virtproc_info *vrp;
 	void *addr;
 	int err, i, num_bufs, buf_size, total_buf_size;
@@ -872,16 +4242,52 @@ static int rpmsg_probe(struct virtio_device *vdev)
 
 	idr_init(&vrp->endpoints);
 	spin_lock_init(&vrp->endpoints_lock);
+	spin_lock_init(&vrp->channels_lock);
+	INIT_WORK(&vrp->ns_work, rpmsg_ns_work);
+	INIT_LIST_HEAD(&vrp->ns_pending);
+	spin_lock_init(&vrp->ns_lock);
+	for (i = 0; i < RPMSG_CHANNEL_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&vrp->channels[i]);
 	spin_lock_init(&vrp->tx_lock);
 	init_waitqueue_head(&vrp->sendq);
-
-	/* We expect two virtqueues, rx and tx (and in this order) */
-	err = vdev->config->find_vqs(vdev, 2, vqs, vq_cbs, names);
+	INIT_LIST_HEAD(&vrp->tx_waiters);
+	spin_lock_init(&vrp->tx_waiters_lock);
+	mutex_init(&vrp->rx_lock);
+	spin_lock_init(&vrp->rvq_lock);
+	INIT_WORK(&vrp->rx_work, rpmsg_rx_work);
+	INIT_WORK(&vrp->resume_work, rpmsg_resume_work);
+	INIT_LIST_HEAD(&vrp->rx_frags);
+	INIT_LIST_HEAD(&vrp->rx_batches);
+	for (i = 0; i < RPMSG_CREDIT_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&vrp->tx_credits[i]);
+	spin_lock_init(&vrp->credits_lock);
+	vrp->rx_coalesce_us = rx_coalesce_us;
+	vrp->rx_coalesce_msgs = rx_coalesce_msgs;
+
+	err = init_srcu_struct(&vrp->ept_srcu);
 	if (err)
 		goto free_vi;
 
-	vrp->rvq = vqs[0];
-	vrp->svq = vqs[1];
+	err = rpmsg_rx_start(vrp);
+	if (err) {
+		dev_err(&vdev->dev, "failed to create the rx context: %d\n", err);
+		goto cleanup_srcu;
+	}
+
+	/* remote processors may support a high priority vq pair, too */
+	vrp->num_vq_pairs = virtio_has_feature(vdev, VIRTIO_RPMSG_F_PRIO) ?
+							RPMSG_PRIO_MAX : 1;
+
+	/* We expect an rx and a tx virtqueue (in this order) per vq pair */
+	err = vdev->config->find_vqs(vdev, 2 * vrp->num_vq_pairs, vqs,
+							vq_cbs, names);
+	if (err)
+		goto rx_stop;
+
+	for (i = 0; i < vrp->num_vq_pairs; i++) {
+		vrp->rvq[i] = vqs[2 * i];
+		vrp->svq[i] = vqs[2 * i + 1];
+	}
 
 	/* Platform must supply pre-allocated uncached buffers for now */
 	vdev->config->get(vdev, VPROC_BUF_ADDR, &addr, sizeof(addr));
@@ -889,6 +4295,12 @@ static int rpmsg_probe(struct virtio_device *vdev)
 	vdev->config->get(vdev, VPROC_BUF_SZ, &buf_size, sizeof(buf_size));
 	vdev->config->get(vdev, VPROC_BUF_PADDR, &vrp->phys_base,
 						sizeof(vrp->phys_base));
+	vdev->config->get(vdev, VPROC_BUF_CACHE_OPS, &vrp->cache_ops,
+						sizeof(vrp->cache_ops));
+	vdev->config->get(vdev, VPROC_PM_OPS, &vrp->pm_ops,
+						sizeof(vrp->pm_ops));
+	vdev->config->get(vdev, VPROC_MEM_MAPS, &vrp->mem_maps,
+						sizeof(vrp->mem_maps));
 
 	total_buf_size = num_bufs * buf_size;
 
@@ -898,38 +4310,70 @@ static int rpmsg_probe(struct virtio_device *vdev)
 	vrp->num_bufs = num_bufs;
 	vrp->buf_size = buf_size;
 
+	/* the compact header must overlay the tail of struct rpmsg_hdr */
+	BUILD_BUG_ON(offsetof(struct rpmsg_hdr, len) != RPMSG_HDR_COMPACT_OFF +
+				offsetof(struct rpmsg_hdr_compact, len));
+
+	if (virtio_has_feature(vdev, VIRTIO_RPMSG_F_COMPACT_HDR))
+		vrp->hdr_off = RPMSG_HDR_COMPACT_OFF;
+
 	/* the first half of the buffers is dedicated for RX */
 	vrp->rbufs = addr;
 
 	/* the second half of the buffers is dedicated for TX */
 	vrp->sbufs = addr + total_buf_size / 2;
 
-	/* set up the receive buffers */
-	for (i = 0; i < num_bufs / 2; i++) {
-		struct scatterlist sg;
-		void *cpu_addr = vrp->rbufs + i * buf_size;
-		phys_addr_t phys_addr = vrp->phys_base + i * buf_size;
+	vrp->tx_max_size = min(RPMSG_TX_MAX_SIZE, total_buf_size / 2);
 
-		sg_init_table(&sg, 1);
+	/* tx buffers are dynamically allocated from the TX half */
+	err = rpmsg_create_tx_pools(vrp, total_buf_size / 2);
+	if (err) {
+		dev_err(&vdev->dev, "failed to create the tx pools\n");
+		goto vqs_del;
+	}
 
-		/*
-		 * can't use sg_set_buf because buffers might not be residing
-		 * in virt_to_page()-able memory.
-		 * revisit this to achieve a cleaner solution.
-		 */
-		sg_set_page(&sg, phys_to_page(phys_addr), buf_size,
-						offset_in_page(phys_addr));
+	vrp->rx_bufs = kcalloc(num_bufs / 2, sizeof(*vrp->rx_bufs),
+							GFP_KERNEL);
+	if (!vrp->rx_bufs) {
+		err = -ENOMEM;
+		goto destroy_pool;
+	}
+
+	vrp->rx_hold_max = num_bufs / 2 / RPMSG_RX_HOLD_EPT_SHARE;
 
-		err = virtqueue_add_buf_gfp(vrp->rvq, &sg, 0, 1, cpu_addr,
-								GFP_KERNEL);
-		WARN_ON(err < 0); /* sanity check; this can't really happen */
+	if (vrp->num_vq_pairs > RPMSG_PRIO_HIGH)
+		vrp->num_hi_rx_bufs = num_bufs / 2 / RPMSG_RX_HI_SHARE;
+
+	vrp->rx_slots = kcalloc(num_bufs / 2, sizeof(*vrp->rx_slots),
+							GFP_KERNEL);
+	if (!vrp->rx_slots) {
+		err = -ENOMEM;
+		goto free_rx_bufs;
 	}
 
+	/* set up the receive buffers, and post them all */
+	for (i = 0; i < num_bufs / 2; i++)
+		vrp->rx_bufs[i].vrp = vrp;
+
+	__rpmsg_post_rx_bufs(vrp, GFP_KERNEL);
+
 	/* suppress "tx-complete" interrupts */
-	virtqueue_disable_cb(vrp->svq);
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		virtqueue_disable_cb(vrp->svq[i]);
 
 	vdev->priv = vrp;
 
+	/* if supported by the remote processor, enable flow control */
+	if (virtio_has_feature(vdev, VIRTIO_RPMSG_F_CREDITS)) {
+		vrp->credit_ept = __rpmsg_create_ept(vrp, NULL, rpmsg_credit_cb,
+						vrp, RPMSG_CREDIT_ADDR);
+		if (!vrp->credit_ept) {
+			dev_err(&vdev->dev, "failed to create the credit ept\n");
+			err = -ENOMEM;
+			goto free_rx_bufs;
+		}
+	}
+
 	/* if supported by the remote processor, enable the name service */
 	if (virtio_has_feature(vdev, VIRTIO_RPMSG_F_NS)) {
 		/* a dedicated endpoint handles the name service msgs */
@@ -938,12 +4382,48 @@ static int rpmsg_probe(struct virtio_device *vdev)
 		if (!vrp->ns_ept) {
 			dev_err(&vdev->dev, "failed to create the ns ept\n");
 			err = -ENOMEM;
-			goto vqs_del;
+			goto destroy_credit_ept;
+		}
+	}
+
+	if (rpmsg_dbg) {
+		vrp->dbg_dir = debugfs_create_dir(dev_name(&vdev->dev),
+								rpmsg_dbg);
+		if (vrp->dbg_dir) {
+			debugfs_create_file("rx_stats", 0400, vrp->dbg_dir,
+						vrp, &rpmsg_rx_stats_ops);
+			debugfs_create_file("tx_stats", 0400, vrp->dbg_dir,
+						vrp, &rpmsg_tx_stats_ops);
+			debugfs_create_file("endpoints", 0400, vrp->dbg_dir,
+						vrp, &rpmsg_endpoints_ops);
+			debugfs_create_file("stats", 0400, vrp->dbg_dir,
+						vrp, &rpmsg_stats_ops);
+			debugfs_create_file("latency", 0400, vrp->dbg_dir,
+						vrp, &rpmsg_latency_ops);
+			debugfs_create_u32("rx_coalesce_us", 0600, vrp->dbg_dir,
+						&vrp->rx_coalesce_us);
+			debugfs_create_u32("rx_coalesce_msgs", 0600,
+					vrp->dbg_dir, &vrp->rx_coalesce_msgs);
+
+			/* the capture ring is only needed if it can be read */
+			vrp->capture = kcalloc(RPMSG_CAPTURE_RECS,
+					sizeof(*vrp->capture), GFP_KERNEL);
+			if (vrp->capture) {
+				debugfs_create_file("capture", 0400,
+						vrp->dbg_dir, vrp,
+						&rpmsg_capture_ops);
+				debugfs_create_u32("capture_len", 0600,
+						vrp->dbg_dir,
+						&vrp->capture_len);
+			}
+		} else {
+			dev_err(&vdev->dev, "can't create debugfs dir\n");
 		}
 	}
 
 	/* tell the remote processor it can start sending messages */
-	virtqueue_kick(vrp->rvq);
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		virtqueue_kick(vrp->rvq[i]);
 
 	/* do we have a platform-specific static channels table ? */
 	vdev->config->get(vdev, VPROC_STATIC_CHANNELS, &ch, sizeof(ch));
@@ -956,17 +4436,187 @@ static int rpmsg_probe(struct virtio_device *vdev)
 
 	return 0;
 
+destroy_credit_ept:
+	if (vrp->credit_ept)
+		rpmsg_destroy_ept(vrp->credit_ept);
+free_rx_bufs:
+	kfree(vrp->rx_slots);
+	kfree(vrp->rx_bufs);
+destroy_pool:
+	rpmsg_destroy_tx_pools(vrp);
 vqs_del:
 	vdev->config->del_vqs(vrp->vdev);
+rx_stop:
+	rpmsg_rx_stop(vrp);
+cleanup_srcu:
+	cleanup_srcu_struct(&vrp->ept_srcu);
 free_vi:
 	kfree(vrp);
 	return err;
 }
 
+/* let a rebooted remote processor know about our channels again */
+static int rpmsg_reannounce(struct device *dev, void *data)
+{
+	struct rpmsg_channel *rpdev = to_rpmsg_channel(dev);
+	int err;
+
+	/* channels without a driver have no endpoint (hence no address) yet */
+	if (!dev->driver)
+		return 0;
+
+	err = rpmsg_announce(rpdev, RPMSG_NS_CREATE);
+	if (err)
+		dev_err(dev, "failed to re-announce service %d\n", err);
+
+	return 0;
+}
+
+/**
+ * rpmsg_recover() - get back in business after the remote processor crashed
+ * @vrp: virtual remote processor state
+ *
+ * The remote processor lost all of its state, so every buffer it had is
+ * taken back, the vrings are reset, and the platform is asked to reboot
+ * it. Everything on our side is kept: the channels (and hence the handles
+ * their drivers gave out, e.g. to user space), the endpoints and their
+ * addresses, and the rx buffers endpoints hold. Once the remote processor
+ * is back, our channels are announced to it again, and the channels it
+ * announces anew are matched with the ones we kept (so their drivers
+ * aren't probed again).
+ *
+ * The messages that were in flight, in either direction, are lost, and
+ * sending fails with -ENXIO until the remote processor is back.
+ */
+static void rpmsg_recover(struct virtproc_info *vrp)
+{
+	struct virtio_device *vdev = vrp->vdev;
+	struct rpmsg_frag *frag, *tmp;
+	struct rpmsg_tx_credit *tc;
+	struct hlist_node *pos, *n;
+	struct rpmsg_hdr *msg;
+	bool crashed = true, idle;
+	int i;
+	unsigned long flags;
+
+	dev_err(&vdev->dev, "remote processor crashed, recovering\n");
+
+	/* stop sending, and wait for the sender that is kicking, if any */
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	vrp->crashed = true;
+	while (vrp->tx_kicking) {
+		spin_unlock_irqrestore(&vrp->tx_lock, flags);
+		cpu_relax();
+		spin_lock_irqsave(&vrp->tx_lock, flags);
+	}
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	/* a pending resume would kick the remote processor, too */
+	cancel_work_sync(&vrp->resume_work);
+
+	/* let the current rx run, if any, complete, and hold off the next */
+	mutex_lock(&vrp->rx_lock);
+
+	spin_lock(&vrp->rvq_lock);
+	vrp->rx_resetting = true;
+	__rpmsg_rx_disable_cb(vrp);
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		while (virtqueue_detach_unused_buf(vrp->rvq[i]))
+			;
+	spin_unlock(&vrp->rvq_lock);
+
+	/* the rest of the fragmented messages won't arrive anymore */
+	list_for_each_entry_safe(frag, tmp, &vrp->rx_frags, node)
+		rpmsg_frag_free(vrp, frag);
+
+	/* take back the tx buffers, whose messages died with the remote */
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	for (i = 0; i < vrp->num_vq_pairs; i++) {
+		while ((msg = virtqueue_detach_unused_buf(vrp->svq[i])))
+			rpmsg_tx_pool_free(vrp, msg, rpmsg_tx_buf_size(msg));
+		vrp->tx_unkicked[i] = 0;
+	}
+	vrp->tx_inflight = 0;
+	vrp->tx_resuming = false;
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	/* so did the flow control state of the remote endpoints */
+	spin_lock(&vrp->credits_lock);
+	for (i = 0; i < RPMSG_CREDIT_HASH_SIZE; i++) {
+		hlist_for_each_entry_safe(tc, pos, n, &vrp->tx_credits[i],
+								node) {
+			hlist_del(&tc->node);
+			kfree(tc);
+		}
+	}
+	spin_unlock(&vrp->credits_lock);
+
+	/* the platform stops the notifications, and wipes the vrings */
+	vdev->config->reset(vdev);
+
+	/* give the remote processor all the rx buffers endpoints don't hold */
+	spin_lock(&vrp->rvq_lock);
+	__rpmsg_post_rx_bufs(vrp, GFP_ATOMIC);
+	vrp->rx_resetting = false;
+	spin_unlock(&vrp->rvq_lock);
+
+	/* and now let the platform reboot it */
+	vdev->config->set_status(vdev, vdev->config->get_status(vdev) |
+						VIRTIO_CONFIG_S_DRIVER_OK);
+
+	vdev->config->get(vdev, VPROC_CRASHED, &crashed, sizeof(crashed));
+	if (crashed) {
+		dev_err(&vdev->dev, "failed to recover the remote processor\n");
+		mutex_unlock(&vrp->rx_lock);
+		return;
+	}
+
+	spin_lock(&vrp->rvq_lock);
+	idle = __rpmsg_rx_enable_cb(vrp);
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		virtqueue_kick(vrp->rvq[i]);
+	spin_unlock(&vrp->rvq_lock);
+
+	mutex_unlock(&vrp->rx_lock);
+
+	/* the remote processor might have been quick to send us something */
+	if (!idle)
+		rpmsg_recv_done(vrp->rvq[RPMSG_PRIO_NORMAL]);
+
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	vrp->crashed = false;
+	vrp->recoveries++;
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	/* tx buffers were freed, and no remote endpoint is flow-controlled */
+	wake_up_interruptible(&vrp->sendq);
+	rpmsg_fire_tx_waiters(vrp);
+
+	device_for_each_child(&vdev->dev, NULL, rpmsg_reannounce);
+
+	dev_info(&vdev->dev, "recovered from the remote processor crash\n");
+}
+
+/* the platform tells us about changes in the remote processor's state */
+static void rpmsg_config_changed(struct virtio_device *vdev)
+{
+	struct virtproc_info *vrp = vdev->priv;
+	bool crashed = false;
+
+	if (!vrp)
+		return;
+
+	vdev->config->get(vdev, VPROC_CRASHED, &crashed, sizeof(crashed));
+	if (crashed)
+		rpmsg_recover(vrp);
+}
+
 static int rpmsg_remove_device(struct device *dev, void *data)
 {
 	struct rpmsg_channel *rpdev = to_rpmsg_channel(dev);
 
+	rpmsg_unhash_channel(rpdev->vrp, rpdev);
+
 	device_unregister(dev);
 
 	kfree(rpdev);
@@ -977,17 +4627,65 @@ static int rpmsg_remove_device(struct device *dev, void *data)
 static void __devexit rpmsg_remove(struct virtio_device *vdev)
 {
 	struct virtproc_info *vrp = vdev->priv;
-	int ret;
+	struct rpmsg_frag *frag, *tmp;
+	struct rpmsg_tx_credit *tc;
+	struct hlist_node *pos, *n;
+	struct rpmsg_hdr *msg;
+	int i, ret;
+	unsigned long flags;
+
+	/* no new channels from here on */
+	rpmsg_ns_stop(vrp);
 
 	ret = device_for_each_child(&vdev->dev, NULL, rpmsg_remove_device);
 	if (ret)
 		dev_warn(&vdev->dev, "can't remove rpmsg device: %d\n", ret);
 
+	if (vrp->ns_ept)
+		rpmsg_destroy_ept(vrp->ns_ept);
+
+	if (vrp->credit_ept)
+		rpmsg_destroy_ept(vrp->credit_ept);
+
+	/* the last messages might still be waiting for the remote to resume */
+	cancel_work_sync(&vrp->resume_work);
+
+	for (i = 0; i < RPMSG_CREDIT_HASH_SIZE; i++)
+		hlist_for_each_entry_safe(tc, pos, n, &vrp->tx_credits[i], node)
+			kfree(tc);
+
+	/* ignore the rx notifications, and stop dispatching inbound messages */
+	rpmsg_rx_stop(vrp);
+
 	idr_remove_all(&vrp->endpoints);
 	idr_destroy(&vrp->endpoints);
 
+	/* drop the messages that were never completely received */
+	list_for_each_entry_safe(frag, tmp, &vrp->rx_frags, node)
+		rpmsg_frag_free(vrp, frag);
+
+	/* take back all the tx buffers before destroying the tx pool */
+	spin_lock_irqsave(&vrp->tx_lock, flags);
+	__rpmsg_reclaim_tx_bufs(vrp);
+	for (i = 0; i < vrp->num_vq_pairs; i++)
+		while ((msg = virtqueue_detach_unused_buf(vrp->svq[i])))
+			rpmsg_tx_pool_free(vrp, msg, rpmsg_tx_buf_size(msg));
+	spin_unlock_irqrestore(&vrp->tx_lock, flags);
+
+	rpmsg_destroy_tx_pools(vrp);
+
 	vdev->config->del_vqs(vrp->vdev);
 
+	kfree(vrp->rx_slots);
+	kfree(vrp->rx_bufs);
+
+	if (vrp->dbg_dir)
+		debugfs_remove_recursive(vrp->dbg_dir);
+
+	kfree(vrp->capture);
+
+	cleanup_srcu_struct(&vrp->ept_srcu);
+
 	kfree(vrp);
 }
 
@@ -998,6 +4696,11 @@ static struct virtio_device_id id_table[] = {
 
 static unsigned int features[] = {
 	VIRTIO_RPMSG_F_NS,
+	VIRTIO_RPMSG_F_PRIO,
+	VIRTIO_RPMSG_F_NS_BATCH,
+	VIRTIO_RPMSG_F_FRAG,
+	VIRTIO_RPMSG_F_COMPACT_HDR,
+	VIRTIO_RPMSG_F_CREDITS,
 };
 
 static struct virtio_driver virtio_ipc_driver = {
@@ -1008,19 +4711,39 @@ static struct virtio_driver virtio_ipc_driver = {
 	.id_table	= id_table,
 	.probe		= rpmsg_probe,
 	.remove		= __devexit_p(rpmsg_remove),
+	.config_changed	= rpmsg_config_changed,
 };
 
 static int __init init(void)
 {
 	int ret;
 
+	if (debugfs_initialized()) {
+		rpmsg_dbg = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (!rpmsg_dbg)
+			pr_err("can't create debugfs dir\n");
+	}
+
 	ret = bus_register(&rpmsg_bus);
 	if (ret) {
 		pr_err("failed to register rpmsg bus: %d\n", ret);
-		return ret;
+		goto rm_dbg;
+	}
+
+	ret = register_virtio_driver(&virtio_ipc_driver);
+	if (ret) {
+		pr_err("failed to register virtio driver: %d\n", ret);
+		goto unreg_bus;
 	}
 
-	return register_virtio_driver(&virtio_ipc_driver);
+	return 0;
+
+unreg_bus:
+	bus_unregister(&rpmsg_bus);
+rm_dbg:
+	if (rpmsg_dbg)
+		debugfs_remove(rpmsg_dbg);
+	return ret;
 }
 module_init(init);
 
@@ -1028,6 +4751,8 @@ static void __exit fini(void)
 {
 	unregister_virtio_driver(&virtio_ipc_driver);
 	bus_unregister(&rpmsg_bus);
+	if (rpmsg_dbg)
+		debugfs_remove(rpmsg_dbg);
 }
 module_exit(fini);
 
@@ -0,0 +1,685 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are allocated from size classes 16 bytes apart, each of which
+ * packs its objects in zspages (see zsmalloc_int.h). zs_malloc() returns
+ * a handle rather than an address: the object must be mapped with
+ * zs_map_object() to be accessed, and compaction is free to move it to
+ * another zspage while it is not mapped.
+ *
+ * Locking: the class lock protects the zspages of a class, their free
+ * lists and the fullness lists. The pin bit of a handle keeps its object
+ * where it is, and is taken before the class lock. Compaction, which
+ * holds the class lock, only trylocks the pin and skips pinned objects.
+ *
+ * Object mappings use the KM_USER1 kmap slot, so a caller may hold a
+ * KM_USER0 mapping while one object is mapped.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *zs_handle_cache;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_ALIGN);
+
+	return idx;
+}
+
+/*
+ * Number of pages per zspage giving the highest usage: with class
+ * sizes that do not divide PAGE_SIZE, a longer zspage wastes a smaller
+ * fraction of its space at its end.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static unsigned long obj_encode(struct zspage *zspage, unsigned int idx)
+{
+	unsigned long obj;
+
+	obj = page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS;
+	obj |= idx & OBJ_INDEX_MASK;
+
+	return obj << OBJ_TAG_BITS;
+}
+
+static struct zspage *obj_decode(unsigned long obj, unsigned int *idx)
+{
+	struct page *page;
+
+	obj >>= OBJ_TAG_BITS;
+	*idx = obj & OBJ_INDEX_MASK;
+	page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+
+	return (struct zspage *)page_private(page);
+}
+
+static unsigned long *handle_ptr(unsigned long handle)
+{
+	return (unsigned long *)handle;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *handle_ptr(handle) & ~(1UL << HANDLE_PIN_BIT);
+}
+
+static void pin_handle(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, handle_ptr(handle));
+}
+
+static int trypin_handle(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, handle_ptr(handle));
+}
+
+static void unpin_handle(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, handle_ptr(handle));
+}
+
+/* Set the location of a pinned handle */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*handle_ptr(handle) = obj | (1UL << HANDLE_PIN_BIT);
+}
+
+/*
+ * Copy len bytes from start into the object, or out of it, one page at
+ * a time.
+ */
+static void zs_copy_obj(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, void *buf, unsigned int start,
+			unsigned int len, bool to_obj)
+{
+	unsigned long offset = (unsigned long)idx * class->size + start;
+
+	while (len) {
+		struct page *page = zspage->pages[offset >> PAGE_SHIFT];
+		unsigned int off = offset & ~PAGE_MASK;
+		unsigned int n = min_t(unsigned int, len, PAGE_SIZE - off);
+		char *vaddr;
+
+		vaddr = kmap_atomic(page, KM_USER1);
+		if (to_obj)
+			memcpy(vaddr + off, buf, n);
+		else
+			memcpy(buf, vaddr + off, n);
+		kunmap_atomic(vaddr, KM_USER1);
+
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+}
+
+static unsigned long obj_read_header(struct size_class *class,
+				struct zspage *zspage, unsigned int idx)
+{
+	unsigned long header;
+
+	zs_copy_obj(class, zspage, idx, &header, 0, sizeof(header), false);
+	return header;
+}
+
+static void obj_write_header(struct size_class *class,
+			struct zspage *zspage, unsigned int idx,
+			unsigned long header)
+{
+	zs_copy_obj(class, zspage, idx, &header, 0, sizeof(header), true);
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	int inuse = zspage->inuse, max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse <= (fullness_threshold_frac - 1) * max_objects /
+			fullness_threshold_frac)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/* Move the zspage to the list of its current fullness group */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+	if (newfg < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static void free_zspage(struct size_class *class, struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	struct zspage *zspage;
+	int i;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(flags);
+
+		if (!page) {
+			while (i--)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	/* Link all objects in the free list, in address order */
+	for (i = 0; i < class->objs_per_zspage; i++)
+		obj_write_header(class, zspage, i,
+				(unsigned long)(i + 1) << OBJ_TAG_BITS);
+	zspage->freeobj = 0;
+
+	return zspage;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+						struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/* Take a free object of the zspage for handle, with the class lock held */
+static unsigned long obj_malloc(struct size_class *class,
+				struct zspage *zspage, unsigned long handle)
+{
+	unsigned int idx = zspage->freeobj;
+
+	BUG_ON(zspage->inuse >= class->objs_per_zspage);
+
+	zspage->freeobj = obj_read_header(class, zspage, idx) >> OBJ_TAG_BITS;
+	obj_write_header(class, zspage, idx, handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	return obj_encode(zspage, idx);
+}
+
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int idx)
+{
+	obj_write_header(class, zspage, idx,
+			(unsigned long)zspage->freeobj << OBJ_TAG_BITS);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, for messages
+ * @flags: allocation flags used to allocate the pages of the pool
+ *
+ * Returns the pool on success, NULL otherwise.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, cpu;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		int j;
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_ALIGN;
+		class->index = i;
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+	}
+
+	pool->area = alloc_percpu(struct mapping_area);
+	if (!pool->area)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = per_cpu_ptr(pool->area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf)
+			goto fail;
+	}
+
+	pool->flags = flags;
+	pool->name = name;
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/**
+ * zs_destroy_pool - Frees a pool and all its pages.
+ * @pool: pool to destroy
+ *
+ * The objects of the pool should have been freed first.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, cpu;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		int fg;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("zsmalloc: %s: freeing non-empty "
+					"zspage, class size %d\n",
+					pool->name, class->size);
+				free_zspage(class, zspage);
+			}
+		}
+	}
+
+	if (pool->area) {
+		for_each_possible_cpu(cpu)
+			kfree(per_cpu_ptr(pool->area, cpu)->vm_buf);
+		free_percpu(pool->area);
+	}
+
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * Returns the handle of the object, 0 on failure. May sleep if the
+ * flags of the pool allow it.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned long handle, obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cache,
+					pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	*handle_ptr(handle) = 0;
+
+	class = &pool->size_class[get_size_class_index(size + ZS_HANDLE_SIZE)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(class, pool->flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, (void *)handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		class->pages_allocated += class->pages_per_zspage;
+	}
+
+	obj = obj_malloc(class, zspage, handle);
+	*handle_ptr(handle) = obj;
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/**
+ * zs_free - Free an object allocated with zs_malloc().
+ * @pool: pool to free from
+ * @handle: handle of the object, which must not be mapped
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fullness;
+	unsigned int idx;
+
+	if (unlikely(!handle))
+		return;
+
+	pin_handle(handle);
+	zspage = obj_decode(handle_to_obj(handle), &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->pages_allocated -= class->pages_per_zspage;
+	spin_unlock(&class->lock);
+	unpin_handle(handle);
+
+	if (fullness == ZS_EMPTY)
+		free_zspage(class, zspage);
+
+	kmem_cache_free(zs_handle_cache, (void *)handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - Get address of an allocated object from its handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: what the caller does with the object
+ *
+ * The object stays pinned, and preemption disabled, until the matching
+ * zs_unmap_object(). Only one object can be mapped at a time on a CPU.
+ * @mm avoids copying in (ZS_MM_WO) or back (ZS_MM_RO) an object that
+ * spans two pages.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	struct mapping_area *area;
+	unsigned long offset;
+	unsigned int idx, off;
+
+	BUG_ON(!handle);
+
+	/* disables preemption */
+	pin_handle(handle);
+
+	zspage = obj_decode(handle_to_obj(handle), &idx);
+	class = zspage->class;
+	offset = (unsigned long)idx * class->size;
+	off = offset & ~PAGE_MASK;
+
+	area = this_cpu_ptr(pool->area);
+	area->vm_mm = mm;
+
+	if (off + class->size <= PAGE_SIZE) {
+		area->vm_addr = kmap_atomic(zspage->pages[offset >> PAGE_SHIFT],
+						KM_USER1);
+		return area->vm_addr + off + ZS_HANDLE_SIZE;
+	}
+
+	/* the object spans two pages */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_obj(class, zspage, idx, area->vm_buf + ZS_HANDLE_SIZE,
+			ZS_HANDLE_SIZE, class->size - ZS_HANDLE_SIZE, false);
+
+	return area->vm_buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct mapping_area *area = this_cpu_ptr(pool->area);
+
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	} else if (area->vm_mm != ZS_MM_RO) {
+		struct size_class *class;
+		struct zspage *zspage;
+		unsigned int idx;
+
+		zspage = obj_decode(handle_to_obj(handle), &idx);
+		class = zspage->class;
+		zs_copy_obj(class, zspage, idx, area->vm_buf + ZS_HANDLE_SIZE,
+			ZS_HANDLE_SIZE, class->size - ZS_HANDLE_SIZE, true);
+	}
+
+	unpin_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	int i;
+	u64 npages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		npages += class->pages_allocated;
+		spin_unlock(&class->lock);
+	}
+
+	return npages << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * Move the objects of src to dst, until either is full or empty. Returns
+ * false if an object could not be moved because it is pinned.
+ */
+static bool migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *src, struct zspage *dst)
+{
+	char *buf = this_cpu_ptr(pool->area)->vm_buf;
+	unsigned int idx;
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		unsigned long header, handle, obj;
+		unsigned int new_idx;
+
+		if (!src->inuse || dst->inuse == class->objs_per_zspage)
+			break;
+
+		header = obj_read_header(class, src, idx);
+		if (!(header & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = header & ~OBJ_ALLOCATED_TAG;
+		if (!trypin_handle(handle))
+			return false;
+
+		zs_copy_obj(class, src, idx, buf, ZS_HANDLE_SIZE,
+				class->size - ZS_HANDLE_SIZE, false);
+		obj = obj_malloc(class, dst, handle);
+		obj_decode(obj, &new_idx);
+		zs_copy_obj(class, dst, new_idx, buf, ZS_HANDLE_SIZE,
+				class->size - ZS_HANDLE_SIZE, true);
+
+		record_obj(handle, obj);
+		obj_free(class, src, idx);
+		unpin_handle(handle);
+	}
+
+	return true;
+}
+
+/* Compacting pays off once the free objects of a class fill a zspage */
+static bool zs_can_compact(struct size_class *class)
+{
+	unsigned long objs_allocated;
+
+	objs_allocated = class->pages_allocated / class->pages_per_zspage *
+				class->objs_per_zspage;
+
+	return objs_allocated - class->objs_inuse >= class->objs_per_zspage;
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct list_head *almost_empty;
+	unsigned long freed = 0;
+
+	almost_empty = &class->fullness_list[ZS_ALMOST_EMPTY];
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class) && !list_empty(almost_empty)) {
+		struct zspage *src, *dst;
+		bool done;
+
+		/* Empty the least recently used almost empty zspage... */
+		src = list_entry(almost_empty->prev, struct zspage, list);
+		list_del_init(&src->list);
+		src->fullness = ZS_FULL;
+
+		/* ...into the fullest ones */
+		while ((dst = find_get_zspage(class))) {
+			done = migrate_zspage(pool, class, src, dst);
+			fix_fullness_group(class, dst);
+			if (!done || !src->inuse)
+				break;
+		}
+
+		if (fix_fullness_group(class, src) != ZS_EMPTY)
+			break;
+
+		class->pages_allocated -= class->pages_per_zspage;
+		free_zspage(class, src);
+		freed += class->pages_per_zspage;
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Free zspages by moving objects out of sparse ones.
+ * @pool: pool to compact
+ *
+ * Must not be called with an object mapped. Returns the number of pages
+ * freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static int __init zs_init(void)
+{
+	zs_handle_cache = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					0, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void __exit zs_exit(void)
+{
+	kmem_cache_destroy(zs_handle_cache);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Memory allocator for compressed pages");
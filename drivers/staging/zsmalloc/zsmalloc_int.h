@@ -0,0 +1,122 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "zsmalloc.h"
+
+/*
+ * A zspage is a group of up to ZS_MAX_PAGES_PER_ZSPAGE 0-order pages,
+ * holding objects of a single size class laid out back to back, so an
+ * object may span two pages. For each size class, the number of pages
+ * per zspage is the one that wastes the least space at its end.
+ */
+#define ZS_MAX_ZSPAGE_ORDER	2
+#define ZS_MAX_PAGES_PER_ZSPAGE	(1 << ZS_MAX_ZSPAGE_ORDER)
+
+/*
+ * Each object starts with a word: the handle when allocated (tagged with
+ * OBJ_ALLOCATED_TAG), the index of the next free object otherwise. It
+ * lets compaction find the handle of an object it moves.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
+/*
+ * Object sizes, header included. ZS_ALIGN keeps the header of an object
+ * within a page.
+ */
+#define ZS_MIN_ALLOC_SHIFT	5
+#define ZS_MIN_ALLOC_SIZE	(1 << ZS_MIN_ALLOC_SHIFT)
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_ALIGN		16
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_ALIGN + 1)
+
+/*
+ * An object location is the pfn of the first page of its zspage and the
+ * index of the object in it, shifted by OBJ_TAG_BITS. The low bit of the
+ * handle, which holds the location, is a lock pinning the object in
+ * place while it is mapped, freed or moved.
+ */
+#define OBJ_TAG_BITS		1
+#define OBJ_ALLOCATED_TAG	1
+#define HANDLE_PIN_BIT		0
+
+#define OBJ_INDEX_BITS		(PAGE_SHIFT + ZS_MAX_ZSPAGE_ORDER - \
+					ZS_MIN_ALLOC_SHIFT)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+/*
+ * A zspage is on the list of its fullness group: almost full zspages are
+ * preferred for allocations, almost empty ones are compacted. Empty
+ * zspages are freed, and full ones are on no list.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+	ZS_FULL
+};
+
+/* Above 3/4 of its objects in use, a zspage is almost full */
+static const int fullness_threshold_frac = 4;
+
+struct size_class {
+	spinlock_t lock;	/* protect the zspages of the class */
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	/* Object size, header included */
+	int size;
+	unsigned int index;
+
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	unsigned long pages_allocated;
+	unsigned long objs_inuse;
+};
+
+/* Pointed to by the private field of each of its pages */
+struct zspage {
+	struct list_head list;
+	struct size_class *class;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+
+	unsigned int inuse;
+	unsigned int freeobj;	/* valid while inuse < objs_per_zspage */
+	enum fullness_group fullness;
+};
+
+/*
+ * Per CPU state of the object mapped by zs_map_object(). An object that
+ * spans two pages is copied to vm_buf.
+ */
+struct mapping_area {
+	char *vm_buf;
+	char *vm_addr;		/* kmap of an object within a page */
+	enum zs_mapmode vm_mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	struct mapping_area __percpu *area;
+
+	gfp_t flags;	/* allocation flags for the pages of the pool */
+	const char *name;
+};
+
+#endif
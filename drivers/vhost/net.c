@@ -13,6 +13,8 @@
 #include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
 #include <linux/workqueue.h>
 #include <linux/rcupdate.h>
 #include <linux/file.h>
@@ -32,6 +34,35 @@
  * Using this limit prevents one virtqueue from starving others. */
 #define VHOST_NET_WEIGHT 0x80000
 
+/*
+ * Once they run dry, keep polling the TX ring and the RX socket for up to
+ * this many microseconds before going back to sleep, to save the guest the
+ * latency of a kick and the wakeup of the worker. Traded for CPU time, so off
+ * by default. Polling ends early when the worker has other work, or should
+ * reschedule.
+ */
+static unsigned int busyloop_timeout;
+module_param(busyloop_timeout, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(busyloop_timeout, "Busy poll timeout in us (0 to disable)");
+
+/*
+ * Transmit guest buffers by pinning their pages and handing them down to the
+ * lower device, rather than copying them, on the sockets that support it
+ * (macvtap on top of a device doing scatter/gather). The guest is signalled
+ * once the lower device is done with them.
+ */
+static int experimental_zcopytx;
+module_param(experimental_zcopytx, int, S_IRUGO);
+MODULE_PARM_DESC(experimental_zcopytx, "Enable Experimental Zero Copy TX");
+
+/* Copy the packets smaller than this: signalling the guest right away is
+ * cheaper than pinning their pages. */
+#define VHOST_GOODCOPY_LEN 256
+
+/* Max number of zero-copy buffers in flight per vq, before TX waits for the
+ * lower device to be done with some of them. */
+#define VHOST_MAX_PEND 128
+
 enum {
 	VHOST_NET_VQ_RX = 0,
 	VHOST_NET_VQ_TX = 1,
@@ -92,6 +123,56 @@ static void copy_iovec_hdr(const struct iovec *from, struct iovec *to,
 	}
 }
 
+/* Roughly microseconds, which is all busy polling needs. */
+static inline u64 busy_clock(void)
+{
+	return local_clock() >> 10;
+}
+
+static bool vhost_can_busy_poll(struct vhost_virtqueue *vq, u64 endtime)
+{
+	return likely(!need_resched()) &&
+	       likely(busy_clock() < endtime) &&
+	       likely(!signal_pending(current)) &&
+	       !vhost_vq_has_work(vq);
+}
+
+/* Like vhost_get_vq_desc(), but busy polls the ring for a while if it's
+ * empty. Caller must have VQ lock, and notifications disabled. */
+static int vhost_net_tx_get_vq_desc(struct vhost_net *net,
+				    struct vhost_virtqueue *vq,
+				    unsigned int *out, unsigned int *in)
+{
+	unsigned int timeout = ACCESS_ONCE(busyloop_timeout);
+	int head;
+	u64 endtime;
+
+	head = vhost_get_vq_desc(&net->dev, vq, vq->iov, ARRAY_SIZE(vq->iov),
+				 out, in, NULL, NULL);
+	if (head != vq->num || !timeout)
+		return head;
+
+	endtime = busy_clock() + timeout;
+	while (vhost_can_busy_poll(vq, endtime) &&
+	       vhost_vq_avail_empty(&net->dev, vq))
+		cpu_relax();
+
+	return vhost_get_vq_desc(&net->dev, vq, vq->iov, ARRAY_SIZE(vq->iov),
+				 out, in, NULL, NULL);
+}
+
+static bool vhost_sock_zcopy(struct socket *sock)
+{
+	return unlikely(experimental_zcopytx) &&
+		sock_flag(sock->sk, SOCK_ZEROCOPY);
+}
+
+/* Number of zero-copy buffers in flight. Caller must have VQ lock. */
+static int vhost_zerocopy_pending(struct vhost_virtqueue *vq)
+{
+	return (vq->upend_idx + UIO_MAXIOV - vq->done_idx) % UIO_MAXIOV;
+}
+
 /* Caller must have TX VQ lock */
 static void tx_poll_stop(struct vhost_net *net)
 {
@@ -129,6 +210,8 @@ static void handle_tx(struct vhost_net *net)
 	int err, wmem;
 	size_t hdr_size;
 	struct socket *sock;
+	struct vhost_ubuf_ref *uninitialized_var(ubufs);
+	bool zcopy;
 
 	/* TODO: check that we are running from vhost_worker? */
 	sock = rcu_dereference_check(vq->private_data, 1);
@@ -139,6 +222,9 @@ static void handle_tx(struct vhost_net *net)
 	if (wmem >= sock->sk->sk_sndbuf) {
 		mutex_lock(&vq->mutex);
 		tx_poll_start(net, sock);
+		/* Zero-copy completions still need to reach the guest. */
+		if (vq->ubufs)
+			vhost_zerocopy_signal_used(vq);
 		mutex_unlock(&vq->mutex);
 		return;
 	}
@@ -149,12 +235,19 @@ static void handle_tx(struct vhost_net *net)
 	if (wmem < sock->sk->sk_sndbuf / 2)
 		tx_poll_stop(net);
 	hdr_size = vq->vhost_hlen;
+	zcopy = vq->ubufs;
 
 	for (;;) {
-		head = vhost_get_vq_desc(&net->dev, vq, vq->iov,
-					 ARRAY_SIZE(vq->iov),
-					 &out, &in,
-					 NULL, NULL);
+		/* Release the buffers the lower device is done with first. */
+		if (zcopy) {
+			vhost_zerocopy_signal_used(vq);
+			/* Too many in flight? Their completions requeue us. */
+			if (unlikely(vhost_zerocopy_pending(vq) >=
+				     VHOST_MAX_PEND))
+				break;
+		}
+
+		head = vhost_net_tx_get_vq_desc(net, vq, &out, &in);
 		/* On error, stop handling until the next kick. */
 		if (unlikely(head < 0))
 			break;
@@ -188,9 +281,41 @@ static void handle_tx(struct vhost_net *net)
 			       iov_length(vq->hdr, s), hdr_size);
 			break;
 		}
+		if (zcopy) {
+			vq->heads[vq->upend_idx].id = head;
+			if (len < VHOST_GOODCOPY_LEN) {
+				/* Copied: nothing to wait for, but signal it in
+				 * order with the buffers in flight. */
+				vq->heads[vq->upend_idx].len =
+							VHOST_DMA_DONE_LEN;
+				msg.msg_control = NULL;
+				msg.msg_controllen = 0;
+				ubufs = NULL;
+			} else {
+				struct ubuf_info *ubuf;
+
+				ubuf = vq->ubuf_info + vq->upend_idx;
+				vq->heads[vq->upend_idx].len =
+							VHOST_DMA_IN_PROGRESS;
+				ubuf->callback = vhost_zerocopy_callback;
+				ubuf->arg = vq->ubufs;
+				ubuf->desc = vq->upend_idx;
+				msg.msg_control = ubuf;
+				msg.msg_controllen = sizeof(ubuf);
+				ubufs = vq->ubufs;
+				kref_get(&ubufs->kref);
+			}
+			vq->upend_idx = (vq->upend_idx + 1) % UIO_MAXIOV;
+		}
 		/* TODO: Check specific error and bomb out unless ENOBUFS? */
 		err = sock->ops->sendmsg(NULL, sock, &msg, len);
 		if (unlikely(err < 0)) {
+			if (zcopy) {
+				if (ubufs)
+					vhost_ubuf_put(ubufs);
+				vq->upend_idx = (vq->upend_idx + UIO_MAXIOV -
+						 1) % UIO_MAXIOV;
+			}
 			vhost_discard_vq_desc(vq, 1);
 			tx_poll_start(net, sock);
 			break;
@@ -198,7 +323,8 @@ static void handle_tx(struct vhost_net *net)
 		if (err != len)
 			pr_debug("Truncated TX packet: "
 				 " len %d != %zd\n", err, len);
-		vhost_add_used_and_signal(&net->dev, vq, head, 0);
+		if (!zcopy)
+			vhost_add_used_and_signal(&net->dev, vq, head, 0);
 		total_len += len;
 		if (unlikely(total_len >= VHOST_NET_WEIGHT)) {
 			vhost_poll_queue(&vq->poll);
@@ -223,6 +349,27 @@ static int peek_head_len(struct sock *sk)
 	return len;
 }
 
+/* Like peek_head_len(), but busy polls the socket for a while if it's
+ * empty. Caller must have RX VQ lock. */
+static int vhost_net_rx_peek_head_len(struct vhost_virtqueue *vq,
+				      struct sock *sk)
+{
+	unsigned int timeout = ACCESS_ONCE(busyloop_timeout);
+	int len;
+	u64 endtime;
+
+	len = peek_head_len(sk);
+	if (len || !timeout)
+		return len;
+
+	endtime = busy_clock() + timeout;
+	while (vhost_can_busy_poll(vq, endtime) &&
+	       skb_queue_empty(&sk->sk_receive_queue))
+		cpu_relax();
+
+	return peek_head_len(sk);
+}
+
 /* This is a multi-buffer version of vhost_get_desc, that works if
  *	vq has read descriptors only.
  * @vq		- the relevant virtqueue
@@ -323,7 +470,7 @@ static void handle_rx(struct vhost_net *net)
 		vq->log : NULL;
 	mergeable = vhost_has_feature(&net->dev, VIRTIO_NET_F_MRG_RXBUF);
 
-	while ((sock_len = peek_head_len(sock->sk))) {
+	while ((sock_len = vhost_net_rx_peek_head_len(vq, sock->sk))) {
 		sock_len += sock_hlen;
 		vhost_len = sock_len + vhost_hlen;
 		headcount = get_rx_bufs(vq, vq->heads, vhost_len,
@@ -446,6 +593,8 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 
 	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, POLLOUT, dev);
 	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, POLLIN, dev);
+	vhost_poll_bind(n->poll + VHOST_NET_VQ_TX, n->vqs + VHOST_NET_VQ_TX);
+	vhost_poll_bind(n->poll + VHOST_NET_VQ_RX, n->vqs + VHOST_NET_VQ_RX);
 	n->tx_poll_state = VHOST_NET_POLL_DISABLED;
 
 	f->private_data = n;
@@ -603,6 +752,7 @@ static long vhost_net_set_backend(struct vhost_net *n, unsigned index, int fd)
 {
 	struct socket *sock, *oldsock;
 	struct vhost_virtqueue *vq;
+	struct vhost_ubuf_ref *ubufs, *oldubufs = NULL;
 	int r;
 
 	mutex_lock(&n->dev.mutex);
@@ -632,6 +782,14 @@ static long vhost_net_set_backend(struct vhost_net *n, unsigned index, int fd)
 	oldsock = rcu_dereference_protected(vq->private_data,
 					    lockdep_is_held(&vq->mutex));
 	if (sock != oldsock) {
+		ubufs = vhost_ubuf_alloc(vq, sock && vq->ubuf_info &&
+					 vhost_sock_zcopy(sock));
+		if (IS_ERR(ubufs)) {
+			r = PTR_ERR(ubufs);
+			goto err_ubufs;
+		}
+		oldubufs = vq->ubufs;
+		vq->ubufs = ubufs;
 		vhost_net_disable_vq(n, vq);
 		rcu_assign_pointer(vq->private_data, sock);
 		vhost_net_enable_vq(n, vq);
@@ -639,6 +797,14 @@ static long vhost_net_set_backend(struct vhost_net *n, unsigned index, int fd)
 
 	mutex_unlock(&vq->mutex);
 
+	/* Wait for the buffers in flight to the old socket. */
+	if (oldubufs) {
+		vhost_ubuf_put_and_wait(oldubufs);
+		mutex_lock(&vq->mutex);
+		vhost_zerocopy_signal_used(vq);
+		mutex_unlock(&vq->mutex);
+	}
+
 	if (oldsock) {
 		vhost_net_flush_vq(n, index);
 		fput(oldsock->file);
@@ -647,6 +813,9 @@ static long vhost_net_set_backend(struct vhost_net *n, unsigned index, int fd)
 	mutex_unlock(&n->dev.mutex);
 	return 0;
 
+err_ubufs:
+	if (sock)
+		fput(sock->file);
 err_vq:
 	mutex_unlock(&vq->mutex);
 err:
@@ -776,6 +945,8 @@ static struct miscdevice vhost_net_misc = {
 
 static int vhost_net_init(void)
 {
+	if (experimental_zcopytx)
+		vhost_enable_zcopy(VHOST_NET_VQ_TX);
 	return misc_register(&vhost_net_misc);
 }
 module_init(vhost_net_init);
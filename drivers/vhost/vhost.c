@@ -25,6 +25,8 @@
 #include <linux/slab.h>
 #include <linux/kthread.h>
 #include <linux/cgroup.h>
+#include <linux/cpumask.h>
+#include <linux/moduleparam.h>
 
 #include <linux/net.h>
 #include <linux/if_packet.h>
@@ -40,6 +42,18 @@ enum {
 #define vhost_used_event(vq) ((u16 __user *)&vq->avail->ring[vq->num])
 #define vhost_avail_event(vq) ((u16 __user *)&vq->used->ring[vq->num])
 
+/*
+ * By default, all the vqs of a device are served by a single worker thread,
+ * which becomes the bottleneck of multi-queue guests. With vq_workers, the
+ * work of each vq is run by a thread of its own instead, so e.g. the TX and
+ * RX processing of vhost-net is spread over two cores. The CPU a worker runs
+ * on can be picked with VHOST_SET_VRING_CPU. Takes effect for the devices
+ * opened after it's changed.
+ */
+static bool vq_workers;
+module_param(vq_workers, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(vq_workers, "Run a worker thread per virtqueue");
+
 static void vhost_poll_func(struct file *file, wait_queue_head_t *wqh,
 			    poll_table *pt)
 {
@@ -79,10 +93,23 @@ void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
 	init_poll_funcptr(&poll->table, vhost_poll_func);
 	poll->mask = mask;
 	poll->dev = dev;
+	poll->worker = &dev->worker;
 
 	vhost_work_init(&poll->work, fn);
 }
 
+static struct vhost_worker *vhost_vq_worker(struct vhost_virtqueue *vq)
+{
+	return vq->dev->vq_workers ? &vq->worker : &vq->dev->worker;
+}
+
+/* Queue the work of an initialized poll structure on the worker of a vq,
+ * so it's serialized with the processing of that vq. */
+void vhost_poll_bind(struct vhost_poll *poll, struct vhost_virtqueue *vq)
+{
+	poll->worker = vhost_vq_worker(vq);
+}
+
 /* Start polling a file. We add ourselves to file's wait queue. The caller must
  * keep a reference to a file until after vhost_poll_stop is called. */
 void vhost_poll_start(struct vhost_poll *poll, struct file *file)
@@ -101,30 +128,31 @@ void vhost_poll_stop(struct vhost_poll *poll)
 	remove_wait_queue(poll->wqh, &poll->wait);
 }
 
-static bool vhost_work_seq_done(struct vhost_dev *dev, struct vhost_work *work,
-				unsigned seq)
+static bool vhost_work_seq_done(struct vhost_worker *worker,
+				struct vhost_work *work, unsigned seq)
 {
 	int left;
 
-	spin_lock_irq(&dev->work_lock);
+	spin_lock_irq(&worker->work_lock);
 	left = seq - work->done_seq;
-	spin_unlock_irq(&dev->work_lock);
+	spin_unlock_irq(&worker->work_lock);
 	return left <= 0;
 }
 
-static void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+static void vhost_work_flush(struct vhost_worker *worker,
+			     struct vhost_work *work)
 {
 	unsigned seq;
 	int flushing;
 
-	spin_lock_irq(&dev->work_lock);
+	spin_lock_irq(&worker->work_lock);
 	seq = work->queue_seq;
 	work->flushing++;
-	spin_unlock_irq(&dev->work_lock);
-	wait_event(work->done, vhost_work_seq_done(dev, work, seq));
-	spin_lock_irq(&dev->work_lock);
+	spin_unlock_irq(&worker->work_lock);
+	wait_event(work->done, vhost_work_seq_done(worker, work, seq));
+	spin_lock_irq(&worker->work_lock);
 	flushing = --work->flushing;
-	spin_unlock_irq(&dev->work_lock);
+	spin_unlock_irq(&worker->work_lock);
 	BUG_ON(flushing < 0);
 }
 
@@ -132,26 +160,26 @@ static void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
  * locks that are also used by the callback. */
 void vhost_poll_flush(struct vhost_poll *poll)
 {
-	vhost_work_flush(poll->dev, &poll->work);
+	vhost_work_flush(poll->worker, &poll->work);
 }
 
-static inline void vhost_work_queue(struct vhost_dev *dev,
+static inline void vhost_work_queue(struct vhost_worker *worker,
 				    struct vhost_work *work)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&dev->work_lock, flags);
+	spin_lock_irqsave(&worker->work_lock, flags);
 	if (list_empty(&work->node)) {
-		list_add_tail(&work->node, &dev->work_list);
+		list_add_tail(&work->node, &worker->work_list);
 		work->queue_seq++;
-		wake_up_process(dev->worker);
+		wake_up_process(worker->task);
 	}
-	spin_unlock_irqrestore(&dev->work_lock, flags);
+	spin_unlock_irqrestore(&worker->work_lock, flags);
 }
 
 void vhost_poll_queue(struct vhost_poll *poll)
 {
-	vhost_work_queue(poll->dev, &poll->work);
+	vhost_work_queue(poll->worker, &poll->work);
 }
 
 static void vhost_vq_reset(struct vhost_dev *dev,
@@ -179,11 +207,15 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->call_ctx = NULL;
 	vq->call = NULL;
 	vq->log_ctx = NULL;
+	vq->upend_idx = 0;
+	vq->done_idx = 0;
+	vq->ubufs = NULL;
 }
 
 static int vhost_worker(void *data)
 {
-	struct vhost_dev *dev = data;
+	struct vhost_worker *worker = data;
+	struct vhost_dev *dev = worker->dev;
 	struct vhost_work *work = NULL;
 	unsigned uninitialized_var(seq);
 
@@ -193,7 +225,7 @@ static int vhost_worker(void *data)
 		/* mb paired w/ kthread_stop */
 		set_current_state(TASK_INTERRUPTIBLE);
 
-		spin_lock_irq(&dev->work_lock);
+		spin_lock_irq(&worker->work_lock);
 		if (work) {
 			work->done_seq = seq;
 			if (work->flushing)
@@ -201,18 +233,18 @@ static int vhost_worker(void *data)
 		}
 
 		if (kthread_should_stop()) {
-			spin_unlock_irq(&dev->work_lock);
+			spin_unlock_irq(&worker->work_lock);
 			__set_current_state(TASK_RUNNING);
 			break;
 		}
-		if (!list_empty(&dev->work_list)) {
-			work = list_first_entry(&dev->work_list,
+		if (!list_empty(&worker->work_list)) {
+			work = list_first_entry(&worker->work_list,
 						struct vhost_work, node);
 			list_del_init(&work->node);
 			seq = work->queue_seq;
 		} else
 			work = NULL;
-		spin_unlock_irq(&dev->work_lock);
+		spin_unlock_irq(&worker->work_lock);
 
 		if (work) {
 			__set_current_state(TASK_RUNNING);
@@ -225,10 +257,34 @@ static int vhost_worker(void *data)
 	return 0;
 }
 
+static void vhost_worker_init(struct vhost_dev *dev,
+			      struct vhost_worker *worker)
+{
+	spin_lock_init(&worker->work_lock);
+	INIT_LIST_HEAD(&worker->work_list);
+	worker->task = NULL;
+	worker->dev = dev;
+	worker->cpu = -1;
+}
+
+/* Bind the thread of a worker to its CPU, or let it run anywhere again. */
+static int vhost_worker_set_cpu(struct vhost_worker *worker)
+{
+	if (!worker->task)
+		return 0;
+	if (worker->cpu < 0)
+		return set_cpus_allowed_ptr(worker->task, cpu_possible_mask);
+	return set_cpus_allowed_ptr(worker->task, cpumask_of(worker->cpu));
+}
+
+/* The vqs which may transmit zero-copy buffers, see vhost_enable_zcopy(). */
+static unsigned vhost_zcopy_mask __read_mostly;
+
 /* Helper to allocate iovec buffers for all vqs. */
 static long vhost_dev_alloc_iovecs(struct vhost_dev *dev)
 {
 	int i;
+	bool zcopy;
 
 	for (i = 0; i < dev->nvqs; ++i) {
 		dev->vqs[i].indirect = kmalloc(sizeof *dev->vqs[i].indirect *
@@ -237,9 +293,15 @@ static long vhost_dev_alloc_iovecs(struct vhost_dev *dev)
 					  GFP_KERNEL);
 		dev->vqs[i].heads = kmalloc(sizeof *dev->vqs[i].heads *
 					    UIO_MAXIOV, GFP_KERNEL);
+		zcopy = vhost_zcopy_mask & (0x1 << i);
+		if (zcopy)
+			dev->vqs[i].ubuf_info =
+				kmalloc(sizeof *dev->vqs[i].ubuf_info *
+					UIO_MAXIOV, GFP_KERNEL);
 
 		if (!dev->vqs[i].indirect || !dev->vqs[i].log ||
-			!dev->vqs[i].heads)
+			!dev->vqs[i].heads ||
+			(zcopy && !dev->vqs[i].ubuf_info))
 			goto err_nomem;
 	}
 	return 0;
@@ -249,6 +311,8 @@ err_nomem:
 		kfree(dev->vqs[i].indirect);
 		kfree(dev->vqs[i].log);
 		kfree(dev->vqs[i].heads);
+		kfree(dev->vqs[i].ubuf_info);
+		dev->vqs[i].ubuf_info = NULL;
 	}
 	return -ENOMEM;
 }
@@ -264,9 +328,17 @@ static void vhost_dev_free_iovecs(struct vhost_dev *dev)
 		dev->vqs[i].log = NULL;
 		kfree(dev->vqs[i].heads);
 		dev->vqs[i].heads = NULL;
+		kfree(dev->vqs[i].ubuf_info);
+		dev->vqs[i].ubuf_info = NULL;
 	}
 }
 
+/* Let vq transmit zero-copy buffers, in the devices set up from now on. */
+void vhost_enable_zcopy(int vq)
+{
+	vhost_zcopy_mask |= 0x1 << vq;
+}
+
 long vhost_dev_init(struct vhost_dev *dev,
 		    struct vhost_virtqueue *vqs, int nvqs)
 {
@@ -279,20 +351,23 @@ long vhost_dev_init(struct vhost_dev *dev,
 	dev->log_file = NULL;
 	dev->memory = NULL;
 	dev->mm = NULL;
-	spin_lock_init(&dev->work_lock);
-	INIT_LIST_HEAD(&dev->work_list);
-	dev->worker = NULL;
+	vhost_worker_init(dev, &dev->worker);
+	dev->vq_workers = vq_workers;
 
 	for (i = 0; i < dev->nvqs; ++i) {
 		dev->vqs[i].log = NULL;
 		dev->vqs[i].indirect = NULL;
 		dev->vqs[i].heads = NULL;
+		dev->vqs[i].ubuf_info = NULL;
 		dev->vqs[i].dev = dev;
 		mutex_init(&dev->vqs[i].mutex);
+		vhost_worker_init(dev, &dev->vqs[i].worker);
 		vhost_vq_reset(dev, dev->vqs + i);
-		if (dev->vqs[i].handle_kick)
+		if (dev->vqs[i].handle_kick) {
 			vhost_poll_init(&dev->vqs[i].poll,
 					dev->vqs[i].handle_kick, POLLIN, dev);
+			vhost_poll_bind(&dev->vqs[i].poll, dev->vqs + i);
+		}
 	}
 
 	return 0;
@@ -319,22 +394,70 @@ static void vhost_attach_cgroups_work(struct vhost_work *work)
 	s->ret = cgroup_attach_task_all(s->owner, current);
 }
 
-static int vhost_attach_cgroups(struct vhost_dev *dev)
+static int vhost_attach_cgroups(struct vhost_worker *worker)
 {
 	struct vhost_attach_cgroups_struct attach;
 
 	attach.owner = current;
 	vhost_work_init(&attach.work, vhost_attach_cgroups_work);
-	vhost_work_queue(dev, &attach.work);
-	vhost_work_flush(dev, &attach.work);
+	vhost_work_queue(worker, &attach.work);
+	vhost_work_flush(worker, &attach.work);
 	return attach.ret;
 }
 
+static int vhost_worker_start(struct vhost_worker *worker, int index)
+{
+	struct task_struct *task;
+	int err;
+
+	if (index < 0)
+		task = kthread_create(vhost_worker, worker, "vhost-%d",
+				      current->pid);
+	else
+		task = kthread_create(vhost_worker, worker, "vhost-%d-%d",
+				      current->pid, index);
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	worker->task = task;
+	wake_up_process(task);	/* avoid contributing to loadavg */
+
+	err = vhost_attach_cgroups(worker);
+	if (err) {
+		kthread_stop(task);
+		worker->task = NULL;
+		return err;
+	}
+
+	/* Only after joining the cgroups of the owner, which may restrict the
+	 * CPUs the thread can run on. Not fatal: the CPU may have gone offline
+	 * since it was picked, and the thread then just floats. */
+	vhost_worker_set_cpu(worker);
+	return 0;
+}
+
+static void vhost_worker_stop(struct vhost_worker *worker)
+{
+	WARN_ON(!list_empty(&worker->work_list));
+	if (worker->task) {
+		kthread_stop(worker->task);
+		worker->task = NULL;
+	}
+}
+
+static void vhost_dev_stop_workers(struct vhost_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nvqs; ++i)
+		vhost_worker_stop(&dev->vqs[i].worker);
+	vhost_worker_stop(&dev->worker);
+}
+
 /* Caller should have device mutex */
 static long vhost_dev_set_owner(struct vhost_dev *dev)
 {
-	struct task_struct *worker;
-	int err;
+	int i, err;
 
 	/* Is there an owner already? */
 	if (dev->mm) {
@@ -344,28 +467,26 @@ static long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
-	if (IS_ERR(worker)) {
-		err = PTR_ERR(worker);
-		goto err_worker;
-	}
 
-	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
-
-	err = vhost_attach_cgroups(dev);
+	/* The device-wide worker is always there, for the work that isn't
+	 * bound to a vq. */
+	err = vhost_worker_start(&dev->worker, -1);
 	if (err)
-		goto err_cgroup;
+		goto err_worker;
+
+	for (i = 0; dev->vq_workers && i < dev->nvqs; ++i) {
+		err = vhost_worker_start(&dev->vqs[i].worker, i);
+		if (err)
+			goto err_worker;
+	}
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
-		goto err_cgroup;
+		goto err_worker;
 
 	return 0;
-err_cgroup:
-	kthread_stop(worker);
-	dev->worker = NULL;
 err_worker:
+	vhost_dev_stop_workers(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -396,6 +517,16 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 	int i;
 
 	for (i = 0; i < dev->nvqs; ++i) {
+		/* Wait for the lower device to be done with all the
+		 * zero-copy buffers, and signal the guest about them. Their
+		 * completions queue the kick work, so do that before the
+		 * final flush below. */
+		if (dev->vqs[i].ubufs) {
+			vhost_ubuf_put_and_wait(dev->vqs[i].ubufs);
+			dev->vqs[i].ubufs = NULL;
+		}
+		if (dev->vqs[i].ubuf_info)
+			vhost_zerocopy_signal_used(&dev->vqs[i]);
 		if (dev->vqs[i].kick && dev->vqs[i].handle_kick) {
 			vhost_poll_stop(&dev->vqs[i].poll);
 			vhost_poll_flush(&dev->vqs[i].poll);
@@ -423,11 +554,7 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 	kfree(rcu_dereference_protected(dev->memory,
 					lockdep_is_held(&dev->mutex)));
 	RCU_INIT_POINTER(dev->memory, NULL);
-	WARN_ON(!list_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	vhost_dev_stop_workers(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -765,6 +892,21 @@ static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 		} else
 			filep = eventfp;
 		break;
+	case VHOST_SET_VRING_CPU:
+		if (copy_from_user(&s, argp, sizeof s)) {
+			r = -EFAULT;
+			break;
+		}
+		if (s.num != ~0U && (s.num >= nr_cpu_ids ||
+				     !cpu_online(s.num))) {
+			r = -EINVAL;
+			break;
+		}
+		/* Without a worker per vq, this binds the worker of the whole
+		 * device. */
+		vhost_vq_worker(vq)->cpu = s.num == ~0U ? -1 : s.num;
+		r = vhost_worker_set_cpu(vhost_vq_worker(vq));
+		break;
 	default:
 		r = -ENOIOCTLCMD;
 	}
@@ -1421,6 +1563,24 @@ void vhost_add_used_and_signal_n(struct vhost_dev *dev,
 }
 
 /* OK, now we need to know about added descriptors. */
+/* Check whether the guest has made no buffers available since we last looked.
+ * Cheap enough to be used for busy polling, with notifications disabled. */
+bool vhost_vq_avail_empty(struct vhost_dev *dev, struct vhost_virtqueue *vq)
+{
+	u16 avail_idx;
+
+	if (__get_user(avail_idx, &vq->avail->idx))
+		return false;
+	return avail_idx == vq->avail_idx;
+}
+
+/* Check whether the worker of a vq has other work pending, which busy polling
+ * on that worker should make way for. */
+bool vhost_vq_has_work(struct vhost_virtqueue *vq)
+{
+	return !list_empty(&vhost_vq_worker(vq)->work_list);
+}
+
 bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	u16 avail_idx;
@@ -1486,3 +1646,79 @@ void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 			       &vq->used->flags, r);
 	}
 }
+
+/* Signal the guest about the zero-copy buffers the lower device is done with,
+ * in the order they were transmitted in. Returns how many there were.
+ * Caller must have VQ lock. */
+int vhost_zerocopy_signal_used(struct vhost_virtqueue *vq)
+{
+	int i;
+	int j = 0;
+
+	for (i = vq->done_idx; i != vq->upend_idx; i = (i + 1) % UIO_MAXIOV) {
+		if (vq->heads[i].len != VHOST_DMA_DONE_LEN)
+			break;
+		vq->heads[i].len = VHOST_DMA_IN_PROGRESS;
+		vhost_add_used_and_signal(vq->dev, vq, vq->heads[i].id, 0);
+		++j;
+	}
+	if (j)
+		vq->done_idx = i;
+	return j;
+}
+
+struct vhost_ubuf_ref *vhost_ubuf_alloc(struct vhost_virtqueue *vq,
+					bool zcopy)
+{
+	struct vhost_ubuf_ref *ubufs;
+
+	/* No zero copy backend? Nothing to count. */
+	if (!zcopy)
+		return NULL;
+	ubufs = kmalloc(sizeof *ubufs, GFP_KERNEL);
+	if (!ubufs)
+		return ERR_PTR(-ENOMEM);
+	kref_init(&ubufs->kref);
+	init_waitqueue_head(&ubufs->wait);
+	ubufs->vq = vq;
+	return ubufs;
+}
+
+static void vhost_zerocopy_done_signal(struct kref *kref)
+{
+	struct vhost_ubuf_ref *ubufs = container_of(kref, struct vhost_ubuf_ref,
+						    kref);
+	wake_up(&ubufs->wait);
+}
+
+void vhost_ubuf_put(struct vhost_ubuf_ref *ubufs)
+{
+	kref_put(&ubufs->kref, vhost_zerocopy_done_signal);
+}
+
+/* Drop the initial reference, and wait for all the buffers in flight. */
+void vhost_ubuf_put_and_wait(struct vhost_ubuf_ref *ubufs)
+{
+	kref_put(&ubufs->kref, vhost_zerocopy_done_signal);
+	wait_event(ubufs->wait, !atomic_read(&ubufs->kref.refcount));
+	/* The callback dropping the last reference may still be in its
+	 * wake_up(), see vhost_zerocopy_callback(). */
+	synchronize_rcu();
+	kfree(ubufs);
+}
+
+/* Called by the lower device once it's done with a zero-copy buffer, in any
+ * context but hard irq. */
+void vhost_zerocopy_callback(void *arg)
+{
+	struct ubuf_info *ubuf = arg;
+	struct vhost_ubuf_ref *ubufs = ubuf->arg;
+	struct vhost_virtqueue *vq = ubufs->vq;
+
+	rcu_read_lock();
+	vq->heads[ubuf->desc].len = VHOST_DMA_DONE_LEN;
+	/* Have the worker signal the guest. */
+	vhost_poll_queue(&vq->poll);
+	vhost_ubuf_put(ubufs);
+	rcu_read_unlock();
+}
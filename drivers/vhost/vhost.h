@@ -8,6 +8,7 @@
 #include <linux/poll.h>
 #include <linux/file.h>
 #include <linux/skbuff.h>
+#include <linux/kref.h>
 #include <linux/uio.h>
 #include <linux/virtio_config.h>
 #include <linux/virtio_ring.h>
@@ -27,6 +28,18 @@ struct vhost_work {
 	unsigned		  done_seq;
 };
 
+/* A kernel thread running the work items queued on it, in the context of
+ * the owner of the device. Every device has one, shared by all of its vqs,
+ * unless it runs a worker per vq (see vq_workers in vhost.c). */
+struct vhost_worker {
+	spinlock_t		  work_lock;
+	struct list_head	  work_list;
+	struct task_struct	 *task;
+	struct vhost_dev	 *dev;
+	/* CPU the thread is bound to, or -1 to let it float. */
+	int			  cpu;
+};
+
 /* Poll a file (eventfd or socket) */
 /* Note: there's nothing vhost specific about this structure. */
 struct vhost_poll {
@@ -36,10 +49,14 @@ struct vhost_poll {
 	struct vhost_work	  work;
 	unsigned long		  mask;
 	struct vhost_dev	 *dev;
+	struct vhost_worker	 *worker;
 };
 
+struct vhost_virtqueue;
+
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
 		     unsigned long mask, struct vhost_dev *dev);
+void vhost_poll_bind(struct vhost_poll *poll, struct vhost_virtqueue *vq);
 void vhost_poll_start(struct vhost_poll *poll, struct file *file);
 void vhost_poll_stop(struct vhost_poll *poll);
 void vhost_poll_flush(struct vhost_poll *poll);
@@ -50,6 +67,23 @@ struct vhost_log {
 	u64 len;
 };
 
+/* The len of the heads of zero-copy buffers in flight tells whether the
+ * lower device is done with them. */
+#define VHOST_DMA_DONE_LEN	1
+#define VHOST_DMA_IN_PROGRESS	0
+
+/* Reference of the zero-copy buffers in flight to a socket, on behalf of a
+ * vq. Held by each of them until the lower device is done with it. */
+struct vhost_ubuf_ref {
+	struct kref kref;
+	wait_queue_head_t wait;
+	struct vhost_virtqueue *vq;
+};
+
+struct vhost_ubuf_ref *vhost_ubuf_alloc(struct vhost_virtqueue *, bool zcopy);
+void vhost_ubuf_put(struct vhost_ubuf_ref *);
+void vhost_ubuf_put_and_wait(struct vhost_ubuf_ref *);
+
 /* The virtqueue structure describes a queue attached to a device. */
 struct vhost_virtqueue {
 	struct vhost_dev *dev;
@@ -69,6 +103,9 @@ struct vhost_virtqueue {
 
 	struct vhost_poll poll;
 
+	/* Runs the work of this vq, if the device has a worker per vq. */
+	struct vhost_worker worker;
+
 	/* The routine to call when the Guest pings us, or timeout. */
 	vhost_work_fn_t handle_kick;
 
@@ -114,6 +151,14 @@ struct vhost_virtqueue {
 	/* Log write descriptors */
 	void __user *log_base;
 	struct vhost_log *log;
+	/* The zero-copy buffers in flight are tracked in heads, from done_idx
+	 * (the first one the lower device may not be done with yet) up to
+	 * upend_idx (the next free entry). Each comes with the ubuf_info of the
+	 * same index, which refers to ubufs. */
+	int upend_idx;
+	int done_idx;
+	struct ubuf_info *ubuf_info;
+	struct vhost_ubuf_ref *ubufs;
 };
 
 struct vhost_dev {
@@ -128,9 +173,9 @@ struct vhost_dev {
 	int nvqs;
 	struct file *log_file;
 	struct eventfd_ctx *log_ctx;
-	spinlock_t work_lock;
-	struct list_head work_list;
-	struct task_struct *worker;
+	struct vhost_worker worker;
+	/* Run the work of each vq on a worker of its own. */
+	bool vq_workers;
 };
 
 long vhost_dev_init(struct vhost_dev *, struct vhost_virtqueue *vqs, int nvqs);
@@ -157,9 +202,14 @@ void vhost_add_used_and_signal_n(struct vhost_dev *, struct vhost_virtqueue *,
 void vhost_signal(struct vhost_dev *, struct vhost_virtqueue *);
 void vhost_disable_notify(struct vhost_dev *, struct vhost_virtqueue *);
 bool vhost_enable_notify(struct vhost_dev *, struct vhost_virtqueue *);
+bool vhost_vq_avail_empty(struct vhost_dev *, struct vhost_virtqueue *);
+bool vhost_vq_has_work(struct vhost_virtqueue *);
 
 int vhost_log_write(struct vhost_virtqueue *vq, struct vhost_log *log,
 		    unsigned int log_num, u64 len);
+void vhost_zerocopy_callback(void *arg);
+int vhost_zerocopy_signal_used(struct vhost_virtqueue *vq);
+void vhost_enable_zcopy(int vq);
 
 #define vq_err(vq, fmt, ...) do {                                  \
 		pr_debug(pr_fmt(fmt), ##__VA_ARGS__);       \
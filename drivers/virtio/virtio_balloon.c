@@ -25,6 +25,7 @@
 #include <linux/freezer.h>
 #include <linux/delay.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 struct virtio_balloon
 {
@@ -48,11 +49,56 @@ struct virtio_balloon
 	unsigned int num_pfns;
 	u32 pfns[256];
 
+	/* Or, with VIRTIO_BALLOON_F_PAGE_CHUNKS, the array of page ranges. */
+	bool use_chunks;
+	unsigned int num_chunks;
+	struct virtio_balloon_chunk chunks[256];
+
 	/* Memory statistics */
 	int need_stats_update;
 	struct virtio_balloon_stat stats[VIRTIO_BALLOON_S_NR];
+
+	/* Free page hinting (VIRTIO_BALLOON_F_FREE_PAGE_HINT) */
+	struct virtqueue *free_page_vq;
+	struct work_struct report_free_page_work;
+	struct work_struct free_page_done_work;
+
+	/* Where we wait for the host to make room on the free_page_vq. */
+	wait_queue_head_t free_page_wq;
+
+	/* The command id we last answered, and the ids we send out. */
+	u32 cmd_id_active;
+	u32 cmd_id_start;
+	u32 cmd_id_stop;
+
+	/* The blocks we reported, held until the host is done with them. */
+	spinlock_t free_page_list_lock;
+	struct list_head free_page_list;
+	unsigned long num_free_page_blocks;
+
+	/* Gives the reported blocks back early if memory gets tight. */
+	struct shrinker shrinker;
 };
 
+/*
+ * With page chunks, the balloon is inflated with blocks of up to 2MB where
+ * the allocator has them; the order of each block on vb->pages is kept in
+ * its page_private().
+ */
+#define BALLOON_CHUNK_ORDER	min_t(unsigned int, MAX_ORDER - 1, \
+				      21 - PAGE_SHIFT)
+
+/* Balloon pages per Linux page */
+#define BALLOON_PAGES_PER_PAGE	(1 << (PAGE_SHIFT - VIRTIO_BALLOON_PFN_SHIFT))
+
+/*
+ * Free memory is reported in blocks of the largest order the allocator has.
+ * They're only taken if they're free right now: no reclaim, no reserves.
+ */
+#define FREE_PAGE_HINT_ORDER	(MAX_ORDER - 1)
+#define FREE_PAGE_HINT_GFP	(__GFP_HIGHMEM | __GFP_NORETRY | \
+				 __GFP_NOWARN | __GFP_NOMEMALLOC)
+
 static struct virtio_device_id id_table[] = {
 	{ VIRTIO_ID_BALLOON, VIRTIO_DEV_ANY_ID },
 	{ 0 },
@@ -81,7 +127,11 @@ static void tell_host(struct virtio_balloon *vb, struct virtqueue *vq)
 {
 	struct scatterlist sg;
 
-	sg_init_one(&sg, vb->pfns, sizeof(vb->pfns[0]) * vb->num_pfns);
+	if (vb->use_chunks)
+		sg_init_one(&sg, vb->chunks,
+			    sizeof(vb->chunks[0]) * vb->num_chunks);
+	else
+		sg_init_one(&sg, vb->pfns, sizeof(vb->pfns[0]) * vb->num_pfns);
 
 	init_completion(&vb->acked);
 
@@ -94,8 +144,76 @@ static void tell_host(struct virtio_balloon *vb, struct virtqueue *vq)
 	wait_for_completion(&vb->acked);
 }
 
+/* Add a range to the chunks array, merging it with the last one if we can. */
+static void add_chunk(struct virtio_balloon *vb, struct page *page,
+		      unsigned int order)
+{
+	struct virtio_balloon_chunk *last;
+	u64 base = page_to_balloon_pfn(page);
+	u64 size = (1ULL << order) * BALLOON_PAGES_PER_PAGE;
+
+	if (vb->num_chunks) {
+		last = &vb->chunks[vb->num_chunks - 1];
+		if (last->base + last->size == base) {
+			last->size += size;
+			return;
+		}
+	}
+
+	vb->chunks[vb->num_chunks].base = base;
+	vb->chunks[vb->num_chunks].size = size;
+	vb->num_chunks++;
+}
+
+static void fill_balloon_chunks(struct virtio_balloon *vb, size_t num)
+{
+	unsigned int order = BALLOON_CHUNK_ORDER;
+	struct page *page;
+
+	vb->num_chunks = 0;
+	while (num && vb->num_chunks < ARRAY_SIZE(vb->chunks)) {
+		while ((1UL << order) > num)
+			order--;
+
+		page = alloc_pages(GFP_HIGHUSER | __GFP_NORETRY |
+				   __GFP_NOMEMALLOC | __GFP_NOWARN, order);
+		if (!page) {
+			/* Fragmented: go on with smaller blocks. */
+			if (order) {
+				order--;
+				continue;
+			}
+			if (printk_ratelimit())
+				dev_printk(KERN_INFO, &vb->vdev->dev,
+					   "Out of puff! Can't get %zu pages\n",
+					   num);
+			/* Sleep for at least 1/5 of a second before retry. */
+			msleep(200);
+			break;
+		}
+
+		set_page_private(page, order);
+		list_add(&page->lru, &vb->pages);
+		totalram_pages -= 1 << order;
+		vb->num_pages += 1 << order;
+		num -= 1 << order;
+		add_chunk(vb, page, order);
+	}
+
+	/* Didn't get any?  Oh well. */
+	if (vb->num_chunks == 0)
+		return;
+
+	tell_host(vb, vb->inflate_vq);
+}
+
 static void fill_balloon(struct virtio_balloon *vb, size_t num)
 {
+	if (vb->use_chunks) {
+		fill_balloon_chunks(vb, num);
+		return;
+	}
+
 	/* We can only do one array worth at a time. */
 	num = min(num, ARRAY_SIZE(vb->pfns));
 
@@ -134,10 +252,60 @@ static void release_pages_by_pfn(const u32 pfns[], unsigned int num)
 	}
 }
 
+static void leak_balloon_chunks(struct virtio_balloon *vb, size_t num)
+{
+	struct page *page, *next;
+	unsigned int order;
+	LIST_HEAD(pages);
+	int i;
+
+	vb->num_chunks = 0;
+	while (num && vb->num_chunks < ARRAY_SIZE(vb->chunks)) {
+		page = list_first_entry(&vb->pages, struct page, lru);
+		order = page_private(page);
+
+		/* Only part of this block is wanted back: break it up. */
+		if ((1UL << order) > num) {
+			list_del(&page->lru);
+			split_page(page, order);
+			for (i = (1 << order) - 1; i >= 0; i--) {
+				set_page_private(page + i, 0);
+				list_add(&page[i].lru, &vb->pages);
+			}
+			continue;
+		}
+
+		list_move(&page->lru, &pages);
+		vb->num_pages -= 1 << order;
+		num -= 1 << order;
+		add_chunk(vb, page, order);
+	}
+
+	/*
+	 * Note that if
+	 * virtio_has_feature(vdev, VIRTIO_BALLOON_F_MUST_TELL_HOST);
+	 * is true, we *have* to do it in this order
+	 */
+	tell_host(vb, vb->deflate_vq);
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		order = page_private(page);
+		list_del(&page->lru);
+		set_page_private(page, 0);
+		__free_pages(page, order);
+		totalram_pages += 1 << order;
+	}
+}
+
 static void leak_balloon(struct virtio_balloon *vb, size_t num)
 {
 	struct page *page;
 
+	if (vb->use_chunks) {
+		leak_balloon_chunks(vb, num);
+		return;
+	}
+
 	/* We can only do one array worth at a time. */
 	num = min(num, ARRAY_SIZE(vb->pfns));
 
@@ -224,11 +392,159 @@ static void stats_handle_request(struct virtio_balloon *vb)
 	virtqueue_kick(vq);
 }
 
+static u32 free_page_cmd_id(struct virtio_balloon *vb)
+{
+	u32 v;
+
+	vb->vdev->config->get(vb->vdev,
+			      offsetof(struct virtio_balloon_config,
+				       free_page_hint_cmd_id),
+			      &v, sizeof(v));
+	return v;
+}
+
+static void free_page_vq_done(struct virtqueue *vq)
+{
+	struct virtio_balloon *vb = vq->vdev->priv;
+
+	wake_up(&vb->free_page_wq);
+}
+
+/* Detach the buffers the host has seen; the blocks stay on our list. */
+static unsigned int detach_free_page_bufs(struct virtio_balloon *vb)
+{
+	unsigned int len, n = 0;
+
+	while (virtqueue_get_buf(vb->free_page_vq, &len))
+		n++;
+	return n;
+}
+
+/*
+ * Queue up a buffer on the free_page_vq, waiting for the host to make room
+ * if needed. We give up if it doesn't for a whole second.
+ */
+static int send_free_page_buf(struct virtio_balloon *vb,
+			      struct scatterlist *sg, bool out, void *data)
+{
+	struct virtqueue *vq = vb->free_page_vq;
+	int err;
+
+	detach_free_page_bufs(vb);
+	while ((err = virtqueue_add_buf(vq, sg, out, !out, data)) == -ENOSPC) {
+		virtqueue_kick(vq);
+		if (!wait_event_timeout(vb->free_page_wq,
+					detach_free_page_bufs(vb), HZ))
+			return -EBUSY;
+	}
+	if (err < 0)
+		return err;
+
+	virtqueue_kick(vq);
+	return 0;
+}
+
+static void report_free_page_func(struct work_struct *work)
+{
+	struct virtio_balloon *vb = container_of(work, struct virtio_balloon,
+						 report_free_page_work);
+	struct scatterlist sg;
+	struct page *page;
+	u32 cmd_id;
+
+	cmd_id = free_page_cmd_id(vb);
+	if (cmd_id == VIRTIO_BALLOON_CMD_ID_STOP ||
+	    cmd_id == VIRTIO_BALLOON_CMD_ID_DONE ||
+	    cmd_id == vb->cmd_id_active)
+		return;
+	vb->cmd_id_active = cmd_id;
+
+	/* Tell the host which of its commands the blocks to come answer. */
+	vb->cmd_id_start = cmd_id;
+	sg_init_one(&sg, &vb->cmd_id_start, sizeof(vb->cmd_id_start));
+	if (send_free_page_buf(vb, &sg, true, &vb->cmd_id_start))
+		return;
+
+	/* Then report blocks until there are none, or the host had enough. */
+	while (free_page_cmd_id(vb) == cmd_id) {
+		page = alloc_pages(FREE_PAGE_HINT_GFP, FREE_PAGE_HINT_ORDER);
+		if (!page)
+			break;
+
+		spin_lock_irq(&vb->free_page_list_lock);
+		list_add(&page->lru, &vb->free_page_list);
+		vb->num_free_page_blocks++;
+		spin_unlock_irq(&vb->free_page_list_lock);
+
+		sg_init_table(&sg, 1);
+		sg_set_page(&sg, page, PAGE_SIZE << FREE_PAGE_HINT_ORDER, 0);
+		if (send_free_page_buf(vb, &sg, false, page))
+			break;
+	}
+
+	vb->cmd_id_stop = VIRTIO_BALLOON_CMD_ID_STOP;
+	sg_init_one(&sg, &vb->cmd_id_stop, sizeof(vb->cmd_id_stop));
+	send_free_page_buf(vb, &sg, true, &vb->cmd_id_stop);
+}
+
+static unsigned long return_free_pages_to_mm(struct virtio_balloon *vb,
+					     unsigned long num_to_return)
+{
+	unsigned long num_returned;
+	struct page *page;
+
+	spin_lock_irq(&vb->free_page_list_lock);
+	for (num_returned = 0; num_returned < num_to_return; num_returned++) {
+		if (list_empty(&vb->free_page_list))
+			break;
+		page = list_first_entry(&vb->free_page_list, struct page, lru);
+		list_del(&page->lru);
+		__free_pages(page, FREE_PAGE_HINT_ORDER);
+	}
+	vb->num_free_page_blocks -= num_returned;
+	spin_unlock_irq(&vb->free_page_list_lock);
+
+	return num_returned;
+}
+
+static void free_page_done_func(struct work_struct *work)
+{
+	struct virtio_balloon *vb = container_of(work, struct virtio_balloon,
+						 free_page_done_work);
+
+	return_free_pages_to_mm(vb, ULONG_MAX);
+}
+
+static int virtballoon_shrinker(struct shrinker *shrinker,
+				struct shrink_control *sc)
+{
+	struct virtio_balloon *vb = container_of(shrinker,
+					struct virtio_balloon, shrinker);
+
+	if (sc->nr_to_scan)
+		return_free_pages_to_mm(vb, DIV_ROUND_UP(sc->nr_to_scan,
+						1 << FREE_PAGE_HINT_ORDER));
+
+	return vb->num_free_page_blocks << FREE_PAGE_HINT_ORDER;
+}
+
 static void virtballoon_changed(struct virtio_device *vdev)
 {
 	struct virtio_balloon *vb = vdev->priv;
 
 	wake_up(&vb->config_change);
+
+	if (virtio_has_feature(vdev, VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+		u32 cmd_id = free_page_cmd_id(vb);
+
+		if (cmd_id == VIRTIO_BALLOON_CMD_ID_DONE)
+			queue_work(system_freezable_wq,
+				   &vb->free_page_done_work);
+		else if (cmd_id != VIRTIO_BALLOON_CMD_ID_STOP &&
+			 cmd_id != vb->cmd_id_active)
+			queue_work(system_freezable_wq,
+				   &vb->report_free_page_work);
+	}
 }
 
 static inline s64 towards_target(struct virtio_balloon *vb)
@@ -277,10 +593,10 @@ static int balloon(void *_vballoon)
 static int virtballoon_probe(struct virtio_device *vdev)
 {
 	struct virtio_balloon *vb;
-	struct virtqueue *vqs[3];
-	vq_callback_t *callbacks[] = { balloon_ack, balloon_ack, stats_request };
-	const char *names[] = { "inflate", "deflate", "stats" };
-	int err, nvqs;
+	struct virtqueue *vqs[4];
+	vq_callback_t *callbacks[4] = { balloon_ack, balloon_ack };
+	const char *names[4] = { "inflate", "deflate" };
+	int err, nvqs, stats_vq = 0, free_page_vq = 0;
 
 	vdev->priv = vb = kmalloc(sizeof(*vb), GFP_KERNEL);
 	if (!vb) {
@@ -293,10 +609,30 @@ static int virtballoon_probe(struct virtio_device *vdev)
 	init_waitqueue_head(&vb->config_change);
 	vb->vdev = vdev;
 	vb->need_stats_update = 0;
+	vb->use_chunks = virtio_has_feature(vdev, VIRTIO_BALLOON_F_PAGE_CHUNKS);
+
+	INIT_WORK(&vb->report_free_page_work, report_free_page_func);
+	INIT_WORK(&vb->free_page_done_work, free_page_done_func);
+	init_waitqueue_head(&vb->free_page_wq);
+	spin_lock_init(&vb->free_page_list_lock);
+	INIT_LIST_HEAD(&vb->free_page_list);
+	vb->num_free_page_blocks = 0;
+	vb->free_page_vq = NULL;
+	vb->cmd_id_active = VIRTIO_BALLOON_CMD_ID_STOP;
 
 	/* We expect two virtqueues: inflate and deflate,
-	 * and optionally stat. */
-	nvqs = virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ) ? 3 : 2;
+	 * and optionally stat and free page. */
+	nvqs = 2;
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ)) {
+		callbacks[nvqs] = stats_request;
+		names[nvqs] = "stats";
+		stats_vq = nvqs++;
+	}
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+		callbacks[nvqs] = free_page_vq_done;
+		names[nvqs] = "free_page_vq";
+		free_page_vq = nvqs++;
+	}
 	err = vdev->config->find_vqs(vdev, nvqs, vqs, callbacks, names);
 	if (err)
 		goto out_free_vb;
@@ -305,7 +641,7 @@ static int virtballoon_probe(struct virtio_device *vdev)
 	vb->deflate_vq = vqs[1];
 	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ)) {
 		struct scatterlist sg;
-		vb->stats_vq = vqs[2];
+		vb->stats_vq = vqs[stats_vq];
 
 		/*
 		 * Prime this virtqueue with one buffer so the hypervisor can
@@ -317,6 +653,13 @@ static int virtballoon_probe(struct virtio_device *vdev)
 		virtqueue_kick(vb->stats_vq);
 	}
 
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+		vb->free_page_vq = vqs[free_page_vq];
+		vb->shrinker.shrink = virtballoon_shrinker;
+		vb->shrinker.seeks = DEFAULT_SEEKS;
+		register_shrinker(&vb->shrinker);
+	}
+
 	vb->thread = kthread_run(balloon, vb, "vballoon");
 	if (IS_ERR(vb->thread)) {
 		err = PTR_ERR(vb->thread);
@@ -326,6 +669,8 @@ static int virtballoon_probe(struct virtio_device *vdev)
 	return 0;
 
 out_del_vqs:
+	if (vb->free_page_vq)
+		unregister_shrinker(&vb->shrinker);
 	vdev->config->del_vqs(vdev);
 out_free_vb:
 	kfree(vb);
@@ -346,6 +691,14 @@ static void __devexit virtballoon_remove(struct virtio_device *vdev)
 	/* Now we reset the device so we can clean up the queues. */
 	vdev->config->reset(vdev);
 
+	/* Give back whatever free page hinting held on to. */
+	if (vb->free_page_vq) {
+		cancel_work_sync(&vb->report_free_page_work);
+		cancel_work_sync(&vb->free_page_done_work);
+		unregister_shrinker(&vb->shrinker);
+		return_free_pages_to_mm(vb, ULONG_MAX);
+	}
+
 	vdev->config->del_vqs(vdev);
 	kfree(vb);
 }
@@ -353,6 +706,8 @@ static void __devexit virtballoon_remove(struct virtio_device *vdev)
 static unsigned int features[] = {
 	VIRTIO_BALLOON_F_MUST_TELL_HOST,
 	VIRTIO_BALLOON_F_STATS_VQ,
+	VIRTIO_BALLOON_F_PAGE_CHUNKS,
+	VIRTIO_BALLOON_F_FREE_PAGE_HINT,
 };
 
 static struct virtio_driver virtio_balloon_driver = {
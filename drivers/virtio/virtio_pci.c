@@ -51,17 +51,18 @@ struct virtio_pci_device
 	/* Name strings for interrupts. This size should be enough,
 	 * and I'm too lazy to allocate each name separately. */
 	char (*msix_names)[256];
+	/* The cpus each vector was hinted to, see vp_set_vq_affinity() */
+	cpumask_var_t *msix_affinity_masks;
 	/* Number of available vectors */
 	unsigned msix_vectors;
 	/* Vectors allocated, excluding per-vq vectors if any */
 	unsigned msix_used_vectors;
-	/* Whether we have vector per vq */
-	bool per_vq_vectors;
 };
 
 /* Constants for MSI-X */
 /* Use first vector for configuration changes, second and the rest for
- * virtqueues Thus, we need at least 2 vectors for MSI. */
+ * virtqueues Thus, we need at least 2 vectors for MSI.  If there are fewer
+ * vectors than queues, the second one is shared by the queues left over. */
 enum {
 	VP_MSIX_CONFIG_VECTOR = 0,
 	VP_MSIX_VQ_VECTOR = 1,
@@ -200,7 +201,15 @@ static irqreturn_t vp_config_changed(int irq, void *opaque)
 	return IRQ_HANDLED;
 }
 
-/* Notify all virtqueues on an interrupt. */
+/* Does this virtqueue have an MSI-X vector all to itself? */
+static bool vp_vq_has_own_vector(struct virtio_pci_device *vp_dev,
+				 struct virtio_pci_vq_info *info)
+{
+	return info->msix_vector != VIRTIO_MSI_NO_VECTOR &&
+	       info->msix_vector >= vp_dev->msix_used_vectors;
+}
+
+/* Notify all virtqueues (but those with their own vector) on an interrupt. */
 static irqreturn_t vp_vring_interrupt(int irq, void *opaque)
 {
 	struct virtio_pci_device *vp_dev = opaque;
@@ -210,6 +219,8 @@ static irqreturn_t vp_vring_interrupt(int irq, void *opaque)
 
 	spin_lock_irqsave(&vp_dev->lock, flags);
 	list_for_each_entry(info, &vp_dev->virtqueues, node) {
+		if (vp_vq_has_own_vector(vp_dev, info))
+			continue;
 		if (vring_interrupt(irq, info->vq) == IRQ_HANDLED)
 			ret = IRQ_HANDLED;
 	}
@@ -254,8 +265,17 @@ static void vp_free_vectors(struct virtio_device *vdev)
 		vp_dev->intx_enabled = 0;
 	}
 
-	for (i = 0; i < vp_dev->msix_used_vectors; ++i)
+	for (i = 0; i < vp_dev->msix_used_vectors; ++i) {
+		irq_set_affinity_hint(vp_dev->msix_entries[i].vector, NULL);
 		free_irq(vp_dev->msix_entries[i].vector, vp_dev);
+	}
+
+	if (vp_dev->msix_affinity_masks) {
+		for (i = 0; i < vp_dev->msix_vectors; ++i)
+			free_cpumask_var(vp_dev->msix_affinity_masks[i]);
+		kfree(vp_dev->msix_affinity_masks);
+		vp_dev->msix_affinity_masks = NULL;
+	}
 
 	if (vp_dev->msix_enabled) {
 		/* Disable the vector used for configuration */
@@ -277,7 +297,7 @@ static void vp_free_vectors(struct virtio_device *vdev)
 }
 
 static int vp_request_msix_vectors(struct virtio_device *vdev, int nvectors,
-				   bool per_vq_vectors)
+				   bool shared_vq_vector)
 {
 	struct virtio_pci_device *vp_dev = to_vp_device(vdev);
 	const char *name = dev_name(&vp_dev->vdev.dev);
@@ -305,6 +325,17 @@ static int vp_request_msix_vectors(struct virtio_device *vdev, int nvectors,
 	vp_dev->msix_vectors = nvectors;
 	vp_dev->msix_enabled = 1;
 
+	err = -ENOMEM;
+	vp_dev->msix_affinity_masks = kcalloc(nvectors,
+					sizeof *vp_dev->msix_affinity_masks,
+					GFP_KERNEL);
+	if (!vp_dev->msix_affinity_masks)
+		goto error;
+	for (i = 0; i < nvectors; ++i)
+		if (!zalloc_cpumask_var(&vp_dev->msix_affinity_masks[i],
+					GFP_KERNEL))
+			goto error;
+
 	/* Set the vector used for configuration */
 	v = vp_dev->msix_used_vectors;
 	snprintf(vp_dev->msix_names[v], sizeof *vp_dev->msix_names,
@@ -324,8 +355,8 @@ static int vp_request_msix_vectors(struct virtio_device *vdev, int nvectors,
 		goto error;
 	}
 
-	if (!per_vq_vectors) {
-		/* Shared vector for all VQs */
+	if (shared_vq_vector) {
+		/* Shared vector for all VQs without one of their own */
 		v = vp_dev->msix_used_vectors;
 		snprintf(vp_dev->msix_names[v], sizeof *vp_dev->msix_names,
 			 "%s-virtqueues", name);
@@ -469,13 +500,14 @@ static void vp_del_vqs(struct virtio_device *vdev)
 
 	list_for_each_entry_safe(vq, n, &vdev->vqs, list) {
 		info = vq->priv;
-		if (vp_dev->per_vq_vectors &&
-			info->msix_vector != VIRTIO_MSI_NO_VECTOR)
-			free_irq(vp_dev->msix_entries[info->msix_vector].vector,
-				 vq);
+		if (vp_vq_has_own_vector(vp_dev, info)) {
+			unsigned irq = vp_dev->msix_entries[info->msix_vector].vector;
+
+			irq_set_affinity_hint(irq, NULL);
+			free_irq(irq, vq);
+		}
 		vp_del_vq(vq);
 	}
-	vp_dev->per_vq_vectors = false;
 
 	vp_free_vectors(vdev);
 }
@@ -485,11 +517,18 @@ static int vp_try_to_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 			      vq_callback_t *callbacks[],
 			      const char *names[],
 			      bool use_msix,
-			      bool per_vq_vectors)
+			      unsigned per_vq_vectors)
 {
 	struct virtio_pci_device *vp_dev = to_vp_device(vdev);
 	u16 msix_vec;
 	int i, err, nvectors, allocated_vectors;
+	unsigned ncallbacks = 0;
+	bool shared;
+
+	for (i = 0; i < nvqs; ++i)
+		if (callbacks[i])
+			++ncallbacks;
+	per_vq_vectors = min(per_vq_vectors, ncallbacks);
 
 	if (!use_msix) {
 		/* Old style: one normal interrupt for change and all vqs. */
@@ -497,28 +536,21 @@ static int vp_try_to_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 		if (err)
 			goto error_request;
 	} else {
-		if (per_vq_vectors) {
-			/* Best option: one for change interrupt, one per vq. */
-			nvectors = 1;
-			for (i = 0; i < nvqs; ++i)
-				if (callbacks[i])
-					++nvectors;
-		} else {
-			/* Second best: one for change, shared for all vqs. */
-			nvectors = 2;
-		}
+		/* One for change interrupt, one for each of the first
+		 * per_vq_vectors vqs, and one shared by the rest, if any. */
+		shared = per_vq_vectors < ncallbacks;
+		nvectors = 1 + per_vq_vectors + shared;
 
-		err = vp_request_msix_vectors(vdev, nvectors, per_vq_vectors);
+		err = vp_request_msix_vectors(vdev, nvectors, shared);
 		if (err)
 			goto error_request;
 	}
 
-	vp_dev->per_vq_vectors = per_vq_vectors;
 	allocated_vectors = vp_dev->msix_used_vectors;
 	for (i = 0; i < nvqs; ++i) {
 		if (!callbacks[i] || !vp_dev->msix_enabled)
 			msix_vec = VIRTIO_MSI_NO_VECTOR;
-		else if (vp_dev->per_vq_vectors)
+		else if (allocated_vectors < vp_dev->msix_vectors)
 			msix_vec = allocated_vectors++;
 		else
 			msix_vec = VP_MSIX_VQ_VECTOR;
@@ -528,7 +560,7 @@ static int vp_try_to_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 			goto error_find;
 		}
 
-		if (!vp_dev->per_vq_vectors || msix_vec == VIRTIO_MSI_NO_VECTOR)
+		if (!vp_vq_has_own_vector(vp_dev, vqs[i]->priv))
 			continue;
 
 		/* allocate per-vq irq if available and necessary */
@@ -560,20 +592,57 @@ static int vp_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 		       vq_callback_t *callbacks[],
 		       const char *names[])
 {
-	int err;
+	struct virtio_pci_device *vp_dev = to_vp_device(vdev);
+	int err, nvectors;
 
 	/* Try MSI-X with one vector per queue. */
-	err = vp_try_to_find_vqs(vdev, nvqs, vqs, callbacks, names, true, true);
+	err = vp_try_to_find_vqs(vdev, nvqs, vqs, callbacks, names, true, nvqs);
 	if (!err)
 		return 0;
+	/* Then give as many queues as the device has vectors for their own
+	 * (keeping one for config, and one for the others to share). */
+	nvectors = pci_msix_table_size(vp_dev->pci_dev);
+	if (nvectors > 2 && nvectors - 2 < nvqs) {
+		err = vp_try_to_find_vqs(vdev, nvqs, vqs, callbacks, names,
+					 true, nvectors - 2);
+		if (!err)
+			return 0;
+	}
 	/* Fallback: MSI-X with one vector for config, one shared for queues. */
 	err = vp_try_to_find_vqs(vdev, nvqs, vqs, callbacks, names,
-				 true, false);
+				 true, 0);
 	if (!err)
 		return 0;
 	/* Finally fall back to regular interrupts. */
 	return vp_try_to_find_vqs(vdev, nvqs, vqs, callbacks, names,
-				  false, false);
+				  false, 0);
+}
+
+/* the config->set_vq_affinity() implementation */
+static int vp_set_vq_affinity(struct virtqueue *vq, int cpu)
+{
+	struct virtio_pci_device *vp_dev = to_vp_device(vq->vdev);
+	struct virtio_pci_vq_info *info = vq->priv;
+	struct cpumask *mask;
+	unsigned irq;
+
+	if (!vq->callback)
+		return -EINVAL;
+
+	/* Nothing to steer with a single INTx line. */
+	if (!vp_dev->msix_enabled || info->msix_vector == VIRTIO_MSI_NO_VECTOR)
+		return 0;
+
+	mask = vp_dev->msix_affinity_masks[info->msix_vector];
+	irq = vp_dev->msix_entries[info->msix_vector].vector;
+	if (cpu == -1) {
+		cpumask_clear(mask);
+		irq_set_affinity_hint(irq, NULL);
+	} else {
+		cpumask_set_cpu(cpu, mask);
+		irq_set_affinity_hint(irq, mask);
+	}
+	return 0;
 }
 
 static struct virtio_config_ops virtio_pci_config_ops = {
@@ -586,6 +655,7 @@ static struct virtio_config_ops virtio_pci_config_ops = {
 	.del_vqs	= vp_del_vqs,
 	.get_features	= vp_get_features,
 	.finalize_features = vp_finalize_features,
+	.set_vq_affinity = vp_set_vq_affinity,
 };
 
 static void virtio_pci_release_dev(struct device *_d)
@@ -21,6 +21,7 @@
 #include <linux/virtio_config.h>
 #include <linux/device.h>
 #include <linux/slab.h>
+#include <linux/debugfs.h>
 
 /* virtio guest is communicating with a virtual "device" that actually runs on
  * a host processor.  Memory barriers are used to control SMP effects. */
@@ -69,6 +70,46 @@
 #define END_USE(vq)
 #endif
 
+/* Per-buffer state of a packed (or in-order) ring, kept out of the ring */
+struct vring_desc_state
+{
+	/* Number of descriptors the buffer takes. */
+	u16 num;
+	/* Next free buffer id (or, while adding a batch, the next one of it). */
+	u16 next;
+	/* Flags of the head, until it's exposed. */
+	u16 head_flags;
+	/* Indirect table of the buffer, if it has one, and its length. */
+	struct vring_desc *indir_desc;
+	u16 indir_num;
+};
+
+/* Indirect tables of up to this many descriptors (e.g. a GSO skb, or a
+ * typical block request) are all allocated at this size, and a few of
+ * them are kept around by every virtqueue, to be reused. */
+#define VRING_INDIRECT_CACHE_DESCS	32
+#define VRING_INDIRECT_CACHE_MAX	64
+
+/* How the ring behaves, exposed in debugfs to tune queue sizes and
+ * notification suppression with. Only approximate: they're updated without
+ * any atomicity (the interrupt ones while the driver may use the vq). */
+struct vring_stats
+{
+	/* Buffers added, and how many of them used an indirect table. */
+	unsigned long added;
+	unsigned long indirect;
+	/* Adds that filled the ring up, and ones that failed since it was. */
+	unsigned long full;
+	unsigned long no_space;
+	/* Kicks the other side wanted, and ones it suppressed. */
+	unsigned long kicks;
+	unsigned long kicks_suppressed;
+	/* Interrupts with work, interrupts without, and buffers used. */
+	unsigned long interrupts;
+	unsigned long spurious;
+	unsigned long used;
+};
+
 struct vring_virtqueue
 {
 	struct virtqueue vq;
@@ -82,9 +123,23 @@ struct vring_virtqueue
 	/* Host supports indirect buffers */
 	bool indirect;
 
+	/* Free indirect tables, chained via their first bytes. */
+	struct vring_desc *indir_cache;
+	unsigned int indir_cached;
+
 	/* Host publishes avail event idx */
 	bool event;
 
+	/* The ring uses the packed layout: vring_packed rather than vring */
+	bool packed;
+
+	/* Host uses the buffers in order, so the split ring needn't read the
+	 * ids of used entries, nor walk the chains to free them: the oldest
+	 * buffer is always the one used, and descriptors are handed out in
+	 * ring order, their state being in desc_state. */
+	bool in_order;
+	struct vring_packed vring_packed;
+
 	/* Number of free buffers */
 	unsigned int num_free;
 	/* Head of free buffer list. */
@@ -95,9 +150,24 @@ struct vring_virtqueue
 	/* Last used index we've seen. */
 	u16 last_used_idx;
 
+	/* Packed ring only: where the next buffer goes, the wrap counters of
+	 * both sides, the AVAIL/USED flags of the current wrap, our last
+	 * event suppression flags (so the ring needn't be read back) and the
+	 * state of every buffer id. Free ids are chained via desc_state. */
+	u16 next_avail_idx;
+	bool avail_wrap_counter;
+	bool used_wrap_counter;
+	u16 avail_used_flags;
+	u16 driver_flags;
+	struct vring_desc_state *desc_state;
+
 	/* How to notify other side. FIXME: commonalize hcalls! */
 	void (*notify)(struct virtqueue *vq);
 
+	/* Counters, and their debugfs file. */
+	struct vring_stats stats;
+	struct dentry *dbg;
+
 #ifdef DEBUG
 	/* They're supposed to lock for us. */
 	unsigned int in_use;
@@ -109,6 +179,72 @@ struct vring_virtqueue
 
 #define to_vvq(_vq) container_of(_vq, struct vring_virtqueue, vq)
 
+/* debugfs parent dir */
+static struct dentry *vring_dbg;
+
+/* Count an add that worked, and whether it filled the ring up. */
+static inline void count_add(struct vring_virtqueue *vq, bool indirect)
+{
+	vq->stats.added++;
+	if (indirect)
+		vq->stats.indirect++;
+	if (!vq->num_free)
+		vq->stats.full++;
+}
+
+static inline bool count_kick(struct vring_virtqueue *vq, bool needs_kick)
+{
+	if (needs_kick)
+		vq->stats.kicks++;
+	else
+		vq->stats.kicks_suppressed++;
+
+	return needs_kick;
+}
+
+/* The free descriptor after @i (in order, we needn't read the ring for it). */
+static inline unsigned int next_desc(const struct vring_virtqueue *vq,
+				     unsigned int i)
+{
+	if (vq->in_order)
+		return (i + 1) & (vq->vring.num - 1);
+
+	return vq->vring.desc[i].next;
+}
+
+/* Get an indirect table for @total descriptors, from the cache if we can. */
+static struct vring_desc *alloc_indirect(struct vring_virtqueue *vq,
+					 unsigned int total, gfp_t gfp)
+{
+	struct vring_desc *desc = vq->indir_cache;
+
+	if (total > VRING_INDIRECT_CACHE_DESCS)
+		return kmalloc(total * sizeof(struct vring_desc), gfp);
+
+	if (desc) {
+		vq->indir_cache = *(struct vring_desc **)desc;
+		vq->indir_cached--;
+		return desc;
+	}
+
+	return kmalloc(VRING_INDIRECT_CACHE_DESCS * sizeof(struct vring_desc),
+									gfp);
+}
+
+static void free_indirect(struct vring_virtqueue *vq, struct vring_desc *desc,
+			  unsigned int total)
+{
+	if (total > VRING_INDIRECT_CACHE_DESCS ||
+	    vq->indir_cached == VRING_INDIRECT_CACHE_MAX) {
+		kfree(desc);
+		return;
+	}
+
+	*(struct vring_desc **)desc = vq->indir_cache;
+	vq->indir_cache = desc;
+	vq->indir_cached++;
+}
+
 /* Set up an indirect table of descriptors and add it to the queue. */
 static int vring_add_indirect(struct vring_virtqueue *vq,
 			      struct scatterlist sg[],
@@ -120,7 +256,7 @@ static int vring_add_indirect(struct vring_virtqueue *vq,
 	unsigned head;
 	int i;
 
-	desc = kmalloc((out + in) * sizeof(struct vring_desc), gfp);
+	desc = alloc_indirect(vq, out + in, gfp);
 	if (!desc)
 		return -ENOMEM;
 
@@ -152,13 +288,408 @@ static int vring_add_indirect(struct vring_virtqueue *vq,
 	vq->vring.desc[head].flags = VRING_DESC_F_INDIRECT;
 	vq->vring.desc[head].addr = virt_to_phys(desc);
 	vq->vring.desc[head].len = i * sizeof(struct vring_desc);
+	if (vq->in_order) {
+		vq->desc_state[head].indir_desc = desc;
+		vq->desc_state[head].indir_num = i;
+	}
 
 	/* Update free pointer */
-	vq->free_head = vq->vring.desc[head].next;
+	vq->free_head = next_desc(vq, head);
 
 	return head;
 }
 
+/*
+ * The packed layout. A buffer is made available by writing its descriptors
+ * in place, the first one last, and is used once the Host overwrites that
+ * first one. Buffer ids are separate from the slots, since buffers may be
+ * used out of order.
+ */
+#define VRING_PACKED_AVAIL	(1 << VRING_PACKED_DESC_F_AVAIL)
+#define VRING_PACKED_USED	(1 << VRING_PACKED_DESC_F_USED)
+
+static inline bool is_used_desc_packed(const struct vring_virtqueue *vq,
+				       u16 idx, bool used_wrap_counter)
+{
+	u16 flags = vq->vring_packed.desc[idx].flags;
+	bool avail = !!(flags & VRING_PACKED_AVAIL);
+	bool used = !!(flags & VRING_PACKED_USED);
+
+	return avail == used && used == used_wrap_counter;
+}
+
+static void set_driver_flags_packed(struct vring_virtqueue *vq, u16 flags)
+{
+	if (vq->driver_flags != flags) {
+		vq->driver_flags = flags;
+		vq->vring_packed.driver->flags = flags;
+	}
+}
+
+/* Put a ring (new, or whose other side was reset) in its initial state. */
+static void vring_init_packed(struct vring_virtqueue *vq)
+{
+	unsigned int i, num = vq->vring_packed.num;
+
+	memset(vq->vring_packed.desc, 0, vring_packed_size(num));
+
+	vq->next_avail_idx = 0;
+	vq->avail_wrap_counter = 1;
+	vq->used_wrap_counter = 1;
+	vq->avail_used_flags = VRING_PACKED_AVAIL;
+
+	/* No callback?  Tell other side not to bother us. */
+	vq->driver_flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	if (!vq->vq.callback)
+		set_driver_flags_packed(vq, VRING_PACKED_EVENT_FLAG_DISABLE);
+
+	vq->free_head = 0;
+	for (i = 0; i < num; i++) {
+		vq->desc_state[i].next = i+1;
+		vq->desc_state[i].indir_desc = NULL;
+	}
+}
+
+/* Write the descriptors of a buffer, all but the flags of its head, which
+ * are left in its desc_state for the caller to expose. Returns its id. */
+static int __vring_add_buf_packed(struct vring_virtqueue *vq,
+				  struct scatterlist sg[],
+				  unsigned int out,
+				  unsigned int in,
+				  void *data,
+				  gfp_t gfp)
+{
+	struct vring_packed_desc *desc = vq->vring_packed.desc;
+	struct vring_desc *indir = NULL;
+	unsigned int n, total = out + in, descs;
+	u16 i, head, id, flags, uninitialized_var(head_flags);
+
+	BUG_ON(data == NULL);
+	BUG_ON(total == 0);
+
+	/* If the host supports indirect descriptor tables, and we have multiple
+	 * buffers, then go indirect. The table has the usual vring_desc's,
+	 * though they're read in order, so "next" is unused. */
+	if (vq->indirect && total > 1 && vq->num_free) {
+		indir = alloc_indirect(vq, total, gfp);
+		for (n = 0; indir && n < total; n++, sg++) {
+			indir[n].flags = n < out ? 0 : VRING_DESC_F_WRITE;
+			indir[n].addr = sg_phys(sg);
+			indir[n].len = sg->length;
+			indir[n].next = 0;
+		}
+	}
+
+	descs = indir ? 1 : total;
+	BUG_ON(descs > vq->vring_packed.num);
+
+	if (vq->num_free < descs) {
+		pr_debug("Can't add buf len %i - avail = %i\n",
+			 descs, vq->num_free);
+		/* Same historical behaviour as the split ring. */
+		if (out)
+			vq->notify(&vq->vq);
+		vq->stats.no_space++;
+		return -ENOSPC;
+	}
+
+	head = i = vq->next_avail_idx;
+	id = vq->free_head;
+
+	for (n = 0; n < descs; n++) {
+		flags = vq->avail_used_flags;
+		if (indir) {
+			flags |= VRING_DESC_F_INDIRECT;
+			desc[i].addr = virt_to_phys(indir);
+			desc[i].len = total * sizeof(struct vring_desc);
+		} else {
+			if (n >= out)
+				flags |= VRING_DESC_F_WRITE;
+			if (n < descs - 1)
+				flags |= VRING_DESC_F_NEXT;
+			desc[i].addr = sg_phys(sg);
+			desc[i].len = sg->length;
+			sg++;
+		}
+		desc[i].id = id;
+
+		/* The head is only made available once the rest is there. */
+		if (i == head)
+			head_flags = flags;
+		else
+			desc[i].flags = flags;
+
+		if (++i == vq->vring_packed.num) {
+			i = 0;
+			vq->avail_wrap_counter ^= 1;
+			vq->avail_used_flags ^= VRING_PACKED_AVAIL |
+						VRING_PACKED_USED;
+		}
+	}
+
+	vq->num_free -= descs;
+	vq->next_avail_idx = i;
+	vq->num_added += descs;
+
+	vq->free_head = vq->desc_state[id].next;
+	vq->desc_state[id].num = descs;
+	vq->desc_state[id].head_flags = head_flags;
+	vq->desc_state[id].indir_desc = indir;
+	vq->desc_state[id].indir_num = total;
+	vq->data[id] = data;
+	count_add(vq, indir);
+
+	pr_debug("Added buffer id %i at %i to %p\n", id, head, vq);
+
+	return id;
+}
+
+static int vring_add_buf_packed(struct vring_virtqueue *vq,
+				struct scatterlist sg[],
+				unsigned int out,
+				unsigned int in,
+				void *data,
+				gfp_t gfp)
+{
+	u16 head = vq->next_avail_idx;
+	int id;
+
+	START_USE(vq);
+
+	id = __vring_add_buf_packed(vq, sg, out, in, data, gfp);
+	if (id < 0) {
+		END_USE(vq);
+		return id;
+	}
+
+	/* Descriptors need to be set before we expose the head. */
+	virtio_wmb();
+	vq->vring_packed.desc[head].flags = vq->desc_state[id].head_flags;
+
+	END_USE(vq);
+
+	return vq->num_free;
+}
+
+/* Add a batch of buffers, and expose all their heads after one barrier.
+ * The ids of the batch are chained via desc_state meanwhile. */
+static int vring_add_bufs_packed(struct vring_virtqueue *vq,
+				 struct scatterlist sg[],
+				 unsigned int *num,
+				 unsigned int out,
+				 unsigned int in,
+				 void *data[],
+				 gfp_t gfp)
+{
+	struct vring_desc_state *state;
+	u16 head = vq->next_avail_idx;
+	int id = 0, first = 0, prev = 0;
+	unsigned int n, i;
+
+	START_USE(vq);
+
+	for (n = 0; n < *num; n++, sg += out + in) {
+		id = __vring_add_buf_packed(vq, sg, out, in, data[n], gfp);
+		if (id < 0)
+			break;
+		if (n)
+			vq->desc_state[prev].next = id;
+		else
+			first = id;
+		prev = id;
+	}
+	*num = n;
+
+	if (n) {
+		/* Descriptors need to be set before we expose the heads. */
+		virtio_wmb();
+
+		for (i = 0, state = &vq->desc_state[first]; i < n;
+				i++, state = &vq->desc_state[state->next]) {
+			vq->vring_packed.desc[head].flags = state->head_flags;
+			head += state->num;
+			if (head >= vq->vring_packed.num)
+				head -= vq->vring_packed.num;
+		}
+	}
+
+	END_USE(vq);
+
+	return id < 0 ? id : vq->num_free;
+}
+
+static bool vring_kick_prepare_packed(struct vring_virtqueue *vq)
+{
+	struct vring_packed_event event;
+	u16 new, old, event_idx;
+	bool needs_kick;
+
+	START_USE(vq);
+
+	/* Need to expose the new descriptors before checking if we should
+	 * notify. */
+	virtio_mb();
+
+	old = vq->next_avail_idx - vq->num_added;
+	new = vq->next_avail_idx;
+	vq->num_added = 0;
+
+	event = *vq->vring_packed.device;
+
+	if (event.flags != VRING_PACKED_EVENT_FLAG_DESC) {
+		needs_kick = event.flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+		goto out;
+	}
+
+	/* An event of the previous wrap is a ring size behind. */
+	event_idx = event.off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((event.off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+						vq->avail_wrap_counter)
+		event_idx -= vq->vring_packed.num;
+
+	needs_kick = vring_need_event(event_idx, new, old);
+out:
+	END_USE(vq);
+	return count_kick(vq, needs_kick);
+}
+
+static void detach_buf_packed(struct vring_virtqueue *vq, unsigned int id)
+{
+	struct vring_desc_state *state = &vq->desc_state[id];
+
+	/* Clear data ptr. */
+	vq->data[id] = NULL;
+
+	/* Free the indirect table */
+	if (state->indir_desc)
+		free_indirect(vq, state->indir_desc, state->indir_num);
+	state->indir_desc = NULL;
+
+	/* Put back on free list */
+	vq->num_free += state->num;
+	state->next = vq->free_head;
+	vq->free_head = id;
+}
+
+static void *vring_get_buf_packed(struct vring_virtqueue *vq,
+				  unsigned int *len)
+{
+	u16 last = vq->last_used_idx;
+	unsigned int id;
+	void *ret;
+
+	START_USE(vq);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return NULL;
+	}
+
+	if (!is_used_desc_packed(vq, last, vq->used_wrap_counter)) {
+		pr_debug("No more buffers in queue\n");
+		END_USE(vq);
+		return NULL;
+	}
+
+	/* Only read the used descriptor after it has been exposed by host. */
+	virtio_rmb();
+
+	id = vq->vring_packed.desc[last].id;
+	*len = vq->vring_packed.desc[last].len;
+
+	if (unlikely(id >= vq->vring_packed.num)) {
+		BAD_RING(vq, "id %u out of range\n", id);
+		return NULL;
+	}
+	if (unlikely(!vq->data[id])) {
+		BAD_RING(vq, "id %u is not a head!\n", id);
+		return NULL;
+	}
+
+	/* The host skips the rest of the chain, and so do we. */
+	vq->last_used_idx += vq->desc_state[id].num;
+	if (vq->last_used_idx >= vq->vring_packed.num) {
+		vq->last_used_idx -= vq->vring_packed.num;
+		vq->used_wrap_counter ^= 1;
+	}
+
+	/* detach_buf_packed clears data, so grab it now. */
+	ret = vq->data[id];
+	detach_buf_packed(vq, id);
+	vq->stats.used++;
+
+	/* If we expect an interrupt for the next entry, tell host
+	 * by writing event index and flush out the write before
+	 * the read in the next get_buf call. */
+	if (vq->driver_flags == VRING_PACKED_EVENT_FLAG_DESC) {
+		vq->vring_packed.driver->off_wrap = vq->last_used_idx |
+			(vq->used_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR);
+		virtio_mb();
+	}
+
+	END_USE(vq);
+	return ret;
+}
+
+/* Ask for an interrupt once the descriptor @bufs after the last used one
+ * is used, and tell whether it is already. */
+static bool vring_enable_cb_packed(struct vring_virtqueue *vq, u16 bufs)
+{
+	u16 used_idx = vq->last_used_idx + bufs;
+	bool wrap_counter = vq->used_wrap_counter;
+
+	START_USE(vq);
+
+	if (used_idx >= vq->vring_packed.num) {
+		used_idx -= vq->vring_packed.num;
+		wrap_counter ^= 1;
+	}
+
+	/* Depending on the VIRTIO_RING_F_EVENT_IDX feature, we need to
+	 * either just enable interrupts, or point the event index at the
+	 * entry we want one for. */
+	if (vq->event) {
+		vq->vring_packed.driver->off_wrap = used_idx |
+			(wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR);
+		/* The event index must be in place before it's enabled. */
+		virtio_wmb();
+	}
+	set_driver_flags_packed(vq, vq->event ? VRING_PACKED_EVENT_FLAG_DESC :
+					VRING_PACKED_EVENT_FLAG_ENABLE);
+	virtio_mb();
+
+	if (unlikely(is_used_desc_packed(vq, used_idx, wrap_counter))) {
+		END_USE(vq);
+		return false;
+	}
+
+	END_USE(vq);
+	return true;
+}
+
+static void *vring_detach_unused_buf_packed(struct vring_virtqueue *vq)
+{
+	unsigned int i;
+	void *buf;
+
+	START_USE(vq);
+
+	for (i = 0; i < vq->vring_packed.num; i++) {
+		if (!vq->data[i])
+			continue;
+		/* detach_buf_packed clears data, so grab it now. */
+		buf = vq->data[i];
+		detach_buf_packed(vq, i);
+		END_USE(vq);
+		return buf;
+	}
+	/* That should have freed everything. */
+	BUG_ON(vq->num_free != vq->vring_packed.num);
+
+	END_USE(vq);
+	return NULL;
+}
+
 int virtqueue_add_buf_gfp(struct virtqueue *_vq,
 			  struct scatterlist sg[],
 			  unsigned int out,
@@ -167,9 +698,12 @@ int virtqueue_add_buf_gfp(struct virtqueue *_vq,
 			  gfp_t gfp)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
-	unsigned int i, avail, uninitialized_var(prev);
+	unsigned int i, avail, uninitialized_var(prev), descs = 1;
 	int head;
 
+	if (vq->packed)
+		return vring_add_buf_packed(vq, sg, out, in, data, gfp);
+
 	START_USE(vq);
 
 	BUG_ON(data == NULL);
@@ -178,8 +712,10 @@ int virtqueue_add_buf_gfp(struct virtqueue *_vq,
 	 * buffers, then go indirect. FIXME: tune this threshold */
 	if (vq->indirect && (out + in) > 1 && vq->num_free) {
 		head = vring_add_indirect(vq, sg, out, in, gfp);
-		if (likely(head >= 0))
+		if (likely(head >= 0)) {
+			count_add(vq, true);
 			goto add_head;
+		}
 	}
 
 	BUG_ON(out + in > vq->vring.num);
@@ -193,22 +729,26 @@ int virtqueue_add_buf_gfp(struct virtqueue *_vq,
 		 * host should service the ring ASAP. */
 		if (out)
 			vq->notify(&vq->vq);
+		vq->stats.no_space++;
 		END_USE(vq);
 		return -ENOSPC;
 	}
 
 	/* We're about to use some buffers from the free list. */
-	vq->num_free -= out + in;
+	descs = out + in;
+	vq->num_free -= descs;
 
 	head = vq->free_head;
-	for (i = vq->free_head; out; i = vq->vring.desc[i].next, out--) {
+	if (vq->in_order)
+		vq->desc_state[head].indir_desc = NULL;
+	for (i = vq->free_head; out; i = next_desc(vq, i), out--) {
 		vq->vring.desc[i].flags = VRING_DESC_F_NEXT;
 		vq->vring.desc[i].addr = sg_phys(sg);
 		vq->vring.desc[i].len = sg->length;
 		prev = i;
 		sg++;
 	}
-	for (; in; i = vq->vring.desc[i].next, in--) {
+	for (; in; i = next_desc(vq, i), in--) {
 		vq->vring.desc[i].flags = VRING_DESC_F_NEXT|VRING_DESC_F_WRITE;
 		vq->vring.desc[i].addr = sg_phys(sg);
 		vq->vring.desc[i].len = sg->length;
@@ -220,10 +760,13 @@ int virtqueue_add_buf_gfp(struct virtqueue *_vq,
 
 	/* Update free pointer */
 	vq->free_head = i;
+	count_add(vq, false);
 
 add_head:
 	/* Set token. */
 	vq->data[head] = data;
+	if (vq->in_order)
+		vq->desc_state[head].num = descs;
 
 	/* Put entry in available array (but don't update avail->idx until they
 	 * do sync).  FIXME: avoid modulus here? */
@@ -237,10 +780,43 @@ add_head:
 }
 EXPORT_SYMBOL_GPL(virtqueue_add_buf_gfp);
 
-void virtqueue_kick(struct virtqueue *_vq)
+int virtqueue_add_bufs_gfp(struct virtqueue *_vq,
+			   struct scatterlist sg[],
+			   unsigned int *num,
+			   unsigned int out,
+			   unsigned int in,
+			   void *data[],
+			   gfp_t gfp)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int n;
+	int ret = vq->num_free;
+
+	if (vq->packed)
+		return vring_add_bufs_packed(vq, sg, num, out, in, data, gfp);
+
+	/* The split ring only exposes the new avail entries (with a single
+	 * barrier) on kick, so there's nothing to batch here. */
+	for (n = 0; n < *num; n++, sg += out + in) {
+		ret = virtqueue_add_buf_gfp(_vq, sg, out, in, data[n], gfp);
+		if (ret < 0)
+			break;
+	}
+	*num = n;
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(virtqueue_add_bufs_gfp);
+
+bool virtqueue_kick_prepare(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	u16 new, old;
+	bool needs_kick;
+
+	if (vq->packed)
+		return vring_kick_prepare_packed(vq);
+
 	START_USE(vq);
 	/* Descriptors and available array need to be set before we expose the
 	 * new available array entries. */
@@ -253,13 +829,28 @@ void virtqueue_kick(struct virtqueue *_vq)
 	/* Need to update avail index before checking if we should notify */
 	virtio_mb();
 
-	if (vq->event ?
-	    vring_need_event(vring_avail_event(&vq->vring), new, old) :
-	    !(vq->vring.used->flags & VRING_USED_F_NO_NOTIFY))
-		/* Prod other side to tell it about changes. */
-		vq->notify(&vq->vq);
+	needs_kick = vq->event ?
+		vring_need_event(vring_avail_event(&vq->vring), new, old) :
+		!(vq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
 
 	END_USE(vq);
+	return count_kick(vq, needs_kick);
+}
+EXPORT_SYMBOL_GPL(virtqueue_kick_prepare);
+
+void virtqueue_notify(struct virtqueue *_vq)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+
+	/* Prod other side to tell it about changes. */
+	vq->notify(_vq);
+}
+EXPORT_SYMBOL_GPL(virtqueue_notify);
+
+void virtqueue_kick(struct virtqueue *vq)
+{
+	if (virtqueue_kick_prepare(vq))
+		virtqueue_notify(vq);
 }
 EXPORT_SYMBOL_GPL(virtqueue_kick);
 
@@ -270,12 +861,23 @@ static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
 	/* Clear data ptr. */
 	vq->data[head] = NULL;
 
+	/* In order, the freed descriptors are the ones right after the free
+	 * ones, and were chained at init, so just count them back in. */
+	if (vq->in_order) {
+		if (vq->desc_state[head].indir_desc)
+			free_indirect(vq, vq->desc_state[head].indir_desc,
+				      vq->desc_state[head].indir_num);
+		vq->num_free += vq->desc_state[head].num;
+		return;
+	}
+
 	/* Put back on free list: find end */
 	i = head;
 
 	/* Free the indirect table */
 	if (vq->vring.desc[i].flags & VRING_DESC_F_INDIRECT)
-		kfree(phys_to_virt(vq->vring.desc[i].addr));
+		free_indirect(vq, phys_to_virt(vq->vring.desc[i].addr),
+			      vq->vring.desc[i].len / sizeof(struct vring_desc));
 
 	while (vq->vring.desc[i].flags & VRING_DESC_F_NEXT) {
 		i = vq->vring.desc[i].next;
@@ -290,6 +892,10 @@ static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
 
 static inline bool more_used(const struct vring_virtqueue *vq)
 {
+	if (vq->packed)
+		return is_used_desc_packed(vq, vq->last_used_idx,
+					   vq->used_wrap_counter);
+
 	return vq->last_used_idx != vq->vring.used->idx;
 }
 
@@ -299,6 +905,9 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	void *ret;
 	unsigned int i;
 
+	if (vq->packed)
+		return vring_get_buf_packed(vq, len);
+
 	START_USE(vq);
 
 	if (unlikely(vq->broken)) {
@@ -315,7 +924,11 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	/* Only get used array entries after they have been exposed by host. */
 	virtio_rmb();
 
-	i = vq->vring.used->ring[vq->last_used_idx%vq->vring.num].id;
+	/* In order, the buffer used is the oldest one, after the free ones. */
+	if (vq->in_order)
+		i = (vq->free_head + vq->num_free) & (vq->vring.num - 1);
+	else
+		i = vq->vring.used->ring[vq->last_used_idx%vq->vring.num].id;
 	*len = vq->vring.used->ring[vq->last_used_idx%vq->vring.num].len;
 
 	if (unlikely(i >= vq->vring.num)) {
@@ -331,6 +944,7 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	ret = vq->data[i];
 	detach_buf(vq, i);
 	vq->last_used_idx++;
+	vq->stats.used++;
 	/* If we expect an interrupt for the next entry, tell host
 	 * by writing event index and flush out the write before
 	 * the read in the next get_buf call. */
@@ -348,6 +962,11 @@ void virtqueue_disable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed) {
+		set_driver_flags_packed(vq, VRING_PACKED_EVENT_FLAG_DISABLE);
+		return;
+	}
+
 	vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
 }
 EXPORT_SYMBOL_GPL(virtqueue_disable_cb);
@@ -356,6 +975,9 @@ bool virtqueue_enable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed)
+		return vring_enable_cb_packed(vq, 0);
+
 	START_USE(vq);
 
 	/* We optimistically turn back on interrupts, then check if there was
@@ -381,6 +1003,10 @@ bool virtqueue_enable_cb_delayed(struct virtqueue *_vq)
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	u16 bufs;
 
+	if (vq->packed)
+		return vring_enable_cb_packed(vq, (vq->vring_packed.num -
+						   vq->num_free) * 3 / 4);
+
 	START_USE(vq);
 
 	/* We optimistically turn back on interrupts, then check if there was
@@ -409,9 +1035,16 @@ void *virtqueue_detach_unused_buf(struct virtqueue *_vq)
 	unsigned int i;
 	void *buf;
 
+	if (vq->packed)
+		return vring_detach_unused_buf_packed(vq);
+
 	START_USE(vq);
 
 	for (i = 0; i < vq->vring.num; i++) {
+		/* In order, buffers can only be detached oldest first. */
+		if (vq->in_order && vq->num_free != vq->vring.num)
+			i = (vq->free_head + vq->num_free) &
+						(vq->vring.num - 1);
 		if (!vq->data[i])
 			continue;
 		/* detach_buf clears data, so grab it now. */
@@ -429,15 +1062,64 @@ void *virtqueue_detach_unused_buf(struct virtqueue *_vq)
 }
 EXPORT_SYMBOL_GPL(virtqueue_detach_unused_buf);
 
+static int vring_stats_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static ssize_t vring_stats_read(struct file *filp, char __user *userbuf,
+				size_t count, loff_t *ppos)
+{
+	struct vring_virtqueue *vq = filp->private_data;
+	struct vring_stats *stats = &vq->stats;
+	unsigned long irqs = stats->interrupts ?: 1;
+	char buf[512];
+	int i;
+
+	i = scnprintf(buf, sizeof(buf),
+		"layout: %s%s\n"
+		"num: %u\n"
+		"free: %u\n"
+		"added: %lu\n"
+		"indirect: %lu\n"
+		"full: %lu\n"
+		"no_space: %lu\n"
+		"kicks: %lu\n"
+		"kicks_suppressed: %lu\n"
+		"interrupts: %lu\n"
+		"spurious: %lu\n"
+		"used: %lu\n"
+		"used_per_interrupt: %lu.%02lu\n",
+		vq->packed ? "packed" : "split",
+		vq->in_order ? ", in order" : "",
+		vq->vring.num, vq->num_free,
+		stats->added, stats->indirect, stats->full, stats->no_space,
+		stats->kicks, stats->kicks_suppressed,
+		stats->interrupts, stats->spurious, stats->used,
+		stats->used / irqs, (stats->used % irqs) * 100 / irqs);
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, i);
+}
+
+static const struct file_operations vring_stats_ops = {
+	.read = vring_stats_read,
+	.open = vring_stats_open,
+	.llseek	= generic_file_llseek,
+};
+
 irqreturn_t vring_interrupt(int irq, void *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
 	if (!more_used(vq)) {
 		pr_debug("virtqueue interrupt with no work for %p\n", vq);
+		vq->stats.spurious++;
 		return IRQ_NONE;
 	}
 
+	vq->stats.interrupts++;
+
 	if (unlikely(vq->broken))
 		return IRQ_HANDLED;
 
@@ -470,11 +1152,27 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 	if (!vq)
 		return NULL;
 
+	vq->packed = virtio_has_feature(vdev, VIRTIO_RING_F_PACKED);
+	vq->in_order = !vq->packed &&
+			virtio_has_feature(vdev, VIRTIO_RING_F_IN_ORDER);
+	vq->desc_state = NULL;
+	if (vq->packed || vq->in_order) {
+		vq->desc_state = kmalloc(num * sizeof(*vq->desc_state),
+								GFP_KERNEL);
+		if (!vq->desc_state) {
+			kfree(vq);
+			return NULL;
+		}
+	}
+
 	vring_init(&vq->vring, num, pages, vring_align);
+	vring_packed_init(&vq->vring_packed, num, pages);
 	vq->vq.callback = callback;
 	vq->vq.vdev = vdev;
 	vq->vq.name = name;
 	vq->notify = notify;
+	memset(&vq->stats, 0, sizeof(vq->stats));
+	vq->dbg = NULL;
 	vq->broken = false;
 	vq->last_used_idx = 0;
 	vq->num_added = 0;
@@ -484,28 +1182,95 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 #endif
 
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC);
+	vq->indir_cache = NULL;
+	vq->indir_cached = 0;
+
+	/* e.g. virtio_ring/virtio0-input */
+	if (vring_dbg) {
+		char dbg_name[32];
+
+		snprintf(dbg_name, sizeof(dbg_name), "%s-%s",
+			 dev_name(&vdev->dev), name ?: "vq");
+		vq->dbg = debugfs_create_file(dbg_name, 0400, vring_dbg, vq,
+					      &vring_stats_ops);
+	}
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
+	/* Put everything in free lists. */
+	vq->num_free = num;
+	for (i = 0; i < num; i++)
+		vq->data[i] = NULL;
+
+	if (vq->packed) {
+		vring_init_packed(vq);
+		return &vq->vq;
+	}
+
 	/* No callback?  Tell other side not to bother us. */
 	if (!callback)
 		vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
 
-	/* Put everything in free lists. */
-	vq->num_free = num;
 	vq->free_head = 0;
-	for (i = 0; i < num-1; i++) {
+	for (i = 0; i < num-1; i++)
 		vq->vring.desc[i].next = i+1;
-		vq->data[i] = NULL;
-	}
-	vq->data[i] = NULL;
+	/* In order, chains may wrap around the end of the ring. */
+	if (vq->in_order)
+		vq->vring.desc[i].next = 0;
 
 	return &vq->vq;
 }
 EXPORT_SYMBOL_GPL(vring_new_virtqueue);
 
+/*
+ * Bring a virtqueue back to its pristine state, e.g. once the other side
+ * was reset: its ring is wiped, and all its descriptors are free again.
+ * The driver must have taken back all of its buffers beforehand (e.g.
+ * using virtqueue_detach_unused_buf()), and no one may use the vq meanwhile.
+ */
+void vring_reset_virtqueue(struct virtqueue *_vq)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int i, num = vq->vring.num;
+
+	BUG_ON(vq->num_free != num);
+
+	if (vq->packed) {
+		vq->broken = false;
+		vq->last_used_idx = 0;
+		vq->num_added = 0;
+		vring_init_packed(vq);
+		return;
+	}
+
+	/* the desc table, the avail ring and the used ring (with its event) */
+	memset(vq->vring.desc, 0, (void *)&vq->vring.used->ring[num] +
+				sizeof(__u16) - (void *)vq->vring.desc);
+
+	vq->broken = false;
+	vq->last_used_idx = 0;
+	vq->num_added = 0;
+
+	if (!vq->vq.callback)
+		vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+
+	vq->free_head = 0;
+	for (i = 0; i < num-1; i++)
+		vq->vring.desc[i].next = i+1;
+}
+EXPORT_SYMBOL_GPL(vring_reset_virtqueue);
+
 void vring_del_virtqueue(struct virtqueue *vq)
 {
+	struct vring_desc *desc;
+
+	while ((desc = to_vvq(vq)->indir_cache)) {
+		to_vvq(vq)->indir_cache = *(struct vring_desc **)desc;
+		kfree(desc);
+	}
+
+	debugfs_remove(to_vvq(vq)->dbg);
 	list_del(&vq->list);
+	kfree(to_vvq(vq)->desc_state);
 	kfree(to_vvq(vq));
 }
 EXPORT_SYMBOL_GPL(vring_del_virtqueue);
@@ -521,6 +1286,10 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_RING_F_EVENT_IDX:
 			break;
+		case VIRTIO_RING_F_PACKED:
+			break;
+		case VIRTIO_RING_F_IN_ORDER:
+			break;
 		default:
 			/* We don't understand this bit. */
 			clear_bit(i, vdev->features);
@@ -529,4 +1298,22 @@ void vring_transport_features(struct virtio_device *vdev)
 }
 EXPORT_SYMBOL_GPL(vring_transport_features);
 
+static int __init vring_init_module(void)
+{
+	if (debugfs_initialized()) {
+		vring_dbg = debugfs_create_dir(KBUILD_MODNAME, NULL);
+		if (!vring_dbg)
+			pr_err("can't create debugfs dir\n");
+	}
+
+	return 0;
+}
+module_init(vring_init_module);
+
+static void __exit vring_exit_module(void)
+{
+	debugfs_remove(vring_dbg);
+}
+module_exit(vring_exit_module);
+
 MODULE_LICENSE("GPL");
@@ -35,6 +35,7 @@
 #include <linux/eventfd.h>
 #include <linux/blkdev.h>
 #include <linux/compat.h>
+#include <linux/pagemap.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -64,6 +65,7 @@ static DEFINE_SPINLOCK(fput_lock);
 static LIST_HEAD(fput_head);
 
 static void aio_kick_handler(struct work_struct *);
+static int aio_wake_page_function(wait_queue_t *, unsigned, int, void *);
 static void aio_queue_work(struct kioctx *);
 
 /* aio_setup
@@ -458,6 +460,8 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
 	req->ki_eventfd = NULL;
+	init_waitqueue_func_entry(&req->ki_wait_page.wait,
+				  aio_wake_page_function);
 
 	/* Check if the completion queue has enough free space to
 	 * accept an event from this io.
@@ -1307,6 +1311,91 @@ static void aio_advance_iovec(struct kiocb *iocb, ssize_t ret)
 	BUG_ON(ret > 0 && iocb->ki_left == 0);
 }
 
+/*
+ * Called from unlock_page() (so possibly from interrupt context) for the
+ * page a buffered read is waiting on: retry the read.
+ */
+static int aio_wake_page_function(wait_queue_t *wait, unsigned mode,
+				  int sync, void *arg)
+{
+	struct wait_bit_queue *wait_bit =
+		container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait_page);
+	struct wait_bit_key *key = arg;
+
+	if (wait_bit->key.flags != key->flags ||
+	    wait_bit->key.bit_nr != key->bit_nr)
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
+/*
+ * Buffered reads of regular files go through the page cache, whose pages
+ * we can wait on without blocking.
+ */
+static inline bool aio_buffered_read(struct file *file)
+{
+	struct address_space *mapping = file->f_mapping;
+
+	return !(file->f_flags & O_DIRECT) && S_ISREG(mapping->host->i_mode) &&
+		mapping->a_ops->readpage;
+}
+
+/*
+ * aio_buffered_read_wait:
+ *	Makes sure the rest of a buffered read can be served from the page
+ *	cache without blocking: the missing pages are read ahead, and if one
+ *	of them is still under i/o, we queue ourselves to be kicked once it
+ *	is unlocked and return -EIOCBRETRY. Returns 0 when the read should
+ *	go ahead, which includes the cases where readahead couldn't bring
+ *	the pages in (the read then just does it synchronously).
+ */
+static ssize_t aio_buffered_read_wait(struct kiocb *iocb)
+{
+	struct file *file = iocb->ki_filp;
+	struct address_space *mapping = file->f_mapping;
+	loff_t isize = i_size_read(mapping->host);
+	pgoff_t index, last;
+	ssize_t ret = 0;
+
+	if (!iocb->ki_left || iocb->ki_pos >= isize)
+		return 0;
+
+	index = iocb->ki_pos >> PAGE_CACHE_SHIFT;
+	last = (min_t(loff_t, iocb->ki_pos + iocb->ki_left, isize) - 1)
+							>> PAGE_CACHE_SHIFT;
+
+	for (; index <= last && !ret; index++) {
+		struct page *page = find_get_page(mapping, index);
+
+		if (!page) {
+			page_cache_sync_readahead(mapping, &file->f_ra, file,
+						  index, last - index + 1);
+			page = find_get_page(mapping, index);
+			if (!page)
+				break;
+		}
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, &file->f_ra, file,
+						   page, index, last - index + 1);
+		if (!PageUptodate(page)) {
+			ret = wait_on_page_locked_async(page,
+							&iocb->ki_wait_page);
+			/* not under i/o, but not uptodate: leave it to ->readpage */
+			if (!ret && !PageUptodate(page)) {
+				page_cache_release(page);
+				break;
+			}
+		}
+		page_cache_release(page);
+	}
+
+	return ret;
+}
+
 static ssize_t aio_rw_vect_retry(struct kiocb *iocb)
 {
 	struct file *file = iocb->ki_filp;
@@ -1330,6 +1419,13 @@ static ssize_t aio_rw_vect_retry(struct kiocb *iocb)
 	if (iocb->ki_pos < 0)
 		return -EINVAL;
 
+	/* Don't block the submitter (or aio_wq) on buffered reads */
+	if (opcode == IOCB_CMD_PREADV && aio_buffered_read(file)) {
+		ret = aio_buffered_read_wait(iocb);
+		if (ret)
+			return ret;
+	}
+
 	do {
 		ret = rw_op(iocb, &iocb->ki_iovec[iocb->ki_cur_seg],
 			    iocb->ki_nr_segs - iocb->ki_cur_seg,
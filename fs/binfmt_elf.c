@@ -315,6 +315,36 @@ create_elf_tables(struct linux_binprm *bprm, struct elfhdr *exec,
 	return 0;
 }
 
+/*
+ * Map the pages of the read-only segment at [addr, addr + size) of the
+ * file that are already up to date in the page cache, which saves the
+ * new program a fault for each of them.  Called with mmap_sem held.
+ */
+static void elf_prefault(struct file *filep, unsigned long addr,
+		unsigned long size, unsigned long off)
+{
+	struct address_space *mapping = filep->f_mapping;
+	pgoff_t pgoff = off >> PAGE_SHIFT;
+	unsigned long start = addr, end;
+
+	for (end = addr; end < addr + size; end += PAGE_SIZE, pgoff++) {
+		struct page *page = find_get_page(mapping, pgoff);
+		int cached = page && PageUptodate(page);
+
+		if (page)
+			page_cache_release(page);
+		if (cached)
+			continue;
+
+		if (start < end)
+			make_pages_present(start, end);
+		start = end + PAGE_SIZE;
+	}
+
+	if (start < end)
+		make_pages_present(start, end);
+}
+
 static unsigned long elf_map(struct file *filep, unsigned long addr,
 		struct elf_phdr *eppnt, int prot, int type,
 		unsigned long total_size)
@@ -347,6 +377,9 @@ static unsigned long elf_map(struct file *filep, unsigned long addr,
 	} else
 		map_addr = do_mmap(filep, addr, size, prot, type, off);
 
+	if (exec_prefault && !BAD_ADDR(map_addr) && !(prot & PROT_WRITE))
+		elf_prefault(filep, map_addr, size, off);
+
 	up_write(&current->mm->mmap_sem);
 	return(map_addr);
 }
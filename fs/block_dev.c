@@ -25,6 +25,7 @@
 #include <linux/namei.h>
 #include <linux/log2.h>
 #include <linux/kmemleak.h>
+#include <linux/task_io_accounting_ops.h>
 #include <asm/uaccess.h>
 #include "internal.h"
 
@@ -181,12 +182,112 @@ blkdev_get_blocks(struct inode *inode, sector_t iblock,
 	return 0;
 }
 
+/*
+ * Small synchronous O_DIRECT requests on a single segment are submitted as
+ * one on-stack bio, instead of going through the generic direct I/O code
+ * with its struct dio allocation and get_block calls.
+ */
+#define DIO_INLINE_BIO_VECS	4
+
+static void blkdev_bio_end_io_simple(struct bio *bio, int error)
+{
+	struct task_struct *waiter = bio->bi_private;
+
+	bio->bi_private = NULL;
+	smp_wmb();
+	wake_up_process(waiter);
+}
+
+/*
+ * Returns -ENOTBLK if the request has to go through the generic code after
+ * all, because the user pages couldn't all be pinned, or the queue didn't
+ * take them in a single bio.
+ */
+static ssize_t
+blkdev_direct_IO_simple(int rw, struct kiocb *iocb, const struct iovec *iov,
+			loff_t offset)
+{
+	struct inode *inode = iocb->ki_filp->f_mapping->host;
+	unsigned long addr = (unsigned long)iov->iov_base;
+	size_t count = iov->iov_len;
+	unsigned int pg_off = addr & ~PAGE_MASK;
+	int nr_pages = DIV_ROUND_UP(pg_off + count, PAGE_SIZE);
+	struct page *pages[DIO_INLINE_BIO_VECS];
+	struct bio_vec vecs[DIO_INLINE_BIO_VECS];
+	struct bio bio;
+	size_t left = count;
+	ssize_t ret = -ENOTBLK;
+	int i, npages;
+
+	npages = get_user_pages_fast(addr, nr_pages, rw == READ, pages);
+	if (npages < nr_pages)
+		goto out;
+
+	bio_init(&bio);
+	bio.bi_io_vec = vecs;
+	bio.bi_max_vecs = DIO_INLINE_BIO_VECS;
+	bio.bi_bdev = I_BDEV(inode);
+	bio.bi_sector = offset >> 9;
+	bio.bi_private = current;
+	bio.bi_end_io = blkdev_bio_end_io_simple;
+
+	for (i = 0; i < npages; i++) {
+		unsigned int len = min_t(size_t, PAGE_SIZE - pg_off, left);
+
+		if (bio_add_page(&bio, pages[i], len, pg_off) != len)
+			goto out;
+		left -= len;
+		pg_off = 0;
+	}
+
+	if (rw == WRITE) {
+		task_io_account_write(count);
+		submit_bio(WRITE_ODIRECT, &bio);
+	} else
+		submit_bio(READ, &bio);
+
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!ACCESS_ONCE(bio.bi_private))
+			break;
+		if (!blk_poll(bdev_get_queue(bio.bi_bdev)))
+			io_schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	smp_rmb();
+
+	ret = test_bit(BIO_UPTODATE, &bio.bi_flags) ? count : -EIO;
+	if (rw == READ) {
+		for (i = 0; i < npages; i++)
+			if (!PageCompound(pages[i]))
+				set_page_dirty_lock(pages[i]);
+	}
+out:
+	for (i = 0; i < npages; i++)
+		put_page(pages[i]);
+	return ret;
+}
+
 static ssize_t
 blkdev_direct_IO(int rw, struct kiocb *iocb, const struct iovec *iov,
 			loff_t offset, unsigned long nr_segs)
 {
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
+	unsigned int mask = bdev_logical_block_size(I_BDEV(inode)) - 1;
+	unsigned long addr = (unsigned long)iov->iov_base;
+	size_t count = iov->iov_len;
+
+	if (nr_segs == 1 && is_sync_kiocb(iocb) && count &&
+	    !((offset | count | addr) & mask) &&
+	    DIV_ROUND_UP((addr & ~PAGE_MASK) + count, PAGE_SIZE) <=
+						DIO_INLINE_BIO_VECS &&
+	    offset + count <= i_size_read(inode)) {
+		ssize_t ret = blkdev_direct_IO_simple(rw, iocb, iov, offset);
+
+		if (ret != -ENOTBLK)
+			return ret;
+	}
 
 	return __blockdev_direct_IO(rw, iocb, inode, I_BDEV(inode), iov, offset,
 				    nr_segs, blkdev_get_blocks, NULL, NULL, 0);
@@ -200,9 +200,12 @@ int btrfs_check_acl(struct inode *inode, int mask, unsigned int flags)
 	int error = -EAGAIN;
 
 	if (flags & IPERM_FLAG_RCU) {
-		if (!negative_cached_acl(inode, ACL_TYPE_ACCESS))
+		struct posix_acl *acl;
+		acl = get_cached_acl_rcu(inode, ACL_TYPE_ACCESS);
+		if (acl == ACL_NOT_CACHED)
 			error = -ECHILD;
-
+		else if (acl)
+			error = posix_acl_permission(inode, acl, mask);
 	} else {
 		struct posix_acl *acl;
 		acl = btrfs_get_acl(inode, ACL_TYPE_ACCESS);
@@ -65,6 +65,7 @@ int core_uses_pid;
 char core_pattern[CORENAME_MAX_SIZE] = "core";
 unsigned int core_pipe_limit;
 int suid_dumpable = 0;
+int exec_prefault = 0;
 
 struct core_name {
 	char *corename;
@@ -237,8 +237,11 @@ ext2_check_acl(struct inode *inode, int mask, unsigned int flags)
 	struct posix_acl *acl;
 
 	if (flags & IPERM_FLAG_RCU) {
-		if (!negative_cached_acl(inode, ACL_TYPE_ACCESS))
+		acl = get_cached_acl_rcu(inode, ACL_TYPE_ACCESS);
+		if (acl == ACL_NOT_CACHED)
 			return -ECHILD;
+		if (acl)
+			return posix_acl_permission(inode, acl, mask);
 		return -EAGAIN;
 	}
 
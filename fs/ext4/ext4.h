@@ -1170,6 +1170,10 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
+	/* initialized groups, by the order of their largest free extent */
+	struct list_head *s_mb_largest_free_orders;
+	spinlock_t *s_mb_largest_free_orders_locks;
 	unsigned int s_max_writeback_mb_bump;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
@@ -2056,7 +2060,12 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_group_t	bb_group;	/* group number */
+	struct          list_head bb_largest_free_order_node;
 	struct          list_head bb_prealloc_list;
+	atomic_t	bb_nr_scans;	/* times the allocator scanned the BG */
+	atomic_t	bb_nr_allocs;	/* ... and allocated from it */
+	atomic64_t	bb_scan_time;	/* time spent in those scans, in ns */
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
 #endif
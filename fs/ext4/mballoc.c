@@ -679,11 +679,14 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the matching s_mb_largest_free_orders list.
+ * Called with the group locked.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
 	int i;
 	int bits;
 
@@ -696,6 +699,22 @@ mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 			break;
 		}
 	}
+
+	if (grp->bb_largest_free_order == old)
+		return;
+
+	if (old >= 0) {
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+	i = grp->bb_largest_free_order;
+	if (i >= 0) {
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[i]);
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
 }
 
 static noinline_for_stack
@@ -1954,6 +1973,108 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Look for a group with a free extent of at least 2^order blocks in the
+ * lists of groups by largest free order, which also passes
+ * ext4_mb_good_group() for @cr. The group found is moved to the end of its
+ * list, so that concurrent allocations spread over the suitable groups
+ * instead of all contending for the first one.
+ */
+static int ext4_mb_find_group_by_order(struct ext4_allocation_context *ac,
+				       int order, int cr, ext4_group_t ngroups,
+				       ext4_group_t *group)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *grp;
+	int i;
+
+	for (i = order; i < MB_NUM_ORDERS(sb); i++) {
+		struct list_head *list = &sbi->s_mb_largest_free_orders[i];
+
+		if (list_empty(list))
+			continue;
+
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_for_each_entry(grp, list, bb_largest_free_order_node) {
+			if (grp->bb_group >= ngroups ||
+			    EXT4_MB_GRP_NEED_INIT(grp) ||
+			    !ext4_mb_good_group(ac, grp->bb_group, cr))
+				continue;
+			list_move_tail(&grp->bb_largest_free_order_node, list);
+			spin_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+			*group = grp->bb_group;
+			return 1;
+		}
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * Scan @group for the allocation, at criteria ac->ac_criteria, if the group
+ * passes ext4_mb_good_group() for @good_cr.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int good_cr,
+			      struct ext4_buddy *e4b)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int cr = ac->ac_criteria;
+	ktime_t start = ktime_set(0, 0);
+	int err;
+
+	/* This now checks without needing the buddy page */
+	if (!ext4_mb_good_group(ac, group, good_cr))
+		return 0;
+
+	if (sbi->s_mb_stats)
+		start = ktime_get();
+
+	err = ext4_mb_load_buddy(sb, group, e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (!ext4_mb_good_group(ac, group, good_cr)) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(e4b);
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, e4b);
+	else
+		ext4_mb_complex_scan_group(ac, e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(e4b);
+
+	if (sbi->s_mb_stats) {
+		struct ext4_group_info *grp = ext4_get_group_info(sb, group);
+
+		atomic_inc(&grp->bb_nr_scans);
+		atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+			     &grp->bb_scan_time);
+		if (ac->ac_status == AC_STATUS_FOUND &&
+		    ac->ac_b_ex.fe_group == group)
+			atomic_inc(&grp->bb_nr_allocs);
+	}
+
+	return 0;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2019,6 +2140,29 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		/*
+		 * Unless the goal group will do, ask the index for a group
+		 * with a large enough free extent: 2^ac_2order blocks for
+		 * cr 0, and one the whole request fits in for cr 1 (which
+		 * only needs to be checked like cr 2 would then).
+		 */
+		if (cr <= 1 && sbi->s_mb_optimize_scan &&
+		    !ext4_mb_good_group(ac, ac->ac_g_ex.fe_group, cr)) {
+			int order = cr ? fls(ac->ac_g_ex.fe_len - 1) :
+					 ac->ac_2order;
+
+			if (ext4_mb_find_group_by_order(ac, order, cr ? 2 : 0,
+							ngroups, &group)) {
+				err = ext4_mb_scan_group(ac, group, cr ? 2 : 0,
+							 &e4b);
+				if (err)
+					goto out;
+				if (ac->ac_status != AC_STATUS_CONTINUE)
+					break;
+			}
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -2029,38 +2173,10 @@ repeat:
 			if (group == ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			if (!ext4_mb_good_group(ac, group, cr))
-				continue;
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr, &e4b);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2165,6 +2281,32 @@ static void ext4_mb_seq_groups_stop(struct seq_file *seq, void *v)
 {
 }
 
+static int ext4_mb_seq_group_stats_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	ext4_group_t group = (ext4_group_t) ((unsigned long) v);
+	struct ext4_group_info *grp;
+	unsigned int scans;
+	u64 time;
+
+	group--;
+	if (group == 0)
+		seq_printf(seq, "#%-5s: %-5s %-10s %-10s %-12s %-10s\n",
+			   "group", "order", "scans", "allocs", "time(us)",
+			   "avg(ns)");
+
+	grp = ext4_get_group_info(sb, group);
+	scans = atomic_read(&grp->bb_nr_scans);
+	time = atomic64_read(&grp->bb_scan_time);
+	seq_printf(seq, "#%-5u: %-5d %-10u %-10u %-12llu %-10llu\n", group,
+		   grp->bb_largest_free_order, scans,
+		   atomic_read(&grp->bb_nr_allocs),
+		   (unsigned long long) div_u64(time, NSEC_PER_USEC),
+		   (unsigned long long) (scans ? div_u64(time, scans) : 0));
+
+	return 0;
+}
+
 static const struct seq_operations ext4_mb_seq_groups_ops = {
 	.start  = ext4_mb_seq_groups_start,
 	.next   = ext4_mb_seq_groups_next,
@@ -2194,6 +2336,34 @@ static const struct file_operations ext4_mb_seq_groups_fops = {
 	.release	= seq_release,
 };
 
+static const struct seq_operations ext4_mb_seq_group_stats_ops = {
+	.start  = ext4_mb_seq_groups_start,
+	.next   = ext4_mb_seq_groups_next,
+	.stop   = ext4_mb_seq_groups_stop,
+	.show   = ext4_mb_seq_group_stats_show,
+};
+
+static int ext4_mb_seq_group_stats_open(struct inode *inode, struct file *file)
+{
+	struct super_block *sb = PDE(inode)->data;
+	int rc;
+
+	rc = seq_open(file, &ext4_mb_seq_group_stats_ops);
+	if (rc == 0) {
+		struct seq_file *m = file->private_data;
+		m->private = sb;
+	}
+	return rc;
+}
+
+static const struct file_operations ext4_mb_seq_group_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ext4_mb_seq_group_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
 static struct kmem_cache *get_groupinfo_cache(int blocksize_bits)
 {
 	int cache_index = blocksize_bits - EXT4_MIN_BLOCK_LOG_SIZE;
@@ -2256,6 +2426,8 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 			ext4_free_blks_count(sb, desc);
 	}
 
+	meta_group_info[i]->bb_group = group;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
@@ -2438,6 +2610,21 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		goto out;
 	}
 
+	i = MB_NUM_ORDERS(sb);
+	sbi->s_mb_largest_free_orders =
+		kmalloc(i * sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc(i * sizeof(spinlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		spin_lock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	ret = ext4_groupinfo_create_slab(sb->s_blocksize);
 	if (ret < 0)
 		goto out;
@@ -2472,6 +2659,7 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
 	sbi->s_mb_group_prealloc = MB_DEFAULT_GROUP_PREALLOC;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 
 	sbi->s_locality_groups = alloc_percpu(struct ext4_locality_group);
 	if (sbi->s_locality_groups == NULL) {
@@ -2487,9 +2675,12 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
 		proc_create_data("mb_groups", S_IRUGO, sbi->s_proc,
 				 &ext4_mb_seq_groups_fops, sb);
+		proc_create_data("mb_group_stats", S_IRUGO, sbi->s_proc,
+				 &ext4_mb_seq_group_stats_fops, sb);
+	}
 
 	if (sbi->s_journal)
 		sbi->s_journal->j_commit_callback = release_blocks_on_commit;
@@ -2497,6 +2688,8 @@ out:
 	if (ret) {
 		kfree(sbi->s_mb_offsets);
 		kfree(sbi->s_mb_maxs);
+		kfree(sbi->s_mb_largest_free_orders);
+		kfree(sbi->s_mb_largest_free_orders_locks);
 	}
 	return ret;
 }
@@ -2548,6 +2741,8 @@ int ext4_mb_release(struct super_block *sb)
 	}
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	if (sbi->s_buddy_cache)
 		iput(sbi->s_buddy_cache);
 	if (sbi->s_mb_stats) {
@@ -2575,8 +2770,10 @@ int ext4_mb_release(struct super_block *sb)
 	}
 
 	free_percpu(sbi->s_locality_groups);
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
+		remove_proc_entry("mb_group_stats", sbi->s_proc);
 		remove_proc_entry("mb_groups", sbi->s_proc);
+	}
 
 	return 0;
 }
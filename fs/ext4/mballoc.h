@@ -89,11 +89,21 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_ORDER2_REQS		2
 
+/*
+ * look up groups for 2^N requests (and, as a first try, for requests that
+ * fit in a 2^N extent) in lists of groups by largest free extent, rather
+ * than by scanning the groups one after the other
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
 /*
  * default group prealloc size 512 blocks
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/* number of orders of free extents, i.e. of buddy bitmaps, of a group */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* this links the free block information from group_info */
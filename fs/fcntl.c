@@ -420,6 +420,10 @@ static long do_fcntl(int fd, unsigned int cmd, unsigned long arg,
 	case F_GETPIPE_SZ:
 		err = pipe_fcntl(filp, cmd, arg);
 		break;
+	case F_SETRA_SZ:
+	case F_GETRA_SZ:
+		err = readahead_fcntl(filp, cmd, arg);
+		break;
 	default:
 		break;
 	}
@@ -19,17 +19,26 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/swap.h>
 #include <linux/splice.h>
+#include <linux/hash.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
 
+/*
+ * Request IDs are even, their interrupt requests get the same ID with
+ * the lowest bit set, so that both hash to the same processing bucket
+ */
+#define FUSE_INT_REQ_BIT (1ULL << 0)
+#define FUSE_REQ_ID_STEP (1ULL << 1)
+
 static struct kmem_cache *fuse_req_cachep;
 
 static struct fuse_conn *fuse_get_conn(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount (or when the device is cloned) and is valid
+	 * until the file is released.
 	 */
 	return file->private_data;
 }
@@ -227,12 +236,18 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/* Processing queue bucket of a request, or of its interrupt request */
+static unsigned int fuse_req_hash(u64 unique)
+{
+	return hash_64(unique & ~FUSE_INT_REQ_BIT, FUSE_PQ_HASH_BITS);
+}
+
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
+	fc->reqctr += FUSE_REQ_ID_STEP;
 	/* zero is special */
 	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+		fc->reqctr = FUSE_REQ_ID_STEP;
 
 	return fc->reqctr;
 }
@@ -952,7 +967,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = req->in.h.unique | FUSE_INT_REQ_BIT;
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -1169,7 +1184,8 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list,
+			       &fc->processing[fuse_req_hash(in->h.unique)]);
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -1597,9 +1613,10 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 /* Look up request on processing list by unique ID */
 static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
 {
+	unsigned int hash = fuse_req_hash(unique);
 	struct list_head *entry;
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, &fc->processing[hash]) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
 		if (req->in.h.unique == unique || req->intr_unique == unique)
@@ -1900,10 +1917,13 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	int i;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
 	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		end_requests(fc, &fc->processing[i]);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -1962,7 +1982,10 @@ EXPORT_SYMBOL_GPL(fuse_abort_conn);
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	if (fc && !atomic_dec_and_test(&fc->dev_count)) {
+		/* Other clones of the device still serve the connection */
+		fuse_conn_put(fc);
+	} else if (fc) {
 		spin_lock(&fc->lock);
 		fc->connected = 0;
 		fc->blocked = 0;
@@ -1987,6 +2010,54 @@ static int fuse_dev_fasync(int fd, struct file *file, int on)
 	return fasync_helper(fd, file, on, &fc->fasync);
 }
 
+/*
+ * Attach a freshly opened device file to the connection of another one,
+ * so that multiple threads of the filesystem daemon can each read and
+ * reply to requests through their own file descriptor
+ */
+static long fuse_dev_clone(struct file *file, unsigned int oldfd)
+{
+	struct file *old;
+	struct fuse_conn *fc;
+	int err = -EINVAL;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	/* Only mounted /dev/fuse files, and not the cuse device */
+	fc = fuse_get_conn(old);
+	if (old->f_op != file->f_op || !fc)
+		goto out;
+
+	mutex_lock(&fuse_mutex);
+	if (!file->private_data) {
+		atomic_inc(&fc->dev_count);
+		file->private_data = fuse_conn_get(fc);
+		err = 0;
+	}
+	mutex_unlock(&fuse_mutex);
+ out:
+	fput(old);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	u32 oldfd;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		if (get_user(oldfd, (__u32 __user *) arg))
+			return -EFAULT;
+		return fuse_dev_clone(file, oldfd);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
 const struct file_operations fuse_dev_operations = {
 	.owner		= THIS_MODULE,
 	.llseek		= no_llseek,
@@ -1999,6 +2070,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
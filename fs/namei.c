@@ -32,6 +32,8 @@
 #include <linux/fcntl.h>
 #include <linux/device_cgroup.h>
 #include <linux/fs_struct.h>
+#include <linux/percpu.h>
+#include <linux/sysctl.h>
 #include <asm/uaccess.h>
 
 #include "internal.h"
@@ -402,6 +404,58 @@ EXPORT_SYMBOL(path_put);
  * to restart the path walk from the beginning in ref-walk mode.
  */
 
+/*
+ * How often rcu-walk is tried, how often it has to be restarted in ref-walk
+ * mode, and why it had to be left (or given up on), as shown in
+ * /proc/sys/fs/namei-stats.
+ */
+enum namei_stat_item {
+	NAMEI_RCU_WALK,		/* path walks started in rcu-walk mode */
+	NAMEI_RCU_RESTART,	/* ... and restarted from scratch in ref-walk */
+	NAMEI_DROP_MISS,	/* dentry not in the dcache */
+	NAMEI_DROP_REVALIDATE,	/* ->d_revalidate() needed to block or failed */
+	NAMEI_DROP_PERMISSION,	/* ->permission() or ->check_acl() needed to block */
+	NAMEI_DROP_MOUNT,	/* mount point or automount point to cross */
+	NAMEI_DROP_SYMLINK,	/* symlink to follow */
+	NAMEI_DROP_DOTDOT,	/* ".." could not be followed */
+	NAMEI_DROP_SEQ,		/* concurrent rename or d_seq change */
+	NR_NAMEI_STAT_ITEMS
+};
+
+struct namei_stat_state {
+	unsigned long item[NR_NAMEI_STAT_ITEMS];
+};
+
+static DEFINE_PER_CPU(struct namei_stat_state, namei_stat_states);
+
+static inline void namei_stat_inc(enum namei_stat_item item)
+{
+	this_cpu_inc(namei_stat_states.item[item]);
+}
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+int proc_namei_stats(ctl_table *table, int write, void __user *buffer,
+		     size_t *lenp, loff_t *ppos)
+{
+	unsigned long stats[NR_NAMEI_STAT_ITEMS];
+	ctl_table fake_table;
+	int cpu, i;
+
+	memset(stats, 0, sizeof(stats));
+	for_each_possible_cpu(cpu) {
+		struct namei_stat_state *this = &per_cpu(namei_stat_states, cpu);
+
+		for (i = 0; i < NR_NAMEI_STAT_ITEMS; i++)
+			stats[i] += this->item[i];
+	}
+
+	fake_table = *table;
+	fake_table.data = stats;
+	fake_table.maxlen = sizeof(stats);
+	return proc_doulongvec_minmax(&fake_table, write, buffer, lenp, ppos);
+}
+#endif
+
 /**
  * unlazy_walk - try to switch to ref-walk mode.
  * @nd: nameidata pathwalk data
@@ -535,6 +589,7 @@ static int complete_walk(struct nameidata *nd)
 			spin_unlock(&dentry->d_lock);
 			rcu_read_unlock();
 			br_read_unlock(vfsmount_lock);
+			namei_stat_inc(NAMEI_DROP_SEQ);
 			return -ECHILD;
 		}
 		BUG_ON(nd->inode != dentry->d_inode);
@@ -1151,12 +1206,16 @@ static int do_lookup(struct nameidata *nd, struct qstr *name,
 		unsigned seq;
 		*inode = nd->inode;
 		dentry = __d_lookup_rcu(parent, name, &seq, inode);
-		if (!dentry)
+		if (!dentry) {
+			namei_stat_inc(NAMEI_DROP_MISS);
 			goto unlazy;
+		}
 
 		/* Memory barrier in read_seqcount_begin of child is enough */
-		if (__read_seqcount_retry(&parent->d_seq, nd->seq))
+		if (__read_seqcount_retry(&parent->d_seq, nd->seq)) {
+			namei_stat_inc(NAMEI_DROP_SEQ);
 			return -ECHILD;
+		}
 		nd->seq = seq;
 
 		if (unlikely(dentry->d_flags & DCACHE_OP_REVALIDATE)) {
@@ -1164,15 +1223,17 @@ static int do_lookup(struct nameidata *nd, struct qstr *name,
 			if (unlikely(status <= 0)) {
 				if (status != -ECHILD)
 					need_reval = 0;
+				namei_stat_inc(NAMEI_DROP_REVALIDATE);
 				goto unlazy;
 			}
 		}
 		path->mnt = mnt;
 		path->dentry = dentry;
-		if (unlikely(!__follow_mount_rcu(nd, path, inode)))
-			goto unlazy;
-		if (unlikely(path->dentry->d_flags & DCACHE_NEED_AUTOMOUNT))
+		if (unlikely(!__follow_mount_rcu(nd, path, inode)) ||
+		    unlikely(path->dentry->d_flags & DCACHE_NEED_AUTOMOUNT)) {
+			namei_stat_inc(NAMEI_DROP_MOUNT);
 			goto unlazy;
+		}
 		return 0;
 unlazy:
 		if (unlazy_walk(nd, dentry))
@@ -1232,6 +1293,7 @@ static inline int may_lookup(struct nameidata *nd)
 		int err = exec_permission(nd->inode, IPERM_FLAG_RCU);
 		if (err != -ECHILD)
 			return err;
+		namei_stat_inc(NAMEI_DROP_PERMISSION);
 		if (unlazy_walk(nd, NULL))
 			return -ECHILD;
 	}
@@ -1242,8 +1304,10 @@ static inline int handle_dots(struct nameidata *nd, int type)
 {
 	if (type == LAST_DOTDOT) {
 		if (nd->flags & LOOKUP_RCU) {
-			if (follow_dotdot_rcu(nd))
+			if (follow_dotdot_rcu(nd)) {
+				namei_stat_inc(NAMEI_DROP_DOTDOT);
 				return -ECHILD;
+			}
 		} else
 			follow_dotdot(nd);
 	}
@@ -1287,6 +1351,7 @@ static inline int walk_component(struct nameidata *nd, struct path *path,
 	}
 	if (unlikely(inode->i_op->follow_link) && follow) {
 		if (nd->flags & LOOKUP_RCU) {
+			namei_stat_inc(NAMEI_DROP_SYMLINK);
 			if (unlikely(unlazy_walk(nd, path->dentry))) {
 				terminate_walk(nd);
 				return -ECHILD;
@@ -1613,9 +1678,14 @@ static int path_lookupat(int dfd, const char *name,
 static int do_path_lookup(int dfd, const char *name,
 				unsigned int flags, struct nameidata *nd)
 {
-	int retval = path_lookupat(dfd, name, flags | LOOKUP_RCU, nd);
-	if (unlikely(retval == -ECHILD))
+	int retval;
+
+	namei_stat_inc(NAMEI_RCU_WALK);
+	retval = path_lookupat(dfd, name, flags | LOOKUP_RCU, nd);
+	if (unlikely(retval == -ECHILD)) {
+		namei_stat_inc(NAMEI_RCU_RESTART);
 		retval = path_lookupat(dfd, name, flags, nd);
+	}
 	if (unlikely(retval == -ESTALE))
 		retval = path_lookupat(dfd, name, flags | LOOKUP_REVAL, nd);
 
@@ -2292,9 +2362,12 @@ struct file *do_filp_open(int dfd, const char *pathname,
 	struct nameidata nd;
 	struct file *filp;
 
+	namei_stat_inc(NAMEI_RCU_WALK);
 	filp = path_openat(dfd, pathname, &nd, op, flags | LOOKUP_RCU);
-	if (unlikely(filp == ERR_PTR(-ECHILD)))
+	if (unlikely(filp == ERR_PTR(-ECHILD))) {
+		namei_stat_inc(NAMEI_RCU_RESTART);
 		filp = path_openat(dfd, pathname, &nd, op, flags);
+	}
 	if (unlikely(filp == ERR_PTR(-ESTALE)))
 		filp = path_openat(dfd, pathname, &nd, op, flags | LOOKUP_REVAL);
 	return filp;
@@ -2314,9 +2387,12 @@ struct file *do_file_open_root(struct dentry *dentry, struct vfsmount *mnt,
 	if (dentry->d_inode->i_op->follow_link && op->intent & LOOKUP_OPEN)
 		return ERR_PTR(-ELOOP);
 
+	namei_stat_inc(NAMEI_RCU_WALK);
 	file = path_openat(-1, name, &nd, op, flags | LOOKUP_RCU);
-	if (unlikely(file == ERR_PTR(-ECHILD)))
+	if (unlikely(file == ERR_PTR(-ECHILD))) {
+		namei_stat_inc(NAMEI_RCU_RESTART);
 		file = path_openat(-1, name, &nd, op, flags);
+	}
 	if (unlikely(file == ERR_PTR(-ESTALE)))
 		file = path_openat(-1, name, &nd, op, flags | LOOKUP_REVAL);
 	return file;
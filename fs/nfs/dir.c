@@ -2166,6 +2166,33 @@ out_zap:
 	return -ENOENT;
 }
 
+/*
+ * Lock-less variant of nfs_access_get_cached() for rcu-walk: it neither
+ * reorders the LRU nor frees stale entries, it just fails with -ECHILD so
+ * that ref-walk can do all of that.
+ */
+static int nfs_access_get_cached_rcu(struct inode *inode, struct rpc_cred *cred, struct nfs_access_entry *res)
+{
+	struct nfs_inode *nfsi = NFS_I(inode);
+	struct nfs_access_entry *cache;
+	int err = -ECHILD;
+
+	spin_lock(&inode->i_lock);
+	if (nfsi->cache_validity & NFS_INO_INVALID_ACCESS)
+		goto out;
+	cache = nfs_access_search_rbtree(inode, cred);
+	if (cache == NULL)
+		goto out;
+	if (!nfs_have_delegated_attributes(inode) &&
+	    !time_in_range_open(jiffies, cache->jiffies, cache->jiffies + nfsi->attrtimeo))
+		goto out;
+	res->mask = cache->mask;
+	err = 0;
+out:
+	spin_unlock(&inode->i_lock);
+	return err;
+}
+
 static void nfs_access_add_rbtree(struct inode *inode, struct nfs_access_entry *set)
 {
 	struct nfs_inode *nfsi = NFS_I(inode);
@@ -2226,6 +2253,24 @@ static void nfs_access_add_cache(struct inode *inode, struct nfs_access_entry *s
 	}
 }
 
+static int nfs_do_access_rcu(struct inode *inode, int mask)
+{
+	struct nfs_access_entry cache;
+	struct rpc_cred *cred;
+	int status;
+
+	cred = rpc_lookup_cred_nonblock();
+	if (IS_ERR(cred))
+		return PTR_ERR(cred);
+	status = nfs_access_get_cached_rcu(inode, cred, &cache);
+	put_rpccred(cred);
+	if (status != 0)
+		return status;
+	if ((mask & ~cache.mask & (MAY_READ | MAY_WRITE | MAY_EXEC)) == 0)
+		return 0;
+	return -EACCES;
+}
+
 static int nfs_do_access(struct inode *inode, struct rpc_cred *cred, int mask)
 {
 	struct nfs_access_entry cache;
@@ -2278,10 +2323,8 @@ int nfs_permission(struct inode *inode, int mask, unsigned int flags)
 	struct rpc_cred *cred;
 	int res = 0;
 
-	if (flags & IPERM_FLAG_RCU)
-		return -ECHILD;
-
-	nfs_inc_stats(inode, NFSIOS_VFSACCESS);
+	if (!(flags & IPERM_FLAG_RCU))
+		nfs_inc_stats(inode, NFSIOS_VFSACCESS);
 
 	if ((mask & (MAY_READ | MAY_WRITE | MAY_EXEC)) == 0)
 		goto out;
@@ -2312,6 +2355,12 @@ force_lookup:
 	if (!NFS_PROTO(inode)->access)
 		goto out_notsup;
 
+	/* Without blocking, all we can use are the cached access rights */
+	if (flags & IPERM_FLAG_RCU) {
+		res = nfs_do_access_rcu(inode, mask);
+		goto out;
+	}
+
 	cred = rpc_lookup_cred();
 	if (!IS_ERR(cred)) {
 		res = nfs_do_access(inode, cred, mask);
@@ -2326,6 +2375,9 @@ out:
 		inode->i_sb->s_id, inode->i_ino, mask, res);
 	return res;
 out_notsup:
+	if (flags & IPERM_FLAG_RCU)
+		return -ECHILD;
+
 	res = nfs_revalidate_inode(NFS_SERVER(inode), inode);
 	if (res == 0)
 		res = generic_permission(inode, mask, flags, NULL);
@@ -4417,6 +4417,10 @@ static int ocfs2_vfs_reflink(struct dentry *old_dentry, struct inode *dir,
 	if (IS_APPEND(inode) || IS_IMMUTABLE(inode))
 		return -EPERM;
 
+	/* The blocks of a swap file must not become shared. */
+	if (IS_SWAPFILE(inode))
+		return -ETXTBSY;
+
 	/* Only regular files can be reflinked. */
 	if (!S_ISREG(inode->i_mode))
 		return -EPERM;
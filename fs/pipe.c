@@ -195,22 +195,37 @@ static void iov_fault_in_pages_read(struct iovec *iov, unsigned long len)
 	}
 }
 
-static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
-				  struct pipe_buffer *buf)
+/*
+ * Pages the writers copy into come from the pipe's cache of released pages
+ * first, so that a busy pipe doesn't go back to the page allocator for
+ * every buffer it moves.
+ */
+static struct page *pipe_get_tmp_page(struct pipe_inode_info *pipe)
 {
-	struct page *page = buf->page;
+	if (pipe->nr_tmp_pages)
+		return pipe->tmp_pages[--pipe->nr_tmp_pages];
+	return alloc_page(GFP_HIGHUSER);
+}
 
+static void pipe_put_tmp_page(struct pipe_inode_info *pipe, struct page *page)
+{
 	/*
-	 * If nobody else uses this page, and we don't already have a
-	 * temporary page, let's keep track of it as a one-deep
-	 * allocation cache. (Otherwise just release our reference to it)
+	 * If nobody else uses this page, and the cache isn't full yet, let's
+	 * keep it for the next write. (Otherwise just release our reference
+	 * to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
-		pipe->tmp_page = page;
+	if (page_count(page) == 1 && pipe->nr_tmp_pages < PIPE_TMP_PAGES)
+		pipe->tmp_pages[pipe->nr_tmp_pages++] = page;
 	else
 		page_cache_release(page);
 }
 
+static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
+				  struct pipe_buffer *buf)
+{
+	pipe_put_tmp_page(pipe, buf->page);
+}
+
 /**
  * generic_pipe_buf_map - virtually map a pipe buffer
  * @pipe:	the pipe that the buffer belongs to
@@ -458,6 +473,29 @@ redo:
 	return ret;
 }
 
+static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages);
+
+/*
+ * Called by a writer that found the pipe full: grow it, if that keeps
+ * happening. Returns true if there's room in the pipe now.
+ */
+static bool pipe_auto_grow(struct pipe_inode_info *pipe)
+{
+	unsigned int nr_pages = pipe->buffers * 2;
+
+	if (!pipe->auto_size || ++pipe->write_stalls < PIPE_GROW_STALLS)
+		return false;
+	pipe->write_stalls = 0;
+
+	if (nr_pages > PIPE_AUTO_MAX_BUFFERS ||
+	    nr_pages > (pipe_max_size >> PAGE_SHIFT)) {
+		pipe->auto_size = false;
+		return false;
+	}
+
+	return pipe_set_size(pipe, nr_pages) > 0;
+}
+
 static ssize_t
 pipe_write(struct kiocb *iocb, const struct iovec *_iov,
 	    unsigned long nr_segs, loff_t ppos)
@@ -540,17 +578,14 @@ redo1:
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
 			char *src;
 			int error, atomic = 1;
 
-			if (!page) {
-				page = alloc_page(GFP_HIGHUSER);
-				if (unlikely(!page)) {
-					ret = ret ? : -ENOMEM;
-					break;
-				}
-				pipe->tmp_page = page;
+			page = pipe_get_tmp_page(pipe);
+			if (unlikely(!page)) {
+				ret = ret ? : -ENOMEM;
+				break;
 			}
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
@@ -581,6 +616,7 @@ redo2:
 					atomic = 0;
 					goto redo2;
 				}
+				pipe_put_tmp_page(pipe, page);
 				if (!ret)
 					ret = error;
 				break;
@@ -593,7 +629,6 @@ redo2:
 			buf->offset = 0;
 			buf->len = chars;
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
 
 			total_len -= chars;
 			if (!total_len)
@@ -601,6 +636,8 @@ redo2:
 		}
 		if (bufs < pipe->buffers)
 			continue;
+		if (pipe_auto_grow(pipe))
+			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret)
 				ret = -EAGAIN;
@@ -902,6 +939,7 @@ struct pipe_inode_info * alloc_pipe_info(struct inode *inode)
 			pipe->r_counter = pipe->w_counter = 1;
 			pipe->inode = inode;
 			pipe->buffers = PIPE_DEF_BUFFERS;
+			pipe->auto_size = true;
 			return pipe;
 		}
 		kfree(pipe);
@@ -919,8 +957,8 @@ void __free_pipe_info(struct pipe_inode_info *pipe)
 		if (buf->ops)
 			buf->ops->release(pipe, buf);
 	}
-	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+	for (i = 0; i < pipe->nr_tmp_pages; i++)
+		__free_page(pipe->tmp_pages[i]);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1237,6 +1275,9 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 			goto out;
 		}
 		ret = pipe_set_size(pipe, nr_pages);
+		/* the size was chosen by the user, stick to it */
+		if (ret > 0)
+			pipe->auto_size = false;
 		break;
 		}
 	case F_GETPIPE_SZ:
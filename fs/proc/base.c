@@ -1899,7 +1899,7 @@ out:
 	return ~0U;
 }
 
-#define PROC_FDINFO_MAX 64
+#define PROC_FDINFO_MAX 128
 
 static int proc_fd_info(struct inode *inode, struct path *path, char *info)
 {
@@ -1927,9 +1927,16 @@ static int proc_fd_info(struct inode *inode, struct path *path, char *info)
 			if (info)
 				snprintf(info, PROC_FDINFO_MAX,
 					 "pos:\t%lli\n"
-					 "flags:\t0%o\n",
+					 "flags:\t0%o\n"
+					 "ra_size:\t%lu\n"
+					 "ra_hits:\t%lu\n"
+					 "ra_misses:\t%lu\n",
 					 (long long) file->f_pos,
-					 file->f_flags);
+					 file->f_flags,
+					 (unsigned long)file->f_ra.ra_pages
+							<< PAGE_SHIFT,
+					 file->f_ra.hits,
+					 file->f_ra.misses);
 			spin_unlock(&files->file_lock);
 			put_files_struct(files);
 			return 0;
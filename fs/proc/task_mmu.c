@@ -61,6 +61,10 @@ void task_mem(struct seq_file *m, struct mm_struct *mm)
 		mm->stack_vm << (PAGE_SHIFT-10), text, lib,
 		(PTRS_PER_PTE*sizeof(pte_t)*mm->nr_ptes) >> 10,
 		swap << (PAGE_SHIFT-10));
+#ifdef CONFIG_KSM
+	seq_printf(m, "VmKsm:\t%8lu kB\n",
+		mm->ksm_merging_pages << (PAGE_SHIFT-10));
+#endif
 }
 
 unsigned long task_vsize(struct mm_struct *mm)
@@ -31,6 +31,7 @@
 #include <linux/uio.h>
 #include <linux/security.h>
 #include <linux/gfp.h>
+#include <linux/backing-dev.h>
 
 /*
  * Attempt to steal a page from a pipe buffer. This should perhaps go into
@@ -716,6 +717,67 @@ static int pipe_to_sendpage(struct pipe_inode_info *pipe,
  * SPLICE_F_MOVE isn't set, or we cannot move the page, we simply create
  * a new page in the output file page cache and fill/dirty that.
  */
+
+/*
+ * Try to insert the (full, page aligned) page of @buf into @mapping at
+ * @index, for pipe_to_file() to find it in ->write_begin() and skip the
+ * copy. The page has to be stealable from the pipe (e.g. a received
+ * socket page, or a page cache page nobody else uses), and fit the
+ * mapping. Returns true if the page was inserted.
+ */
+static bool splice_move_page(struct pipe_inode_info *pipe,
+			     struct pipe_buffer *buf,
+			     struct address_space *mapping, pgoff_t index)
+{
+	struct page *page = buf->page;
+
+	if (PageCompound(page) || mapping_cap_swap_backed(mapping) ||
+	    (PageHighMem(page) && !(mapping_gfp_mask(mapping) & __GFP_HIGHMEM)))
+		return false;
+
+	/* on success, the page comes back locked */
+	if (buf->ops->steal(pipe, buf))
+		return false;
+
+	if (page->mapping || page_mapped(page) || page_has_private(page))
+		goto out_unlock;
+
+	/*
+	 * The page holds the whole data to be written there, so it may be
+	 * found uptodate rather than read in before ->write_end() is done.
+	 */
+	ClearPageError(page);
+	SetPageUptodate(page);
+	if (add_to_page_cache_locked(page, mapping, index, GFP_KERNEL))
+		goto out_unlock;
+
+	if (!(buf->flags & PIPE_BUF_FLAG_LRU)) {
+		lru_cache_add_file(page);
+		buf->flags |= PIPE_BUF_FLAG_LRU;
+	}
+	unlock_page(page);
+	return true;
+
+out_unlock:
+	unlock_page(page);
+	return false;
+}
+
+/*
+ * ->write_begin() failed after the page was moved in: its data never made
+ * it to the file, so don't leave it in the page cache.
+ */
+static void splice_unmove_page(struct address_space *mapping,
+			       struct page *page)
+{
+	lock_page(page);
+	if (page->mapping == mapping) {
+		ClearPageUptodate(page);
+		delete_from_page_cache(page);
+	}
+	unlock_page(page);
+}
+
 int pipe_to_file(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
 		 struct splice_desc *sd)
 {
@@ -723,6 +785,7 @@ int pipe_to_file(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
 	struct address_space *mapping = file->f_mapping;
 	unsigned int offset, this_len;
 	struct page *page;
+	bool moved = false;
 	void *fsdata;
 	int ret;
 
@@ -732,10 +795,18 @@ int pipe_to_file(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
 	if (this_len + offset > PAGE_CACHE_SIZE)
 		this_len = PAGE_CACHE_SIZE - offset;
 
+	if ((sd->flags & SPLICE_F_MOVE) && !offset && !buf->offset &&
+	    this_len == PAGE_CACHE_SIZE)
+		moved = splice_move_page(pipe, buf, mapping,
+					 sd->pos >> PAGE_CACHE_SHIFT);
+
 	ret = pagecache_write_begin(file, mapping, sd->pos, this_len,
 				AOP_FLAG_UNINTERRUPTIBLE, &page, &fsdata);
-	if (unlikely(ret))
+	if (unlikely(ret)) {
+		if (moved)
+			splice_unmove_page(mapping, buf->page);
 		goto out;
+	}
 
 	if (buf->page != page) {
 		/*
@@ -22,7 +22,9 @@
  */
 
 #include <linux/types.h>
-#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
 #include <linux/slab.h>
 #include <linux/buffer_head.h>
 
@@ -36,6 +38,27 @@
  * Squashfs, allowing multiple decompressors to be easily supported
  */
 
+/*
+ * Each mounted filesystem has a pool of decompressor streams, so that
+ * blocks can be decompressed in parallel.  The pool starts with one
+ * stream, and grows on demand up to one stream per online CPU.  Streams
+ * sleep waiting for buffers, which is why they aren't per-CPU.
+ */
+struct squashfs_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+struct squashfs_stream_pool {
+	void			*comp_opts;
+	int			comp_opts_len;
+	spinlock_t		lock;
+	struct list_head	idle;
+	int			streams;
+	int			max_streams;
+	wait_queue_head_t	wait;
+};
+
 static const struct squashfs_decompressor squashfs_lzma_unsupported_comp_ops = {
 	NULL, NULL, NULL, LZMA_COMPRESSION, "lzma", 0
 };
@@ -52,6 +75,12 @@ static const struct squashfs_decompressor squashfs_xz_comp_ops = {
 };
 #endif
 
+#ifndef CONFIG_SQUASHFS_LZ4
+static const struct squashfs_decompressor squashfs_lz4_comp_ops = {
+	NULL, NULL, NULL, LZ4_COMPRESSION, "lz4", 0
+};
+#endif
+
 static const struct squashfs_decompressor squashfs_unknown_comp_ops = {
 	NULL, NULL, NULL, 0, "unknown", 0
 };
@@ -60,6 +89,7 @@ static const struct squashfs_decompressor *decompressor[] = {
 	&squashfs_zlib_comp_ops,
 	&squashfs_lzo_comp_ops,
 	&squashfs_xz_comp_ops,
+	&squashfs_lz4_comp_ops,
 	&squashfs_lzma_unsupported_comp_ops,
 	&squashfs_unknown_comp_ops
 };
@@ -77,10 +107,116 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
+static struct squashfs_stream *squashfs_stream_alloc(
+	struct squashfs_sb_info *msblk, struct squashfs_stream_pool *pool)
+{
+	struct squashfs_stream *stream;
+	void *strm;
+
+	stream = kmalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	strm = msblk->decompressor->init(msblk, pool->comp_opts,
+		pool->comp_opts_len);
+	if (IS_ERR(strm)) {
+		kfree(stream);
+		return strm;
+	}
+
+	stream->stream = strm;
+	return stream;
+}
+
+
+/*
+ * Get an idle stream from the pool, allocating a new one if all of them
+ * are busy and the pool may still grow, or else waiting for one
+ */
+static struct squashfs_stream *squashfs_stream_get(
+	struct squashfs_sb_info *msblk, struct squashfs_stream_pool *pool)
+{
+	struct squashfs_stream *stream;
+
+	while (1) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->idle)) {
+			stream = list_first_entry(&pool->idle,
+				struct squashfs_stream, list);
+			list_del(&stream->list);
+			spin_unlock(&pool->lock);
+			return stream;
+		}
+
+		if (pool->streams < pool->max_streams) {
+			pool->streams++;
+			spin_unlock(&pool->lock);
+
+			stream = squashfs_stream_alloc(msblk, pool);
+			if (!IS_ERR(stream))
+				return stream;
+
+			/* Stop growing, and wait for one of the others */
+			spin_lock(&pool->lock);
+			pool->streams--;
+			pool->max_streams = pool->streams;
+		}
+		spin_unlock(&pool->lock);
+
+		wait_event(pool->wait, !list_empty(&pool->idle));
+	}
+}
+
+
+static void squashfs_stream_put(struct squashfs_stream_pool *pool,
+	struct squashfs_stream *stream)
+{
+	spin_lock(&pool->lock);
+	list_add(&stream->list, &pool->idle);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+	struct squashfs_stream *stream = squashfs_stream_get(msblk, pool);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, stream->stream, buffer,
+		bh, b, offset, length, srclength, pages);
+	squashfs_stream_put(pool, stream);
+
+	return res;
+}
+
+
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk, void *s)
+{
+	struct squashfs_stream_pool *pool = s;
+	struct squashfs_stream *stream, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(stream, next, &pool->idle, list) {
+		msblk->decompressor->free(stream->stream);
+		kfree(stream);
+	}
+	kfree(pool->comp_opts);
+	kfree(pool);
+}
+
+
 void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
+	struct squashfs_stream_pool *pool;
+	struct squashfs_stream *stream;
+	void *buffer = NULL;
 	int length = 0;
 
 	/*
@@ -96,15 +232,37 @@ void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 			PAGE_CACHE_SIZE, 1);
 
 		if (length < 0) {
-			strm = ERR_PTR(length);
-			goto finished;
+			kfree(buffer);
+			return ERR_PTR(length);
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL) {
+		kfree(buffer);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	pool->comp_opts = buffer;
+	pool->comp_opts_len = length;
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->idle);
+	init_waitqueue_head(&pool->wait);
+
+	/*
+	 * Allocate the first stream up front, this also checks the
+	 * compressor options
+	 */
+	stream = squashfs_stream_alloc(msblk, pool);
+	if (IS_ERR(stream)) {
+		kfree(buffer);
+		kfree(pool);
+		return stream;
+	}
 
-finished:
-	kfree(buffer);
+	list_add(&stream->list, &pool->idle);
+	pool->streams = 1;
+	pool->max_streams = num_online_cpus();
 
-	return strm;
+	return pool;
 }
@@ -47,6 +47,7 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/highmem.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -371,6 +372,78 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a full datablock straight into the page cache, rather than
+ * through the read_page cache (which has a single entry, and so serialises
+ * readers of different blocks).  Returns -EAGAIN if some page of the block
+ * can't be grabbed without blocking, or is in highmem, in which case the
+ * caller falls back to the read_page cache.  The page being read is left
+ * locked.
+ */
+static int squashfs_readpage_block(struct page *target_page, u64 block,
+	int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int pages = msblk->block_size >> PAGE_CACHE_SHIFT;
+	int start_index = target_page->index & ~(pages - 1);
+	struct page **page;
+	void **pageaddr;
+	int i, n, res = -EAGAIN;
+
+	page = kmalloc(pages * sizeof(*page), GFP_KERNEL);
+	pageaddr = kmalloc(pages * sizeof(*pageaddr), GFP_KERNEL);
+	if (page == NULL || pageaddr == NULL)
+		goto out;
+
+	for (n = 0; n < pages; n++) {
+		page[n] = (start_index + n == target_page->index) ?
+			target_page : grab_cache_page_nowait(
+				target_page->mapping, start_index + n);
+		if (page[n] == NULL)
+			break;
+
+		if (PageHighMem(page[n])) {
+			n++;
+			break;
+		}
+		pageaddr[n] = page_address(page[n]);
+	}
+
+	if (n == pages && !PageHighMem(page[n - 1])) {
+		res = squashfs_read_data(inode->i_sb, pageaddr, block, bsize,
+			NULL, msblk->block_size, pages);
+		if (res >= 0 && res < msblk->block_size) {
+			/* Shouldn't happen for a full block, zero the rest */
+			for (i = res >> PAGE_CACHE_SHIFT; i < pages; i++) {
+				int offset = max_t(int, res -
+					(i << PAGE_CACHE_SHIFT), 0);
+				memset(pageaddr[i] + offset, 0,
+					PAGE_CACHE_SIZE - offset);
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (res >= 0) {
+			flush_dcache_page(page[i]);
+			SetPageUptodate(page[i]);
+		}
+		if (page[i] != target_page) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+	}
+
+	if (res > 0)
+		res = 0;
+out:
+	kfree(pageaddr);
+	kfree(page);
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -409,6 +482,21 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				 msblk->block_size;
 			sparse = 1;
 		} else {
+			/*
+			 * Decompress full datablocks directly into the page
+			 * cache if possible
+			 */
+			if (index < file_end) {
+				int res = squashfs_readpage_block(page, block,
+								bsize);
+				if (res == 0) {
+					unlock_page(page);
+					return 0;
+				}
+				if (res != -EAGAIN)
+					goto error_out;
+			}
+
 			/*
 			 * Read and decompress datablock.
 			 */
@@ -6,6 +6,7 @@
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
 #include <linux/rcupdate.h>
+#include <linux/wait.h>
 
 #include <asm/atomic.h>
 
@@ -123,6 +124,12 @@ struct kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/*
+	 * Page a buffered read waits on to come uptodate, rather than
+	 * blocking; unlocking the page kicks the iocb.
+	 */
+	struct wait_bit_queue	ki_wait_page;
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
@@ -67,6 +67,8 @@ extern void bus_remove_file(struct bus_type *, struct bus_attribute *);
  * @resume:	Called to bring a device on this bus out of sleep mode.
  * @pm:		Power management operations of this bus, callback the specific
  *		device driver's pm-ops.
+ * @async_probe: Probe the devices of the drivers of this bus asynchronously,
+ *		unless a driver asks otherwise through its @probe_type.
  * @p:		The private data of the driver core, only the driver core can
  *		touch this.
  *
@@ -96,6 +98,8 @@ struct bus_type {
 
 	const struct dev_pm_ops *pm;
 
+	bool async_probe;	/* probe drivers asynchronously by default */
+
 	struct subsys_private *p;
 };
 
@@ -151,6 +155,24 @@ extern int bus_unregister_notifier(struct bus_type *bus,
 extern struct kset *bus_get_kset(struct bus_type *bus);
 extern struct klist *bus_get_device_klist(struct bus_type *bus);
 
+/**
+ * enum probe_type - device driver probe type to try
+ * @PROBE_DEFAULT_STRATEGY: Probe asynchronously if the bus asks for it.
+ * @PROBE_PREFER_ASYNCHRONOUS: Probe asynchronously. Such probes overlap
+ *	with each other and with the rest of the boot, so they must not
+ *	rely on the order devices are probed in, beyond @probe_after.
+ * @PROBE_FORCE_SYNCHRONOUS: Probe synchronously, whatever the bus asks.
+ *
+ * Asynchronous probes are done when wait_for_device_probe() returns. They
+ * are not supported for drivers whose probe needs the lock of the parent
+ * device, like USB interface drivers.
+ */
+enum probe_type {
+	PROBE_DEFAULT_STRATEGY,
+	PROBE_PREFER_ASYNCHRONOUS,
+	PROBE_FORCE_SYNCHRONOUS,
+};
+
 /**
  * struct device_driver - The basic device driver structure
  * @name:	Name of the device driver.
@@ -158,6 +180,10 @@ extern struct klist *bus_get_device_klist(struct bus_type *bus);
  * @owner:	The module owner.
  * @mod_name:	Used for built-in modules.
  * @suppress_bind_attrs: Disables bind/unbind via sysfs.
+ * @probe_type:	Whether the driver probes asynchronously, see enum probe_type.
+ * @probe_after: Drivers of the same bus this driver depends on. The probes
+ *		of this driver wait for their asynchronous probes scheduled so
+ *		far. The dependencies must not be circular.
  * @of_match_table: The open firmware table.
  * @probe:	Called to query the existence of a specific device,
  *		whether this driver can work with it, and bind the driver
@@ -190,6 +216,13 @@ struct device_driver {
 	const char		*mod_name;	/* used for built-in modules */
 
 	bool suppress_bind_attrs;	/* disables bind/unbind via sysfs */
+	enum probe_type probe_type;
+
+	/*
+	 * NULL terminated names of drivers on the same bus whose pending
+	 * asynchronous probes must be done before this driver probes.
+	 */
+	const char * const *probe_after;
 
 	const struct of_device_id	*of_match_table;
 
@@ -27,6 +27,12 @@
 #define F_SETPIPE_SZ	(F_LINUX_SPECIFIC_BASE + 7)
 #define F_GETPIPE_SZ	(F_LINUX_SPECIFIC_BASE + 8)
 
+/*
+ * Set and get the maximum readahead window of a file, in bytes
+ */
+#define F_SETRA_SZ	(F_LINUX_SPECIFIC_BASE + 9)
+#define F_GETRA_SZ	(F_LINUX_SPECIFIC_BASE + 10)
+
 /*
  * Types of directory notifications that may be requested.
  */
@@ -84,10 +84,13 @@ struct idr {
  * DOC: idr sync
  * idr synchronization (stolen from radix-tree.h)
  *
- * idr_find() is able to be called locklessly, using RCU. The caller must
- * ensure calls to this function are made within rcu_read_lock() regions.
- * Other readers (lock-free or otherwise) and modifications may be running
- * concurrently.
+ * idr_find(), idr_get_next() and idr_for_each() are able to be called
+ * locklessly, using RCU. The caller must ensure calls to these functions
+ * are made within rcu_read_lock() regions. Other readers (lock-free or
+ * otherwise) and modifications may be running concurrently; idr layers
+ * are only freed after a grace period, so a lockless walk never touches
+ * freed memory, it may just miss an id that is being added or removed.
+ * Allocation and removal still need to be serialized by the caller.
  *
  * It is still required that the caller manage the synchronization and
  * lifetimes of the items. So if RCU lock-free lookups are used, typically
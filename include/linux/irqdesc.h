@@ -59,7 +59,9 @@ struct irq_desc {
 #ifdef CONFIG_GENERIC_PENDING_IRQ
 	cpumask_var_t		pending_mask;
 #endif
+	cpumask_var_t		thread_affinity; /* empty: follow the irq */
 #endif
+	int			thread_prio;	/* 0: the default priority */
 	unsigned long		threads_oneshot;
 	atomic_t		threads_active;
 	wait_queue_head_t       wait_for_threads;
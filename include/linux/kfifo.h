@@ -48,16 +48,21 @@
  *  For multiple writer and one reader there is only a need to lock the writer.
  * And vice versa for only one writer and multiple reader there is only a need
  * to lock the reader.
+ *  Alternatively, multiple writers can use kfifo_in_mp() without locking,
+ * and multiple readers kfifo_out_mc(). A fifo written with kfifo_in_mp()
+ * must not be written with any other kfifo function.
  */
 
 #include <linux/kernel.h>
 #include <linux/spinlock.h>
 #include <linux/stddef.h>
 #include <linux/scatterlist.h>
+#include <linux/uio.h>
 
 struct __kfifo {
 	unsigned int	in;
 	unsigned int	out;
+	unsigned int	reserved;
 	unsigned int	mask;
 	unsigned int	esize;
 	void		*data;
@@ -139,6 +144,7 @@ struct kfifo_rec_ptr_2 __STRUCT_KFIFO_PTR(unsigned char, 2, void);
 	struct __kfifo *__kfifo = &__tmp->kfifo; \
 	__kfifo->in = 0; \
 	__kfifo->out = 0; \
+	__kfifo->reserved = 0; \
 	__kfifo->mask = __is_kfifo_ptr(__tmp) ? 0 : ARRAY_SIZE(__tmp->buf) - 1;\
 	__kfifo->esize = sizeof(*__tmp->buf); \
 	__kfifo->data = __is_kfifo_ptr(__tmp) ?  NULL : __tmp->buf; \
@@ -159,6 +165,7 @@ struct kfifo_rec_ptr_2 __STRUCT_KFIFO_PTR(unsigned char, 2, void);
 			{ \
 			.in	= 0, \
 			.out	= 0, \
+			.reserved = 0, \
 			.mask	= __is_kfifo_ptr(&(fifo)) ? \
 				  0 : \
 				  ARRAY_SIZE((fifo).buf) - 1, \
@@ -221,7 +228,7 @@ __kfifo_int_must_check_helper(int val)
 #define kfifo_reset(fifo) \
 (void)({ \
 	typeof((fifo) + 1) __tmp = (fifo); \
-	__tmp->kfifo.in = __tmp->kfifo.out = 0; \
+	__tmp->kfifo.in = __tmp->kfifo.out = __tmp->kfifo.reserved = 0; \
 })
 
 /**
@@ -601,6 +608,114 @@ __kfifo_uint_must_check_helper( \
 #define kfifo_out_locked(fifo, buf, n, lock) \
 		kfifo_out_spinlocked(fifo, buf, n, lock)
 
+/**
+ * kfifo_in_mp - put data into the fifo, with multiple writers
+ * @fifo: address of the fifo to be used
+ * @buf: the data to be added
+ * @n: number of elements to be added
+ *
+ * This macro copies the given buffer into the fifo and returns the
+ * number of copied elements, like kfifo_in(). For record fifos, the
+ * record is either copied entirely or not at all.
+ *
+ * Any number of writers may call this macro concurrently without extra
+ * locking, from any context but NMI. All writers of the fifo must use it.
+ */
+#define	kfifo_in_mp(fifo, buf, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof((buf) + 1) __buf = (buf); \
+	unsigned long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	if (0) { \
+		typeof(__tmp->ptr_const) __dummy __attribute__ ((unused)); \
+		__dummy = (typeof(__buf))NULL; \
+	} \
+	__kfifo_in_mp(__kfifo, __buf, __n, __recsize); \
+})
+
+/**
+ * kfifo_out_mc - get data from the fifo, with multiple readers
+ * @fifo: address of the fifo to be used
+ * @buf: pointer to the storage buffer
+ * @n: max. number of elements to get
+ *
+ * This macro gets some data from the fifo and returns the number of
+ * elements copied, like kfifo_out().
+ *
+ * Any number of readers may call this macro concurrently without extra
+ * locking. Readers using other kfifo functions still need to be locked
+ * against each other and against the users of this macro.
+ */
+#define	kfifo_out_mc(fifo, buf, n) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof((buf) + 1) __buf = (buf); \
+	unsigned long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	if (0) { \
+		typeof(__tmp->ptr) __dummy = NULL; \
+		__buf = __dummy; \
+	} \
+	__kfifo_out_mc(__kfifo, __buf, __n, __recsize); \
+}) \
+)
+
+/**
+ * kfifo_in_vec - put several buffers into the fifo at once
+ * @fifo: address of the fifo to be used
+ * @vec: array of the buffers to be added
+ * @nr: number of buffers
+ *
+ * For record fifos, every buffer becomes one record. For other fifos, the
+ * elements of the buffers are appended to the fifo; iov_len is in bytes
+ * and must be a multiple of the element size.
+ *
+ * Buffers are added in order, while they fit entirely, and the fifo is
+ * only updated once. The macro returns the number of buffers added.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define	kfifo_in_vec(fifo, vec, nr) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const struct kvec *__vec = (vec); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	__kfifo_in_vec(__kfifo, __vec, (nr), __recsize); \
+})
+
+/**
+ * kfifo_out_vec - get data from the fifo into several buffers at once
+ * @fifo: address of the fifo to be used
+ * @vec: array of the buffers to fill
+ * @nr: number of buffers
+ *
+ * For record fifos, every buffer gets one record, truncated to the buffer
+ * size. For other fifos, every buffer is filled with as many elements as
+ * fit. iov_len is updated to the number of bytes stored in each buffer.
+ *
+ * The fifo is only updated once. The macro returns the number of buffers
+ * filled.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define	kfifo_out_vec(fifo, vec, nr) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	struct kvec *__vec = (vec); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	__kfifo_out_vec(__kfifo, __vec, (nr), __recsize); \
+}) \
+)
+
 /**
  * kfifo_from_user - puts some data from user space into the fifo
  * @fifo: address of the fifo to be used
@@ -849,4 +964,16 @@ extern unsigned int __kfifo_out_peek_r(struct __kfifo *fifo,
 
 extern unsigned int __kfifo_max_r(unsigned int len, size_t recsize);
 
+extern unsigned int __kfifo_in_mp(struct __kfifo *fifo,
+	const void *buf, unsigned int len, size_t recsize);
+
+extern unsigned int __kfifo_out_mc(struct __kfifo *fifo,
+	void *buf, unsigned int len, size_t recsize);
+
+extern unsigned int __kfifo_in_vec(struct __kfifo *fifo,
+	const struct kvec *vec, unsigned int nr, size_t recsize);
+
+extern unsigned int __kfifo_out_vec(struct __kfifo *fifo,
+	struct kvec *vec, unsigned int nr, size_t recsize);
+
 #endif
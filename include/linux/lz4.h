@@ -0,0 +1,41 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  LZ4 is an LZ77-type compressor with a fixed, byte-oriented encoding
+ *  which trades some compression ratio for very fast decompression.
+ *  This implements the LZ4 block format; see lib/lz4/lz4defs.h.
+ */
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(unsigned int))
+
+/* Worst case size of the compressed form of x bytes */
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * Compress src_len bytes from src into dst.  On entry *dst_len is the size
+ * of dst, which is always large enough if it is lz4_compressbound(src_len);
+ * on success it is set to the compressed length.  This requires 'wrkmem'
+ * of size LZ4_MEM_COMPRESS.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression with overrun testing: on entry *dst_len is the size of
+ * dst, on success it is set to the decompressed length.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK			0
+#define LZ4_E_ERROR			(-1)
+#define LZ4_E_INPUT_OVERRUN		(-4)
+#define LZ4_E_OUTPUT_OVERRUN		(-5)
+#define LZ4_E_LOOKBEHIND_OVERRUN	(-6)
+
+#endif
@@ -7,6 +7,7 @@
 #include <linux/wait.h>
 
 struct kmem_cache;
+struct mempool_pcp;
 
 typedef void * (mempool_alloc_t)(gfp_t gfp_mask, void *pool_data);
 typedef void (mempool_free_t)(void *element, void *pool_data);
@@ -16,6 +17,8 @@ typedef struct mempool_s {
 	int min_nr;		/* nr of elements at *elements */
 	int curr_nr;		/* Current nr of elements at *elements */
 	void **elements;
+	atomic_t avail;		/* nr of elements at *elements and per-cpu */
+	struct mempool_pcp __percpu *pcp;
 
 	void *pool_data;
 	mempool_alloc_t *alloc;
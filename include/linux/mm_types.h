@@ -313,6 +313,16 @@ struct mm_struct {
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
 #endif
+#ifdef CONFIG_KSM
+	unsigned long ksm_merging_pages; /* pages mapped from ksm pages */
+#endif
+#ifdef CONFIG_NUMA
+	/* NUMA placement, see task_numa_work() */
+	unsigned long numa_next_scan;	/* jiffies of the next scan */
+	unsigned long numa_scan_offset;	/* where the next scan starts */
+	unsigned long *numa_pages;	/* decaying count of pages per node */
+	int numa_preferred_nid;		/* node holding most pages, or -1 */
+#endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
@@ -35,6 +35,9 @@
  */
 #define PAGE_ALLOC_COSTLY_ORDER 3
 
+/* The highest order of pages kept on the per-cpu lists */
+#define PCP_MAX_ORDER PAGE_ALLOC_COSTLY_ORDER
+
 #define MIGRATE_UNMOVABLE     0
 #define MIGRATE_RECLAIMABLE   1
 #define MIGRATE_MOVABLE       2
@@ -176,6 +179,10 @@ struct per_cpu_pages {
 
 	/* Lists of pages, one per migrate type stored on the pcp-lists */
 	struct list_head lists[MIGRATE_PCPTYPES];
+
+	/* Likewise for orders 1 to PCP_MAX_ORDER, against the same high/batch */
+	int order_count;	/* number of base pages in the order lists */
+	struct list_head order_lists[PCP_MAX_ORDER][MIGRATE_PCPTYPES];
 };
 
 struct per_cpu_pageset {
@@ -636,6 +643,11 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
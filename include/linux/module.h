@@ -317,6 +317,10 @@ struct module
 	const unsigned long *gpl_future_crcs;
 	unsigned int num_gpl_future_syms;
 
+	/* Entries of all the above in the exported symbol hash */
+	struct module_export *exports;
+	unsigned int num_exports;
+
 	/* Exception table */
 	unsigned int num_exentries;
 	struct exception_table_entry *extable;
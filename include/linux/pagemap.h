@@ -400,6 +400,8 @@ extern void end_page_writeback(struct page *page);
  * Add an arbitrary waiter to a page's wait queue
  */
 extern void add_page_wait_queue(struct page *page, wait_queue_t *waiter);
+extern int wait_on_page_locked_async(struct page *page,
+				     struct wait_bit_queue *wait);
 
 /*
  * Fault a userspace page into pagetables.  Return non-zero on a fault.
@@ -7,6 +7,7 @@
  */
 
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
 #include <linux/smp.h>
 #include <linux/list.h>
 #include <linux/threads.h>
@@ -17,7 +18,9 @@
 
 struct percpu_counter {
 	spinlock_t lock;
+	seqcount_t seq;		/* Bumped when per-cpu counts are folded */
 	s64 count;
+	s32 batch;		/* 0 means percpu_counter_batch */
 #ifdef CONFIG_HOTPLUG_CPU
 	struct list_head list;	/* All percpu_counters are on a list */
 #endif
@@ -42,9 +45,26 @@ void __percpu_counter_add(struct percpu_counter *fbc, s64 amount, s32 batch);
 s64 __percpu_counter_sum(struct percpu_counter *fbc);
 int percpu_counter_compare(struct percpu_counter *fbc, s64 rhs);
 
+/*
+ * Counters that are updated much more often than they are summed may use a
+ * larger batch than the global default, counters that are compared against
+ * limits often may use a smaller one.  Must be set before the counter is
+ * used.
+ */
+static inline void percpu_counter_set_batch(struct percpu_counter *fbc,
+					    s32 batch)
+{
+	fbc->batch = batch;
+}
+
+static inline s32 percpu_counter_get_batch(struct percpu_counter *fbc)
+{
+	return fbc->batch ? fbc->batch : percpu_counter_batch;
+}
+
 static inline void percpu_counter_add(struct percpu_counter *fbc, s64 amount)
 {
-	__percpu_counter_add(fbc, amount, percpu_counter_batch);
+	__percpu_counter_add(fbc, amount, percpu_counter_get_batch(fbc));
 }
 
 static inline s64 percpu_counter_sum_positive(struct percpu_counter *fbc)
@@ -104,6 +124,11 @@ static inline void percpu_counter_set(struct percpu_counter *fbc, s64 amount)
 	fbc->count = amount;
 }
 
+static inline void percpu_counter_set_batch(struct percpu_counter *fbc,
+					    s32 batch)
+{
+}
+
 static inline int percpu_counter_compare(struct percpu_counter *fbc, s64 rhs)
 {
 	if (fbc->count > rhs)
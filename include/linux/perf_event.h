@@ -127,10 +127,38 @@ enum perf_event_sample_format {
 	PERF_SAMPLE_PERIOD			= 1U << 8,
 	PERF_SAMPLE_STREAM_ID			= 1U << 9,
 	PERF_SAMPLE_RAW				= 1U << 10,
+	PERF_SAMPLE_BRANCH_STACK		= 1U << 11,
 
-	PERF_SAMPLE_MAX = 1U << 11,		/* non-ABI */
+	PERF_SAMPLE_MAX = 1U << 12,		/* non-ABI */
 };
 
+/*
+ * Values to program into attr.branch_sample_type when
+ * PERF_SAMPLE_BRANCH_STACK is set in attr.sample_type.
+ *
+ * The privilege bits select the levels at which branches are
+ * recorded; when none is set, they follow the exclude_* bits of
+ * the event. The remaining bits select the branch types; when
+ * none is set, PERF_SAMPLE_BRANCH_ANY is assumed.
+ */
+enum perf_branch_sample_type {
+	PERF_SAMPLE_BRANCH_USER			= 1U << 0, /* user branches */
+	PERF_SAMPLE_BRANCH_KERNEL		= 1U << 1, /* kernel branches */
+	PERF_SAMPLE_BRANCH_HV			= 1U << 2, /* hypervisor branches */
+
+	PERF_SAMPLE_BRANCH_ANY			= 1U << 3, /* any branch types */
+	PERF_SAMPLE_BRANCH_ANY_CALL		= 1U << 4, /* any call branch */
+	PERF_SAMPLE_BRANCH_ANY_RETURN		= 1U << 5, /* any return branch */
+	PERF_SAMPLE_BRANCH_IND_CALL		= 1U << 6, /* indirect calls */
+
+	PERF_SAMPLE_BRANCH_MAX			= 1U << 7, /* non-ABI */
+};
+
+#define PERF_SAMPLE_BRANCH_PLM_ALL \
+	(PERF_SAMPLE_BRANCH_USER|\
+	 PERF_SAMPLE_BRANCH_KERNEL|\
+	 PERF_SAMPLE_BRANCH_HV)
+
 /*
  * The format of the data returned by read() on a perf event fd,
  * as specified by attr.read_format:
@@ -161,6 +189,8 @@ enum perf_event_read_format {
 };
 
 #define PERF_ATTR_SIZE_VER0	64	/* sizeof first published struct */
+#define PERF_ATTR_SIZE_VER1	72	/* add: config2 */
+#define PERF_ATTR_SIZE_VER2	80	/* add: branch_sample_type */
 
 /*
  * Hardware event_id to monitor via a performance monitoring event:
@@ -235,6 +265,7 @@ struct perf_event_attr {
 		__u64		bp_len;
 		__u64		config2; /* extension of config1 */
 	};
+	__u64	branch_sample_type; /* enum perf_branch_sample_type */
 };
 
 /*
@@ -451,6 +482,10 @@ enum perf_event_type {
 	 *
 	 *	{ u32			size;
 	 *	  char                  data[size];}&& PERF_SAMPLE_RAW
+	 *
+	 *	{ u64			bnr;
+	 *	  struct perf_branch_entry lbr[bnr];
+	 *	} && PERF_SAMPLE_BRANCH_STACK
 	 * };
 	 */
 	PERF_RECORD_SAMPLE			= 9,
@@ -474,6 +509,20 @@ enum perf_callchain_context {
 #define PERF_FLAG_FD_OUTPUT		(1U << 1)
 #define PERF_FLAG_PID_CGROUP		(1U << 2) /* pid=cgroup id, per-cpu mode only */
 
+/*
+ * Branch record, as found in PERF_SAMPLE_BRANCH_STACK samples:
+ *
+ * from: source instruction (may not always be a branch insn)
+ *   to: branch target
+ * flags: bit 0 is set when the branch was mispredicted, if the
+ *        hardware reports it
+ */
+struct perf_branch_entry {
+	__u64				from;
+	__u64				to;
+	__u64				flags;
+};
+
 #ifdef __KERNEL__
 /*
  * Kernel-internal data types and definitions:
@@ -523,12 +572,6 @@ struct perf_raw_record {
 	void				*data;
 };
 
-struct perf_branch_entry {
-	__u64				from;
-	__u64				to;
-	__u64				flags;
-};
-
 struct perf_branch_stack {
 	__u64				nr;
 	struct perf_branch_entry	entries[0];
@@ -1001,12 +1044,19 @@ struct perf_sample_data {
 	u64				period;
 	struct perf_callchain_entry	*callchain;
 	struct perf_raw_record		*raw;
+	struct perf_branch_stack	*br_stack;
 };
 
 static inline void perf_sample_data_init(struct perf_sample_data *data, u64 addr)
 {
 	data->addr = addr;
 	data->raw  = NULL;
+	data->br_stack = NULL;
+}
+
+static inline bool has_branch_stack(struct perf_event *event)
+{
+	return event->attr.sample_type & PERF_SAMPLE_BRANCH_STACK;
 }
 
 extern void perf_output_sample(struct perf_output_handle *handle,
@@ -5,6 +5,17 @@
 
 #define PIPE_DEF_BUFFERS	16
 
+/* Number of released pages a pipe keeps around for its next writes */
+#define PIPE_TMP_PAGES		8
+
+/*
+ * A pipe whose writers keep finding it full doubles its number of buffers,
+ * every PIPE_GROW_STALLS times that happens, up to PIPE_AUTO_MAX_BUFFERS
+ * (and pipe-max-size). Sizing it with F_SETPIPE_SZ turns that off.
+ */
+#define PIPE_GROW_STALLS	8
+#define PIPE_AUTO_MAX_BUFFERS	64
+
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
 #define PIPE_BUF_FLAG_GIFT	0x04	/* page is a gift */
@@ -32,7 +43,10 @@ struct pipe_buffer {
  *	@nrbufs: the number of non-empty pipe buffers in this pipe
  *	@buffers: total number of buffers (should be a power of 2)
  *	@curbuf: the current pipe buffer entry
- *	@tmp_page: cached released page
+ *	@nr_tmp_pages: number of pages in @tmp_pages
+ *	@tmp_pages: cache of released pages, reused by the writers
+ *	@write_stalls: times writers found the pipe full since it last grew
+ *	@auto_size: whether the pipe grows by itself (see PIPE_GROW_STALLS)
  *	@readers: number of current readers of this pipe
  *	@writers: number of current writers of this pipe
  *	@waiting_writers: number of writers blocked waiting for room
@@ -51,7 +65,10 @@ struct pipe_inode_info {
 	unsigned int waiting_writers;
 	unsigned int r_counter;
 	unsigned int w_counter;
-	struct page *tmp_page;
+	unsigned int nr_tmp_pages;
+	struct page *tmp_pages[PIPE_TMP_PAGES];
+	unsigned int write_stalls;
+	bool auto_size;
 	struct fasync_struct *fasync_readers;
 	struct fasync_struct *fasync_writers;
 	struct inode *inode;
@@ -9,6 +9,7 @@
 #define __LINUX_POSIX_ACL_H
 
 #include <linux/slab.h>
+#include <linux/rcupdate.h>
 
 #define ACL_UNDEFINED_ID	(-1)
 
@@ -38,7 +39,10 @@ struct posix_acl_entry {
 };
 
 struct posix_acl {
-	atomic_t		a_refcount;
+	union {
+		atomic_t		a_refcount;
+		struct rcu_head		a_rcu;
+	};
 	unsigned int		a_count;
 	struct posix_acl_entry	a_entries[0];
 };
@@ -59,13 +63,14 @@ posix_acl_dup(struct posix_acl *acl)
 }
 
 /*
- * Free an ACL handle.
+ * Free an ACL handle. The memory is only given back after a grace period,
+ * so that rcu-walk can look at a cached ACL without taking a reference.
  */
 static inline void
 posix_acl_release(struct posix_acl *acl)
 {
 	if (acl && atomic_dec_and_test(&acl->a_refcount))
-		kfree(acl);
+		kfree_rcu(acl, a_rcu);
 }
 
 
@@ -109,6 +114,24 @@ static inline struct posix_acl *get_cached_acl(struct inode *inode, int type)
 	return acl;
 }
 
+/*
+ * Peek at the cached ACL of @inode without taking a reference, for use by
+ * the ->check_acl() methods in rcu-walk mode (IPERM_FLAG_RCU). The result
+ * is only good until rcu_read_unlock(), and may be ACL_NOT_CACHED.
+ */
+static inline struct posix_acl *get_cached_acl_rcu(struct inode *inode,
+						   int type)
+{
+	switch (type) {
+	case ACL_TYPE_ACCESS:
+		return rcu_dereference(inode->i_acl);
+	case ACL_TYPE_DEFAULT:
+		return rcu_dereference(inode->i_default_acl);
+	default:
+		return ERR_PTR(-EINVAL);
+	}
+}
+
 static inline int negative_cached_acl(struct inode *inode, int type)
 {
 	struct posix_acl **p, *acl;
@@ -137,11 +160,11 @@ static inline void set_cached_acl(struct inode *inode,
 	switch (type) {
 	case ACL_TYPE_ACCESS:
 		old = inode->i_acl;
-		inode->i_acl = posix_acl_dup(acl);
+		rcu_assign_pointer(inode->i_acl, posix_acl_dup(acl));
 		break;
 	case ACL_TYPE_DEFAULT:
 		old = inode->i_default_acl;
-		inode->i_default_acl = posix_acl_dup(acl);
+		rcu_assign_pointer(inode->i_default_acl, posix_acl_dup(acl));
 		break;
 	}
 	spin_unlock(&inode->i_lock);
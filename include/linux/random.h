@@ -88,6 +88,12 @@ static inline u32 __seed(u32 x, u32 m)
 	return (x < m) ? x + m : x;
 }
 
+/* Pseudo random number generator from numerical recipes. */
+static inline u32 next_pseudo_random32(u32 seed)
+{
+	return seed * 1664525 + 1013904223;
+}
+
 /**
  * prandom32_seed - set seed for prandom32().
  * @state: pointer to state structure to receive the seed.
@@ -37,6 +37,9 @@
 
 #include <linux/mutex.h>
 #include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/notifier.h>
+#include <linux/ktime.h>
 
 /**
  * DOC: The Binary Structure of the Firmware
@@ -162,6 +165,20 @@ struct fw_resource {
  *		extended/generalized.
  * @RSC_BOOTADDR: announces the address of the first instruction the remote
  *		processor should be booted with (address indicated in 'da').
+ * @RSC_IPC:	announces the layout of an IPC (rpmsg) link the firmware was
+ *		built with: 'name' identifies the link (e.g. "ipu_c0"), 'len'
+ *		is the number of IPC buffers (rx + tx) and 'flags' is the size
+ *		of each of them. The host places the buffers and the vrings,
+ *		and tells the remote processor where they are, so 'da' and
+ *		'pa' are unused.
+ * @RSC_VRING:	announces the vrings of an IPC link (named like its RSC_IPC
+ *		entry, which it may come with or replace): 'len' is the number
+ *		of entries of each of its vrings (the depth of its queues),
+ *		and 'flags' is their alignment (0 keeps the host's default).
+ *		Without a RSC_IPC entry, each side of the link gets as many
+ *		buffers as its vring has entries; with one, the vrings have to
+ *		have an entry per buffer of their side, at least. The host
+ *		places them, so 'da' and 'pa' are unused.
  *
  * Note: most of the resource types are not implemented yet, so they are
  * not documented yet.
@@ -173,6 +190,27 @@ enum fw_resource_type {
 	RSC_IRQ		= 3,
 	RSC_TRACE	= 4,
 	RSC_BOOTADDR	= 5,
+	RSC_IPC		= 6,
+	RSC_VRING	= 7,
+};
+
+/* max number of IPC links a single remote processor may announce */
+#define RPROC_MAX_IPC_CFGS	4
+
+/**
+ * struct rproc_ipc_cfg - IPC layout announced by the firmware
+ * @name: name of the IPC link
+ * @num_bufs: number of IPC buffers (rx + tx), or 0 if not announced
+ * @buf_size: size of each IPC buffer, or 0 if not announced
+ * @vring_num: number of entries of each vring, or 0 if not announced
+ * @vring_align: alignment of the vrings, or 0 if not announced
+ */
+struct rproc_ipc_cfg {
+	char name[48];
+	u32 num_bufs;
+	u32 buf_size;
+	u32 vring_num;
+	u32 vring_align;
 };
 
 /**
@@ -192,16 +230,22 @@ struct rproc_mem_entry {
 };
 
 struct rproc;
+struct firmware;
 
 /**
  * struct rproc_ops - platform-specific device handlers
  * @start:	power on the device and boot it. implementation may require
  *		specifyng a boot address
  * @stop:	power off the device
+ * @suspend:	put the device in a low power state, from which it can quickly
+ *		resume (optional)
+ * @resume:	wake up a suspended device (optional)
  */
 struct rproc_ops {
 	int (*start)(struct rproc *rproc, u64 bootaddr);
 	int (*stop)(struct rproc *rproc);
+	int (*suspend)(struct rproc *rproc);
+	int (*resume)(struct rproc *rproc);
 };
 
 /*
@@ -222,8 +266,74 @@ enum rproc_state {
 	RPROC_CRASHED,
 };
 
+/*
+ * enum rproc_event - events users can get notified of
+ *
+ * @RPROC_BOOTED:	the asynchronous boot of the remote processor is over,
+ *			and it's up and running
+ * @RPROC_BOOT_FAILED:	the asynchronous boot of the remote processor failed
+ */
+enum rproc_event {
+	RPROC_BOOTED,
+	RPROC_BOOT_FAILED,
+};
+
 #define RPROC_MAX_NAME	100
 
+/* the number of sections (or segments) whose loading is profiled */
+#define RPROC_MAX_BOOT_SEGMENTS	16
+
+/*
+ * struct rproc_boot_segment - how long loading a section of the image took
+ *
+ * @pa: physical address the section was loaded at
+ * @filesz: number of bytes copied from the image
+ * @memsz: number of bytes the section occupies (the rest is zeroed)
+ * @us: time spent loading the section, in usecs (with DMA, only the time
+ *	it took to issue the copy; see @copy_wait_us of rproc_boot_stats)
+ */
+struct rproc_boot_segment {
+	u32 pa;
+	u32 filesz;
+	u32 memsz;
+	u32 us;
+};
+
+/*
+ * struct rproc_boot_stats - where the time of the last boot went
+ *
+ * @requested: when the image was requested
+ * @cached: whether the image was the cached one (see rproc_request_fw())
+ * @status: result of the boot, or 1 while it's in progress
+ * @request_us: latency of getting the image, until its loading started
+ * @validate_us: time spent parsing and validating the image headers (the
+ *		 loading time not spent copying or handling resources)
+ * @copy_us: total time spent loading the sections of the image
+ * @copy_wait_us: time spent waiting for the DMA copies to complete
+ * @copy_bytes: number of bytes copied from the image
+ * @resources_us: time spent handling the resource table
+ * @start_us: time the ->start() handler took
+ * @total_us: time from the request of the image until the boot was over
+ * @num_segments: number of sections loaded (only the first
+ *		  RPROC_MAX_BOOT_SEGMENTS are in @segments)
+ * @segments: timing of the loading of each section
+ */
+struct rproc_boot_stats {
+	ktime_t requested;
+	bool cached;
+	int status;
+	s64 request_us;
+	s64 validate_us;
+	s64 copy_us;
+	s64 copy_wait_us;
+	u32 copy_bytes;
+	s64 resources_us;
+	s64 start_us;
+	s64 total_us;
+	int num_segments;
+	struct rproc_boot_segment segments[RPROC_MAX_BOOT_SEGMENTS];
+};
+
 /*
  * struct rproc - represents a physical remote processor device
  *
@@ -231,6 +341,7 @@ enum rproc_state {
  * @name: human readable name of the rproc, cannot exceed RPROC_MAX_NAME bytes
  * @memory_maps: table of da-to-pa memory maps (relevant if device is behind
  *               an iommu)
+ * @maps_va: kernel mappings of the @memory_maps regions, created on demand
  * @firmware: name of firmware file to be loaded
  * @owner: reference to the platform-specific rproc module
  * @priv: private data which belongs to the platform-specific rproc module
@@ -244,12 +355,21 @@ enum rproc_state {
  * @trace_buf1: second, optional, trace buffer of the remote processor
  * @trace_len0: length of main trace buffer of the remote processor
  * @trace_len1: length of the second (and optional) trace buffer
+ * @trace_wq: where pollers of the trace buffers wait for new trace
+ * @trace_work: periodically wakes up @trace_wq while there are pollers
  * @firmware_loading_complete: marks e/o asynchronous firmware loading
+ * @ipc_cfgs: IPC layouts announced by the firmware's resource table
+ * @num_ipc_cfgs: number of valid entries in @ipc_cfgs
+ * @cached_fw: the image of the last successful boot, kept for reboots
+ * @fw_work: boots from @cached_fw (asynchronously, like request_firmware)
+ * @nbh: notifier chain of the users that want to hear about rproc_event's
+ * @boot_stats: profile of the last boot, exposed in debugfs
  */
 struct rproc {
 	struct list_head next;
 	const char *name;
 	const struct rproc_mem_entry *memory_maps;
+	void **maps_va;
 	const char *firmware;
 	struct module *owner;
 	void *priv;
@@ -261,11 +381,29 @@ struct rproc {
 	struct dentry *dbg_dir;
 	char *trace_buf0, *trace_buf1;
 	int trace_len0, trace_len1;
+	wait_queue_head_t trace_wq;
+	struct delayed_work trace_work;
 	struct completion firmware_loading_complete;
+	struct rproc_ipc_cfg ipc_cfgs[RPROC_MAX_IPC_CFGS];
+	int num_ipc_cfgs;
+	const struct firmware *cached_fw;
+	struct work_struct fw_work;
+	struct blocking_notifier_head nbh;
+	struct rproc_boot_stats boot_stats;
 };
 
 struct rproc *rproc_get(const char *);
 void rproc_put(struct rproc *);
+int rproc_suspend(struct rproc *);
+int rproc_resume(struct rproc *);
+void rproc_report_crash(struct rproc *);
+int rproc_restart(struct rproc *);
+int rproc_get_ipc_cfg(struct rproc *, const char *, struct rproc_ipc_cfg *);
+void *rproc_pa_to_va(struct rproc *, phys_addr_t, u32);
+const struct rproc_mem_entry *rproc_get_memory_maps(const char *);
+int rproc_wait_for_boot(struct rproc *);
+int rproc_event_register(struct rproc *, struct notifier_block *);
+int rproc_event_unregister(struct rproc *, struct notifier_block *);
 int rproc_register(struct device *, const char *, const struct rproc_ops *,
 		const char *, const struct rproc_mem_entry *, struct module *);
 int rproc_unregister(const char *);
@@ -38,20 +38,46 @@
 #include <linux/types.h>
 #include <linux/device.h>
 #include <linux/mod_devicetable.h>
+#include <linux/kref.h>
+#include <linux/workqueue.h>
+#include <linux/uio.h>
+#include <linux/dma-mapping.h>
 
 /* The feature bitmap for virtio rpmsg */
 #define VIRTIO_RPMSG_F_NS	0 /* RP supports name service notifications */
+#define VIRTIO_RPMSG_F_PRIO	1 /* RP supports a high priority vq pair */
+#define VIRTIO_RPMSG_F_NS_BATCH	2 /* RP may batch name service messages */
+#define VIRTIO_RPMSG_F_FRAG	3 /* RP supports fragmented messages */
+#define VIRTIO_RPMSG_F_COMPACT_HDR 4 /* RP uses struct rpmsg_hdr_compact */
+#define VIRTIO_RPMSG_F_CREDITS	5 /* RP supports per endpoint flow control */
+
+/*
+ * Message flags. The low byte is set aside for bus-level features (e.g.
+ * fragmentation, and in the future per-message priority or acknowledgement
+ * suppression), each of which is only used if its feature is negotiated.
+ * The other bits are reserved, and must be zero.
+ */
+#define RPMSG_HDR_BUS_FLAGS	(0x00ff)
+
+/* more fragments of this message follow (with VIRTIO_RPMSG_F_FRAG) */
+#define RPMSG_HDR_MORE_FRAGS	(1 << 0)
 
 /**
  * struct rpmsg_hdr - common header for all rpmsg messages
  * @src: source address
  * @dst: destination address
- * @reserved: reserved for future use
+ * @reserved: offset of this fragment's payload within its message, if
+ *	      VIRTIO_RPMSG_F_FRAG is negotiated (otherwise reserved)
  * @len: length of payload (in bytes)
- * @flags: message flags
+ * @flags: message flags (e.g. RPMSG_HDR_MORE_FRAGS)
  * @data: @len bytes of message payload data
  *
  * Every message sent(/received) on the rpmsg bus begins with this header.
+ *
+ * If VIRTIO_RPMSG_F_FRAG is negotiated, a message whose payload doesn't fit
+ * in a single buffer may be sent as several consecutive fragments, with the
+ * same @src and @dst. All fragments but the last have RPMSG_HDR_MORE_FRAGS
+ * set, and the receiver reassembles them before delivering the message.
  */
 struct rpmsg_hdr {
 	u32 src;
@@ -62,6 +88,32 @@ struct rpmsg_hdr {
 	u8 data[0];
 } __packed;
 
+/**
+ * struct rpmsg_hdr_compact - compact header for all rpmsg messages
+ * @src: source address
+ * @dst: destination address
+ * @len: length of payload (in bytes)
+ * @flags: message flags
+ * @data: @len bytes of message payload data
+ *
+ * If VIRTIO_RPMSG_F_COMPACT_HDR is negotiated, every message begins with
+ * this 8-byte header instead of struct rpmsg_hdr, which limits addresses
+ * to 16 bits. Fragmentation isn't available with compact headers, since
+ * there's no room for the fragment offset.
+ *
+ * Its layout matches the last 8 bytes of struct rpmsg_hdr (@src and @dst
+ * take the place of the reserved field), so an rx buffer that is posted
+ * 8 bytes into a buffer slot can be parsed as a struct rpmsg_hdr, once
+ * the addresses are unpacked.
+ */
+struct rpmsg_hdr_compact {
+	u16 src;
+	u16 dst;
+	u16 len;
+	u16 flags;
+	u8 data[0];
+} __packed;
+
 /**
  * struct rpmsg_ns_msg - dynamic name service announcement message
  * @name: name of remote service that is published
@@ -73,6 +125,10 @@ struct rpmsg_hdr {
  * rpmsg channel (i.e device) is created/destroyed. In turn, the ->probe()
  * or ->remove() handler of the appropriate rpmsg driver will be invoked
  * (if/as-soon-as one is registered).
+ *
+ * If VIRTIO_RPMSG_F_NS_BATCH is negotiated, a single name service message
+ * may carry several such announcements back to back (e.g. when the remote
+ * processor boots), which are then handled in order.
  */
 struct rpmsg_ns_msg {
 	char name[RPMSG_NAME_SIZE];
@@ -85,10 +141,61 @@ struct rpmsg_ns_msg {
  *
  * @RPMSG_NS_CREATE: a new remote service was just created
  * @RPMSG_NS_DESTROY: a known remote service was just destroyed
+ * @RPMSG_NS_PRIO: the service carries control traffic, so its channel
+ *		   should use the high priority virtqueues (RPMSG_PRIO_HIGH);
+ *		   may be or'ed with RPMSG_NS_CREATE
  */
 enum rpmsg_ns_flags {
 	RPMSG_NS_CREATE		= 0,
 	RPMSG_NS_DESTROY	= 1,
+	RPMSG_NS_PRIO		= 2,
+};
+
+/**
+ * struct rpmsg_credit_msg - flow control credits message
+ * @credits: number of credits granted
+ * @flags: see enum rpmsg_credit_flags
+ *
+ * If VIRTIO_RPMSG_F_CREDITS is negotiated, this message is sent to the
+ * reserved credits address (54) of the other side, from the address of an
+ * endpoint that is flow-controlled, to let the other side send @credits
+ * more messages to it. Every message sent to a flow-controlled endpoint
+ * (a fragmented one counts once) consumes a credit, and a credit is given
+ * back whenever the endpoint consumes a message. Endpoints that never
+ * sent such a message aren't flow-controlled.
+ */
+struct rpmsg_credit_msg {
+	u32 credits;
+	u32 flags;
+} __packed;
+
+/**
+ * enum rpmsg_credit_flags - flow control credits message flags
+ *
+ * @RPMSG_CREDIT_SET: @credits is the total number of credits available
+ *		      (the size of the window), rather than additional ones.
+ *		      Setting RPMSG_CREDITS_UNLIMITED stops flow control.
+ */
+enum rpmsg_credit_flags {
+	RPMSG_CREDIT_SET	= (1 << 0),
+};
+
+#define RPMSG_CREDITS_UNLIMITED	(~0U)
+
+/**
+ * enum rpmsg_prio - the traffic class of an rpmsg channel
+ *
+ * @RPMSG_PRIO_NORMAL: bulk traffic, using the default virtqueue pair
+ * @RPMSG_PRIO_HIGH: control traffic, using a dedicated virtqueue pair, so
+ *		     it isn't blocked behind bulk traffic. If the remote
+ *		     processor doesn't support VIRTIO_RPMSG_F_PRIO, this is
+ *		     the same as @RPMSG_PRIO_NORMAL.
+ * @RPMSG_PRIO_MAX: number of traffic classes
+ */
+enum rpmsg_prio {
+	RPMSG_PRIO_NORMAL	= 0,
+	RPMSG_PRIO_HIGH		= 1,
+	RPMSG_PRIO_MAX,
 };
 
 /**
@@ -97,7 +204,8 @@ enum rpmsg_ns_flags {
  * These configuration requests are required by the rpmsg bus, and must be
  * implemented by the platform-specific rpmsg backend.
  *
- * @VPROC_BUF_ADDR: Kernel virtual address of an uncached memory region,
+ * @VPROC_BUF_ADDR: Kernel virtual address of a memory region (normally
+ *		    uncached, but see @VPROC_BUF_CACHE_OPS),
  *		    shared with the remote processor, that will be splitted
  *		    to buffers and then used to send messages across to the
  *		    remote processor. Those buffers will be added to the
@@ -114,6 +222,10 @@ enum rpmsg_ns_flags {
  *		  implementation to make sure that the size of the memory
  *		  region provided by @VPROC_BUF_ADDR is exactly
  *		  @VPROC_BUF_NUM * @VPROC_BUF_SZ bytes.
+ *		  Note that only the RX half of the region is actually split
+ *		  into @VPROC_BUF_SZ buffers; the TX half is managed by a
+ *		  variable-size allocator, so outbound messages only take as
+ *		  much space as they need (and may exceed @VPROC_BUF_SZ).
  *
  * @VPROC_STATIC_CHANNELS: Table of static channels that this platform
  *			   expects to have. See struct rpmsg_channel_info
@@ -121,6 +233,39 @@ enum rpmsg_ns_flags {
  *			   This configuration is optional: it is perfectly
  *			   fine not to have any pre-configured static channels.
  *
+ * @VPROC_BUF_CACHE_OPS: Cache maintenance operations (a pointer to a
+ *			 struct rpmsg_cache_ops) for platforms that map the
+ *			 shared memory region cacheable, or NULL if it is not.
+ *			 When provided, the rpmsg bus syncs exactly the part
+ *			 of a buffer that is used by a message, whenever
+ *			 ownership of the buffer moves between the processors.
+ *
+ * @VPROC_MEM_MAPS: Table of the remote processor's memory mappings (a
+ *		    pointer to an array of struct rproc_mem_entry, terminated
+ *		    by an entry of zero size), or NULL if the remote
+ *		    processor accesses physical memory directly. Used by
+ *		    rpmsg_pa_to_da() to tell drivers where the remote
+ *		    processor sees the buffers they share with it.
+ *
+ * @VPROC_PM_OPS: Power management operations (a pointer to a struct
+ *		  rpmsg_pm_ops) for platforms whose remote processor may be
+ *		  suspended while idle, or NULL if it is always on. When
+ *		  provided, messages sent while the remote processor is
+ *		  suspended are queued, the remote processor is resumed in
+ *		  the background, and then it's notified of all of them once.
+ *		  A remote processor that is booted on demand can be reported
+ *		  as suspended until then, so it's booted by its first use.
+ *
+ * @VPROC_CRASHED: Whether the remote processor crashed, and is still to be
+ *		   recovered (a bool). Platforms that detect crashes notify
+ *		   the rpmsg bus using the config_changed handler of the
+ *		   virtio driver; the bus then takes back all the buffers,
+ *		   and calls the ->reset() config op (which must stop the
+ *		   notifications and reset the vrings) and then ->set_status()
+ *		   with VIRTIO_CONFIG_S_DRIVER_OK (which must restart them,
+ *		   and reboot the remote processor). Once this reads false
+ *		   again, the bus resumes business as usual.
+ *
  * The number and size of buffers to use are considered platform-specific,
  * because this is strongly tied with the performance/functionality
  * requirements of the specific use cases that the platform needs rpmsg
@@ -137,6 +282,43 @@ enum rpmsg_platform_requests {
 	VPROC_BUF_NUM,
 	VPROC_BUF_SZ,
 	VPROC_STATIC_CHANNELS,
+	VPROC_BUF_CACHE_OPS,
+	VPROC_MEM_MAPS,
+	VPROC_PM_OPS,
+	VPROC_CRASHED,
+};
+
+struct virtio_device;
+struct rproc_mem_entry;
+
+/**
+ * struct rpmsg_cache_ops - cache maintenance of a cacheable shared region
+ * @sync_for_device: make @len bytes at @va (physical address @pa) coherent
+ *		     before the remote processor accesses them
+ * @sync_for_cpu: make @len bytes at @va (physical address @pa) coherent
+ *		  after the remote processor has written them
+ *
+ * The semantics of @dir are identical to those of the DMA API's
+ * dma_sync_single_for_device() and dma_sync_single_for_cpu().
+ */
+struct rpmsg_cache_ops {
+	void (*sync_for_device)(struct virtio_device *vdev, void *va,
+			phys_addr_t pa, size_t len, enum dma_data_direction dir);
+	void (*sync_for_cpu)(struct virtio_device *vdev, void *va,
+			phys_addr_t pa, size_t len, enum dma_data_direction dir);
+};
+
+/**
+ * struct rpmsg_pm_ops - power management of a remote processor
+ * @suspended: is the remote processor suspended right now ? this is
+ *	       called whenever the remote processor is about to be kicked,
+ *	       so it should be cheap, and it must not sleep
+ * @resume: wake up the remote processor, and return once it can be kicked
+ *	    (might sleep). returns 0 on success, or an appropriate error
+ */
+struct rpmsg_pm_ops {
+	bool (*suspended)(struct virtio_device *vdev);
+	int (*resume)(struct virtio_device *vdev);
 };
 
 #define RPMSG_ADDR_ANY		0xFFFFFFFF
@@ -152,6 +334,15 @@ struct virtproc_info;
  * @dst: destination address
  * @ept: the rpmsg endpoint of this channel
  * @announce: if set, rpmsg will announce the creation/removal of this channel
+ * @corked: if nonzero, kicking the remote processor is deferred (see rpmsg_cork)
+ * @tx_timeout: how long (in jiffies) blocking senders wait for a tx buffer
+ *		(15 seconds by default, MAX_SCHEDULE_TIMEOUT to wait forever)
+ * @tx_spin_us: if nonzero, senders busy-poll for a tx buffer for up to this
+ *		many microseconds before sleeping (or failing)
+ * @prio: the traffic class of this channel (see enum rpmsg_prio)
+ * @node: link in the channels hash of the remote processor (for the bus)
+ *
+ * Drivers may change @tx_timeout and @tx_spin_us (e.g. in their probe).
  */
 struct rpmsg_channel {
 	struct virtproc_info *vrp;
@@ -161,6 +352,11 @@ struct rpmsg_channel {
 	u32 dst;
 	struct rpmsg_endpoint *ept;
 	bool announce;
+	atomic_t corked;
+	long tx_timeout;
+	unsigned int tx_spin_us;
+	enum rpmsg_prio prio;
+	struct hlist_node node;
 };
 
 /**
@@ -168,6 +364,7 @@ struct rpmsg_channel {
  * @name: name of service
  * @src: local address
  * @dst: destination address
+ * @prio: traffic class of the channel (RPMSG_PRIO_NORMAL if omitted)
  *
  * This struct is used to define static channel information, namely name
  * and addresses, which is used by platform-specific code to create static
@@ -196,6 +393,7 @@ struct rpmsg_channel_info {
 	char name[RPMSG_NAME_SIZE];
 	u32 src;
 	u32 dst;
+	enum rpmsg_prio prio;
 };
 
 /*
@@ -210,12 +408,52 @@ struct rpmsg_channel_info {
  */
 #define RMSG_REMOTE_CHNL(name, addr)	name, RPMSG_ADDR_ANY, addr
 
+/**
+ * enum rpmsg_ept_flags - rpmsg endpoint flags
+ *
+ * @RPMSG_EPT_HOLD_RX: the rx callback of this endpoint may hold on to the
+ *		       inbound message buffers (see rpmsg_hold_rx_buf())
+ */
+enum rpmsg_ept_flags {
+	RPMSG_EPT_HOLD_RX	= (1 << 0),
+};
+
+/**
+ * struct rpmsg_rx_msg - an inbound message, as delivered to a batch callback
+ * @data: the message payload
+ * @len: length of the payload (in bytes)
+ * @src: source address of the message
+ */
+struct rpmsg_rx_msg {
+	void *data;
+	int len;
+	u32 src;
+};
+
 /**
  * struct rpmsg_endpoint - binds a local rpmsg address to its user
+ * @vrp: the remote processor this endpoint belongs to
  * @rpdev: rpmsg channel device
  * @cb: rx callback handler
  * @addr: local rpmsg address
  * @priv: private data for the driver's use
+ * @flags: endpoint flags (see enum rpmsg_ept_flags)
+ * @rx_held: number of rx buffers currently held by this endpoint
+ * @rx_quota: max number of rx buffers this endpoint may hold (0 for default)
+ * @rx_msgs: number of messages received by this endpoint
+ * @rx_bytes: number of payload bytes received by this endpoint
+ * @tx_msgs: number of messages sent from this endpoint's channel address
+ * @tx_bytes: number of payload bytes sent from this endpoint's channel address
+ * @refcount: the endpoint is freed only after its last rx buffer is released
+ * @rx_credits: flow control window of this endpoint, or 0 if the remote
+ *		processor isn't flow-controlled (see rpmsg_set_rx_credits())
+ * @rx_credits_owed: number of consumed messages whose credits weren't
+ *		     given back to the remote processor yet
+ * @credit_work: gives the owed credits back to the remote processor
+ * @batch_cb: rx batch callback handler, or NULL (see rpmsg_set_batch_cb())
+ * @rx_batch: messages pending delivery to @batch_cb in the current rx run
+ * @rx_batch_len: number of messages in @rx_batch
+ * @rx_batch_node: link in the list of endpoints with pending rx batches
  *
  * In essence, an rpmsg endpoint represents a listener on the rpmsg bus, as
  * it binds together an rpmsg address with an rx callback handler.
@@ -232,12 +470,77 @@ struct rpmsg_channel_info {
  * create themselves additional endpoints (see rpmsg_create_ept()).
  */
 struct rpmsg_endpoint {
+	struct virtproc_info *vrp;
 	struct rpmsg_channel *rpdev;
 	void (*cb)(struct rpmsg_channel *, void *, int, void *, u32);
 	u32 addr;
 	void *priv;
+	unsigned long flags;
+	int rx_held;
+	int rx_quota;
+	unsigned long rx_msgs;
+	unsigned long rx_bytes;
+	unsigned long tx_msgs;
+	unsigned long tx_bytes;
+	struct kref refcount;
+	int rx_credits;
+	atomic_t rx_credits_owed;
+	struct work_struct credit_work;
+	void (*batch_cb)(struct rpmsg_channel *, struct rpmsg_rx_msg *, int,
+									void *);
+	struct rpmsg_rx_msg *rx_batch;
+	int rx_batch_len;
+	struct list_head rx_batch_node;
+};
+
+/**
+ * struct rpmsg_rx_buf - an inbound message buffer held by its recipient
+ * @node: free for the holder's use (e.g. for queueing) while the buffer is held
+ * @data: the message payload
+ * @len: length of the payload (in bytes)
+ * @src: source address of the message
+ * @vrp: the remote processor the buffer belongs to
+ * @ept: the endpoint holding this buffer
+ * @held: whether the buffer is currently held
+ *
+ * This handle is returned by rpmsg_hold_rx_buf(), and describes an
+ * inbound message whose buffer was not yet given back to the remote
+ * processor. It should eventually be passed to rpmsg_release_rx_buf().
+ */
+struct rpmsg_rx_buf {
+	struct list_head node;
+	void *data;
+	int len;
+	u32 src;
+	struct virtproc_info *vrp;
+	struct rpmsg_endpoint *ept;
+	bool held;
+};
+
+/**
+ * struct rpmsg_tx_waiter - a request to be notified when tx space is available
+ * @node: used internally by the rpmsg bus
+ * @rpdev: the channel this waiter was registered with
+ * @cb: invoked once tx space may be available again (must not sleep)
+ * @priv: private data for the driver's use
+ *
+ * See rpmsg_tx_notify().
+ */
+struct rpmsg_tx_waiter {
+	struct list_head node;
+	struct rpmsg_channel *rpdev;
+	void (*cb)(struct rpmsg_channel *rpdev, void *priv);
+	void *priv;
 };
 
+static inline void rpmsg_init_tx_waiter(struct rpmsg_tx_waiter *w,
+		void (*cb)(struct rpmsg_channel *, void *), void *priv)
+{
+	INIT_LIST_HEAD(&w->node);
+	w->cb = cb;
+	w->priv = priv;
+}
+
 /**
  * struct rpmsg_driver - rpmsg driver struct
  * @drv: underlying device driver
@@ -265,6 +568,32 @@ struct rpmsg_endpoint *rpmsg_create_ept(struct rpmsg_channel *,
 
 int
 rpmsg_send_offchannel_raw(struct rpmsg_channel *, u32, u32, void *, int, bool);
+int rpmsg_send_offchannel_timeout(struct rpmsg_channel *rpdev, u32 src,
+			u32 dst, void *data, int len, long timeout);
+int rpmsg_send_urgent_offchannel(struct rpmsg_channel *rpdev, u32 src,
+				u32 dst, void *data, int len, bool wait);
+int rpmsg_sendv_offchannel_raw(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+			const struct kvec *vec, size_t nvec, bool wait);
+void *rpmsg_alloc_tx_buf(struct rpmsg_channel *rpdev, int len, bool wait);
+int rpmsg_send_prepared(struct rpmsg_channel *rpdev, u32 src, u32 dst,
+							void *buf, int len);
+void rpmsg_free_tx_buf(struct rpmsg_channel *rpdev, void *buf);
+void rpmsg_cork(struct rpmsg_channel *rpdev);
+void rpmsg_uncork(struct rpmsg_channel *rpdev);
+int rpmsg_send_batch(struct rpmsg_channel *rpdev, const struct kvec *msgs,
+								int num);
+int rpmsg_tx_notify(struct rpmsg_channel *rpdev, struct rpmsg_tx_waiter *w);
+void rpmsg_tx_notify_cancel(struct rpmsg_channel *rpdev,
+						struct rpmsg_tx_waiter *w);
+struct rpmsg_rx_buf *rpmsg_hold_rx_buf(struct rpmsg_endpoint *ept, void *data);
+void rpmsg_release_rx_buf(struct rpmsg_rx_buf *rxb);
+int rpmsg_set_rx_quota(struct rpmsg_endpoint *ept, int quota);
+int rpmsg_set_rx_credits(struct rpmsg_endpoint *ept, int credits);
+int rpmsg_set_batch_cb(struct rpmsg_endpoint *ept,
+		void (*batch_cb)(struct rpmsg_channel *, struct rpmsg_rx_msg *,
+								int, void *));
+int rpmsg_pa_to_da(struct rpmsg_channel *rpdev, phys_addr_t pa, size_t len,
+								u32 *da);
 
 /**
  * rpmsg_send() - send a message across to the remote processor
@@ -276,8 +605,8 @@ rpmsg_send_offchannel_raw(struct rpmsg_channel *, u32, u32, void *, int, bool);
  * The message will be sent to the remote processor which the @rpdev
  * channel belongs to, using @rpdev's source and destination addresses.
  * In case there are no TX buffers available, the function will block until
- * one becomes available, or a timeout of 15 seconds elapses. When the latter
- * happens, -ERESTARTSYS is returned.
+ * one becomes available, or the channel's tx_timeout (15 seconds by default)
+ * elapses. When the latter happens, -ERESTARTSYS is returned.
  *
  * Can only be called from process context (for now).
  *
@@ -301,8 +630,8 @@ static inline int rpmsg_send(struct rpmsg_channel *rpdev, void *data, int len)
  * The message will be sent to the remote processor which the @rpdev
  * channel belongs to, using @rpdev's source address.
  * In case there are no TX buffers available, the function will block until
- * one becomes available, or a timeout of 15 seconds elapses. When the latter
- * happens, -ERESTARTSYS is returned.
+ * one becomes available, or the channel's tx_timeout (15 seconds by default)
+ * elapses. When the latter happens, -ERESTARTSYS is returned.
  *
  * Can only be called from process context (for now).
  *
@@ -329,8 +658,8 @@ int rpmsg_sendto(struct rpmsg_channel *rpdev, void *data, int len, u32 dst)
  * The message will be sent to the remote processor which the @rpdev
  * channel belongs to.
  * In case there are no TX buffers available, the function will block until
- * one becomes available, or a timeout of 15 seconds elapses. When the latter
- * happens, -ERESTARTSYS is returned.
+ * one becomes available, or the channel's tx_timeout (15 seconds by default)
+ * elapses. When the latter happens, -ERESTARTSYS is returned.
  *
  * Can only be called from process context (for now).
  *
@@ -418,4 +747,94 @@ int rpmsg_trysend_offchannel(struct rpmsg_channel *rpdev, u32 src, u32 dst,
 	return rpmsg_send_offchannel_raw(rpdev, src, dst, data, len, false);
 }
 
+/**
+ * rpmsg_sendv() - send a message gathered from several buffers
+ * @rpdev: the rpmsg channel
+ * @vec: the buffers that make up the payload of the message, in order
+ * @nvec: number of buffers in @vec
+ *
+ * This function is identical to rpmsg_send(), except that the payload is
+ * gathered from the @nvec buffers described by @vec directly into the
+ * TX buffer, so drivers need not flatten it into a single buffer first.
+ *
+ * Can only be called from process context (for now).
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+static inline int rpmsg_sendv(struct rpmsg_channel *rpdev,
+				const struct kvec *vec, size_t nvec)
+{
+	u32 src = rpdev->src, dst = rpdev->dst;
+
+	return rpmsg_sendv_offchannel_raw(rpdev, src, dst, vec, nvec, true);
+}
+
+/**
+ * rpmsg_sendtov() - send a gathered message to a specific dst address
+ * @rpdev: the rpmsg channel
+ * @vec: the buffers that make up the payload of the message, in order
+ * @nvec: number of buffers in @vec
+ * @dst: destination address
+ *
+ * This function is identical to rpmsg_sendto(), except that the payload is
+ * gathered from the @nvec buffers described by @vec (see rpmsg_sendv()).
+ *
+ * Can only be called from process context (for now).
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+static inline int rpmsg_sendtov(struct rpmsg_channel *rpdev,
+			const struct kvec *vec, size_t nvec, u32 dst)
+{
+	u32 src = rpdev->src;
+
+	return rpmsg_sendv_offchannel_raw(rpdev, src, dst, vec, nvec, true);
+}
+
+/**
+ * rpmsg_send_timeout() - send a message, waiting up to @timeout for tx space
+ * @rpdev: the rpmsg channel
+ * @data: payload of message
+ * @len: length of payload
+ * @timeout: how long (in jiffies) to wait for a TX buffer (0 means don't wait)
+ *
+ * This function is identical to rpmsg_send(), except that the caller
+ * explicitly specifies how long it's willing to wait for a TX buffer,
+ * instead of using @rpdev's @tx_timeout.
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+static inline int rpmsg_send_timeout(struct rpmsg_channel *rpdev, void *data,
+						int len, long timeout)
+{
+	u32 src = rpdev->src, dst = rpdev->dst;
+
+	return rpmsg_send_offchannel_timeout(rpdev, src, dst, data, len,
+								timeout);
+}
+
+/**
+ * rpmsg_send_urgent() - send a message ahead of the channel's bulk traffic
+ * @rpdev: the rpmsg channel
+ * @data: payload of message
+ * @len: length of payload
+ *
+ * This function is identical to rpmsg_send(), except that the message
+ * gets a tx buffer out of the space reserved for urgent messages, and it
+ * is sent on the high priority virtqueue, if the remote processor has one
+ * (see rpmsg_send_urgent_offchannel()). It's meant for the few control
+ * messages that must not wait behind bulk data, e.g. a "stop" command.
+ *
+ * Can only be called from process context (for now).
+ *
+ * Returns 0 on success and an appropriate error value on failure.
+ */
+static inline int rpmsg_send_urgent(struct rpmsg_channel *rpdev, void *data,
+								int len)
+{
+	u32 src = rpdev->src, dst = rpdev->dst;
+
+	return rpmsg_send_urgent_offchannel(rpdev, src, dst, data, len, true);
+}
+
 #endif /* _LINUX_RPMSG_H */
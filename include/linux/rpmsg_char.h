@@ -0,0 +1,31 @@
+/*
+ * Generic rpmsg user space interface
+ *
+ * Copyright (C) 2011 Texas Instruments, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef RPMSG_CHAR_H
+#define RPMSG_CHAR_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define RPMSG_CHAR_IOC_MAGIC	'R'
+
+/* get the local address of the endpoint that was created by open() */
+#define RPMSG_CHAR_IOCGETADDR	_IOR(RPMSG_CHAR_IOC_MAGIC, 1, __u32)
+/* set the remote address written messages are sent to */
+#define RPMSG_CHAR_IOCSETDST	_IOW(RPMSG_CHAR_IOC_MAGIC, 2, __u32)
+
+#define RPMSG_CHAR_IOC_MAXNR	(2)
+
+#endif /* RPMSG_CHAR_H */
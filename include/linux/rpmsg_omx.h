@@ -34,12 +34,117 @@
 #define RPMSG_OMX_H
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define OMX_IOC_MAGIC	'X'
 
 #define OMX_IOCCONNECT	_IOW(OMX_IOC_MAGIC, 1, char *)
+#define OMX_IOCRINGSETUP _IOW(OMX_IOC_MAGIC, 2, struct omx_ring_setup)
+#define OMX_IOCRINGKICK	_IO(OMX_IOC_MAGIC, 3)
+#define OMX_IOCFRAMED	_IOW(OMX_IOC_MAGIC, 4, int)
+#define OMX_IOCREGBUF	_IOWR(OMX_IOC_MAGIC, 5, struct omx_buf)
+#define OMX_IOCUNREGBUF	_IOW(OMX_IOC_MAGIC, 6, __u32)
+#define OMX_IOCEVENTFD	_IOW(OMX_IOC_MAGIC, 7, int)
 
-#define OMX_IOC_MAXNR	(1)
+#define OMX_IOC_MAXNR	(7)
+
+/**
+ * struct omx_buf - a buffer shared with the remote OMX instance
+ * @pa:		physical address of the buffer (e.g. a video frame that was
+ *		allocated from a carveout the remote processor has mapped)
+ * @size:	size of the buffer, in bytes
+ * @id:		set by the kernel: the id of the buffer, to be used in the
+ *		OMX messages that refer to it, and with OMX_IOCUNREGBUF
+ * @da:		set by the kernel: the address of the buffer, as seen by
+ *		the remote processor
+ *
+ * Passed with OMX_IOCREGBUF, which lets the remote OMX instance access
+ * the buffer directly, so its contents never need to be copied.
+ */
+struct omx_buf {
+	__u64 pa;
+	__u32 size;
+	__u32 id;
+	__u32 da;
+};
+
+/**
+ * struct omx_frame - a single message in a framed read() or write() buffer
+ * @len:	length of @data, in bytes
+ * @data:	the OMX payload of the message
+ *
+ * Once framed mode is enabled with OMX_IOCFRAMED, read() returns as many
+ * complete messages as fit in the user buffer, and write() sends every
+ * message in the user buffer (kicking the remote processor only once),
+ * each message being a struct omx_frame. Frames are laid out back to
+ * back, every one of them padded to OMX_FRAME_ALIGN bytes.
+ */
+struct omx_frame {
+	__u32 len;
+	char data[0];
+};
+
+#define OMX_FRAME_ALIGN		(4)
+#define OMX_FRAME_SIZE(len)	((sizeof(struct omx_frame) + (len) + \
+				OMX_FRAME_ALIGN - 1) & ~(OMX_FRAME_ALIGN - 1))
+
+/* size of every slot of the mmap'able message rings (incl. its header) */
+#define OMX_RING_SLOT_SIZE	(512)
+
+/* maximum number of slots in each of the mmap'able message rings */
+#define OMX_RING_MAX_SLOTS	(1024)
+
+/**
+ * struct omx_ring_setup - set up the mmap'able message rings of an instance
+ * @num_slots:	number of slots in each of the tx and rx rings (power of two)
+ * @eventfd:	eventfd to signal when messages are added to the rx ring,
+ *		or -1 if the user prefers to poll() the device instead (or
+ *		has already set one with OMX_IOCEVENTFD)
+ *
+ * Passed with OMX_IOCRINGSETUP. Afterwards, the rings are mapped with
+ * mmap(), at offset 0: the first page holds a struct omx_ring_ctrl, and
+ * is followed by the @num_slots tx slots and then the @num_slots rx slots.
+ */
+struct omx_ring_setup {
+	__u32 num_slots;
+	__s32 eventfd;
+};
+
+/**
+ * struct omx_ring_ctrl - the control page of the mmap'able message rings
+ * @tx_head:	bumped by the user after writing a tx slot
+ * @tx_tail:	bumped by the kernel after sending a tx slot
+ * @rx_head:	bumped by the kernel after writing an rx slot
+ * @rx_tail:	bumped by the user after consuming an rx slot
+ * @num_slots:	number of slots in each ring
+ * @slot_size:	size of each slot (OMX_RING_SLOT_SIZE)
+ *
+ * Each ring is single producer, single consumer. The indices are free
+ * running, and slot i lives at ring offset (i % num_slots) * slot_size.
+ * A producer must write the slot before it publishes the new head (and
+ * a consumer must read the head before the slot), using the appropriate
+ * memory barriers. Pending tx slots are sent when the user rings the
+ * OMX_IOCRINGKICK doorbell, which also lets the kernel reuse the rx slots
+ * consumed so far, so a single ioctl serves a whole batch of messages.
+ */
+struct omx_ring_ctrl {
+	__u32 tx_head;
+	__u32 tx_tail;
+	__u32 rx_head;
+	__u32 rx_tail;
+	__u32 num_slots;
+	__u32 slot_size;
+};
+
+/**
+ * struct omx_ring_slot - a single message in an mmap'able ring
+ * @len:	length of @data, in bytes
+ * @data:	the OMX payload of the message
+ */
+struct omx_ring_slot {
+	__u32 len;
+	char data[0];
+};
 
 #ifdef __KERNEL__
 
@@ -61,12 +166,21 @@
  * @OMX_RAW_MSG: a message that should be propagated as-is to the user.
  * this would immediately enable user space development to start.
  * as we progress, most likely this message won't be needed anymore.
+ *
+ * @OMX_REG_BUF: tell the remote OMX instance about a buffer it may access
+ * directly. the message carries a struct omx_buf_msg.
+ *
+ * @OMX_UNREG_BUF: tell the remote OMX instance that a buffer is no longer
+ * shared with it. the message carries a struct omx_buf_msg (only its id
+ * is meaningful).
  */
 enum omx_msg_types {
 	OMX_CONN_REQ = 0,
 	OMX_CONN_RSP = 1,
 	OMX_DISCONNECT = 4,
 	OMX_RAW_MSG = 5,
+	OMX_REG_BUF = 6,
+	OMX_UNREG_BUF = 7,
 	/* todo: do we need a disconnect response ? ION refcounts should allow
 	 * asynchronous release of relevant buffers */
 };
@@ -91,6 +205,7 @@ enum omx_state {
 	OMX_UNCONNECTED,
 	OMX_CONNECTED,
 	OMX_FAIL,
+	OMX_CONNECTING,
 };
 
 /**
@@ -119,6 +234,12 @@ struct omx_disc_req {
 	u32 addr;
 } __packed;
 
+struct omx_buf_msg {
+	u32 id;
+	u32 da;
+	u32 size;
+} __packed;
+
 
 #endif /* __KERNEL__ */
 
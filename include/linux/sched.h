@@ -277,6 +277,9 @@ extern int get_nohz_timer_target(void);
 #else
 static inline void select_nohz_load_balancer(int stop_tick) { }
 #endif
+#ifdef CONFIG_NO_HZ_FULL
+extern int sched_can_stop_tick(void);
+#endif
 
 /*
  * Only dump TASK_* tasks. (0 for all tasks)
@@ -1126,6 +1129,7 @@ struct load_weight {
 
 #ifdef CONFIG_SCHEDSTATS
 struct sched_statistics {
+	u64			wakeup_start;
 	u64			wait_start;
 	u64			wait_max;
 	u64			wait_count;
@@ -1221,6 +1225,10 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct task_struct *wake_entry;
 	int on_cpu;
+	/* how often the task switched between wakees, see wake_wide() */
+	struct task_struct *last_wakee;
+	unsigned long wakee_flips;
+	unsigned long wakee_flip_decay_ts;
 #endif
 	int on_rq;
 
@@ -1994,6 +2002,19 @@ int sched_rt_handler(struct ctl_table *table, int write,
 		void __user *buffer, size_t *lenp,
 		loff_t *ppos);
 
+#ifdef CONFIG_NUMA
+extern unsigned int sysctl_sched_numa_balance;
+extern unsigned int sysctl_sched_numa_migrate;
+extern unsigned int sysctl_sched_numa_scan_period;
+extern unsigned int sysctl_sched_numa_scan_size;
+
+extern void task_numa_work(void);
+#else
+static inline void task_numa_work(void)
+{
+}
+#endif
+
 #ifdef CONFIG_SCHED_AUTOGROUP
 extern unsigned int sysctl_sched_autogroup_enabled;
 
@@ -187,6 +187,22 @@ enum {
 
 	/* ensure the originating sk reference is available on driver level */
 	SKBTX_DRV_NEEDS_SK_REF = 1 << 3,
+
+	/* frags are pinned userspace buffers, see struct ubuf_info */
+	SKBTX_DEV_ZEROCOPY = 1 << 4,
+};
+
+/*
+ * The callback notifies the owner of the userspace buffers an skb's frags
+ * point to (i.e. @destructor_arg of an SKBTX_DEV_ZEROCOPY skb) that the
+ * lower device is done with them. It's called once the last reference to the
+ * skb's data is gone, or once the frags are copied into kernel buffers. The
+ * desc is for the owner to keep track of which buffers these are.
+ */
+struct ubuf_info {
+	void (*callback)(void *);
+	void *arg;
+	unsigned long desc;
 };
 
 /* This data is invariant across clones and lives at
@@ -249,6 +265,9 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* This indicates the segments are GRE encapsulated. */
+	SKB_GSO_GRE = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -505,8 +524,10 @@ static inline struct sk_buff *alloc_skb_fclone(unsigned int size,
 }
 
 extern bool skb_recycle_check(struct sk_buff *skb, int skb_size);
+extern int sysctl_skb_recycle_max;
 
 extern struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src);
+extern int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask);
 extern struct sk_buff *skb_clone(struct sk_buff *skb,
 				 gfp_t priority);
 extern struct sk_buff *skb_copy(const struct sk_buff *skb,
@@ -1747,6 +1768,23 @@ static inline int skb_linearize_cow(struct sk_buff *skb)
 	       __skb_linearize(skb) : 0;
 }
 
+/**
+ *	skb_orphan_frags - make sure frags don't point to userspace buffers
+ *	@skb: buffer to process
+ *	@gfp_mask: allocation priority
+ *
+ *	If the frags of @skb are pinned userspace buffers (SKBTX_DEV_ZEROCOPY),
+ *	copy them into kernel pages, and release the userspace buffers. Needed
+ *	before the frags are shared beyond the lifetime of @skb's data.
+ *	If there is no free memory -ENOMEM is returned, otherwise zero.
+ */
+static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!(skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
 /**
  *	skb_postpull_rcsum - update checksum for received skb after pull
  *	@skb: buffer to update
@@ -310,6 +310,42 @@ static inline void *kmem_cache_zalloc(struct kmem_cache *k, gfp_t flags)
 	return kmem_cache_alloc(k, flags | __GFP_ZERO);
 }
 
+/*
+ * Bulk allocation and freeing: fill @p with @size objects of cache @s, or
+ * free the @size objects in @p.  SLUB works on the whole batch with the
+ * cpu freelist at hand, so it is much cheaper than a loop; the other
+ * allocators just loop.  kmem_cache_alloc_bulk() returns @size, or 0 if
+ * it couldn't allocate them all (in which case it allocated none).
+ */
+#ifdef CONFIG_SLUB
+int kmem_cache_alloc_bulk(struct kmem_cache *, gfp_t, size_t, void **);
+void kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+#else
+static inline void kmem_cache_free_bulk(struct kmem_cache *s, size_t size,
+					void **p)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		kmem_cache_free(s, p[i]);
+}
+
+static inline int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags,
+					size_t size, void **p)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		p[i] = kmem_cache_alloc(s, flags);
+		if (!p[i]) {
+			kmem_cache_free_bulk(s, i, p);
+			return 0;
+		}
+	}
+	return size;
+}
+#endif
+
 /**
  * kzalloc - allocate memory. The memory is set to zero.
  * @size: how many bytes of memory are required.
@@ -460,6 +460,16 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+	/* TCP Small Queues, see tcp_wfree() */
+	unsigned long		tsq_flags;
+	struct list_head	tsq_node;
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,		/* hit tcp_limit_output_bytes */
+	TSQ_QUEUED,		/* on the tsq tasklet list */
+	TSQ_DEFERRED,		/* left to tcp_release_cb() */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
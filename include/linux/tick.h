@@ -45,6 +45,10 @@ enum tick_nohz_mode {
  * @iowait_sleeptime:	Sum of the time slept in idle with sched tick stopped, with IO outstanding
  * @sleep_length:	Duration of the current idle sleep
  * @do_timer_lst:	CPU was the last one doing do_timer before going idle
+ * @tick_stretched:	The tick timer is programmed further than the next
+ *			tick, as this adaptive-tick CPU runs a single task
+ * @tick_full:		Ticks since @full_last_tick still need accounting
+ * @full_last_tick:	Expiry time of the last tick accounted for
  */
 struct tick_sched {
 	struct hrtimer			sched_timer;
@@ -67,6 +71,11 @@ struct tick_sched {
 	unsigned long			next_jiffies;
 	ktime_t				idle_expires;
 	int				do_timer_last;
+#ifdef CONFIG_NO_HZ_FULL
+	int				tick_stretched;
+	int				tick_full;
+	ktime_t				full_last_tick;
+#endif
 };
 
 extern void __init tick_init(void);
@@ -139,4 +148,20 @@ static inline u64 get_cpu_idle_time_us(int cpu, u64 *unused) { return -1; }
 static inline u64 get_cpu_iowait_time_us(int cpu, u64 *unused) { return -1; }
 # endif /* !NO_HZ */
 
+struct task_struct;
+
+# ifdef CONFIG_NO_HZ_FULL
+extern int tick_nohz_full_cpu(int cpu);
+extern void tick_nohz_full_check(void);
+extern void tick_nohz_full_kick(void);
+extern void tick_nohz_full_kick_cpu(int cpu);
+extern void tick_nohz_full_flush(struct task_struct *prev);
+# else
+static inline int tick_nohz_full_cpu(int cpu) { return 0; }
+static inline void tick_nohz_full_check(void) { }
+static inline void tick_nohz_full_kick(void) { }
+static inline void tick_nohz_full_kick_cpu(int cpu) { }
+static inline void tick_nohz_full_flush(struct task_struct *prev) { }
+# endif /* !NO_HZ_FULL */
+
 #endif
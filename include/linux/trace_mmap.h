@@ -0,0 +1,45 @@
+#ifndef _LINUX_TRACE_MMAP_H
+#define _LINUX_TRACE_MMAP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Memory mapped consumer of a per-CPU ring buffer.
+ *
+ * mmap() of per_cpu/cpuN/trace_pipe_raw maps, read-only and from offset
+ * zero, one meta page followed by every sub-buffer of that CPU's ring
+ * buffer, in sub-buffer id order. Each sub-buffer has the layout given
+ * in events/header_page.
+ *
+ * The sub-buffer being consumed is the reader one, found at
+ * (1 + reader.id) * meta_page_size. Events between reader.read and the
+ * sub-buffer's commit field are unread. After processing up to some
+ * offset, pass that offset to TRACE_MMAP_IOCTL_GET_READER; this consumes
+ * the events before it and, once the reader sub-buffer is entirely
+ * consumed and the writer has left it, selects the next one. The meta
+ * page is only updated by that ioctl.
+ */
+struct trace_buffer_meta {
+	__u32	meta_page_size;		/* size of this page */
+	__u32	meta_struct_len;	/* size of this structure */
+
+	__u32	subbuf_size;		/* size of each sub-buffer */
+	__u32	nr_subbufs;		/* number of sub-buffers */
+
+	struct {
+		__u64	lost_events;	/* events lost before this one */
+		__u32	id;		/* mapped sub-buffer being read */
+		__u32	read;		/* first unread byte in its data */
+	} reader;
+
+	__u64	flags;			/* reserved, zero */
+
+	__u64	entries;		/* events in the ring buffer */
+	__u64	overrun;		/* events overwritten */
+	__u64	read;			/* events consumed */
+};
+
+#define TRACE_MMAP_IOCTL_GET_READER	_IO('T', 0x1)
+
+#endif /* _LINUX_TRACE_MMAP_H */
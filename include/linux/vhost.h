@@ -102,6 +102,10 @@ struct vhost_memory {
 #define VHOST_SET_VRING_BASE _IOW(VHOST_VIRTIO, 0x12, struct vhost_vring_state)
 /* Get accessor: reads index, writes value in num */
 #define VHOST_GET_VRING_BASE _IOWR(VHOST_VIRTIO, 0x12, struct vhost_vring_state)
+/* Bind the worker thread processing the ring to the CPU given in num, or
+ * let it run on any CPU again if num is ~0U. Unless the vq_workers module
+ * parameter is set, all rings share the worker of the device. */
+#define VHOST_SET_VRING_CPU _IOW(VHOST_VIRTIO, 0x13, struct vhost_vring_state)
 
 /* The following ioctls use eventfd file descriptors to signal and poll
  * for events. */
@@ -35,9 +35,28 @@ struct virtqueue {
  *	data: the token identifying the buffer.
  *	gfp: how to do memory allocations (if necessary).
  *      Returns remaining capacity of queue (sg segments) or a negative error.
+ * virtqueue_add_bufs: expose a batch of buffers to other end
+ *	vq: the struct virtqueue we're talking about.
+ *	sg: the description of the buffers, out_num + in_num sg per buffer.
+ *	num: the number of buffers; updated to the number of buffers added.
+ *	out_num: the number of sg of each buffer readable by other side
+ *	in_num: the number of sg of each buffer which are writable
+ *	data: the tokens identifying the buffers.
+ *	gfp: how to do memory allocations (if necessary).
+ *	Like num add_buf calls, but cheaper: the batch is exposed at once.
+ *	Returns remaining capacity of queue (sg segments), or the error of
+ *	the first buffer that couldn't be added (e.g. if the queue filled up).
  * virtqueue_kick: update after add_buf
  *	vq: the struct virtqueue
  *	After one or more add_buf calls, invoke this to kick the other side.
+ * virtqueue_kick_prepare: first half of split virtqueue_kick call.
+ *	vq: the struct virtqueue
+ *	Publishes the added buffers, and returns true if the other side
+ *	should be notified (using virtqueue_notify).
+ * virtqueue_notify: second half of split virtqueue_kick call.
+ *	vq: the struct virtqueue
+ *	Unlike the other operations, this one doesn't need the driver's lock,
+ *	so a (possibly slow) notification need not be done while holding it.
  * virtqueue_get_buf: get the next used buffer
  *	vq: the struct virtqueue we're talking about.
  *	len: the length written into the buffer
@@ -85,8 +104,20 @@ static inline int virtqueue_add_buf(struct virtqueue *vq,
 	return virtqueue_add_buf_gfp(vq, sg, out_num, in_num, data, GFP_ATOMIC);
 }
 
+int virtqueue_add_bufs_gfp(struct virtqueue *vq,
+			   struct scatterlist sg[],
+			   unsigned int *num,
+			   unsigned int out_num,
+			   unsigned int in_num,
+			   void *data[],
+			   gfp_t gfp);
+
 void virtqueue_kick(struct virtqueue *vq);
 
+bool virtqueue_kick_prepare(struct virtqueue *vq);
+
+void virtqueue_notify(struct virtqueue *vq);
+
 void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len);
 
 void virtqueue_disable_cb(struct virtqueue *vq);
@@ -31,18 +31,45 @@
 /* The feature bitmap for virtio balloon */
 #define VIRTIO_BALLOON_F_MUST_TELL_HOST	0 /* Tell before reclaiming pages */
 #define VIRTIO_BALLOON_F_STATS_VQ	1 /* Memory Stats virtqueue */
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT	3 /* VQ to report free pages */
+#define VIRTIO_BALLOON_F_PAGE_CHUNKS	6 /* Inflate/deflate in page ranges */
 
 /* Size of a PFN in the balloon interface. */
 #define VIRTIO_BALLOON_PFN_SHIFT 12
 
+/*
+ * With VIRTIO_BALLOON_F_PAGE_CHUNKS, the buffers on the inflate and
+ * deflate virtqueues carry an array of these, rather than an array of
+ * 32-bit PFNs: a range of physically contiguous pages each.
+ */
+struct virtio_balloon_chunk {
+	/* First PFN of the range */
+	__u64 base;
+	/* Number of pages in the range */
+	__u64 size;
+};
+
 struct virtio_balloon_config
 {
 	/* Number of pages host wants Guest to give up. */
 	__le32 num_pages;
 	/* Number of pages we've actually got in balloon. */
 	__le32 actual;
+	/* Free page hint command id, readonly by guest */
+	__le32 free_page_hint_cmd_id;
 };
 
+/*
+ * Free page hinting: when the host writes a new command id (other than the
+ * ones below) to free_page_hint_cmd_id, the guest sends that id on the
+ * free page virtqueue, followed by one buffer for each block of free
+ * memory it finds, and VIRTIO_BALLOON_CMD_ID_STOP once it's done (or the
+ * host wrote VIRTIO_BALLOON_CMD_ID_STOP itself).  The guest holds on to
+ * the blocks it reported until the host writes VIRTIO_BALLOON_CMD_ID_DONE.
+ */
+#define VIRTIO_BALLOON_CMD_ID_STOP	0
+#define VIRTIO_BALLOON_CMD_ID_DONE	1
+
 #define VIRTIO_BALLOON_S_SWAP_IN  0   /* Amount of memory swapped in */
 #define VIRTIO_BALLOON_S_SWAP_OUT 1   /* Amount of memory swapped out */
 #define VIRTIO_BALLOON_S_MAJFLT   2   /* Number of major faults */
@@ -41,10 +41,10 @@
 /* We've given up on this device. */
 #define VIRTIO_CONFIG_S_FAILED		0x80
 
-/* Some virtio feature bits (currently bits 28 through 31) are reserved for the
+/* Some virtio feature bits (currently bits 27 through 31) are reserved for the
  * transport being used (eg. virtio_ring), the rest are per-device feature
  * bits. */
-#define VIRTIO_TRANSPORT_F_START	28
+#define VIRTIO_TRANSPORT_F_START	27
 #define VIRTIO_TRANSPORT_F_END		32
 
 /* Do we get callbacks when the ring is completely used, even if we've
@@ -100,6 +100,11 @@
  *	vdev: the virtio_device
  *	This gives the final feature bits for the device: it can change
  *	the dev->feature bits if it wants.
+ * @set_vq_affinity: hint which cpu the interrupts of a virtqueue are for.
+ *	vq: the virtqueue
+ *	cpu: a cpu to add to the hint, or -1 to clear it.
+ *	Returns 0 on success or error status
+ *	Optional; repeated calls add up to a mask.
  */
 typedef void vq_callback_t(struct virtqueue *);
 struct virtio_config_ops {
@@ -117,6 +122,7 @@ struct virtio_config_ops {
 	void (*del_vqs)(struct virtio_device *);
 	u32 (*get_features)(struct virtio_device *vdev);
 	void (*finalize_features)(struct virtio_device *vdev);
+	int (*set_vq_affinity)(struct virtqueue *vq, int cpu);
 };
 
 /* If driver didn't advertise the feature, it will never appear. */
@@ -179,5 +185,22 @@ struct virtqueue *virtio_find_single_vq(struct virtio_device *vdev,
 		return ERR_PTR(err);
 	return vq;
 }
+
+/**
+ * virtqueue_set_affinity - hint which cpu a virtqueue's interrupts are for
+ * @vq: the virtqueue
+ * @cpu: the cpu to add to the hint, or -1 to clear it
+ *
+ * Drivers which spread their queues over the cpus use this so the
+ * transport can steer each queue's interrupt to the cpus using it.
+ * It's only a hint: transports which can't do it just ignore it. */
+static inline int virtqueue_set_affinity(struct virtqueue *vq, int cpu)
+{
+	struct virtio_device *vdev = vq->vdev;
+
+	if (vdev->config->set_vq_affinity)
+		return vdev->config->set_vq_affinity(vq, cpu);
+	return 0;
+}
 #endif /* __KERNEL__ */
 #endif /* _LINUX_VIRTIO_CONFIG_H */
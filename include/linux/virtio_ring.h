@@ -49,6 +49,10 @@
  * optimization.  */
 #define VRING_AVAIL_F_NO_INTERRUPT	1
 
+/* The Host uses the buffers in the order they were made available. The
+ * transport range was full, so it was extended down to bit 27 for this. */
+#define VIRTIO_RING_F_IN_ORDER		27
+
 /* We support indirect buffer descriptors */
 #define VIRTIO_RING_F_INDIRECT_DESC	28
 
@@ -58,6 +62,10 @@
  * at the end of the used ring. Guest should ignore the used->flags field. */
 #define VIRTIO_RING_F_EVENT_IDX		29
 
+/* The ring uses the packed layout (see struct vring_packed below). Bit 30
+ * is avoided, since some hosts use it to detect broken negotiation. */
+#define VIRTIO_RING_F_PACKED		31
+
 /* Virtio ring descriptors: 16 bytes.  These can chain together via "next". */
 struct vring_desc {
 	/* Address (guest-physical). */
@@ -146,6 +154,89 @@ static inline unsigned vring_size(unsigned int num, unsigned long align)
 		+ sizeof(__u16) * 3 + sizeof(struct vring_used_elem) * num;
 }
 
+/* The packed layout keeps all the state of a buffer in its descriptors,
+ * which are written in place by both sides, rather than spreading it over
+ * the descriptor table and the avail and used rings. A round trip of a
+ * buffer then only touches the cache lines of its descriptors.
+ *
+ * struct vring_packed
+ * {
+ *	// The actual descriptors (16 bytes each)
+ *	struct vring_packed_desc desc[num];
+ *
+ *	// Event suppression of the Guest, and then of the Host.
+ *	struct vring_packed_event driver;
+ *	struct vring_packed_event device;
+ * };
+ *
+ * The Guest makes a descriptor available by setting its AVAIL flag to its
+ * wrap counter, and its USED flag to the inverse. The Host marks it used
+ * by setting both flags to its own wrap counter. Both wrap counters start
+ * at 1, and are flipped whenever the respective side wraps the ring. A
+ * chain is used as a whole: the Host writes a single used descriptor (with
+ * the id of the chain) in the place of its first one, and skips the rest.
+ *
+ * It always fits in vring_size(), so transports can allocate the same
+ * memory for either layout. */
+
+/* Bit numbers of the AVAIL and USED flags of a packed descriptor. */
+#define VRING_PACKED_DESC_F_AVAIL	7
+#define VRING_PACKED_DESC_F_USED	15
+
+/* Values of the flags of a packed event suppression structure. */
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	1
+/* Only notify for the descriptor at off_wrap (with VIRTIO_RING_F_EVENT_IDX) */
+#define VRING_PACKED_EVENT_FLAG_DESC	2
+
+/* Bit number of the wrap counter in off_wrap. */
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
+/* Packed ring descriptors: 16 bytes. A chain is contiguous, so there's no
+ * "next" field, and the id identifies the chain rather than the slot. */
+struct vring_packed_desc {
+	/* Address (guest-physical). */
+	__u64 addr;
+	/* Length. */
+	__u32 len;
+	/* Buffer id. */
+	__u16 id;
+	/* The flags as indicated above, and the AVAIL/USED flags. */
+	__u16 flags;
+};
+
+struct vring_packed_event {
+	/* Descriptor offset, and the wrap counter in the MSB. */
+	__u16 off_wrap;
+	/* One of the VRING_PACKED_EVENT_FLAG_* values. */
+	__u16 flags;
+};
+
+struct vring_packed {
+	unsigned int num;
+
+	struct vring_packed_desc *desc;
+
+	struct vring_packed_event *driver;
+
+	struct vring_packed_event *device;
+};
+
+static inline void vring_packed_init(struct vring_packed *vr,
+				     unsigned int num, void *p)
+{
+	vr->num = num;
+	vr->desc = p;
+	vr->driver = p + num*sizeof(struct vring_packed_desc);
+	vr->device = vr->driver + 1;
+}
+
+static inline unsigned vring_packed_size(unsigned int num)
+{
+	return sizeof(struct vring_packed_desc) * num
+		+ sizeof(struct vring_packed_event) * 2;
+}
+
 /* The following is used with USED_EVENT_IDX and AVAIL_EVENT_IDX */
 /* Assuming a given event_idx value from the other size, if
  * we have just incremented index from old to new_idx,
@@ -172,6 +263,7 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 				      void (*notify)(struct virtqueue *vq),
 				      void (*callback)(struct virtqueue *vq),
 				      const char *name);
+void vring_reset_virtqueue(struct virtqueue *vq);
 void vring_del_virtqueue(struct virtqueue *vq);
 /* Filter out transport-specific feature bits. */
 void vring_transport_features(struct virtio_device *vdev);
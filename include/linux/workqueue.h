@@ -10,6 +10,7 @@
 #include <linux/bitops.h>
 #include <linux/lockdep.h>
 #include <linux/threads.h>
+#include <linux/numa.h>
 #include <asm/atomic.h>
 
 struct workqueue_struct;
@@ -56,7 +57,8 @@ enum {
 
 	/* special cpu IDs */
 	WORK_CPU_UNBOUND	= NR_CPUS,
-	WORK_CPU_NONE		= NR_CPUS + 1,
+	WORK_CPU_NODE		= NR_CPUS + 1,	/* + node, per-node unbound */
+	WORK_CPU_NONE		= NR_CPUS + 1 + MAX_NUMNODES,
 	WORK_CPU_LAST		= WORK_CPU_NONE,
 
 	/*
@@ -257,6 +259,7 @@ enum {
 
 	WQ_DYING		= 1 << 6, /* internal: workqueue is dying */
 	WQ_RESCUER		= 1 << 7, /* internal: workqueue has rescuer */
+	WQ_NUMA			= 1 << 8, /* internal: per-node unbound cwqs */
 
 	WQ_MAX_ACTIVE		= 512,	  /* I like 512, better ideas? */
 	WQ_MAX_UNBOUND_PER_CPU	= 4,	  /* 4 * #cpus for unbound wq */
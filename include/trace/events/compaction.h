@@ -67,6 +67,47 @@ TRACE_EVENT(mm_compaction_migratepages,
 		__entry->nr_failed)
 );
 
+TRACE_EVENT(mm_compaction_direct_begin,
+
+	TP_PROTO(int order, gfp_t gfp_mask, bool sync),
+
+	TP_ARGS(order, gfp_mask, sync),
+
+	TP_STRUCT__entry(
+		__field(int, order)
+		__field(gfp_t, gfp_mask)
+		__field(bool, sync)
+	),
+
+	TP_fast_assign(
+		__entry->order = order;
+		__entry->gfp_mask = gfp_mask;
+		__entry->sync = sync;
+	),
+
+	TP_printk("order=%d gfp_mask=%s sync=%d",
+		__entry->order,
+		show_gfp_flags(__entry->gfp_mask),
+		__entry->sync)
+);
+
+TRACE_EVENT(mm_compaction_direct_end,
+
+	TP_PROTO(int status),
+
+	TP_ARGS(status),
+
+	TP_STRUCT__entry(
+		__field(int, status)
+	),
+
+	TP_fast_assign(
+		__entry->status = status;
+	),
+
+	TP_printk("status=%d", __entry->status)
+);
+
 
 #endif /* _TRACE_COMPACTION_H */
 
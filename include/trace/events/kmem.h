@@ -147,6 +147,55 @@ DEFINE_EVENT(kmem_free, kmem_cache_free,
 	TP_ARGS(call_site, ptr)
 );
 
+/*
+ * A slab cache allocates a new slab from the page allocator, on behalf of
+ * the allocation at call_site.
+ */
+TRACE_EVENT(kmem_cache_grow_begin,
+
+	TP_PROTO(unsigned long call_site, size_t bytes, unsigned int order,
+		 gfp_t gfp_flags),
+
+	TP_ARGS(call_site, bytes, order, gfp_flags),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	call_site	)
+		__field(	size_t,		bytes		)
+		__field(	unsigned int,	order		)
+		__field(	gfp_t,		gfp_flags	)
+	),
+
+	TP_fast_assign(
+		__entry->call_site	= call_site;
+		__entry->bytes		= bytes;
+		__entry->order		= order;
+		__entry->gfp_flags	= gfp_flags;
+	),
+
+	TP_printk("call_site=%lx bytes=%zu order=%u gfp_flags=%s",
+		__entry->call_site,
+		__entry->bytes,
+		__entry->order,
+		show_gfp_flags(__entry->gfp_flags))
+);
+
+TRACE_EVENT(kmem_cache_grow_end,
+
+	TP_PROTO(struct page *page),
+
+	TP_ARGS(page),
+
+	TP_STRUCT__entry(
+		__field(	struct page *,	page		)
+	),
+
+	TP_fast_assign(
+		__entry->page		= page;
+	),
+
+	TP_printk("page=%p", __entry->page)
+);
+
 TRACE_EVENT(mm_page_free_direct,
 
 	TP_PROTO(struct page *page, unsigned int order),
@@ -220,6 +269,58 @@ TRACE_EVENT(mm_page_alloc,
 		show_gfp_flags(__entry->gfp_flags))
 );
 
+/*
+ * The slow path of the page allocator: kswapd wakeup, direct compaction
+ * and reclaim, retries. Between the two events, the task is stalled on
+ * memory.
+ */
+TRACE_EVENT(mm_page_alloc_slowpath_begin,
+
+	TP_PROTO(unsigned long call_site, unsigned int order,
+			gfp_t gfp_flags),
+
+	TP_ARGS(call_site, order, gfp_flags),
+
+	TP_STRUCT__entry(
+		__field(	unsigned long,	call_site	)
+		__field(	unsigned int,	order		)
+		__field(	gfp_t,		gfp_flags	)
+	),
+
+	TP_fast_assign(
+		__entry->call_site	= call_site;
+		__entry->order		= order;
+		__entry->gfp_flags	= gfp_flags;
+	),
+
+	TP_printk("call_site=%lx order=%u gfp_flags=%s",
+		__entry->call_site,
+		__entry->order,
+		show_gfp_flags(__entry->gfp_flags))
+);
+
+TRACE_EVENT(mm_page_alloc_slowpath_end,
+
+	TP_PROTO(struct page *page, unsigned int order),
+
+	TP_ARGS(page, order),
+
+	TP_STRUCT__entry(
+		__field(	struct page *,	page		)
+		__field(	unsigned int,	order		)
+	),
+
+	TP_fast_assign(
+		__entry->page		= page;
+		__entry->order		= order;
+	),
+
+	TP_printk("page=%p pfn=%lu order=%u",
+		__entry->page,
+		__entry->page ? page_to_pfn(__entry->page) : 0,
+		__entry->order)
+);
+
 DECLARE_EVENT_CLASS(mm_page,
 
 	TP_PROTO(struct page *page, unsigned int order, int migratetype),
@@ -0,0 +1,139 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rpmsg
+
+#if !defined(_TRACE_RPMSG_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_RPMSG_H
+
+#include <linux/tracepoint.h>
+#include <linux/virtio.h>
+
+DECLARE_EVENT_CLASS(rpmsg_msg,
+
+	TP_PROTO(struct virtqueue *vq, u32 src, u32 dst, u16 len),
+
+	TP_ARGS(vq, src, dst, len),
+
+	TP_STRUCT__entry(
+		__field(int, vdev)
+		__string(vq, vq->name)
+		__field(u32, src)
+		__field(u32, dst)
+		__field(u16, len)
+	),
+
+	TP_fast_assign(
+		__entry->vdev = vq->vdev->index;
+		__assign_str(vq, vq->name);
+		__entry->src = src;
+		__entry->dst = dst;
+		__entry->len = len;
+	),
+
+	TP_printk("virtio%d %s src=0x%x dst=0x%x len=%u", __entry->vdev,
+		__get_str(vq), __entry->src, __entry->dst, __entry->len)
+);
+
+/* a message was handed over to the remote processor */
+DEFINE_EVENT(rpmsg_msg, rpmsg_send,
+
+	TP_PROTO(struct virtqueue *vq, u32 src, u32 dst, u16 len),
+
+	TP_ARGS(vq, src, dst, len)
+);
+
+/* an inbound message is about to be dispatched to its recipient */
+DEFINE_EVENT(rpmsg_msg, rpmsg_recv,
+
+	TP_PROTO(struct virtqueue *vq, u32 src, u32 dst, u16 len),
+
+	TP_ARGS(vq, src, dst, len)
+);
+
+DECLARE_EVENT_CLASS(rpmsg_vq,
+
+	TP_PROTO(struct virtqueue *vq),
+
+	TP_ARGS(vq),
+
+	TP_STRUCT__entry(
+		__field(int, vdev)
+		__string(vq, vq->name)
+	),
+
+	TP_fast_assign(
+		__entry->vdev = vq->vdev->index;
+		__assign_str(vq, vq->name);
+	),
+
+	TP_printk("virtio%d %s", __entry->vdev, __get_str(vq))
+);
+
+/* the remote processor notified us that it used some rx buffers */
+DEFINE_EVENT(rpmsg_vq, rpmsg_recv_done,
+
+	TP_PROTO(struct virtqueue *vq),
+
+	TP_ARGS(vq)
+);
+
+/* the remote processor notified us that it consumed some tx buffers */
+DEFINE_EVENT(rpmsg_vq, rpmsg_xmit_done,
+
+	TP_PROTO(struct virtqueue *vq),
+
+	TP_ARGS(vq)
+);
+
+/* a name service announcement arrived */
+TRACE_EVENT(rpmsg_ns,
+
+	TP_PROTO(struct virtio_device *vdev, const char *name, u32 addr,
+								u32 flags),
+
+	TP_ARGS(vdev, name, addr, flags),
+
+	TP_STRUCT__entry(
+		__field(int, vdev)
+		__string(name, name)
+		__field(u32, addr)
+		__field(u32, flags)
+	),
+
+	TP_fast_assign(
+		__entry->vdev = vdev->index;
+		__assign_str(name, name);
+		__entry->addr = addr;
+		__entry->flags = flags;
+	),
+
+	TP_printk("virtio%d %s addr=0x%x flags=0x%x", __entry->vdev,
+		__get_str(name), __entry->addr, __entry->flags)
+);
+
+/* a platform-specific backend is about to interrupt the remote processor */
+TRACE_EVENT(rpmsg_notify,
+
+	TP_PROTO(struct virtqueue *vq, int vq_id),
+
+	TP_ARGS(vq, vq_id),
+
+	TP_STRUCT__entry(
+		__field(int, vdev)
+		__string(vq, vq->name)
+		__field(int, vq_id)
+	),
+
+	TP_fast_assign(
+		__entry->vdev = vq->vdev->index;
+		__assign_str(vq, vq->name);
+		__entry->vq_id = vq_id;
+	),
+
+	TP_printk("virtio%d %s vq_id=%d", __entry->vdev, __get_str(vq),
+		__entry->vq_id)
+);
+
+#endif /* _TRACE_RPMSG_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
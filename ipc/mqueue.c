@@ -33,6 +33,7 @@
 #include <linux/pid.h>
 #include <linux/ipc_namespace.h>
 #include <linux/slab.h>
+#include <linux/rbtree.h>
 
 #include <net/sock.h>
 #include "util.h"
@@ -48,6 +49,13 @@
 #define STATE_PENDING	1
 #define STATE_READY	2
 
+/* all messages of one priority, in FIFO order */
+struct posix_msg_tree_node {
+	struct rb_node		rb_node;
+	struct list_head	msg_list;
+	int			priority;
+};
+
 struct ext_wait_queue {		/* queue of sleeping tasks */
 	struct task_struct *task;
 	struct list_head list;
@@ -60,7 +68,8 @@ struct mqueue_inode_info {
 	struct inode vfs_inode;
 	wait_queue_head_t wait_q;
 
-	struct msg_msg **messages;
+	struct rb_root msg_tree;	/* posix_msg_tree_nodes, by priority */
+	struct posix_msg_tree_node *node_cache;	/* spare tree node */
 	struct mq_attr attr;
 
 	struct sigevent notify;
@@ -107,6 +116,78 @@ static struct ipc_namespace *get_ns_from_inode(struct inode *inode)
 	return ns;
 }
 
+/*
+ * Auxiliary functions to manipulate the message tree.
+ *
+ * Each priority that has messages queued has a node in the tree, holding
+ * a FIFO list of these messages. Inserting a message needs a new node only
+ * for the first message of a priority; it uses info->node_cache if that is
+ * set, which mq_timedsend() and mq_timedreceive() fill with an allocation
+ * made before taking info->lock, and which gets the nodes freed by
+ * msg_get().
+ */
+static int msg_insert(struct msg_msg *msg, struct mqueue_inode_info *info)
+{
+	struct rb_node **p, *parent = NULL;
+	struct posix_msg_tree_node *leaf;
+
+	p = &info->msg_tree.rb_node;
+	while (*p) {
+		parent = *p;
+		leaf = rb_entry(parent, struct posix_msg_tree_node, rb_node);
+
+		if (likely(leaf->priority == msg->m_type))
+			goto insert_msg;
+		else if (msg->m_type < leaf->priority)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	if (info->node_cache) {
+		leaf = info->node_cache;
+		info->node_cache = NULL;
+	} else {
+		leaf = kmalloc(sizeof(*leaf), GFP_ATOMIC);
+		if (!leaf)
+			return -ENOMEM;
+	}
+	leaf->priority = msg->m_type;
+	INIT_LIST_HEAD(&leaf->msg_list);
+	rb_link_node(&leaf->rb_node, parent, p);
+	rb_insert_color(&leaf->rb_node, &info->msg_tree);
+insert_msg:
+	info->attr.mq_curmsgs++;
+	info->qsize += msg->m_ts;
+	list_add_tail(&msg->m_list, &leaf->msg_list);
+	return 0;
+}
+
+/* removes the oldest message of the highest priority, NULL if empty */
+static struct msg_msg *msg_get(struct mqueue_inode_info *info)
+{
+	struct rb_node *last;
+	struct posix_msg_tree_node *leaf;
+	struct msg_msg *msg;
+
+	last = rb_last(&info->msg_tree);
+	if (!last)
+		return NULL;
+
+	leaf = rb_entry(last, struct posix_msg_tree_node, rb_node);
+	msg = list_first_entry(&leaf->msg_list, struct msg_msg, m_list);
+	list_del(&msg->m_list);
+	if (list_empty(&leaf->msg_list)) {
+		rb_erase(&leaf->rb_node, &info->msg_tree);
+		if (info->node_cache)
+			kfree(leaf);
+		else
+			info->node_cache = leaf;
+	}
+	info->attr.mq_curmsgs--;
+	info->qsize -= msg->m_ts;
+	return msg;
+}
+
 static struct inode *mqueue_get_inode(struct super_block *sb,
 		struct ipc_namespace *ipc_ns, int mode,
 		struct mq_attr *attr)
@@ -126,7 +207,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 		if (S_ISREG(mode)) {
 			struct mqueue_inode_info *info;
 			struct task_struct *p = current;
-			unsigned long mq_bytes, mq_msg_tblsz;
+			unsigned long mq_bytes;
 
 			inode->i_fop = &mqueue_file_operations;
 			inode->i_size = FILENT_SIZE;
@@ -137,6 +218,8 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 			INIT_LIST_HEAD(&info->e_wait_q[0].list);
 			INIT_LIST_HEAD(&info->e_wait_q[1].list);
 			info->notify_owner = NULL;
+			info->msg_tree = RB_ROOT;
+			info->node_cache = NULL;
 			info->qsize = 0;
 			info->user = NULL;	/* set when all is ok */
 			memset(&info->attr, 0, sizeof(info->attr));
@@ -146,20 +229,20 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 				info->attr.mq_maxmsg = attr->mq_maxmsg;
 				info->attr.mq_msgsize = attr->mq_msgsize;
 			}
-			mq_msg_tblsz = info->attr.mq_maxmsg * sizeof(struct msg_msg *);
-			info->messages = kmalloc(mq_msg_tblsz, GFP_KERNEL);
-			if (!info->messages)
-				goto out_inode;
-
-			mq_bytes = (mq_msg_tblsz +
-				(info->attr.mq_maxmsg * info->attr.mq_msgsize));
+			/*
+			 * Messages are kept in a tree of per-priority lists
+			 * now, but the queue is charged as it was when they
+			 * were kept in an array of pointers, so that existing
+			 * RLIMIT_MSGQUEUE settings keep working.
+			 */
+			mq_bytes = info->attr.mq_maxmsg * (sizeof(struct msg_msg *)
+				+ info->attr.mq_msgsize);
 
 			spin_lock(&mq_lock);
 			if (u->mq_bytes + mq_bytes < u->mq_bytes ||
 		 	    u->mq_bytes + mq_bytes >
 			    task_rlimit(p, RLIMIT_MSGQUEUE)) {
 				spin_unlock(&mq_lock);
-				/* mqueue_evict_inode() releases info->messages */
 				goto out_inode;
 			}
 			u->mq_bytes += mq_bytes;
@@ -254,7 +337,7 @@ static void mqueue_evict_inode(struct inode *inode)
 	struct mqueue_inode_info *info;
 	struct user_struct *user;
 	unsigned long mq_bytes;
-	int i;
+	struct msg_msg *msg;
 	struct ipc_namespace *ipc_ns;
 
 	end_writeback(inode);
@@ -265,9 +348,10 @@ static void mqueue_evict_inode(struct inode *inode)
 	ipc_ns = get_ns_from_inode(inode);
 	info = MQUEUE_I(inode);
 	spin_lock(&info->lock);
-	for (i = 0; i < info->attr.mq_curmsgs; i++)
-		free_msg(info->messages[i]);
-	kfree(info->messages);
+	while ((msg = msg_get(info)) != NULL)
+		free_msg(msg);
+	kfree(info->node_cache);
+	info->node_cache = NULL;
 	spin_unlock(&info->lock);
 
 	/* Total amount of bytes accounted for the mqueue */
@@ -491,26 +575,6 @@ static struct ext_wait_queue *wq_get_first_waiter(
 	return list_entry(ptr, struct ext_wait_queue, list);
 }
 
-/* Auxiliary functions to manipulate messages' list */
-static void msg_insert(struct msg_msg *ptr, struct mqueue_inode_info *info)
-{
-	int k;
-
-	k = info->attr.mq_curmsgs - 1;
-	while (k >= 0 && info->messages[k]->m_type >= ptr->m_type) {
-		info->messages[k + 1] = info->messages[k];
-		k--;
-	}
-	info->attr.mq_curmsgs++;
-	info->qsize += ptr->m_ts;
-	info->messages[k + 1] = ptr;
-}
-
-static inline struct msg_msg *msg_get(struct mqueue_inode_info *info)
-{
-	info->qsize -= info->messages[--info->attr.mq_curmsgs]->m_ts;
-	return info->messages[info->attr.mq_curmsgs];
-}
 
 static inline void set_cookie(struct sk_buff *skb, char code)
 {
@@ -836,7 +900,14 @@ static inline void pipelined_receive(struct mqueue_inode_info *info)
 		wake_up_interruptible(&info->wait_q);
 		return;
 	}
-	msg_insert(sender->msg, info);
+	/*
+	 * Only fails if no tree node can be allocated; the sender then
+	 * stays queued until the next receive.
+	 */
+	if (msg_insert(sender->msg, info)) {
+		wake_up_interruptible(&info->wait_q);
+		return;
+	}
 	list_del(&sender->list);
 	sender->state = STATE_PENDING;
 	wake_up_process(sender->task);
@@ -854,6 +925,7 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 	struct ext_wait_queue *receiver;
 	struct msg_msg *msg_ptr;
 	struct mqueue_inode_info *info;
+	struct posix_msg_tree_node *new_leaf = NULL;
 	ktime_t expires, *timeout = NULL;
 	struct timespec ts;
 	int ret;
@@ -904,8 +976,17 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 	msg_ptr->m_ts = msg_len;
 	msg_ptr->m_type = msg_prio;
 
+	/* The tree node a new priority needs, unless one is cached */
+	if (!info->node_cache)
+		new_leaf = kmalloc(sizeof(*new_leaf), GFP_KERNEL);
+
 	spin_lock(&info->lock);
 
+	if (!info->node_cache && new_leaf) {
+		info->node_cache = new_leaf;
+		new_leaf = NULL;
+	}
+
 	if (info->attr.mq_curmsgs == info->attr.mq_maxmsg) {
 		if (filp->f_flags & O_NONBLOCK) {
 			spin_unlock(&info->lock);
@@ -922,16 +1003,21 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 		receiver = wq_get_first_waiter(info, RECV);
 		if (receiver) {
 			pipelined_send(info, msg_ptr, receiver);
+			ret = 0;
 		} else {
 			/* adds message to the queue */
-			msg_insert(msg_ptr, info);
-			__do_notify(info);
+			ret = msg_insert(msg_ptr, info);
+			if (!ret)
+				__do_notify(info);
 		}
-		inode->i_atime = inode->i_mtime = inode->i_ctime =
-				CURRENT_TIME;
+		if (!ret)
+			inode->i_atime = inode->i_mtime = inode->i_ctime =
+					CURRENT_TIME;
 		spin_unlock(&info->lock);
-		ret = 0;
+		if (ret)
+			free_msg(msg_ptr);
 	}
+	kfree(new_leaf);
 out_fput:
 	fput(filp);
 out:
@@ -948,6 +1034,7 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 	struct inode *inode;
 	struct mqueue_inode_info *info;
 	struct ext_wait_queue wait;
+	struct posix_msg_tree_node *new_leaf = NULL;
 	ktime_t expires, *timeout = NULL;
 	struct timespec ts;
 
@@ -985,7 +1072,20 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 		goto out_fput;
 	}
 
+	/*
+	 * A sender woken by pipelined_receive() may need a tree node for
+	 * its message.
+	 */
+	if (!info->node_cache)
+		new_leaf = kmalloc(sizeof(*new_leaf), GFP_KERNEL);
+
 	spin_lock(&info->lock);
+
+	if (!info->node_cache && new_leaf) {
+		info->node_cache = new_leaf;
+		new_leaf = NULL;
+	}
+
 	if (info->attr.mq_curmsgs == 0) {
 		if (filp->f_flags & O_NONBLOCK) {
 			spin_unlock(&info->lock);
@@ -1007,6 +1107,7 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 		spin_unlock(&info->lock);
 		ret = 0;
 	}
+	kfree(new_leaf);
 	if (ret == 0) {
 		ret = msg_ptr->m_ts;
 
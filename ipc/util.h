@@ -121,6 +121,8 @@ void* ipc_rcu_alloc(int size);
 void ipc_rcu_getref(void *ptr);
 void ipc_rcu_putref(void *ptr);
 
+struct kern_ipc_perm *ipc_obtain_object(struct ipc_ids *ids, int id);
+struct kern_ipc_perm *ipc_obtain_object_check(struct ipc_ids *ids, int id);
 struct kern_ipc_perm *ipc_lock(struct ipc_ids *, int);
 
 void kernel_to_ipc64_perm(struct kern_ipc_perm *in, struct ipc64_perm *out);
@@ -149,7 +151,8 @@ static inline int ipc_buildid(int id, int seq)
 }
 
 /*
- * Must be called with ipcp locked
+ * Must be called with ipcp locked, or inside an RCU read side critical
+ * section (the sequence of an object never changes)
  */
 static inline int ipc_checkid(struct kern_ipc_perm *ipcp, int uid)
 {
@@ -24,6 +24,7 @@ extern int noirqdebug;
  * IRQTF_WARNED    - warning "IRQ_WAKE_THREAD w/o thread_fn" has been printed
  * IRQTF_AFFINITY  - irq thread is requested to adjust affinity
  * IRQTF_FORCED_THREAD  - irq action is force threaded
+ * IRQTF_PRIO      - irq thread is requested to adjust its priority
  */
 enum {
 	IRQTF_RUNTHREAD,
@@ -31,6 +32,7 @@ enum {
 	IRQTF_WARNED,
 	IRQTF_AFFINITY,
 	IRQTF_FORCED_THREAD,
+	IRQTF_PRIO,
 };
 
 /*
@@ -100,6 +102,7 @@ static inline void unregister_handler_proc(unsigned int irq,
 extern int irq_select_affinity_usr(unsigned int irq, struct cpumask *mask);
 
 extern void irq_set_thread_affinity(struct irq_desc *desc);
+extern void irq_set_thread_prio(struct irq_desc *desc);
 
 /* Inline functions for support of irq chips on slow busses */
 static inline void chip_bus_lock(struct irq_desc *desc)
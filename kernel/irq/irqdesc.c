@@ -46,6 +46,13 @@ static int alloc_masks(struct irq_desc *desc, gfp_t gfp, int node)
 		return -ENOMEM;
 	}
 #endif
+	if (!zalloc_cpumask_var_node(&desc->thread_affinity, gfp, node)) {
+#ifdef CONFIG_GENERIC_PENDING_IRQ
+		free_cpumask_var(desc->pending_mask);
+#endif
+		free_cpumask_var(desc->irq_data.affinity);
+		return -ENOMEM;
+	}
 	return 0;
 }
 
@@ -56,6 +63,7 @@ static void desc_smp_init(struct irq_desc *desc, int node)
 #ifdef CONFIG_GENERIC_PENDING_IRQ
 	cpumask_clear(desc->pending_mask);
 #endif
+	cpumask_clear(desc->thread_affinity);
 }
 
 static inline int desc_node(struct irq_desc *desc)
@@ -85,6 +93,7 @@ static void desc_set_defaults(unsigned int irq, struct irq_desc *desc, int node)
 	desc->depth = 1;
 	desc->irq_count = 0;
 	desc->irqs_unhandled = 0;
+	desc->thread_prio = 0;
 	desc->name = NULL;
 	for_each_possible_cpu(cpu)
 		*per_cpu_ptr(desc->kstat_irqs, cpu) = 0;
@@ -122,6 +131,7 @@ static void free_masks(struct irq_desc *desc)
 #ifdef CONFIG_GENERIC_PENDING_IRQ
 	free_cpumask_var(desc->pending_mask);
 #endif
+	free_cpumask_var(desc->thread_affinity);
 	free_cpumask_var(desc->irq_data.affinity);
 }
 #else
@@ -111,6 +111,24 @@ void irq_set_thread_affinity(struct irq_desc *desc)
 	}
 }
 
+/**
+ *	irq_set_thread_prio - Notify irq threads to adjust priority
+ *	@desc:		irq descriptor which has thread_prio changed
+ *
+ *	Same as irq_set_thread_affinity(), for the priority: the threads
+ *	apply desc->thread_prio themselves, the next time they run.
+ */
+void irq_set_thread_prio(struct irq_desc *desc)
+{
+	struct irqaction *action = desc->action;
+
+	while (action) {
+		if (action->thread)
+			set_bit(IRQTF_PRIO, &action->thread_flags);
+		action = action->next;
+	}
+}
+
 #ifdef CONFIG_GENERIC_PENDING_IRQ
 static inline bool irq_can_move_pcntxt(struct irq_data *data)
 {
@@ -708,8 +726,15 @@ irq_thread_check_affinity(struct irq_desc *desc, struct irqaction *action)
 		return;
 	}
 
+	/*
+	 * The threads follow the affinity of the irq, unless they were
+	 * given one of their own
+	 */
 	raw_spin_lock_irq(&desc->lock);
-	cpumask_copy(mask, desc->irq_data.affinity);
+	if (cpumask_empty(desc->thread_affinity))
+		cpumask_copy(mask, desc->irq_data.affinity);
+	else
+		cpumask_copy(mask, desc->thread_affinity);
 	raw_spin_unlock_irq(&desc->lock);
 
 	set_cpus_allowed_ptr(current, mask);
@@ -720,6 +745,26 @@ static inline void
 irq_thread_check_affinity(struct irq_desc *desc, struct irqaction *action) { }
 #endif
 
+/*
+ * Irq threads run SCHED_FIFO, at MAX_USER_RT_PRIO/2 unless some other
+ * priority was set for the irq (/proc/irq/<irq>/thread_prio).
+ */
+static void irq_thread_set_prio(struct irq_desc *desc)
+{
+	struct sched_param param = {
+		.sched_priority = desc->thread_prio ? : MAX_USER_RT_PRIO/2,
+	};
+
+	sched_setscheduler(current, SCHED_FIFO, &param);
+}
+
+static void
+irq_thread_check_prio(struct irq_desc *desc, struct irqaction *action)
+{
+	if (test_and_clear_bit(IRQTF_PRIO, &action->thread_flags))
+		irq_thread_set_prio(desc);
+}
+
 /*
  * Interrupts which are not explicitely requested as threaded
  * interrupts rely on the implicit bh/preempt disable of the hard irq
@@ -758,9 +803,6 @@ static irqreturn_t irq_thread_fn(struct irq_desc *desc,
  */
 static int irq_thread(void *data)
 {
-	static const struct sched_param param = {
-		.sched_priority = MAX_USER_RT_PRIO/2,
-	};
 	struct irqaction *action = data;
 	struct irq_desc *desc = irq_to_desc(action->irq);
 	irqreturn_t (*handler_fn)(struct irq_desc *desc,
@@ -773,12 +815,13 @@ static int irq_thread(void *data)
 	else
 		handler_fn = irq_thread_fn;
 
-	sched_setscheduler(current, SCHED_FIFO, &param);
+	irq_thread_set_prio(desc);
 	current->irqaction = action;
 
 	while (!irq_wait_for_interrupt(action)) {
 
 		irq_thread_check_affinity(desc, action);
+		irq_thread_check_prio(desc, action);
 
 		atomic_inc(&desc->threads_active);
 
@@ -938,6 +981,8 @@ __setup_irq(unsigned int irq, struct irq_desc *desc, struct irqaction *new)
 		 */
 		get_task_struct(t);
 		new->thread = t;
+		/* Pick up the affinity of the irq, or the one of its threads */
+		set_bit(IRQTF_AFFINITY, &new->thread_flags);
 	}
 
 	if (!alloc_cpumask_var(&mask, GFP_KERNEL)) {
@@ -8,6 +8,7 @@
 
 #include <linux/irq.h>
 #include <linux/gfp.h>
+#include <linux/sched.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/interrupt.h>
@@ -223,6 +224,67 @@ static const struct file_operations default_affinity_proc_fops = {
 	.write		= default_affinity_write,
 };
 
+static int irq_thread_affinity_proc_show(struct seq_file *m, void *v)
+{
+	struct irq_desc *desc = irq_to_desc((long)m->private);
+
+	seq_cpumask_list(m, desc->thread_affinity);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+/*
+ * Give the threads of the irq an affinity of their own, instead of the
+ * one of the irq. An empty list makes them follow the irq again.
+ */
+static ssize_t irq_thread_affinity_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	unsigned int irq = (int)(long)PDE(file->f_path.dentry->d_inode)->data;
+	struct irq_desc *desc = irq_to_desc(irq);
+	cpumask_var_t new_value;
+	unsigned long flags;
+	int err;
+
+	if (!alloc_cpumask_var(&new_value, GFP_KERNEL))
+		return -ENOMEM;
+
+	err = cpumask_parselist_user(buffer, count, new_value);
+	if (err)
+		goto free_cpumask;
+
+	if (!cpumask_empty(new_value) &&
+	    !cpumask_intersects(new_value, cpu_online_mask)) {
+		err = -EINVAL;
+		goto free_cpumask;
+	}
+
+	raw_spin_lock_irqsave(&desc->lock, flags);
+	cpumask_copy(desc->thread_affinity, new_value);
+	irq_set_thread_affinity(desc);
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+	err = count;
+
+free_cpumask:
+	free_cpumask_var(new_value);
+	return err;
+}
+
+static int irq_thread_affinity_proc_open(struct inode *inode,
+					 struct file *file)
+{
+	return single_open(file, irq_thread_affinity_proc_show,
+			   PDE(inode)->data);
+}
+
+static const struct file_operations irq_thread_affinity_proc_fops = {
+	.open		= irq_thread_affinity_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= irq_thread_affinity_proc_write,
+};
+
 static int irq_node_proc_show(struct seq_file *m, void *v)
 {
 	struct irq_desc *desc = irq_to_desc((long) m->private);
@@ -244,6 +306,54 @@ static const struct file_operations irq_node_proc_fops = {
 };
 #endif
 
+static int irq_thread_prio_proc_show(struct seq_file *m, void *v)
+{
+	struct irq_desc *desc = irq_to_desc((long) m->private);
+
+	seq_printf(m, "%d\n", desc->thread_prio ? : MAX_USER_RT_PRIO/2);
+	return 0;
+}
+
+/*
+ * Set the SCHED_FIFO priority of the threads of the irq; 0 restores
+ * the default one. The threads switch over the next time they run.
+ */
+static ssize_t irq_thread_prio_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	unsigned int irq = (int)(long)PDE(file->f_path.dentry->d_inode)->data;
+	struct irq_desc *desc = irq_to_desc(irq);
+	unsigned long flags;
+	int prio, err;
+
+	err = kstrtoint_from_user(buffer, count, 0, &prio);
+	if (err)
+		return err;
+
+	if (prio < 0 || prio >= MAX_USER_RT_PRIO)
+		return -EINVAL;
+
+	raw_spin_lock_irqsave(&desc->lock, flags);
+	desc->thread_prio = prio;
+	irq_set_thread_prio(desc);
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+	return count;
+}
+
+static int irq_thread_prio_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_thread_prio_proc_show, PDE(inode)->data);
+}
+
+static const struct file_operations irq_thread_prio_proc_fops = {
+	.open		= irq_thread_prio_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= irq_thread_prio_proc_write,
+};
+
 static int irq_spurious_proc_show(struct seq_file *m, void *v)
 {
 	struct irq_desc *desc = irq_to_desc((long) m->private);
@@ -337,8 +447,16 @@ void register_irq_proc(unsigned int irq, struct irq_desc *desc)
 
 	proc_create_data("node", 0444, desc->dir,
 			 &irq_node_proc_fops, (void *)(long)irq);
+
+	/* create /proc/irq/<irq>/thread_affinity_list */
+	proc_create_data("thread_affinity_list", 0600, desc->dir,
+			 &irq_thread_affinity_proc_fops, (void *)(long)irq);
 #endif
 
+	/* create /proc/irq/<irq>/thread_prio */
+	proc_create_data("thread_prio", 0600, desc->dir,
+			 &irq_thread_prio_proc_fops, (void *)(long)irq);
+
 	proc_create_data("spurious", 0444, desc->dir,
 			 &irq_spurious_proc_fops, (void *)(long)irq);
 }
@@ -354,7 +472,9 @@ void unregister_irq_proc(unsigned int irq, struct irq_desc *desc)
 	remove_proc_entry("affinity_hint", desc->dir);
 	remove_proc_entry("smp_affinity_list", desc->dir);
 	remove_proc_entry("node", desc->dir);
+	remove_proc_entry("thread_affinity_list", desc->dir);
 #endif
+	remove_proc_entry("thread_prio", desc->dir);
 	remove_proc_entry("spurious", desc->dir);
 
 	memset(name, 0, MAX_NAMELEN);
@@ -47,6 +47,7 @@ int __kfifo_alloc(struct __kfifo *fifo, unsigned int size,
 
 	fifo->in = 0;
 	fifo->out = 0;
+	fifo->reserved = 0;
 	fifo->esize = esize;
 
 	if (size < 2) {
@@ -72,6 +73,7 @@ void __kfifo_free(struct __kfifo *fifo)
 	kfree(fifo->data);
 	fifo->in = 0;
 	fifo->out = 0;
+	fifo->reserved = 0;
 	fifo->esize = 0;
 	fifo->data = NULL;
 	fifo->mask = 0;
@@ -88,6 +90,7 @@ int __kfifo_init(struct __kfifo *fifo, void *buffer,
 
 	fifo->in = 0;
 	fifo->out = 0;
+	fifo->reserved = 0;
 	fifo->esize = esize;
 	fifo->data = buffer;
 
@@ -101,7 +104,7 @@ int __kfifo_init(struct __kfifo *fifo, void *buffer,
 }
 EXPORT_SYMBOL(__kfifo_init);
 
-static void kfifo_copy_in(struct __kfifo *fifo, const void *src,
+static void kfifo_memcpy_in(struct __kfifo *fifo, const void *src,
 		unsigned int len, unsigned int off)
 {
 	unsigned int size = fifo->mask + 1;
@@ -118,6 +121,12 @@ static void kfifo_copy_in(struct __kfifo *fifo, const void *src,
 
 	memcpy(fifo->data + off, src, l);
 	memcpy(fifo->data, src + l, len - l);
+}
+
+static void kfifo_copy_in(struct __kfifo *fifo, const void *src,
+		unsigned int len, unsigned int off)
+{
+	kfifo_memcpy_in(fifo, src, len, off);
 	/*
 	 * make sure that the data in the fifo is up to date before
 	 * incrementing the fifo->in index counter
@@ -140,7 +149,7 @@ unsigned int __kfifo_in(struct __kfifo *fifo,
 }
 EXPORT_SYMBOL(__kfifo_in);
 
-static void kfifo_copy_out(struct __kfifo *fifo, void *dst,
+static void kfifo_memcpy_out(struct __kfifo *fifo, void *dst,
 		unsigned int len, unsigned int off)
 {
 	unsigned int size = fifo->mask + 1;
@@ -157,6 +166,12 @@ static void kfifo_copy_out(struct __kfifo *fifo, void *dst,
 
 	memcpy(dst, fifo->data + off, l);
 	memcpy(dst + l, fifo->data, len - l);
+}
+
+static void kfifo_copy_out(struct __kfifo *fifo, void *dst,
+		unsigned int len, unsigned int off)
+{
+	kfifo_memcpy_out(fifo, dst, len, off);
 	/*
 	 * make sure that the data is copied before
 	 * incrementing the fifo->out index counter
@@ -406,41 +421,61 @@ unsigned int __kfifo_max_r(unsigned int len, size_t recsize)
 #define	__KFIFO_PEEK(data, out, mask) \
 	((data)[(out) & (mask)])
 /*
- * __kfifo_peek_n internal helper function for determinate the length of
- * the next record in the fifo
+ * kfifo_peek_n_at internal helper function for determinate the length of
+ * the record at offset off in the fifo
  */
-static unsigned int __kfifo_peek_n(struct __kfifo *fifo, size_t recsize)
+static unsigned int kfifo_peek_n_at(struct __kfifo *fifo, unsigned int off,
+		size_t recsize)
 {
 	unsigned int l;
 	unsigned int mask = fifo->mask;
 	unsigned char *data = fifo->data;
 
-	l = __KFIFO_PEEK(data, fifo->out, mask);
+	l = __KFIFO_PEEK(data, off, mask);
 
 	if (--recsize)
-		l |= __KFIFO_PEEK(data, fifo->out + 1, mask) << 8;
+		l |= __KFIFO_PEEK(data, off + 1, mask) << 8;
 
 	return l;
 }
 
+/*
+ * __kfifo_peek_n internal helper function for determinate the length of
+ * the next record in the fifo
+ */
+static unsigned int __kfifo_peek_n(struct __kfifo *fifo, size_t recsize)
+{
+	return kfifo_peek_n_at(fifo, fifo->out, recsize);
+}
+
 #define	__KFIFO_POKE(data, in, mask, val) \
 	( \
 	(data)[(in) & (mask)] = (unsigned char)(val) \
 	)
 
 /*
- * __kfifo_poke_n internal helper function for storeing the length of
- * the record into the fifo
+ * kfifo_poke_n_at internal helper function for storeing the length of
+ * the record at offset off into the fifo
  */
-static void __kfifo_poke_n(struct __kfifo *fifo, unsigned int n, size_t recsize)
+static void kfifo_poke_n_at(struct __kfifo *fifo, unsigned int off,
+		unsigned int n, size_t recsize)
 {
 	unsigned int mask = fifo->mask;
 	unsigned char *data = fifo->data;
 
-	__KFIFO_POKE(data, fifo->in, mask, n);
+	__KFIFO_POKE(data, off, mask, n);
 
 	if (recsize > 1)
-		__KFIFO_POKE(data, fifo->in + 1, mask, n >> 8);
+		__KFIFO_POKE(data, off + 1, mask, n >> 8);
+}
+
+/*
+ * __kfifo_poke_n internal helper function for storeing the length of
+ * the record into the fifo
+ */
+static void __kfifo_poke_n(struct __kfifo *fifo, unsigned int n, size_t recsize)
+{
+	kfifo_poke_n_at(fifo, fifo->in, n, recsize);
 }
 
 unsigned int __kfifo_len_r(struct __kfifo *fifo, size_t recsize)
@@ -606,3 +641,153 @@ void __kfifo_dma_out_finish_r(struct __kfifo *fifo, size_t recsize)
 	fifo->out += len + recsize;
 }
 EXPORT_SYMBOL(__kfifo_dma_out_finish_r);
+
+/*
+ * Multiple writers first reserve their space by advancing fifo->reserved,
+ * copy their data, and then publish it by advancing fifo->in, in the order
+ * of their reservations. Interrupts are disabled meanwhile, so that a
+ * writer never waits for one it interrupted on the same cpu.
+ */
+unsigned int __kfifo_in_mp(struct __kfifo *fifo,
+		const void *buf, unsigned int len, size_t recsize)
+{
+	unsigned long flags;
+	unsigned int start, n;
+
+	local_irq_save(flags);
+	do {
+		start = ACCESS_ONCE(fifo->reserved);
+		n = (fifo->mask + 1) - (start - ACCESS_ONCE(fifo->out));
+		if (recsize)
+			n = (len + recsize > n) ? 0 : len + recsize;
+		else if (n > len)
+			n = len;
+		if (!n)
+			goto out;
+	} while (cmpxchg(&fifo->reserved, start, start + n) != start);
+
+	if (recsize) {
+		kfifo_poke_n_at(fifo, start, len, recsize);
+		kfifo_copy_in(fifo, buf, len, start + recsize);
+	} else
+		kfifo_copy_in(fifo, buf, n, start);
+
+	/* wait for the writers that reserved space before us */
+	while (ACCESS_ONCE(fifo->in) != start)
+		cpu_relax();
+	ACCESS_ONCE(fifo->in) = start + n;
+out:
+	local_irq_restore(flags);
+	if (recsize)
+		return n ? len : 0;
+	return n;
+}
+EXPORT_SYMBOL(__kfifo_in_mp);
+
+/*
+ * Multiple readers copy the data first, and then try to consume it by
+ * advancing fifo->out. If another reader was faster, the data may have
+ * been overwritten meanwhile, so it is copied again.
+ */
+unsigned int __kfifo_out_mc(struct __kfifo *fifo,
+		void *buf, unsigned int len, size_t recsize)
+{
+	unsigned int out, l, n, copied;
+
+	for (;;) {
+		out = ACCESS_ONCE(fifo->out);
+		smp_rmb();
+		l = ACCESS_ONCE(fifo->in) - out;
+		if (!l)
+			return 0;
+		/* out is already stale */
+		if (l > fifo->mask + 1)
+			continue;
+		smp_rmb();
+
+		if (recsize) {
+			n = kfifo_peek_n_at(fifo, out, recsize);
+			if (n + recsize > l)
+				continue;
+			copied = min(len, n);
+			kfifo_memcpy_out(fifo, buf, copied, out + recsize);
+			n += recsize;
+		} else {
+			copied = min(len, l);
+			kfifo_memcpy_out(fifo, buf, copied, out);
+			n = copied;
+		}
+
+		if (cmpxchg(&fifo->out, out, out + n) == out)
+			return copied;
+	}
+}
+EXPORT_SYMBOL(__kfifo_out_mc);
+
+unsigned int __kfifo_in_vec(struct __kfifo *fifo,
+		const struct kvec *vec, unsigned int nr, size_t recsize)
+{
+	unsigned int in = fifo->in;
+	unsigned int unused = kfifo_unused(fifo);
+	unsigned int i, len;
+
+	for (i = 0; i < nr; i++) {
+		len = vec[i].iov_len;
+		if (!recsize)
+			len /= fifo->esize;
+		if (len + recsize > unused)
+			break;
+
+		if (recsize)
+			kfifo_poke_n_at(fifo, in, len, recsize);
+		kfifo_memcpy_in(fifo, vec[i].iov_base, len, in + recsize);
+		in += len + recsize;
+		unused -= len + recsize;
+	}
+	/*
+	 * make sure that the data in the fifo is up to date before
+	 * incrementing the fifo->in index counter
+	 */
+	smp_wmb();
+	fifo->in = in;
+	return i;
+}
+EXPORT_SYMBOL(__kfifo_in_vec);
+
+unsigned int __kfifo_out_vec(struct __kfifo *fifo,
+		struct kvec *vec, unsigned int nr, size_t recsize)
+{
+	unsigned int out = fifo->out;
+	unsigned int used = fifo->in - out;
+	unsigned int i, len, n;
+
+	for (i = 0; i < nr && used; i++) {
+		len = vec[i].iov_len;
+		if (recsize) {
+			n = kfifo_peek_n_at(fifo, out, recsize);
+			if (len > n)
+				len = n;
+			kfifo_memcpy_out(fifo, vec[i].iov_base, len,
+					out + recsize);
+			n += recsize;
+		} else {
+			len /= fifo->esize;
+			if (len > used)
+				len = used;
+			kfifo_memcpy_out(fifo, vec[i].iov_base, len, out);
+			n = len;
+			len *= fifo->esize;
+		}
+		vec[i].iov_len = len;
+		out += n;
+		used -= n;
+	}
+	/*
+	 * make sure that the data is copied before
+	 * incrementing the fifo->out index counter
+	 */
+	smp_wmb();
+	fifo->out = out;
+	return i;
+}
+EXPORT_SYMBOL(__kfifo_out_vec);
@@ -58,6 +58,7 @@
 #include <linux/jump_label.h>
 #include <linux/pfn.h>
 #include <linux/bsearch.h>
+#include <linux/jhash.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/module.h>
@@ -104,6 +105,24 @@
 DEFINE_MUTEX(module_mutex);
 EXPORT_SYMBOL_GPL(module_mutex);
 static LIST_HEAD(modules);
+
+/*
+ * Symbols exported by modules, hashed by name, so that find_symbol()
+ * does not walk the symbol tables of every module. Maintained along with
+ * the list of modules, under the same rules.
+ */
+#define EXPORT_HASH_BITS	10
+#define EXPORT_HASH_SIZE	(1 << EXPORT_HASH_BITS)
+
+struct module_export {
+	struct hlist_node node;
+	struct module *owner;
+	/* a one symbol table, with the licence and crc of the symbol */
+	struct symsearch syms;
+};
+
+static struct hlist_head export_hash[EXPORT_HASH_SIZE];
+
 #ifdef CONFIG_KGDB_KDB
 struct list_head *kdb_modules = &modules; /* kdb needs the list of modules */
 #endif /* CONFIG_KGDB_KDB */
@@ -254,6 +273,25 @@ static bool each_symbol_in_section(const struct symsearch *arr,
 	return false;
 }
 
+static const struct symsearch core_symsearch[] = {
+	{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	  NOT_GPL_ONLY, false },
+	{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
+	  __start___kcrctab_gpl,
+	  GPL_ONLY, false },
+	{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
+	  __start___kcrctab_gpl_future,
+	  WILL_BE_GPL_ONLY, false },
+#ifdef CONFIG_UNUSED_SYMBOLS
+	{ __start___ksymtab_unused, __stop___ksymtab_unused,
+	  __start___kcrctab_unused,
+	  NOT_GPL_ONLY, true },
+	{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
+	  __start___kcrctab_unused_gpl,
+	  GPL_ONLY, true },
+#endif
+};
+
 /* Returns true as soon as fn returns true, otherwise false. */
 bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
 				    struct module *owner,
@@ -261,26 +299,9 @@ bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
 			 void *data)
 {
 	struct module *mod;
-	static const struct symsearch arr[] = {
-		{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
-		  NOT_GPL_ONLY, false },
-		{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
-		  __start___kcrctab_gpl,
-		  GPL_ONLY, false },
-		{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
-		  __start___kcrctab_gpl_future,
-		  WILL_BE_GPL_ONLY, false },
-#ifdef CONFIG_UNUSED_SYMBOLS
-		{ __start___ksymtab_unused, __stop___ksymtab_unused,
-		  __start___kcrctab_unused,
-		  NOT_GPL_ONLY, true },
-		{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
-		  __start___kcrctab_unused_gpl,
-		  GPL_ONLY, true },
-#endif
-	};
 
-	if (each_symbol_in_section(arr, ARRAY_SIZE(arr), NULL, fn, data))
+	if (each_symbol_in_section(core_symsearch, ARRAY_SIZE(core_symsearch),
+				   NULL, fn, data))
 		return true;
 
 	list_for_each_entry_rcu(mod, &modules, list) {
@@ -364,6 +385,47 @@ static bool check_symbol(const struct symsearch *syms,
 	return true;
 }
 
+static struct hlist_head *export_hash_head(const char *name)
+{
+	return &export_hash[jhash(name, strlen(name), 0) &
+			    (EXPORT_HASH_SIZE - 1)];
+}
+
+/* Called with module_mutex held, along with adding mod to the list */
+static void hash_module_exports(struct module *mod)
+{
+	unsigned int i;
+
+	for (i = 0; i < mod->num_exports; i++) {
+		struct module_export *exp = &mod->exports[i];
+
+		hlist_add_head_rcu(&exp->node,
+				   export_hash_head(exp->syms.start->name));
+	}
+}
+
+static void unhash_module_exports(struct module *mod)
+{
+	unsigned int i;
+
+	for (i = 0; i < mod->num_exports; i++)
+		hlist_del_rcu(&mod->exports[i].node);
+}
+
+static bool find_symbol_in_modules(struct find_symbol_arg *fsa)
+{
+	struct module_export *exp;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(exp, node, export_hash_head(fsa->name), node) {
+		/* Exports are unique, see verify_export_symbols() */
+		if (strcmp(exp->syms.start->name, fsa->name) == 0)
+			return check_symbol(&exp->syms, exp->owner, 0, fsa);
+	}
+
+	return false;
+}
+
 static int cmp_name(const void *va, const void *vb)
 {
 	const char *a;
@@ -402,7 +464,9 @@ const struct kernel_symbol *find_symbol(const char *name,
 	fsa.gplok = gplok;
 	fsa.warn = warn;
 
-	if (each_symbol_section(find_symbol_in_section, &fsa)) {
+	if (each_symbol_in_section(core_symsearch, ARRAY_SIZE(core_symsearch),
+				   NULL, find_symbol_in_section, &fsa) ||
+	    find_symbol_in_modules(&fsa)) {
 		if (owner)
 			*owner = fsa.owner;
 		if (crc)
@@ -1582,6 +1646,7 @@ static int __unlink_module(void *_mod)
 {
 	struct module *mod = _mod;
 	list_del(&mod->list);
+	unhash_module_exports(mod);
 	module_bug_cleanup(mod);
 	return 0;
 }
@@ -1706,6 +1771,7 @@ static void free_module(struct module *mod)
 	mutex_lock(&module_mutex);
 	stop_machine(__unlink_module, mod, NULL);
 	mutex_unlock(&module_mutex);
+	kfree(mod->exports);
 	mod_sysfs_teardown(mod);
 
 	/* Remove dynamic debug info */
@@ -1791,6 +1857,56 @@ static int verify_export_symbols(struct module *mod)
 	return 0;
 }
 
+/* Build, but do not hash yet, the entries of the exports of mod */
+static int alloc_module_exports(struct module *mod)
+{
+	unsigned int i, j, num = 0;
+	struct module_export *exp;
+	struct symsearch arr[] = {
+		{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
+		  NOT_GPL_ONLY, false },
+		{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
+		  mod->gpl_crcs,
+		  GPL_ONLY, false },
+		{ mod->gpl_future_syms,
+		  mod->gpl_future_syms + mod->num_gpl_future_syms,
+		  mod->gpl_future_crcs,
+		  WILL_BE_GPL_ONLY, false },
+#ifdef CONFIG_UNUSED_SYMBOLS
+		{ mod->unused_syms,
+		  mod->unused_syms + mod->num_unused_syms,
+		  mod->unused_crcs,
+		  NOT_GPL_ONLY, true },
+		{ mod->unused_gpl_syms,
+		  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
+		  mod->unused_gpl_crcs,
+		  GPL_ONLY, true },
+#endif
+	};
+
+	for (i = 0; i < ARRAY_SIZE(arr); i++)
+		num += arr[i].stop - arr[i].start;
+	if (!num)
+		return 0;
+
+	exp = kmalloc(num * sizeof(*exp), GFP_KERNEL);
+	if (!exp)
+		return -ENOMEM;
+	mod->exports = exp;
+	mod->num_exports = num;
+
+	for (i = 0; i < ARRAY_SIZE(arr); i++) {
+		for (j = 0; j < arr[i].stop - arr[i].start; j++, exp++) {
+			exp->owner = mod;
+			exp->syms = arr[i];
+			exp->syms.start = &arr[i].start[j];
+			exp->syms.stop = exp->syms.start + 1;
+			exp->syms.crcs = symversion(arr[i].crcs, j);
+		}
+	}
+	return 0;
+}
+
 /* Change all symbols so that st_value encodes the pointer directly. */
 static int simplify_symbols(struct module *mod, const struct load_info *info)
 {
@@ -2795,6 +2911,10 @@ static struct module *load_module(void __user *umod,
 		goto free_arch_cleanup;
 	}
 
+	err = alloc_module_exports(mod);
+	if (err < 0)
+		goto free_args;
+
 	/* Mark state as coming so strong_try_module_get() ignores us. */
 	mod->state = MODULE_STATE_COMING;
 
@@ -2822,6 +2942,7 @@ static struct module *load_module(void __user *umod,
 
 	module_bug_finalize(info.hdr, info.sechdrs, mod);
 	list_add_rcu(&mod->list, &modules);
+	hash_module_exports(mod);
 	mutex_unlock(&module_mutex);
 
 	/* Module is ready to execute: parsing args may do that. */
@@ -2846,6 +2967,7 @@ static struct module *load_module(void __user *umod,
 	mutex_lock(&module_mutex);
 	/* Unlink carefully: kallsyms could be walking list. */
 	list_del_rcu(&mod->list);
+	unhash_module_exports(mod);
 	module_bug_cleanup(mod);
 
  ddebug:
@@ -2854,6 +2976,8 @@ static struct module *load_module(void __user *umod,
  unlock:
 	mutex_unlock(&module_mutex);
 	synchronize_sched();
+	kfree(mod->exports);
+ free_args:
 	kfree(mod->args);
  free_arch_cleanup:
 	module_arch_cleanup(mod);
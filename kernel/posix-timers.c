@@ -631,9 +631,10 @@ out:
 /*
  * Locking issues: We need to protect the result of the id look up until
  * we get the timer locked down so it is not deleted under us.  The
- * removal is done under the idr spinlock so we use that here to bridge
- * the find to the timer lock.  To avoid a dead lock, the timer id MUST
- * be release with out holding the timer lock.
+ * lookup is done under rcu_read_lock() and timers are freed after a grace
+ * period, so the timer found stays valid until its it_lock is taken; a
+ * timer being deleted is caught by the it_signal check.  To avoid a dead
+ * lock, the timer id MUST be release with out holding the timer lock.
  */
 static struct k_itimer *__lock_timer(timer_t timer_id, unsigned long *flags)
 {
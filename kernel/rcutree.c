@@ -50,6 +50,7 @@
 #include <linux/wait.h>
 #include <linux/kthread.h>
 #include <linux/prefetch.h>
+#include <linux/bootmem.h>
 
 #include "rcutree.h"
 
@@ -1161,6 +1162,147 @@ static void rcu_offline_cpu(int cpu)
 
 #endif /* #else #ifdef CONFIG_HOTPLUG_CPU */
 
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * CPUs given via the rcu_nocbs= boot parameter don't invoke their own
+ * RCU callbacks: rcu_do_batch() hands the ready callbacks of all flavors
+ * over to a per-CPU "rcuo" kthread, which isn't bound to the CPU, so it
+ * can run on some housekeeping CPU instead.  Grace-period processing
+ * still happens on the CPU itself.
+ */
+struct rcu_nocb {
+	spinlock_t lock;
+	struct rcu_head *head;		/* callbacks to invoke */
+	struct rcu_head **tail;
+	wait_queue_head_t wq;
+	struct task_struct *task;	/* NULL unless offloading */
+};
+
+static DEFINE_PER_CPU(struct rcu_nocb, rcu_nocb);
+static cpumask_var_t rcu_nocb_mask;
+static bool have_rcu_nocb_mask;
+
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/*
+ * Hand the ready callbacks in list (ending at *tail) over to the rcuo
+ * kthread of the CPU of rdp, if it has one.  Returns the number of
+ * callbacks handed over, or -1 if they need to be invoked here.
+ */
+static int rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *list,
+			    struct rcu_head **tail)
+{
+	struct rcu_nocb *nocb = &per_cpu(rcu_nocb, rdp->cpu);
+	struct rcu_head *rhp;
+	unsigned long flags;
+	int count = 0;
+
+	if (!ACCESS_ONCE(nocb->task))
+		return -1;
+
+	for (rhp = list; rhp; rhp = rhp->next)
+		count++;
+
+	spin_lock_irqsave(&nocb->lock, flags);
+	*nocb->tail = list;
+	nocb->tail = tail;
+	spin_unlock_irqrestore(&nocb->lock, flags);
+	wake_up(&nocb->wq);
+	return count;
+}
+
+static int rcu_nocb_kthread(void *arg)
+{
+	struct rcu_nocb *nocb = arg;
+	struct rcu_head *list, *next;
+	unsigned long flags;
+
+	for (;;) {
+		wait_event_interruptible(nocb->wq, ACCESS_ONCE(nocb->head));
+
+		spin_lock_irqsave(&nocb->lock, flags);
+		list = nocb->head;
+		nocb->head = NULL;
+		nocb->tail = &nocb->head;
+		spin_unlock_irqrestore(&nocb->lock, flags);
+
+		/* Callbacks expect to run with bh disabled, like in rcuc. */
+		while (list) {
+			next = list->next;
+			prefetch(next);
+			debug_rcu_head_unqueue(list);
+			local_bh_disable();
+			__rcu_reclaim(list);
+			local_bh_enable();
+			list = next;
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
+/*
+ * Spawn the rcuo kthreads of the CPUs in rcu_nocb_mask, and let them run
+ * on the other CPUs, if there are any.  They can be moved around later on.
+ */
+static void __init rcu_spawn_nocb_kthreads(void)
+{
+	cpumask_var_t housekeeping;
+	struct task_struct *t;
+	char buf[64];
+	int cpu;
+
+	if (!have_rcu_nocb_mask)
+		return;
+	if (!zalloc_cpumask_var(&housekeeping, GFP_KERNEL))
+		return;
+	cpumask_andnot(housekeeping, cpu_possible_mask, rcu_nocb_mask);
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		struct rcu_nocb *nocb = &per_cpu(rcu_nocb, cpu);
+
+		if (!cpu_possible(cpu))
+			continue;
+		spin_lock_init(&nocb->lock);
+		nocb->head = NULL;
+		nocb->tail = &nocb->head;
+		init_waitqueue_head(&nocb->wq);
+		t = kthread_create(rcu_nocb_kthread, nocb, "rcuo%d", cpu);
+		if (IS_ERR(t))
+			continue;
+		if (!cpumask_empty(housekeeping))
+			set_cpus_allowed_ptr(t, housekeeping);
+		smp_wmb(); /* nocb initialized before rcu_do_batch() sees it. */
+		nocb->task = t;
+		wake_up_process(t);
+	}
+	cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+	printk(KERN_INFO "RCU: offloading callbacks of CPUs %s\n", buf);
+	free_cpumask_var(housekeeping);
+}
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static int rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *list,
+			    struct rcu_head **tail)
+{
+	return -1;
+}
+
+static void __init rcu_spawn_nocb_kthreads(void)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
+
 /*
  * Invoke any RCU callbacks that have made it to the end of their grace
  * period.  Thottle as specified by rdp->blimit.
@@ -1189,8 +1331,12 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 			rdp->nxttail[count] = &rdp->nxtlist;
 	local_irq_restore(flags);
 
-	/* Invoke callbacks. */
-	count = 0;
+	/* Invoke callbacks, unless offloaded to the rcuo kthread. */
+	count = rcu_nocb_enqueue(rdp, list, tail);
+	if (count >= 0)
+		list = NULL;
+	else
+		count = 0;
 	while (list) {
 		next = list->next;
 		prefetch(next);
@@ -1797,6 +1943,7 @@ static int __init rcu_spawn_kthreads(void)
 			rcu_wake_one_boost_kthread(rnp);
 		}
 	}
+	rcu_spawn_nocb_kthreads();
 	return 0;
 }
 early_initcall(rcu_spawn_kthreads);
@@ -543,6 +543,7 @@ struct rq {
 
 #ifdef CONFIG_SCHEDSTATS
 	/* latency stats */
+#define SCHED_LAT_BUCKETS	20
 	struct sched_info rq_sched_info;
 	unsigned long long rq_cpu_time;
 	/* could above be rq->cfs_rq.exec_clock + rq->rt_rq.rt_runtime ? */
@@ -558,6 +559,9 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int ttwu_count;
 	unsigned int ttwu_local;
+
+	/* wakeup to run latencies, log2 buckets of usecs */
+	unsigned int wakeup_lat[SCHED_LAT_BUCKETS];
 #endif
 
 #ifdef CONFIG_SMP
@@ -1214,7 +1218,7 @@ int get_nohz_timer_target(void)
 	rcu_read_lock();
 	for_each_domain(cpu, sd) {
 		for_each_cpu(i, sched_domain_span(sd)) {
-			if (!idle_cpu(i)) {
+			if (!idle_cpu(i) && !tick_nohz_full_cpu(i)) {
 				cpu = i;
 				goto unlock;
 			}
@@ -1782,7 +1786,26 @@ static const struct sched_class rt_sched_class;
 static void inc_nr_running(struct rq *rq)
 {
 	rq->nr_running++;
+#ifdef CONFIG_NO_HZ_FULL
+	/*
+	 * The tick of an adaptive-tick CPU may be stretched while it runs a
+	 * single task; have it come through schedule() to bring it back.
+	 */
+	if (rq->nr_running == 2 && tick_nohz_full_cpu(cpu_of(rq)))
+		resched_task(rq->curr);
+#endif
+}
+
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Whether the tick of this CPU may be stretched: only the tick makes a
+ * CPU switch between the tasks it has, unless there is a single one.
+ */
+int sched_can_stop_tick(void)
+{
+	return this_rq()->nr_running == 1;
 }
+#endif
 
 static void dec_nr_running(struct rq *rq)
 {
@@ -2477,6 +2500,7 @@ static void ttwu_activate(struct rq *rq, struct task_struct *p, int en_flags)
 {
 	activate_task(rq, p, en_flags);
 	p->on_rq = 1;
+	schedstat_set(p->se.statistics.wakeup_start, rq->clock);
 
 	/* if a worker is waking up, notify workqueue */
 	if (p->flags & PF_WQ_WORKER)
@@ -2566,6 +2590,7 @@ static void sched_ttwu_pending(void)
 void scheduler_ipi(void)
 {
 	sched_ttwu_pending();
+	tick_nohz_full_kick();
 }
 
 static void ttwu_queue_remote(struct task_struct *p, int cpu)
@@ -2782,6 +2807,12 @@ static void __sched_fork(struct task_struct *p)
 
 	INIT_LIST_HEAD(&p->rt.run_list);
 
+#ifdef CONFIG_SMP
+	p->last_wakee			= NULL;
+	p->wakee_flips			= 0;
+	p->wakee_flip_decay_ts		= jiffies;
+#endif
+
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
@@ -3963,6 +3994,27 @@ void account_idle_ticks(unsigned long ticks)
 	account_idle_time(jiffies_to_cputime(ticks));
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Account multiple ticks of a task, which ran on an adaptive-tick CPU
+ * while its tick was stretched.
+ * @p: the process which ran
+ * @user_tick: indicates whether it's user or system time
+ * @ticks: number of ticks
+ */
+void account_busy_ticks(struct task_struct *p, int user_tick,
+			unsigned long ticks)
+{
+	cputime_t cputime = jiffies_to_cputime(ticks);
+
+	if (user_tick)
+		account_user_time(p, cputime, cputime_to_scaled(cputime));
+	else
+		account_system_time(p, in_irq() ? HARDIRQ_OFFSET : 0,
+				    cputime, cputime_to_scaled(cputime));
+}
+#endif
+
 #endif
 
 /*
@@ -4282,6 +4334,7 @@ need_resched:
 		rq->curr = next;
 		++*switch_count;
 
+		tick_nohz_full_flush(prev);
 		context_switch(rq, prev, next); /* unlocks the rq */
 		/*
 		 * The context switch have flipped the stack from under us
@@ -4296,6 +4349,8 @@ need_resched:
 
 	post_schedule(rq);
 
+	tick_nohz_full_check();
+
 	preempt_enable_no_resched();
 	if (need_resched())
 		goto need_resched;
@@ -23,6 +23,7 @@
 #include <linux/latencytop.h>
 #include <linux/sched.h>
 #include <linux/cpumask.h>
+#include <linux/mempolicy.h>
 
 /*
  * Targeted preemption latency for CPU-bound tasks:
@@ -89,6 +90,244 @@ const_debug unsigned int sysctl_sched_migration_cost = 500000UL;
  */
 unsigned int __read_mostly sysctl_sched_shares_window = 10000000UL;
 
+#ifdef CONFIG_NUMA
+/*
+ * NUMA placement: the page tables of a task are sampled for the nodes its
+ * memory lives on, and the node holding most of it becomes the preferred
+ * node of the task, which the load balancer then tries to keep it on.
+ * With sched_numa_migrate set, memory on the other nodes is migrated to
+ * the preferred node as well.
+ */
+unsigned int sysctl_sched_numa_balance __read_mostly;
+unsigned int sysctl_sched_numa_migrate __read_mostly;
+
+/*
+ * Scan sched_numa_scan_size MB of the address space of a task every
+ * sched_numa_scan_period ms.
+ * (default: 256MB every 1 sec)
+ */
+unsigned int sysctl_sched_numa_scan_period __read_mostly = 1000;
+unsigned int sysctl_sched_numa_scan_size __read_mostly = 256;
+
+static inline int task_numa_nid(struct task_struct *p)
+{
+	if (!sysctl_sched_numa_balance || !p->mm)
+		return -1;
+	return ACCESS_ONCE(p->mm->numa_preferred_nid);
+}
+
+/*
+ * Whether moving p from src_cpu to dst_cpu takes it to its preferred node
+ * (> 0), away from it (< 0), or neither (0).
+ */
+static int task_numa_bias(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	int nid = task_numa_nid(p);
+	int src_nid, dst_nid;
+
+	if (nid < 0)
+		return 0;
+
+	src_nid = cpu_to_node(src_cpu);
+	dst_nid = cpu_to_node(dst_cpu);
+	if (src_nid == dst_nid)
+		return 0;
+	if (dst_nid == nid)
+		return 1;
+	if (src_nid == nid)
+		return -1;
+	return 0;
+}
+
+struct numa_scan {
+	struct vm_area_struct *vma;
+	unsigned long *pages;
+};
+
+static void numa_scan_pte(pte_t pte, unsigned long addr, int nr,
+			  struct numa_scan *scan)
+{
+	struct page *page;
+
+	if (!pte_present(pte))
+		return;
+
+	page = vm_normal_page(scan->vma, addr, pte);
+	if (page)
+		scan->pages[page_to_nid(page)] += nr;
+}
+
+static int numa_scan_pte_range(pmd_t *pmd, unsigned long addr,
+			       unsigned long end, struct mm_walk *walk)
+{
+	struct numa_scan *scan = walk->private;
+	pte_t *pte;
+	spinlock_t *ptl;
+
+	spin_lock(&walk->mm->page_table_lock);
+	if (pmd_trans_huge(*pmd)) {
+		if (!pmd_trans_splitting(*pmd))
+			numa_scan_pte(*(pte_t *)pmd, addr, HPAGE_PMD_NR, scan);
+		spin_unlock(&walk->mm->page_table_lock);
+		return 0;
+	}
+	spin_unlock(&walk->mm->page_table_lock);
+
+	/* mmap_sem keeps khugepaged from collapsing the range under us */
+	pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE)
+		numa_scan_pte(*pte, addr, 1, scan);
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
+
+/*
+ * Called at the end of every full pass over the address space: pick the
+ * node holding most of the pages a preferred node, and decay the counts,
+ * so the next pass weighs in as much as all the earlier ones.
+ */
+static int task_numa_placement(struct mm_struct *mm)
+{
+	unsigned long max = 0, total = 0;
+	int nid, max_nid = -1;
+
+	for_each_online_node(nid) {
+		total += mm->numa_pages[nid];
+		if (mm->numa_pages[nid] > max) {
+			max = mm->numa_pages[nid];
+			max_nid = nid;
+		}
+		mm->numa_pages[nid] /= 2;
+	}
+	mm->numa_preferred_nid = max_nid;
+
+	/* only bother migrating once an eighth of the memory is remote */
+	if (max_nid < 0 || total - max < total / 8)
+		return -1;
+	return max_nid;
+}
+
+static void task_numa_migrate(struct mm_struct *mm, int nid)
+{
+	nodemask_t from = node_states[N_HIGH_MEMORY];
+	nodemask_t to = nodemask_of_node(nid);
+
+	/* don't override the memory policy of the task */
+	if (current->mempolicy || !node_isset(nid, cpuset_current_mems_allowed))
+		return;
+
+	node_clear(nid, from);
+	do_migrate_pages(mm, &from, &to, MPOL_MF_MOVE);
+}
+
+/*
+ * Scan the next sched_numa_scan_size MB of the address space of current,
+ * counting the pages per node. Called on the way back to user space, once
+ * task_tick_numa() found a scan due.
+ */
+void task_numa_work(void)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long next_scan, start, end, pages;
+	unsigned long *counts;
+	struct numa_scan scan;
+	struct mm_walk walk = {
+		.pmd_entry = numa_scan_pte_range,
+		.private = &scan,
+	};
+	int nid = -1;
+
+	if (!sysctl_sched_numa_balance || !mm || (current->flags & PF_EXITING))
+		return;
+
+	next_scan = mm->numa_next_scan;
+	if (time_before(jiffies, next_scan))
+		return;
+
+	/* only one of the threads sharing the mm does the scan */
+	if (cmpxchg(&mm->numa_next_scan, next_scan, jiffies +
+		    msecs_to_jiffies(sysctl_sched_numa_scan_period)) != next_scan)
+		return;
+
+	if (!mm->numa_pages) {
+		counts = kcalloc(nr_node_ids, sizeof(*counts), GFP_KERNEL);
+		if (!counts)
+			return;
+		if (cmpxchg(&mm->numa_pages, NULL, counts))
+			kfree(counts);
+	}
+
+	scan.pages = mm->numa_pages;
+	walk.mm = mm;
+	pages = (unsigned long)sysctl_sched_numa_scan_size <<
+						(20 - PAGE_SHIFT);
+	start = mm->numa_scan_offset;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, start);
+	if (!vma) {
+		start = 0;
+		vma = mm->mmap;
+	}
+	while (vma && pages) {
+		if (!vma_migratable(vma)) {
+			vma = vma->vm_next;
+			continue;
+		}
+
+		start = max(start, vma->vm_start);
+		end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+		if (end > vma->vm_end || end < start)
+			end = vma->vm_end;
+
+		scan.vma = vma;
+		walk_page_range(start, end, &walk);
+
+		pages -= min(pages, (end - start) >> PAGE_SHIFT);
+		start = end;
+		if (end == vma->vm_end)
+			vma = vma->vm_next;
+	}
+	if (vma) {
+		mm->numa_scan_offset = start;
+	} else {
+		mm->numa_scan_offset = 0;
+		nid = task_numa_placement(mm);
+	}
+	up_read(&mm->mmap_sem);
+
+	if (nid >= 0 && sysctl_sched_numa_migrate)
+		task_numa_migrate(mm, nid);
+}
+
+/*
+ * Ask the running task to scan its address space once it's due, on its
+ * way back to user space (the scan needs to sleep).
+ */
+static void task_tick_numa(struct task_struct *curr)
+{
+	struct mm_struct *mm = curr->mm;
+
+	if (!sysctl_sched_numa_balance || !mm || (curr->flags & PF_EXITING))
+		return;
+
+	if (time_after_eq(jiffies, mm->numa_next_scan))
+		set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+}
+#else
+static inline int task_numa_bias(struct task_struct *p, int src_cpu,
+				 int dst_cpu)
+{
+	return 0;
+}
+
+static inline void task_tick_numa(struct task_struct *curr)
+{
+}
+#endif /* CONFIG_NUMA */
+
 static const struct sched_class fair_sched_class;
 
 /**************************************************************
@@ -1461,6 +1700,42 @@ static inline unsigned long effective_load(struct task_group *tg, int cpu,
 
 #endif
 
+/*
+ * Keep track of how often the waker switches between wakees: a task that
+ * keeps waking different tasks (a producer feeding several consumers, or
+ * a dispatcher thread) has a high flip count, decaying by half every
+ * second.
+ */
+static void record_wakee(struct task_struct *p)
+{
+	if (time_after(jiffies, current->wakee_flip_decay_ts + HZ)) {
+		current->wakee_flips >>= 1;
+		current->wakee_flip_decay_ts = jiffies;
+	}
+
+	if (current->last_wakee != p) {
+		current->last_wakee = p;
+		current->wakee_flips++;
+	}
+}
+
+/*
+ * Pulling the wakee to the waker's CPU is good for 1:1 pairs, which share
+ * their data, but when the waker feeds many wakees (so flips a lot more
+ * than the wakee, which flips too), stacking them all up on the waker's
+ * cache domain starves them, and the waker itself. Spread them instead.
+ */
+static int wake_wide(struct task_struct *p)
+{
+	int factor = nr_cpus_node(cpu_to_node(smp_processor_id()));
+
+	if (p->wakee_flips > factor &&
+	    current->wakee_flips > factor * p->wakee_flips)
+		return 1;
+
+	return 0;
+}
+
 static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 {
 	s64 this_load, load;
@@ -1470,6 +1745,9 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 	unsigned long weight;
 	int balanced;
 
+	if (wake_wide(p))
+		return 0;
+
 	idx	  = sd->wake_idx;
 	this_cpu  = smp_processor_id();
 	prev_cpu  = task_cpu(p);
@@ -1698,6 +1976,7 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 	int sync = wake_flags & WF_SYNC;
 
 	if (sd_flag & SD_BALANCE_WAKE) {
+		record_wakee(p);
 		if (cpumask_test_cpu(cpu, &p->cpus_allowed))
 			want_affine = 1;
 		new_cpu = prev_cpu;
@@ -1753,7 +2032,9 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 	}
 
 	if (affine_sd) {
-		if (cpu == prev_cpu || wake_affine(affine_sd, p, sync))
+		/* don't pull the task off the node holding its memory */
+		if (cpu == prev_cpu || (task_numa_bias(p, prev_cpu, cpu) >= 0 &&
+					wake_affine(affine_sd, p, sync)))
 			prev_cpu = cpu;
 
 		new_cpu = select_idle_sibling(p, prev_cpu);
@@ -2061,11 +2342,13 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 		     int *all_pinned)
 {
 	int tsk_cache_hot = 0;
+	int numa_bias;
 	/*
 	 * We do not migrate tasks that are:
 	 * 1) running (obviously), or
 	 * 2) cannot be migrated to this CPU due to cpus_allowed, or
-	 * 3) are cache-hot on their current CPU.
+	 * 3) are cache-hot on their current CPU, or
+	 * 4) would leave the node holding their memory.
 	 */
 	if (!cpumask_test_cpu(this_cpu, &p->cpus_allowed)) {
 		schedstat_inc(p, se.statistics.nr_failed_migrations_affine);
@@ -2081,9 +2364,16 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 	/*
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
-	 * 2) too many balance attempts have failed.
+	 * 2) too many balance attempts have failed, or
+	 * 3) it takes the task to the node holding its memory.
 	 */
 
+	numa_bias = task_numa_bias(p, cpu_of(rq), this_cpu);
+	if (numa_bias < 0 && sd->nr_balance_failed <= sd->cache_nice_tries)
+		return 0;
+	if (numa_bias > 0)
+		return 1;
+
 	tsk_cache_hot = task_hot(p, rq->clock_task, sd);
 	if (!tsk_cache_hot ||
 		sd->nr_balance_failed > sd->cache_nice_tries) {
@@ -4120,6 +4410,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(curr);
 }
 
 /*
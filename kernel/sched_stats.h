@@ -4,11 +4,11 @@
  * bump this up when changing the output format or the meaning of an existing
  * format, so that tools can adapt (or abort)
  */
-#define SCHEDSTAT_VERSION 15
+#define SCHEDSTAT_VERSION 16
 
 static int show_schedstat(struct seq_file *seq, void *v)
 {
-	int cpu;
+	int cpu, i;
 	int mask_len = DIV_ROUND_UP(NR_CPUS, 32) * 9;
 	char *mask_str = kmalloc(mask_len, GFP_KERNEL);
 
@@ -35,6 +35,11 @@ static int show_schedstat(struct seq_file *seq, void *v)
 
 		seq_printf(seq, "\n");
 
+		seq_printf(seq, "wakeup_lat%d", cpu);
+		for (i = 0; i < SCHED_LAT_BUCKETS; i++)
+			seq_printf(seq, " %u", rq->wakeup_lat[i]);
+		seq_printf(seq, "\n");
+
 #ifdef CONFIG_SMP
 		/* domain-specific stats */
 		rcu_read_lock();
@@ -132,6 +137,28 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 	if (rq)
 		rq->rq_sched_info.run_delay += delta;
 }
+
+/*
+ * Account the time from the wakeup of t to it hitting the cpu in the log2
+ * histogram of rq: bucket n counts the wakeups that took less than 2^n
+ * usecs (taking 1024ns for a usec), but those not counted in the buckets
+ * below it. The last bucket counts everything longer as well.
+ */
+static inline void
+rq_sched_info_wakeup(struct rq *rq, struct task_struct *t)
+{
+	s64 delta;
+	int bucket = 0;
+
+	if (!t->se.statistics.wakeup_start)
+		return;
+
+	delta = (s64)(rq->clock - t->se.statistics.wakeup_start) >> 10;
+	t->se.statistics.wakeup_start = 0;
+	if (delta > 0)
+		bucket = min(ilog2(delta) + 1, SCHED_LAT_BUCKETS - 1);
+	rq->wakeup_lat[bucket]++;
+}
 # define schedstat_inc(rq, field)	do { (rq)->field++; } while (0)
 # define schedstat_add(rq, field, amt)	do { (rq)->field += (amt); } while (0)
 # define schedstat_set(var, val)	do { var = (val); } while (0)
@@ -145,6 +172,9 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 static inline void
 rq_sched_info_depart(struct rq *rq, unsigned long long delta)
 {}
+static inline void
+rq_sched_info_wakeup(struct rq *rq, struct task_struct *t)
+{}
 # define schedstat_inc(rq, field)	do { } while (0)
 # define schedstat_add(rq, field, amt)	do { } while (0)
 # define schedstat_set(var, val)	do { } while (0)
@@ -192,6 +222,7 @@ static void sched_info_arrive(struct task_struct *t)
 	t->sched_info.pcount++;
 
 	rq_sched_info_arrive(task_rq(t), delta);
+	rq_sched_info_wakeup(task_rq(t), t);
 }
 
 /*
@@ -12,6 +12,8 @@
 #include <linux/gfp.h>
 #include <linux/smp.h>
 #include <linux/cpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #ifdef CONFIG_USE_GENERIC_SMP_HELPERS
 static struct {
@@ -31,10 +33,31 @@ struct call_function_data {
 	struct call_single_data	csd;
 	atomic_t		refs;
 	cpumask_var_t		cpumask;
+	cpumask_var_t		cpumask_ipi;
 };
 
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct call_function_data, cfd_data);
 
+/*
+ * Set when a call function IPI was sent to the cpu, and cleared by the
+ * cpu before it walks the call function queue.  Until then, there is no
+ * need to send it another IPI for new entries: it will see them anyway.
+ */
+static DEFINE_PER_CPU_SHARED_ALIGNED(unsigned long, cfd_ipi_pending);
+
+/*
+ * IPIs sent from this cpu, and the ones it could do without, as the
+ * target already had one on its way.
+ */
+struct smp_ipi_stats {
+	unsigned long		single;
+	unsigned long		single_batched;
+	unsigned long		many;
+	unsigned long		many_batched;
+};
+
+static DEFINE_PER_CPU(struct smp_ipi_stats, smp_ipi_stats);
+
 struct call_single_queue {
 	struct list_head	list;
 	raw_spinlock_t		lock;
@@ -54,6 +77,13 @@ hotplug_cfd(struct notifier_block *nfb, unsigned long action, void *hcpu)
 		if (!zalloc_cpumask_var_node(&cfd->cpumask, GFP_KERNEL,
 				cpu_to_node(cpu)))
 			return notifier_from_errno(-ENOMEM);
+		if (!zalloc_cpumask_var_node(&cfd->cpumask_ipi, GFP_KERNEL,
+				cpu_to_node(cpu))) {
+			free_cpumask_var(cfd->cpumask);
+			return notifier_from_errno(-ENOMEM);
+		}
+		/* don't let an IPI which never arrived hold off new ones */
+		per_cpu(cfd_ipi_pending, cpu) = 0;
 		break;
 
 #ifdef CONFIG_HOTPLUG_CPU
@@ -63,6 +93,7 @@ hotplug_cfd(struct notifier_block *nfb, unsigned long action, void *hcpu)
 	case CPU_DEAD:
 	case CPU_DEAD_FROZEN:
 		free_cpumask_var(cfd->cpumask);
+		free_cpumask_var(cfd->cpumask_ipi);
 		break;
 #endif
 	};
@@ -159,8 +190,11 @@ void generic_exec_single(int cpu, struct call_single_data *data, int wait)
 	 * locking and barrier primitives. Generic code isn't really
 	 * equipped to do the right thing...
 	 */
-	if (ipi)
+	if (ipi) {
 		arch_send_call_function_single_ipi(cpu);
+		this_cpu_inc(smp_ipi_stats.single);
+	} else
+		this_cpu_inc(smp_ipi_stats.single_batched);
 
 	if (wait)
 		csd_lock_wait(data);
@@ -180,6 +214,12 @@ void generic_smp_call_function_interrupt(void)
 	 */
 	WARN_ON_ONCE(!cpu_online(cpu));
 
+	/*
+	 * From now on, entries added to the queue need another IPI; the
+	 * barrier below orders this against the walk of the queue.
+	 */
+	clear_bit(0, &__get_cpu_var(cfd_ipi_pending));
+
 	/*
 	 * Ensure entry is visible on call_function_queue after we have
 	 * entered the IPI. See comment in smp_call_function_many.
@@ -549,8 +589,23 @@ void smp_call_function_many(const struct cpumask *mask,
 	 */
 	smp_mb();
 
-	/* Send a message to all CPUs in the map */
-	arch_send_call_function_ipi_mask(data->cpumask);
+	/*
+	 * Send a message to all CPUs in the map, but those which already
+	 * have one on the way (or are done already), as they will see
+	 * our entry anyway when they walk the queue.  test_and_set_bit()
+	 * implies a full barrier, pairing with the one in the interrupt.
+	 */
+	cpumask_clear(data->cpumask_ipi);
+	for_each_cpu(cpu, data->cpumask) {
+		if (test_and_set_bit(0, &per_cpu(cfd_ipi_pending, cpu))) {
+			this_cpu_inc(smp_ipi_stats.many_batched);
+			continue;
+		}
+		cpumask_set_cpu(cpu, data->cpumask_ipi);
+		this_cpu_inc(smp_ipi_stats.many);
+	}
+	if (!cpumask_empty(data->cpumask_ipi))
+		arch_send_call_function_ipi_mask(data->cpumask_ipi);
 
 	/* Optionally wait for the CPUs to complete */
 	if (wait)
@@ -602,6 +657,48 @@ void ipi_call_unlock_irq(void)
 {
 	raw_spin_unlock_irq(&call_function.lock);
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int smp_ipi_stats_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_printf(m, "%-6s %12s %12s %12s %12s\n", "cpu", "single",
+		   "single_batch", "many", "many_batch");
+	for_each_online_cpu(cpu) {
+		struct smp_ipi_stats *st = &per_cpu(smp_ipi_stats, cpu);
+
+		seq_printf(m, "%-6d %12lu %12lu %12lu %12lu\n", cpu,
+			   st->single, st->single_batched,
+			   st->many, st->many_batched);
+	}
+	return 0;
+}
+
+static int smp_ipi_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, smp_ipi_stats_show, NULL);
+}
+
+static const struct file_operations smp_ipi_stats_fops = {
+	.open		= smp_ipi_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * debugfs/smp_ipi_stats: the call function IPIs each cpu sent, per kind,
+ * and the ones that were batched with an IPI the target had pending.
+ */
+static int __init smp_ipi_stats_init(void)
+{
+	debugfs_create_file("smp_ipi_stats", 0444, NULL, NULL,
+			    &smp_ipi_stats_fops);
+	return 0;
+}
+late_initcall(smp_ipi_stats_init);
+#endif
 #endif /* USE_GENERIC_SMP_HELPERS */
 
 /* Setup configured maximum number of CPUs to activate */
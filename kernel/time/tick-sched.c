@@ -123,6 +123,197 @@ static int __init setup_tick_nohz(char *str)
 
 __setup("nohz=", setup_tick_nohz);
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Adaptive ticks: while a CPU given via nohz_full= runs a single task,
+ * tick_sched_timer() programs the next tick up to a second away (see
+ * tick_nohz_full_ticks()), rather than HZ times a second.  It stops
+ * doing so as soon as something needs the tick: a second task gets
+ * enqueued (this is caught in schedule()), a timer is added, or some
+ * other CPU needs a quiescent state from us and sends a reschedule IPI.
+ * The jiffies are left to a CPU outside of the set, which never gives
+ * the do_timer duty up.
+ */
+static cpumask_var_t nohz_full_mask;
+static bool have_nohz_full_mask;
+
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu = smp_processor_id();
+
+	alloc_bootmem_cpumask_var(&nohz_full_mask);
+	if (cpulist_parse(str, nohz_full_mask) < 0) {
+		printk(KERN_WARNING "NOHZ: incorrect nohz_full cpumask\n");
+		return 1;
+	}
+	if (cpumask_test_cpu(cpu, nohz_full_mask)) {
+		printk(KERN_WARNING "NOHZ: clearing boot CPU %d from nohz_full "
+		       "range for timekeeping\n", cpu);
+		cpumask_clear_cpu(cpu, nohz_full_mask);
+	}
+	have_nohz_full_mask = true;
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+
+int tick_nohz_full_cpu(int cpu)
+{
+	return have_nohz_full_mask && cpumask_test_cpu(cpu, nohz_full_mask);
+}
+
+/*
+ * The CPU in charge of the jiffies keeps it (and its tick), for as long
+ * as there are adaptive-tick CPUs which may not update them.
+ */
+static inline int tick_nohz_full_timekeeper(int cpu)
+{
+	return have_nohz_full_mask && cpu == tick_do_timer_cpu;
+}
+
+/*
+ * Number of ticks the next tick of this CPU can be put off by: 1 unless
+ * it is an adaptive-tick CPU running a single task, which nothing else
+ * needs the tick for.  It still ticks once a second, for the scheduler
+ * and load average bookkeeping.
+ */
+static unsigned long tick_nohz_full_ticks(struct tick_sched *ts, int cpu)
+{
+	unsigned long now, delta;
+
+	if (!tick_nohz_full_cpu(cpu) || cpu == tick_do_timer_cpu ||
+	    ts->inidle)
+		return 1;
+
+	if (!sched_can_stop_tick() || need_resched() ||
+	    local_softirq_pending())
+		return 1;
+
+	if (rcu_needs_cpu(cpu) || printk_needs_cpu(cpu) ||
+	    arch_needs_cpu(cpu))
+		return 1;
+
+	now = jiffies;
+	delta = get_next_timer_interrupt(now) - now;
+	if ((long)delta < 1)
+		return 1;
+
+	return min_t(unsigned long, delta, HZ);
+}
+
+/*
+ * Account the ticks between @full_last_tick and @now, which we didn't
+ * take as the tick was stretched, to @p.  Returns how many they were.
+ */
+static unsigned long tick_nohz_full_account(struct tick_sched *ts,
+				struct task_struct *p, int user, ktime_t now)
+{
+	unsigned long ticks;
+
+	if (now.tv64 <= ts->full_last_tick.tv64)
+		return 0;
+
+	ticks = ktime_divns(ktime_sub(now, ts->full_last_tick),
+			    tick_period.tv64);
+	if (ticks)
+		account_busy_ticks(p, user, ticks);
+
+	return ticks;
+}
+
+/*
+ * Bring the periodic tick back, in the timeline of the stretched one.
+ * Must be called with interrupts disabled.
+ */
+static void tick_nohz_full_restart(struct tick_sched *ts)
+{
+	ts->tick_stretched = 0;
+
+	hrtimer_cancel(&ts->sched_timer);
+	hrtimer_set_expires(&ts->sched_timer, ts->full_last_tick);
+	hrtimer_forward(&ts->sched_timer, ktime_get(), tick_period);
+	hrtimer_start_expires(&ts->sched_timer, HRTIMER_MODE_ABS_PINNED);
+}
+
+/**
+ * tick_nohz_full_check - restart the tick if it was stretched too far
+ *
+ * Called after something changed which the stretched tick of this CPU
+ * may depend on: from schedule(), and when a timer is added.
+ */
+void tick_nohz_full_check(void)
+{
+	struct tick_sched *ts;
+	unsigned long flags;
+	ktime_t next;
+
+	local_irq_save(flags);
+	ts = &__get_cpu_var(tick_cpu_sched);
+	if (ts->tick_stretched) {
+		next = ktime_add_ns(ktime_get(), tick_period.tv64 *
+				tick_nohz_full_ticks(ts, smp_processor_id()));
+		if (next.tv64 < hrtimer_get_expires_tv64(&ts->sched_timer))
+			tick_nohz_full_restart(ts);
+	}
+	local_irq_restore(flags);
+}
+
+/**
+ * tick_nohz_full_kick - restart a stretched tick
+ *
+ * Called from the reschedule IPI: some other CPU wants something from us
+ * (e.g. RCU a quiescent state), which the next tick takes care of.
+ */
+void tick_nohz_full_kick(void)
+{
+	struct tick_sched *ts;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	ts = &__get_cpu_var(tick_cpu_sched);
+	if (ts->tick_stretched)
+		tick_nohz_full_restart(ts);
+	local_irq_restore(flags);
+}
+
+/**
+ * tick_nohz_full_kick_cpu - reevaluate the stretched tick of a cpu
+ * @cpu: the cpu, which e.g. got a new timer
+ */
+void tick_nohz_full_kick_cpu(int cpu)
+{
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	if (cpu == smp_processor_id())
+		tick_nohz_full_check();
+	else
+		smp_send_reschedule(cpu);
+}
+
+/**
+ * tick_nohz_full_flush - account the stretched tick to the task leaving
+ * @prev: the task being switched out
+ *
+ * Called from schedule() with interrupts disabled, so that the time the
+ * task ran without ticks isn't accounted to the one coming next.
+ */
+void tick_nohz_full_flush(struct task_struct *prev)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+	unsigned long ticks;
+
+	if (!ts->tick_full)
+		return;
+
+	ticks = tick_nohz_full_account(ts, prev, prev->mm != NULL,
+				       ktime_get());
+	ts->full_last_tick = ktime_add_ns(ts->full_last_tick,
+					  tick_period.tv64 * ticks);
+}
+#else
+static inline int tick_nohz_full_timekeeper(int cpu) { return 0; }
+#endif /* NO_HZ_FULL */
+
 /**
  * tick_nohz_update_jiffies - update jiffies when idle was interrupted
  *
@@ -324,7 +515,7 @@ void tick_nohz_stop_sched_tick(int inidle)
 	} while (read_seqretry(&xtime_lock, seq));
 
 	if (rcu_needs_cpu(cpu) || printk_needs_cpu(cpu) ||
-	    arch_needs_cpu(cpu)) {
+	    arch_needs_cpu(cpu) || tick_nohz_full_timekeeper(cpu)) {
 		next_jiffies = last_jiffies + 1;
 		delta_jiffies = 1;
 	} else {
@@ -355,7 +546,8 @@ void tick_nohz_stop_sched_tick(int inidle)
 		 * max_deferement value which we retrieved
 		 * above. Otherwise we can sleep as long as we want.
 		 */
-		if (cpu == tick_do_timer_cpu) {
+		if (cpu == tick_do_timer_cpu &&
+		    !tick_nohz_full_timekeeper(cpu)) {
 			tick_do_timer_cpu = TICK_DO_TIMER_NONE;
 			ts->do_timer_last = 1;
 		} else if (tick_do_timer_cpu != TICK_DO_TIMER_NONE) {
@@ -410,6 +602,10 @@ void tick_nohz_stop_sched_tick(int inidle)
 			ts->tick_stopped = 1;
 			ts->idle_jiffies = last_jiffies;
 			rcu_enter_nohz();
+#ifdef CONFIG_NO_HZ_FULL
+			ts->tick_stretched = 0;
+			ts->tick_full = 0;
+#endif
 		}
 
 		ts->idle_sleeps++;
@@ -721,6 +917,7 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 		container_of(timer, struct tick_sched, sched_timer);
 	struct pt_regs *regs = get_irq_regs();
 	ktime_t now = ktime_get();
+	ktime_t period = tick_period;
 	int cpu = smp_processor_id();
 
 #ifdef CONFIG_NO_HZ
@@ -756,11 +953,37 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 			touch_softlockup_watchdog();
 			ts->idle_jiffies++;
 		}
+#ifdef CONFIG_NO_HZ_FULL
+		/*
+		 * This tick accounts for one period; the ones we skipped
+		 * before it are accounted here.
+		 */
+		if (ts->tick_full) {
+			ts->full_last_tick = ktime_add_ns(ts->full_last_tick,
+							  tick_period.tv64);
+			tick_nohz_full_account(ts, current, user_mode(regs),
+					       hrtimer_get_expires(timer));
+			ts->tick_full = 0;
+		}
+		ts->tick_stretched = 0;
+#endif
 		update_process_times(user_mode(regs));
 		profile_tick(CPU_PROFILING);
 	}
 
-	hrtimer_forward(timer, now, tick_period);
+#ifdef CONFIG_NO_HZ_FULL
+	if (regs) {
+		unsigned long ticks = tick_nohz_full_ticks(ts, cpu);
+
+		if (ticks > 1) {
+			ts->tick_stretched = 1;
+			ts->tick_full = 1;
+			ts->full_last_tick = hrtimer_get_expires(timer);
+			period = ns_to_ktime(tick_period.tv64 * ticks);
+		}
+	}
+#endif
+	hrtimer_forward(timer, now, period);
 
 	return HRTIMER_RESTART;
 }
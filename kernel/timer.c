@@ -77,6 +77,7 @@ struct tvec_base {
 	struct timer_list *running_timer;
 	unsigned long timer_jiffies;
 	unsigned long next_timer;
+	int cpu;
 	struct tvec_root tv1;
 	struct tvec tv2;
 	struct tvec tv3;
@@ -682,8 +683,17 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 	cpu = smp_processor_id();
 
 #if defined(CONFIG_NO_HZ) && defined(CONFIG_SMP)
-	if (!pinned && get_sysctl_timer_migration() && idle_cpu(cpu))
-		cpu = get_nohz_timer_target();
+	if (!pinned && get_sysctl_timer_migration() && idle_cpu(cpu)) {
+		/*
+		 * Rather than moving the timer over to yet another cpu,
+		 * leave it where it is, if that cpu is busy anyway.
+		 */
+		if (base->cpu != cpu && !idle_cpu(base->cpu) &&
+		    !tick_nohz_full_cpu(base->cpu))
+			cpu = base->cpu;
+		else
+			cpu = get_nohz_timer_target();
+	}
 #endif
 	new_base = per_cpu(tvec_bases, cpu);
 
@@ -710,6 +720,13 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 	    !tbase_get_deferrable(timer->base))
 		base->next_timer = timer->expires;
 	internal_add_timer(base, timer);
+	spin_unlock_irqrestore(&base->lock, flags);
+
+	/* A stretched tick of the cpu might come too late for the timer */
+	if (!tbase_get_deferrable(timer->base))
+		tick_nohz_full_kick_cpu(cpu);
+
+	return ret;
 
 out_unlock:
 	spin_unlock_irqrestore(&base->lock, flags);
@@ -738,15 +755,23 @@ EXPORT_SYMBOL(mod_timer_pending);
  *
  * Algorithm:
  *   1) calculate the maximum (absolute) time
- *   2) calculate the highest bit where the expires and new max are different
- *   3) use this bit to make a mask
- *   4) use the bitmask to round down the maximum time, so that all last
+ *   2) if this cpu has to wake up for its next timer between the expires
+ *      and the maximum time anyway, use that time
+ *   3) otherwise calculate the highest bit where the expires and new max
+ *      are different
+ *   4) use this bit to make a mask
+ *   5) use the bitmask to round down the maximum time, so that all last
  *      bits are zeros
+ *
+ * Step 2 reads the next_timer of the base without its lock; it is just a
+ * hint (a stale value at worst costs an extra wakeup, as before), and the
+ * timer doesn't necessarily end up on this cpu anyway.
  */
 static inline
 unsigned long apply_slack(struct timer_list *timer, unsigned long expires)
 {
-	unsigned long expires_limit, mask;
+	unsigned long expires_limit, mask, next;
+	struct tvec_base *base;
 	int bit;
 
 	if (timer->slack >= 0) {
@@ -759,6 +784,12 @@ unsigned long apply_slack(struct timer_list *timer, unsigned long expires)
 
 		expires_limit = expires + delta / 256;
 	}
+
+	base = per_cpu(tvec_bases, raw_smp_processor_id());
+	next = ACCESS_ONCE(base->next_timer);
+	if (time_after_eq(next, expires) && time_before_eq(next, expires_limit))
+		return next;
+
 	mask = expires ^ expires_limit;
 	if (mask == 0)
 		return expires;
@@ -882,6 +913,7 @@ void add_timer_on(struct timer_list *timer, int cpu)
 	 */
 	wake_up_idle_cpu(cpu);
 	spin_unlock_irqrestore(&base->lock, flags);
+	tick_nohz_full_kick_cpu(cpu);
 }
 EXPORT_SYMBOL_GPL(add_timer_on);
 
@@ -1646,6 +1678,7 @@ static int __cpuinit init_timers_cpu(int cpu)
 
 	base->timer_jiffies = jiffies;
 	base->next_timer = base->timer_jiffies;
+	base->cpu = cpu;
 	return 0;
 }
 
@@ -5,6 +5,7 @@
  */
 #include <linux/ring_buffer.h>
 #include <linux/trace_clock.h>
+#include <linux/trace_mmap.h>
 #include <linux/spinlock.h>
 #include <linux/debugfs.h>
 #include <linux/uaccess.h>
@@ -381,6 +382,7 @@ struct buffer_page {
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
 	struct buffer_data_page *page;	/* Actual data page */
+	unsigned	 id;		/* sub-buffer id when mapped */
 };
 
 /*
@@ -496,6 +498,10 @@ struct ring_buffer_per_cpu {
 	unsigned long			read;
 	u64				write_stamp;
 	u64				read_stamp;
+	/* user space mapping, see ring_buffer_map() */
+	int				mapped;
+	struct trace_buffer_meta	*meta_page;
+	struct buffer_page		**subbuf_ids;
 };
 
 struct ring_buffer {
@@ -1244,6 +1250,7 @@ void ring_buffer_set_clock(struct ring_buffer *buffer,
 }
 
 static void rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer);
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer);
 
 static void
 rb_remove_pages(struct ring_buffer_per_cpu *cpu_buffer, unsigned nr_pages)
@@ -1343,6 +1350,16 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 	mutex_lock(&buffer->mutex);
 	get_online_cpus();
 
+	/* The pages of a mapped buffer must stay where they are */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (buffer->buffers[cpu]->mapped) {
+			put_online_cpus();
+			mutex_unlock(&buffer->mutex);
+			atomic_dec(&buffer->record_disabled);
+			return -EBUSY;
+		}
+	}
+
 	nr_pages = DIV_ROUND_UP(size, BUF_PAGE_SIZE);
 
 	if (size < buffer_size) {
@@ -3526,6 +3543,9 @@ rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 	cpu_buffer->last_overrun = 0;
 
 	rb_head_page_activate(cpu_buffer);
+
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer);
 }
 
 /**
@@ -3683,6 +3703,11 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (atomic_read(&cpu_buffer_b->record_disabled))
 		goto out;
 
+	/* A mapped CPU buffer belongs to its mapping */
+	ret = -EBUSY;
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	/*
 	 * We can't do a synchronize_sched here because this
 	 * function can be called in atomic context.
@@ -3828,6 +3853,10 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 
 	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
 
+	/* Swapping pages would pull them out of the user mapping */
+	if (cpu_buffer->mapped)
+		goto out_unlock;
+
 	reader = rb_get_reader_page(cpu_buffer);
 	if (!reader)
 		goto out_unlock;
@@ -3956,6 +3985,231 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->reader.read = cpu_buffer->reader_page->read;
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+
+	/* the consumer reads the meta page after the ioctl returns */
+	smp_wmb();
+}
+
+static void rb_clear_mapping(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	free_page((unsigned long)cpu_buffer->meta_page);
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->meta_page = NULL;
+	cpu_buffer->subbuf_ids = NULL;
+}
+
+/**
+ * ring_buffer_map - map a CPU buffer into user space
+ * @buffer: the buffer to map
+ * @cpu: the CPU buffer to map
+ * @vma: the user mapping, one meta page plus one page per sub-buffer
+ *
+ * Every page of the CPU buffer, the reader page included, is inserted
+ * into @vma read only, so the consumer reads the events where the
+ * writer committed them. Page swapping reads (ring_buffer_read_page()),
+ * resizing and ring_buffer_swap_cpu() fail with -EBUSY while mapped.
+ *
+ * The layout and the consuming protocol are in <linux/trace_mmap.h>.
+ *
+ * Returns 0 on success, -EBUSY if the CPU buffer is already mapped.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page **subbuf_ids;
+	struct buffer_page *bpage;
+	struct list_head *head, *p;
+	unsigned long flags;
+	unsigned nr_subbufs, i;
+	int ret;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	if (vma->vm_pgoff || (vma->vm_flags & VM_WRITE))
+		return -EPERM;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	ret = -EBUSY;
+	if (cpu_buffer->mapped)
+		goto out;
+
+	/* the ring plus the reader page */
+	nr_subbufs = buffer->pages + 1;
+
+	ret = -EINVAL;
+	if (vma_pages(vma) != nr_subbufs + 1)
+		goto out;
+
+	ret = -ENOMEM;
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!meta)
+		goto out;
+
+	subbuf_ids = kcalloc(nr_subbufs, sizeof(*subbuf_ids), GFP_KERNEL);
+	if (!subbuf_ids) {
+		free_page((unsigned long)meta);
+		goto out;
+	}
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = nr_subbufs;
+
+	/*
+	 * Only the reader moves pages in and out of the ring, under the
+	 * reader_lock. From here on it just rotates the mapped ones.
+	 */
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	i = 0;
+	cpu_buffer->reader_page->id = i;
+	subbuf_ids[i++] = cpu_buffer->reader_page;
+
+	head = cpu_buffer->pages;
+	p = head;
+	do {
+		bpage = list_entry(p, struct buffer_page, list);
+		if (i < nr_subbufs) {
+			bpage->id = i;
+			subbuf_ids[i] = bpage;
+		}
+		i++;
+		p = rb_list_head(p->next);
+	} while (p != head);
+
+	if (RB_WARN_ON(cpu_buffer, i != nr_subbufs)) {
+		spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+		kfree(subbuf_ids);
+		free_page((unsigned long)meta);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	cpu_buffer->meta_page = meta;
+	cpu_buffer->subbuf_ids = subbuf_ids;
+	rb_update_meta_page(cpu_buffer);
+	cpu_buffer->mapped = 1;
+
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_RESERVED;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = vm_insert_page(vma, vma->vm_start, virt_to_page(meta));
+	for (i = 0; !ret && i < nr_subbufs; i++)
+		ret = vm_insert_page(vma, vma->vm_start + (i + 1) * PAGE_SIZE,
+				     virt_to_page(subbuf_ids[i]->page));
+
+	if (ret)
+		rb_clear_mapping(cpu_buffer);
+ out:
+	mutex_unlock(&buffer->mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - end the user mapping of a CPU buffer
+ * @buffer: the mapped buffer
+ * @cpu: the CPU buffer that was mapped
+ *
+ * To be called when the mapping goes away; the pages themselves are
+ * only freed once the last user space reference to them is dropped.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	int ret = -ENODEV;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+	if (cpu_buffer->mapped) {
+		rb_clear_mapping(cpu_buffer);
+		ret = 0;
+	}
+	mutex_unlock(&buffer->mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_get_reader - consume mapped events
+ * @buffer: the mapped buffer
+ * @cpu: the mapped CPU buffer
+ * @consumed: offset in the reader sub-buffer data the consumer is done with
+ *
+ * Consumes the events of the reader sub-buffer up to @consumed, and swaps
+ * in the next sub-buffer once the reader one is consumed and the writer
+ * has moved off it. None of this copies any event. The meta page is then
+ * brought up to date, including the events lost since the last call.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu,
+			       unsigned long consumed)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *reader;
+	unsigned long flags;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	reader = cpu_buffer->reader_page;
+	while (reader->read < consumed && reader->read < rb_page_size(reader))
+		rb_advance_reader(cpu_buffer);
+
+	/* hands out the next page if this one is done with */
+	rb_get_reader_page(cpu_buffer);
+
+	cpu_buffer->meta_page->reader.lost_events = cpu_buffer->lost_events;
+	cpu_buffer->lost_events = 0;
+
+	rb_update_meta_page(cpu_buffer);
+ out:
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 #ifdef CONFIG_TRACING
 static ssize_t
 rb_simple_read(struct file *filp, char __user *ubuf,
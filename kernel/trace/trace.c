@@ -12,6 +12,7 @@
  *  Copyright (C) 2004 William Lee Irwin III
  */
 #include <linux/ring_buffer.h>
+#include <linux/trace_mmap.h>
 #include <generated/utsrelease.h>
 #include <linux/stacktrace.h>
 #include <linux/writeback.h>
@@ -209,6 +210,9 @@ static struct trace_array	max_tr;
 
 static DEFINE_PER_CPU(struct trace_array_cpu, max_tr_data);
 
+/* max_tr is sized for the "snapshot" file, see tracing_snapshot_write() */
+static bool			snapshot_allocated;
+
 /* tracer_enabled is used to toggle activation of a tracer */
 static int			tracer_enabled = 1;
 
@@ -2113,7 +2117,7 @@ static const struct seq_operations tracer_seq_ops = {
 };
 
 static struct trace_iterator *
-__tracing_open(struct inode *inode, struct file *file)
+__tracing_open(struct inode *inode, struct file *file, bool snapshot)
 {
 	long cpu_file = (long) inode->i_private;
 	void *fail_ret = ERR_PTR(-ENOMEM);
@@ -2143,7 +2147,7 @@ __tracing_open(struct inode *inode, struct file *file)
 	if (!zalloc_cpumask_var(&iter->started, GFP_KERNEL))
 		goto fail;
 
-	if (current_trace && current_trace->print_max)
+	if (snapshot || (current_trace && current_trace->print_max))
 		iter->tr = &max_tr;
 	else
 		iter->tr = &global_trace;
@@ -2151,6 +2155,10 @@ __tracing_open(struct inode *inode, struct file *file)
 	mutex_init(&iter->mutex);
 	iter->cpu_file = cpu_file;
 
+	/* Nothing writes to the snapshot, no need to stop tracing */
+	if (snapshot)
+		iter->iter_flags |= TRACE_FILE_SNAPSHOT;
+
 	/* Notify the tracer early; before we stop tracing. */
 	if (iter->trace && iter->trace->open)
 		iter->trace->open(iter);
@@ -2160,7 +2168,8 @@ __tracing_open(struct inode *inode, struct file *file)
 		iter->iter_flags |= TRACE_FILE_ANNOTATE;
 
 	/* stop the trace while dumping */
-	tracing_stop();
+	if (!snapshot)
+		tracing_stop();
 
 	if (iter->cpu_file == TRACE_PIPE_ALL_CPU) {
 		for_each_tracing_cpu(cpu) {
@@ -2200,7 +2209,8 @@ __tracing_open(struct inode *inode, struct file *file)
 			ring_buffer_read_finish(iter->buffer_iter[cpu]);
 	}
 	free_cpumask_var(iter->started);
-	tracing_start();
+	if (!snapshot)
+		tracing_start();
  fail:
 	mutex_unlock(&trace_types_lock);
 	kfree(iter->trace);
@@ -2239,7 +2249,8 @@ static int tracing_release(struct inode *inode, struct file *file)
 		iter->trace->close(iter);
 
 	/* reenable tracing if it was previously enabled */
-	tracing_start();
+	if (!(iter->iter_flags & TRACE_FILE_SNAPSHOT))
+		tracing_start();
 	mutex_unlock(&trace_types_lock);
 
 	seq_release(inode, file);
@@ -2267,7 +2278,7 @@ static int tracing_open(struct inode *inode, struct file *file)
 	}
 
 	if (file->f_mode & FMODE_READ) {
-		iter = __tracing_open(inode, file);
+		iter = __tracing_open(inode, file, false);
 		if (IS_ERR(iter))
 			ret = PTR_ERR(iter);
 		else if (trace_flags & TRACE_ITER_LATENCY_FMT)
@@ -2782,7 +2793,7 @@ static int tracing_resize_ring_buffer(unsigned long size)
 	if (ret < 0)
 		return ret;
 
-	if (!current_trace->use_max_tr)
+	if (!current_trace->use_max_tr && !snapshot_allocated)
 		goto out;
 
 	ret = ring_buffer_resize(max_tr.buffer, size);
@@ -2880,7 +2891,7 @@ static int tracing_set_tracer(const char *buf)
 	trace_branch_disable();
 	if (current_trace && current_trace->reset)
 		current_trace->reset(tr);
-	if (current_trace && current_trace->use_max_tr) {
+	if (current_trace && current_trace->use_max_tr && !snapshot_allocated) {
 		/*
 		 * We don't free the ring buffer. instead, resize it because
 		 * The max_tr ring buffer has some state (e.g. ring->clock) and
@@ -3659,6 +3670,8 @@ struct ftrace_buffer_info {
 	void			*spare;
 	int			cpu;
 	unsigned int		read;
+	struct ring_buffer	*map_buffer;	/* buffer mapped by this file */
+	atomic_t		map_count;	/* vmas of the mapping */
 };
 
 static int tracing_buffers_open(struct inode *inode, struct file *filp)
@@ -3907,14 +3920,238 @@ out:
 	return ret;
 }
 
+/* a mapping split by munmap(), or copied by fork(), has several vmas */
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_private_data;
+
+	atomic_inc(&info->map_count);
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_private_data;
+
+	if (atomic_dec_and_test(&info->map_count)) {
+		ring_buffer_unmap(info->map_buffer, info->cpu);
+		info->map_buffer = NULL;
+	}
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+/*
+ * Zero copy consumer: the CPU's ring buffer pages are mapped read only,
+ * and TRACE_MMAP_IOCTL_GET_READER moves the reader along them, see
+ * <linux/trace_mmap.h>.
+ */
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct ring_buffer *buffer = info->tr->buffer;
+	int ret;
+
+	if (info->map_buffer)
+		return -EBUSY;
+
+	ret = ring_buffer_map(buffer, info->cpu, vma);
+	if (ret)
+		return ret;
+
+	/*
+	 * Keep the buffer that was mapped: the latency tracers swap the
+	 * buffer of the trace array with their max one.
+	 */
+	info->map_buffer = buffer;
+	atomic_set(&info->map_count, 1);
+	vma->vm_ops = &tracing_buffers_vmops;
+	vma->vm_private_data = info;
+
+	return 0;
+}
+
+static long tracing_buffers_ioctl(struct file *filp, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	int ret;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	if (!info->map_buffer)
+		return -ENODEV;
+
+	trace_access_lock(info->cpu);
+	ret = ring_buffer_map_get_reader(info->map_buffer, info->cpu, arg);
+	trace_access_unlock(info->cpu);
+
+	return ret;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.mmap		= tracing_buffers_mmap,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
 	.llseek		= no_llseek,
 };
 
+#ifdef CONFIG_TRACER_SNAPSHOT
+struct snapshot_swap {
+	int			cpu;
+	int			ret;
+};
+
+static void tracing_snapshot_swap_cpu(void *data)
+{
+	struct snapshot_swap *swap = data;
+
+	arch_spin_lock(&ftrace_max_lock);
+	ftrace_disable_cpu();
+	swap->ret = ring_buffer_swap_cpu(max_tr.buffer, global_trace.buffer,
+					 swap->cpu);
+	ftrace_enable_cpu();
+	arch_spin_unlock(&ftrace_max_lock);
+}
+
+/*
+ * Swap the live buffer of a CPU, or of all of them, with the snapshot
+ * one. No event is copied, a swap just exchanges the per CPU buffers.
+ * It runs on the CPU it swaps, where no commit can then be in flight.
+ */
+static int tracing_snapshot_swap(long cpu_file)
+{
+	struct snapshot_swap swap;
+	int cpu, ret = 0;
+
+	get_online_cpus();
+	for_each_tracing_cpu(cpu) {
+		if (cpu_file != TRACE_PIPE_ALL_CPU && cpu != cpu_file)
+			continue;
+
+		swap.cpu = cpu;
+		swap.ret = 0;
+		if (cpu_online(cpu)) {
+			smp_call_function_single(cpu, tracing_snapshot_swap_cpu,
+						 &swap, 1);
+		} else {
+			local_irq_disable();
+			tracing_snapshot_swap_cpu(&swap);
+			local_irq_enable();
+		}
+		if (swap.ret && !ret)
+			ret = swap.ret;
+	}
+	put_online_cpus();
+
+	return ret;
+}
+
+static int tracing_snapshot_open(struct inode *inode, struct file *file)
+{
+	struct trace_iterator *iter;
+	int ret = 0;
+
+	if (file->f_mode & FMODE_READ) {
+		iter = __tracing_open(inode, file, true);
+		if (IS_ERR(iter))
+			ret = PTR_ERR(iter);
+	}
+	return ret;
+}
+
+/*
+ * 0: free the snapshot buffer (all CPUs file only)
+ * 1: allocate the snapshot buffer if needed, and take a snapshot
+ * anything else: clear the snapshot buffer
+ */
+static ssize_t
+tracing_snapshot_write(struct file *filp, const char __user *ubuf,
+		       size_t cnt, loff_t *ppos)
+{
+	long cpu_file = (long)filp->f_path.dentry->d_inode->i_private;
+	char buf[64];
+	unsigned long val;
+	int ret;
+
+	if (cnt >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(&buf, ubuf, cnt))
+		return -EFAULT;
+
+	buf[cnt] = 0;
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&trace_types_lock);
+
+	/* The latency tracers own max_tr */
+	if (current_trace->use_max_tr) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	switch (val) {
+	case 0:
+		if (cpu_file != TRACE_PIPE_ALL_CPU) {
+			ret = -EINVAL;
+			break;
+		}
+		if (snapshot_allocated) {
+			ring_buffer_resize(max_tr.buffer, 1);
+			max_tr.entries = 1;
+			snapshot_allocated = false;
+		}
+		break;
+	case 1:
+		if (!snapshot_allocated) {
+			ret = ring_buffer_resize(max_tr.buffer,
+						 global_trace.entries);
+			if (ret < 0)
+				break;
+			max_tr.entries = global_trace.entries;
+			snapshot_allocated = true;
+		}
+		ret = tracing_snapshot_swap(cpu_file);
+		break;
+	default:
+		if (snapshot_allocated) {
+			if (cpu_file == TRACE_PIPE_ALL_CPU)
+				tracing_reset_online_cpus(&max_tr);
+			else
+				tracing_reset(&max_tr, cpu_file);
+		}
+		break;
+	}
+ out:
+	mutex_unlock(&trace_types_lock);
+
+	if (ret < 0)
+		return ret;
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
+static const struct file_operations snapshot_fops = {
+	.open		= tracing_snapshot_open,
+	.read		= seq_read,
+	.write		= tracing_snapshot_write,
+	.llseek		= tracing_seek,
+	.release	= tracing_release,
+};
+#endif /* CONFIG_TRACER_SNAPSHOT */
+
 static ssize_t
 tracing_stats_read(struct file *filp, char __user *ubuf,
 		   size_t count, loff_t *ppos)
@@ -4065,6 +4302,11 @@ static void tracing_init_debugfs_percpu(long cpu)
 
 	trace_create_file("stats", 0444, d_cpu,
 			(void *) cpu, &tracing_stats_fops);
+
+#ifdef CONFIG_TRACER_SNAPSHOT
+	trace_create_file("snapshot", 0644, d_cpu,
+			(void *) cpu, &snapshot_fops);
+#endif
 }
 
 #ifdef CONFIG_FTRACE_SELFTEST
@@ -4374,6 +4616,11 @@ static __init int tracer_init_debugfs(void)
 	trace_create_file("trace_clock", 0644, d_tracer, NULL,
 			  &trace_clock_fops);
 
+#ifdef CONFIG_TRACER_SNAPSHOT
+	trace_create_file("snapshot", 0644, d_tracer,
+			(void *) TRACE_PIPE_ALL_CPU, &snapshot_fops);
+#endif
+
 #ifdef CONFIG_DYNAMIC_FTRACE
 	trace_create_file("dyn_ftrace_total_info", 0444, d_tracer,
 			&ftrace_update_tot_cnt, &tracing_dyn_info_fops);
@@ -366,6 +366,7 @@ int is_tracing_stopped(void);
 enum trace_file_type {
 	TRACE_FILE_LAT_FMT	= 1,
 	TRACE_FILE_ANNOTATE	= 2,
+	TRACE_FILE_SNAPSHOT	= 4,
 };
 
 extern cpumask_var_t __read_mostly tracing_buffer_mask;
@@ -265,9 +265,18 @@ EXPORT_SYMBOL_GPL(system_freezable_wq);
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
 
+/* whether there are per-node unbound gcwqs, see init_workqueues() */
+static bool wq_numa __read_mostly;
+
+/*
+ * @sw selects the cpus of @mask (1), the unbound gcwq (2) and the
+ * per-node unbound gcwqs (4).
+ */
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
+	int node;
+
 	if (cpu < nr_cpu_ids) {
 		if (sw & 1) {
 			cpu = cpumask_next(cpu, mask);
@@ -276,6 +285,13 @@ static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 		}
 		if (sw & 2)
 			return WORK_CPU_UNBOUND;
+		cpu = WORK_CPU_UNBOUND;
+	}
+	if ((sw & 4) && wq_numa && cpu < WORK_CPU_NONE) {
+		node = cpu == WORK_CPU_UNBOUND ? -1 : cpu - WORK_CPU_NODE;
+		node = next_node(node, node_possible_map);
+		if (node < MAX_NUMNODES)
+			return WORK_CPU_NODE + node;
 	}
 	return WORK_CPU_NONE;
 }
@@ -283,7 +299,11 @@ static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 				struct workqueue_struct *wq)
 {
-	return __next_gcwq_cpu(cpu, mask, !(wq->flags & WQ_UNBOUND) ? 1 : 2);
+	unsigned int sw = 1;
+
+	if (wq->flags & WQ_UNBOUND)
+		sw = wq->flags & WQ_NUMA ? 4 : 2;
+	return __next_gcwq_cpu(cpu, mask, sw);
 }
 
 /*
@@ -291,23 +311,29 @@ static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
  *
  * An extra gcwq is defined for an invalid cpu number
  * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
- *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * specific CPU.  On NUMA machines, there are also unbound gcwqs for
+ * each possible node (WORK_CPU_NODE + node), whose workers are affine
+ * to the cpus of the node.  The following iterators are similar to
+ * for_each_*_cpu() iterators but also considers the unbound gcwqs.
+ *
+ * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND +
+ *				  WORK_CPU_NODE + possible nodes
+ * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND +
+ *				  WORK_CPU_NODE + possible nodes
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  WORK_CPU_UNBOUND for unbound workqueues,
+ *				  WORK_CPU_NODE + possible nodes for
+ *				  unbound workqueues with WQ_NUMA
  */
 #define for_each_gcwq_cpu(cpu)						\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
+	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 7);		\
 	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_possible_mask, 3))
+	     (cpu) = __next_gcwq_cpu((cpu), cpu_possible_mask, 7))
 
 #define for_each_online_gcwq_cpu(cpu)					\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_online_mask, 3);		\
+	for ((cpu) = __next_gcwq_cpu(-1, cpu_online_mask, 7);		\
 	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_online_mask, 3))
+	     (cpu) = __next_gcwq_cpu((cpu), cpu_online_mask, 7))
 
 #define for_each_cwq_cpu(cpu, wq)					\
 	for ((cpu) = __next_wq_cpu(-1, cpu_possible_mask, (wq));	\
@@ -451,24 +477,37 @@ static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 static struct global_cwq unbound_global_cwq;
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
+/*
+ * The per-node unbound gcwqs, indexed by node.  They're like the unbound
+ * gcwq otherwise, and share its nr_running.
+ */
+static struct global_cwq *unbound_node_gcwqs;
+
 static int worker_thread(void *__worker);
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(global_cwq, cpu);
-	else
+	else if (cpu == WORK_CPU_UNBOUND)
 		return &unbound_global_cwq;
+	else
+		return &unbound_node_gcwqs[cpu - WORK_CPU_NODE];
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(gcwq_nr_running, cpu);
 	else
 		return &unbound_gcwq_nr_running;
 }
 
+/* a WQ_NUMA workqueue has an array of cwqs, one for each node */
+#define NODE_CWQ_SIZE	ALIGN(sizeof(struct cpu_workqueue_struct),	\
+			      max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,	\
+				    __alignof__(unsigned long long)))
+
 static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 					    struct workqueue_struct *wq)
 {
@@ -480,8 +519,12 @@ static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 			return wq->cpu_wq.single;
 #endif
 		}
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (!(wq->flags & WQ_NUMA)) {
+		if (likely(cpu == WORK_CPU_UNBOUND))
+			return wq->cpu_wq.single;
+	} else if (likely(cpu >= WORK_CPU_NODE && cpu < WORK_CPU_NONE))
+		return (void *)wq->cpu_wq.single +
+			(cpu - WORK_CPU_NODE) * NODE_CWQ_SIZE;
 	return NULL;
 }
 
@@ -563,7 +606,7 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && cpu < WORK_CPU_UNBOUND);
 	return get_gcwq(cpu);
 }
 
@@ -995,20 +1038,26 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 		return;
 
 	/* determine gcwq to use */
-	if (!(wq->flags & WQ_UNBOUND)) {
+	if (!(wq->flags & WQ_UNBOUND) || wq->flags & WQ_NUMA) {
 		struct global_cwq *last_gcwq;
 
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
 
 		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
+		 * It's multi cpu, or multi node for WQ_NUMA, which queues
+		 * to the unbound gcwq of the node of @cpu.  If @wq is
+		 * non-reentrant (WQ_NUMA ones always are, like any other
+		 * unbound workqueue) and @work was previously on a
+		 * different gcwq, it might still be running there, in
+		 * which case the work needs to be queued there to
+		 * guarantee non-reentrance.
 		 */
-		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
+		if (wq->flags & WQ_NUMA)
+			gcwq = get_gcwq(WORK_CPU_NODE + cpu_to_node(cpu));
+		else
+			gcwq = get_gcwq(cpu);
+		if (wq->flags & (WQ_NON_REENTRANT | WQ_NUMA) &&
 		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
 			struct worker *worker;
 
@@ -1156,11 +1205,13 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 		if (!(wq->flags & WQ_UNBOUND)) {
 			struct global_cwq *gcwq = get_work_gcwq(work);
 
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
+			if (gcwq && gcwq->cpu < WORK_CPU_UNBOUND)
 				lcpu = gcwq->cpu;
 			else
 				lcpu = raw_smp_processor_id();
-		} else
+		} else if (wq->flags & WQ_NUMA)
+			lcpu = WORK_CPU_NODE + numa_node_id();
+		else
 			lcpu = WORK_CPU_UNBOUND;
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
@@ -1351,7 +1402,8 @@ static struct worker *alloc_worker(void)
  */
 static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 {
-	bool on_unbound_cpu = gcwq->cpu == WORK_CPU_UNBOUND;
+	bool on_unbound_cpu = gcwq->cpu >= WORK_CPU_UNBOUND;
+	int node = gcwq->cpu - WORK_CPU_NODE;
 	struct worker *worker = NULL;
 	int id = -1;
 
@@ -1376,12 +1428,24 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 						      worker,
 						      cpu_to_node(gcwq->cpu),
 						      "kworker/%u:%d", gcwq->cpu, id);
-	else
+	else if (gcwq->cpu == WORK_CPU_UNBOUND)
 		worker->task = kthread_create(worker_thread, worker,
 					      "kworker/u:%d", id);
+	else
+		worker->task = kthread_create_on_node(worker_thread,
+						      worker, node,
+						      "kworker/n%d:%d", node, id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
+	/*
+	 * Workers of the per-node gcwqs stay on the cpus of their node.
+	 * This may fail for nodes without cpus, whose workers can't be
+	 * affine to anything, but work isn't queued there either.
+	 */
+	if (gcwq->cpu >= WORK_CPU_NODE)
+		set_cpus_allowed_ptr(worker->task, cpumask_of_node(node));
+
 	/*
 	 * A rogue worker will become a regular one if CPU comes
 	 * online later on.  Make sure every worker has
@@ -1495,8 +1559,11 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
+	/*
+	 * Unbound gcwqs can't be set in cpumask, use cpu 0 instead (the
+	 * rescuer then looks at the cwqs of all nodes of WQ_NUMA ones).
+	 */
+	if (cpu >= WORK_CPU_UNBOUND)
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
@@ -2023,13 +2090,45 @@ sleep:
  *
  * This should happen rarely.
  */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq)
+{
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
 static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	unsigned int cpu, tcpu;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -2040,41 +2139,20 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND, and
+	 * for any of the nodes of WQ_NUMA ones.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(gcwq))
-			wake_up_worker(gcwq);
-
-		spin_unlock_irq(&gcwq->lock);
+		if (wq->flags & WQ_NUMA) {
+			for_each_cwq_cpu(tcpu, wq)
+				rescue_cwq(rescuer, get_cwq(tcpu, wq));
+		} else {
+			tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
+			rescue_cwq(rescuer, get_cwq(tcpu, wq));
+		}
 	}
 
 	schedule();
@@ -2840,7 +2918,7 @@ static int alloc_cwqs(struct workqueue_struct *wq)
 	 * Make sure that the alignment isn't lower than that of
 	 * unsigned long long.
 	 */
-	const size_t size = sizeof(struct cpu_workqueue_struct);
+	size_t size = sizeof(struct cpu_workqueue_struct);
 	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
 				   __alignof__(unsigned long long));
 #ifdef CONFIG_SMP
@@ -2854,6 +2932,10 @@ static int alloc_cwqs(struct workqueue_struct *wq)
 	else {
 		void *ptr;
 
+		/* WQ_NUMA workqueues have one cwq for each node */
+		if (wq->flags & WQ_NUMA)
+			size = nr_node_ids * NODE_CWQ_SIZE;
+
 		/*
 		 * Allocate enough room to align cwq and put an extra
 		 * pointer at the end pointing back to the originally
@@ -2862,7 +2944,7 @@ static int alloc_cwqs(struct workqueue_struct *wq)
 		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
 		if (ptr) {
 			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+			*(void **)((void *)wq->cpu_wq.single + size) = ptr;
 		}
 	}
 
@@ -2882,8 +2964,13 @@ static void free_cwqs(struct workqueue_struct *wq)
 	if (percpu)
 		free_percpu(wq->cpu_wq.pcpu);
 	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
+		size_t size = sizeof(struct cpu_workqueue_struct);
+
+		if (wq->flags & WQ_NUMA)
+			size = nr_node_ids * NODE_CWQ_SIZE;
+
+		/* the pointer to free is stored right after the cwq(s) */
+		kfree(*(void **)((void *)wq->cpu_wq.single + size));
 	}
 }
 
@@ -2926,6 +3013,14 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, name);
 
+	/*
+	 * Unbound workqueues queue to the gcwq of the local node, if
+	 * there are several, except ordered ones (max_active of 1),
+	 * which need a single cwq to keep the ordering.
+	 */
+	if (flags & WQ_UNBOUND && max_active > 1 && wq_numa)
+		flags |= WQ_NUMA;
+
 	wq = kzalloc(sizeof(*wq), GFP_KERNEL);
 	if (!wq)
 		goto err;
@@ -3118,7 +3213,14 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	if (wq->flags & WQ_NUMA) {
+		if (cpu == WORK_CPU_UNBOUND)
+			cpu = raw_smp_processor_id();
+		cpu = WORK_CPU_NODE + cpu_to_node(cpu);
+	}
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3744,6 +3846,17 @@ static int __init init_workqueues(void)
 
 	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
 
+	/*
+	 * On NUMA machines, unbound workqueues queue their works to the
+	 * gcwq of the local node, so they're processed there.
+	 */
+	if (nr_node_ids > 1) {
+		unbound_node_gcwqs = kcalloc(nr_node_ids,
+					     sizeof(struct global_cwq),
+					     GFP_KERNEL);
+		wq_numa = unbound_node_gcwqs != NULL;
+	}
+
 	/* initialize gcwqs */
 	for_each_gcwq_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3775,7 +3888,7 @@ static int __init init_workqueues(void)
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
+		if (cpu < WORK_CPU_UNBOUND)
 			gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
@@ -0,0 +1,166 @@
+/*
+ * LZ4 decompressor for the Linux kernel.
+ *
+ * Decodes the legacy LZ4 stream format written by "lz4 -l": a 4 byte magic
+ * number followed by chunks, each of them a 4 byte little endian compressed
+ * length and an LZ4 block that decompresses to at most 8MB.  The magic
+ * number may appear again between chunks when streams were concatenated.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef STATIC
+#include "lz4/lz4_decompress.c"
+#else
+#include <linux/decompress/unlz4.h>
+#endif
+
+#include <linux/types.h>
+#include <linux/lz4.h>
+#include <linux/decompress/mm.h>
+
+#include <linux/compiler.h>
+#include <asm/unaligned.h>
+
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_LEGACY_CHUNK_SIZE	(8 << 20)
+
+STATIC inline int INIT unlz4(u8 *input, int in_len,
+				int (*fill) (void *, unsigned int),
+				int (*flush) (void *, unsigned int),
+				u8 *output, int *posp,
+				void (*error) (char *x))
+{
+	u32 chunk;
+	size_t dst_len;
+	int skip;
+	u8 *in_buf, *out_buf;
+	int ret = -1;
+
+	if (output) {
+		out_buf = output;
+	} else if (!flush) {
+		error("NULL output pointer and no flush function provided");
+		goto exit;
+	} else {
+		out_buf = large_malloc(LZ4_LEGACY_CHUNK_SIZE);
+		if (!out_buf) {
+			error("Could not allocate output buffer");
+			goto exit;
+		}
+	}
+
+	if (input && fill) {
+		error("Both input pointer and fill function provided, don't know what to do");
+		goto exit_1;
+	} else if (input) {
+		in_buf = input;
+	} else if (!fill) {
+		error("NULL input pointer and missing fill function");
+		goto exit_1;
+	} else {
+		in_buf = large_malloc(lz4_compressbound(LZ4_LEGACY_CHUNK_SIZE));
+		if (!in_buf) {
+			error("Could not allocate input buffer");
+			goto exit_1;
+		}
+		in_len = 0;
+	}
+
+	if (posp)
+		*posp = 0;
+
+	/* in fill mode in_buf always holds the start of the next field */
+	if (fill && in_len < 4) {
+		skip = fill(in_buf, 4);
+		if (skip > 0)
+			in_len = skip;
+	}
+	if (in_len < 4 || get_unaligned_le32(in_buf) != LZ4_LEGACY_MAGIC) {
+		error("invalid header");
+		goto exit_2;
+	}
+	if (!fill)
+		in_buf += 4;
+	in_len -= 4;
+	if (posp)
+		*posp = 4;
+
+	for (;;) {
+		/* read compressed chunk size */
+		if (fill) {
+			in_len = 0;
+			skip = fill(in_buf, 4);
+			if (skip > 0)
+				in_len = skip;
+		}
+		/* exit at the end of the input, or at trailing padding */
+		if (in_len == 0)
+			break;
+		if (in_len < 4) {
+			error("file corrupted");
+			goto exit_2;
+		}
+		chunk = get_unaligned_le32(in_buf);
+		if (chunk == 0) {
+			if (posp)
+				*posp += 4;
+			break;
+		}
+		if (!fill)
+			in_buf += 4;
+		in_len -= 4;
+		if (posp)
+			*posp += 4;
+
+		/* the start of a concatenated stream */
+		if (chunk == LZ4_LEGACY_MAGIC)
+			continue;
+
+		if (chunk > lz4_compressbound(LZ4_LEGACY_CHUNK_SIZE)) {
+			error("chunk longer than block size");
+			goto exit_2;
+		}
+
+		if (fill) {
+			skip = fill(in_buf, chunk);
+			in_len = skip > 0 ? skip : 0;
+		}
+		if (in_len < chunk) {
+			error("file corrupted");
+			goto exit_2;
+		}
+
+		dst_len = LZ4_LEGACY_CHUNK_SIZE;
+		if (lz4_decompress_safe(in_buf, chunk, out_buf, &dst_len) !=
+		    LZ4_E_OK) {
+			error("Compressed data violation");
+			goto exit_2;
+		}
+
+		if (flush && flush(out_buf, dst_len) != dst_len)
+			goto exit_2;
+		if (output)
+			out_buf += dst_len;
+		if (posp)
+			*posp += chunk;
+
+		if (!fill)
+			in_buf += chunk;
+		in_len -= chunk;
+	}
+
+	ret = 0;
+exit_2:
+	if (!input)
+		large_free(in_buf);
+exit_1:
+	if (!output)
+		large_free(out_buf);
+exit:
+	return ret;
+}
+
+#define decompress unlz4
@@ -502,17 +502,25 @@ EXPORT_SYMBOL(idr_destroy);
  * idr_get_new().
  *
  * This function can be called under rcu_read_lock(), given that the leaf
- * pointers lifetimes are correctly managed.
+ * pointers lifetimes are correctly managed.  idr layers are only freed
+ * after an RCU grace period, and the walk sizes itself from the top layer
+ * it actually found rather than from @idp->layers, so a concurrent
+ * idr_get_new() or idr_remove() at worst makes the lookup miss an id that
+ * is being added or removed at the same time.
  */
 void *idr_find(struct idr *idp, int id)
 {
 	int n;
-	struct idr_layer *p;
+	struct idr_layer *p, *top;
 
-	p = rcu_dereference_raw(idp->top);
+	top = p = rcu_dereference_raw(idp->top);
 	if (!p)
 		return NULL;
-	n = (p->layer+1) * IDR_BITS;
+	/*
+	 * An empty top layer may be raised in place while the tree grows,
+	 * so its ->layer is only read once here and not checked below.
+	 */
+	n = (ACCESS_ONCE(p->layer) + 1) * IDR_BITS;
 
 	/* Mask off upper bits we don't use for the search. */
 	id &= MAX_ID_MASK;
@@ -523,7 +531,7 @@ void *idr_find(struct idr *idp, int id)
 
 	while (n > 0 && p) {
 		n -= IDR_BITS;
-		BUG_ON(n != p->layer*IDR_BITS);
+		BUG_ON(p != top && n != p->layer*IDR_BITS);
 		p = rcu_dereference_raw(p->ary[(id >> n) & IDR_MASK]);
 	}
 	return((void *)p);
@@ -546,7 +554,9 @@ EXPORT_SYMBOL(idr_find);
  * We check the return of @fn each time. If it returns anything other
  * than %0, we break out and return that value.
  *
- * The caller must serialize idr_for_each() vs idr_get_new() and idr_remove().
+ * The caller must serialize idr_for_each() vs idr_get_new() and idr_remove(),
+ * or call it under rcu_read_lock() and cope with missing ids that are being
+ * added or removed concurrently.
  */
 int idr_for_each(struct idr *idp,
 		 int (*fn)(int id, void *p, void *data), void *data)
@@ -556,8 +566,10 @@ int idr_for_each(struct idr *idp,
 	struct idr_layer *pa[MAX_LEVEL];
 	struct idr_layer **paa = &pa[0];
 
-	n = idp->layers * IDR_BITS;
 	p = rcu_dereference_raw(idp->top);
+	if (!p)
+		return 0;
+	n = (ACCESS_ONCE(p->layer) + 1) * IDR_BITS;
 	max = 1 << n;
 
 	id = 0;
@@ -593,6 +605,8 @@ EXPORT_SYMBOL(idr_for_each);
  * Returns pointer to registered object with id, which is next number to
  * given id. After being looked up, *@nextidp will be updated for the next
  * iteration.
+ *
+ * Like idr_find(), this can be called under rcu_read_lock().
  */
 
 void *idr_get_next(struct idr *idp, int *nextidp)
@@ -603,11 +617,11 @@ void *idr_get_next(struct idr *idp, int *nextidp)
 	int n, max;
 
 	/* find first ent */
-	n = idp->layers * IDR_BITS;
-	max = 1 << n;
 	p = rcu_dereference_raw(idp->top);
 	if (!p)
 		return NULL;
+	n = (ACCESS_ONCE(p->layer) + 1) * IDR_BITS;
+	max = 1 << n;
 
 	while (id < max) {
 		while (n > 0 && p) {
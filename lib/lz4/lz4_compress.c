@@ -0,0 +1,146 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Greedy single-pass compressor for the LZ4 block format: candidate
+ *  matches come from a hash table of the positions of recently seen 4 byte
+ *  sequences, and every match is taken as soon as it is found.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_read32(const unsigned char *p)
+{
+	return get_unaligned((const u32 *)p);
+}
+
+static inline u32 lz4_hash(u32 seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/*
+ * Emit a length: the part that fits in the token nibble has already been
+ * stored, len is what is left over.
+ */
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char * const ip_end = src + src_len;
+	const unsigned char * const mflimit = ip_end - MFLIMIT;
+	const unsigned char * const matchlimit = ip_end - LASTLITERALS;
+	unsigned char * const op_end = dst + *dst_len;
+	const unsigned char *ip = src, *anchor = src, *ref;
+	unsigned char *op = dst, *token;
+	u32 *table = wrkmem;
+	size_t lit, len;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	/* An empty table points every hash at position 0 */
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	ip++;
+
+	for (;;) {
+		const unsigned char *m;
+		u32 seq, h;
+
+		/* Find a match */
+		for (;;) {
+			if (ip > mflimit)
+				goto last_literals;
+			seq = lz4_read32(ip);
+			h = lz4_hash(seq);
+			ref = src + table[h];
+			table[h] = ip - src;
+			if (ip - ref <= MAX_DISTANCE && lz4_read32(ref) == seq)
+				break;
+			ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+		}
+
+		/* Extend it backwards over the pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* And forwards, stopping short of the trailing literals */
+		for (m = ip + MINMATCH, ref += MINMATCH;
+		     m < matchlimit && *m == *ref; m++, ref++)
+			;
+
+		lit = ip - anchor;
+		len = m - ip - MINMATCH;
+
+		/* token + lengths + literals + offset */
+		if ((size_t)(op_end - op) <
+		    1 + lit / 255 + 1 + lit + 2 + len / 255 + 1)
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		token = op++;
+		if (lit >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, lit - RUN_MASK);
+		} else {
+			*token = lit << ML_BITS;
+		}
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		put_unaligned_le16(m - ref, op);
+		op += 2;
+
+		if (len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token |= len;
+		}
+
+		ip = anchor = m;
+		if (ip > mflimit)
+			break;
+
+		/* Index a position near the end of the match as well */
+		table[lz4_hash(lz4_read32(ip - 2))] = ip - 2 - src;
+	}
+
+last_literals:
+	lit = ip_end - anchor;
+	if ((size_t)(op_end - op) < 1 + lit / 255 + 1 + lit)
+		return LZ4_E_OUTPUT_OVERRUN;
+
+	token = op++;
+	if (lit >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit - RUN_MASK);
+	} else {
+		*token = lit << ML_BITS;
+	}
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
@@ -0,0 +1,116 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Decodes the LZ4 block format (see lz4defs.h), checking every length
+ *  and offset against the input and output buffers.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#endif
+
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+/*
+ * Read the extension bytes of a length whose nibble was 15.  Returns 0 if
+ * the input ran out.
+ */
+static inline int lz4_get_length(const unsigned char **ipp,
+				 const unsigned char *ip_end, size_t *len)
+{
+	const unsigned char *ip = *ipp;
+	unsigned int s;
+
+	do {
+		if (ip >= ip_end)
+			return 0;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return 1;
+}
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char * const ip_end = src + src_len;
+	unsigned char * const op_end = dst + *dst_len;
+	const unsigned char *ip = src, *match;
+	unsigned char *op = dst;
+	size_t len, offset, n;
+	unsigned int token;
+
+	*dst_len = 0;
+
+	for (;;) {
+		if (ip >= ip_end)
+			return LZ4_E_INPUT_OVERRUN;
+		token = *ip++;
+
+		/* Literals */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && !lz4_get_length(&ip, ip_end, &len))
+			return LZ4_E_INPUT_OVERRUN;
+		if ((size_t)(ip_end - ip) < len)
+			return LZ4_E_INPUT_OVERRUN;
+		if ((size_t)(op_end - op) < len)
+			return LZ4_E_OUTPUT_OVERRUN;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence has no match */
+		if (ip == ip_end)
+			break;
+
+		/* Match */
+		if (ip_end - ip < 2)
+			return LZ4_E_INPUT_OVERRUN;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return LZ4_E_LOOKBEHIND_OVERRUN;
+		match = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && !lz4_get_length(&ip, ip_end, &len))
+			return LZ4_E_INPUT_OVERRUN;
+		len += MINMATCH;
+		if ((size_t)(op_end - op) < len)
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		/*
+		 * The match may overlap the bytes it produces.  Every copy
+		 * doubles the distance the next one may cover, so short
+		 * offsets (runs) still go a chunk at a time.
+		 */
+		while (len) {
+			n = op - match;
+			if (n > len)
+				n = len;
+			memcpy(op, match, n);
+			op += n;
+			len -= n;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ *  lz4defs.h -- LZ4 block format definitions
+ *
+ *  A compressed block is a sequence of sequences, each of which is:
+ *
+ *	token:		1 byte, high nibble literal length, low nibble
+ *			match length - MINMATCH
+ *	[literal length extension]
+ *	literals
+ *	offset:		2 bytes little endian, 1 .. MAX_DISTANCE
+ *	[match length extension]
+ *
+ *  A nibble of 15 is continued by extension bytes that are added to it
+ *  until one is not 255.  The last sequence of a block has no offset and
+ *  no match; it ends after its literals.  The last match starts no later
+ *  than MFLIMIT bytes before the end of the block, and the last
+ *  LASTLITERALS bytes are always literals.
+ */
+
+#define MINMATCH	4
+#define MFLIMIT		12
+#define LASTLITERALS	5
+#define MAX_DISTANCE	65535
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define LZ4_HASH_LOG	12
+#define LZ4_HASH_SIZE	(1 << LZ4_HASH_LOG)
+
+/*
+ * When no match is found for this many literals in a row, start skipping
+ * ahead faster so that incompressible data is not searched byte by byte.
+ */
+#define SKIP_TRIGGER	6
@@ -60,11 +60,13 @@ void percpu_counter_set(struct percpu_counter *fbc, s64 amount)
 	int cpu;
 
 	spin_lock(&fbc->lock);
+	write_seqcount_begin(&fbc->seq);
 	for_each_possible_cpu(cpu) {
 		s32 *pcount = per_cpu_ptr(fbc->counters, cpu);
 		*pcount = 0;
 	}
 	fbc->count = amount;
+	write_seqcount_end(&fbc->seq);
 	spin_unlock(&fbc->lock);
 }
 EXPORT_SYMBOL(percpu_counter_set);
@@ -77,8 +79,10 @@ void __percpu_counter_add(struct percpu_counter *fbc, s64 amount, s32 batch)
 	count = __this_cpu_read(*fbc->counters) + amount;
 	if (count >= batch || count <= -batch) {
 		spin_lock(&fbc->lock);
+		write_seqcount_begin(&fbc->seq);
 		fbc->count += count;
 		__this_cpu_write(*fbc->counters, 0);
+		write_seqcount_end(&fbc->seq);
 		spin_unlock(&fbc->lock);
 	} else {
 		__this_cpu_write(*fbc->counters, count);
@@ -88,20 +92,48 @@ void __percpu_counter_add(struct percpu_counter *fbc, s64 amount, s32 batch)
 EXPORT_SYMBOL(__percpu_counter_add);
 
 /*
- * Add up all the per-cpu counts, return the result.  This is a more accurate
- * but much slower version of percpu_counter_read_positive()
+ * Number of lockless passes __percpu_counter_sum() makes before it gives up
+ * and takes the lock to keep folding CPUs out.
  */
-s64 __percpu_counter_sum(struct percpu_counter *fbc)
+#define PERCPU_COUNTER_SUM_RETRIES	3
+
+static s64 percpu_counter_sum_cpus(struct percpu_counter *fbc)
 {
 	s64 ret;
 	int cpu;
 
-	spin_lock(&fbc->lock);
 	ret = fbc->count;
 	for_each_online_cpu(cpu) {
 		s32 *pcount = per_cpu_ptr(fbc->counters, cpu);
-		ret += *pcount;
+		ret += ACCESS_ONCE(*pcount);
 	}
+	return ret;
+}
+
+/*
+ * Add up all the per-cpu counts, return the result.  This is a more accurate
+ * but much slower version of percpu_counter_read_positive()
+ *
+ * The walk is done without fbc->lock: a fold moves a per-cpu count into
+ * fbc->count under the seqcount, so a pass that did not race with one has
+ * counted every contribution exactly once.  Only if folds keep racing with
+ * the walk is the lock taken to hold them off.
+ */
+s64 __percpu_counter_sum(struct percpu_counter *fbc)
+{
+	s64 ret;
+	unsigned seq;
+	int tries = PERCPU_COUNTER_SUM_RETRIES;
+
+	do {
+		seq = read_seqcount_begin(&fbc->seq);
+		ret = percpu_counter_sum_cpus(fbc);
+		if (!read_seqcount_retry(&fbc->seq, seq))
+			return ret;
+	} while (--tries);
+
+	spin_lock(&fbc->lock);
+	ret = percpu_counter_sum_cpus(fbc);
 	spin_unlock(&fbc->lock);
 	return ret;
 }
@@ -112,7 +144,9 @@ int __percpu_counter_init(struct percpu_counter *fbc, s64 amount,
 {
 	spin_lock_init(&fbc->lock);
 	lockdep_set_class(&fbc->lock, key);
+	seqcount_init(&fbc->seq);
 	fbc->count = amount;
+	fbc->batch = 0;
 	fbc->counters = alloc_percpu(s32);
 	if (!fbc->counters)
 		return -ENOMEM;
@@ -174,9 +208,11 @@ static int __cpuinit percpu_counter_hotcpu_callback(struct notifier_block *nb,
 		unsigned long flags;
 
 		spin_lock_irqsave(&fbc->lock, flags);
+		write_seqcount_begin(&fbc->seq);
 		pcount = per_cpu_ptr(fbc->counters, cpu);
 		fbc->count += *pcount;
 		*pcount = 0;
+		write_seqcount_end(&fbc->seq);
 		spin_unlock_irqrestore(&fbc->lock, flags);
 	}
 	mutex_unlock(&percpu_counters_lock);
@@ -194,7 +230,8 @@ int percpu_counter_compare(struct percpu_counter *fbc, s64 rhs)
 
 	count = percpu_counter_read(fbc);
 	/* Check to see if rough count will be sufficient for comparison */
-	if (abs(count - rhs) > (percpu_counter_batch*num_online_cpus())) {
+	if (abs(count - rhs) >
+	    ((s64)percpu_counter_get_batch(fbc) * num_online_cpus())) {
 		if (count > rhs)
 			return 1;
 		else
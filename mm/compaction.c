@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -636,6 +638,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 		return rc;
 
 	count_vm_event(COMPACTSTALL);
+	trace_mm_compaction_direct_begin(order, gfp_mask, sync);
 
 	/* Compact each zone in the list */
 	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
@@ -650,6 +653,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			break;
 	}
 
+	trace_mm_compaction_direct_end(rc);
 	return rc;
 }
 
@@ -716,6 +720,153 @@ int sysctl_compaction_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * kcompactd compacts the zones of its node in the background, so that
+ * high-order allocations find free pages instead of having to compact
+ * directly. It runs when such an allocation enters the slow path, and
+ * every sysctl_kcompactd_interval seconds, on the zones that fail the
+ * order yet have enough free memory spread out in small blocks (see
+ * compaction_suitable()). Its periodic passes target pageblock_order.
+ */
+int sysctl_kcompactd_interval = 10;
+
+static void kcompactd_do_work(pg_data_t *pgdat, int order)
+{
+	int zoneid;
+
+	lru_add_drain();
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, order) != COMPACT_CONTINUE)
+			continue;
+
+		compact_zone_order(zone, order, GFP_HIGHUSER_MOVABLE, false);
+
+		if (kthread_should_stop())
+			return;
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		long timeout = MAX_SCHEDULE_TIMEOUT;
+		int order;
+
+		if (sysctl_kcompactd_interval)
+			timeout = sysctl_kcompactd_interval * HZ;
+
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				pgdat->kcompactd_max_order ||
+				kthread_should_stop(), timeout);
+		if (kthread_should_stop())
+			break;
+
+		order = xchg(&pgdat->kcompactd_max_order, 0);
+		if (!order)
+			order = pageblock_order;
+
+		kcompactd_do_work(pgdat, order);
+	}
+
+	return 0;
+}
+
+/* Called by the page allocator when a high-order allocation struggles */
+void wakeup_kcompactd(struct zone *zone, int order)
+{
+	pg_data_t *pgdat = zone->zone_pgdat;
+
+	if (!pgdat->kcompactd)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+
+	if (waitqueue_active(&pgdat->kcompactd_wait))
+		wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * Started by init and node hot-add, the same way as kswapd.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	struct task_struct *tsk;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	tsk = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(tsk)) {
+		pr_err("Failed to start kcompactd on node %d\n", nid);
+		return PTR_ERR(tsk);
+	}
+	pgdat->kcompactd = tsk;
+
+	return 0;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
+/*
+ * Setting the interval kicks off a periodic pass on every node, after which
+ * kcompactd sleeps for the new interval rather than what's left of the old.
+ */
+int sysctl_kcompactd_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret, nid;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		pgdat->kcompactd_max_order = pageblock_order;
+		wake_up_interruptible(&pgdat->kcompactd_wait);
+	}
+
+	return 0;
+}
+
 int sysctl_extfrag_handler(struct ctl_table *table, int write,
 			void __user *buffer, size_t *length, loff_t *ppos)
 {
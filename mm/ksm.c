@@ -189,6 +189,22 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/*
+ * With auto_scan, ksmd adapts its batches to how much it merges: they grow
+ * up to max_pages_to_scan while pages get merged (and when a new mm comes
+ * along), and shrink back to pages_to_scan over full scans that merge
+ * nothing, after which ksmd also sleeps up to 1 << KSM_MAX_SLEEP_SHIFT
+ * times longer between batches.
+ */
+static unsigned int ksm_auto_scan;
+static unsigned int ksm_thread_max_pages_to_scan = 2000;
+static unsigned int ksm_auto_pages_to_scan;
+static unsigned int ksm_auto_sleep_shift;
+#define KSM_MAX_SLEEP_SHIFT	5
+
+/* The number of rmap_items ever added to the stable tree */
+static unsigned long ksm_pages_merged;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -453,6 +469,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_merging_pages--;
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
 		cond_resched();
@@ -540,6 +557,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_merging_pages--;
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
@@ -1157,6 +1175,8 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_sharing++;
 	else
 		ksm_pages_shared++;
+	rmap_item->mm->ksm_merging_pages++;
+	ksm_pages_merged++;
 }
 
 /*
@@ -1428,6 +1448,43 @@ static int ksmd_should_run(void)
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
 }
 
+static unsigned int ksm_scan_npages(void)
+{
+	if (!ksm_auto_scan)
+		return ksm_thread_pages_to_scan;
+	return clamp(ksm_auto_pages_to_scan, ksm_thread_pages_to_scan,
+		     max(ksm_thread_pages_to_scan,
+			 ksm_thread_max_pages_to_scan));
+}
+
+static unsigned int ksm_sleep_millisecs(void)
+{
+	if (!ksm_auto_scan)
+		return ksm_thread_sleep_millisecs;
+	return ksm_thread_sleep_millisecs << ksm_auto_sleep_shift;
+}
+
+/* Called by ksmd after each batch, under ksm_thread_mutex */
+static void ksm_auto_scan_update(unsigned long merged, bool full_scan)
+{
+	static unsigned long scan_merged;
+	unsigned int npages = ksm_scan_npages();
+
+	scan_merged += merged;
+
+	if (merged) {
+		ksm_auto_pages_to_scan = npages * 2;
+		ksm_auto_sleep_shift = 0;
+	} else if (full_scan && !scan_merged) {
+		ksm_auto_pages_to_scan = npages / 2;
+		if (ksm_auto_sleep_shift < KSM_MAX_SLEEP_SHIFT)
+			ksm_auto_sleep_shift++;
+	}
+
+	if (full_scan)
+		scan_merged = 0;
+}
+
 static int ksm_scan_thread(void *nothing)
 {
 	set_freezable();
@@ -1435,15 +1492,21 @@ static int ksm_scan_thread(void *nothing)
 
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
+		if (ksmd_should_run()) {
+			unsigned long merged = ksm_pages_merged;
+			unsigned long seqnr = ksm_scan.seqnr;
+
+			ksm_do_scan(ksm_scan_npages());
+			ksm_auto_scan_update(ksm_pages_merged - merged,
+					     ksm_scan.seqnr != seqnr);
+		}
 		mutex_unlock(&ksm_thread_mutex);
 
 		try_to_freeze();
 
 		if (ksmd_should_run()) {
 			schedule_timeout_interruptible(
-				msecs_to_jiffies(ksm_thread_sleep_millisecs));
+				msecs_to_jiffies(ksm_sleep_millisecs()));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
 				ksmd_should_run() || kthread_should_stop());
@@ -1520,6 +1583,10 @@ int __ksm_enter(struct mm_struct *mm)
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
 	atomic_inc(&mm->mm_count);
 
+	/* A new mm may well bring lots to merge: scan at full speed */
+	ksm_auto_pages_to_scan = ksm_thread_max_pages_to_scan;
+	ksm_auto_sleep_shift = 0;
+
 	if (needs_wakeup)
 		wake_up_interruptible(&ksm_thread_wait);
 
@@ -1872,6 +1939,56 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t max_pages_to_scan_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_thread_max_pages_to_scan);
+}
+
+static ssize_t max_pages_to_scan_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr_pages;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || nr_pages > UINT_MAX)
+		return -EINVAL;
+
+	ksm_thread_max_pages_to_scan = nr_pages;
+
+	return count;
+}
+KSM_ATTR(max_pages_to_scan);
+
+static ssize_t auto_scan_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_scan);
+}
+
+static ssize_t auto_scan_store(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	int err;
+	unsigned long enable;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	ksm_auto_scan = enable;
+	ksm_auto_pages_to_scan = ksm_thread_max_pages_to_scan;
+	ksm_auto_sleep_shift = 0;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(auto_scan);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1966,15 +2083,34 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_merged_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_merged);
+}
+KSM_ATTR_RO(pages_merged);
+
+static ssize_t current_pages_to_scan_show(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_scan_npages());
+}
+KSM_ATTR_RO(current_pages_to_scan);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&max_pages_to_scan_attr.attr,
+	&auto_scan_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_merged_attr.attr,
+	&current_pages_to_scan_attr.attr,
 	NULL,
 };
 
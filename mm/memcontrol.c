@@ -208,10 +208,9 @@ static void mem_cgroup_oom_notify(struct mem_cgroup *mem);
  * statistics based on the statistics developed by Rik Van Riel for clock-pro,
  * to help the administrator determine what knobs to tune.
  *
- * TODO: Add a water mark for the memory controller. Reclaim will begin when
- * we hit the water mark. May be even add a low water mark, such that
- * no reclaim occurs from a cgroup at it's low water mark, this is
- * a feature that will be implemented much later in the future.
+ * TODO: Add a low water mark, such that no reclaim occurs from a cgroup at
+ * it's low water mark, this is a feature that will be implemented much later
+ * in the future.
  */
 struct mem_cgroup {
 	struct cgroup_subsys_state css;
@@ -252,6 +251,13 @@ struct mem_cgroup {
 	/* set when res.limit == memsw.limit */
 	bool		memsw_is_minimum;
 
+	/*
+	 * Background reclaim starts once usage is within high_wmark_distance
+	 * of the limit (0 disables it), see mem_cgroup_check_high_wmark().
+	 */
+	u64		high_wmark_distance;
+	struct work_struct high_wmark_work;
+
 	/* protect arrays of thresholds */
 	struct mutex thresholds_lock;
 
@@ -360,6 +366,7 @@ static void mem_cgroup_get(struct mem_cgroup *mem);
 static void mem_cgroup_put(struct mem_cgroup *mem);
 static struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *mem);
 static void drain_all_stock_async(struct mem_cgroup *mem);
+static void mem_cgroup_check_high_wmark(struct mem_cgroup *mem);
 
 static struct mem_cgroup_per_zone *
 mem_cgroup_zoneinfo(struct mem_cgroup *mem, int nid, int zid)
@@ -704,6 +711,7 @@ static void memcg_check_events(struct mem_cgroup *mem, struct page *page)
 	/* threshold event is triggered in finer grain than soft limit */
 	if (unlikely(__memcg_event_check(mem, MEM_CGROUP_TARGET_THRESH))) {
 		mem_cgroup_threshold(mem);
+		mem_cgroup_check_high_wmark(mem);
 		__mem_cgroup_target_update(mem, MEM_CGROUP_TARGET_THRESH);
 		if (unlikely(__memcg_event_check(mem,
 			MEM_CGROUP_TARGET_SOFTLIMIT))){
@@ -1733,6 +1741,59 @@ static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
 	return total;
 }
 
+/*
+ * Background reclaim: once the usage of a memcg gets within
+ * high_wmark_distance of its limit, a work item reclaims from its hierarchy
+ * until the usage is back below that mark, so that its tasks don't have to
+ * reclaim directly when they charge. Direct reclaim still steps in if the
+ * work can't keep up.
+ */
+static bool mem_cgroup_above_high_wmark(struct mem_cgroup *mem)
+{
+	u64 distance = mem->high_wmark_distance;
+
+	if (!distance)
+		return false;
+	if (distance >= res_counter_read_u64(&mem->res, RES_LIMIT))
+		return false;
+	return res_counter_margin(&mem->res) < distance;
+}
+
+static void mem_cgroup_high_wmark_work(struct work_struct *work)
+{
+	struct mem_cgroup *mem = container_of(work, struct mem_cgroup,
+						high_wmark_work);
+	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+
+	if (!css_tryget(&mem->css))
+		goto out;
+
+	while (nr_retries && mem_cgroup_above_high_wmark(mem)) {
+		if (!mem_cgroup_hierarchical_reclaim(mem, NULL, GFP_KERNEL,
+					MEM_CGROUP_RECLAIM_SHRINK, NULL))
+			nr_retries--;
+		cond_resched();
+	}
+
+	css_put(&mem->css);
+out:
+	mem_cgroup_put(mem);
+}
+
+/* Called every THRESHOLDS_EVENTS_TARGET events of the charging memcg */
+static void mem_cgroup_check_high_wmark(struct mem_cgroup *mem)
+{
+	for (; mem; mem = parent_mem_cgroup(mem)) {
+		if (!mem_cgroup_above_high_wmark(mem))
+			continue;
+		if (work_pending(&mem->high_wmark_work))
+			continue;
+		mem_cgroup_get(mem);
+		if (!queue_work(system_unbound_wq, &mem->high_wmark_work))
+			mem_cgroup_put(mem);
+	}
+}
+
 /*
  * Check OOM-Killer is already running under our hierarchy.
  * If someone is running, return false.
@@ -1936,6 +1997,12 @@ EXPORT_SYMBOL(mem_cgroup_update_page_stat);
  * TODO: maybe necessary to use big numbers in big irons.
  */
 #define CHARGE_BATCH	32U
+/*
+ * Uncharges of the cached memcg go back to the stock rather than to the
+ * res_counter, up to this many pages. So a cpu holds at most that much of
+ * a memcg's usage, until the stocks get drained when its limit is hit.
+ */
+#define STOCK_MAX_PAGES	(2 * CHARGE_BATCH)
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
@@ -1947,25 +2014,45 @@ static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
 static DEFINE_MUTEX(percpu_charge_mutex);
 
 /*
- * Try to consume stocked charge on this cpu. If success, one page is consumed
- * from local stock and true is returned. If the stock is 0 or charges from a
- * cgroup which is not current target, returns false. This stock will be
+ * Try to consume stocked charge on this cpu. If success, nr_pages are consumed
+ * from local stock and true is returned. If the stock is too small or charges
+ * from a cgroup which is not current target, returns false. This stock will be
  * refilled.
  */
-static bool consume_stock(struct mem_cgroup *mem)
+static bool consume_stock(struct mem_cgroup *mem, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
 	bool ret = true;
 
 	stock = &get_cpu_var(memcg_stock);
-	if (mem == stock->cached && stock->nr_pages)
-		stock->nr_pages--;
+	if (mem == stock->cached && stock->nr_pages >= nr_pages)
+		stock->nr_pages -= nr_pages;
 	else /* need to call res_counter_charge */
 		ret = false;
 	put_cpu_var(memcg_stock);
 	return ret;
 }
 
+/*
+ * Keep the charge of uncharged pages in the local stock, if it's stocking
+ * for this memcg anyway and has room left. The next charges on this cpu
+ * can then be served without touching the res_counter.
+ */
+static bool uncharge_to_stock(struct mem_cgroup *mem, unsigned int nr_pages)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = false;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (mem == stock->cached &&
+	    stock->nr_pages + nr_pages <= STOCK_MAX_PAGES) {
+		stock->nr_pages += nr_pages;
+		ret = true;
+	}
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
 /*
  * Returns stocks cached in percpu to res_counter and reset cached information.
  */
@@ -2245,7 +2332,7 @@ again:
 		VM_BUG_ON(css_is_removed(&mem->css));
 		if (mem_cgroup_is_root(mem))
 			goto done;
-		if (nr_pages == 1 && consume_stock(mem))
+		if (consume_stock(mem, nr_pages))
 			goto done;
 		css_get(&mem->css);
 	} else {
@@ -2268,7 +2355,7 @@ again:
 			rcu_read_unlock();
 			goto done;
 		}
-		if (nr_pages == 1 && consume_stock(mem)) {
+		if (consume_stock(mem, nr_pages)) {
 			/*
 			 * It seems dagerous to access memcg without css_get().
 			 * But considering how consume_stok works, it's not
@@ -2920,6 +3007,14 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *mem,
 		batch->memsw_nr_pages++;
 	return;
 direct_uncharge:
+	/*
+	 * The stock holds charges of both counters, so it can only take
+	 * uncharges of both. Nor should it keep charges from OOM waiters.
+	 */
+	if (uncharge_memsw == do_swap_account &&
+	    !test_thread_flag(TIF_MEMDIE) && !atomic_read(&mem->oom_lock) &&
+	    uncharge_to_stock(mem, nr_pages))
+		return;
 	res_counter_uncharge(&mem->res, nr_pages * PAGE_SIZE);
 	if (uncharge_memsw)
 		res_counter_uncharge(&mem->memsw, nr_pages * PAGE_SIZE);
@@ -4254,6 +4349,34 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_high_wmark_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return mem_cgroup_from_cont(cgrp)->high_wmark_distance;
+}
+
+static int mem_cgroup_high_wmark_write(struct cgroup *cgrp, struct cftype *cft,
+				       const char *buffer)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	unsigned long long val;
+	int ret;
+
+	if (mem_cgroup_is_root(memcg))	/* root has no limit to be close to */
+		return -EINVAL;
+
+	ret = res_counter_memparse_write_strategy(buffer, &val);
+	if (ret)
+		return ret;
+
+	if (val >= res_counter_read_u64(&memcg->res, RES_LIMIT))
+		return -EINVAL;
+
+	memcg->high_wmark_distance = val;
+	mem_cgroup_check_high_wmark(memcg);
+
+	return 0;
+}
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -4656,6 +4779,11 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_move_charge_read,
 		.write_u64 = mem_cgroup_move_charge_write,
 	},
+	{
+		.name = "high_wmark_distance",
+		.read_u64 = mem_cgroup_high_wmark_read,
+		.write_string = mem_cgroup_high_wmark_write,
+	},
 	{
 		.name = "oom_control",
 		.read_map = mem_cgroup_oom_control_read,
@@ -4928,6 +5056,7 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	mem->last_scanned_child = 0;
 	mem->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&mem->oom_notify);
+	INIT_WORK(&mem->high_wmark_work, mem_cgroup_high_wmark_work);
 
 	if (parent)
 		mem->swappiness = get_swappiness(parent);
@@ -14,6 +14,24 @@
 #include <linux/mempool.h>
 #include <linux/blkdev.h>
 #include <linux/writeback.h>
+#include <linux/percpu.h>
+
+/*
+ * Each cpu keeps a few of the reserved elements it freed, so pools whose
+ * reserve is in use don't all serialize on pool->lock.  pool->avail counts
+ * the reserve wherever it is.  The elements stay reachable from the other
+ * cpus through steal_pcp(), which an allocation falls back to when its own
+ * cpu and pool->elements are empty.
+ *
+ * Lock order: pool->lock, then a pcp->lock.
+ */
+#define MEMPOOL_PCP_NR	4
+
+struct mempool_pcp {
+	spinlock_t lock;
+	int nr;
+	void *elements[MEMPOOL_PCP_NR];
+};
 
 static void add_element(mempool_t *pool, void *element)
 {
@@ -27,12 +45,45 @@ static void *remove_element(mempool_t *pool)
 	return pool->elements[--pool->curr_nr];
 }
 
+/* Take an element from whichever cpu cache has one. Called with irqs off. */
+static void *steal_pcp(mempool_t *pool)
+{
+	void *element = NULL;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mempool_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+		if (!pcp->nr)
+			continue;
+		spin_lock(&pcp->lock);
+		if (pcp->nr)
+			element = pcp->elements[--pcp->nr];
+		spin_unlock(&pcp->lock);
+		if (element)
+			break;
+	}
+	return element;
+}
+
 static void free_pool(mempool_t *pool)
 {
+	int cpu;
+
+	if (pool->pcp) {
+		for_each_possible_cpu(cpu) {
+			struct mempool_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+			while (pcp->nr)
+				pool->free(pcp->elements[--pcp->nr],
+							pool->pool_data);
+		}
+	}
 	while (pool->curr_nr) {
 		void *element = remove_element(pool);
 		pool->free(element, pool->pool_data);
 	}
+	free_percpu(pool->pcp);
 	kfree(pool->elements);
 	kfree(pool);
 }
@@ -62,15 +113,22 @@ mempool_t *mempool_create_node(int min_nr, mempool_alloc_t *alloc_fn,
 			mempool_free_t *free_fn, void *pool_data, int node_id)
 {
 	mempool_t *pool;
+	int cpu;
+
 	pool = kmalloc_node(sizeof(*pool), GFP_KERNEL | __GFP_ZERO, node_id);
 	if (!pool)
 		return NULL;
 	pool->elements = kmalloc_node(min_nr * sizeof(void *),
 					GFP_KERNEL, node_id);
-	if (!pool->elements) {
+	pool->pcp = alloc_percpu(struct mempool_pcp);
+	if (!pool->elements || !pool->pcp) {
+		free_percpu(pool->pcp);
+		kfree(pool->elements);
 		kfree(pool);
 		return NULL;
 	}
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(pool->pcp, cpu)->lock);
 	spin_lock_init(&pool->lock);
 	pool->min_nr = min_nr;
 	pool->pool_data = pool_data;
@@ -90,6 +148,7 @@ mempool_t *mempool_create_node(int min_nr, mempool_alloc_t *alloc_fn,
 			return NULL;
 		}
 		add_element(pool, element);
+		atomic_inc(&pool->avail);
 	}
 	return pool;
 }
@@ -121,13 +180,27 @@ int mempool_resize(mempool_t *pool, int new_min_nr, gfp_t gfp_mask)
 
 	spin_lock_irqsave(&pool->lock, flags);
 	if (new_min_nr <= pool->min_nr) {
-		while (new_min_nr < pool->curr_nr) {
-			element = remove_element(pool);
+		/*
+		 * Lower min_nr first: mempool_free() either sees it, or
+		 * we see the element it's adding to the reserve.
+		 */
+		pool->min_nr = new_min_nr;
+		smp_mb();
+		while (new_min_nr < atomic_read(&pool->avail)) {
+			if (pool->curr_nr)
+				element = remove_element(pool);
+			else
+				element = steal_pcp(pool);
+			if (!element) {
+				/* an allocation is about to account for it */
+				cpu_relax();
+				continue;
+			}
+			atomic_dec(&pool->avail);
 			spin_unlock_irqrestore(&pool->lock, flags);
 			pool->free(element, pool->pool_data);
 			spin_lock_irqsave(&pool->lock, flags);
 		}
-		pool->min_nr = new_min_nr;
 		goto out_unlock;
 	}
 	spin_unlock_irqrestore(&pool->lock, flags);
@@ -150,15 +223,16 @@ int mempool_resize(mempool_t *pool, int new_min_nr, gfp_t gfp_mask)
 	pool->elements = new_elements;
 	pool->min_nr = new_min_nr;
 
-	while (pool->curr_nr < pool->min_nr) {
+	while (atomic_read(&pool->avail) < pool->min_nr) {
 		spin_unlock_irqrestore(&pool->lock, flags);
 		element = pool->alloc(gfp_mask, pool->pool_data);
 		if (!element)
 			goto out;
 		spin_lock_irqsave(&pool->lock, flags);
-		if (pool->curr_nr < pool->min_nr) {
+		if (atomic_inc_return(&pool->avail) <= pool->min_nr) {
 			add_element(pool, element);
 		} else {
+			atomic_dec(&pool->avail);
 			spin_unlock_irqrestore(&pool->lock, flags);
 			pool->free(element, pool->pool_data);	/* Raced */
 			goto out;
@@ -183,11 +257,82 @@ EXPORT_SYMBOL(mempool_resize);
 void mempool_destroy(mempool_t *pool)
 {
 	/* Check for outstanding elements */
-	BUG_ON(pool->curr_nr != pool->min_nr);
+	BUG_ON(atomic_read(&pool->avail) != pool->min_nr);
 	free_pool(pool);
 }
 EXPORT_SYMBOL(mempool_destroy);
 
+/* Take an element from the reserve: this cpu's first, then the pool's. */
+static void *get_reserved(mempool_t *pool)
+{
+	struct mempool_pcp *pcp;
+	void *element = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	pcp = this_cpu_ptr(pool->pcp);
+	spin_lock(&pcp->lock);
+	if (pcp->nr)
+		element = pcp->elements[--pcp->nr];
+	spin_unlock(&pcp->lock);
+
+	if (!element) {
+		spin_lock(&pool->lock);
+		if (pool->curr_nr)
+			element = remove_element(pool);
+		spin_unlock(&pool->lock);
+	}
+
+	/* what's left of the reserve was freed on other cpus */
+	if (!element && atomic_read(&pool->avail))
+		element = steal_pcp(pool);
+
+	if (element)
+		atomic_dec(&pool->avail);
+
+	local_irq_restore(flags);
+
+	return element;
+}
+
+/* Put an element back into the reserve, if it's short of one. */
+static bool put_reserved(mempool_t *pool, void *element)
+{
+	struct mempool_pcp *pcp;
+	unsigned long flags;
+	bool ret = false;
+
+	local_irq_save(flags);
+
+	pcp = this_cpu_ptr(pool->pcp);
+	spin_lock(&pcp->lock);
+	if (pcp->nr < MEMPOOL_PCP_NR) {
+		if (atomic_inc_return(&pool->avail) <= pool->min_nr) {
+			pcp->elements[pcp->nr++] = element;
+			ret = true;
+		} else {
+			atomic_dec(&pool->avail);
+		}
+		spin_unlock(&pcp->lock);
+		goto out;
+	}
+	spin_unlock(&pcp->lock);
+
+	spin_lock(&pool->lock);
+	if (atomic_inc_return(&pool->avail) <= pool->min_nr) {
+		add_element(pool, element);
+		ret = true;
+	} else {
+		atomic_dec(&pool->avail);
+	}
+	spin_unlock(&pool->lock);
+out:
+	local_irq_restore(flags);
+
+	return ret;
+}
+
 /**
  * mempool_alloc - allocate an element from a specific memory pool
  * @pool:      pointer to the memory pool which was allocated via
@@ -202,7 +347,6 @@ EXPORT_SYMBOL(mempool_destroy);
 void * mempool_alloc(mempool_t *pool, gfp_t gfp_mask)
 {
 	void *element;
-	unsigned long flags;
 	wait_queue_t wait;
 	gfp_t gfp_temp;
 
@@ -220,13 +364,9 @@ repeat_alloc:
 	if (likely(element != NULL))
 		return element;
 
-	spin_lock_irqsave(&pool->lock, flags);
-	if (likely(pool->curr_nr)) {
-		element = remove_element(pool);
-		spin_unlock_irqrestore(&pool->lock, flags);
+	element = get_reserved(pool);
+	if (likely(element != NULL))
 		return element;
-	}
-	spin_unlock_irqrestore(&pool->lock, flags);
 
 	/* We must not sleep in the GFP_ATOMIC case */
 	if (!(gfp_mask & __GFP_WAIT))
@@ -237,7 +377,7 @@ repeat_alloc:
 	init_wait(&wait);
 	prepare_to_wait(&pool->wait, &wait, TASK_UNINTERRUPTIBLE);
 	smp_mb();
-	if (!pool->curr_nr) {
+	if (!atomic_read(&pool->avail)) {
 		/*
 		 * FIXME: this should be io_schedule().  The timeout is there
 		 * as a workaround for some DM problems in 2.6.18.
@@ -260,21 +400,14 @@ EXPORT_SYMBOL(mempool_alloc);
  */
 void mempool_free(void *element, mempool_t *pool)
 {
-	unsigned long flags;
-
 	if (unlikely(element == NULL))
 		return;
 
 	smp_mb();
-	if (pool->curr_nr < pool->min_nr) {
-		spin_lock_irqsave(&pool->lock, flags);
-		if (pool->curr_nr < pool->min_nr) {
-			add_element(pool, element);
-			spin_unlock_irqrestore(&pool->lock, flags);
-			wake_up(&pool->wait);
-			return;
-		}
-		spin_unlock_irqrestore(&pool->lock, flags);
+	if (atomic_read(&pool->avail) < pool->min_nr &&
+	    put_reserved(pool, element)) {
+		wake_up(&pool->wait);
+		return;
 	}
 	pool->free(element, pool->pool_data);
 }
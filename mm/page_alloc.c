@@ -636,6 +636,46 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 	spin_unlock(&zone->lock);
 }
 
+/*
+ * Frees blocks off the order lists of the pcp until at least count base
+ * pages were freed, or the lists are empty, and accounts for them in
+ * pcp->order_count.
+ */
+static void free_pcppages_order_bulk(struct zone *zone, int count,
+					struct per_cpu_pages *pcp)
+{
+	int order, migratetype;
+	int freed = 0;
+
+	spin_lock(&zone->lock);
+	zone->all_unreclaimable = 0;
+	zone->pages_scanned = 0;
+
+	for (order = PCP_MAX_ORDER; order > 0 && freed < count; order--) {
+		for (migratetype = 0; migratetype < MIGRATE_PCPTYPES &&
+						freed < count; migratetype++) {
+			struct list_head *list;
+
+			list = &pcp->order_lists[order - 1][migratetype];
+			while (!list_empty(list) && freed < count) {
+				struct page *page;
+
+				page = list_entry(list->prev, struct page, lru);
+				list_del(&page->lru);
+				__free_one_page(page, zone, order,
+							page_private(page));
+				trace_mm_page_pcpu_drain(page, order,
+							page_private(page));
+				freed += 1 << order;
+			}
+		}
+	}
+	__mod_zone_page_state(zone, NR_FREE_PAGES, freed);
+	spin_unlock(&zone->lock);
+
+	pcp->order_count -= freed;
+}
+
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
@@ -674,20 +714,49 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
+/*
+ * Small high-order pages go to the order lists of the pcp, the same way
+ * free_hot_cold_page() puts order-0 pages on its lists.
+ */
+static void free_pcp_order_page(struct zone *zone, struct page *page,
+				unsigned int order, int migratetype)
+{
+	struct per_cpu_pages *pcp;
+
+	if (migratetype >= MIGRATE_PCPTYPES) {
+		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
+			free_one_page(zone, page, order, migratetype);
+			return;
+		}
+		migratetype = MIGRATE_MOVABLE;
+	}
+
+	set_page_private(page, migratetype);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list_add(&page->lru, &pcp->order_lists[order - 1][migratetype]);
+	pcp->order_count += 1 << order;
+	if (pcp->order_count >= pcp->high)
+		free_pcppages_order_bulk(zone, pcp->batch, pcp);
+}
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
 	int wasMlocked = __TestClearPageMlocked(page);
+	int migratetype;
 
 	if (!free_pages_prepare(page, order))
 		return;
 
+	migratetype = get_pageblock_migratetype(page);
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
 	__count_vm_events(PGFREE, 1 << order);
-	free_one_page(page_zone(page), page, order,
-					get_pageblock_migratetype(page));
+	if (order && order <= PCP_MAX_ORDER)
+		free_pcp_order_page(page_zone(page), page, order, migratetype);
+	else
+		free_one_page(page_zone(page), page, order, migratetype);
 	local_irq_restore(flags);
 }
 
@@ -1073,6 +1142,8 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
 	pcp->count -= to_drain;
+	if (pcp->order_count)
+		free_pcppages_order_bulk(zone, pcp->batch, pcp);
 	local_irq_restore(flags);
 }
 #endif
@@ -1101,6 +1172,8 @@ static void drain_pages(unsigned int cpu)
 			free_pcppages_bulk(zone, pcp->count, pcp);
 			pcp->count = 0;
 		}
+		if (pcp->order_count)
+			free_pcppages_order_bulk(zone, pcp->order_count, pcp);
 		local_irq_restore(flags);
 	}
 }
@@ -1236,6 +1309,7 @@ void split_page(struct page *page, unsigned int order)
 	for (i = 1; i < (1 << order); i++)
 		set_page_refcounted(page + i);
 }
+EXPORT_SYMBOL_GPL(split_page);
 
 /*
  * Similar to split_page except the page is already free. As this is only
@@ -1333,6 +1407,27 @@ again:
 			 */
 			WARN_ON_ONCE(order > 1);
 		}
+		if (order <= PCP_MAX_ORDER) {
+			struct per_cpu_pages *pcp;
+			struct list_head *list;
+
+			local_irq_save(flags);
+			pcp = &this_cpu_ptr(zone->pageset)->pcp;
+			list = &pcp->order_lists[order - 1][migratetype];
+			if (list_empty(list)) {
+				int nr = max(pcp->batch >> order, 1);
+
+				nr = rmqueue_bulk(zone, order, nr, list,
+							migratetype, 0);
+				pcp->order_count += nr << order;
+				if (unlikely(list_empty(list)))
+					goto failed;
+			}
+			page = list_entry(list->next, struct page, lru);
+			list_del(&page->lru);
+			pcp->order_count -= 1 << order;
+			goto got_page;
+		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
@@ -1341,6 +1436,7 @@ again:
 		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1 << order));
 	}
 
+got_page:
 	__count_zone_vm_events(PGALLOC, zone, 1 << order);
 	zone_statistics(preferred_zone, zone, gfp_flags);
 	local_irq_restore(flags);
@@ -2090,6 +2186,8 @@ restart:
 	if (!(gfp_mask & __GFP_NO_KSWAPD))
 		wake_all_kswapd(order, zonelist, high_zoneidx,
 						zone_idx(preferred_zone));
+	if (order)
+		wakeup_kcompactd(preferred_zone, order);
 
 	/*
 	 * OK, we're below the kswapd watermark and have kicked background
@@ -2270,10 +2368,13 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 	page = get_page_from_freelist(gfp_mask|__GFP_HARDWALL, nodemask, order,
 			zonelist, high_zoneidx, ALLOC_WMARK_LOW|ALLOC_CPUSET,
 			preferred_zone, migratetype);
-	if (unlikely(!page))
+	if (unlikely(!page)) {
+		trace_mm_page_alloc_slowpath_begin(_RET_IP_, order, gfp_mask);
 		page = __alloc_pages_slowpath(gfp_mask, order,
 				zonelist, high_zoneidx, nodemask,
 				preferred_zone, migratetype);
+		trace_mm_page_alloc_slowpath_end(page, order);
+	}
 	put_mems_allowed();
 
 	trace_mm_page_alloc(page, order, gfp_mask, migratetype);
@@ -3542,7 +3643,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int migratetype, order;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3552,6 +3653,12 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->batch = max(1UL, 1 * batch);
 	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+
+	pcp->order_count = 0;
+	for (order = 0; order < PCP_MAX_ORDER; order++)
+		for (migratetype = 0; migratetype < MIGRATE_PCPTYPES;
+							migratetype++)
+			INIT_LIST_HEAD(&pcp->order_lists[order][migratetype]);
 }
 
 /*
@@ -3659,6 +3766,7 @@ static int __zone_pcp_update(void *data)
 
 		local_irq_save(flags);
 		free_pcppages_bulk(zone, pcp->count, pcp);
+		free_pcppages_order_bulk(zone, pcp->order_count, pcp);
 		setup_pageset(pset, batch);
 		local_irq_restore(flags);
 	}
@@ -4263,6 +4371,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat->kswapd_max_order = 0;
 	pgdat_page_cgroup_init(pgdat);
 	
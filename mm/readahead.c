@@ -17,6 +17,7 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
+#include <linux/capability.h>
 
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
@@ -504,6 +505,8 @@ void page_cache_sync_readahead(struct address_space *mapping,
 			       struct file_ra_state *ra, struct file *filp,
 			       pgoff_t offset, unsigned long req_size)
 {
+	ra->misses++;
+
 	/* no read-ahead */
 	if (!ra->ra_pages)
 		return;
@@ -550,6 +553,8 @@ page_cache_async_readahead(struct address_space *mapping,
 	if (PageWriteback(page))
 		return;
 
+	ra->hits++;
+
 	ClearPageReadahead(page);
 
 	/*
@@ -562,3 +567,35 @@ page_cache_async_readahead(struct address_space *mapping,
 	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
 }
 EXPORT_SYMBOL_GPL(page_cache_async_readahead);
+
+/*
+ * F_SETRA_SZ sets the maximum readahead window of @file, which starts out
+ * as the read_ahead_kb of its device. A size of 0 disables readahead.
+ * Going beyond the device's setting takes CAP_SYS_RESOURCE.
+ */
+long readahead_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct address_space *mapping = file->f_mapping;
+	unsigned long nr_pages;
+
+	if (S_ISFIFO(file->f_path.dentry->d_inode->i_mode))
+		return -ESPIPE;
+	if (!mapping)
+		return -EINVAL;
+
+	switch (cmd) {
+	case F_SETRA_SZ:
+		if (arg > INT_MAX)
+			return -EINVAL;
+		nr_pages = DIV_ROUND_UP(arg, PAGE_CACHE_SIZE);
+		if (nr_pages > mapping->backing_dev_info->ra_pages &&
+		    !capable(CAP_SYS_RESOURCE))
+			return -EPERM;
+		file->f_ra.ra_pages = nr_pages;
+		return 0;
+	case F_GETRA_SZ:
+		return (long)file->f_ra.ra_pages << PAGE_CACHE_SHIFT;
+	default:
+		return -EINVAL;
+	}
+}
@@ -1606,6 +1606,34 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Place large mappings so that their virtual address and file offset agree
+ * modulo HPAGE_PMD_SIZE, as a pmd can only ever map huge pages of the page
+ * cache that are laid out that way.
+ */
+static unsigned long shmem_get_unmapped_area(struct file *file,
+				unsigned long uaddr, unsigned long len,
+				unsigned long pgoff, unsigned long flags)
+{
+	unsigned long (*get_area)(struct file *, unsigned long, unsigned long,
+				  unsigned long, unsigned long);
+	unsigned long addr;
+
+	get_area = current->mm->get_unmapped_area;
+
+	if (uaddr || (flags & MAP_FIXED) || len < HPAGE_PMD_SIZE ||
+	    len > TASK_SIZE - HPAGE_PMD_SIZE)
+		return get_area(file, uaddr, len, pgoff, flags);
+
+	addr = get_area(file, 0, len + HPAGE_PMD_SIZE, pgoff, flags);
+	if (IS_ERR_VALUE(addr))
+		return get_area(file, uaddr, len, pgoff, flags);
+
+	return addr + (((pgoff << PAGE_SHIFT) - addr) & ~HPAGE_PMD_MASK);
+}
+#endif
+
 static struct inode *shmem_get_inode(struct super_block *sb, const struct inode *dir,
 				     int mode, dev_t dev, unsigned long flags)
 {
@@ -2693,6 +2721,9 @@ static const struct address_space_operations shmem_aops = {
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.get_unmapped_area = shmem_get_unmapped_area,
+#endif
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= do_sync_read,
@@ -1853,7 +1853,10 @@ new_slab:
 	if (gfpflags & __GFP_WAIT)
 		local_irq_enable();
 
+	trace_kmem_cache_grow_begin(addr, s->objsize, oo_order(s->oo),
+				    gfpflags);
 	page = new_slab(s, gfpflags, node);
+	trace_kmem_cache_grow_end(page);
 
 	if (gfpflags & __GFP_WAIT)
 		local_irq_disable();
@@ -2143,6 +2146,109 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Bulk freeing: the objects of the current cpu slab go straight onto the
+ * cpu freelist, all within a single irq disabled section instead of a
+ * cmpxchg_double each. The others take the slow path as usual.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	c = __this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void **object = p[i];
+		struct page *page = virt_to_head_page(object);
+
+		slab_free_hook(s, object);
+
+		if (likely(page == c->page)) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+		} else
+			__slab_free(s, page, object, _RET_IP_);
+
+		trace_kmem_cache_free(_RET_IP_, object);
+	}
+
+	/* Make a fastpath we preempted on this cpu notice and redo. */
+	c->tid = next_tid(c->tid);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
+/*
+ * Bulk allocation: take @size objects off the cpu freelist within a single
+ * irq disabled section, refilling it through the slow path as needed.
+ * Returns @size, or 0 (with nothing allocated) on failure.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t gfpflags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	size_t i, j;
+
+	if (slab_pre_alloc_hook(s, gfpflags))
+		return 0;
+
+	local_irq_save(flags);
+	c = __this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void **object = c->freelist;
+
+		if (unlikely(!object)) {
+			/*
+			 * __slab_alloc() may enable interrupts to grow the
+			 * cache, so the freelist we changed must be seen as
+			 * such, and we may come back on another cpu.
+			 */
+			c->tid = next_tid(c->tid);
+			object = __slab_alloc(s, gfpflags, NUMA_NO_NODE,
+					      _RET_IP_, c);
+			if (unlikely(!object))
+				goto error;
+			c = __this_cpu_ptr(s->cpu_slab);
+		} else {
+			c->freelist = get_freepointer(s, object);
+			stat(s, ALLOC_FASTPATH);
+		}
+		p[i] = object;
+	}
+
+	c->tid = next_tid(c->tid);
+	local_irq_restore(flags);
+
+	for (i = 0; i < size; i++) {
+		if (unlikely(gfpflags & __GFP_ZERO))
+			memset(p[i], 0, s->objsize);
+
+		slab_post_alloc_hook(s, gfpflags, p[i]);
+		trace_kmem_cache_alloc(_RET_IP_, p[i], s->objsize, s->size,
+				       gfpflags);
+	}
+
+	return size;
+
+error:
+	c = __this_cpu_ptr(s->cpu_slab);
+	c->tid = next_tid(c->tid);
+	local_irq_restore(flags);
+
+	for (j = 0; j < i; j++)
+		slab_post_alloc_hook(s, gfpflags, p[j]);
+	kmem_cache_free_bulk(s, i, p);
+
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
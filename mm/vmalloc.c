@@ -560,6 +560,18 @@ static unsigned long lazy_max_pages(void)
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
+/*
+ * Lazily freed areas wait for the next purge on a queue of the cpu that
+ * freed them: frees don't contend on a global lock, and the purge doesn't
+ * have to look through all the vmap areas for them.
+ */
+struct vmap_purge_queue {
+	spinlock_t lock;
+	struct list_head list;
+};
+
+static DEFINE_PER_CPU(struct vmap_purge_queue, vmap_purge_queue);
+
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
@@ -590,6 +602,7 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	struct vmap_area *va;
 	struct vmap_area *n_va;
 	int nr = 0;
+	int cpu;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -605,20 +618,23 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	for_each_possible_cpu(cpu) {
+		struct vmap_purge_queue *vpq = &per_cpu(vmap_purge_queue, cpu);
+
+		spin_lock(&vpq->lock);
+		list_splice_tail_init(&vpq->list, &valist);
+		spin_unlock(&vpq->lock);
+	}
+
+	list_for_each_entry(va, &valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -663,7 +679,15 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
+	struct vmap_purge_queue *vpq;
+
 	va->flags |= VM_LAZY_FREE;
+	vpq = &get_cpu_var(vmap_purge_queue);
+	spin_lock(&vpq->lock);
+	list_add_tail(&va->purge_list, &vpq->list);
+	spin_unlock(&vpq->lock);
+	put_cpu_var(vmap_purge_queue);
+
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
@@ -1170,6 +1194,14 @@ void __init vmalloc_init(void)
 		INIT_LIST_HEAD(&vbq->free);
 	}
 
+	for_each_possible_cpu(i) {
+		struct vmap_purge_queue *vpq;
+
+		vpq = &per_cpu(vmap_purge_queue, i);
+		spin_lock_init(&vpq->lock);
+		INIT_LIST_HEAD(&vpq->list);
+	}
+
 	/* Import existing vmlist entries. */
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
 		va = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
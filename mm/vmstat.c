@@ -470,7 +470,7 @@ void refresh_cpu_vm_stats(int cpu)
 		 * Check if there are pages remaining in this pageset
 		 * if not then there is nothing to expire.
 		 */
-		if (!p->expire || !p->pcp.count)
+		if (!p->expire || (!p->pcp.count && !p->pcp.order_count))
 			continue;
 
 		/*
@@ -485,7 +485,7 @@ void refresh_cpu_vm_stats(int cpu)
 		if (p->expire)
 			continue;
 
-		if (p->pcp.count)
+		if (p->pcp.count || p->pcp.order_count)
 			drain_zone_pages(zone, &p->pcp);
 #endif
 	}
@@ -51,6 +51,7 @@
 #endif
 #include <linux/string.h>
 #include <linux/skbuff.h>
+#include <linux/pagemap.h>
 #include <linux/splice.h>
 #include <linux/cache.h>
 #include <linux/rtnetlink.h>
@@ -58,6 +59,7 @@
 #include <linux/scatterlist.h>
 #include <linux/errqueue.h>
 #include <linux/prefetch.h>
+#include <linux/cpu.h>
 
 #include <net/protocol.h>
 #include <net/dst.h>
@@ -74,6 +76,80 @@
 static struct kmem_cache *skbuff_head_cache __read_mostly;
 static struct kmem_cache *skbuff_fclone_cache __read_mostly;
 
+/*
+ * Per-cpu cache of skbs consumed on this cpu (typically on tx completion),
+ * which are handed back, head and data, to the next rx refills of the same
+ * cpu (__netdev_alloc_skb()) instead of going back to the allocators.
+ * Only linear skbs able to hold SKB_RECYCLE_SIZE bytes (but not too much
+ * more) are kept, up to sysctl_skb_recycle_max per cpu.
+ */
+#define SKB_RECYCLE_SIZE	1536
+#define SKB_RECYCLE_MAX_SIZE	SKB_DATA_ALIGN(2 * SKB_RECYCLE_SIZE + NET_SKB_PAD)
+
+int sysctl_skb_recycle_max __read_mostly = 64;
+static DEFINE_PER_CPU(struct sk_buff_head, skb_recycle_cache);
+
+static struct sk_buff *skb_recycle_cache_get(unsigned int length,
+					     gfp_t gfp_mask)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	/* the cached buffers might not come from the zone asked for */
+	if (length > SKB_RECYCLE_SIZE || (gfp_mask & (__GFP_DMA | __GFP_DMA32)))
+		return NULL;
+
+	local_irq_save(flags);
+	skb = __skb_dequeue(&__get_cpu_var(skb_recycle_cache));
+	local_irq_restore(flags);
+
+	return skb;
+}
+
+static bool skb_recycle_cache_put(struct sk_buff *skb)
+{
+	struct sk_buff_head *cache;
+	unsigned long flags;
+	bool full;
+
+	if (in_irq() ||
+	    skb_end_pointer(skb) - skb->head > SKB_RECYCLE_MAX_SIZE)
+		return false;
+
+	local_irq_save(flags);
+	cache = &__get_cpu_var(skb_recycle_cache);
+	full = skb_queue_len(cache) >= sysctl_skb_recycle_max;
+	local_irq_restore(flags);
+	if (full)
+		return false;
+
+	/* releases whatever the skb holds, so needs irqs enabled */
+	if (!skb_recycle_check(skb, SKB_RECYCLE_SIZE))
+		return false;
+
+	local_irq_save(flags);
+	__skb_queue_head(&__get_cpu_var(skb_recycle_cache), skb);
+	local_irq_restore(flags);
+
+	return true;
+}
+
+static int skb_recycle_cpu_callback(struct notifier_block *nfb,
+				    unsigned long action, void *hcpu)
+{
+	struct sk_buff_head *cache;
+	struct sk_buff *skb;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	cache = &per_cpu(skb_recycle_cache, (unsigned long)hcpu);
+	while ((skb = __skb_dequeue(cache)) != NULL)
+		__kfree_skb(skb);
+
+	return NOTIFY_OK;
+}
+
 static void sock_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
@@ -86,10 +162,20 @@ static void sock_pipe_buf_get(struct pipe_inode_info *pipe,
 	get_page(buf->page);
 }
 
+/*
+ * Once the skb is gone, a page of its data only referenced by the pipe
+ * can be moved e.g. into the page cache, by splice to a file.
+ */
 static int sock_pipe_buf_steal(struct pipe_inode_info *pipe,
 			       struct pipe_buffer *buf)
 {
-	return 1;
+	struct page *page = buf->page;
+
+	if (page_count(page) != 1 || PageCompound(page))
+		return 1;
+
+	lock_page(page);
+	return 0;
 }
 
 
@@ -251,6 +337,13 @@ struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 {
 	struct sk_buff *skb;
 
+	/* comes with its NET_SKB_PAD reserved already */
+	skb = skb_recycle_cache_get(length, gfp_mask);
+	if (skb) {
+		skb->dev = dev;
+		return skb;
+	}
+
 	skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, NUMA_NO_NODE);
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
@@ -329,6 +422,17 @@ static void skb_release_data(struct sk_buff *skb)
 				put_page(skb_shinfo(skb)->frags[i].page);
 		}
 
+		/*
+		 * If the frags are userspace buffers, tell their owner the
+		 * lower device is done with them.
+		 */
+		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
+			struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
+
+			if (uarg->callback)
+				uarg->callback(uarg);
+		}
+
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
 
@@ -458,6 +562,8 @@ void consume_skb(struct sk_buff *skb)
 	else if (likely(!atomic_dec_and_test(&skb->users)))
 		return;
 	trace_consume_skb(skb);
+	if (sysctl_skb_recycle_max && skb_recycle_cache_put(skb))
+		return;
 	__kfree_skb(skb);
 }
 EXPORT_SYMBOL(consume_skb);
@@ -596,6 +702,67 @@ struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src)
 }
 EXPORT_SYMBOL_GPL(skb_morph);
 
+/**
+ *	skb_copy_ubufs	-	copy userspace skb frags buffers to kernel
+ *	@skb: the skb to modify
+ *	@gfp_mask: allocation priority
+ *
+ *	This must be called on SKBTX_DEV_ZEROCOPY skb.
+ *	It will copy all frags into kernel and drop the reference
+ *	to userspace pages.
+ *
+ *	If this function is called from an interrupt gfp_mask() must be
+ *	%GFP_ATOMIC.
+ *
+ *	Returns 0 on success or a negative error code on failure
+ *	to allocate kernel memory to copy to.
+ */
+int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	int i;
+	int num_frags = skb_shinfo(skb)->nr_frags;
+	struct page *page, *head = NULL;
+	struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
+
+	for (i = 0; i < num_frags; i++) {
+		u8 *vaddr;
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+
+		page = alloc_page(gfp_mask);
+		if (!page) {
+			while (head) {
+				struct page *next = (struct page *)head->private;
+				put_page(head);
+				head = next;
+			}
+			return -ENOMEM;
+		}
+		vaddr = kmap_skb_frag(f);
+		memcpy(page_address(page), vaddr + f->page_offset, f->size);
+		kunmap_skb_frag(vaddr);
+		page->private = (unsigned long)head;
+		head = page;
+	}
+
+	/* skb frags release userspace buffers */
+	for (i = 0; i < num_frags; i++)
+		put_page(skb_shinfo(skb)->frags[i].page);
+
+	if (uarg->callback)
+		uarg->callback(uarg);
+
+	/* skb frags point to kernel buffers, in the order they were copied */
+	for (i = num_frags - 1; i >= 0; i--) {
+		skb_shinfo(skb)->frags[i].page_offset = 0;
+		skb_shinfo(skb)->frags[i].page = head;
+		head = (struct page *)head->private;
+	}
+
+	skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_copy_ubufs);
+
 /**
  *	skb_clone	-	duplicate an sk_buff
  *	@skb: buffer to clone
@@ -614,6 +781,11 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	struct sk_buff *n;
 
+	/* A clone may outlive the original by far (e.g. in a packet tap),
+	 * don't let it hold on to userspace buffers. */
+	if (skb_orphan_frags(skb, gfp_mask))
+		return NULL;
+
 	n = skb + 1;
 	if (skb->fclone == SKB_FCLONE_ORIG &&
 	    n->fclone == SKB_FCLONE_UNAVAILABLE) {
@@ -731,6 +903,11 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 	if (skb_shinfo(skb)->nr_frags) {
 		int i;
 
+		if (skb_orphan_frags(skb, gfp_mask)) {
+			kfree_skb(n);
+			n = NULL;
+			goto out;
+		}
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
 			skb_shinfo(n)->frags[i] = skb_shinfo(skb)->frags[i];
 			get_page(skb_shinfo(n)->frags[i].page);
@@ -2511,6 +2688,10 @@ struct sk_buff *skb_segment(struct sk_buff *skb, u32 features)
 	int i = 0;
 	int pos;
 
+	/* The segments share the frags, and may outlive skb. */
+	if (skb_orphan_frags(skb, GFP_ATOMIC))
+		return ERR_PTR(-ENOMEM);
+
 	__skb_push(skb, doffset);
 	headroom = skb_headroom(skb);
 	pos = skb_headlen(skb);
@@ -2770,6 +2951,8 @@ EXPORT_SYMBOL_GPL(skb_gro_receive);
 
 void __init skb_init(void)
 {
+	int i;
+
 	skbuff_head_cache = kmem_cache_create("skbuff_head_cache",
 					      sizeof(struct sk_buff),
 					      0,
@@ -2781,6 +2964,9 @@ void __init skb_init(void)
 						0,
 						SLAB_HWCACHE_ALIGN|SLAB_PANIC,
 						NULL);
+	for_each_possible_cpu(i)
+		__skb_queue_head_init(&per_cpu(skb_recycle_cache, i));
+	hotcpu_notifier(skb_recycle_cpu_callback, 0);
 }
 
 /**
@@ -15,7 +15,10 @@
 #include <linux/kmod.h>
 #include <linux/skbuff.h>
 #include <linux/in.h>
+#include <linux/ip.h>
 #include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_tunnel.h>
 #include <linux/version.h>
 #include <linux/spinlock.h>
 #include <net/protocol.h>
@@ -120,9 +123,228 @@ drop:
 	kfree_skb(skb);
 }
 
+/*
+ * GRO/GSO of GRE (version 0) encapsulated IPv4, directly or behind an
+ * ethernet header (ETH_P_TEB). Only the key may be present: packets with
+ * a checksum or a sequence number can't be merged.
+ */
+struct gre_base_hdr {
+	__be16 flags;
+	__be16 protocol;
+};
+
+static int gre_offload_hlen(const struct gre_base_hdr *greh)
+{
+	if (greh->flags & ~GRE_KEY)
+		return -1;
+	return sizeof(*greh) + (greh->flags & GRE_KEY ? 4 : 0);
+}
+
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	const struct gre_base_hdr *greh;
+	const struct ethhdr *eh = NULL;
+	struct packet_type *ptype;
+	unsigned int hlen, off;
+	int grehlen, len;
+	__be16 type;
+	int flush = 1;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*greh);
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	/* skb->csum would have to go without the GRE header, which would
+	 * then be wrong for the tunnel if this isn't merged.
+	 */
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		goto out;
+
+	grehlen = gre_offload_hlen(greh);
+	if (grehlen < 0)
+		goto out;
+
+	type = greh->protocol;
+	len = grehlen;
+	if (type == htons(ETH_P_TEB))
+		len += ETH_HLEN;
+
+	hlen = off + len;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if (type == htons(ETH_P_TEB)) {
+		eh = (const struct ethhdr *)((const u8 *)greh + grehlen);
+		type = eh->h_proto;
+	}
+	if (type != htons(ETH_P_IP))
+		goto out;
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(type);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		const u8 *hdr2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* the flags match, so does the length of the header */
+		hdr2 = p->data + off;
+		if (memcmp(greh, hdr2, grehlen) ||
+		    (eh && compare_ether_header(eh, hdr2 + grehlen)))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, len);
+	pp = ptype->gro_receive(head, skb);
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int gre_gro_complete(struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	const struct gre_base_hdr *greh;
+	int nhoff = skb_network_offset(skb);
+	struct packet_type *ptype;
+	__be16 type;
+	int err = -ENOENT;
+	int len;
+
+	greh = (const struct gre_base_hdr *)((const u8 *)iph + iph->ihl * 4);
+	len = gre_offload_hlen(greh);
+	type = greh->protocol;
+	if (type == htons(ETH_P_TEB)) {
+		type = ((const struct ethhdr *)((const u8 *)greh + len))->h_proto;
+		len += ETH_HLEN;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(type);
+	if (ptype) {
+		/* the inner handlers expect the network header on theirs */
+		skb_set_network_header(skb, nhoff + iph->ihl * 4 + len);
+		err = ptype->gro_complete(skb);
+		skb_set_network_header(skb, nhoff);
+
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+	}
+	rcu_read_unlock();
+
+	return err;
+}
+
+static struct sk_buff *gre_gso_segment(struct sk_buff *skb, u32 features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	const struct gre_base_hdr *greh;
+	__be16 protocol = skb->protocol;
+	int mac_len = skb->mac_len;
+	unsigned char *outer, *nh;
+	int grehlen, tnl_hlen;
+	int inner_mac_len = 0;
+	__be16 type;
+	int err;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(*greh))))
+		goto out;
+
+	greh = (const struct gre_base_hdr *)skb_transport_header(skb);
+	grehlen = gre_offload_hlen(greh);
+	if (grehlen < 0)
+		goto out;
+
+	type = greh->protocol;
+	if (type == htons(ETH_P_TEB))
+		inner_mac_len = ETH_HLEN;
+
+	if (unlikely(!pskb_may_pull(skb, grehlen + inner_mac_len)))
+		goto out;
+
+	greh = (const struct gre_base_hdr *)skb_transport_header(skb);
+	if (inner_mac_len)
+		type = ((struct ethhdr *)(skb->data + grehlen))->h_proto;
+
+	/* everything up to the inner packet gets copied to each segment */
+	outer = skb_mac_header(skb);
+	nh = skb_network_header(skb);
+	tnl_hlen = skb->data + grehlen - outer;
+
+	/* Segment the inner packet. The device won't know how to checksum
+	 * the inner segments, so claim any checksum can be offloaded, and
+	 * do it below.
+	 */
+	__skb_pull(skb, grehlen);
+	skb_set_network_header(skb, inner_mac_len);
+	skb->protocol = type;
+
+	segs = skb_gso_segment(skb, (features & ~NETIF_F_ALL_CSUM) |
+				    NETIF_F_HW_CSUM);
+
+	/* skb_gso_segment() left skb at the inner mac header */
+	__skb_push(skb, grehlen);
+	skb_reset_transport_header(skb);
+	skb_set_network_header(skb, nh - skb->data);
+	skb_set_mac_header(skb, outer - skb->data);
+	skb->mac_len = mac_len;
+	skb->protocol = protocol;
+
+	if (!segs || IS_ERR(segs))
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		if (skb->ip_summed == CHECKSUM_PARTIAL) {
+			err = skb_checksum_help(skb);
+			if (err) {
+				while (segs) {
+					skb = segs;
+					segs = segs->next;
+					kfree_skb(skb);
+				}
+				segs = ERR_PTR(err);
+				goto out;
+			}
+		}
+
+		__skb_push(skb, tnl_hlen);
+		memcpy(skb->data, outer, tnl_hlen);
+		skb_reset_mac_header(skb);
+		skb_set_network_header(skb, mac_len);
+		skb->mac_len = mac_len;
+		skb->protocol = protocol;
+	}
+
+out:
+	return segs;
+}
+
 static const struct net_protocol net_gre_protocol = {
 	.handler     = gre_rcv,
 	.err_handler = gre_err,
+	.gso_segment = gre_gso_segment,
+	.gro_receive = gre_gro_receive,
+	.gro_complete = gre_gro_complete,
 	.netns_ok    = 1,
 };
 
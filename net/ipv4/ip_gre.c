@@ -674,6 +674,10 @@ static int ipgre_rcv(struct sk_buff *skb)
 		skb_reset_network_header(skb);
 		ipgre_ecn_decapsulate(iph, skb);
 
+		/* merged by GRO: the segments aren't encapsulated anymore */
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
 		netif_rx(skb);
 
 		rcu_read_unlock();
@@ -161,13 +161,38 @@ struct packet_mreq_max {
 	unsigned char	mr_address[MAX_ADDR_LEN];
 };
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
 struct pgv {
 	char *buffer;
 };
 
+/*
+ * State of a TPACKET_V3 rx ring: its blocks are filled one at a time with
+ * variable sized frames, and handed over to user space as a whole, when
+ * the next frame doesn't fit or the block timed out (retire_timer).
+ * Protected by the lock of sk_receive_queue.
+ */
+struct packet_blk_ring {
+	unsigned int		active;		/* block being filled */
+	unsigned int		open:1,		/* active block is set up */
+				frozen:1;	/* it is still user's */
+	unsigned int		blk_size;
+	unsigned int		priv_len;	/* aligned tp_sizeof_priv */
+	char			*nxt_offset;	/* where the next frame goes */
+	char			*blk_end;
+	struct tpacket3_hdr	*last_pkt;
+	atomic_t		fill_in_prog;	/* frames being copied in */
+	u64			seq_num;
+	unsigned long		retire_tov;	/* in jiffies */
+	struct timer_list	retire_timer;
+};
+
+#define V3_BLK_HDR_LEN		ALIGN(sizeof(struct tpacket_block_desc), 8)
+#define BLK_PLUS_PRIV(prb)	(V3_BLK_HDR_LEN + (prb)->priv_len)
+#define V3_DEFAULT_TOV_MS	8
+
 struct packet_ring_buffer {
 	struct pgv		*pg_vec;
 	unsigned int		head;
@@ -179,6 +204,8 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_pages;
 	unsigned int		pg_vec_len;
 
+	struct packet_blk_ring	prb;
+
 	atomic_t		pending;
 };
 
@@ -190,7 +217,7 @@ static void packet_flush_mclist(struct sock *sk);
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	struct tpacket_stats_v3	stats;
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
@@ -207,7 +234,8 @@ struct packet_sock {
 	enum tpacket_versions	tp_version;
 	unsigned int		tp_hdrlen;
 	unsigned int		tp_reserve;
-	unsigned int		tp_loss:1;
+	unsigned int		tp_loss:1,
+				tp_qdisc_bypass:1;
 	unsigned int		tp_tstamp;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
 };
@@ -329,6 +357,164 @@ static inline struct packet_sock *pkt_sk(struct sock *sk)
 	return (struct packet_sock *)sk;
 }
 
+static inline struct tpacket_block_desc *
+prb_block(struct packet_ring_buffer *rb, unsigned int n)
+{
+	return (struct tpacket_block_desc *)rb->pg_vec[n].buffer;
+}
+
+static int prb_block_owned_by_user(struct tpacket_block_desc *pbd)
+{
+	smp_rmb();
+	flush_dcache_page(pgv_to_page(&pbd->hdr.bh1.block_status));
+	return pbd->hdr.bh1.block_status & TP_STATUS_USER;
+}
+
+static void prb_open_block(struct packet_ring_buffer *rb,
+			   struct tpacket_block_desc *pbd)
+{
+	struct packet_blk_ring *prb = &rb->prb;
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = V3_BLK_HDR_LEN;
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(prb);
+	h1->blk_len = BLK_PLUS_PRIV(prb);
+	h1->seq_num = ++prb->seq_num;
+	h1->ts_first_pkt.ts_sec = h1->ts_last_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = h1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+
+	prb->nxt_offset = (char *)pbd + BLK_PLUS_PRIV(prb);
+	prb->blk_end = (char *)pbd + prb->blk_size;
+	prb->last_pkt = NULL;
+	prb->open = 1;
+
+	mod_timer(&prb->retire_timer, jiffies + prb->retire_tov);
+}
+
+/*
+ * Hand the active block over to user space, once the frames still being
+ * copied into it are done.  The caller wakes up the readers.
+ */
+static void prb_close_block(struct packet_ring_buffer *rb, int status)
+{
+	struct packet_blk_ring *prb = &rb->prb;
+	struct tpacket_block_desc *pbd = prb_block(rb, prb->active);
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+
+	while (atomic_read(&prb->fill_in_prog))
+		cpu_relax();
+	smp_rmb();
+
+	if (h1->num_pkts) {
+		struct tpacket3_hdr *first;
+
+		first = (void *)pbd + h1->offset_to_first_pkt;
+		h1->ts_first_pkt.ts_sec = first->tp_sec;
+		h1->ts_first_pkt.ts_nsec = first->tp_nsec;
+		h1->ts_last_pkt.ts_sec = prb->last_pkt->tp_sec;
+		h1->ts_last_pkt.ts_nsec = prb->last_pkt->tp_nsec;
+	}
+
+#if ARCH_IMPLEMENTS_FLUSH_DCACHE_PAGE == 1
+	{
+		char *start;
+
+		for (start = (char *)pbd; start < prb->nxt_offset;
+		     start += PAGE_SIZE)
+			flush_dcache_page(pgv_to_page(start));
+	}
+#endif
+	smp_wmb();
+
+	h1->block_status = TP_STATUS_USER | status;
+	flush_dcache_page(pgv_to_page(&h1->block_status));
+	smp_wmb();
+
+	prb->open = 0;
+	prb->active = (prb->active + 1) % rb->pg_vec_len;
+}
+
+/*
+ * Find room for a frame of len bytes in the active block, closing it
+ * (and setting *closed) if it doesn't fit anymore, and opening the next
+ * one if needed.  Returns NULL if that block wasn't released by user
+ * space yet: the ring stays "frozen" until it is.
+ */
+static void *prb_lookup_frame(struct packet_sock *po,
+			      struct packet_ring_buffer *rb,
+			      unsigned int len, bool *closed)
+{
+	struct packet_blk_ring *prb = &rb->prb;
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *h3;
+
+	len = TPACKET_ALIGN(len);
+	if (prb->open && prb->nxt_offset + len > prb->blk_end) {
+		prb_close_block(rb, 0);
+		*closed = true;
+	}
+
+	pbd = prb_block(rb, prb->active);
+	if (!prb->open) {
+		if (prb_block_owned_by_user(pbd)) {
+			if (!prb->frozen) {
+				prb->frozen = 1;
+				po->stats.tp_freeze_q_cnt++;
+			}
+			return NULL;
+		}
+		prb->frozen = 0;
+		prb_open_block(rb, pbd);
+	}
+
+	h3 = (struct tpacket3_hdr *)prb->nxt_offset;
+	h3->tp_next_offset = 0;
+	if (prb->last_pkt)
+		prb->last_pkt->tp_next_offset =
+			(char *)h3 - (char *)prb->last_pkt;
+	prb->last_pkt = h3;
+	prb->nxt_offset += len;
+
+	pbd->hdr.bh1.num_pkts++;
+	pbd->hdr.bh1.blk_len += len;
+	atomic_inc(&prb->fill_in_prog);
+
+	return h3;
+}
+
+/*
+ * Retire the active block if it got frames but didn't fill up within
+ * tp_retire_blk_tov, so that user space doesn't wait for them forever.
+ */
+static void prb_retire_timer(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct packet_blk_ring *prb = &rb->prb;
+	struct sock *sk = &po->sk;
+	bool closed = false;
+
+	spin_lock(&sk->sk_receive_queue.lock);
+	if (rb->pg_vec && prb->open) {
+		if (prb_block(rb, prb->active)->hdr.bh1.num_pkts) {
+			prb_close_block(rb, TP_STATUS_BLK_TMO);
+			closed = true;
+		} else {
+			mod_timer(&prb->retire_timer,
+				  jiffies + prb->retire_tov);
+		}
+	}
+	spin_unlock(&sk->sk_receive_queue.lock);
+
+	if (closed)
+		sk->sk_data_ready(sk, 0);
+}
+
 static void packet_sock_destruct(struct sock *sk)
 {
 	skb_queue_purge(&sk->sk_error_queue);
@@ -675,11 +861,13 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
 	int skb_len = skb->len;
 	unsigned int snaplen, res;
+	bool closed = false;
 	unsigned long status = TP_STATUS_LOSING|TP_STATUS_USER;
 	unsigned short macoff, netoff, hdrlen;
 	struct sk_buff *copy_skb = NULL;
@@ -746,10 +934,16 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
+	if (po->tp_version == TPACKET_V3)
+		h.raw = prb_lookup_frame(po, &po->rx_ring, macoff + snaplen,
+					 &closed);
+	else
+		h.raw = packet_current_frame(po, &po->rx_ring,
+					     TP_STATUS_KERNEL);
 	if (!h.raw)
 		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
+	if (po->tp_version != TPACKET_V3)
+		packet_increment_head(&po->rx_ring);
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -807,6 +1001,33 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_padding = 0;
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* tp_next_offset belongs to prb_lookup_frame() */
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if ((po->tp_tstamp & SOF_TIMESTAMPING_SYS_HARDWARE)
+				&& shhwtstamps->syststamp.tv64)
+			ts = ktime_to_timespec(shhwtstamps->syststamp);
+		else if ((po->tp_tstamp & SOF_TIMESTAMPING_RAW_HARDWARE)
+				&& shhwtstamps->hwtstamp.tv64)
+			ts = ktime_to_timespec(shhwtstamps->hwtstamp);
+		else if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		h.h3->hv1.tp_rxhash = skb->rxhash;
+		if (vlan_tx_tag_present(skb)) {
+			h.h3->hv1.tp_vlan_tci = vlan_tx_tag_get(skb);
+			status |= TP_STATUS_VLAN_VALID;
+		} else {
+			h.h3->hv1.tp_vlan_tci = 0;
+		}
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -822,7 +1043,10 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	__packet_set_status(po, h.raw, status);
+	if (po->tp_version == TPACKET_V3)
+		h.h3->tp_status = status;
+	else
+		__packet_set_status(po, h.raw, status);
 	smp_mb();
 #if ARCH_IMPLEMENTS_FLUSH_DCACHE_PAGE == 1
 	{
@@ -834,7 +1058,16 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 #endif
 
-	sk->sk_data_ready(sk, 0);
+	/*
+	 * V3 blocks are handed over (and readers woken up) as a whole, see
+	 * prb_close_block()
+	 */
+	if (po->tp_version == TPACKET_V3) {
+		atomic_dec(&po->rx_ring.prb.fill_in_prog);
+		if (closed)
+			sk->sk_data_ready(sk, 0);
+	} else
+		sk->sk_data_ready(sk, 0);
 
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
@@ -970,8 +1203,67 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	return tp_len;
 }
 
+/* Max. number of tx ring frames handed to the driver in one go */
+#define PACKET_TX_BATCH		32
+
+/*
+ * Hand the frames queued up by tpacket_snd() straight to the driver,
+ * taking its tx lock once for all of them (PACKET_QDISC_BYPASS).  Once
+ * the queue of the device is stopped, the rest of them go through the
+ * qdisc instead, which will hold them until the driver can take more.
+ */
+static void packet_xmit_batch(struct net_device *dev, struct sk_buff **batch,
+			      unsigned int *nr)
+{
+	const struct net_device_ops *ops = dev->netdev_ops;
+	struct netdev_queue *txq;
+	unsigned int i = 0;
+	u16 queue;
+	int cpu, rc;
+
+	if (!*nr)
+		return;
+
+	local_bh_disable();
+	cpu = smp_processor_id();
+	queue = cpu % dev->real_num_tx_queues;
+	txq = netdev_get_tx_queue(dev, queue);
+
+	HARD_TX_LOCK(dev, txq, cpu);
+	for (; i < *nr; i++) {
+		if (netif_tx_queue_frozen_or_stopped(txq))
+			break;
+		skb_set_queue_mapping(batch[i], queue);
+		rc = ops->ndo_start_xmit(batch[i], dev);
+		if (!dev_xmit_complete(rc))
+			break;
+		txq_trans_update(txq);
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	local_bh_enable();
+
+	/* frames dropped on the way are released by tpacket_destruct_skb() */
+	for (; i < *nr; i++)
+		dev_queue_xmit(batch[i]);
+	*nr = 0;
+}
+
+/*
+ * The frames handed straight to the driver skip the checks of
+ * dev_hard_start_xmit(), so a frame built on ring pages that the device
+ * can't gather (no NETIF_F_SG, or pages it can't DMA from) goes through
+ * dev_queue_xmit(), which linearizes it.
+ */
+static bool packet_xmit_direct_ok(struct sk_buff *skb)
+{
+	return !skb_shinfo(skb)->nr_frags ||
+		(netif_skb_features(skb) & NETIF_F_SG);
+}
+
 static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 {
+	struct sk_buff *batch[PACKET_TX_BATCH];
+	unsigned int nr_batch = 0;
 	struct sk_buff *skb;
 	struct net_device *dev;
 	__be16 proto;
@@ -1025,6 +1317,8 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 				TP_STATUS_SEND_REQUEST);
 
 		if (unlikely(ph == NULL)) {
+			/* what we wait for may be sitting in the batch */
+			packet_xmit_batch(dev, batch, &nr_batch);
 			schedule();
 			continue;
 		}
@@ -1060,6 +1354,16 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 		atomic_inc(&po->tx_ring.pending);
 
 		status = TP_STATUS_SEND_REQUEST;
+		if (po->tp_qdisc_bypass && packet_xmit_direct_ok(skb)) {
+			batch[nr_batch++] = skb;
+			if (nr_batch == PACKET_TX_BATCH)
+				packet_xmit_batch(dev, batch, &nr_batch);
+			packet_increment_head(&po->tx_ring);
+			len_sum += tp_len;
+			continue;
+		}
+		/* keep the frames in order */
+		packet_xmit_batch(dev, batch, &nr_batch);
 		err = dev_queue_xmit(skb);
 		if (unlikely(err > 0)) {
 			err = net_xmit_errno(err);
@@ -1088,6 +1392,7 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 out_status:
 	__packet_set_status(po, ph, status);
 	kfree_skb(skb);
+	packet_xmit_batch(dev, batch, &nr_batch);
 out_put:
 	dev_put(dev);
 out:
@@ -1320,7 +1625,7 @@ static int packet_release(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct packet_sock *po;
 	struct net *net;
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 
 	if (!sk)
 		return 0;
@@ -1347,13 +1652,13 @@ static int packet_release(struct socket *sock)
 
 	packet_flush_mclist(sk);
 
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
 
 	synchronize_net();
 	/*
@@ -1528,6 +1833,8 @@ static int packet_create(struct net *net, struct socket *sock, int protocol,
 
 	spin_lock_init(&po->bind_lock);
 	mutex_init(&po->pg_vec_lock);
+	setup_timer(&po->rx_ring.prb.retire_timer, prb_retire_timer,
+		    (unsigned long)po);
 	po->prot_hook.func = packet_rcv;
 
 	if (sock->type == SOCK_PACKET)
@@ -1983,15 +2290,21 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		if (po->tp_version == TPACKET_V3)
+			len = sizeof(req_u.req3);
+		else
+			len = sizeof(req_u.req);
+		if (optlen < len)
 			return -EINVAL;
 		if (pkt_sk(sk)->has_vnet_hdr)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -2018,6 +2331,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -2050,6 +2364,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->tp_loss = !!val;
 		return 0;
 	}
+	case PACKET_QDISC_BYPASS:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+		po->tp_qdisc_bypass = !!val;
+		return 0;
+	}
 	case PACKET_AUXDATA:
 	{
 		int val;
@@ -2115,7 +2440,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	struct tpacket_stats_v3 st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -2128,7 +2453,10 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+		} else if (len > sizeof(struct tpacket_stats))
 			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
@@ -2177,6 +2505,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -2194,6 +2525,12 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		val = po->tp_loss;
 		data = &val;
 		break;
+	case PACKET_QDISC_BYPASS:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = po->tp_qdisc_bypass;
+		data = &val;
+		break;
 	case PACKET_TIMESTAMP:
 		if (len > sizeof(int))
 			len = sizeof(int);
@@ -2326,7 +2663,15 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 	unsigned int mask = datagram_poll(file, sock, wait);
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
-	if (po->rx_ring.pg_vec) {
+	if (po->rx_ring.pg_vec && po->tp_version == TPACKET_V3) {
+		struct packet_ring_buffer *rb = &po->rx_ring;
+		unsigned int prev = rb->prb.active ? rb->prb.active - 1 :
+						     rb->pg_vec_len - 1;
+
+		/* blocks are released in order: is the last one closed ours? */
+		if (prb_block_owned_by_user(prb_block(rb, prev)))
+			mask |= POLLIN | POLLRDNORM;
+	} else if (po->rx_ring.pg_vec) {
 		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
@@ -2446,9 +2791,10 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
+	struct tpacket_req *req = &req_u->req;
 	struct pgv *pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
@@ -2481,6 +2827,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2500,6 +2849,20 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		if (unlikely((rb->frames_per_block * req->tp_block_nr) !=
 					req->tp_frame_nr))
 			goto out;
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_req3 *req3 = &req_u->req3;
+
+			/* Variable sized frames are for receiving only */
+			if (unlikely(tx_ring))
+				goto out;
+			if (unlikely(req3->tp_sizeof_priv >=
+				     req->tp_block_size))
+				goto out;
+			if (unlikely(V3_BLK_HDR_LEN +
+				     ALIGN(req3->tp_sizeof_priv, 8) +
+				     req->tp_frame_size > req->tp_block_size))
+				goto out;
+		}
 
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
@@ -2530,6 +2893,10 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 
 	synchronize_net();
 
+	/* Nothing can rearm the block timer of a detached socket */
+	if (!tx_ring)
+		del_timer_sync(&rb->prb.retire_timer);
+
 	err = -EBUSY;
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
@@ -2539,6 +2906,25 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (!tx_ring) {
+			struct packet_blk_ring *prb = &rb->prb;
+			unsigned int tov = req_u->req3.tp_retire_blk_tov;
+
+			prb->active = 0;
+			prb->open = 0;
+			prb->frozen = 0;
+			prb->last_pkt = NULL;
+			atomic_set(&prb->fill_in_prog, 0);
+			if (po->tp_version == TPACKET_V3 && req->tp_block_nr) {
+				prb->blk_size = req->tp_block_size;
+				prb->priv_len =
+					ALIGN(req_u->req3.tp_sizeof_priv, 8);
+				prb->retire_tov = msecs_to_jiffies(tov ? :
+							V3_DEFAULT_TOV_MS);
+				if (!prb->retire_tov)
+					prb->retire_tov = 1;
+			}
+		}
 		spin_unlock_bh(&rb_queue->lock);
 
 		swap(rb->pg_vec_order, order);
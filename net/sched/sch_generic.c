@@ -39,12 +39,21 @@
  * - updates to tree and tree walking are only done under the rtnl mutex.
  */
 
-static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
+/* Max. number of skbs qdisc_restart() hands to the driver in one go */
+#define QDISC_BULK_MAX	8
+
+/* Put skb back in front of the qdisc, to be dequeued first next time */
+static inline void qdisc_putback_skb(struct sk_buff *skb, struct Qdisc *q)
 {
 	skb_dst_force(skb);
-	q->gso_skb = skb;
-	q->qstats.requeues++;
+	__skb_queue_head(&q->gso_skb, skb);
 	q->q.qlen++;	/* it's still part of the queue */
+}
+
+static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
+{
+	qdisc_putback_skb(skb, q);
+	q->qstats.requeues++;
 	__netif_schedule(q);
 
 	return 0;
@@ -52,7 +61,7 @@ static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 
 static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
-	struct sk_buff *skb = q->gso_skb;
+	struct sk_buff *skb = skb_peek(&q->gso_skb);
 
 	if (unlikely(skb)) {
 		struct net_device *dev = qdisc_dev(q);
@@ -61,7 +70,7 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 		if (!netif_tx_queue_frozen_or_stopped(txq)) {
-			q->gso_skb = NULL;
+			__skb_unlink(skb, &q->gso_skb);
 			q->q.qlen--;
 		} else
 			skb = NULL;
@@ -72,6 +81,46 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 	return skb;
 }
 
+/*
+ * Dequeue up to QDISC_BULK_MAX skbs for the tx queue of the first one,
+ * so that they're handed to the driver under a single lock round trip.
+ * An skb for another tx queue ends the batch, and is put back.
+ */
+static int dequeue_skb_bulk(struct Qdisc *q, struct sk_buff **bulk)
+{
+	struct sk_buff *skb;
+	int n = 0;
+	u16 queue;
+
+	skb = dequeue_skb(q);
+	if (unlikely(!skb))
+		return 0;
+	queue = skb_get_queue_mapping(skb);
+	bulk[n++] = skb;
+
+	while (n < QDISC_BULK_MAX) {
+		skb = dequeue_skb(q);
+		if (!skb)
+			break;
+		if (skb_get_queue_mapping(skb) != queue) {
+			qdisc_putback_skb(skb, q);
+			break;
+		}
+		bulk[n++] = skb;
+	}
+
+	return n;
+}
+
+/* Requeue what's left of a batch, in front of anything put back since */
+static void dev_requeue_bulk(struct sk_buff **bulk, int n, struct Qdisc *q)
+{
+	while (n--)
+		qdisc_putback_skb(bulk[n], q);
+	q->qstats.requeues++;
+	__netif_schedule(q);
+}
+
 static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 					   struct netdev_queue *dev_queue,
 					   struct Qdisc *q)
@@ -149,6 +198,63 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	return ret;
 }
 
+/*
+ * Same as sch_direct_xmit(), for a batch of skbs going to the same tx
+ * queue: the qdisc lock is released, and the tx lock taken, only once for
+ * all of them.
+ */
+static int sch_direct_xmit_bulk(struct sk_buff **bulk, int n, struct Qdisc *q,
+				struct net_device *dev,
+				struct netdev_queue *txq,
+				spinlock_t *root_lock)
+{
+	int ret = NETDEV_TX_OK;
+	int i;
+
+	/* And release qdisc */
+	spin_unlock(root_lock);
+
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	for (i = 0; i < n; i++) {
+		ret = NETDEV_TX_BUSY;
+		if (!netif_tx_queue_frozen_or_stopped(txq))
+			ret = dev_hard_start_xmit(bulk[i], dev, txq);
+		if (!dev_xmit_complete(ret))
+			break;
+	}
+	HARD_TX_UNLOCK(dev, txq);
+
+	spin_lock(root_lock);
+
+	if (i == n) {
+		/* Driver sent out all skbs successfully or consumed them */
+		ret = qdisc_qlen(q);
+	} else if (ret == NETDEV_TX_LOCKED &&
+		   txq->xmit_lock_owner == smp_processor_id()) {
+		/* Dead loop, see handle_dev_cpu_collision() */
+		for (; i < n; i++)
+			kfree_skb(bulk[i]);
+		if (net_ratelimit())
+			pr_warning("Dead loop on netdevice %s, fix it urgently!\n",
+				   dev->name);
+		ret = qdisc_qlen(q);
+	} else {
+		if (ret == NETDEV_TX_LOCKED)
+			__this_cpu_inc(softnet_data.cpu_collision);
+		else if (unlikely(ret != NETDEV_TX_BUSY && net_ratelimit()))
+			pr_warning("BUG %s code %d qlen %d\n",
+				   dev->name, ret, q->q.qlen);
+
+		dev_requeue_bulk(bulk + i, n - i, q);
+		ret = 0;
+	}
+
+	if (ret && netif_tx_queue_frozen_or_stopped(txq))
+		ret = 0;
+
+	return ret;
+}
+
 /*
  * NOTE: Called under qdisc_lock(q) with locally disabled BH.
  *
@@ -173,18 +279,23 @@ static inline int qdisc_restart(struct Qdisc *q)
 	struct netdev_queue *txq;
 	struct net_device *dev;
 	spinlock_t *root_lock;
+	struct sk_buff *bulk[QDISC_BULK_MAX];
 	struct sk_buff *skb;
+	int n;
 
-	/* Dequeue packet */
-	skb = dequeue_skb(q);
-	if (unlikely(!skb))
+	/* Dequeue packets */
+	n = dequeue_skb_bulk(q, bulk);
+	if (unlikely(!n))
 		return 0;
+	skb = bulk[0];
 	WARN_ON_ONCE(skb_dst_is_noref(skb));
 	root_lock = qdisc_lock(q);
 	dev = qdisc_dev(q);
 	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
-	return sch_direct_xmit(skb, q, dev, txq, root_lock);
+	if (n == 1)
+		return sch_direct_xmit(skb, q, dev, txq, root_lock);
+	return sch_direct_xmit_bulk(bulk, n, q, dev, txq, root_lock);
 }
 
 void __qdisc_run(struct Qdisc *q)
@@ -379,6 +490,11 @@ struct Qdisc noop_qdisc = {
 	.ops		=	&noop_qdisc_ops,
 	.list		=	LIST_HEAD_INIT(noop_qdisc.list),
 	.q.lock		=	__SPIN_LOCK_UNLOCKED(noop_qdisc.q.lock),
+	.gso_skb	=	{
+		.next	=	(struct sk_buff *)&noop_qdisc.gso_skb,
+		.prev	=	(struct sk_buff *)&noop_qdisc.gso_skb,
+		.lock	=	__SPIN_LOCK_UNLOCKED(noop_qdisc.gso_skb.lock),
+	},
 	.dev_queue	=	&noop_netdev_queue,
 	.busylock	=	__SPIN_LOCK_UNLOCKED(noop_qdisc.busylock),
 };
@@ -406,6 +522,11 @@ static struct Qdisc noqueue_qdisc = {
 	.ops		=	&noqueue_qdisc_ops,
 	.list		=	LIST_HEAD_INIT(noqueue_qdisc.list),
 	.q.lock		=	__SPIN_LOCK_UNLOCKED(noqueue_qdisc.q.lock),
+	.gso_skb	=	{
+		.next	=	(struct sk_buff *)&noqueue_qdisc.gso_skb,
+		.prev	=	(struct sk_buff *)&noqueue_qdisc.gso_skb,
+		.lock	=	__SPIN_LOCK_UNLOCKED(noqueue_qdisc.gso_skb.lock),
+	},
 	.dev_queue	=	&noqueue_netdev_queue,
 	.busylock	=	__SPIN_LOCK_UNLOCKED(noqueue_qdisc.busylock),
 };
@@ -570,6 +691,7 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 	}
 	INIT_LIST_HEAD(&sch->list);
 	skb_queue_head_init(&sch->q);
+	__skb_queue_head_init(&sch->gso_skb);
 	spin_lock_init(&sch->busylock);
 	sch->ops = ops;
 	sch->enqueue = ops->enqueue;
@@ -611,9 +733,8 @@ void qdisc_reset(struct Qdisc *qdisc)
 	if (ops->reset)
 		ops->reset(qdisc);
 
-	if (qdisc->gso_skb) {
-		kfree_skb(qdisc->gso_skb);
-		qdisc->gso_skb = NULL;
+	if (!skb_queue_empty(&qdisc->gso_skb)) {
+		__skb_queue_purge(&qdisc->gso_skb);
 		qdisc->q.qlen = 0;
 	}
 }
@@ -648,7 +769,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	module_put(ops->owner);
 	dev_put(qdisc_dev(qdisc));
 
-	kfree_skb(qdisc->gso_skb);
+	__skb_queue_purge(&qdisc->gso_skb);
 	/*
 	 * gen_estimator est_timer() might access qdisc->q.lock,
 	 * wait a RCU grace period before freeing qdisc.
@@ -516,6 +516,8 @@ static int unix_stream_sendmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t);
 static int unix_stream_recvmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t, int);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int,
+				    size_t, int);
 static int unix_dgram_sendmsg(struct kiocb *, struct socket *,
 			      struct msghdr *, size_t);
 static int unix_dgram_recvmsg(struct kiocb *, struct socket *,
@@ -545,7 +547,7 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -1682,6 +1684,107 @@ out_err:
 	return sent ? : err;
 }
 
+/*
+ *	Zero-copy send of a page (splice(2), sendfile(2)): the page is
+ *	referenced from the receiver's queue rather than copied, so data
+ *	vmsplice'd into a pipe and spliced to the socket is only copied
+ *	once, by the receiver. As with TCP, later changes to the page
+ *	(e.g. to the user memory it was vmsplice'd from) may still show.
+ */
+
+static ssize_t unix_stream_sendpage(struct socket *socket, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = socket->sk;
+	struct sock *other;
+	struct sk_buff *skb, *newskb = NULL;
+	struct scm_cookie scm;
+	int err, i;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other || sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	memset(&scm, 0, sizeof(scm));
+	scm_set_cred(&scm, task_tgid(current), current_cred());
+
+	for (;;) {
+		err = -EPIPE;
+		if (sk->sk_shutdown & SEND_SHUTDOWN)
+			goto pipe_err;
+
+		unix_state_lock(other);
+
+		if (sock_flag(other, SOCK_DEAD) ||
+		    (other->sk_shutdown & RCV_SHUTDOWN)) {
+			unix_state_unlock(other);
+			goto pipe_err;
+		}
+
+		/*
+		 *	Readers dequeue an skb before copying from it, so
+		 *	the ones still queued may be grown under the state
+		 *	lock. Append to our last one if it only has data.
+		 */
+		skb = skb_peek_tail(&other->sk_receive_queue);
+		if (skb && skb->sk == sk && !UNIXCB(skb).fp &&
+		    UNIXCB(skb).pid == scm.pid &&
+		    UNIXCB(skb).cred == scm.cred &&
+		    (skb_shinfo(skb)->nr_frags < MAX_SKB_FRAGS ||
+		     skb_can_coalesce(skb, skb_shinfo(skb)->nr_frags,
+				      page, offset)) &&
+		    (newskb || unix_writable(sk)))
+			break;
+
+		if (newskb) {
+			skb = newskb;
+			newskb = NULL;
+			skb_queue_tail(&other->sk_receive_queue, skb);
+			break;
+		}
+		unix_state_unlock(other);
+
+		newskb = sock_alloc_send_pskb(sk, 0, 0, flags & MSG_DONTWAIT,
+					      &err);
+		if (!newskb)
+			goto out;
+
+		/* never fails without fds to attach */
+		unix_scm_to_skb(&scm, newskb, false);
+	}
+
+	i = skb_shinfo(skb)->nr_frags;
+	if (skb_can_coalesce(skb, i, page, offset)) {
+		skb_shinfo(skb)->frags[i - 1].size += size;
+	} else {
+		get_page(page);
+		skb_fill_page_desc(skb, i, page, offset, size);
+	}
+
+	skb->len += size;
+	skb->data_len += size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+
+	unix_state_unlock(other);
+	other->sk_data_ready(other, size);
+
+	kfree_skb(newskb);
+	scm_destroy(&scm);
+	return size;
+
+pipe_err:
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+out:
+	kfree_skb(newskb);
+	scm_destroy(&scm);
+	return err;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1849,6 +1952,14 @@ static long unix_stream_data_wait(struct sock *sk, long timeo)
 
 
 
+/* Stream skbs are read in place (they may be paged, see
+ * unix_stream_sendpage()), this is what is left to read of them.
+ */
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return skb->len - UNIXCB(skb).consumed;
+}
+
 static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			       struct msghdr *msg, size_t size,
 			       int flags)
@@ -1953,8 +2064,9 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		if (skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+					    msg->msg_iov, chunk)) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
 				copied = -EFAULT;
@@ -1965,13 +2077,13 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
 				unix_detach_fds(siocb->scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
@@ -2064,7 +2176,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)
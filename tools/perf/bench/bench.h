@@ -4,6 +4,9 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_ipc_rpmsg(int argc, const char **argv, const char *prefix __used);
+extern int bench_ipc_unix(int argc, const char **argv, const char *prefix __used);
+extern int bench_ipc_pipe(int argc, const char **argv, const char *prefix __used);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -0,0 +1,526 @@
+/*
+ *
+ * ipc.c
+ *
+ * ipc: round trip benchmarks of rpmsg, AF_UNIX sockets and pipes
+ *
+ * Every endpoint is driven by its own thread, which sends a message, waits
+ * for it to come back and records how long that took.  The rpmsg suite
+ * talks to an rpmsg-char device whose remote side echoes what it receives
+ * (e.g. a firmware echo service, or an echo server on the loopback host);
+ * the unix and pipe suites run a local echo thread per endpoint, and serve
+ * as a baseline for the same workload on local IPC.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define LOOPS_DEFAULT		10000
+#define SIZES_DEFAULT		"16,64,256,496"
+#define ENDPOINTS_DEFAULT	"1"
+#define RPMSG_DEVICE_DEFAULT	"/dev/rpmsg-char0"
+
+/* the largest payload of a single rpmsg message */
+#define RPMSG_MAX_PAYLOAD	496
+
+/* keep a whole message within the default socket and pipe buffers */
+#define LOCAL_MAX_PAYLOAD	65536
+
+/* how long to wait for an echo before deciding there is no echo service */
+#define ECHO_TIMEOUT_MS		2000
+
+#define MAX_STEPS		32
+
+static int loops = LOOPS_DEFAULT;
+static const char *sizes_str = SIZES_DEFAULT;
+static const char *endpoints_str = ENDPOINTS_DEFAULT;
+static const char *rpmsg_device = RPMSG_DEVICE_DEFAULT;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of round trips per endpoint and size"),
+	OPT_STRING('s', "size", &sizes_str, "16,64,256,496",
+		    "Specify comma separated payload sizes"),
+	OPT_STRING('e', "endpoints", &endpoints_str, "1",
+		    "Specify comma separated numbers of concurrent endpoints"),
+	OPT_END()
+};
+
+static const struct option rpmsg_options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of round trips per endpoint and size"),
+	OPT_STRING('s', "size", &sizes_str, "16,64,256,496",
+		    "Specify comma separated payload sizes"),
+	OPT_STRING('e', "endpoints", &endpoints_str, "1",
+		    "Specify comma separated numbers of concurrent endpoints"),
+	OPT_STRING('d', "device", &rpmsg_device, "/dev/rpmsg-char0",
+		    "Specify the rpmsg-char device to use"),
+	OPT_END()
+};
+
+static const char * const bench_ipc_rpmsg_usage[] = {
+	"perf bench ipc rpmsg <options>",
+	NULL
+};
+
+static const char * const bench_ipc_unix_usage[] = {
+	"perf bench ipc unix <options>",
+	NULL
+};
+
+static const char * const bench_ipc_pipe_usage[] = {
+	"perf bench ipc pipe <options>",
+	NULL
+};
+
+struct ipc_ept {
+	int rfd, wfd;		/* our side */
+	int peer_rfd, peer_wfd;	/* the echo thread's side, or -1 */
+	pthread_t peer;
+	pthread_t thread;
+	size_t size;
+	u64 *lat;		/* round trip times, in nsecs */
+	int err;
+};
+
+struct ipc_transport {
+	const char *name;
+	int max_size;
+	int (*open)(struct ipc_ept *ept);
+	/* set if messages don't keep their boundaries */
+	int stream;
+};
+
+static u64 now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int parse_list(const char *str, int *vals, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*str) {
+		if (n == max)
+			return -1;
+		vals[n] = strtol(str, &end, 0);
+		if (end == str || vals[n] <= 0)
+			return -1;
+		n++;
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str)
+			return -1;
+	}
+
+	return n;
+}
+
+/* read exactly len bytes off a stream transport */
+static int read_full(int fd, char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len) {
+		r = read(fd, buf, len);
+		if (r <= 0)
+			return r < 0 ? -errno : -EPIPE;
+		buf += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len) {
+		r = write(fd, buf, len);
+		if (r < 0)
+			return -errno;
+		buf += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int transport_stream;
+
+static void *echo_thread(void *arg)
+{
+	struct ipc_ept *ept = arg;
+	char *buf = malloc(ept->size);
+	ssize_t r;
+
+	if (!buf)
+		return NULL;
+
+	for (;;) {
+		if (transport_stream) {
+			if (read_full(ept->peer_rfd, buf, ept->size))
+				break;
+			r = ept->size;
+		} else {
+			r = read(ept->peer_rfd, buf, ept->size);
+			if (r <= 0)
+				break;
+		}
+		if (write_full(ept->peer_wfd, buf, r))
+			break;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int rpmsg_open(struct ipc_ept *ept)
+{
+	int fd = open(rpmsg_device, O_RDWR);
+
+	if (fd < 0)
+		return -errno;
+
+	ept->rfd = ept->wfd = fd;
+	ept->peer_rfd = ept->peer_wfd = -1;
+	return 0;
+}
+
+static int unix_open(struct ipc_ept *ept)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv))
+		return -errno;
+
+	ept->rfd = ept->wfd = sv[0];
+	ept->peer_rfd = ept->peer_wfd = sv[1];
+	return 0;
+}
+
+static int pipe_open(struct ipc_ept *ept)
+{
+	int to_peer[2], from_peer[2];
+
+	if (pipe(to_peer))
+		return -errno;
+	if (pipe(from_peer)) {
+		close(to_peer[0]);
+		close(to_peer[1]);
+		return -errno;
+	}
+
+	ept->wfd = to_peer[1];
+	ept->peer_rfd = to_peer[0];
+	ept->peer_wfd = from_peer[1];
+	ept->rfd = from_peer[0];
+	return 0;
+}
+
+static void ept_close(struct ipc_ept *ept)
+{
+	if (ept->peer_rfd < 0) {
+		close(ept->rfd);
+		return;
+	}
+
+	/* a closed (or shut down) write side makes the echo thread exit */
+	if (ept->wfd == ept->rfd)
+		shutdown(ept->wfd, SHUT_WR);
+	else
+		close(ept->wfd);
+
+	pthread_join(ept->peer, NULL);
+	close(ept->peer_rfd);
+	if (ept->peer_wfd != ept->peer_rfd)
+		close(ept->peer_wfd);
+	close(ept->rfd);
+}
+
+static void *ept_thread(void *arg)
+{
+	struct ipc_ept *ept = arg;
+	struct pollfd pfd = { .fd = ept->rfd, .events = POLLIN };
+	char *tx, *rx;
+	u64 start;
+	u32 seq;
+	ssize_t r;
+	int i;
+
+	tx = calloc(1, ept->size);
+	rx = malloc(ept->size);
+	if (!tx || !rx) {
+		ept->err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < loops; i++) {
+		seq = i;
+		memcpy(tx, &seq, ept->size < sizeof(seq) ? ept->size :
+		       sizeof(seq));
+
+		start = now_nsec();
+		ept->err = write_full(ept->wfd, tx, ept->size);
+		if (ept->err)
+			break;
+
+		r = poll(&pfd, 1, ECHO_TIMEOUT_MS);
+		if (r <= 0) {
+			ept->err = r ? -errno : -ETIMEDOUT;
+			break;
+		}
+
+		if (transport_stream) {
+			ept->err = read_full(ept->rfd, rx, ept->size);
+			if (ept->err)
+				break;
+		} else {
+			r = read(ept->rfd, rx, ept->size);
+			if (r != (ssize_t)ept->size) {
+				ept->err = r < 0 ? -errno : -EBADMSG;
+				break;
+			}
+		}
+		ept->lat[i] = now_nsec() - start;
+
+		if (memcmp(tx, rx, ept->size)) {
+			ept->err = -EBADMSG;
+			break;
+		}
+	}
+
+out:
+	free(tx);
+	free(rx);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(u64 *lat, int n, double p)
+{
+	int i = (int)(p * (n - 1) / 100.0 + 0.5);
+
+	return lat[i] / 1000.0;
+}
+
+static void print_header(const struct ipc_transport *t)
+{
+	if (bench_format != BENCH_FORMAT_DEFAULT)
+		return;
+
+	printf("# Executed %d round trips per endpoint and size over %s",
+	       loops, t->name);
+	if (!strcmp(t->name, "rpmsg"))
+		printf(" (%s)", rpmsg_device);
+	printf("\n# Latencies in usecs\n\n");
+	printf(" %9s %6s %9s %9s %9s %9s %9s %9s %11s %9s\n",
+	       "endpoints", "size", "min", "p50", "p90", "p99", "p99.9",
+	       "max", "msgs/sec", "MB/sec");
+}
+
+static void print_step(int nr_epts, int size, u64 *lat, int n, u64 wall)
+{
+	double secs = wall / 1e9;
+	double msgs = n / secs;
+
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %9d %6d %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %11.0f %9.2f\n",
+		       nr_epts, size, lat[0] / 1000.0,
+		       percentile(lat, n, 50), percentile(lat, n, 90),
+		       percentile(lat, n, 99), percentile(lat, n, 99.9),
+		       lat[n - 1] / 1000.0, msgs,
+		       msgs * size / (1024 * 1024));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%d %d %.2f %.2f %.2f %.2f %.2f %.2f %.0f\n",
+		       nr_epts, size, lat[0] / 1000.0,
+		       percentile(lat, n, 50), percentile(lat, n, 90),
+		       percentile(lat, n, 99), percentile(lat, n, 99.9),
+		       lat[n - 1] / 1000.0, msgs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_step(const struct ipc_transport *t, int nr_epts, int size)
+{
+	struct ipc_ept *epts;
+	u64 *lat, start, wall;
+	int i, opened = 0, err = 0;
+
+	epts = calloc(nr_epts, sizeof(*epts));
+	lat = calloc((size_t)nr_epts * loops, sizeof(*lat));
+	if (!epts || !lat) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (; opened < nr_epts; opened++) {
+		struct ipc_ept *ept = &epts[opened];
+
+		ept->size = size;
+		ept->lat = lat + (size_t)opened * loops;
+		err = t->open(ept);
+		if (err)
+			goto close;
+		if (ept->peer_rfd >= 0 &&
+		    pthread_create(&ept->peer, NULL, echo_thread, ept)) {
+			err = -errno;
+			close(ept->rfd);
+			if (ept->wfd != ept->rfd)
+				close(ept->wfd);
+			close(ept->peer_rfd);
+			if (ept->peer_wfd != ept->peer_rfd)
+				close(ept->peer_wfd);
+			goto close;
+		}
+	}
+
+	start = now_nsec();
+	for (i = 0; i < nr_epts; i++)
+		pthread_create(&epts[i].thread, NULL, ept_thread, &epts[i]);
+	for (i = 0; i < nr_epts; i++) {
+		pthread_join(epts[i].thread, NULL);
+		if (epts[i].err && !err)
+			err = epts[i].err;
+	}
+	wall = now_nsec() - start;
+
+	if (!err)
+		print_step(nr_epts, size, lat, nr_epts * loops, wall);
+
+close:
+	for (i = 0; i < opened; i++)
+		ept_close(&epts[i]);
+out:
+	free(epts);
+	free(lat);
+	return err;
+}
+
+static int bench_ipc(const struct ipc_transport *t)
+{
+	int sizes[MAX_STEPS], nr_epts[MAX_STEPS];
+	int nr_sizes, nr_steps, i, j, err;
+
+	nr_sizes = parse_list(sizes_str, sizes, MAX_STEPS);
+	nr_steps = parse_list(endpoints_str, nr_epts, MAX_STEPS);
+	if (nr_sizes <= 0 || nr_steps <= 0 || loops <= 0) {
+		fprintf(stderr, "Invalid size, endpoints or loop option\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_sizes; i++) {
+		if (sizes[i] > t->max_size) {
+			fprintf(stderr, "%s messages are at most %d bytes\n",
+				t->name, t->max_size);
+			return 1;
+		}
+	}
+
+	transport_stream = t->stream;
+	print_header(t);
+
+	for (i = 0; i < nr_steps; i++) {
+		for (j = 0; j < nr_sizes; j++) {
+			err = run_step(t, nr_epts[i], sizes[j]);
+			if (err == -ETIMEDOUT) {
+				fprintf(stderr, "No echo within %d msecs; is "
+					"an echo service running behind %s?\n",
+					ECHO_TIMEOUT_MS, rpmsg_device);
+				return 1;
+			} else if (err) {
+				fprintf(stderr, "%s: %d endpoints, %d bytes: %s\n",
+					t->name, nr_epts[i], sizes[j],
+					strerror(-err));
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static const struct ipc_transport rpmsg_transport = {
+	.name		= "rpmsg",
+	.max_size	= RPMSG_MAX_PAYLOAD,
+	.open		= rpmsg_open,
+};
+
+static const struct ipc_transport unix_transport = {
+	.name		= "unix",
+	.max_size	= LOCAL_MAX_PAYLOAD,
+	.open		= unix_open,
+};
+
+static const struct ipc_transport pipe_transport = {
+	.name		= "pipe",
+	.max_size	= LOCAL_MAX_PAYLOAD,
+	.open		= pipe_open,
+	.stream		= 1,
+};
+
+int bench_ipc_rpmsg(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	argc = parse_options(argc, argv, rpmsg_options,
+			     bench_ipc_rpmsg_usage, 0);
+
+	return bench_ipc(&rpmsg_transport);
+}
+
+int bench_ipc_unix(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	argc = parse_options(argc, argv, options,
+			     bench_ipc_unix_usage, 0);
+
+	return bench_ipc(&unix_transport);
+}
+
+int bench_ipc_pipe(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	argc = parse_options(argc, argv, options,
+			     bench_ipc_pipe_usage, 0);
+
+	return bench_ipc(&pipe_transport);
+}
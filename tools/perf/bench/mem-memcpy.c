@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #define K 1024
@@ -28,6 +30,10 @@ static bool		use_clock;
 static int		clock_fd;
 static bool		only_prefault;
 static bool		no_prefault;
+static const char	*map_file;
+static const char	*map_offset_str	= "0";
+static bool		map_sync;
+static const char	*map_target	= "dst";
 
 static const struct option options[] = {
 	OPT_STRING('l', "length", &length_str, "1MB",
@@ -41,6 +47,17 @@ static const struct option options[] = {
 		    "Show only the result with page faults before memcpy()"),
 	OPT_BOOLEAN('n', "no-prefault", &no_prefault,
 		    "Show only the result without page faults before memcpy()"),
+	OPT_STRING('m', "map", &map_file, "file",
+		    "Map the buffer(s) from this file (e.g. /dev/mem) "
+		    "instead of allocating them"),
+	OPT_STRING('a', "map-offset", &map_offset_str, "0",
+		    "Specify offset of the mapping in the file "
+		    "(a physical address for /dev/mem)"),
+	OPT_BOOLEAN('s', "map-sync", &map_sync,
+		    "Open the mapped file with O_SYNC, for an uncached "
+		    "(or, on ARM, write-combined) mapping"),
+	OPT_STRING('t', "map-target", &map_target, "dst",
+		    "Specify which buffer is mapped: dst, src or both"),
 	OPT_END()
 };
 
@@ -62,6 +79,13 @@ struct routine routines[] = {
 #include "mem-memcpy-x86-64-asm-def.h"
 #undef MEMCPY_FN
 
+#endif
+#ifdef ARCH_ARM
+
+#define MEMCPY_FN(fn, name, desc) { name, desc, fn },
+#include "mem-memcpy-arm-asm-def.h"
+#undef MEMCPY_FN
+
 #endif
 
 	{ NULL,
@@ -106,23 +130,70 @@ static double timeval2double(struct timeval *ts)
 		(double)ts->tv_usec / (double)1000000;
 }
 
+static bool map_dst, map_src;
+static off_t map_offset;
+
+/*
+ * Map length bytes of map_file, at map_offset plus index lengths.  With
+ * /dev/mem this gives a copy destination (or source) with the memory
+ * attributes the kernel uses for that physical address: with O_SYNC, x86
+ * maps it uncached; ARM maps RAM write-combined, and memory the kernel
+ * doesn't own (such as remoteproc carveouts) uncached in any case.
+ */
+static void *map_mem(size_t length, int index)
+{
+	void *p;
+	int fd;
+
+	fd = open(map_file, O_RDWR | (map_sync ? O_SYNC : 0));
+	if (fd < 0)
+		die("cannot open %s: %s\n", map_file, strerror(errno));
+
+	p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		 map_offset + (off_t)length * index);
+	if (p == MAP_FAILED)
+		die("cannot map %s: %s\n", map_file, strerror(errno));
+
+	close(fd);
+	return p;
+}
+
 static void alloc_mem(void **dst, void **src, size_t length)
 {
-	*dst = zalloc(length);
-	if (!dst)
+	if (map_dst)
+		*dst = map_mem(length, 0);
+	else
+		*dst = zalloc(length);
+	if (!*dst)
 		die("memory allocation failed - maybe length is too large?\n");
 
-	*src = zalloc(length);
-	if (!src)
+	if (map_src)
+		*src = map_mem(length, map_dst ? 1 : 0);
+	else
+		*src = zalloc(length);
+	if (!*src)
 		die("memory allocation failed - maybe length is too large?\n");
 }
 
+static void free_mem(void *dst, void *src, size_t length)
+{
+	if (map_dst)
+		munmap(dst, length);
+	else
+		free(dst);
+
+	if (map_src)
+		munmap(src, length);
+	else
+		free(src);
+}
+
 static u64 do_memcpy_clock(memcpy_t fn, size_t len, bool prefault)
 {
 	u64 clock_start = 0ULL, clock_end = 0ULL;
 	void *src = NULL, *dst = NULL;
 
-	alloc_mem(&src, &dst, len);
+	alloc_mem(&dst, &src, len);
 
 	if (prefault)
 		fn(dst, src, len);
@@ -131,8 +202,7 @@ static u64 do_memcpy_clock(memcpy_t fn, size_t len, bool prefault)
 	fn(dst, src, len);
 	clock_end = get_clock();
 
-	free(src);
-	free(dst);
+	free_mem(dst, src, len);
 	return clock_end - clock_start;
 }
 
@@ -141,7 +211,7 @@ static double do_memcpy_gettimeofday(memcpy_t fn, size_t len, bool prefault)
 	struct timeval tv_start, tv_end, tv_diff;
 	void *src = NULL, *dst = NULL;
 
-	alloc_mem(&src, &dst, len);
+	alloc_mem(&dst, &src, len);
 
 	if (prefault)
 		fn(dst, src, len);
@@ -152,8 +222,7 @@ static double do_memcpy_gettimeofday(memcpy_t fn, size_t len, bool prefault)
 
 	timersub(&tv_end, &tv_start, &tv_diff);
 
-	free(src);
-	free(dst);
+	free_mem(dst, src, len);
 	return (double)((double)len / timeval2double(&tv_diff));
 }
 
@@ -194,6 +263,18 @@ int bench_mem_memcpy(int argc, const char **argv,
 		return 1;
 	}
 
+	if (map_file) {
+		if (!strcmp(map_target, "dst") || !strcmp(map_target, "both"))
+			map_dst = true;
+		if (!strcmp(map_target, "src") || !strcmp(map_target, "both"))
+			map_src = true;
+		if (!map_dst && !map_src) {
+			fprintf(stderr, "Invalid map target:%s\n", map_target);
+			return 1;
+		}
+		map_offset = (off_t)strtoull(map_offset_str, NULL, 0);
+	}
+
 	/* same to without specifying either of prefault and no-prefault */
 	if (only_prefault && no_prefault)
 		only_prefault = no_prefault = false;
@@ -212,8 +293,14 @@ int bench_mem_memcpy(int argc, const char **argv,
 		return 1;
 	}
 
-	if (bench_format == BENCH_FORMAT_DEFAULT)
-		printf("# Copying %s Bytes ...\n\n", length_str);
+	if (bench_format == BENCH_FORMAT_DEFAULT) {
+		printf("# Copying %s Bytes ...\n", length_str);
+		if (map_file)
+			printf("# (%s mapped from %s at %s%s)\n", map_target,
+			       map_file, map_offset_str,
+			       map_sync ? ", O_SYNC" : "");
+		printf("\n");
+	}
 
 	if (!only_prefault && !no_prefault) {
 		/* show both of results */
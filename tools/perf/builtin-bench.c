@@ -13,6 +13,7 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  ipc   ... round trips over rpmsg and local IPC
  *
  */
 
@@ -58,6 +59,22 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite ipc_suites[] = {
+	{ "rpmsg",
+	  "Round trips to an echo service over an rpmsg-char device",
+	  bench_ipc_rpmsg },
+	{ "unix",
+	  "Round trips to an echo thread over AF_UNIX sockets",
+	  bench_ipc_unix },
+	{ "pipe",
+	  "Round trips to an echo thread over pipe()",
+	  bench_ipc_pipe },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +88,9 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "ipc",
+	  "round trips over rpmsg and local IPC",
+	  ipc_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },
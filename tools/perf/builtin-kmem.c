@@ -27,6 +27,7 @@ static int			alloc_lines = -1;
 static int			caller_lines = -1;
 
 static bool			raw_ip;
+static bool			stall_flag;
 
 static char			default_sort_order[] = "frag,hit,bytes";
 
@@ -54,6 +55,58 @@ static struct rb_root root_caller_sorted;
 static unsigned long total_requested, total_allocated;
 static unsigned long nr_allocs, nr_cross_allocs;
 
+/*
+ * --stall: time spent by tasks in the slow paths of the allocators,
+ * between the begin and end tracepoints of each kind of stall.
+ */
+enum stall_type {
+	STALL_SLOWPATH,
+	STALL_COMPACT,
+	STALL_RECLAIM,
+	STALL_SLAB,
+	STALL_MAX,
+};
+
+static const char * const stall_names[STALL_MAX] = {
+	[STALL_SLOWPATH]	= "slowpath",
+	[STALL_COMPACT]		= "compact",
+	[STALL_RECLAIM]		= "reclaim",
+	[STALL_SLAB]		= "slab",
+};
+
+#define NSEC_PER_USEC		1000ULL
+#define NSEC_PER_MSEC		1000000ULL
+
+/* log2 buckets of microseconds, the last one catches everything above */
+#define STALL_HIST_BUCKETS	24
+
+struct stall_stat {
+	u64	call_site;
+	int	type;
+	u64	nr;
+	u64	total;
+	u64	max;
+	u64	hist[STALL_HIST_BUCKETS];
+
+	struct rb_node node;
+};
+
+/* stalls a task is in, nested ones are charged to the outer call site */
+struct task_stall {
+	pid_t	tid;
+	u64	start[STALL_MAX];
+	u64	call_site[STALL_MAX];
+
+	struct rb_node node;
+};
+
+static struct rb_root root_stall_stat;
+static struct rb_root root_stall_sorted;
+static struct rb_root root_task_stall;
+
+static u64 total_stall_time;
+static unsigned long nr_stalls;
+
 #define PATH_SYS_NODE	"/sys/devices/system/node"
 
 static void init_cpunode_map(void)
@@ -275,8 +328,167 @@ static void process_free_event(void *data,
 	s_alloc->alloc_cpu = -1;
 }
 
+static struct task_stall *findnew_task_stall(pid_t tid)
+{
+	struct rb_node **node = &root_task_stall.rb_node;
+	struct rb_node *parent = NULL;
+	struct task_stall *task;
+
+	while (*node) {
+		parent = *node;
+		task = rb_entry(*node, struct task_stall, node);
+
+		if (tid > task->tid)
+			node = &(*node)->rb_right;
+		else if (tid < task->tid)
+			node = &(*node)->rb_left;
+		else
+			return task;
+	}
+
+	task = zalloc(sizeof(*task));
+	if (!task)
+		die("zalloc");
+	task->tid = tid;
+
+	rb_link_node(&task->node, parent, node);
+	rb_insert_color(&task->node, &root_task_stall);
+
+	return task;
+}
+
+static int stall_bucket(u64 delta)
+{
+	u64 usecs = delta / NSEC_PER_USEC;
+	int bucket = 0;
+
+	while (usecs && bucket < STALL_HIST_BUCKETS - 1) {
+		usecs >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void insert_stall_stat(u64 call_site, int type, u64 delta)
+{
+	struct rb_node **node = &root_stall_stat.rb_node;
+	struct rb_node *parent = NULL;
+	struct stall_stat *data = NULL;
+
+	while (*node) {
+		parent = *node;
+		data = rb_entry(*node, struct stall_stat, node);
+
+		if (call_site > data->call_site)
+			node = &(*node)->rb_right;
+		else if (call_site < data->call_site)
+			node = &(*node)->rb_left;
+		else if (type > data->type)
+			node = &(*node)->rb_right;
+		else if (type < data->type)
+			node = &(*node)->rb_left;
+		else
+			break;
+	}
+
+	if (!data || data->call_site != call_site || data->type != type) {
+		data = zalloc(sizeof(*data));
+		if (!data)
+			die("zalloc");
+		data->call_site = call_site;
+		data->type = type;
+
+		rb_link_node(&data->node, parent, node);
+		rb_insert_color(&data->node, &root_stall_stat);
+	}
+
+	data->nr++;
+	data->total += delta;
+	if (delta > data->max)
+		data->max = delta;
+	data->hist[stall_bucket(delta)]++;
+
+	nr_stalls++;
+	total_stall_time += delta;
+}
+
+static void stall_begin(struct task_stall *task, int type, u64 call_site,
+			u64 timestamp)
+{
+	/* charge nested stalls to the allocation that caused them */
+	switch (type) {
+	case STALL_SLOWPATH:
+		if (task->start[STALL_SLAB])
+			call_site = task->call_site[STALL_SLAB];
+		break;
+	case STALL_COMPACT:
+	case STALL_RECLAIM:
+		call_site = task->start[STALL_SLOWPATH] ?
+			    task->call_site[STALL_SLOWPATH] : 0;
+		break;
+	default:
+		break;
+	}
+
+	task->start[type] = timestamp;
+	task->call_site[type] = call_site;
+}
+
+static void stall_end(struct task_stall *task, int type, u64 timestamp)
+{
+	/* the begin event was before the recording started */
+	if (!task->start[type] || timestamp < task->start[type])
+		return;
+
+	insert_stall_stat(task->call_site[type], type,
+			  timestamp - task->start[type]);
+	task->start[type] = 0;
+}
+
+static const struct {
+	const char	*name;
+	int		type;
+	bool		begin;
+} stall_events[] = {
+	{ "mm_page_alloc_slowpath_begin",	STALL_SLOWPATH,	true  },
+	{ "mm_page_alloc_slowpath_end",		STALL_SLOWPATH,	false },
+	{ "mm_compaction_direct_begin",		STALL_COMPACT,	true  },
+	{ "mm_compaction_direct_end",		STALL_COMPACT,	false },
+	{ "mm_vmscan_direct_reclaim_begin",	STALL_RECLAIM,	true  },
+	{ "mm_vmscan_direct_reclaim_end",	STALL_RECLAIM,	false },
+	{ "kmem_cache_grow_begin",		STALL_SLAB,	true  },
+	{ "kmem_cache_grow_end",		STALL_SLAB,	false },
+};
+
+static bool process_stall_event(struct event *event, void *data,
+				pid_t tid, u64 timestamp)
+{
+	struct task_stall *task;
+	u64 call_site = 0;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(stall_events); i++) {
+		if (!strcmp(event->name, stall_events[i].name))
+			break;
+	}
+	if (i == ARRAY_SIZE(stall_events))
+		return false;
+
+	task = findnew_task_stall(tid);
+	if (stall_events[i].begin) {
+		if (stall_events[i].type == STALL_SLOWPATH ||
+		    stall_events[i].type == STALL_SLAB)
+			call_site = raw_field_value(event, "call_site", data);
+		stall_begin(task, stall_events[i].type, call_site, timestamp);
+	} else
+		stall_end(task, stall_events[i].type, timestamp);
+
+	return true;
+}
+
 static void process_raw_event(union perf_event *raw_event __used, void *data,
-			      int cpu, u64 timestamp, struct thread *thread)
+			      int cpu, u64 timestamp, struct thread *thread,
+			      pid_t tid)
 {
 	struct event *event;
 	int type;
@@ -284,6 +496,9 @@ static void process_raw_event(union perf_event *raw_event __used, void *data,
 	type = trace_parse_common_type(data);
 	event = trace_find_event(type);
 
+	if (stall_flag && process_stall_event(event, data, tid, timestamp))
+		return;
+
 	if (!strcmp(event->name, "kmalloc") ||
 	    !strcmp(event->name, "kmem_cache_alloc")) {
 		process_alloc_event(data, event, cpu, timestamp, thread, 0);
@@ -319,7 +534,7 @@ static int process_sample_event(union perf_event *event,
 	dump_printf(" ... thread: %s:%d\n", thread->comm, thread->pid);
 
 	process_raw_event(event, sample->raw_data, sample->cpu,
-			  sample->time, thread);
+			  sample->time, thread, sample->tid);
 
 	return 0;
 }
@@ -408,13 +623,109 @@ static void print_summary(void)
 	printf("Cross CPU allocations: %lu/%lu\n", nr_cross_allocs, nr_allocs);
 }
 
+static void print_stall_hist(struct stall_stat *data)
+{
+	int first, last, i;
+	u64 max = 0;
+
+	for (first = 0; first < STALL_HIST_BUCKETS; first++) {
+		if (data->hist[first])
+			break;
+	}
+	for (last = STALL_HIST_BUCKETS - 1; last > first; last--) {
+		if (data->hist[last])
+			break;
+	}
+	for (i = first; i <= last; i++) {
+		if (data->hist[i] > max)
+			max = data->hist[i];
+	}
+
+	for (i = first; i <= last; i++) {
+		char bar[41];
+		int len = max ? data->hist[i] * 40 / max : 0;
+
+		memset(bar, '*', len);
+		bar[len] = '\0';
+
+		if (i == STALL_HIST_BUCKETS - 1)
+			printf("   %8llu ->          us : %8llu |%-40s|\n",
+			       1ULL << (i - 1),
+			       (unsigned long long)data->hist[i], bar);
+		else
+			printf("   %8llu -> %-8llu us : %8llu |%-40s|\n",
+			       i ? 1ULL << (i - 1) : 0ULL, 1ULL << i,
+			       (unsigned long long)data->hist[i], bar);
+	}
+}
+
+static void print_stall_result(struct perf_session *session)
+{
+	struct rb_node *next;
+	struct machine *machine;
+	int n_lines = caller_lines;
+
+	printf("\n%.102s\n", graph_dotted_line);
+	printf(" %-34s | Stall    | Count    | Total(ms)  | Avg(us)    | Max(us)\n",
+	       "Callsite");
+	printf("%.102s\n", graph_dotted_line);
+
+	machine = perf_session__find_host_machine(session);
+	if (!machine) {
+		pr_err("print_stall_result: couldn't find kernel information\n");
+		return;
+	}
+
+	next = rb_first(&root_stall_sorted);
+	while (next && n_lines--) {
+		struct stall_stat *data = rb_entry(next, struct stall_stat,
+						   node);
+		struct symbol *sym = NULL;
+		struct map *map;
+		char buf[BUFSIZ];
+		u64 addr = data->call_site;
+
+		if (!raw_ip && addr)
+			sym = machine__find_kernel_function(machine, addr, &map, NULL);
+
+		if (sym != NULL)
+			snprintf(buf, sizeof(buf), "%s+%" PRIx64 "", sym->name,
+				 addr - map->unmap_ip(map, sym->start));
+		else if (addr)
+			snprintf(buf, sizeof(buf), "%#" PRIx64 "", addr);
+		else
+			snprintf(buf, sizeof(buf), "[unknown]");
+		printf(" %-34s |", buf);
+
+		printf(" %-8s | %8llu | %10.3f | %10.3f | %10.3f\n",
+		       stall_names[data->type],
+		       (unsigned long long)data->nr,
+		       (double)data->total / NSEC_PER_MSEC,
+		       (double)data->total / data->nr / NSEC_PER_USEC,
+		       (double)data->max / NSEC_PER_USEC);
+		print_stall_hist(data);
+
+		next = rb_next(next);
+	}
+
+	if (n_lines == -1)
+		printf(" ...                                | ...      | ...      | ...        | ...        | ...\n");
+
+	printf("%.102s\n", graph_dotted_line);
+}
+
 static void print_result(struct perf_session *session)
 {
 	if (caller_flag)
 		__print_result(&root_caller_sorted, session, caller_lines, 1);
 	if (alloc_flag)
 		__print_result(&root_alloc_sorted, session, alloc_lines, 0);
+	if (stall_flag)
+		print_stall_result(session);
 	print_summary();
+	if (stall_flag)
+		printf("Allocation stalls: %lu, %.3f ms\n", nr_stalls,
+		       (double)total_stall_time / NSEC_PER_MSEC);
 }
 
 struct sort_dimension {
@@ -473,10 +784,41 @@ static void __sort_result(struct rb_root *root, struct rb_root *root_sorted,
 	}
 }
 
+/* longest total stall first */
+static void sort_stall_result(void)
+{
+	struct rb_node *node;
+
+	while ((node = rb_first(&root_stall_stat))) {
+		struct rb_node **new = &root_stall_sorted.rb_node;
+		struct rb_node *parent = NULL;
+		struct stall_stat *data;
+
+		rb_erase(node, &root_stall_stat);
+		data = rb_entry(node, struct stall_stat, node);
+
+		while (*new) {
+			struct stall_stat *this;
+
+			this = rb_entry(*new, struct stall_stat, node);
+			parent = *new;
+
+			if (data->total > this->total)
+				new = &((*new)->rb_left);
+			else
+				new = &((*new)->rb_right);
+		}
+
+		rb_link_node(&data->node, parent, new);
+		rb_insert_color(&data->node, &root_stall_sorted);
+	}
+}
+
 static void sort_result(void)
 {
 	__sort_result(&root_alloc_stat, &root_alloc_sorted, &alloc_sort);
 	__sort_result(&root_caller_stat, &root_caller_sorted, &caller_sort);
+	sort_stall_result();
 }
 
 static int __cmd_kmem(void)
@@ -713,6 +1055,8 @@ static const struct option kmem_options[] = {
 		     "show n lines",
 		     parse_line_opt),
 	OPT_BOOLEAN(0, "raw-ip", &raw_ip, "show raw ip instead of symbol"),
+	OPT_BOOLEAN(0, "stall", &stall_flag,
+		    "record/show allocation slow path latencies per callsite"),
 	OPT_END()
 };
 
@@ -730,12 +1074,25 @@ static const char *record_args[] = {
 	"-e", "kmem:kmem_cache_free",
 };
 
+static const char *stall_record_args[] = {
+	"-e", "kmem:mm_page_alloc_slowpath_begin",
+	"-e", "kmem:mm_page_alloc_slowpath_end",
+	"-e", "kmem:kmem_cache_grow_begin",
+	"-e", "kmem:kmem_cache_grow_end",
+	"-e", "compaction:mm_compaction_direct_begin",
+	"-e", "compaction:mm_compaction_direct_end",
+	"-e", "vmscan:mm_vmscan_direct_reclaim_begin",
+	"-e", "vmscan:mm_vmscan_direct_reclaim_end",
+};
+
 static int __cmd_record(int argc, const char **argv)
 {
 	unsigned int rec_argc, i, j;
 	const char **rec_argv;
 
 	rec_argc = ARRAY_SIZE(record_args) + argc - 1;
+	if (stall_flag)
+		rec_argc += ARRAY_SIZE(stall_record_args);
 	rec_argv = calloc(rec_argc + 1, sizeof(char *));
 
 	if (rec_argv == NULL)
@@ -744,6 +1101,11 @@ static int __cmd_record(int argc, const char **argv)
 	for (i = 0; i < ARRAY_SIZE(record_args); i++)
 		rec_argv[i] = strdup(record_args[i]);
 
+	if (stall_flag) {
+		for (j = 0; j < ARRAY_SIZE(stall_record_args); j++, i++)
+			rec_argv[i] = strdup(stall_record_args[j]);
+	}
+
 	for (j = 1; j < (unsigned int)argc; j++, i++)
 		rec_argv[i] = argv[j];
 
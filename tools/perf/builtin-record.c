@@ -65,6 +65,7 @@ static bool			sample_address			=  false;
 static bool			sample_time			=  false;
 static bool			no_buildid			=  false;
 static bool			no_buildid_cache		=  false;
+static u64			branch_stack			=      0;
 static struct perf_evlist	*evsel_list;
 
 static long			samples				=      0;
@@ -215,6 +216,12 @@ static void config_attr(struct perf_evsel *evsel, struct perf_evlist *evlist)
 		attr->sample_type	|= PERF_SAMPLE_CPU;
 	}
 
+	if (branch_stack) {
+		attr->sample_type	|= PERF_SAMPLE_BRANCH_STACK;
+		attr->branch_sample_type = branch_stack;
+		attr->size = sizeof(*attr);
+	}
+
 	if (nodelay) {
 		attr->watermark = 0;
 		attr->wakeup_events = 1;
@@ -301,7 +308,8 @@ try_again:
 			 * is always available even if no PMU support:
 			 */
 			if (attr->type == PERF_TYPE_HARDWARE
-					&& attr->config == PERF_COUNT_HW_CPU_CYCLES) {
+					&& attr->config == PERF_COUNT_HW_CPU_CYCLES
+					&& !branch_stack) {
 
 				if (verbose)
 					ui__warning("The cycles event is not supported, "
@@ -321,6 +329,11 @@ try_again:
 			error("sys_perf_event_open() syscall returned with %d (%s).  /bin/dmesg may provide additional information.\n",
 			      err, strerror(err));
 
+			if (branch_stack && err == EOPNOTSUPP)
+				die("The %s event can not sample taken branches"
+				    " with the requested filter on this CPU.\n",
+				    event_name(pos));
+
 #if defined(__i386__) || defined(__x86_64__)
 			if (attr->type == PERF_TYPE_HARDWARE && err == EOPNOTSUPP)
 				die("No hardware sampling interrupt available."
@@ -729,6 +742,65 @@ out_delete_session:
 	return err;
 }
 
+struct branch_mode {
+	const char *name;
+	u64 mode;
+};
+
+static const struct branch_mode branch_modes[] = {
+	{ "u",		PERF_SAMPLE_BRANCH_USER },
+	{ "k",		PERF_SAMPLE_BRANCH_KERNEL },
+	{ "hv",		PERF_SAMPLE_BRANCH_HV },
+	{ "any",	PERF_SAMPLE_BRANCH_ANY },
+	{ "any_call",	PERF_SAMPLE_BRANCH_ANY_CALL },
+	{ "any_ret",	PERF_SAMPLE_BRANCH_ANY_RETURN },
+	{ "ind_call",	PERF_SAMPLE_BRANCH_IND_CALL },
+	{ NULL,		0 },
+};
+
+static int parse_branch_stack(const struct option *opt,
+			      const char *arg, int unset)
+{
+	u64 *mode = (u64 *)opt->value;
+	const struct branch_mode *br;
+	char *str, *s, *tok;
+
+	if (unset)
+		return 0;
+
+	/* -b takes no argument and means any branch */
+	if (!arg) {
+		*mode = PERF_SAMPLE_BRANCH_ANY;
+		return 0;
+	}
+
+	str = strdup(arg);
+	if (!str)
+		return -1;
+
+	*mode = 0;
+	for (s = str; (tok = strsep(&s, ",")) != NULL; ) {
+		for (br = branch_modes; br->name; br++)
+			if (!strcasecmp(tok, br->name))
+				break;
+
+		if (!br->name) {
+			ui__warning("unknown branch filter %s,"
+				    " check man page\n", tok);
+			free(str);
+			return -1;
+		}
+		*mode |= br->mode;
+	}
+	free(str);
+
+	/* only privilege levels given: sample any branch type at them */
+	if (!(*mode & ~PERF_SAMPLE_BRANCH_PLM_ALL))
+		*mode |= PERF_SAMPLE_BRANCH_ANY;
+
+	return 0;
+}
+
 static const char * const record_usage[] = {
 	"perf record [<options>] [<command>]",
 	"perf record [<options>] -- <command> [<options>]",
@@ -787,6 +859,12 @@ const struct option record_options[] = {
 	OPT_CALLBACK('G', "cgroup", &evsel_list, "name",
 		     "monitor event in cgroup name only",
 		     parse_cgroups),
+	OPT_CALLBACK_NOOPT('b', "branch-any", &branch_stack,
+		     "branch any", "sample any taken branches",
+		     parse_branch_stack),
+	OPT_CALLBACK('j', "branch-filter", &branch_stack,
+		     "branch filter mask", "branch stack filter modes",
+		     parse_branch_stack),
 	OPT_END()
 };
 
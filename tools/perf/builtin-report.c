@@ -38,6 +38,7 @@ static char		const *input_name = "perf.data";
 static bool		force, use_tui, use_stdio;
 static bool		hide_unresolved;
 static bool		dont_use_callchains;
+static bool		branch_mode;
 
 static bool		show_threads;
 static struct perf_read_values	show_threads_values;
@@ -46,6 +47,7 @@ static const char	default_pretty_printing_style[] = "normal";
 static const char	*pretty_printing_style = default_pretty_printing_style;
 
 static char		callchain_default_opt[] = "fractal,0.5";
+static const char	default_branch_sort_order[] = "comm,dso,symbol,target";
 static symbol_filter_t	annotate_init;
 
 static int perf_session__add_hist_entry(struct perf_session *session,
@@ -98,6 +100,86 @@ out:
 	return err;
 }
 
+/*
+ * Branch records carry no cpumode, look the address up in the task's
+ * maps first and in the kernel's if that fails.
+ */
+static void perf_session__resolve_branch_addr(struct perf_session *session,
+					      struct thread *thread, u64 addr,
+					      struct addr_location *al)
+{
+	thread__find_addr_location(thread, session, PERF_RECORD_MISC_USER,
+				   MAP__FUNCTION, thread->pid, addr, al,
+				   annotate_init);
+	if (al->map == NULL)
+		thread__find_addr_location(thread, session,
+					   PERF_RECORD_MISC_KERNEL,
+					   MAP__FUNCTION, thread->pid, addr, al,
+					   annotate_init);
+}
+
+/*
+ * In branch mode every taken branch of the sample's branch stack is an
+ * entry of its own, keyed on where it came from and where it went,
+ * each counting as one.
+ */
+static int perf_session__add_branch_entries(struct perf_session *session,
+					    struct addr_location *sample_al,
+					    struct perf_sample *sample,
+					    struct perf_evsel *evsel)
+{
+	struct branch_stack *bs = sample->branch_stack;
+	struct hist_entry *he;
+	u64 i;
+	int err;
+
+	if (bs == NULL)
+		return 0;
+
+	for (i = 0; i < bs->nr; i++) {
+		struct addr_location al = *sample_al, to_al = *sample_al;
+		struct branch_info to;
+
+		perf_session__resolve_branch_addr(session, sample_al->thread,
+						  bs->entries[i].from, &al);
+		perf_session__resolve_branch_addr(session, sample_al->thread,
+						  bs->entries[i].to, &to_al);
+
+		if (hide_unresolved && al.sym == NULL)
+			continue;
+
+		if (al.map != NULL)
+			al.map->dso->hit = 1;
+
+		to.ms.map = to_al.map;
+		to.ms.sym = to_al.sym;
+		to.addr	  = to_al.addr;
+		to.level  = to_al.level;
+
+		he = __hists__add_branch_entry(&evsel->hists, &al, NULL, &to, 1);
+		if (he == NULL)
+			return -ENOMEM;
+
+		if (al.sym != NULL && use_browser > 0) {
+			struct annotation *notes = symbol__annotation(he->ms.sym);
+
+			if (notes->src == NULL &&
+			    symbol__alloc_hist(he->ms.sym,
+					       session->evlist->nr_entries) < 0)
+				return -ENOMEM;
+
+			err = hist_entry__inc_addr_samples(he, evsel->idx,
+							   al.addr);
+			if (err)
+				return err;
+		}
+
+		evsel->hists.stats.total_period += 1;
+	}
+	hists__inc_nr_events(&evsel->hists, PERF_RECORD_SAMPLE);
+
+	return 0;
+}
 
 static int process_sample_event(union perf_event *event,
 				struct perf_sample *sample,
@@ -116,6 +198,15 @@ static int process_sample_event(union perf_event *event,
 	if (al.filtered || (hide_unresolved && al.sym == NULL))
 		return 0;
 
+	if (branch_mode) {
+		if (perf_session__add_branch_entries(session, &al, sample,
+						     evsel)) {
+			pr_debug("problem adding branch entries, skipping event\n");
+			return -1;
+		}
+		return 0;
+	}
+
 	if (al.map != NULL)
 		al.map->dso->hit = 1;
 
@@ -151,6 +242,12 @@ static int process_read_event(union perf_event *event,
 
 static int perf_session__setup_sample_type(struct perf_session *self)
 {
+	if (branch_mode && !(self->sample_type & PERF_SAMPLE_BRANCH_STACK)) {
+		fprintf(stderr, "selected -b but no branch stack data."
+				" Did you call perf record without -b?\n");
+		return -EINVAL;
+	}
+
 	if (!(self->sample_type & PERF_SAMPLE_CALLCHAIN)) {
 		if (sort__has_parent) {
 			fprintf(stderr, "selected --sort parent, but no"
@@ -455,6 +552,8 @@ static const struct option options[] = {
 		    "Only display entries resolved to a symbol"),
 	OPT_STRING(0, "symfs", &symbol_conf.symfs, "directory",
 		    "Look for files with symbols relative to this directory"),
+	OPT_BOOLEAN('b', "branch-stack", &branch_mode,
+		    "use branch records for histogram filling"),
 	OPT_END()
 };
 
@@ -499,6 +598,9 @@ int cmd_report(int argc, const char **argv, const char *prefix __used)
 	if (symbol__init() < 0)
 		return -1;
 
+	if (branch_mode && sort_order == default_sort_order)
+		sort_order = default_branch_sort_order;
+
 	setup_sorting(report_usage, options);
 
 	if (parent_pattern != default_parent_pattern) {
@@ -170,6 +170,17 @@ struct ip_callchain {
 	u64 ips[0];
 };
 
+struct branch_entry {
+	u64 from;
+	u64 to;
+	u64 flags;
+};
+
+struct branch_stack {
+	u64 nr;
+	struct branch_entry entries[0];
+};
+
 extern bool perf_host, perf_guest;
 
 #endif
@@ -434,6 +434,26 @@ int perf_event__parse_sample(const union perf_event *event, u64 type,
 			return -EFAULT;
 
 		data->raw_data = p;
+		array = (void *)array + ALIGN(sizeof(u32) + data->raw_size,
+					      sizeof(u64));
+	}
+
+	if (type & PERF_SAMPLE_BRANCH_STACK) {
+		u64 sz;
+
+		if (sample_overlap(event, array, sizeof(u64)))
+			return -EFAULT;
+
+		data->branch_stack = (struct branch_stack *)array;
+		if (data->branch_stack->nr > event->header.size)
+			return -EFAULT;
+
+		sz = data->branch_stack->nr * sizeof(struct branch_entry);
+
+		if (sample_overlap(event, array, sizeof(u64) + sz))
+			return -EFAULT;
+
+		array = (void *)array + sizeof(u64) + sz;
 	}
 
 	return 0;
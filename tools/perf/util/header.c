@@ -595,6 +595,18 @@ out_free:
 	return err;
 }
 
+/*
+ * Files written before perf_event_attr grew carry shorter attrs,
+ * anything from the first published attr on is understood.
+ */
+static bool perf_file_attr__size_ok(u64 attr_size)
+{
+	return attr_size >= PERF_ATTR_SIZE_VER0 +
+			    sizeof(struct perf_file_section) &&
+	       attr_size <= sizeof(struct perf_file_attr) &&
+	       !(attr_size & (sizeof(u64) - 1));
+}
+
 int perf_file_header__read(struct perf_file_header *header,
 			   struct perf_header *ph, int fd)
 {
@@ -604,10 +616,10 @@ int perf_file_header__read(struct perf_file_header *header,
 	    memcmp(&header->magic, __perf_magic, sizeof(header->magic)))
 		return -1;
 
-	if (header->attr_size != sizeof(struct perf_file_attr)) {
+	if (!perf_file_attr__size_ok(header->attr_size)) {
 		u64 attr_size = bswap_64(header->attr_size);
 
-		if (attr_size != sizeof(struct perf_file_attr))
+		if (!perf_file_attr__size_ok(attr_size))
 			return -1;
 
 		mem_bswap_64(header, offsetof(struct perf_file_header,
@@ -870,14 +882,18 @@ int perf_session__read_header(struct perf_session *session, int fd)
 		return -EINVAL;
 	}
 
-	nr_attrs = f_header.attrs.size / sizeof(f_attr);
+	nr_attrs = f_header.attrs.size / f_header.attr_size;
 	lseek(fd, f_header.attrs.offset, SEEK_SET);
 
 	for (i = 0; i < nr_attrs; i++) {
+		size_t attr_size = f_header.attr_size - sizeof(f_attr.ids);
 		struct perf_evsel *evsel;
 		off_t tmp;
 
-		if (perf_header__getbuffer64(header, fd, &f_attr, sizeof(f_attr)))
+		memset(&f_attr, 0, sizeof(f_attr));
+		if (perf_header__getbuffer64(header, fd, &f_attr.attr, attr_size) ||
+		    perf_header__getbuffer64(header, fd, &f_attr.ids,
+					     sizeof(f_attr.ids)))
 			goto out_errno;
 
 		tmp = lseek(fd, 0, SEEK_CUR);
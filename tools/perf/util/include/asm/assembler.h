@@ -0,0 +1,33 @@
+
+#ifndef PERF_ASM_ASSEMBLER_H
+#define PERF_ASM_ASSEMBLER_H
+
+/*
+ * assembler.h ... the subset of arch/arm/include/asm/assembler.h
+ * needed for including arch/arm/lib/memcpy.S
+ */
+
+#ifndef __ARMEB__
+#define pull		lsr
+#define push		lsl
+#else
+#define pull		lsl
+#define push		lsr
+#endif
+
+#if defined(__ARM_ARCH_5TE__) || defined(__ARM_ARCH_6__) || \
+	defined(__ARM_ARCH_6J__) || defined(__ARM_ARCH_6K__) || \
+	defined(__ARM_ARCH_6Z__) || defined(__ARM_ARCH_6ZK__) || \
+	defined(__ARM_ARCH_7A__)
+#define PLD(code...)	code
+#else
+#define PLD(code...)
+#endif
+
+/* cache line alignment of the destination is only worth it on Feroceon */
+#define CALGN(code...)
+
+/* the routines are always built as ARM code */
+#define W(instr)	instr
+
+#endif	/* PERF_ASM_ASSEMBLER_H */
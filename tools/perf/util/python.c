@@ -839,6 +839,7 @@ static struct {
 	{ "SAMPLE_PERIOD",    PERF_SAMPLE_PERIOD },
 	{ "SAMPLE_STREAM_ID", PERF_SAMPLE_STREAM_ID },
 	{ "SAMPLE_RAW",	      PERF_SAMPLE_RAW },
+	{ "SAMPLE_BRANCH_STACK", PERF_SAMPLE_BRANCH_STACK },
 
 	{ "FORMAT_TOTAL_TIME_ENABLED", PERF_FORMAT_TOTAL_TIME_ENABLED },
 	{ "FORMAT_TOTAL_TIME_RUNNING", PERF_FORMAT_TOTAL_TIME_RUNNING },
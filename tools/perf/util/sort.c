@@ -27,6 +27,8 @@ static int hist_entry__parent_snprintf(struct hist_entry *self, char *bf,
 				       size_t size, unsigned int width);
 static int hist_entry__cpu_snprintf(struct hist_entry *self, char *bf,
 				    size_t size, unsigned int width);
+static int hist_entry__target_snprintf(struct hist_entry *self, char *bf,
+				       size_t size, unsigned int width);
 
 struct sort_entry sort_thread = {
 	.se_header	= "Command:  Pid",
@@ -71,6 +73,13 @@ struct sort_entry sort_cpu = {
 	.se_width_idx	= HISTC_CPU,
 };
 
+struct sort_entry sort_target = {
+	.se_header	= "Branch Target",
+	.se_cmp		= sort__target_cmp,
+	.se_snprintf	= hist_entry__target_snprintf,
+	.se_width_idx	= HISTC_TARGET,
+};
+
 struct sort_dimension {
 	const char		*name;
 	struct sort_entry	*entry;
@@ -84,6 +93,7 @@ static struct sort_dimension sort_dimensions[] = {
 	{ .name = "symbol",	.entry = &sort_sym,	},
 	{ .name = "parent",	.entry = &sort_parent,	},
 	{ .name = "cpu",	.entry = &sort_cpu,	},
+	{ .name = "target",	.entry = &sort_target,	},
 };
 
 int64_t cmp_null(void *l, void *r)
@@ -266,6 +276,42 @@ static int hist_entry__cpu_snprintf(struct hist_entry *self, char *bf,
 	return repsep_snprintf(bf, size, "%-*d", width, self->cpu);
 }
 
+/* --sort target */
+
+int64_t
+sort__target_cmp(struct hist_entry *left, struct hist_entry *right)
+{
+	struct branch_info *to_l = &left->branch_to;
+	struct branch_info *to_r = &right->branch_to;
+	u64 ip_l, ip_r;
+
+	ip_l = to_l->ms.sym ? to_l->ms.sym->start : to_l->addr;
+	ip_r = to_r->ms.sym ? to_r->ms.sym->start : to_r->addr;
+
+	return (int64_t)(ip_r - ip_l);
+}
+
+static int hist_entry__target_snprintf(struct hist_entry *self, char *bf,
+				       size_t size, unsigned int width __used)
+{
+	struct branch_info *to = &self->branch_to;
+	size_t ret = 0;
+
+	if (verbose)
+		ret += repsep_snprintf(bf, size, "%-#*llx ",
+				       BITS_PER_LONG / 4, to->addr);
+
+	ret += repsep_snprintf(bf + ret, size - ret, "[%c] ", to->level);
+	if (to->ms.sym)
+		ret += repsep_snprintf(bf + ret, size - ret, "%s",
+				       to->ms.sym->name);
+	else
+		ret += repsep_snprintf(bf + ret, size - ret, "%-#*llx",
+				       BITS_PER_LONG / 4, to->addr);
+
+	return ret;
+}
+
 int sort_dimension__add(const char *tok)
 {
 	unsigned int i;
@@ -307,6 +353,8 @@ int sort_dimension__add(const char *tok)
 				sort__first_dimension = SORT_PARENT;
 			else if (!strcmp(sd->name, "cpu"))
 				sort__first_dimension = SORT_CPU;
+			else if (!strcmp(sd->name, "target"))
+				sort__first_dimension = SORT_TARGET;
 		}
 
 		list_add_tail(&sd->entry->list, &hist_entry__sort_list);
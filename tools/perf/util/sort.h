@@ -36,6 +36,7 @@ extern struct sort_entry sort_comm;
 extern struct sort_entry sort_dso;
 extern struct sort_entry sort_sym;
 extern struct sort_entry sort_parent;
+extern struct sort_entry sort_target;
 extern enum sort_type sort__first_dimension;
 
 /**
@@ -44,6 +45,16 @@ extern enum sort_type sort__first_dimension;
  * @row_offset - offset from the first callchain expanded to appear on screen
  * @nr_rows - rows expanded in callchain, recalculated on folding/unfolding
  */
+/*
+ * Where a sampled branch went, for the branch source hist_entry
+ * 'perf report -b' builds:
+ */
+struct branch_info {
+	struct map_symbol	ms;
+	u64			addr;
+	char			level;
+};
+
 struct hist_entry {
 	struct rb_node		rb_node;
 	u64			period;
@@ -65,6 +76,7 @@ struct hist_entry {
 	char			level;
 	u8			filtered;
 	struct symbol		*parent;
+	struct branch_info	branch_to;
 	union {
 		unsigned long	  position;
 		struct hist_entry *pair;
@@ -80,6 +92,7 @@ enum sort_type {
 	SORT_SYM,
 	SORT_PARENT,
 	SORT_CPU,
+	SORT_TARGET,
 };
 
 /*
@@ -116,6 +129,7 @@ extern int64_t sort__dso_cmp(struct hist_entry *, struct hist_entry *);
 extern int64_t sort__sym_cmp(struct hist_entry *, struct hist_entry *);
 extern int64_t sort__parent_cmp(struct hist_entry *, struct hist_entry *);
 int64_t sort__cpu_cmp(struct hist_entry *left, struct hist_entry *right);
+int64_t sort__target_cmp(struct hist_entry *left, struct hist_entry *right);
 extern size_t sort__parent_print(FILE *, struct hist_entry *, unsigned int);
 extern int sort_dimension__add(const char *);
 void sort_entry__setup_elide(struct sort_entry *self, struct strlist *list,
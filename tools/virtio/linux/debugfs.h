@@ -0,0 +1,57 @@
+#ifndef LINUX_DEBUGFS_H
+#define LINUX_DEBUGFS_H
+/* There's no debugfs in userspace: empty stubs, enough for virtio_ring.c */
+#include <sys/types.h>
+
+#define __user
+
+struct dentry;
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	void *private_data;
+};
+
+struct file_operations {
+	ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+	int (*open)(struct inode *, struct file *);
+	loff_t (*llseek)(struct file *, loff_t, int);
+};
+
+#define generic_file_llseek NULL
+#define scnprintf snprintf
+
+static inline ssize_t simple_read_from_buffer(void __user *to, size_t count,
+					      loff_t *ppos, const void *from,
+					      size_t available)
+{
+	return 0;
+}
+
+static inline bool debugfs_initialized(void)
+{
+	return false;
+}
+
+static inline struct dentry *debugfs_create_dir(const char *name,
+						struct dentry *parent)
+{
+	return NULL;
+}
+
+static inline struct dentry *debugfs_create_file(const char *name, int mode,
+						 struct dentry *parent,
+						 void *data,
+						 const struct file_operations *fops)
+{
+	return NULL;
+}
+
+static inline void debugfs_remove(struct dentry *dentry)
+{
+}
+
+#endif
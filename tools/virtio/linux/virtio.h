@@ -122,6 +122,7 @@ static inline void kfree(void *p)
 #endif
 #define dev_err(dev, format, ...) fprintf (stderr, format, ## __VA_ARGS__)
 #define dev_warn(dev, format, ...) fprintf (stderr, format, ## __VA_ARGS__)
+#define dev_name(dev) "vdev"
 
 /* TODO: empty stubs for now. Broken but enough for virtio_ring.c */
 #define list_add_tail(a, b) do {} while (0)
@@ -171,6 +172,13 @@ struct virtqueue {
 }
 #define MODULE_LICENSE(__MODULE_LICENSE_value) \
 	const char *__MODULE_LICENSE_name = __MODULE_LICENSE_value
+#define module_init(__module_init_fn) \
+	int (*__module_init_##__module_init_fn)(void) = __module_init_fn
+#define module_exit(__module_exit_fn) \
+	void (*__module_exit_##__module_exit_fn)(void) = __module_exit_fn
+#define __init
+#define __exit
+#define KBUILD_MODNAME "virtio_ring"
 
 #define CONFIG_SMP
 
@@ -202,14 +210,28 @@ static inline int virtqueue_add_buf(struct virtqueue *vq,
 	return virtqueue_add_buf_gfp(vq, sg, out_num, in_num, data, GFP_ATOMIC);
 }
 
+int virtqueue_add_bufs_gfp(struct virtqueue *vq,
+			   struct scatterlist sg[],
+			   unsigned int *num,
+			   unsigned int out_num,
+			   unsigned int in_num,
+			   void *data[],
+			   gfp_t gfp);
+
 void virtqueue_kick(struct virtqueue *vq);
 
+bool virtqueue_kick_prepare(struct virtqueue *vq);
+
+void virtqueue_notify(struct virtqueue *vq);
+
 void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len);
 
 void virtqueue_disable_cb(struct virtqueue *vq);
 
 bool virtqueue_enable_cb(struct virtqueue *vq);
 
+bool virtqueue_enable_cb_delayed(struct virtqueue *vq);
+
 void *virtqueue_detach_unused_buf(struct virtqueue *vq);
 struct virtqueue *vring_new_virtqueue(unsigned int num,
 				      unsigned int vring_align,
@@ -218,6 +240,8 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 				      void (*notify)(struct virtqueue *vq),
 				      void (*callback)(struct virtqueue *vq),
 				      const char *name);
+void vring_reset_virtqueue(struct virtqueue *vq);
 void vring_del_virtqueue(struct virtqueue *vq);
+irqreturn_t vring_interrupt(int irq, void *_vq);
 
 #endif
@@ -0,0 +1,644 @@
+/*
+ * Microbenchmark of drivers/virtio/virtio_ring.c: a driver thread runs the
+ * actual ring code, against a minimal device thread which consumes its
+ * buffers, each on a CPU of its own. Reports the throughput, the number of
+ * notifications each way, and the cache misses of both threads.
+ *
+ * With --poll, neither side ever sleeps, so it needs a CPU for each.
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <linux/virtio.h>
+#include <linux/virtio_ring.h>
+
+#define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define cpu_relax() asm volatile("rep; nop" ::: "memory")
+
+#define RING_ALIGN 4096
+#define BUF_SIZE 64
+
+struct bench_cfg {
+	unsigned int ring_size;
+	unsigned int batch;
+	unsigned int sgs;
+	long ops;
+	int driver_cpu;
+	int device_cpu;
+	bool poll;
+	unsigned long long features;
+};
+
+struct bench_stats {
+	long long cache_misses;
+	long notifies;
+};
+
+struct bench {
+	struct bench_cfg cfg;
+	struct virtio_device vdev;
+	struct virtqueue *vq;
+	void *ring;
+	char buf[BUF_SIZE];
+	/* kick: driver -> device, call: device -> driver */
+	int kick;
+	int call;
+	pthread_barrier_t start;
+	struct bench_stats driver;
+	struct bench_stats device;
+};
+
+static bool has_feature(struct bench *b, int feature)
+{
+	return b->cfg.features & (1ULL << feature);
+}
+
+static void pin_to_cpu(int cpu)
+{
+	cpu_set_t set;
+	int r;
+
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	r = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+	assert(!r);
+}
+
+/* Count the cache misses of the calling thread, or return -1 if the
+ * counter isn't available (e.g. no PMU access in a VM or a container). */
+static int cache_miss_counter(void)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_HARDWARE,
+		.size = sizeof(attr),
+		.config = PERF_COUNT_HW_CACHE_MISSES,
+		.disabled = 1,
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+	};
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void counter_start(int fd)
+{
+	if (fd >= 0)
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static long long counter_stop(int fd)
+{
+	long long count;
+
+	if (fd < 0)
+		return -1;
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, &count, sizeof count) != sizeof count)
+		count = -1;
+	close(fd);
+	return count;
+}
+
+static void signal_fd(int fd)
+{
+	unsigned long long v = 1;
+	int r;
+
+	r = write(fd, &v, sizeof v);
+	assert(r == sizeof v);
+}
+
+static void wait_fd(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	unsigned long long v;
+
+	poll(&pfd, 1, -1);
+	read(fd, &v, sizeof v);
+}
+
+static void vq_notify(struct virtqueue *vq)
+{
+	struct bench *b = vq->priv;
+
+	b->driver.notifies++;
+	if (!b->cfg.poll)
+		signal_fd(b->kick);
+}
+
+static void vq_callback(struct virtqueue *vq)
+{
+}
+
+/* Walk the descriptors of a buffer, as a device would to get at the data. */
+static unsigned int read_indirect(struct vring_desc *desc)
+{
+	struct vring_desc *table = phys_to_virt(desc->addr);
+	unsigned int i, len = 0;
+
+	for (i = 0; i < desc->len / sizeof(*table); i++)
+		len += ACCESS_ONCE(table[i].len);
+	return len;
+}
+
+/* The device side of the split layout. */
+static void device_split(struct bench *b)
+{
+	struct vring vr;
+	u16 last_avail = 0, used_idx = 0, old, avail_idx;
+	u16 *avail_event;
+	bool event = has_feature(b, VIRTIO_RING_F_EVENT_IDX);
+	long done = 0;
+
+	vring_init(&vr, b->cfg.ring_size, b->ring, RING_ALIGN);
+	avail_event = &vring_avail_event(&vr);
+	/* Notifications are enabled only when we run out of buffers. */
+	if (!event)
+		vr.used->flags = VRING_USED_F_NO_NOTIFY;
+
+	while (done < b->cfg.ops) {
+		avail_idx = ACCESS_ONCE(vr.avail->idx);
+		if (avail_idx == last_avail) {
+			if (b->cfg.poll) {
+				cpu_relax();
+				continue;
+			}
+			if (event)
+				ACCESS_ONCE(*avail_event) = last_avail;
+			else
+				vr.used->flags = 0;
+			smp_mb();
+			if (ACCESS_ONCE(vr.avail->idx) == last_avail)
+				wait_fd(b->kick);
+			if (!event)
+				vr.used->flags = VRING_USED_F_NO_NOTIFY;
+			continue;
+		}
+		/* Read the ring entries after the index. */
+		smp_rmb();
+
+		old = used_idx;
+		while (last_avail != avail_idx) {
+			u16 head = vr.avail->ring[last_avail % vr.num];
+			u16 i = head;
+			unsigned int len = 0;
+
+			for (;;) {
+				struct vring_desc *desc = &vr.desc[i];
+
+				if (desc->flags & VRING_DESC_F_INDIRECT)
+					len += read_indirect(desc);
+				else
+					len += desc->len;
+				if (!(desc->flags & VRING_DESC_F_NEXT))
+					break;
+				i = desc->next;
+			}
+			vr.used->ring[used_idx % vr.num].id = head;
+			vr.used->ring[used_idx % vr.num].len = len;
+			last_avail++;
+			used_idx++;
+			done++;
+		}
+		/* Expose the used entries before the index. */
+		smp_wmb();
+		ACCESS_ONCE(vr.used->idx) = used_idx;
+
+		if (b->cfg.poll)
+			continue;
+		/* Check whether the driver wants an interrupt after the
+		 * index is visible, so we don't miss a request for one. */
+		smp_mb();
+		if (event ? vring_need_event(ACCESS_ONCE(vring_used_event(&vr)),
+					     used_idx, old) :
+			    !(ACCESS_ONCE(vr.avail->flags) &
+			      VRING_AVAIL_F_NO_INTERRUPT)) {
+			b->device.notifies++;
+			signal_fd(b->call);
+		}
+	}
+}
+
+#define PACKED_AVAIL (1 << VRING_PACKED_DESC_F_AVAIL)
+#define PACKED_USED (1 << VRING_PACKED_DESC_F_USED)
+
+static bool packed_avail(struct vring_packed *vr, u16 idx, bool wrap)
+{
+	u16 flags = ACCESS_ONCE(vr->desc[idx].flags);
+
+	return !!(flags & PACKED_AVAIL) == wrap &&
+	       !!(flags & PACKED_USED) != wrap;
+}
+
+/* The device side of the packed layout. */
+static void device_packed(struct bench *b)
+{
+	struct vring_packed vr;
+	struct vring_packed_event ev;
+	bool event = has_feature(b, VIRTIO_RING_F_EVENT_IDX);
+	bool wrap = true;
+	u16 idx = 0, slots, event_idx;
+	long done = 0;
+
+	vring_packed_init(&vr, b->cfg.ring_size, b->ring);
+	vr.device->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+
+	while (done < b->cfg.ops) {
+		if (!packed_avail(&vr, idx, wrap)) {
+			if (b->cfg.poll) {
+				cpu_relax();
+				continue;
+			}
+			if (event) {
+				vr.device->off_wrap = idx |
+					(wrap << VRING_PACKED_EVENT_F_WRAP_CTR);
+				smp_wmb();
+				vr.device->flags = VRING_PACKED_EVENT_FLAG_DESC;
+			} else
+				vr.device->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+			smp_mb();
+			if (!packed_avail(&vr, idx, wrap))
+				wait_fd(b->kick);
+			vr.device->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+			continue;
+		}
+
+		slots = 0;
+		while (packed_avail(&vr, idx, wrap)) {
+			struct vring_packed_desc *head = &vr.desc[idx];
+			unsigned int len = 0, n = 0;
+			u16 flags;
+
+			/* Read the descriptors after their flags. */
+			smp_rmb();
+			do {
+				struct vring_packed_desc *desc;
+
+				desc = &vr.desc[(idx + n) % vr.num];
+				flags = desc->flags;
+				if (flags & VRING_DESC_F_INDIRECT) {
+					struct vring_desc d = {
+						.addr = desc->addr,
+						.len = desc->len,
+					};
+					len += read_indirect(&d);
+				} else
+					len += desc->len;
+				n++;
+			} while (flags & VRING_DESC_F_NEXT);
+
+			head->len = len;
+			/* The id of the chain is in its last descriptor. */
+			head->id = vr.desc[(idx + n - 1) % vr.num].id;
+			smp_wmb();
+			head->flags = wrap ? PACKED_AVAIL | PACKED_USED : 0;
+
+			idx += n;
+			if (idx >= vr.num) {
+				idx -= vr.num;
+				wrap = !wrap;
+			}
+			slots += n;
+			done++;
+		}
+
+		if (b->cfg.poll)
+			continue;
+		smp_mb();
+		ev = *vr.driver;
+		if (ev.flags == VRING_PACKED_EVENT_FLAG_DESC) {
+			/* An event of the previous wrap is a ring size
+			 * behind. */
+			event_idx = ev.off_wrap &
+				~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+			if ((ev.off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+									wrap)
+				event_idx -= vr.num;
+			if (!vring_need_event(event_idx, idx, idx - slots))
+				continue;
+		} else if (ev.flags != VRING_PACKED_EVENT_FLAG_ENABLE)
+			continue;
+		b->device.notifies++;
+		signal_fd(b->call);
+	}
+}
+
+static void *device_thread(void *arg)
+{
+	struct bench *b = arg;
+	int counter;
+
+	pin_to_cpu(b->cfg.device_cpu);
+	counter = cache_miss_counter();
+	pthread_barrier_wait(&b->start);
+	counter_start(counter);
+
+	if (has_feature(b, VIRTIO_RING_F_PACKED))
+		device_packed(b);
+	else
+		device_split(b);
+
+	b->device.cache_misses = counter_stop(counter);
+	return NULL;
+}
+
+static void run_driver(struct bench *b)
+{
+	struct scatterlist sg[b->cfg.sgs];
+	long started = 0, completed = 0;
+	unsigned int i, added, len;
+	int r;
+
+	sg_init_table(sg, b->cfg.sgs);
+	for (i = 0; i < b->cfg.sgs; i++)
+		sg_set_buf(&sg[i], b->buf, sizeof b->buf);
+
+	virtqueue_disable_cb(b->vq);
+	while (completed < b->cfg.ops) {
+		bool progress = false;
+
+		for (added = 0; added < b->cfg.batch &&
+					started < b->cfg.ops; added++) {
+			r = virtqueue_add_buf(b->vq, sg, b->cfg.sgs, 0,
+					      b->buf + started % BUF_SIZE);
+			if (r < 0)
+				break;
+			started++;
+		}
+		if (added) {
+			virtqueue_kick(b->vq);
+			progress = true;
+		}
+
+		while (virtqueue_get_buf(b->vq, &len)) {
+			completed++;
+			progress = true;
+		}
+
+		if (progress)
+			continue;
+		if (b->cfg.poll) {
+			cpu_relax();
+			continue;
+		}
+		/* Nothing to do: sleep until the device used some. */
+		if (virtqueue_enable_cb(b->vq)) {
+			wait_fd(b->call);
+			vring_interrupt(0, b->vq);
+		}
+		virtqueue_disable_cb(b->vq);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_misses(const char *who, long long misses, long ops)
+{
+	if (misses < 0)
+		fprintf(stderr, "%s cache misses: n/a\n", who);
+	else
+		fprintf(stderr, "%s cache misses: %lld (%.2f/op)\n", who,
+			misses, (double)misses / ops);
+}
+
+static void run_bench(struct bench *b)
+{
+	pthread_t device;
+	double start, time;
+	int counter, r;
+
+	r = posix_memalign(&b->ring, RING_ALIGN,
+			   vring_size(b->cfg.ring_size, RING_ALIGN));
+	assert(!r);
+	memset(b->ring, 0, vring_size(b->cfg.ring_size, RING_ALIGN));
+	b->vdev.features[0] = b->cfg.features;
+	b->vq = vring_new_virtqueue(b->cfg.ring_size, RING_ALIGN, &b->vdev,
+				    b->ring, vq_notify, vq_callback, "bench");
+	assert(b->vq);
+	b->vq->priv = b;
+	b->kick = eventfd(0, 0);
+	b->call = eventfd(0, 0);
+	assert(b->kick >= 0 && b->call >= 0);
+	pthread_barrier_init(&b->start, NULL, 2);
+
+	r = pthread_create(&device, NULL, device_thread, b);
+	assert(!r);
+
+	pin_to_cpu(b->cfg.driver_cpu);
+	counter = cache_miss_counter();
+	pthread_barrier_wait(&b->start);
+	counter_start(counter);
+	start = now();
+
+	run_driver(b);
+
+	time = now() - start;
+	b->driver.cache_misses = counter_stop(counter);
+	pthread_join(device, NULL);
+
+	fprintf(stderr, "layout: %s%s%s%s\n",
+		has_feature(b, VIRTIO_RING_F_PACKED) ? "packed" : "split",
+		has_feature(b, VIRTIO_RING_F_EVENT_IDX) ? ", event idx" : "",
+		has_feature(b, VIRTIO_RING_F_INDIRECT_DESC) &&
+			b->cfg.sgs > 1 ? ", indirect" : "",
+		has_feature(b, VIRTIO_RING_F_IN_ORDER) &&
+			!has_feature(b, VIRTIO_RING_F_PACKED) ?
+							", in order" : "");
+	fprintf(stderr, "ring size: %u, batch: %u, sgs: %u, %s\n",
+		b->cfg.ring_size, b->cfg.batch, b->cfg.sgs,
+		b->cfg.poll ? "polling" : "notifications");
+	fprintf(stderr, "ops: %ld in %.3fs: %.0f ops/sec\n",
+		b->cfg.ops, time, b->cfg.ops / time);
+	fprintf(stderr, "kicks: %ld, interrupts: %ld\n",
+		b->driver.notifies, b->device.notifies);
+	print_misses("driver", b->driver.cache_misses, b->cfg.ops);
+	print_misses("device", b->device.cache_misses, b->cfg.ops);
+
+	vring_del_virtqueue(b->vq);
+	free(b->ring);
+}
+
+const char optstring[] = "h";
+const struct option longopts[] = {
+	{
+		.name = "help",
+		.val = 'h',
+	},
+	{
+		.name = "packed",
+		.val = 'P',
+	},
+	{
+		.name = "event-idx",
+		.val = 'E',
+	},
+	{
+		.name = "no-event-idx",
+		.val = 'e',
+	},
+	{
+		.name = "indirect",
+		.val = 'I',
+	},
+	{
+		.name = "no-indirect",
+		.val = 'i',
+	},
+	{
+		.name = "in-order",
+		.val = 'O',
+	},
+	{
+		.name = "poll",
+		.val = 'p',
+	},
+	{
+		.name = "ring-size",
+		.has_arg = required_argument,
+		.val = 'r',
+	},
+	{
+		.name = "batch",
+		.has_arg = required_argument,
+		.val = 'b',
+	},
+	{
+		.name = "sgs",
+		.has_arg = required_argument,
+		.val = 's',
+	},
+	{
+		.name = "ops",
+		.has_arg = required_argument,
+		.val = 'n',
+	},
+	{
+		.name = "driver-cpu",
+		.has_arg = required_argument,
+		.val = 'g',
+	},
+	{
+		.name = "device-cpu",
+		.has_arg = required_argument,
+		.val = 'd',
+	},
+	{
+	}
+};
+
+static void help()
+{
+	fprintf(stderr, "Usage: ring_bench [--help]"
+		" [--packed]"
+		" [--no-event-idx]"
+		" [--no-indirect]"
+		" [--in-order]"
+		" [--poll]"
+		"\n\t[--ring-size N]"
+		" [--batch N]"
+		" [--sgs N]"
+		" [--ops N]"
+		" [--driver-cpu CPU]"
+		" [--device-cpu CPU]"
+		"\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct bench b;
+	struct bench_cfg *cfg = &b.cfg;
+	int o;
+
+	cfg->ring_size = 256;
+	cfg->batch = 1;
+	cfg->sgs = 1;
+	cfg->ops = 10000000;
+	cfg->driver_cpu = -1;
+	cfg->device_cpu = -1;
+	cfg->features = (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
+		(1ULL << VIRTIO_RING_F_EVENT_IDX);
+
+	for (;;) {
+		o = getopt_long(argc, argv, optstring, longopts, NULL);
+		switch (o) {
+		case -1:
+			goto done;
+		case '?':
+			help();
+			exit(2);
+		case 'P':
+			cfg->features |= 1ULL << VIRTIO_RING_F_PACKED;
+			break;
+		case 'E':
+			cfg->features |= 1ULL << VIRTIO_RING_F_EVENT_IDX;
+			break;
+		case 'e':
+			cfg->features &= ~(1ULL << VIRTIO_RING_F_EVENT_IDX);
+			break;
+		case 'I':
+			cfg->features |= 1ULL << VIRTIO_RING_F_INDIRECT_DESC;
+			break;
+		case 'i':
+			cfg->features &= ~(1ULL << VIRTIO_RING_F_INDIRECT_DESC);
+			break;
+		case 'O':
+			cfg->features |= 1ULL << VIRTIO_RING_F_IN_ORDER;
+			break;
+		case 'p':
+			cfg->poll = true;
+			break;
+		case 'r':
+			cfg->ring_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg->batch = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			cfg->sgs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			cfg->ops = strtol(optarg, NULL, 0);
+			break;
+		case 'g':
+			cfg->driver_cpu = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg->device_cpu = strtol(optarg, NULL, 0);
+			break;
+		case 'h':
+			help();
+			exit(0);
+		default:
+			assert(0);
+			break;
+		}
+	}
+
+done:
+	if (!cfg->ring_size || (cfg->ring_size & (cfg->ring_size - 1)) ||
+	    !cfg->batch || !cfg->sgs || cfg->ops <= 0) {
+		help();
+		exit(2);
+	}
+	run_bench(&b);
+	return 0;
+}